@@ -197,6 +197,13 @@ extern int flock _PARAMS ((int, int));
 extern int futimesat _PARAMS ((int, const char *, const struct timeval *));
 #endif
 
+/* Pipe to pipe transfers: splice() moves the data, tee() copies it */
+#define	SPLICE_F_MOVE		0x01
+#define	SPLICE_F_NONBLOCK	0x02
+#define	SPLICE_F_MORE		0x04
+extern int splice _PARAMS ((int, int, size_t, unsigned int));
+extern int tee _PARAMS ((int, int, size_t, unsigned int));
+
 /* Provide _<systemcall> prototypes for functions provided by some versions
    of newlib.  */
 #ifdef _COMPILING_NEWLIB
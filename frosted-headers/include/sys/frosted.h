@@ -102,4 +102,13 @@
 #define SYS_DLCLOSE 			(98)
 #define SYS_SENDMSG 			(99)
 #define SYS_RECVMSG 			(100)
-#define _SYSCALLS_NR (101) /* We have 101 syscalls! */
+#define SYS_EPOLL_CREATE 			(101)
+#define SYS_EPOLL_CTL 			(102)
+#define SYS_EPOLL_WAIT 			(103)
+#define SYS_SPLICE 			(104)
+#define SYS_TEE 			(105)
+#define SYS_FSYNC 			(106)
+#define SYS_GETRUSAGE 			(107)
+#define SYS_FUTEX_WAIT 			(108)
+#define SYS_FUTEX_WAKE 			(109)
+#define _SYSCALLS_NR (110) /* We have 110 syscalls! */
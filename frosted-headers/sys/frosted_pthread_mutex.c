@@ -0,0 +1,150 @@
+/*
+ * pthread mutexes locked in userspace.
+ *
+ * pthread_mutex_t is a word in the caller's memory (PTHREAD_MUTEX_INITIALIZER
+ * is 0). Once used, it holds its own address with the state in the two low
+ * bits: 0 unlocked, 1 locked, 2 locked and possibly contended. The C
+ * library passes the address of the word to init, lock and trylock but its
+ * value to unlock and destroy: the address bits let those find the word.
+ * Taking a free mutex and releasing one nobody waits for is a single
+ * LDREX/STREX sequence. The kernel is only entered to sleep on the word
+ * (futex_wait) or to wake a sleeper (futex_wake).
+ *
+ * Included at the end of frosted_syscalls.c: the C library keeps calling
+ * sys_pthread_mutex_*() as before.
+ */
+#include <errno.h>
+
+#define MUTEX_UNLOCKED  0
+#define MUTEX_LOCKED    1
+#define MUTEX_CONTENDED 2
+#define MUTEX_STATE     3
+
+/* Returns the previous value; stores 'new' only if it was 'old' */
+static inline uint32_t mutex_cmpxchg(volatile uint32_t *w, uint32_t old, uint32_t new)
+{
+#if defined(__arm__)
+    uint32_t cur, fail;
+
+    do {
+        __asm__ volatile ("ldrex %0, [%1]" : "=&r" (cur) : "r" (w) : "memory");
+        if (cur != old) {
+            __asm__ volatile ("clrex" ::: "memory");
+            return cur;
+        }
+        __asm__ volatile ("strex %0, %2, [%1]" : "=&r" (fail) : "r" (w), "r" (new) : "memory");
+    } while (fail);
+    __asm__ volatile ("dmb" ::: "memory");
+    return cur;
+#else
+    __atomic_compare_exchange_n(w, &old, new, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    return old;
+#endif
+}
+
+static inline uint32_t mutex_xchg(volatile uint32_t *w, uint32_t val)
+{
+#if defined(__arm__)
+    uint32_t cur, fail;
+
+    __asm__ volatile ("dmb" ::: "memory");
+    do {
+        __asm__ volatile ("ldrex %0, [%1]" : "=&r" (cur) : "r" (w) : "memory");
+        __asm__ volatile ("strex %0, %2, [%1]" : "=&r" (fail) : "r" (w), "r" (val) : "memory");
+    } while (fail);
+    __asm__ volatile ("dmb" ::: "memory");
+    return cur;
+#else
+    return __atomic_exchange_n(w, val, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/* From the value passed to unlock/destroy: NULL if the mutex was never used */
+static inline volatile uint32_t *mutex_of_value(uint32_t val)
+{
+    return (volatile uint32_t *)(uintptr_t)(val & ~MUTEX_STATE);
+}
+
+/* Lock, trylock: give a statically initialized word its address */
+static inline uint32_t mutex_self(volatile uint32_t *w)
+{
+    uint32_t self = (uint32_t)(uintptr_t)w;
+
+    if (*w == 0)
+        mutex_cmpxchg(w, 0, self);
+    return self;
+}
+
+int sys_pthread_mutex_init(uint32_t arg1, uint32_t arg2)
+{
+    volatile uint32_t *w = (volatile uint32_t *)(uintptr_t)arg1;
+
+    (void)arg2;
+    if (!w)
+        return -EINVAL;
+    *w = (uint32_t)(uintptr_t)w | MUTEX_UNLOCKED;
+    return 0;
+}
+
+int sys_pthread_mutex_destroy(uint32_t arg1)
+{
+    volatile uint32_t *w = mutex_of_value(arg1);
+
+    if (!w)
+        return 0;
+    if ((*w & MUTEX_STATE) != MUTEX_UNLOCKED)
+        return -EBUSY;
+    return 0;
+}
+
+int sys_pthread_mutex_trylock(uint32_t arg1)
+{
+    volatile uint32_t *w = (volatile uint32_t *)(uintptr_t)arg1;
+    uint32_t self;
+
+    if (!w)
+        return -EINVAL;
+    self = mutex_self(w);
+    if (mutex_cmpxchg(w, self | MUTEX_UNLOCKED, self | MUTEX_LOCKED) != (self | MUTEX_UNLOCKED))
+        return -EAGAIN;
+    return 0;
+}
+
+int sys_pthread_mutex_lock(uint32_t arg1)
+{
+    volatile uint32_t *w = (volatile uint32_t *)(uintptr_t)arg1;
+    uint32_t self, c;
+
+    if (!w)
+        return -EINVAL;
+    self = mutex_self(w);
+    c = mutex_cmpxchg(w, self | MUTEX_UNLOCKED, self | MUTEX_LOCKED);
+    if (c == (self | MUTEX_UNLOCKED))
+        return 0;
+    /* Mark it contended, so that the holder wakes someone on unlock. A
+     * task taking it this way keeps the mark: other waiters may remain. */
+    if ((c & MUTEX_STATE) != MUTEX_CONTENDED)
+        c = mutex_xchg(w, self | MUTEX_CONTENDED);
+    while ((c & MUTEX_STATE) != MUTEX_UNLOCKED) {
+        /* Returns at once if the word changed since it was read */
+        sys_futex_wait(self, self | MUTEX_CONTENDED, (uint32_t)-1);
+        c = mutex_xchg(w, self | MUTEX_CONTENDED);
+    }
+    return 0;
+}
+
+int sys_pthread_mutex_unlock(uint32_t arg1)
+{
+    volatile uint32_t *w = mutex_of_value(arg1);
+    uint32_t self = arg1 & ~MUTEX_STATE;
+    uint32_t c;
+
+    if (!w)
+        return -EPERM;
+    c = mutex_xchg(w, self | MUTEX_UNLOCKED);
+    if ((c & MUTEX_STATE) == MUTEX_UNLOCKED)
+        return -EPERM;
+    if ((c & MUTEX_STATE) == MUTEX_CONTENDED)
+        sys_futex_wake(self, 1);
+    return 0;
+}
@@ -420,31 +420,6 @@ int sys_sched_yield(void){
     return syscall(SYS_SCHED_YIELD, 0, 0, 0, 0, 0); 
 }
 
-/* Syscall: pthread_mutex_init(2 arguments) */
-int sys_pthread_mutex_init(uint32_t arg1, uint32_t arg2){
-    return syscall(SYS_PTHREAD_MUTEX_INIT, arg1, arg2, 0, 0, 0); 
-}
-
-/* Syscall: pthread_mutex_destroy(1 arguments) */
-int sys_pthread_mutex_destroy(uint32_t arg1){
-    return syscall(SYS_PTHREAD_MUTEX_DESTROY, arg1, 0, 0, 0, 0); 
-}
-
-/* Syscall: pthread_mutex_lock(1 arguments) */
-int sys_pthread_mutex_lock(uint32_t arg1){
-    return syscall(SYS_PTHREAD_MUTEX_LOCK, arg1, 0, 0, 0, 0); 
-}
-
-/* Syscall: pthread_mutex_trylock(1 arguments) */
-int sys_pthread_mutex_trylock(uint32_t arg1){
-    return syscall(SYS_PTHREAD_MUTEX_TRYLOCK, arg1, 0, 0, 0, 0); 
-}
-
-/* Syscall: pthread_mutex_unlock(1 arguments) */
-int sys_pthread_mutex_unlock(uint32_t arg1){
-    return syscall(SYS_PTHREAD_MUTEX_UNLOCK, arg1, 0, 0, 0, 0); 
-}
-
 /* Syscall: pthread_kill(2 arguments) */
 int sys_pthread_kill(uint32_t arg1, uint32_t arg2){
     return syscall(SYS_PTHREAD_KILL, arg1, arg2, 0, 0, 0); 
@@ -510,3 +485,50 @@ int sys_recvmsg(uint32_t arg1, uint32_t arg2, uint32_t arg3){
     return syscall(SYS_RECVMSG, arg1, arg2, arg3, 0,  0); 
 }
 
+/* Syscall: epoll_create(1 arguments) */
+int sys_epoll_create(uint32_t arg1){
+    return syscall(SYS_EPOLL_CREATE, arg1, 0, 0, 0, 0); 
+}
+
+/* Syscall: epoll_ctl(4 arguments) */
+int sys_epoll_ctl(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4){
+    return syscall(SYS_EPOLL_CTL, arg1, arg2, arg3, arg4, 0); 
+}
+
+/* Syscall: epoll_wait(4 arguments) */
+int sys_epoll_wait(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4){
+    return syscall(SYS_EPOLL_WAIT, arg1, arg2, arg3, arg4, 0); 
+}
+
+/* Syscall: splice(4 arguments) */
+int sys_splice(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4){
+    return syscall(SYS_SPLICE, arg1, arg2, arg3, arg4, 0); 
+}
+
+/* Syscall: tee(4 arguments) */
+int sys_tee(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4){
+    return syscall(SYS_TEE, arg1, arg2, arg3, arg4, 0); 
+}
+
+/* Syscall: fsync(1 arguments) */
+int sys_fsync(uint32_t arg1){
+    return syscall(SYS_FSYNC, arg1, 0, 0, 0, 0); 
+}
+
+/* Syscall: getrusage(2 arguments) */
+int sys_getrusage(uint32_t arg1, uint32_t arg2){
+    return syscall(SYS_GETRUSAGE, arg1, arg2, 0, 0, 0); 
+}
+
+/* Syscall: futex_wait(3 arguments) */
+int sys_futex_wait(uint32_t arg1, uint32_t arg2, uint32_t arg3){
+    return syscall(SYS_FUTEX_WAIT, arg1, arg2, arg3, 0,  0); 
+}
+
+/* Syscall: futex_wake(2 arguments) */
+int sys_futex_wake(uint32_t arg1, uint32_t arg2){
+    return syscall(SYS_FUTEX_WAKE, arg1, arg2, 0, 0, 0); 
+}
+
+/* Userspace fast paths */
+#include "frosted_pthread_mutex.c"
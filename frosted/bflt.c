@@ -574,7 +574,7 @@ int shlib_resolve_got(uint32_t *got_start, uint32_t got_words,
 
         /* Patch app's GOT entry: point to trampoline with Thumb bit */
         got_start[idx] = (uint32_t)tramp | 1;
-        kprintf("bFLT: shlib: GOT[%lu] lib%d:ord%lu → tramp=0x%08lx func=0x%08lx\r\n",
+        klog(KLOG_DEBUG, "bFLT: shlib: GOT[%lu] lib%d:ord%lu → tramp=0x%08lx func=0x%08lx\r\n",
                 (unsigned long)idx, lib_id, (unsigned long)ordinal,
                 (unsigned long)((uint32_t)tramp | 1),
                 (unsigned long)(func_addr | 1));
@@ -616,6 +616,7 @@ int shlib_runtime_load(const struct loaded_shlib *sl, uint16_t owner_pid,
         kprintf("bFLT: shlib alloc failed (%lu bytes)\r\n", (unsigned long)total);
         return -ENOMEM;
     }
+    task_mpu_invalidate(owner_pid);
 
     runtime->alloc_base = mem;
     runtime->trampoline_base = mem;
@@ -853,13 +854,13 @@ int bflt_load(uint8_t* from, void **reloc_text, void **reloc_data, void **reloc_
     if (flags & FLAT_FLAG_GOTPIC) {
         unsigned long got_words = (long_be(hdr.data_end) - long_be(hdr.data_start))
                                   / sizeof(unsigned long);
-        kprintf("bFLT: shlib_resolve_got: data_dest=0x%p got_words=%lu text_src=0x%p\r\n",
+        klog(KLOG_DEBUG, "bFLT: shlib_resolve_got: data_dest=0x%p got_words=%lu text_src=0x%p\r\n",
                 data_dest, got_words, text_src);
         if (shlib_resolve_got((uint32_t *)data_dest, got_words,
                               text_src, data_dest,
                               extra_mmap, extra_mmap_count) != 0)
             goto error;
-        kprintf("bFLT: shlib_resolve_got: done\r\n");
+        klog(KLOG_DEBUG, "bFLT: shlib_resolve_got: done\r\n");
     }
 #endif
 
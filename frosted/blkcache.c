@@ -0,0 +1,544 @@
+/*
+ *      This file is part of frosted.
+ *
+ *      frosted is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License version 2, as
+ *      published by the Free Software Foundation.
+ *
+ *
+ *      frosted is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with frosted.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Block cache for SPI flash.
+ *
+ * CONFIG_BLKCACHE_PAGES flash pages shared by every cached device: the
+ * raw /dev/spiflash0 node (which classic flashfs volumes go through too)
+ * and the logical pages of log-structured volumes.
+ *
+ * Reads are served from RAM. A miss on the block right after the previous
+ * miss doubles a read-ahead window, so sequential readers (scripts being
+ * run, audio being played) fetch up to BLKCACHE_RA_MAX blocks per flash
+ * command; any other miss closes it again.
+ *
+ * Writes only dirty the cached block. Dirty blocks go back to the device
+ * one erase group per call, so that several pages of a NOR sector cost a
+ * single erase: on fsync() and close(), when the LRU needs their slot,
+ * and CONFIG_BLKCACHE_FLUSH_MS after the first write, from a kernel
+ * thread woken by a timer.
+ *
+ * One mutex covers the cache and every call into a device, so a device is
+ * never driven from two places at once. The flush thread only try-locks it,
+ * but then sleeps through the transfers with it held: a syscall finding it
+ * taken gets SYS_CALL_AGAIN back, before anything changed, and restarts
+ * once it is released. Callers that make several cache calls in one
+ * syscall take it first with blkcache_lock().
+ */
+
+#include "frosted.h"
+#include "blkcache.h"
+#include <string.h>
+
+#ifndef CONFIG_BLKCACHE_PAGES
+#define CONFIG_BLKCACHE_PAGES 16
+#endif
+#ifndef CONFIG_BLKCACHE_FLUSH_MS
+#define CONFIG_BLKCACHE_FLUSH_MS 1000
+#endif
+
+#define BC_VALID 0x01
+#define BC_DIRTY 0x02
+#define BC_AHEAD 0x04       /* read ahead and not used yet */
+#define BC_BUSY  0x08       /* slot taken by a fill in progress */
+
+/* Leave half of the cache to blocks that were actually asked for */
+#define BC_RA_MAX (BLKCACHE_RA_MAX < CONFIG_BLKCACHE_PAGES / 2 ? \
+        BLKCACHE_RA_MAX : CONFIG_BLKCACHE_PAGES / 2)
+
+struct blkcache_entry {
+    struct blkcache_dev *dev;
+    uint32_t blk;
+    uint32_t used;          /* LRU clock at the last access */
+    uint8_t flags;
+};
+
+static struct blkcache_entry bc_entry[CONFIG_BLKCACHE_PAGES];
+static uint8_t bc_data[CONFIG_BLKCACHE_PAGES][BLKCACHE_BLOCK_SIZE];
+static uint32_t bc_clock;
+static uint16_t bc_dirty;
+static uint8_t bc_timer_pending;
+static volatile uint8_t bc_flush_wake;
+static struct task *bc_flush_task;
+static struct blkcache_stats bc_stats;
+static mutex_t *bc_lock;
+
+/* Returns 0 with bc_lock taken, 1 if the caller already held it (see
+ * blkcache_lock()), or the mutex_lock() error. */
+static int bc_enter(void)
+{
+    if (mutex_owned(bc_lock))
+        return 1;
+    return mutex_lock(bc_lock);
+}
+
+static void bc_leave(int held)
+{
+    if (!held)
+        mutex_unlock(bc_lock);
+}
+
+static int bc_find(const struct blkcache_dev *dev, uint32_t blk)
+{
+    int i;
+
+    for (i = 0; i < CONFIG_BLKCACHE_PAGES; i++) {
+        if ((bc_entry[i].flags & BC_VALID) && bc_entry[i].dev == dev &&
+                bc_entry[i].blk == blk)
+            return i;
+    }
+    return -1;
+}
+
+static inline void bc_touch(int i)
+{
+    bc_entry[i].used = ++bc_clock;
+}
+
+static void bc_drop(int i)
+{
+    if (bc_entry[i].flags & BC_DIRTY)
+        bc_dirty--;
+    bc_entry[i].flags = 0;
+    bc_entry[i].dev = NULL;
+}
+
+/* Write back the dirty blocks of the erase group holding 'blk' */
+static int bc_writeback(struct blkcache_dev *dev, uint32_t blk)
+{
+    const uint8_t *bufs[BLKCACHE_GROUP_MAX];
+    uint32_t first = blk - blk % dev->group;
+    uint32_t count = dev->group;
+    uint32_t n = 0;
+    int i, ret;
+
+    if (count > dev->blocks - first)
+        count = dev->blocks - first;
+    memset(bufs, 0, sizeof(bufs));
+    for (i = 0; i < CONFIG_BLKCACHE_PAGES; i++) {
+        struct blkcache_entry *e = &bc_entry[i];
+        if ((e->flags & BC_DIRTY) && e->dev == dev &&
+                e->blk >= first && e->blk < first + count) {
+            bufs[e->blk - first] = bc_data[i];
+            n++;
+        }
+    }
+    if (n == 0)
+        return 0;
+    ret = dev->ops->write(dev->priv, first, bufs, count);
+    if (ret < 0) {
+        bc_stats.errors++;
+        return ret;
+    }
+    for (i = 0; i < CONFIG_BLKCACHE_PAGES; i++) {
+        struct blkcache_entry *e = &bc_entry[i];
+        if ((e->flags & BC_DIRTY) && e->dev == dev &&
+                e->blk >= first && e->blk < first + count) {
+            e->flags &= ~BC_DIRTY;
+            bc_dirty--;
+        }
+    }
+    bc_stats.flushes++;
+    bc_stats.flushed += n;
+    return 0;
+}
+
+/* Write back every dirty block of 'dev' (NULL: of all devices), in
+ * ascending block order */
+static int bc_flush(struct blkcache_dev *dev)
+{
+    int i, next, ret;
+
+    while (bc_dirty > 0) {
+        next = -1;
+        for (i = 0; i < CONFIG_BLKCACHE_PAGES; i++) {
+            struct blkcache_entry *e = &bc_entry[i];
+            if (!(e->flags & BC_DIRTY) || (dev && e->dev != dev))
+                continue;
+            if (next < 0 || (e->dev == bc_entry[next].dev && e->blk < bc_entry[next].blk))
+                next = i;
+        }
+        if (next < 0)
+            break;
+        ret = bc_writeback(bc_entry[next].dev, bc_entry[next].blk);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+static void bc_schedule(void);
+
+/* The timer only wakes the flush thread */
+static void bc_flush_tick(uint32_t now, void *arg)
+{
+    (void)now;
+    (void)arg;
+    bc_timer_pending = 0;
+    bc_flush_wake = 1;
+    if (bc_flush_task)
+        task_resume(bc_flush_task);
+}
+
+static void bc_flush_work(void)
+{
+    if (mutex_trylock(bc_lock) == 0) {
+        bc_flush(NULL);
+        mutex_unlock(bc_lock);
+    }
+    /* Busy, or the device failed: try again later */
+    bc_schedule();
+}
+
+/* Write-back and erases take milliseconds and wait on the SPI bus: they
+ * run here, where the thread can sleep through them */
+static void bc_flush_thread(void *arg)
+{
+    (void)arg;
+    while (1) {
+        irq_off();
+        while (!bc_flush_wake) {
+            task_suspend();
+            /* The switch happens as soon as interrupts are enabled */
+            irq_on();
+            irq_off();
+        }
+        bc_flush_wake = 0;
+        irq_on();
+        bc_flush_work();
+    }
+}
+
+static void bc_schedule(void)
+{
+    if (bc_timer_pending || bc_dirty == 0)
+        return;
+    if (ktimer_add(CONFIG_BLKCACHE_FLUSH_MS, bc_flush_tick, NULL) >= 0)
+        bc_timer_pending = 1;
+}
+
+/*
+ * Free a slot: an unused one, else the least recently used block. A dirty
+ * victim is written back first, unless 'clean_only' (read-ahead must not
+ * cause writes).
+ */
+static int bc_slot(int clean_only)
+{
+    int i, victim = -1;
+
+    for (i = 0; i < CONFIG_BLKCACHE_PAGES; i++) {
+        struct blkcache_entry *e = &bc_entry[i];
+        if (e->flags & BC_BUSY)
+            continue;
+        if (!(e->flags & BC_VALID))
+            return i;
+        if (clean_only && (e->flags & BC_DIRTY))
+            continue;
+        if (victim < 0 || e->used < bc_entry[victim].used)
+            victim = i;
+    }
+    if (victim < 0)
+        return -ENOMEM;
+    if (bc_entry[victim].flags & BC_DIRTY) {
+        int ret = bc_writeback(bc_entry[victim].dev, bc_entry[victim].blk);
+        if (ret < 0)
+            return ret;
+        bc_stats.evictions++;
+    }
+    bc_drop(victim);
+    return victim;
+}
+
+/* Bring 'blk' in, with read-ahead if it continues the previous miss.
+ * Returns its slot. */
+static int bc_fill(struct blkcache_dev *dev, uint32_t blk, int ahead)
+{
+    uint8_t *bufs[BLKCACHE_RA_MAX];
+    int slot[BLKCACHE_RA_MAX];
+    uint32_t count = 1, k;
+    int ret;
+
+    if (ahead) {
+        if (blk == dev->next_blk) {
+            dev->ra = dev->ra ? dev->ra * 2 : 2;
+            if (dev->ra > BC_RA_MAX)
+                dev->ra = BC_RA_MAX;
+            count = dev->ra;
+        } else {
+            dev->ra = 0;
+        }
+        if (count > dev->blocks - blk)
+            count = dev->blocks - blk;
+    }
+    for (k = 0; k < count; k++) {
+        if (k > 0 && bc_find(dev, blk + k) >= 0)
+            break;
+        slot[k] = bc_slot(k > 0);
+        if (slot[k] < 0)
+            break;
+        bc_entry[slot[k]].flags = BC_BUSY;
+        bufs[k] = bc_data[slot[k]];
+    }
+    if (k == 0)
+        return slot[0];
+    count = k;
+
+    ret = dev->ops->read(dev->priv, blk, bufs, count);
+    for (k = 0; k < count; k++) {
+        struct blkcache_entry *e = &bc_entry[slot[k]];
+        if (ret < 0) {
+            e->flags = 0;
+            continue;
+        }
+        e->dev = dev;
+        e->blk = blk + k;
+        e->flags = BC_VALID | (k > 0 ? BC_AHEAD : 0);
+        e->used = ++bc_clock;
+    }
+    if (ret < 0) {
+        bc_stats.errors++;
+        return ret;
+    }
+    bc_stats.misses++;
+    bc_stats.readahead += count - 1;
+    if (ahead)
+        dev->next_blk = blk + count;
+    return slot[0];
+}
+
+void blkcache_dev_init(struct blkcache_dev *dev, const struct blkcache_ops *ops,
+        void *priv, uint32_t blocks, uint32_t group)
+{
+    if (!bc_lock)
+        bc_lock = mutex_init();
+    if (!bc_flush_task)
+        bc_flush_task = kthread_create(bc_flush_thread, NULL);
+    memset(dev, 0, sizeof(*dev));
+    dev->ops = ops;
+    dev->priv = priv;
+    dev->blocks = blocks;
+    dev->next_blk = 0xFFFFFFFFu;
+    if (group < 1)
+        group = 1;
+    if (group > BLKCACHE_GROUP_MAX)
+        group = BLKCACHE_GROUP_MAX;
+    dev->group = (uint8_t)group;
+}
+
+/* Write back and forget every block of a device, e.g. before something
+ * else writes to it directly */
+int blkcache_invalidate(struct blkcache_dev *dev)
+{
+    int held;
+    int i;
+
+    if (!dev->ops)
+        return 0;
+    held = bc_enter();
+    if (held < 0)
+        return held;
+    bc_flush(dev);
+    for (i = 0; i < CONFIG_BLKCACHE_PAGES; i++) {
+        if (bc_entry[i].dev == dev)
+            bc_drop(i);
+    }
+    dev->ra = 0;
+    dev->next_blk = 0xFFFFFFFFu;
+    bc_leave(held);
+    return 0;
+}
+
+/* Same, for a device going away */
+int blkcache_dev_release(struct blkcache_dev *dev)
+{
+    int ret = blkcache_invalidate(dev);
+
+    if (ret < 0)
+        return ret;
+    dev->ops = NULL;
+    return 0;
+}
+
+int blkcache_read(struct blkcache_dev *dev, uint32_t addr, void *buf, uint32_t len)
+{
+    uint8_t *dst = buf;
+    int ret = 0;
+    int held;
+
+    if (!dev || !dev->ops || (addr + len) < addr ||
+            addr + len > dev->blocks * BLKCACHE_BLOCK_SIZE)
+        return -EINVAL;
+    held = bc_enter();
+    if (held < 0)
+        return held;
+    while (len > 0) {
+        uint32_t blk = addr / BLKCACHE_BLOCK_SIZE;
+        uint32_t off = addr % BLKCACHE_BLOCK_SIZE;
+        uint32_t chunk = BLKCACHE_BLOCK_SIZE - off;
+        int i;
+
+        if (chunk > len)
+            chunk = len;
+        i = bc_find(dev, blk);
+        if (i >= 0) {
+            bc_stats.hits++;
+            if (bc_entry[i].flags & BC_AHEAD) {
+                bc_entry[i].flags &= ~BC_AHEAD;
+                bc_stats.ra_hits++;
+            }
+        } else {
+            i = bc_fill(dev, blk, 1);
+            if (i < 0) {
+                ret = i;
+                break;
+            }
+        }
+        bc_touch(i);
+        memcpy(dst, bc_data[i] + off, chunk);
+        dst += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+    bc_leave(held);
+    return ret;
+}
+
+int blkcache_write(struct blkcache_dev *dev, uint32_t addr, const void *buf, uint32_t len)
+{
+    const uint8_t *src = buf;
+    int ret = 0;
+    int held;
+
+    if (!dev || !dev->ops || (addr + len) < addr ||
+            addr + len > dev->blocks * BLKCACHE_BLOCK_SIZE)
+        return -EINVAL;
+    held = bc_enter();
+    if (held < 0)
+        return held;
+    while (len > 0) {
+        uint32_t blk = addr / BLKCACHE_BLOCK_SIZE;
+        uint32_t off = addr % BLKCACHE_BLOCK_SIZE;
+        uint32_t chunk = BLKCACHE_BLOCK_SIZE - off;
+        struct blkcache_entry *e;
+        int i;
+
+        if (chunk > len)
+            chunk = len;
+        i = bc_find(dev, blk);
+        if (i < 0 && chunk < BLKCACHE_BLOCK_SIZE) {
+            /* Partial block: the rest comes from the device */
+            i = bc_fill(dev, blk, 0);
+        } else if (i < 0) {
+            i = bc_slot(0);
+            if (i >= 0) {
+                bc_entry[i].dev = dev;
+                bc_entry[i].blk = blk;
+                bc_entry[i].flags = BC_VALID;
+            }
+        }
+        if (i < 0) {
+            ret = i;
+            break;
+        }
+        e = &bc_entry[i];
+        e->flags &= ~BC_AHEAD;
+        bc_touch(i);
+        /* Rewriting what is already there does not need a flush */
+        if ((e->flags & BC_DIRTY) || memcmp(bc_data[i] + off, src, chunk) != 0) {
+            memcpy(bc_data[i] + off, src, chunk);
+            if (!(e->flags & BC_DIRTY)) {
+                e->flags |= BC_DIRTY;
+                bc_dirty++;
+            }
+        }
+        bc_stats.writes++;
+        src += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+    bc_schedule();
+    bc_leave(held);
+    return ret;
+}
+
+int blkcache_flush(struct blkcache_dev *dev)
+{
+    int held;
+    int ret;
+
+    if (!bc_lock)
+        return 0;
+    held = bc_enter();
+    if (held < 0)
+        return held;
+    ret = bc_flush(dev);
+    bc_leave(held);
+    return ret;
+}
+
+/* The block no longer holds data: drop it without writing it back */
+int blkcache_trim(struct blkcache_dev *dev, uint32_t blk)
+{
+    int held;
+    int i;
+
+    if (!dev->ops)
+        return 0;
+    held = bc_enter();
+    if (held < 0)
+        return held;
+    i = bc_find(dev, blk);
+    if (i >= 0)
+        bc_drop(i);
+    if (dev->ops->trim)
+        dev->ops->trim(dev->priv, blk);
+    bc_leave(held);
+    return 0;
+}
+
+/* For syscalls that make several cache calls: take the lock before
+ * changing anything, the calls in between then find it held */
+int blkcache_lock(void)
+{
+    if (!bc_lock)
+        return 0;
+    return mutex_lock(bc_lock);
+}
+
+/* For callers that drive a cached device behind the cache's back (e.g.
+ * log garbage collection) */
+int blkcache_trylock(void)
+{
+    if (!bc_lock)
+        return 0;
+    return mutex_trylock(bc_lock);
+}
+
+void blkcache_unlock(void)
+{
+    if (bc_lock)
+        mutex_unlock(bc_lock);
+}
+
+void blkcache_get_stats(struct blkcache_stats *st)
+{
+    *st = bc_stats;
+    st->pages = CONFIG_BLKCACHE_PAGES;
+    st->dirty = bc_dirty;
+}
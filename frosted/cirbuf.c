@@ -94,64 +94,160 @@ int cirbuf_readbyte(struct cirbuf *cb, uint8_t *byte)
     return 0;
 }
 
+/* Contiguous regions for bulk copies. The readable region starts at
+ * readptr and the writable one at writeptr; either wraps at most once,
+ * so it is described by two segments. Nothing moves until commit.
+ */
+static int cirbuf_segs(struct cirbuf *cb, uint8_t *start, int len, struct cirbuf_seg seg[2])
+{
+    int tail = (int)(cb->buf + cb->bufsize - start);
+
+    seg[0].ptr = start;
+    seg[1].ptr = cb->buf;
+    if (len > tail) {
+        seg[0].len = tail;
+        seg[1].len = len - tail;
+    } else {
+        seg[0].len = len;
+        seg[1].len = 0;
+    }
+    return len;
+}
+
+static uint8_t *cirbuf_advance(struct cirbuf *cb, uint8_t *ptr, int len)
+{
+    ptr += len;
+    if (ptr >= cb->buf + cb->bufsize)
+        ptr -= cb->bufsize;
+    return ptr;
+}
+
+int cirbuf_peek_read(struct cirbuf *cb, struct cirbuf_seg seg[2])
+{
+    if (!cb || !seg || cb->bufsize <= 0)
+        return 0;
+    return cirbuf_segs(cb, cb->readptr, (int)cirbuf_bytesinuse(cb), seg);
+}
+
+int cirbuf_peek_write(struct cirbuf *cb, struct cirbuf_seg seg[2])
+{
+    if (!cb || !seg || cb->bufsize <= 0)
+        return 0;
+    return cirbuf_segs(cb, cb->writeptr, (int)cirbuf_bytesfree(cb), seg);
+}
+
+/* The pointer is published with a single store: a producer in interrupt
+ * context and a consumer in a task can run without extra locking. */
+void cirbuf_commit_read(struct cirbuf *cb, int len)
+{
+    if (!cb || len <= 0)
+        return;
+    if ((size_t)len > cirbuf_bytesinuse(cb))
+        len = (int)cirbuf_bytesinuse(cb);
+    cb->readptr = cirbuf_advance(cb, cb->readptr, len);
+}
+
+void cirbuf_commit_write(struct cirbuf *cb, int len)
+{
+    if (!cb || len <= 0)
+        return;
+    if ((size_t)len > cirbuf_bytesfree(cb))
+        len = (int)cirbuf_bytesfree(cb);
+    cb->writeptr = cirbuf_advance(cb, cb->writeptr, len);
+}
+
+/* len on success, -1 on fail */
 int cirbuf_readbytes(struct cirbuf *cb, void *bytes, int len)
 {
-    size_t buflen;
-    int i;
-    char *dst = bytes;
+    struct cirbuf_seg seg[2];
+    uint8_t *dst = bytes;
+    int avail;
+
     if (!cb || !bytes || cb->bufsize <= 0 || len < 0)
         return -1;
 
-    /* check if there is data */
-    buflen = cirbuf_bytesinuse(cb);
-    if (buflen == 0)
+    avail = cirbuf_peek_read(cb, seg);
+    if (avail == 0)
         return -1;
-    if ((size_t)len > buflen)
-        len = (int)buflen;
-
-    for (i = 0; i < len; i++) {
-        dst[i] = *(cb->readptr++);
-        /* wrap if needed */
-        if (cb->readptr > (cb->buf + cb->bufsize - 1u))
-            cb->readptr = cb->buf;
+    if (len > avail)
+        len = avail;
+
+    if (len <= seg[0].len) {
+        memcpy(dst, seg[0].ptr, len);
+    } else {
+        memcpy(dst, seg[0].ptr, seg[0].len);
+        memcpy(dst + seg[0].len, seg[1].ptr, len - seg[0].len);
     }
+    cirbuf_commit_read(cb, len);
     return len;
 }
 
 /* written len on success, 0 on fail */
 int cirbuf_writebytes(struct cirbuf *cb, const uint8_t * bytes, int len)
 {
-    size_t freesize;
-    int tot_len = len;
-    if (!cb || cb->bufsize <= 0 || len < 0)
+    struct cirbuf_seg seg[2];
+    int avail;
+
+    if (!cb || !bytes || cb->bufsize <= 0 || len < 0)
         return 0;
 
-    /* check if there is space */
-    freesize = cirbuf_bytesfree(cb);
-    if (!freesize)
+    avail = cirbuf_peek_write(cb, seg);
+    if (avail == 0)
         return 0;
-    if (freesize < (size_t)len) {
-        len = (int)freesize;
-        tot_len = (int)freesize;
-    }
+    if (len > avail)
+        len = avail;
 
-    /* Wrap needed ? */
-    if ((cb->writeptr + len) > (cb->buf + cb->bufsize) - 1u)
-    {
-        int len_first_part = cb->buf + cb->bufsize - cb->writeptr; /* end - current position */
-        memcpy(cb->writeptr, bytes, len_first_part);
-        bytes += len_first_part;
-        cb->writeptr = cb->buf; /* set to start of buffer */
-        len -= len_first_part;
-    }
-    /* write remaining part */
-    if (len)
-    {
-        memcpy(cb->writeptr, bytes, len);
-        cb->writeptr += len;
+    if (len <= seg[0].len) {
+        memcpy(seg[0].ptr, bytes, len);
+    } else {
+        memcpy(seg[0].ptr, bytes, seg[0].len);
+        memcpy(seg[1].ptr, bytes + seg[0].len, len - seg[0].len);
     }
+    cirbuf_commit_write(cb, len);
+    return len;
+}
 
-    return tot_len;
+/* Copy up to len bytes from src to dst without a bounce buffer. With
+ * 'consume' the bytes are removed from src, otherwise src is untouched.
+ * Returns the number of bytes copied. */
+int cirbuf_transfer(struct cirbuf *dst, struct cirbuf *src, int len, int consume)
+{
+    struct cirbuf_seg rs[2], ws[2];
+    int ri = 0, wi = 0, roff = 0, woff = 0, done = 0;
+    int avail, room, chunk;
+
+    if (!dst || !src || (dst == src) || len <= 0)
+        return 0;
+    avail = cirbuf_peek_read(src, rs);
+    room = cirbuf_peek_write(dst, ws);
+    if (len > avail)
+        len = avail;
+    if (len > room)
+        len = room;
+
+    while (done < len) {
+        chunk = len - done;
+        if (chunk > rs[ri].len - roff)
+            chunk = rs[ri].len - roff;
+        if (chunk > ws[wi].len - woff)
+            chunk = ws[wi].len - woff;
+        memcpy(ws[wi].ptr + woff, rs[ri].ptr + roff, chunk);
+        done += chunk;
+        roff += chunk;
+        woff += chunk;
+        if (roff == rs[ri].len) {
+            ri++;
+            roff = 0;
+        }
+        if (woff == ws[wi].len) {
+            wi++;
+            woff = 0;
+        }
+    }
+    cirbuf_commit_write(dst, done);
+    if (consume)
+        cirbuf_commit_read(src, done);
+    return done;
 }
 
 size_t cirbuf_bytesfree(struct cirbuf *cb)
@@ -0,0 +1,217 @@
+/*
+ *      This file is part of frosted.
+ *
+ *      frosted is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License version 2, as
+ *      published by the Free Software Foundation.
+ *
+ *
+ *      frosted is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with frosted.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Path lookup cache.
+ *
+ * Resolving a path walks one sibling list per component, comparing names,
+ * and for flashfs and xipfs asks the module to search the medium when the
+ * name is not among the fnodes already in RAM. Each (parent, component)
+ * result is kept here, including "not there": scripts probing for files
+ * that do not exist would otherwise scan the flash every time.
+ *
+ * DCACHE_SETS sets of DCACHE_WAYS entries, indexed by a hash of the parent
+ * pointer and the name. A clock hand per set picks the entry to replace,
+ * skipping the ones used since it last went by.
+ *
+ * The VFS keeps entries valid: creating a name drops (parent, name), an
+ * fnode going away drops every entry that points to it or hangs from it,
+ * and mount/umount drop everything since they change who answers lookups
+ * under the mount point. Like the fnode lists, the table is only touched
+ * from syscalls.
+ */
+
+#include "frosted.h"
+#include "dcache.h"
+#include <string.h>
+
+struct dcache_entry {
+    struct fnode *parent;       /* NULL: free */
+    struct fnode *child;        /* NULL: the name does not exist */
+    uint32_t hash;
+    uint8_t len;
+    uint8_t ref;                /* used since the hand last passed */
+    char name[DCACHE_NAME_MAX];
+};
+
+static struct dcache_entry dcache[DCACHE_SETS][DCACHE_WAYS];
+static uint8_t dcache_hand[DCACHE_SETS];
+static int dcache_on = 1;
+static struct dcache_stats dcache_st;
+
+/* FNV-1a over the name, seeded with the parent */
+static uint32_t dcache_hash(const struct fnode *parent, const char *name, int len)
+{
+    uint32_t h = 2166136261u ^ (uint32_t)((uintptr_t)parent >> 2);
+    int i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Multiplicative: the set comes from the well mixed high bits */
+static unsigned int dcache_set(uint32_t hash)
+{
+    return ((hash * 2654435761u) >> 24) & (DCACHE_SETS - 1);
+}
+
+static struct dcache_entry *dcache_find(struct fnode *parent, const char *name, int len,
+        uint32_t hash)
+{
+    struct dcache_entry *set = dcache[dcache_set(hash)];
+    int i;
+
+    for (i = 0; i < DCACHE_WAYS; i++) {
+        struct dcache_entry *e = &set[i];
+        if (e->parent == parent && e->hash == hash && e->len == len &&
+                memcmp(e->name, name, len) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+static void dcache_drop(struct dcache_entry *e)
+{
+    e->parent = NULL;
+    e->child = NULL;
+    dcache_st.invalidated++;
+}
+
+int dcache_lookup(struct fnode *parent, const char *name, int len, struct fnode **child)
+{
+    struct dcache_entry *e;
+
+    if (!dcache_on || len <= 0 || len >= DCACHE_NAME_MAX)
+        return 0;
+    e = dcache_find(parent, name, len, dcache_hash(parent, name, len));
+    if (!e) {
+        dcache_st.misses++;
+        return 0;
+    }
+    e->ref = 1;
+    if (e->child)
+        dcache_st.hits++;
+    else
+        dcache_st.neg_hits++;
+    *child = e->child;
+    return 1;
+}
+
+void dcache_insert(struct fnode *parent, const char *name, int len, struct fnode *child)
+{
+    uint32_t hash;
+    unsigned int s;
+    struct dcache_entry *set, *e;
+    int i;
+
+    if (!dcache_on || !parent || len <= 0 || len >= DCACHE_NAME_MAX)
+        return;
+    hash = dcache_hash(parent, name, len);
+    e = dcache_find(parent, name, len, hash);
+    if (!e) {
+        s = dcache_set(hash);
+        set = dcache[s];
+        for (i = 0; i < DCACHE_WAYS; i++) {
+            if (!set[i].parent) {
+                e = &set[i];
+                break;
+            }
+        }
+        while (!e) {
+            struct dcache_entry *cand = &set[dcache_hand[s]];
+            dcache_hand[s] = (dcache_hand[s] + 1) % DCACHE_WAYS;
+            if (cand->ref) {
+                cand->ref = 0;
+                continue;
+            }
+            dcache_st.evictions++;
+            e = cand;
+        }
+        e->parent = parent;
+        e->hash = hash;
+        e->len = (uint8_t)len;
+        memcpy(e->name, name, len);
+    }
+    e->child = child;
+    e->ref = 0;
+}
+
+void dcache_forget(struct fnode *parent, const char *name, int len)
+{
+    struct dcache_entry *e;
+
+    if (len <= 0 || len >= DCACHE_NAME_MAX)
+        return;
+    e = dcache_find(parent, name, len, dcache_hash(parent, name, len));
+    if (e)
+        dcache_drop(e);
+}
+
+void dcache_forget_fnode(struct fnode *fno)
+{
+    int s, i;
+
+    if (!fno)
+        return;
+    for (s = 0; s < DCACHE_SETS; s++) {
+        for (i = 0; i < DCACHE_WAYS; i++) {
+            struct dcache_entry *e = &dcache[s][i];
+            if (e->parent && (e->parent == fno || e->child == fno))
+                dcache_drop(e);
+        }
+    }
+}
+
+void dcache_flush(void)
+{
+    memset(dcache, 0, sizeof(dcache));
+    dcache_st.flushes++;
+}
+
+void dcache_enable(int on)
+{
+    dcache_flush();
+    dcache_on = on ? 1 : 0;
+}
+
+void dcache_get_stats(struct dcache_stats *st)
+{
+    int s, i;
+
+    *st = dcache_st;
+    st->enabled = dcache_on;
+    st->entries = 0;
+    st->negative = 0;
+    for (s = 0; s < DCACHE_SETS; s++) {
+        for (i = 0; i < DCACHE_WAYS; i++) {
+            if (!dcache[s][i].parent)
+                continue;
+            st->entries++;
+            if (!dcache[s][i].child)
+                st->negative++;
+        }
+    }
+}
+
+void dcache_reset_stats(void)
+{
+    memset(&dcache_st, 0, sizeof(dcache_st));
+}
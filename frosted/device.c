@@ -55,7 +55,6 @@ struct device *  device_fno_init(struct module * mod, const char * name, struct
         device->fno->priv = priv;
         device->fno->flags |= flags;
     }
-    device->task = NULL;
     device->mutex = mutex_init();
     return device;
 }
@@ -0,0 +1,330 @@
+/*
+ *      This file is part of frosted.
+ *
+ *      epoll: event notification for servers watching many descriptors.
+ *
+ *      An epoll instance is an fnode owned by mod_epoll. Every watched
+ *      file gets an epitem whose waitq_entry sits on the file's wait
+ *      queue; when the driver signals readiness the item is appended to
+ *      the instance ready list and epoll_wait() sleepers are woken. Only
+ *      items on the ready list are polled again, so the cost of a wakeup
+ *      does not depend on the size of the interest list.
+ *
+ *      Level triggered by default: an item that is still ready after
+ *      being reported stays on the ready list. EPOLLET drops it until the
+ *      next driver signal, EPOLLONESHOT disarms it until EPOLL_CTL_MOD.
+ *      Closing a watched file removes its item.
+ */
+
+#include "frosted.h"
+#include "string.h"
+#include "poll.h"
+#include "sys/epoll.h"
+
+#define EPOLL_EVENT_MASK (EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLERR | EPOLLHUP)
+
+struct eventpoll;
+
+struct epitem {
+    struct waitq_entry wait;    /* linked on the watched fnode's queue */
+    struct eventpoll *ep;
+    struct fnode *fno;          /* NULL once the watched file is gone */
+    uint32_t events;
+    epoll_data_t data;
+    struct epitem *next;        /* interest list */
+    struct epitem *rdnext;      /* ready list */
+    uint8_t ready;
+};
+
+struct eventpoll {
+    struct fnode *fno;
+    struct epitem *items;
+    struct epitem *rdhead;
+    struct epitem *rdtail;
+};
+
+static struct module mod_epoll;
+
+static struct fnode EPOLL_ROOT = {
+};
+
+static struct eventpoll *ep_from_fd(int epfd)
+{
+    struct fnode *f = task_filedesc_get(epfd);
+
+    if (!f || (f->owner != &mod_epoll))
+        return NULL;
+    return (struct eventpoll *)f->priv;
+}
+
+/* Ready list: appended from wait queue callbacks, possibly in interrupt
+ * context, so it is only touched with interrupts masked. */
+static void ep_ready_add(struct eventpoll *ep, struct epitem *it)
+{
+    uint32_t irq_state = irq_save();
+
+    if (!it->ready) {
+        it->ready = 1;
+        it->rdnext = NULL;
+        if (ep->rdtail)
+            ep->rdtail->rdnext = it;
+        else
+            ep->rdhead = it;
+        ep->rdtail = it;
+    }
+    irq_restore(irq_state);
+}
+
+static struct epitem *ep_ready_pop(struct eventpoll *ep)
+{
+    struct epitem *it;
+    uint32_t irq_state = irq_save();
+
+    it = ep->rdhead;
+    if (it) {
+        ep->rdhead = it->rdnext;
+        if (!ep->rdhead)
+            ep->rdtail = NULL;
+        it->rdnext = NULL;
+        it->ready = 0;
+    }
+    irq_restore(irq_state);
+    return it;
+}
+
+static void ep_ready_del(struct eventpoll *ep, struct epitem *it)
+{
+    struct epitem **pp;
+    struct epitem *prev = NULL;
+    uint32_t irq_state = irq_save();
+
+    if (it->ready) {
+        pp = &ep->rdhead;
+        while (*pp) {
+            if (*pp == it) {
+                *pp = it->rdnext;
+                if (ep->rdtail == it)
+                    ep->rdtail = prev;
+                break;
+            }
+            prev = *pp;
+            pp = &(*pp)->rdnext;
+        }
+        it->ready = 0;
+        it->rdnext = NULL;
+    }
+    irq_restore(irq_state);
+}
+
+static void ep_item_event(struct waitq_entry *e, uint16_t events)
+{
+    struct epitem *it = (struct epitem *)e;
+    struct eventpoll *ep = it->ep;
+
+    if (events & POLLNVAL)
+        it->fno = NULL;
+    ep_ready_add(ep, it);
+    fno_wake(ep->fno, POLLIN);
+}
+
+static struct epitem *ep_find(struct eventpoll *ep, struct fnode *f)
+{
+    struct epitem *it = ep->items;
+
+    while (it) {
+        if (it->fno == f)
+            return it;
+        it = it->next;
+    }
+    return NULL;
+}
+
+static void ep_item_free(struct eventpoll *ep, struct epitem *it)
+{
+    struct epitem **pp = &ep->items;
+
+    waitq_del(&it->wait);
+    ep_ready_del(ep, it);
+    while (*pp) {
+        if (*pp == it) {
+            *pp = it->next;
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+    kfree(it);
+}
+
+static void ep_item_arm(struct epitem *it, const struct epoll_event *ev)
+{
+    it->events = ev->events;
+    it->data = ev->data;
+    it->wait.events = (uint16_t)(ev->events & EPOLL_EVENT_MASK);
+}
+
+/* Re-poll the items on the ready list and report up to maxevents. */
+static int ep_collect(struct eventpoll *ep, struct epoll_event *events, int maxevents)
+{
+    struct epitem *it, *requeue = NULL;
+    uint16_t revents;
+    int n = 0;
+
+    while ((n < maxevents) && ((it = ep_ready_pop(ep)) != NULL)) {
+        if (!it->fno) {
+            ep_item_free(ep, it);
+            continue;
+        }
+        revents = 0;
+        it->fno->owner->ops.poll(it->fno, it->wait.events, &revents);
+        revents &= (it->wait.events | POLLERR | POLLHUP);
+        if (!revents)
+            continue;
+        events[n].events = revents;
+        events[n].data = it->data;
+        n++;
+        if (it->events & EPOLLONESHOT) {
+            it->wait.events = 0;
+        } else if ((it->events & EPOLLET) == 0) {
+            /* Level triggered: check it again on the next call */
+            it->rdnext = requeue;
+            requeue = it;
+        }
+    }
+    while (requeue) {
+        it = requeue;
+        requeue = it->rdnext;
+        ep_ready_add(ep, it);
+    }
+    return n;
+}
+
+int sys_epoll_create_hdlr(int flags)
+{
+    struct eventpoll *ep;
+    struct fnode *f;
+    int fd;
+
+    (void)flags;
+    ep = kcalloc(1, sizeof(struct eventpoll));
+    if (!ep)
+        return -ENOMEM;
+    f = fno_create(&mod_epoll, "", &EPOLL_ROOT);
+    if (!f) {
+        kfree(ep);
+        return -ENOMEM;
+    }
+    f->priv = ep;
+    ep->fno = f;
+    fd = task_filedesc_add(f);
+    if (fd < 0) {
+        fno_unlink(f);
+        kfree(ep);
+        return -EMFILE;
+    }
+    return fd;
+}
+
+int sys_epoll_ctl_hdlr(int epfd, int op, int fd, struct epoll_event *ev)
+{
+    struct eventpoll *ep = ep_from_fd(epfd);
+    struct fnode *f;
+    struct epitem *it;
+
+    if (!ep)
+        return -EBADF;
+    f = task_filedesc_get(fd);
+    if (!f)
+        return -EBADF;
+    if ((f->owner == &mod_epoll) || !f->owner || !f->owner->ops.poll)
+        return -EPERM;
+    if ((op != EPOLL_CTL_DEL) && (!ev || task_ptr_valid(ev)))
+        return -EFAULT;
+
+    it = ep_find(ep, f);
+    switch (op) {
+        case EPOLL_CTL_ADD:
+            if (it)
+                return -EEXIST;
+            it = kcalloc(1, sizeof(struct epitem));
+            if (!it)
+                return -ENOMEM;
+            it->ep = ep;
+            it->fno = f;
+            it->wait.func = ep_item_event;
+            ep_item_arm(it, ev);
+            waitq_add(&f->wq, &it->wait);
+            it->next = ep->items;
+            ep->items = it;
+            break;
+        case EPOLL_CTL_MOD:
+            if (!it)
+                return -ENOENT;
+            ep_item_arm(it, ev);
+            break;
+        case EPOLL_CTL_DEL:
+            if (!it)
+                return -ENOENT;
+            ep_item_free(ep, it);
+            return 0;
+        default:
+            return -EINVAL;
+    }
+    /* Let the next epoll_wait() find out the current state */
+    ep_ready_add(ep, it);
+    fno_wake(ep->fno, POLLIN);
+    return 0;
+}
+
+int sys_epoll_wait_hdlr(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+    struct eventpoll *ep = ep_from_fd(epfd);
+    int n;
+
+    if (!ep)
+        return -EBADF;
+    if (maxevents <= 0)
+        return -EINVAL;
+    if (!events || task_ptr_range_valid(events, maxevents * sizeof(struct epoll_event)))
+        return -EFAULT;
+
+    n = ep_collect(ep, events, maxevents);
+    if ((n > 0) || (timeout == 0) || task_timed_out()) {
+        task_timeout_cancel();
+        return n;
+    }
+    return task_waitq_sleep_timeout(&ep->fno->wq, POLLIN, timeout);
+}
+
+static int epoll_poll(struct fnode *f, uint16_t events, uint16_t *revents)
+{
+    struct eventpoll *ep = (struct eventpoll *)f->priv;
+
+    if ((events & POLLIN) && ep && ep->rdhead) {
+        *revents |= POLLIN;
+        return 1;
+    }
+    return 0;
+}
+
+static int epoll_close(struct fnode *f)
+{
+    struct eventpoll *ep = (struct eventpoll *)f->priv;
+
+    if (!ep)
+        return -EINVAL;
+    while (ep->items)
+        ep_item_free(ep, ep->items);
+    f->priv = NULL;
+    fno_unlink(f);
+    kfree(ep);
+    return 0;
+}
+
+void epoll_init(void)
+{
+    mod_epoll.family = FAMILY_DEV;
+    strcpy(mod_epoll.name, "epoll");
+    mod_epoll.ops.poll = epoll_poll;
+    mod_epoll.ops.close = epoll_close;
+    register_module(&mod_epoll);
+}
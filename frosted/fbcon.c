@@ -28,6 +28,7 @@
 
 static uint32_t fbcon_l, fbcon_h;
 static uint32_t screen_rows, screen_cols;
+static uint32_t screen_stride;  /* framebuffer line length, in 32-bit words */
 
 #define COLOR_DEFAULT 15 /* White */
 
@@ -37,13 +38,41 @@ struct dev_fbcon {
     uint16_t size_x;
     uint16_t size_y;
     uint16_t cursor;
+    uint16_t top;               /* buffer row shown on the first console line */
+    uint16_t hw_top;            /* 'top' as last programmed into the display */
     uint8_t color;
     uint8_t escape;
-    unsigned char *buffer;
+    uint8_t hw_scroll;          /* display wraps the rows in hardware */
+    uint8_t refresh_pending;
+    unsigned char *buffer;      /* text and colours: a ring of fbcon_h rows */
     unsigned char *colormap;
+    unsigned char *dirty_lo;    /* per buffer row: first and last changed */
+    unsigned char *dirty_hi;    /* column, lo > hi when the row is clean */
     unsigned char *screen;
 };
 
+#define DIRTY_NONE 0xFF
+
+#if FONT_WIDTH != 8
+#  error "fbcon renders 8 pixel wide fonts only"
+#endif
+
+/* Font row bitmap -> eight 8-bit pixels, 0xFF where the glyph is set,
+ * as two little endian words. Masking with the colour replicated in
+ * every byte renders one glyph row with two stores. */
+#define GR_PX(b, n)  ((((b) & (0x80 >> (n))) ? 0xFFu : 0u) << (8 * ((n) & 3)))
+#define GR(b)       { GR_PX(b, 0) | GR_PX(b, 1) | GR_PX(b, 2) | GR_PX(b, 3), \
+                      GR_PX(b, 4) | GR_PX(b, 5) | GR_PX(b, 6) | GR_PX(b, 7) }
+#define GR4(b)      GR(b), GR((b) + 1), GR((b) + 2), GR((b) + 3)
+#define GR16(b)     GR4(b), GR4((b) + 4), GR4((b) + 8), GR4((b) + 12)
+
+static const uint32_t glyph_rows[256][2] = {
+    GR16(0x00), GR16(0x10), GR16(0x20), GR16(0x30),
+    GR16(0x40), GR16(0x50), GR16(0x60), GR16(0x70),
+    GR16(0x80), GR16(0x90), GR16(0xA0), GR16(0xB0),
+    GR16(0xC0), GR16(0xD0), GR16(0xE0), GR16(0xF0),
+};
+
 static int devfbcon_write(struct fnode *fno, const void *buf, unsigned int len);
 static int devfbcon_read(struct fnode *fno, void *buf, unsigned int len);
 static int devfbcon_poll(struct fnode *fno, uint16_t events, uint16_t *revents);
@@ -74,54 +103,168 @@ static void devfbcon_tty_attach(struct fnode *fno, int pid)
     }
 }
 
-static void render_row(struct dev_fbcon *fbcon, int row)
+static void mark_dirty(struct dev_fbcon *fbcon, uint32_t row, uint32_t lo, uint32_t hi)
 {
-    int i, j, l;
-    unsigned char fc;
-    const unsigned char *fcl;
-    uint8_t fc_color = COLOR_DEFAULT;
-    int screen_off;
-
-    for (i = 0; i < fbcon_l; i++) {            /* Each char ... i = column */ 
-        fc = fbcon->buffer[row * fbcon_l + i]; /* fc = char to render */
-        fc_color = 
-            fbcon->colormap[row * fbcon_l + i];/* fc_color: char color */
-        fcl = fb_font[fc];                     /* fcl = font rendering, 8 bytes. */
-        for (l = 0; l < FONT_HEIGHT; l++) {              /* screen lines 0..FONT_HEIGHT */
-            for (j = 0; j < FONT_WIDTH; j++) {          /* each pixel in screen line */
-                screen_off = ((row * FONT_HEIGHT + l) * screen_cols) + (i * FONT_WIDTH) + j;
-                fbcon->screen[screen_off] = ((fcl[l] & (1 << (7 - j))))?fc_color:0;
-            }
+    if (fbcon->dirty_lo[row] == DIRTY_NONE || hi > fbcon->dirty_hi[row])
+        fbcon->dirty_hi[row] = (unsigned char)hi;
+    if (lo < fbcon->dirty_lo[row])
+        fbcon->dirty_lo[row] = (unsigned char)lo;
+}
+
+static void mark_all_dirty(struct dev_fbcon *fbcon)
+{
+    memset(fbcon->dirty_lo, 0, fbcon_h);
+    memset(fbcon->dirty_hi, fbcon_l - 1, fbcon_h);
+}
+
+/* Store a character at console position 'pos', marking the cell dirty
+ * only if it actually changes. */
+static void put_cell(struct dev_fbcon *fbcon, uint32_t pos, unsigned char c, uint8_t color)
+{
+    uint32_t row, col, idx;
+
+    if (pos >= fbcon_l * fbcon_h)
+        return;
+    row = pos / fbcon_l;
+    col = pos - row * fbcon_l;
+    row += fbcon->top;
+    if (row >= fbcon_h)
+        row -= fbcon_h;
+    idx = row * fbcon_l + col;
+    if (fbcon->buffer[idx] == c && fbcon->colormap[idx] == color)
+        return;
+    fbcon->buffer[idx] = c;
+    fbcon->colormap[idx] = color;
+    mark_dirty(fbcon, row, col, col);
+}
+
+/* Rasterize columns lo..hi of buffer row 'row' at screen line 'y' */
+static void render_cells(struct dev_fbcon *fbcon, uint32_t row, uint32_t y, uint32_t lo, uint32_t hi)
+{
+    const unsigned char *fc = fbcon->buffer + row * fbcon_l;
+    const unsigned char *fc_color = fbcon->colormap + row * fbcon_l;
+    uint32_t *line = (uint32_t *)fbcon->screen + y * screen_stride;
+    uint32_t i, l;
+
+    for (i = lo; i <= hi; i++) {
+        const unsigned char *fcl = fb_font[fc[i]];
+        uint32_t color = fc_color[i] * 0x01010101u;
+        uint32_t *px = line + i * (FONT_WIDTH / 4);
+
+        for (l = 0; l < FONT_HEIGHT; l++) {
+            const uint32_t *g = glyph_rows[fcl[l]];
+            px[0] = g[0] & color;
+            px[1] = g[1] & color;
+            px += screen_stride;
         }
     }
 }
 
+/* Writers run in syscall context and cannot interrupt each other; the
+ * refresh timer runs on the kernel thread and must not race them. */
+static inline void fbcon_lock(void)
+{
+    if (!task_in_syscall())
+        irq_off();
+}
+
+static inline void fbcon_unlock(void)
+{
+    if (!task_in_syscall())
+        irq_on();
+}
+
+/* Render the dirty cells and push them to the display, merging dirty
+ * rows that are adjacent on screen into one rectangle. With hardware
+ * scrolling buffer row N always lives at screen line N * FONT_HEIGHT
+ * and the panel is told which row to show first; otherwise rows are
+ * drawn in console order and a scroll dirties the whole screen. */
 static void render_screen(struct dev_fbcon *fbcon)
 {
-    int i;
-    for (i = 0; i < fbcon_h; i++)
-        render_row(fbcon, i);
-    framebuffer_flush(0, 0, screen_cols, screen_rows);
+    uint32_t i, row = 0, lo, hi, top;
+    uint32_t band_y = 0, band_h = 0, band_lo = 0, band_hi = 0;
+
+    fbcon_lock();
+    top = fbcon->top;
+    fbcon_unlock();
+
+    for (i = 0; i <= fbcon_h; i++) {
+        lo = DIRTY_NONE;
+        hi = 0;
+        if (i < fbcon_h) {
+            row = i;
+            if (!fbcon->hw_scroll) {
+                row += top;
+                if (row >= fbcon_h)
+                    row -= fbcon_h;
+            }
+            fbcon_lock();
+            lo = fbcon->dirty_lo[row];
+            hi = fbcon->dirty_hi[row];
+            fbcon->dirty_lo[row] = DIRTY_NONE;
+            fbcon->dirty_hi[row] = 0;
+            fbcon_unlock();
+        }
+        if (lo != DIRTY_NONE) {
+            render_cells(fbcon, row, i * FONT_HEIGHT, lo, hi);
+            if (band_h == 0) {
+                band_y = i * FONT_HEIGHT;
+                band_lo = lo;
+                band_hi = hi;
+            }
+            if (lo < band_lo)
+                band_lo = lo;
+            if (hi > band_hi)
+                band_hi = hi;
+            band_h += FONT_HEIGHT;
+        } else if (band_h) {
+            framebuffer_flush(band_lo * FONT_WIDTH, band_y,
+                    (band_hi - band_lo + 1) * FONT_WIDTH, band_h);
+            band_h = 0;
+        }
+    }
+
+    if (fbcon->hw_scroll && fbcon->hw_top != top) {
+        if (framebuffer_vscroll(fbcon_h * FONT_HEIGHT, top * FONT_HEIGHT) == 0)
+            fbcon->hw_top = (uint16_t)top;
+    }
 }
 
-static void scroll(struct dev_fbcon *fbcon)
+static void fbcon_refresh(uint32_t now, void *arg)
 {
-    unsigned char *dest = fbcon->buffer;
-    unsigned char *src = fbcon->buffer + fbcon_l;
-    unsigned char *c_dest = fbcon->colormap;
-    unsigned char *c_src = fbcon->colormap + fbcon_l;
-    int i;
-    for (i = 0; i < fbcon_h; i++) {
-        memcpy(dest, src, fbcon_l);
-        dest += fbcon_l;
-        src += fbcon_l;
-        memcpy(c_dest, c_src, fbcon_l);
-        c_dest += fbcon_l;
-        c_src += fbcon_l;
+    struct dev_fbcon *fbcon = arg;
+
+    (void)now;
+    fbcon->refresh_pending = 0;
+    render_screen(fbcon);
+}
+
+/* Coalesce writes: one refresh per CONFIG_FBCON_REFRESH_MS at most */
+static void fbcon_schedule(struct dev_fbcon *fbcon)
+{
+    if (fbcon->refresh_pending)
+        return;
+    if (ktimer_add(CONFIG_FBCON_REFRESH_MS, fbcon_refresh, fbcon) < 0) {
+        render_screen(fbcon);
+        return;
     }
+    fbcon->refresh_pending = 1;
+}
+
+/* The oldest row is recycled as the new last line: nothing is copied,
+ * only 'top' moves. */
+static void scroll(struct dev_fbcon *fbcon)
+{
+    uint32_t row = fbcon->top;
+
+    fbcon->top = (row + 1 == fbcon_h) ? 0 : (uint16_t)(row + 1);
     fbcon->cursor = fbcon_l * (fbcon_h - 1);
-    memset(fbcon->buffer + fbcon->cursor, 0, fbcon_l);
-    memset(fbcon->colormap + fbcon->cursor, COLOR_DEFAULT, fbcon_l);
+    memset(fbcon->buffer + row * fbcon_l, 0, fbcon_l);
+    memset(fbcon->colormap + row * fbcon_l, COLOR_DEFAULT, fbcon_l);
+    if (fbcon->hw_scroll)
+        mark_dirty(fbcon, row, 0, fbcon_l - 1);
+    else
+        mark_all_dirty(fbcon);
 }
 
 static int devfbcon_write(struct fnode *fno, const void *buf, unsigned int len)
@@ -150,9 +293,8 @@ static int devfbcon_write(struct fnode *fno, const void *buf, unsigned int len)
                 fbcon->cursor = 0;
             }
             if (cbuf[i] == 'J') {
-                for (j = fbcon->cursor; j < (fbcon_l * fbcon_h); j++) {
-                    fbcon->buffer[j] = 0x20;
-                }
+                for (j = fbcon->cursor; j < (fbcon_l * fbcon_h); j++)
+                    put_cell(fbcon, j, 0x20, COLOR_DEFAULT);
             }
             fbcon->escape = 0;
             continue;
@@ -173,6 +315,7 @@ static int devfbcon_write(struct fnode *fno, const void *buf, unsigned int len)
             case 0x0c:
                 memset(fbcon->buffer, 0, fbcon_l * fbcon_h);
                 fbcon->cursor = 0;
+                mark_all_dirty(fbcon);
                 break;
 
             /* TAB */
@@ -181,7 +324,7 @@ static int devfbcon_write(struct fnode *fno, const void *buf, unsigned int len)
                 if (t == 0) 
                     t = 4;
                 for (p = 0; p < t; p++)
-                    fbcon->buffer[fbcon->cursor + p] = 0x20;
+                    put_cell(fbcon, fbcon->cursor + p, 0x20, COLOR_DEFAULT);
                 fbcon->cursor += t;
                 break;
 
@@ -190,16 +333,14 @@ static int devfbcon_write(struct fnode *fno, const void *buf, unsigned int len)
             case 0x08:
                 if (fbcon->cursor > 0) {
                     fbcon->cursor--;
-                    fbcon->buffer[fbcon->cursor] = 0x20;
-                    fbcon->colormap[fbcon->cursor] = COLOR_DEFAULT;
+                    put_cell(fbcon, fbcon->cursor, 0x20, COLOR_DEFAULT);
                 }
                 break;
 
 
             /* DEL */
             case 0x7f:
-                fbcon->buffer[fbcon->cursor] = 0x20;
-                fbcon->colormap[fbcon->cursor] = COLOR_DEFAULT;
+                put_cell(fbcon, fbcon->cursor, 0x20, COLOR_DEFAULT);
                 break;
 
             /* ESC */
@@ -209,11 +350,10 @@ static int devfbcon_write(struct fnode *fno, const void *buf, unsigned int len)
 
             /* Printable char */
             default:
-                fbcon->colormap[fbcon->cursor] = fbcon->color;
-                fbcon->buffer[fbcon->cursor++] = cbuf[i];
+                put_cell(fbcon, fbcon->cursor++, cbuf[i], fbcon->color);
         }
     }
-    render_screen(fbcon);
+    fbcon_schedule(fbcon);
     return len;
 }
 
@@ -264,21 +404,35 @@ const char fbcon_banner[] = "\r\nConsole framebuffer enabled.\r\n";
 static const unsigned char color[2] = { 0x1b, 13 };
 static const unsigned char white[2] = { 0x1b, 15 };
 
+/* cols x rows: console area in pixels, clipped to the framebuffer */
 int fbcon_init(uint32_t cols, uint32_t rows)
 {
     struct fnode *devfs = fno_search("/dev");
-    struct dev_fbcon *fbcon = kalloc(sizeof(struct dev_fbcon));
+    struct dev_fbcon *fbcon;
     struct fnode *fno_fbcon;
+    unsigned char *screen = framebuffer_get();
+    uint32_t xres, yres;
 
+    if (!screen || framebuffer_get_res(&xres, &yres) < 0)
+        return -1;
+    if (devfs == NULL)
+        return -1;
+    if ((xres % 4) != 0 || ((uintptr_t)screen % 4) != 0)
+        return -1;
+
+    fbcon = kalloc(sizeof(struct dev_fbcon));
     if (!fbcon)
         return -1;
 
     memset(fbcon, 0, sizeof(struct dev_fbcon));
-    screen_cols = cols;
-    screen_rows = rows;
+    screen_cols = (cols < xres) ? cols : xres;
+    screen_rows = (rows < yres) ? rows : yres;
+    screen_stride = xres / 4;
 
     fbcon_l = screen_cols / FONT_WIDTH;
     fbcon_h = screen_rows / FONT_HEIGHT;
+    if (fbcon_l >= DIRTY_NONE)
+        fbcon_l = DIRTY_NONE - 1;
 
     fbcon->buffer = kalloc(fbcon_l * fbcon_h);
     if (!fbcon->buffer) {
@@ -291,34 +445,38 @@ int fbcon_init(uint32_t cols, uint32_t rows)
         kfree(fbcon);
         return -1;
     }
-
-    if (devfs == NULL) {
+    fbcon->dirty_lo = kalloc(2 * fbcon_h);
+    if (!fbcon->dirty_lo) {
         kfree(fbcon->colormap);
         kfree(fbcon->buffer);
         kfree(fbcon);
         return -1;
     }
+    fbcon->dirty_hi = fbcon->dirty_lo + fbcon_h;
 
     memset(fbcon->buffer, 0, (fbcon_l * fbcon_h));
     memset(fbcon->colormap, COLOR_DEFAULT, (fbcon_l * fbcon_h));
+    mark_all_dirty(fbcon);
     register_module(&mod_devfbcon);
     fno_fbcon = fno_create(&mod_devfbcon, "fbcon", devfs);
     fno_fbcon->priv = fbcon;
     fbcon->size_x = fbcon_l;
     fbcon->size_y = fbcon_h;
-    fbcon->screen = framebuffer_get();
-    if (!fbcon->screen) {
-        kfree(fbcon->colormap);
-        kfree(fbcon->buffer);
-        kfree(fbcon);
-        return -1;
-    }
+    fbcon->screen = screen;
     fbcon->color = COLOR_DEFAULT;
     framebuffer_setcmap(xterm_cmap);
-    /* Test */
+
+    /* Scroll by moving the panel start line if the driver can */
+    if (framebuffer_vscroll(fbcon_h * FONT_HEIGHT, 0) == 0)
+        fbcon->hw_scroll = 1;
+
+    /* Timers are not running yet: draw the banner right away */
+    fbcon->refresh_pending = 1;
     devfbcon_write(fno_fbcon, color, 2);
     devfbcon_write(fno_fbcon, frosted_banner, strlen(frosted_banner));
     devfbcon_write(fno_fbcon, white, 2);
     devfbcon_write(fno_fbcon, fbcon_banner, strlen(fbcon_banner));
+    render_screen(fbcon);
+    fbcon->refresh_pending = 0;
     return 0;
 }
@@ -22,19 +22,14 @@
 #include "pool.h"
 #include "string.h"
 #include "locks.h"
+#include "flashfs.h"
+#include "flashfs_log.h"
 
 #ifdef CONFIG_FLASHFS
 
 static struct module mod_flashfs;
 static mutex_t *flashfs_lock;
 
-#ifndef FLASH_PAGE_SIZE
-#define FLASH_PAGE_SIZE 256
-#endif
-
-#define F_PREV_PAGE 0xFFFE
-#define F_DIR_FLAG  0x8000   /* top bit of fname_len marks a directory entry */
-
 #if defined(TARGET_rp2350)
 #define PART_MAP_BASE_DEFAULT (0x101F0000U)
 #define PART_SIZE_DEFAULT     (0x10000U)
@@ -53,9 +48,6 @@ static mutex_t *flashfs_lock;
 static uint32_t part_map_base;
 static uint32_t part_size;
 #define PART_MAX_PAGES (part_size / FLASH_PAGE_SIZE)
-#define BITS_PER_BMP_PAGE (FLASH_PAGE_SIZE * 8)
-
-#define MAX_FNAME 128
 
 int secure_flash_write_page(uint32_t off, uint8_t *page);
 
@@ -64,14 +56,97 @@ int secure_flash_write_page(uint32_t off, uint8_t *page);
 static struct jedec_spi_flash *registered_jedec;
 #endif
 
+/*
+ * Calls that read or change a volume hold flashfs_lock and, with the
+ * block cache, the cache lock. The GC and cache flush threads keep them
+ * across transfers they sleep through: a call finding them taken returns
+ * SYS_CALL_AGAIN before touching anything, and restarts once they are
+ * released.
+ */
+static int flashfs_enter(void)
+{
+    int ret = mutex_lock(flashfs_lock);
+
+    if (ret != 0)
+        return ret;
+#if CONFIG_BLKCACHE
+    ret = blkcache_lock();
+    if (ret != 0)
+        mutex_unlock(flashfs_lock);
+#endif
+    return ret;
+}
+
+static void flashfs_leave(void)
+{
+#if CONFIG_BLKCACHE
+    blkcache_unlock();
+#endif
+    mutex_unlock(flashfs_lock);
+}
+
+/*
+ * Mounted volumes and their directory index (see flashfs_index.c). Lookups
+ * go through the index; creat/unlink/relocate keep it in sync.
+ */
+#define FLASHFS_VOLUMES 2
+
+struct flashfs_volume {
+    uint8_t in_use;
+    uint8_t ckpt;               /* checkpoint on flash matches the index */
+    const struct jedec_spi_flash *jedec;
+    struct flashfs_index idx;
+#if CONFIG_FLASHFS_LOG
+    struct flashfs_log log;     /* log.map set: log-structured volume */
+    uint8_t gc_pending;         /* ktimer armed */
+    volatile uint8_t gc_due;    /* the GC thread should collect */
+#if CONFIG_BLKCACHE
+    struct blkcache_dev cache;  /* logical pages of a log volume */
+#endif
+#endif
+};
+
+static struct flashfs_volume flashfs_vols[FLASHFS_VOLUMES];
+
+static struct flashfs_volume *flashfs_volume_of(const struct jedec_spi_flash *jedec)
+{
+    int i;
+    for (i = 0; i < FLASHFS_VOLUMES; i++) {
+        if (flashfs_vols[i].in_use && flashfs_vols[i].jedec == jedec)
+            return &flashfs_vols[i];
+    }
+    return NULL;
+}
+
+#if CONFIG_FLASHFS_LOG
+/* Volume of a JEDEC device mounted in log-structured mode, if any */
+static struct flashfs_volume *flashfs_log_volume(const struct jedec_spi_flash *jedec)
+{
+    struct flashfs_volume *vol;
+
+    if (!jedec)
+        return NULL;
+    vol = flashfs_volume_of(jedec);
+    if (!vol || !vol->log.map)
+        return NULL;
+    return vol;
+}
+#endif
+
 /**
  * Return the effective page count for a flashfs instance.
- * JEDEC-backed mounts use the probed device geometry;
+ * JEDEC-backed mounts use the probed device geometry, or the logical size
+ * of a log-structured volume;
  * internal-flash mounts use the runtime-computed partition size.
  */
 #ifdef CONFIG_JEDEC_SPI_FLASH
 static inline uint32_t flashfs_effective_pages(const struct jedec_spi_flash *jedec)
 {
+#if CONFIG_FLASHFS_LOG
+    struct flashfs_volume *vol = flashfs_log_volume(jedec);
+    if (vol)
+        return vol->log.lpages;
+#endif
     if (jedec && jedec->page_count > 0)
         return jedec->page_count;
     return PART_MAX_PAGES;
@@ -84,11 +159,6 @@ static inline uint32_t flashfs_effective_pages(const void *unused)
 }
 #endif
 
-struct __attribute__((packed)) flashfs_file_hdr {
-    uint16_t fname_len;
-    uint16_t fsize;
-};
-
 static int flashfs_payload_caps(int fname_len, int *first_cap, int *cont_cap)
 {
     int first;
@@ -211,6 +281,184 @@ static inline uint32_t bmp_flash_page_for(const void *jedec, uint32_t p)
 }
 
 #ifdef CONFIG_JEDEC_SPI_FLASH
+#if CONFIG_FLASHFS_LOG
+/*
+ * Background GC keeps a couple of erased sectors ahead of the writers, so
+ * that appends rarely wait for a collection. It runs in its own kernel
+ * thread, which sleeps through the page copies, erases and DMA waits; the
+ * ktimer only wakes it. It backs off while a flashfs call holds the lock.
+ */
+#define FLASHFS_LOG_BG_FREE (FLASHFS_LOG_GC_RESERVE + 2)
+#define FLASHFS_LOG_GC_MS   50
+
+static struct task *flashfs_gc_task;
+static volatile uint8_t flashfs_gc_wake_pending;
+
+static void flashfs_log_gc_schedule(struct flashfs_volume *vol);
+
+static void flashfs_log_gc_tick(uint32_t now, void *arg)
+{
+    struct flashfs_volume *vol = arg;
+
+    (void)now;
+    vol->gc_pending = 0;
+    vol->gc_due = 1;
+    flashfs_gc_wake_pending = 1;
+    if (flashfs_gc_task)
+        task_resume(flashfs_gc_task);
+}
+
+static void flashfs_log_gc_run(struct flashfs_volume *vol)
+{
+    if (mutex_trylock(flashfs_lock) != 0) {
+        flashfs_log_gc_schedule(vol);
+        return;
+    }
+    /* Cache write-backs append to the log too */
+    if (blkcache_trylock() != 0) {
+        mutex_unlock(flashfs_lock);
+        flashfs_log_gc_schedule(vol);
+        return;
+    }
+    if (vol->in_use && vol->log.map &&
+            flashfs_log_gc(&vol->log, FLASHFS_LOG_BG_FREE) > 0)
+        flashfs_log_gc_schedule(vol);
+    blkcache_unlock();
+    mutex_unlock(flashfs_lock);
+}
+
+static void flashfs_gc_wait(void)
+{
+    irq_off();
+    while (!flashfs_gc_wake_pending) {
+        task_suspend();
+        /* The switch happens as soon as interrupts are enabled */
+        irq_on();
+        irq_off();
+    }
+    flashfs_gc_wake_pending = 0;
+    irq_on();
+}
+
+static void flashfs_gc_thread(void *arg)
+{
+    int i;
+
+    (void)arg;
+    while (1) {
+        flashfs_gc_wait();
+        for (i = 0; i < FLASHFS_VOLUMES; i++) {
+            if (!flashfs_vols[i].gc_due)
+                continue;
+            flashfs_vols[i].gc_due = 0;
+            flashfs_log_gc_run(&flashfs_vols[i]);
+        }
+    }
+}
+
+static void flashfs_log_gc_schedule(struct flashfs_volume *vol)
+{
+    if (vol->gc_pending || vol->log.free >= FLASHFS_LOG_BG_FREE)
+        return;
+    if (ktimer_add(FLASHFS_LOG_GC_MS, flashfs_log_gc_tick, vol) >= 0)
+        vol->gc_pending = 1;
+}
+
+static int flashfs_log_io_read(void *dev, uint32_t addr, void *buf, uint32_t len)
+{
+    return jedec_spi_flash_read(dev, addr, buf, len) < 0 ? -EIO : 0;
+}
+
+static int flashfs_log_io_program(void *dev, uint32_t addr, const void *buf, uint32_t len)
+{
+    return jedec_spi_flash_program(dev, addr, buf, len) < 0 ? -EIO : 0;
+}
+
+static int flashfs_log_io_erase(void *dev, uint32_t addr)
+{
+    return jedec_spi_flash_erase_sector(dev, addr) < 0 ? -EIO : 0;
+}
+
+#if CONFIG_BLKCACHE
+/* Cache backend of a log volume: logical pages in and out of the log */
+static int flashfs_log_cache_read(void *priv, uint32_t blk, uint8_t *const *bufs,
+        uint32_t count)
+{
+    struct flashfs_volume *vol = priv;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        if (flashfs_log_read(&vol->log, (blk + i) * FLASH_PAGE_SIZE, bufs[i],
+                    FLASH_PAGE_SIZE) < 0)
+            return -EIO;
+    }
+    return 0;
+}
+
+static int flashfs_log_cache_write(void *priv, uint32_t blk, const uint8_t *const *bufs,
+        uint32_t count)
+{
+    struct flashfs_volume *vol = priv;
+    uint32_t i;
+    int ret = 0;
+
+    for (i = 0; ret == 0 && i < count; i++) {
+        if (bufs[i])
+            ret = flashfs_log_write(&vol->log, blk + i, bufs[i]);
+    }
+    flashfs_log_gc_schedule(vol);
+    return ret;
+}
+
+static void flashfs_log_cache_trim(void *priv, uint32_t blk)
+{
+    struct flashfs_volume *vol = priv;
+    flashfs_log_trim(&vol->log, blk);
+}
+
+static const struct blkcache_ops flashfs_log_cache_ops = {
+    .read = flashfs_log_cache_read,
+    .write = flashfs_log_cache_write,
+    .trim = flashfs_log_cache_trim,
+};
+#endif
+#endif
+
+#if CONFIG_BLKCACHE
+/* The cache a JEDEC volume goes through: its logical pages in log mode,
+ * the raw device otherwise */
+static struct blkcache_dev *flashfs_cache(const struct jedec_spi_flash *jedec)
+{
+#if CONFIG_FLASHFS_LOG
+    struct flashfs_volume *vol = flashfs_log_volume(jedec);
+    if (vol)
+        return &vol->cache;
+#endif
+    return jedec_spi_flash_cache(jedec);
+}
+#endif
+
+/* Byte reads from a JEDEC volume: through the page map in log mode */
+static int flashfs_jedec_read(const struct jedec_spi_flash *jedec, uint32_t addr,
+        void *buf, uint32_t len)
+{
+#if CONFIG_BLKCACHE
+    struct blkcache_dev *cache = flashfs_cache(jedec);
+#endif
+#if CONFIG_FLASHFS_LOG
+    struct flashfs_volume *vol = flashfs_log_volume(jedec);
+#endif
+#if CONFIG_BLKCACHE
+    if (cache)
+        return blkcache_read(cache, addr, buf, len);
+#endif
+#if CONFIG_FLASHFS_LOG
+    if (vol)
+        return flashfs_log_read(&vol->log, addr, buf, len);
+#endif
+    return jedec_spi_flash_read(jedec, addr, buf, len);
+}
+
 static int flashfs_read_jedec_page(const struct jedec_spi_flash *jedec, uint16_t page,
         uint8_t *buf)
 {
@@ -218,7 +466,7 @@ static int flashfs_read_jedec_page(const struct jedec_spi_flash *jedec, uint16_t
 
     if (!jedec || !buf)
         return -EINVAL;
-    ret = jedec_spi_flash_read(jedec, (uint32_t)page * FLASH_PAGE_SIZE,
+    ret = flashfs_jedec_read(jedec, (uint32_t)page * FLASH_PAGE_SIZE,
             buf, FLASH_PAGE_SIZE);
     if (ret < 0)
         kprintf("flashfs: JEDEC read page %u failed (%d)\n", page, ret);
@@ -228,8 +476,26 @@ static int flashfs_read_jedec_page(const struct jedec_spi_flash *jedec, uint16_t
 static int flashfs_write_jedec_page(const struct jedec_spi_flash *jedec, uint16_t page,
         const uint8_t *buf)
 {
+#if CONFIG_FLASHFS_LOG
+    struct flashfs_volume *vol = flashfs_log_volume(jedec);
+#endif
+#if CONFIG_BLKCACHE
+    struct blkcache_dev *cache = flashfs_cache(jedec);
+#endif
     if (!jedec || !buf)
         return -EINVAL;
+#if CONFIG_BLKCACHE
+    /* Absorbed until fsync, close or the flush timer */
+    if (cache)
+        return blkcache_write(cache, (uint32_t)page * FLASH_PAGE_SIZE, buf, FLASH_PAGE_SIZE);
+#endif
+#if CONFIG_FLASHFS_LOG
+    if (vol) {
+        int ret = flashfs_log_write(&vol->log, page, buf);
+        flashfs_log_gc_schedule(vol);
+        return ret;
+    }
+#endif
     return jedec_spi_flash_write_page(jedec, (uint32_t)page * FLASH_PAGE_SIZE,
             buf, FLASH_PAGE_SIZE);
 }
@@ -280,6 +546,15 @@ static int flashfs_write_page(const struct jedec_spi_flash *jedec, uint16_t page
     return 0;
 }
 
+/*
+ * Single-page bitmap cache used by scan loops (lookup / readdir).
+ * The tag pairs (jedec pointer, bitmap flash-page number) uniquely identify
+ * the cached content.
+ */
+static uint8_t flashfs_bmp_cache[FLASH_PAGE_SIZE];
+static const struct jedec_spi_flash *flashfs_bmp_cache_jedec;
+static uint32_t flashfs_bmp_cache_page = 0xFFFFFFFFu;
+
 static int fs_bmp_clear(const struct jedec_spi_flash *jedec, uint32_t page)
 {
     static uint8_t cache_bmp[FLASH_PAGE_SIZE];
@@ -291,6 +566,20 @@ static int fs_bmp_clear(const struct jedec_spi_flash *jedec, uint32_t page)
     cache_bmp[byte_off] |= 1 << (page & 7);
     if (flashfs_write_page(jedec, bp, cache_bmp) != 0)
         return -EIO;
+    flashfs_bmp_cache_page = 0xFFFFFFFFu;
+#if CONFIG_FLASHFS_LOG
+    {
+        /* Freed pages are not worth copying around any more */
+        struct flashfs_volume *vol = flashfs_log_volume(jedec);
+#if CONFIG_BLKCACHE
+        if (vol)
+            blkcache_trim(&vol->cache, page);
+#else
+        if (vol)
+            flashfs_log_trim(&vol->log, page);
+#endif
+    }
+#endif
     return 0;
 }
 
@@ -304,6 +593,7 @@ static int fs_bmp_set(const struct jedec_spi_flash *jedec, uint32_t page)
     cache_bmp[byte_off] &= ~(1 << (page & 7));
     if (flashfs_write_page(jedec, bp, cache_bmp) != 0)
         return -EIO;
+    flashfs_bmp_cache_page = 0xFFFFFFFFu;
     return 0;
 }
 
@@ -317,8 +607,11 @@ static int fs_bmp_test(const struct jedec_spi_flash *jedec, uint32_t page)
     return !(cache_bmp[byte_off] & (1 << (page & 7)));
 }
 
+/* First page of a run of 'pages' free pages, one bitmap read per
+ * BITS_PER_BMP_PAGE pages */
 static int fs_bmp_find_free(const struct jedec_spi_flash *jedec, int pages)
 {
+    uint8_t bmp[FLASH_PAGE_SIZE];
     int i;
     int sz = 0;
     int first = -1;
@@ -326,17 +619,206 @@ static int fs_bmp_find_free(const struct jedec_spi_flash *jedec, int pages)
     if (pages <= 0)
         return -1;
     for (i = 0; i < (int)max_pages; i++) {
-        if (!fs_bmp_test(jedec, i)){
+        if ((i % BITS_PER_BMP_PAGE) == 0 &&
+                flashfs_read_page(jedec, bmp_flash_page_for(jedec, i), bmp) < 0)
+            return -1;
+        if (bmp[(i % BITS_PER_BMP_PAGE) / 8] & (1 << (i & 7))) {
             if (sz++ == 0)
                 first = i;
             if (sz == pages)
-                return i;
+                return first;
         }
         else sz = 0;
     }
     return -1;
 }
 
+static int flashfs_io_read(void *dev, uint32_t addr, void *buf, uint32_t len)
+{
+#ifdef CONFIG_JEDEC_SPI_FLASH
+    if (dev)
+        return flashfs_jedec_read(dev, addr, buf, len) < 0 ? -EIO : 0;
+#endif
+    memcpy(buf, (void *)(uintptr_t)(part_map_base + addr), len);
+    return 0;
+}
+
+static int flashfs_io_write_page(void *dev, uint32_t page, const uint8_t *buf)
+{
+    return flashfs_write_page(dev, (uint16_t)page, buf);
+}
+
+static void flashfs_volume_io(const struct flashfs_volume *vol, struct flashfs_index_io *io)
+{
+    io->read = flashfs_io_read;
+    io->write_page = flashfs_io_write_page;
+    io->dev = (void *)vol->jedec;
+    io->total_pages = flashfs_effective_pages(vol->jedec);
+}
+
+#if CONFIG_FLASHFS_CHECKPOINT
+/* The checkpoint sits in the last data pages, right below the bitmap */
+static inline uint32_t flashfs_ckpt_first(const void *jedec)
+{
+    return flashfs_usable_pages(jedec) - CONFIG_FLASHFS_CHECKPOINT_PAGES;
+}
+
+/* Claim the checkpoint pages in the bitmap. Pages already holding a
+ * checkpoint (fname_len 0) are reused; anything else means a file got
+ * there first and the volume is left without a checkpoint. */
+static int flashfs_ckpt_reserve(const struct jedec_spi_flash *jedec)
+{
+    uint32_t first = flashfs_ckpt_first(jedec);
+    uint32_t p;
+
+    for (p = first; p < first + CONFIG_FLASHFS_CHECKPOINT_PAGES; p++) {
+        uint16_t fname_len;
+        if (!fs_bmp_test(jedec, p))
+            continue;
+        if (flashfs_io_read((void *)jedec, p * FLASH_PAGE_SIZE, &fname_len,
+                    sizeof(fname_len)) < 0 ||
+                (fname_len != 0 && fname_len != 0xFFFF))
+            return -EEXIST;
+    }
+    for (p = first; p < first + CONFIG_FLASHFS_CHECKPOINT_PAGES; p++) {
+        if (!fs_bmp_test(jedec, p) && fs_bmp_set(jedec, p) != 0)
+            return -EIO;
+    }
+    return 0;
+}
+#endif
+
+#if CONFIG_FLASHFS_LOG
+/*
+ * Mount the page map if the device holds a log volume. Pages the bitmap
+ * marks free are trimmed right away so GC does not copy them. Returns 0
+ * for classic images too.
+ */
+static int flashfs_volume_log_mount(struct flashfs_volume *vol)
+{
+    const struct jedec_spi_flash *jedec = vol->jedec;
+    struct flashfs_log_io io;
+    uint8_t bmp[FLASH_PAGE_SIZE];
+    uint32_t p, usable;
+    int ret;
+
+    io.read = flashfs_log_io_read;
+    io.program = flashfs_log_io_program;
+    io.erase = flashfs_log_io_erase;
+    io.dev = (void *)jedec;
+#if CONFIG_BLKCACHE
+    {
+        /* The log reads and writes the device below the raw page cache */
+        struct blkcache_dev *raw = jedec_spi_flash_cache(jedec);
+        ret = raw ? blkcache_invalidate(raw) : 0;
+        if (ret < 0)
+            return ret;
+    }
+#endif
+    ret = flashfs_log_mount(&vol->log, &io, jedec->sector_size,
+            jedec->size_bytes / jedec->sector_size, CONFIG_FLASHFS_LOG_MAX_PAGES);
+    if (ret == -ENOENT)
+        return 0;
+    if (ret < 0) {
+        kprintf("flashfs: log volume on %s not mounted (%d)\n",
+                jedec->dev_path ? jedec->dev_path : "/dev/spiflash0", ret);
+        return ret;
+    }
+#if CONFIG_BLKCACHE
+    blkcache_dev_init(&vol->cache, &flashfs_log_cache_ops, vol, vol->log.lpages, 1);
+#endif
+
+    usable = flashfs_usable_pages(jedec);
+    for (p = 0; p < usable; p++) {
+        if ((p % BITS_PER_BMP_PAGE) == 0 &&
+                flashfs_read_page(jedec, bmp_flash_page_for(jedec, p), bmp) < 0)
+            break;
+        if (bmp[(p % BITS_PER_BMP_PAGE) / 8] & (1 << (p & 7)))
+            flashfs_log_trim(&vol->log, p);
+    }
+    kprintf("flashfs: log volume, %u pages, %u of %u sectors free\n",
+            vol->log.lpages, vol->log.free, vol->log.sectors);
+    return 0;
+}
+#endif
+
+/*
+ * Build the index of a freshly mounted volume. External volumes try the
+ * checkpoint first, and write one after a full scan so the next mount
+ * can skip it. Without memory for the table lookups fall back to scanning.
+ */
+static int flashfs_volume_mount(const struct jedec_spi_flash *jedec)
+{
+    struct flashfs_volume *vol = flashfs_volume_of(jedec);
+    struct flashfs_index_io io;
+    int i;
+
+    for (i = 0; !vol && i < FLASHFS_VOLUMES; i++) {
+        if (!flashfs_vols[i].in_use)
+            vol = &flashfs_vols[i];
+    }
+    if (!vol)
+        return 0;
+    if (vol->in_use) {
+#if CONFIG_FLASHFS_LOG && CONFIG_BLKCACHE
+        int ret = blkcache_dev_release(&vol->cache);
+        if (ret < 0)
+            return ret;
+#endif
+        flashfs_index_free(&vol->idx);
+#if CONFIG_FLASHFS_LOG
+        flashfs_log_unmount(&vol->log);
+#endif
+    }
+    vol->in_use = 1;
+    vol->ckpt = 0;
+    vol->jedec = jedec;
+#if CONFIG_FLASHFS_LOG
+    if (jedec) {
+        int ret = flashfs_volume_log_mount(vol);
+        if (ret < 0) {
+            vol->in_use = 0;
+            return ret;
+        }
+    }
+#endif
+    flashfs_index_init(&vol->idx, CONFIG_FLASHFS_INDEX_MAX);
+    flashfs_volume_io(vol, &io);
+
+#if CONFIG_FLASHFS_CHECKPOINT
+    if (jedec) {
+        uint32_t first = flashfs_ckpt_first(jedec);
+        if (flashfs_index_load(&vol->idx, &io, first, CONFIG_FLASHFS_CHECKPOINT_PAGES,
+                    flashfs_index_bmp_hash(&io)) == 0) {
+            vol->ckpt = 1;
+            return 0;
+        }
+        if (flashfs_index_scan(&vol->idx, &io) == 0 && flashfs_ckpt_reserve(jedec) == 0 &&
+                flashfs_index_store(&vol->idx, &io, first, CONFIG_FLASHFS_CHECKPOINT_PAGES,
+                    flashfs_index_bmp_hash(&io)) == 0)
+            vol->ckpt = 1;
+        return 0;
+    }
+#endif
+    flashfs_index_scan(&vol->idx, &io);
+    return 0;
+}
+
+/* The volume changed: the checkpoint no longer describes it */
+static void flashfs_volume_changed(struct flashfs_volume *vol)
+{
+#if CONFIG_FLASHFS_CHECKPOINT
+    if (vol->ckpt) {
+        struct flashfs_index_io io;
+        flashfs_volume_io(vol, &io);
+        flashfs_index_invalidate(&io, flashfs_ckpt_first(vol->jedec));
+        vol->ckpt = 0;
+    }
+#else
+    (void)vol;
+#endif
+}
+
 static int get_page_count_on_flash(const char *filename, uint16_t sz)
 {
     uint16_t first_cap = FLASH_PAGE_SIZE - (sizeof(struct flashfs_file_hdr) + strlen(filename) + 1);
@@ -461,27 +943,31 @@ static int flash_commit_file_info(struct fnode *fno)
     return 0;
 }
 
+/* Called with the volume locked, see flashfs_enter() */
 static int relocate_file(struct fnode *fno, uint16_t newpage,
         uint16_t old_page_count, uint16_t new_page_count)
 {
     struct flashfs_fnode *mfno;
+    struct flashfs_volume *vol;
     struct flashfs_file_hdr *hdr; 
     uint8_t page_cache[FLASH_PAGE_SIZE];
+    char relpath[MAX_FNAME];
+    int pathlen;
     int i;
 
     mfno = FNO_MOD_PRIV(fno, &mod_flashfs);
     if (!mfno)
         return -ENOENT;
+    pathlen = flashfs_build_relpath(fno, relpath, MAX_FNAME);
+    if (pathlen < 0)
+        return -ENAMETOOLONG;
 
-    mutex_lock(flashfs_lock);
     for (i = 0; i < old_page_count; i++)
     {
         if (flashfs_read_page(mfno->jedec, mfno->startpage + i, page_cache) < 0) {
-            mutex_unlock(flashfs_lock);
             return -EIO;
         }
         if (flashfs_write_page(mfno->jedec, newpage + i, page_cache) != 0) {
-            mutex_unlock(flashfs_lock);
             return -EIO;
         }
     } 
@@ -489,29 +975,30 @@ static int relocate_file(struct fnode *fno, uint16_t newpage,
     for (i = old_page_count; i < new_page_count; i++)
     {
         if (flashfs_write_page(mfno->jedec, newpage + i, page_cache) != 0) {
-            mutex_unlock(flashfs_lock);
             return -EIO;
         }
     }
     for (i = 0; i < new_page_count; i++)  {
         if (fs_bmp_set(mfno->jedec, newpage + i) != 0) {
-            mutex_unlock(flashfs_lock);
             return -EIO;
         }
     }
     for (i = 0; i < old_page_count; i++) {
         if (fs_bmp_clear(mfno->jedec, mfno->startpage + i) != 0) {
-            mutex_unlock(flashfs_lock);
             return -EIO;
         }
     }
+    vol = flashfs_volume_of(mfno->jedec);
+    if (vol) {
+        flashfs_index_move(&vol->idx, relpath, pathlen, mfno->startpage, newpage);
+        flashfs_volume_changed(vol);
+    }
     mfno->startpage = newpage;
-    mutex_unlock(flashfs_lock);
     return 0;
 }
 
 
-static int flashfs_read(struct fnode *fno, void *buf, unsigned int len)
+static int flashfs_read_locked(struct fnode *fno, void *buf, unsigned int len)
 {
     struct flashfs_fnode *mfno;
     uint32_t off;
@@ -548,7 +1035,7 @@ static int flashfs_read(struct fnode *fno, void *buf, unsigned int len)
                 size_in_page = len - take;
             if (mfno->jedec) {
                 uint32_t addr = mfno->startpage * FLASH_PAGE_SIZE + page_off;
-                if (jedec_spi_flash_read(mfno->jedec, addr, buf + take, size_in_page) < 0)
+                if (flashfs_jedec_read(mfno->jedec, addr, buf + take, size_in_page) < 0)
                     return take > 0 ? take : -EIO;
             } else {
                 memcpy(buf + take, get_page_content(mfno->startpage) + off,
@@ -565,7 +1052,7 @@ static int flashfs_read(struct fnode *fno, void *buf, unsigned int len)
                 size_in_page = len - take;
             if (mfno->jedec) {
                 uint32_t addr = (mfno->startpage + page_idx) * FLASH_PAGE_SIZE + page_off;
-                if (jedec_spi_flash_read(mfno->jedec, addr, buf + take, size_in_page) < 0)
+                if (flashfs_jedec_read(mfno->jedec, addr, buf + take, size_in_page) < 0)
                     return take > 0 ? take : -EIO;
             } else {
                 content = (uint8_t *)part_map_base +
@@ -580,8 +1067,19 @@ static int flashfs_read(struct fnode *fno, void *buf, unsigned int len)
     return take;
 }
 
+static int flashfs_read(struct fnode *fno, void *buf, unsigned int len)
+{
+    int ret = flashfs_enter();
 
-static int flashfs_write(struct fnode *fno, const void *buf, unsigned int len)
+    if (ret != 0)
+        return ret;
+    ret = flashfs_read_locked(fno, buf, len);
+    flashfs_leave();
+    return ret;
+}
+
+
+static int flashfs_write_locked(struct fnode *fno, const void *buf, unsigned int len)
 {
     struct flashfs_fnode *mfno;
     uint32_t off;
@@ -593,6 +1091,8 @@ static int flashfs_write(struct fnode *fno, const void *buf, unsigned int len)
     int first_cap;
     int cont_cap;
     char relpath[MAX_FNAME];
+    int grown = 0;
+    int hdr_done = 0;
     static uint8_t page_cache[FLASH_PAGE_SIZE];
 
     if (len <= 0)
@@ -626,28 +1126,25 @@ static int flashfs_write(struct fnode *fno, const void *buf, unsigned int len)
                         mfno = FNO_MOD_PRIV(fno, &mod_flashfs);
                         if (!mfno)
                             return -ENOENT;
+                        fno->size = off + len;
+                        grown = 1;
                         goto actual_write;
                     } else
                         return -ENOSPC;
                 } else {
-                    mutex_lock(flashfs_lock);
-                    if (fs_bmp_set(mfno->jedec, mfno->startpage + old_page_count + i) != 0) {
-                        mutex_unlock(flashfs_lock);
+                    if (fs_bmp_set(mfno->jedec, mfno->startpage + old_page_count + i) != 0)
                         return -EIO;
-                    }
-                    mutex_unlock(flashfs_lock);
                 }
             }
         }
         fno->size = off + len;
+        grown = 1;
     }
 
 actual_write:
-    mutex_lock(flashfs_lock);
     while (written < len) {
         if (off < (uint32_t)first_cap) {
             if (flashfs_read_page(mfno->jedec, mfno->startpage, page_cache) < 0) {
-                mutex_unlock(flashfs_lock);
                 return -EIO;
             }
             page_off = off + sizeof(struct flashfs_file_hdr) + fname_len + 1;
@@ -655,11 +1152,17 @@ actual_write:
             if (size_in_page > len - written)
                 size_in_page = len - written;
             memcpy(page_cache + page_off, buf + written, size_in_page);
+            /* The header shares this page: when it also holds the end of
+             * the write, update the size in the same write. Otherwise the
+             * size is committed last, once every page is on flash. */
+            if (grown && (written + size_in_page == len)) {
+                ((struct flashfs_file_hdr *)page_cache)->fsize = fno->size;
+                hdr_done = 1;
+            }
             written += size_in_page;
             off += size_in_page;
             ret = flashfs_write_page(mfno->jedec, mfno->startpage, page_cache);
             if (ret != 0) {
-                mutex_unlock(flashfs_lock);
                 return ret;
             }
         } else {
@@ -668,7 +1171,6 @@ actual_write:
             page_off = sizeof(struct flashfs_file_hdr) + data_off % cont_cap;
             if (flashfs_read_page(mfno->jedec, mfno->startpage + current_page_n,
                         page_cache) < 0) {
-                mutex_unlock(flashfs_lock);
                 return -EIO;
             }
             size_in_page = FLASH_PAGE_SIZE - page_off;
@@ -679,26 +1181,39 @@ actual_write:
             off += size_in_page;
             ret = flashfs_write_page(mfno->jedec, mfno->startpage + current_page_n, page_cache);
             if (ret != 0) {
-                mutex_unlock(flashfs_lock);
                 return ret;
             }
         }
     }
     task_fd_set_off(fno, off);
-    ret = flash_commit_file_info(fno);
-    mutex_unlock(flashfs_lock);
+    /* Overwrites leave the header alone */
+    if (grown && !hdr_done)
+        ret = flash_commit_file_info(fno);
+    else
+        ret = 0;
     if (ret != 0)
         return ret;
     return len;
 }
 
+static int flashfs_write(struct fnode *fno, const void *buf, unsigned int len)
+{
+    int ret = flashfs_enter();
+
+    if (ret != 0)
+        return ret;
+    ret = flashfs_write_locked(fno, buf, len);
+    flashfs_leave();
+    return ret;
+}
+
 static int flashfs_poll(struct fnode *fno, uint16_t events, uint16_t *revents)
 {
     *revents = events;
     return 1;
 }
 
-static int flashfs_seek(struct fnode *fno, int off, int whence)
+static int flashfs_seek_locked(struct fnode *fno, int off, int whence)
 {
     struct flashfs_fnode *mfno;
     int new_off;
@@ -742,28 +1257,64 @@ static int flashfs_seek(struct fnode *fno, int off, int whence)
                 }
             }
         }
-        mutex_lock(flashfs_lock);
         fno->size = new_off;
-        if (flash_commit_file_info(fno) != 0) {
-            mutex_unlock(flashfs_lock);
+        if (flash_commit_file_info(fno) != 0)
             return -EIO;
-        }
-        mutex_unlock(flashfs_lock);
     }
     task_fd_set_off(fno, new_off);
     return new_off;
 }
 
+static int flashfs_seek(struct fnode *fno, int off, int whence)
+{
+    int ret = flashfs_enter();
+
+    if (ret != 0)
+        return ret;
+    ret = flashfs_seek_locked(fno, off, whence);
+    flashfs_leave();
+    return ret;
+}
+
+/* Write back the pages the block cache still holds for this volume */
+static int flashfs_fsync(struct fnode *fno)
+{
+    struct flashfs_fnode *mfno;
+    mfno = FNO_MOD_PRIV(fno, &mod_flashfs);
+    if (!mfno)
+        return -ENOENT;
+#if CONFIG_BLKCACHE
+    if (mfno->jedec) {
+        struct blkcache_dev *cache = flashfs_cache(mfno->jedec);
+        int ret = cache ? blkcache_flush(cache) : 0;
+        if (ret == SYS_CALL_AGAIN)
+            return ret;
+        if (ret < 0)
+            return -EIO;
+    }
+#endif
+    return 0;
+}
+
 static int flashfs_close(struct fnode *fno)
 {
     struct flashfs_fnode *mfno;
+    int ret = 0;
     mfno = FNO_MOD_PRIV(fno, &mod_flashfs);
     if (!mfno)
         return -1;
-    return 0;
+#if CONFIG_BLKCACHE
+    /* close() cannot be restarted: with the cache busy, the blocks are
+     * left to the flush thread */
+    if (mfno->jedec && blkcache_trylock() == 0) {
+        ret = flashfs_fsync(fno);
+        blkcache_unlock();
+    }
+#endif
+    return ret;
 }
 
-static int flashfs_creat(struct fnode *fno)
+static int flashfs_creat_locked(struct fnode *fno)
 {
     struct flashfs_fnode *mfs;
     const struct jedec_spi_flash *jedec = NULL;
@@ -780,8 +1331,13 @@ static int flashfs_creat(struct fnode *fno)
     jedec = flashfs_find_jedec(fno);
 #ifdef CONFIG_JEDEC_SPI_FLASH
     /* JEDEC-backed mounts are read-only here; writing would corrupt the
-     * backing image with zero-byte placeholder headers. */
+     * backing image with zero-byte placeholder headers. Log volumes only
+     * append, so they take new files. */
+#if CONFIG_FLASHFS_LOG
+    if (jedec && !flashfs_log_volume(jedec))
+#else
     if (jedec)
+#endif
         return -EROFS;
 #endif
 
@@ -794,13 +1350,10 @@ static int flashfs_creat(struct fnode *fno)
     if (first_page < 0)
         return -ENOSPC;
 
-    mutex_lock(flashfs_lock);
     page = first_page;
     while (page < first_page + page_count) {
-        if (fs_bmp_set(jedec, page++) != 0) {
-            mutex_unlock(flashfs_lock);
+        if (fs_bmp_set(jedec, page++) != 0)
             return -EIO;
-        }
     }
 
     mfs = pool_alloc(&flashfs_fnode_pool);
@@ -813,19 +1366,33 @@ static int flashfs_creat(struct fnode *fno)
 #endif
         fno->priv = mfs;
         if (flash_commit_file_info(fno) == 0) {
-            mutex_unlock(flashfs_lock);
+            struct flashfs_volume *vol = flashfs_volume_of(jedec);
+            if (vol) {
+                flashfs_index_insert(&vol->idx, relpath, pathlen, first_page);
+                flashfs_volume_changed(vol);
+            }
             return 0;
         }
-        mutex_unlock(flashfs_lock);
         return -EIO;
     }
-    mutex_unlock(flashfs_lock);
     return -1;
 }
 
-static int flashfs_unlink(struct fnode *fno)
+static int flashfs_creat(struct fnode *fno)
+{
+    int ret = flashfs_enter();
+
+    if (ret != 0)
+        return ret;
+    ret = flashfs_creat_locked(fno);
+    flashfs_leave();
+    return ret;
+}
+
+static int flashfs_unlink_locked(struct fnode *fno)
 {
     struct flashfs_fnode *mfno;
+    struct flashfs_volume *vol;
     int page, page_count;
     char relpath[MAX_FNAME];
     int pathlen;
@@ -843,11 +1410,27 @@ static int flashfs_unlink(struct fnode *fno)
         if (fs_bmp_clear(mfno->jedec, page++) != 0)
             return -EIO;
     }
+    vol = flashfs_volume_of(mfno->jedec);
+    if (vol) {
+        flashfs_index_remove(&vol->idx, relpath, pathlen, mfno->startpage);
+        flashfs_volume_changed(vol);
+    }
     kfree(mfno);
     return 0;
 }
 
-static int flashfs_truncate(struct fnode *fno, unsigned int newsize)
+static int flashfs_unlink(struct fnode *fno)
+{
+    int ret = flashfs_enter();
+
+    if (ret != 0)
+        return ret;
+    ret = flashfs_unlink_locked(fno);
+    flashfs_leave();
+    return ret;
+}
+
+static int flashfs_truncate_locked(struct fnode *fno, unsigned int newsize)
 {
     struct flashfs_fnode *mfno;
     int old_page_count, new_page_count;
@@ -872,6 +1455,17 @@ static int flashfs_truncate(struct fnode *fno, unsigned int newsize)
     return -EFAULT;
 }
 
+static int flashfs_truncate(struct fnode *fno, unsigned int newsize)
+{
+    int ret = flashfs_enter();
+
+    if (ret != 0)
+        return ret;
+    ret = flashfs_truncate_locked(fno, newsize);
+    flashfs_leave();
+    return ret;
+}
+
 /*
  * Read the header and filename for `page` into caller-provided buffers.
  * Returns 1 if the page holds a valid entry (file or directory), 2 for a
@@ -1018,6 +1612,7 @@ static int flashfs_mount(char *source, char *tgt, uint32_t flags, void *arg)
     struct fnode *tgt_dir = NULL;
 #ifdef CONFIG_JEDEC_SPI_FLASH
     const struct jedec_spi_flash *jedec = NULL;
+    int ret;
 #endif
     (void)flags;
     (void)arg;
@@ -1040,24 +1635,23 @@ static int flashfs_mount(char *source, char *tgt, uint32_t flags, void *arg)
     if (!tgt_dir || ((tgt_dir->flags & FL_DIR) == 0))
         return -ENOTDIR;
 
-    tgt_dir->owner = &mod_flashfs;
 #ifdef CONFIG_JEDEC_SPI_FLASH
+    ret = flashfs_enter();
+    if (ret != 0)
+        return ret;
+    ret = flashfs_volume_mount(jedec);
+    flashfs_leave();
+    if (ret < 0)
+        return ret;
     tgt_dir->priv = (void *)jedec;
 #else
+    flashfs_volume_mount(NULL);
     tgt_dir->priv = NULL;
 #endif
+    tgt_dir->owner = &mod_flashfs;
     return 0;
 }
 
-/*
- * Single-page bitmap cache used by scan loops (lookup / readdir).
- * The tag pairs (jedec pointer, bitmap flash-page number) uniquely identify
- * the cached content.
- */
-static uint8_t flashfs_bmp_cache[FLASH_PAGE_SIZE];
-static const struct jedec_spi_flash *flashfs_bmp_cache_jedec;
-static uint32_t flashfs_bmp_cache_page = 0xFFFFFFFFu;
-
 /*
  * On-demand page_used probe. Keeps one bitmap page cached across calls,
  * so sequential scans don't thrash the backing store.
@@ -1178,24 +1772,113 @@ static int flashfs_attach_file(struct fnode *fno,
     return 0;
 }
 
+#define FLASHFS_ENTRY_PREFIX 3  /* directory inferred from the paths below it */
+
+/*
+ * Linear scan of the bitmap + headers for "target". Returns the kind of
+ * match (FLASHFS_ENTRY_*) with its page, header and full name, or 0 if the
+ * name is not present in the mount.
+ */
+static int flashfs_lookup_scan(const struct jedec_spi_flash *jedec, const char *target,
+        int tlen, uint32_t *out_page, struct flashfs_file_hdr *hdr, char *fname)
+{
+    uint32_t max_pages = flashfs_usable_pages(jedec);
+    uint32_t page;
+
+    for (page = 0; page < max_pages; page++) {
+        int used = flashfs_page_used(jedec, page);
+        int rc;
+        int cmp;
+        if (used < 0)
+            return 0;
+        if (!used)
+            continue;
+        rc = flashfs_read_entry(jedec, page, hdr, fname);
+        if (rc <= 0)
+            continue;
+
+        /* Sorted layout lets us short-circuit once we're past the target
+         * window. "target" < "target/..." bytewise (NUL < '/'), so the
+         * first entry with fname[0..tlen-1] > target terminates the scan. */
+        cmp = strncmp(fname, target, tlen);
+        if (cmp > 0)
+            break;
+        if (cmp == 0 && fname[tlen] != '\0' && fname[tlen] != '/')
+            break;
+        if (cmp < 0)
+            continue;
+
+        *out_page = page;
+        /* Exact name match — could be a FILE entry or a DIR entry. */
+        if (fname[tlen] == '\0')
+            return rc;
+
+        /* Fallback prefix match: an older image that pre-dates explicit
+         * DIR entries can still be walked by inferring directories from
+         * the file paths underneath them. */
+        if (fname[tlen] == '/')
+            return FLASHFS_ENTRY_PREFIX;
+    }
+    return 0;
+}
+
 /*
- * Lazy lookup: scan the on-flash bitmap + headers for a file whose on-flash
- * path matches "<dir_relpath>/<name>" (or just "<name>" if dir is the mount
- * point). If no exact file match but some file lives under that name as a
- * directory prefix, synthesise a directory fnode. Returns NULL if the name
- * is not present in the mount.
+ * Index lookup: every candidate with the hash of "target" is confirmed by
+ * reading its entry back. Same results as flashfs_lookup_scan(), or -1
+ * when the index cannot tell and the caller has to scan.
+ */
+static int flashfs_lookup_index(const struct jedec_spi_flash *jedec,
+        const struct flashfs_index *idx, const char *target, int tlen,
+        uint32_t *out_page, struct flashfs_file_hdr *hdr, char *fname)
+{
+    const struct flashfs_index_ent *e;
+    uint32_t hash = flashfs_hash(target, tlen);
+    uint32_t pos = 0;
+    int unsure = !idx->complete;
+
+    while ((e = flashfs_index_next(idx, hash, &pos)) != NULL) {
+        int rc;
+        if (e->page == FLASHFS_INDEX_NOPAGE) {
+            unsure = 1;
+            continue;
+        }
+        if (flashfs_page_used(jedec, e->page) <= 0)
+            continue;
+        rc = flashfs_read_entry(jedec, e->page, hdr, fname);
+        if (rc <= 0 || strncmp(fname, target, tlen) != 0)
+            continue;
+        if (!e->refs && fname[tlen] == '\0') {
+            *out_page = e->page;
+            return rc;
+        }
+        if (e->refs && fname[tlen] == '/') {
+            *out_page = e->page;
+            return FLASHFS_ENTRY_PREFIX;
+        }
+    }
+    return unsure ? -1 : 0;
+}
+
+/*
+ * Lazy lookup: find the on-flash entry whose path matches
+ * "<dir_relpath>/<name>" (or just "<name>" if dir is the mount point),
+ * through the volume index or, failing that, a scan. If no exact file
+ * match but some file lives under that name as a directory prefix,
+ * synthesise a directory fnode. Returns NULL if the name is not present
+ * in the mount.
  */
 static struct fnode *flashfs_lookup(struct fnode *dir, const char *name)
 {
     const struct jedec_spi_flash *jedec;
+    struct flashfs_volume *vol;
     char dir_path[MAX_FNAME + 1];
     char target[MAX_FNAME + 1];
     char fname[MAX_FNAME + 1];
     struct flashfs_file_hdr hdr;
-    uint32_t max_pages;
-    uint32_t page;
+    uint32_t page = 0;
     int dlen;
     int tlen;
+    int rc = -1;
     struct fnode *fno;
 
     if (!dir || !name)
@@ -1222,69 +1905,35 @@ static struct fnode *flashfs_lookup(struct fnode *dir, const char *name)
     }
 
     jedec = flashfs_jedec_for(dir);
-    max_pages = flashfs_usable_pages(jedec);
+    vol = flashfs_volume_of(jedec);
+    if (vol)
+        rc = flashfs_lookup_index(jedec, &vol->idx, target, tlen, &page, &hdr, fname);
+    if (rc < 0)
+        rc = flashfs_lookup_scan(jedec, target, tlen, &page, &hdr, fname);
+    if (rc == 0)
+        return NULL;
 
-    for (page = 0; page < max_pages; page++) {
-        int used = flashfs_page_used(jedec, page);
-        int rc;
-        int cmp;
-        if (used < 0)
+    if (rc == FLASHFS_ENTRY_FILE) {
+        fno = flashfs_create_cached(dir, name, 0);
+        if (!fno)
+            return NULL;
+        if (flashfs_attach_file(fno, jedec, page, hdr.fsize,
+                    (int)strlen(fname)) < 0) {
+            fno_detach(fno);
             return NULL;
-        if (!used)
-            continue;
-        rc = flashfs_read_entry(jedec, page, &hdr, fname);
-        if (rc <= 0)
-            continue;
-
-        /* Sorted layout lets us short-circuit once we're past the target
-         * window. "target" < "target/..." bytewise (NUL < '/'), so the
-         * first entry with fname[0..tlen-1] > target terminates the scan. */
-        cmp = strncmp(fname, target, tlen);
-        if (cmp > 0)
-            break;
-        if (cmp == 0 && fname[tlen] != '\0' && fname[tlen] != '/')
-            break;
-        if (cmp < 0)
-            continue;
-
-        /* Exact name match — could be a FILE entry or a DIR entry. */
-        if (fname[tlen] == '\0') {
-            if (rc == FLASHFS_ENTRY_DIR) {
-                fno = flashfs_create_cached(dir, name, 1);
-                if (!fno)
-                    return NULL;
-#ifdef CONFIG_JEDEC_SPI_FLASH
-                if (jedec)
-                    fno->flags |= FL_RDONLY;
-#endif
-                return fno;
-            }
-            fno = flashfs_create_cached(dir, name, 0);
-            if (!fno)
-                return NULL;
-            if (flashfs_attach_file(fno, jedec, page, hdr.fsize,
-                        (int)strlen(fname)) < 0) {
-                fno_detach(fno);
-                return NULL;
-            }
-            return fno;
         }
+        return fno;
+    }
 
-        /* Fallback prefix match: an older image that pre-dates explicit
-         * DIR entries can still be walked by inferring directories from
-         * the file paths underneath them. */
-        if (fname[tlen] == '/') {
-            fno = flashfs_create_cached(dir, name, 1);
-            if (!fno)
-                return NULL;
+    /* FLASHFS_ENTRY_DIR or FLASHFS_ENTRY_PREFIX */
+    fno = flashfs_create_cached(dir, name, 1);
+    if (!fno)
+        return NULL;
 #ifdef CONFIG_JEDEC_SPI_FLASH
-            if (jedec)
-                fno->flags |= FL_RDONLY;
+    if (jedec)
+        fno->flags |= FL_RDONLY;
 #endif
-            return fno;
-        }
-    }
-    return NULL;
+    return fno;
 }
 
 /*
@@ -1310,7 +1959,7 @@ static int flashfs_readdir_last_len;
  * DIR entry for "dir_path/child") handles older images that pre-date the
  * DIR-entry encoding; it uses a single-element dedup guard.
  */
-static int flashfs_readdir(struct fnode *dir, uint32_t *cursor,
+static int flashfs_readdir_locked(struct fnode *dir, uint32_t *cursor,
         struct dirent *ep)
 {
     const struct jedec_spi_flash *jedec;
@@ -1399,12 +2048,27 @@ static int flashfs_readdir(struct fnode *dir, uint32_t *cursor,
     return -1;
 }
 
+static int flashfs_readdir(struct fnode *dir, uint32_t *cursor, struct dirent *ep)
+{
+    int ret = flashfs_enter();
+
+    if (ret != 0)
+        return ret;
+    ret = flashfs_readdir_locked(dir, cursor, ep);
+    flashfs_leave();
+    return ret;
+}
+
 static int flashfs_mount_info(struct fnode *fno, char *buf, int len)
 {
     const char *desc = "NVM (internal flash): small config and log files";
 #ifdef CONFIG_JEDEC_SPI_FLASH
     if (fno && fno->priv)
         desc = "SPI NOR flash (external): mounted via /dev/spiflash0";
+#endif
+#if CONFIG_FLASHFS_LOG
+    if (fno && flashfs_log_volume(fno->priv))
+        desc = "SPI NOR flash (external, log-structured): mounted via /dev/spiflash0";
 #endif
     if (len < 0)
         return -1;
@@ -1459,7 +2123,7 @@ static int flashfs_mount_stat(struct fnode *mnt, struct fs_usage *out)
     return 0;
 }
 
-void flashfs_init(void)
+int flashfs_init(void)
 {
     pool_init(&flashfs_fnode_pool);
     mod_flashfs.family = FAMILY_FILE;
@@ -1494,10 +2158,15 @@ void flashfs_init(void)
     mod_flashfs.ops.creat = flashfs_creat;
     mod_flashfs.ops.unlink = flashfs_unlink;
     mod_flashfs.ops.close = flashfs_close;
+    mod_flashfs.ops.fsync = flashfs_fsync;
     mod_flashfs.ops.truncate = flashfs_truncate;
     mod_flashfs.ops.lookup = flashfs_lookup;
     mod_flashfs.ops.readdir = flashfs_readdir;
     register_module(&mod_flashfs);
+#if defined(CONFIG_JEDEC_SPI_FLASH) && CONFIG_FLASHFS_LOG
+    flashfs_gc_task = kthread_create(flashfs_gc_thread, NULL);
+#endif
+    return 0;
 }
 
 /*
@@ -0,0 +1,484 @@
+/*
+ *      This file is part of frosted.
+ *
+ *      frosted is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License version 2, as
+ *      published by the Free Software Foundation.
+ *
+ *
+ *      frosted is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with frosted.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * FlashFS directory index.
+ *
+ * Open addressing hash table (linear probing) from the FNV-1a hash of an
+ * on-flash relative path to the first page of its entry. Only hashes are
+ * kept in RAM: flashfs confirms a hit by reading the entry name back from
+ * flash, so a lookup costs one page read instead of a scan of the whole
+ * partition.
+ *
+ * The table can be checkpointed into a few reserved pages so that large
+ * (external) volumes do not need a full scan at every mount. Checkpoint
+ * pages start with fname_len == 0, which entry scans already skip.
+ */
+
+#include "frosted.h"
+#include "flashfs_index.h"
+#include <string.h>
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME  16777619u
+
+#define INDEX_MIN_SIZE 32
+
+#define CKPT_MAGIC 0x58444946u /* "FIDX" */
+
+struct __attribute__((packed)) flashfs_ckpt_hdr {
+    uint16_t fname_len;     /* always 0: not a file entry */
+    uint16_t seq;           /* page number within the checkpoint */
+};
+
+struct __attribute__((packed)) flashfs_ckpt_info {
+    uint32_t magic;
+    uint32_t bmp_hash;      /* allocation bitmap the index was built from */
+    uint32_t count;
+    uint32_t hash;          /* over the stored entries */
+};
+
+#define CKPT_FIRST_ENTS ((FLASH_PAGE_SIZE - sizeof(struct flashfs_ckpt_hdr) - \
+            sizeof(struct flashfs_ckpt_info)) / sizeof(struct flashfs_index_ent))
+#define CKPT_PAGE_ENTS  ((FLASH_PAGE_SIZE - sizeof(struct flashfs_ckpt_hdr)) / \
+            sizeof(struct flashfs_index_ent))
+
+static inline uint32_t fnv_step(uint32_t h, uint8_t c)
+{
+    return (h ^ c) * FNV_PRIME;
+}
+
+/* 0 marks a free slot */
+static inline uint32_t fnv_final(uint32_t h)
+{
+    return h ? h : 1;
+}
+
+static uint32_t fnv_update(uint32_t h, const void *data, uint32_t len)
+{
+    const uint8_t *p = data;
+
+    while (len--)
+        h = fnv_step(h, *p++);
+    return h;
+}
+
+uint32_t flashfs_hash(const void *data, uint32_t len)
+{
+    return fnv_final(fnv_update(FNV_OFFSET, data, len));
+}
+
+void flashfs_index_init(struct flashfs_index *idx, uint32_t max)
+{
+    memset(idx, 0, sizeof(*idx));
+    idx->max = max;
+}
+
+void flashfs_index_free(struct flashfs_index *idx)
+{
+    if (idx->tab)
+        kfree(idx->tab);
+    idx->tab = NULL;
+    idx->size = 0;
+    idx->count = 0;
+    idx->complete = 0;
+}
+
+static void index_put(struct flashfs_index_ent *tab, uint32_t size,
+        const struct flashfs_index_ent *e)
+{
+    uint32_t slot = e->hash & (size - 1);
+
+    while (tab[slot].hash)
+        slot = (slot + 1) & (size - 1);
+    tab[slot] = *e;
+}
+
+static int index_grow(struct flashfs_index *idx)
+{
+    uint32_t size = idx->size ? idx->size * 2 : INDEX_MIN_SIZE;
+    struct flashfs_index_ent *tab;
+    uint32_t i;
+
+    tab = kalloc(size * sizeof(*tab));
+    if (!tab)
+        return -ENOMEM;
+    memset(tab, 0, size * sizeof(*tab));
+    for (i = 0; i < idx->size; i++) {
+        if (idx->tab[i].hash)
+            index_put(tab, size, &idx->tab[i]);
+    }
+    if (idx->tab)
+        kfree(idx->tab);
+    idx->tab = tab;
+    idx->size = size;
+    return 0;
+}
+
+/* Keep the load factor under 3/4 */
+static int index_add(struct flashfs_index *idx, const struct flashfs_index_ent *e)
+{
+    if (idx->count >= idx->max)
+        return -ENOSPC;
+    if ((idx->count + 1) * 4 > idx->size * 3 && index_grow(idx) < 0)
+        return -ENOMEM;
+    index_put(idx->tab, idx->size, e);
+    idx->count++;
+    return 0;
+}
+
+/* Backward shift deletion: no tombstones, probe chains stay short */
+static void index_del(struct flashfs_index *idx, struct flashfs_index_ent *e)
+{
+    uint32_t mask = idx->size - 1;
+    uint32_t hole = (uint32_t)(e - idx->tab);
+    uint32_t slot = hole;
+
+    for (;;) {
+        uint32_t home;
+
+        slot = (slot + 1) & mask;
+        if (!idx->tab[slot].hash)
+            break;
+        home = idx->tab[slot].hash & mask;
+        /* Move the entry back unless its home lies in (hole, slot] */
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            idx->tab[hole] = idx->tab[slot];
+            hole = slot;
+        }
+    }
+    idx->tab[hole].hash = 0;
+    idx->count--;
+}
+
+const struct flashfs_index_ent *flashfs_index_next(const struct flashfs_index *idx,
+        uint32_t hash, uint32_t *pos)
+{
+    while (idx->size && *pos < idx->size) {
+        const struct flashfs_index_ent *e =
+            &idx->tab[(hash + *pos) & (idx->size - 1)];
+        if (!e->hash)
+            break;
+        (*pos)++;
+        if (e->hash == hash)
+            return e;
+    }
+    return NULL;
+}
+
+/* refs == 0 selects the on-flash entry at 'page', otherwise any implicit
+ * directory with that hash. */
+static struct flashfs_index_ent *index_find(struct flashfs_index *idx, uint32_t hash,
+        int implicit, uint16_t page)
+{
+    const struct flashfs_index_ent *e;
+    uint32_t pos = 0;
+
+    while ((e = flashfs_index_next(idx, hash, &pos)) != NULL) {
+        if (implicit && e->refs)
+            return (struct flashfs_index_ent *)e;
+        if (!implicit && !e->refs && e->page == page)
+            return (struct flashfs_index_ent *)e;
+    }
+    return NULL;
+}
+
+int flashfs_index_insert(struct flashfs_index *idx, const char *path, uint32_t len,
+        uint16_t page)
+{
+    struct flashfs_index_ent e;
+    uint32_t h = FNV_OFFSET;
+    uint32_t i;
+
+    /* Count the file in every parent directory on the way */
+    for (i = 0; i < len; i++) {
+        if (path[i] == '/' && i > 0) {
+            struct flashfs_index_ent *d = index_find(idx, fnv_final(h), 1, 0);
+            if (d) {
+                d->refs++;
+                if (d->page == FLASHFS_INDEX_NOPAGE)
+                    d->page = page;
+            } else {
+                e.hash = fnv_final(h);
+                e.page = page;
+                e.refs = 1;
+                if (index_add(idx, &e) < 0)
+                    goto full;
+            }
+        }
+        h = fnv_step(h, (uint8_t)path[i]);
+    }
+    e.hash = fnv_final(h);
+    e.page = page;
+    e.refs = 0;
+    if (index_add(idx, &e) == 0)
+        return 0;
+full:
+    /* Misses can no longer be trusted: lookups fall back to scanning */
+    idx->complete = 0;
+    return -ENOSPC;
+}
+
+void flashfs_index_remove(struct flashfs_index *idx, const char *path, uint32_t len,
+        uint16_t page)
+{
+    struct flashfs_index_ent *e;
+    uint32_t h = FNV_OFFSET;
+    uint32_t i;
+
+    if (!idx->size)
+        return;
+    for (i = 0; i < len; i++) {
+        if (path[i] == '/' && i > 0) {
+            e = index_find(idx, fnv_final(h), 1, 0);
+            if (e && --e->refs == 0)
+                index_del(idx, e);
+            else if (e && e->page == page)
+                e->page = FLASHFS_INDEX_NOPAGE;
+        }
+        h = fnv_step(h, (uint8_t)path[i]);
+    }
+    e = index_find(idx, fnv_final(h), 0, page);
+    if (e)
+        index_del(idx, e);
+}
+
+void flashfs_index_move(struct flashfs_index *idx, const char *path, uint32_t len,
+        uint16_t old_page, uint16_t new_page)
+{
+    struct flashfs_index_ent *e;
+    uint32_t h = FNV_OFFSET;
+    uint32_t i;
+
+    if (!idx->size)
+        return;
+    for (i = 0; i < len; i++) {
+        if (path[i] == '/' && i > 0) {
+            e = index_find(idx, fnv_final(h), 1, 0);
+            if (e && e->page == old_page)
+                e->page = new_page;
+        }
+        h = fnv_step(h, (uint8_t)path[i]);
+    }
+    e = index_find(idx, fnv_final(h), 0, old_page);
+    if (e)
+        e->page = new_page;
+}
+
+static inline uint32_t io_bmp_pages(const struct flashfs_index_io *io)
+{
+    return (io->total_pages + BITS_PER_BMP_PAGE - 1) / BITS_PER_BMP_PAGE;
+}
+
+/*
+ * Build the index from flash: one header read per allocated page, the
+ * bitmap read once per BITS_PER_BMP_PAGE pages. Returns 0 when the table
+ * covers the whole volume, -ENOSPC if it hit the entry limit (the partial
+ * table still serves hits), -EIO on read errors.
+ */
+int flashfs_index_scan(struct flashfs_index *idx, const struct flashfs_index_io *io)
+{
+    uint8_t bmp[FLASH_PAGE_SIZE];
+    uint8_t entry[sizeof(struct flashfs_file_hdr) + MAX_FNAME + 1];
+    uint32_t bmp_count = io_bmp_pages(io);
+    uint32_t usable = io->total_pages - bmp_count;
+    uint32_t page = 0;
+
+    flashfs_index_free(idx);
+    idx->complete = 1;
+    while (page < usable) {
+        struct flashfs_file_hdr hdr;
+        const char *name = (const char *)entry + sizeof(hdr);
+        uint16_t name_len;
+
+        if ((page % BITS_PER_BMP_PAGE) == 0) {
+            uint32_t bp = usable + page / BITS_PER_BMP_PAGE;
+            if (io->read(io->dev, bp * FLASH_PAGE_SIZE, bmp, FLASH_PAGE_SIZE) < 0)
+                goto err;
+        }
+        /* Inverted bitmap: eight free pages at once */
+        if ((page & 7) == 0 && bmp[(page % BITS_PER_BMP_PAGE) / 8] == 0xFF) {
+            page += 8;
+            continue;
+        }
+        if (bmp[(page % BITS_PER_BMP_PAGE) / 8] & (1 << (page & 7))) {
+            page++;
+            continue;
+        }
+
+        if (io->read(io->dev, page * FLASH_PAGE_SIZE, entry, sizeof(entry)) < 0)
+            goto err;
+        memcpy(&hdr, entry, sizeof(hdr));
+        if (hdr.fname_len == 0xFFFF || hdr.fname_len == 0x0000 ||
+                hdr.fname_len == F_PREV_PAGE) {
+            page++;
+            continue;
+        }
+        name_len = hdr.fname_len & ~F_DIR_FLAG;
+        if (name_len == 0 || name_len > MAX_FNAME || name[name_len] != '\0' ||
+                memchr(name, '\0', name_len) != NULL) {
+            page++;
+            continue;
+        }
+        if (flashfs_index_insert(idx, name, name_len, (uint16_t)page) < 0)
+            return -ENOSPC;
+        page++;
+    }
+    return 0;
+
+err:
+    flashfs_index_free(idx);
+    return -EIO;
+}
+
+uint32_t flashfs_index_bmp_hash(const struct flashfs_index_io *io)
+{
+    uint8_t bmp[FLASH_PAGE_SIZE];
+    uint32_t bmp_count = io_bmp_pages(io);
+    uint32_t bp = io->total_pages - bmp_count;
+    uint32_t h = FNV_OFFSET;
+
+    for (; bp < io->total_pages; bp++) {
+        if (io->read(io->dev, bp * FLASH_PAGE_SIZE, bmp, FLASH_PAGE_SIZE) < 0)
+            return 0;
+        h = fnv_update(h, bmp, FLASH_PAGE_SIZE);
+    }
+    return fnv_final(h);
+}
+
+static uint32_t ckpt_capacity(uint32_t npages)
+{
+    if (npages == 0)
+        return 0;
+    return CKPT_FIRST_ENTS + (npages - 1) * CKPT_PAGE_ENTS;
+}
+
+/*
+ * Load a checkpoint written by flashfs_index_store(). It is only taken if
+ * it was stored against the same allocation bitmap; any allocation change
+ * since then (by this kernel or an older one) forces a scan.
+ */
+int flashfs_index_load(struct flashfs_index *idx, const struct flashfs_index_io *io,
+        uint32_t first, uint32_t npages, uint32_t bmp_hash)
+{
+    uint8_t buf[FLASH_PAGE_SIZE];
+    struct flashfs_ckpt_hdr hdr;
+    struct flashfs_ckpt_info info;
+    uint32_t left, off, p, h = FNV_OFFSET;
+
+    if (io->read(io->dev, first * FLASH_PAGE_SIZE, buf, FLASH_PAGE_SIZE) < 0)
+        return -EIO;
+    memcpy(&hdr, buf, sizeof(hdr));
+    memcpy(&info, buf + sizeof(hdr), sizeof(info));
+    if (hdr.fname_len != 0 || hdr.seq != 0 || info.magic != CKPT_MAGIC)
+        return -ENOENT;
+    if (info.bmp_hash != bmp_hash || info.count > idx->max ||
+            info.count > ckpt_capacity(npages))
+        return -ESTALE;
+
+    flashfs_index_free(idx);
+    left = info.count;
+    off = sizeof(hdr) + sizeof(info);
+    for (p = 0; left > 0; p++) {
+        if (p > 0) {
+            if (io->read(io->dev, (first + p) * FLASH_PAGE_SIZE, buf, FLASH_PAGE_SIZE) < 0)
+                goto err;
+            memcpy(&hdr, buf, sizeof(hdr));
+            if (hdr.fname_len != 0 || hdr.seq != p)
+                goto err;
+            off = sizeof(hdr);
+        }
+        while (left > 0 && off + sizeof(struct flashfs_index_ent) <= FLASH_PAGE_SIZE) {
+            struct flashfs_index_ent e;
+            memcpy(&e, buf + off, sizeof(e));
+            h = fnv_update(h, &e, sizeof(e));
+            if (!e.hash || index_add(idx, &e) < 0)
+                goto err;
+            off += sizeof(e);
+            left--;
+        }
+    }
+    if (fnv_final(h) != info.hash)
+        goto err;
+    idx->complete = 1;
+    return 0;
+
+err:
+    flashfs_index_free(idx);
+    return -EIO;
+}
+
+int flashfs_index_store(const struct flashfs_index *idx, const struct flashfs_index_io *io,
+        uint32_t first, uint32_t npages, uint32_t bmp_hash)
+{
+    uint8_t buf[FLASH_PAGE_SIZE];
+    struct flashfs_ckpt_hdr hdr;
+    struct flashfs_ckpt_info info;
+    uint32_t i, off, p = 0, h = FNV_OFFSET;
+
+    if (!idx->complete || idx->count > ckpt_capacity(npages) || !io->write_page)
+        return -ENOSPC;
+
+    for (i = 0; i < idx->size; i++) {
+        if (idx->tab[i].hash)
+            h = fnv_update(h, &idx->tab[i], sizeof(idx->tab[i]));
+    }
+    info.magic = CKPT_MAGIC;
+    info.bmp_hash = bmp_hash;
+    info.count = idx->count;
+    info.hash = fnv_final(h);
+
+    memset(buf, 0xFF, sizeof(buf));
+    hdr.fname_len = 0;
+    hdr.seq = 0;
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), &info, sizeof(info));
+    off = sizeof(hdr) + sizeof(info);
+    for (i = 0; i < idx->size; i++) {
+        if (!idx->tab[i].hash)
+            continue;
+        if (off + sizeof(idx->tab[i]) > FLASH_PAGE_SIZE) {
+            if (io->write_page(io->dev, first + p, buf) != 0)
+                return -EIO;
+            memset(buf, 0xFF, sizeof(buf));
+            hdr.seq = (uint16_t)++p;
+            memcpy(buf, &hdr, sizeof(hdr));
+            off = sizeof(hdr);
+        }
+        memcpy(buf + off, &idx->tab[i], sizeof(idx->tab[i]));
+        off += sizeof(idx->tab[i]);
+    }
+    if (io->write_page(io->dev, first + p, buf) != 0)
+        return -EIO;
+    return 0;
+}
+
+/* Drop the checkpoint once the volume changes: the page keeps its zero
+ * fname_len, only the magic goes. */
+int flashfs_index_invalidate(const struct flashfs_index_io *io, uint32_t first)
+{
+    uint8_t buf[FLASH_PAGE_SIZE];
+
+    if (!io->write_page)
+        return -EROFS;
+    memset(buf, 0xFF, sizeof(buf));
+    memset(buf, 0, sizeof(struct flashfs_ckpt_hdr));
+    if (io->write_page(io->dev, first, buf) != 0)
+        return -EIO;
+    return 0;
+}
@@ -0,0 +1,465 @@
+/*
+ *      This file is part of frosted.
+ *
+ *      frosted is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License version 2, as
+ *      published by the Free Software Foundation.
+ *
+ *
+ *      frosted is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with frosted.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * FlashFS log-structured page store.
+ *
+ * Writing a flashfs page in place on NOR flash means erasing and
+ * reprogramming the whole erase sector around it whenever a bit has to go
+ * from 0 to 1, which is nearly every header update. In a log volume every
+ * logical page write is instead programmed into the next erased page of
+ * the head sector and its logical page number is then programmed into the
+ * tag table of that sector's header. The newest copy of a page (highest
+ * sector seq, then highest slot) is the live one; the RAM map is rebuilt
+ * from the tag tables at mount.
+ *
+ * When free sectors run low, garbage collection copies the live pages out
+ * of the sector with the fewest of them and erases it. Appends go to the
+ * least worn free sector, and once the erase count spread exceeds
+ * FLASHFS_LOG_WEAR_DELTA the least worn used sector is collected instead,
+ * so that cold data stops pinning it.
+ *
+ * Power loss: a page counts only once its tag is programmed, after the
+ * data; GC erases a sector only after its live pages were copied; a sector
+ * without a valid header is erased again before use.
+ */
+
+#include "frosted.h"
+#include "flashfs_log.h"
+#include <string.h>
+
+#define LOG_F_FREE  0x01    /* erased, header written, seq unset */
+#define LOG_F_DIRTY 0x02    /* no valid header: erase before use */
+
+#define LOG_MAX_SLOTS ((FLASH_PAGE_SIZE - FLASHFS_LOG_TAGS_OFF) / sizeof(uint16_t))
+
+static uint8_t log_page[FLASH_PAGE_SIZE];
+static uint16_t log_tags[LOG_MAX_SLOTS];
+
+static inline uint32_t log_pps(const struct flashfs_log *log)
+{
+    return (uint32_t)log->slots + 1;
+}
+
+static inline uint32_t log_sector_of(const struct flashfs_log *log, uint32_t ppage)
+{
+    return ppage / log_pps(log);
+}
+
+static inline uint32_t log_ppage(const struct flashfs_log *log, uint32_t s, uint32_t slot)
+{
+    return s * log_pps(log) + slot + 1;
+}
+
+static int log_geometry_valid(uint32_t sector_size, uint32_t sectors, uint32_t lpages)
+{
+    uint32_t slots = sector_size / FLASH_PAGE_SIZE - 1;
+
+    if (sector_size % FLASH_PAGE_SIZE || slots == 0 || slots > LOG_MAX_SLOTS)
+        return 0;
+    if (sectors <= FLASHFS_LOG_MIN_SPARE || sectors * (slots + 1) > 0xFFFF)
+        return 0;
+    return lpages > 0 && lpages <= (sectors - FLASHFS_LOG_MIN_SPARE) * slots;
+}
+
+static int log_write_header(const struct flashfs_log_io *io, uint32_t sector_size,
+        uint32_t s, uint32_t erase_count, uint16_t sectors, uint16_t lpages)
+{
+    struct flashfs_log_sect hdr;
+
+    hdr.magic = FLASHFS_LOG_MAGIC;
+    hdr.erase_count = erase_count;
+    hdr.seq = FLASHFS_LOG_FREE;
+    hdr.lpages = lpages;
+    hdr.sectors = sectors;
+    return io->program(io->dev, s * sector_size, &hdr, sizeof(hdr)) < 0 ? -EIO : 0;
+}
+
+static int log_erase(struct flashfs_log *log, uint32_t s)
+{
+    if (log->io.erase(log->io.dev, s * log->sector_size) < 0)
+        return -EIO;
+    log->erases[s]++;
+    log->stats.erases++;
+    if (log_write_header(&log->io, log->sector_size, s, log->erases[s],
+                log->sectors, log->lpages) < 0)
+        return -EIO;
+    log->flags[s] = LOG_F_FREE;
+    log->valid[s] = 0;
+    return 0;
+}
+
+static int log_gc_one(struct flashfs_log *log);
+
+/* Start appending to the least worn free sector. Outside of GC, the last
+ * FLASHFS_LOG_GC_RESERVE free sectors are only handed out after a
+ * collection. */
+static int log_open_head(struct flashfs_log *log, int gc)
+{
+    uint32_t s, best = log->sectors;
+    uint32_t seq;
+    int ret;
+
+    while (!gc && log->free <= FLASHFS_LOG_GC_RESERVE) {
+        ret = log_gc_one(log);
+        if (ret < 0)
+            return ret;
+    }
+    for (s = 0; s < log->sectors; s++) {
+        if ((log->flags[s] & (LOG_F_FREE | LOG_F_DIRTY)) &&
+                (best == log->sectors || log->erases[s] < log->erases[best]))
+            best = s;
+    }
+    if (best == log->sectors)
+        return -ENOSPC;
+    if ((log->flags[best] & LOG_F_DIRTY) && log_erase(log, best) < 0)
+        return -EIO;
+
+    seq = log->next_seq++;
+    if (log->io.program(log->io.dev, best * log->sector_size +
+                offsetof(struct flashfs_log_sect, seq), &seq, sizeof(seq)) < 0)
+        return -EIO;
+    log->flags[best] = 0;
+    log->free--;
+    log->head = (uint16_t)best;
+    log->head_slot = 0;
+    return 0;
+}
+
+static int log_append(struct flashfs_log *log, uint32_t lpage, const uint8_t *buf, int gc)
+{
+    uint32_t s, slot, p, old;
+    uint16_t tag = (uint16_t)lpage;
+    int ret;
+
+    if (log->head == log->sectors) {
+        ret = log_open_head(log, gc);
+        if (ret < 0)
+            return ret;
+    }
+    s = log->head;
+    slot = log->head_slot;
+    p = log_ppage(log, s, slot);
+    /* The slot is spent whatever happens next */
+    if (++log->head_slot == log->slots)
+        log->head = log->sectors;
+
+    if (log->io.program(log->io.dev, p * FLASH_PAGE_SIZE, buf, FLASH_PAGE_SIZE) < 0)
+        return -EIO;
+    if (log->io.program(log->io.dev, s * log->sector_size + FLASHFS_LOG_TAGS_OFF +
+                slot * sizeof(uint16_t), &tag, sizeof(tag)) < 0)
+        return -EIO;
+
+    old = log->map[lpage];
+    if (old != FLASHFS_LOG_NOPAGE)
+        log->valid[log_sector_of(log, old)]--;
+    log->map[lpage] = (uint16_t)p;
+    log->valid[s]++;
+    log->stats.programs++;
+    return 0;
+}
+
+/* Pick a victim: the used sector with the fewest live pages. While the
+ * wear spread is too wide, every eighth run takes the least worn one
+ * instead: that run frees nothing, so it must not come back to back. */
+static uint32_t log_pick_victim(const struct flashfs_log *log)
+{
+    uint32_t s, best = log->sectors, cold = log->sectors;
+    uint32_t max_erase = 0;
+
+    for (s = 0; s < log->sectors; s++) {
+        if (log->erases[s] > max_erase)
+            max_erase = log->erases[s];
+        if ((log->flags[s] & (LOG_F_FREE | LOG_F_DIRTY)) || s == log->head)
+            continue;
+        if (best == log->sectors || log->valid[s] < log->valid[best] ||
+                (log->valid[s] == log->valid[best] && log->erases[s] < log->erases[best]))
+            best = s;
+        if (cold == log->sectors || log->erases[s] < log->erases[cold])
+            cold = s;
+    }
+    if (cold != log->sectors && (log->stats.gc_runs & 7) == 0 &&
+            max_erase - log->erases[cold] > FLASHFS_LOG_WEAR_DELTA)
+        return cold;
+    if (best != log->sectors && log->valid[best] < log->slots)
+        return best;
+    return log->sectors;
+}
+
+static int log_gc_one(struct flashfs_log *log)
+{
+    uint32_t v = log_pick_victim(log);
+    uint32_t k;
+    int ret;
+
+    /* Only the head has stale pages left: give up its remaining slots */
+    if (v == log->sectors && log->head != log->sectors) {
+        log->head = log->sectors;
+        v = log_pick_victim(log);
+    }
+    if (v == log->sectors)
+        return -ENOSPC;
+
+    if (log->valid[v] > 0) {
+        if (log->io.read(log->io.dev, v * log->sector_size + FLASHFS_LOG_TAGS_OFF,
+                    log_tags, log->slots * sizeof(uint16_t)) < 0)
+            return -EIO;
+        for (k = 0; k < log->slots && log->valid[v] > 0; k++) {
+            uint32_t lp = log_tags[k];
+            uint32_t p = log_ppage(log, v, k);
+            if (lp >= log->lpages || log->map[lp] != p)
+                continue;
+            if (log->io.read(log->io.dev, p * FLASH_PAGE_SIZE, log_page, FLASH_PAGE_SIZE) < 0)
+                return -EIO;
+            ret = log_append(log, lp, log_page, 1);
+            if (ret < 0)
+                return ret;
+            log->stats.copies++;
+        }
+    }
+    ret = log_erase(log, v);
+    if (ret < 0)
+        return ret;
+    log->free++;
+    log->stats.gc_runs++;
+    return 0;
+}
+
+/* Erase 'sectors' sectors and write empty headers: a volume with every
+ * logical page unwritten (reads as 0xFF). */
+int flashfs_log_format(const struct flashfs_log_io *io, uint32_t sector_size,
+        uint16_t sectors, uint16_t lpages)
+{
+    uint32_t s;
+
+    if (!log_geometry_valid(sector_size, sectors, lpages))
+        return -EINVAL;
+    for (s = 0; s < sectors; s++) {
+        if (io->erase(io->dev, s * sector_size) < 0 ||
+                log_write_header(io, sector_size, s, 0, sectors, lpages) < 0)
+            return -EIO;
+    }
+    return 0;
+}
+
+/* First slot after the last tagged one that is still erased */
+static uint32_t log_resume_slot(struct flashfs_log *log, uint32_t s)
+{
+    uint32_t k, slot = 0, i;
+
+    for (k = 0; k < log->slots; k++) {
+        if (log_tags[k] != FLASHFS_LOG_NOPAGE)
+            slot = k + 1;
+    }
+    for (; slot < log->slots; slot++) {
+        if (log->io.read(log->io.dev, log_ppage(log, s, slot) * FLASH_PAGE_SIZE,
+                    log_page, FLASH_PAGE_SIZE) < 0)
+            return log->slots;
+        for (i = 0; i < FLASH_PAGE_SIZE && log_page[i] == 0xFF; i++)
+            ;
+        if (i == FLASH_PAGE_SIZE)
+            break;
+    }
+    return slot;
+}
+
+/*
+ * Mount a log volume: two header passes over all sectors, one for seq and
+ * erase counts, one for the tag tables. Returns -ENOENT if the device does
+ * not hold a log volume, -EFBIG if its map would exceed max_lpages.
+ */
+int flashfs_log_mount(struct flashfs_log *log, const struct flashfs_log_io *io,
+        uint32_t sector_size, uint32_t dev_sectors, uint32_t max_lpages)
+{
+    struct flashfs_log_sect hdr;
+    uint32_t *seqs;
+    uint32_t s, k, lp, last = 0, max_erase = 0, max_seq = 0;
+    uint8_t *block;
+
+    memset(log, 0, sizeof(*log));
+    log->io = *io;
+    log->sector_size = sector_size;
+
+    /* Only one sector can lack its header (GC erased it and lost power) */
+    for (s = 0; s < 2 && s < dev_sectors; s++) {
+        if (io->read(io->dev, s * sector_size, &hdr, sizeof(hdr)) < 0)
+            return -EIO;
+        if (hdr.magic == FLASHFS_LOG_MAGIC)
+            break;
+    }
+    if (s == 2 || s == dev_sectors)
+        return -ENOENT;
+    if (hdr.sectors > dev_sectors || !log_geometry_valid(sector_size, hdr.sectors, hdr.lpages))
+        return -EINVAL;
+    if (hdr.lpages > max_lpages)
+        return -EFBIG;
+
+    log->sectors = hdr.sectors;
+    log->lpages = hdr.lpages;
+    log->slots = (uint16_t)(sector_size / FLASH_PAGE_SIZE - 1);
+    log->head = log->sectors;
+    block = kalloc(log->sectors * (sizeof(uint32_t) + 2) + log->lpages * sizeof(uint16_t));
+    if (!block)
+        return -ENOMEM;
+    seqs = kalloc(log->sectors * sizeof(uint32_t));
+    if (!seqs) {
+        kfree(block);
+        return -ENOMEM;
+    }
+    log->erases = (uint32_t *)block;
+    log->map = (uint16_t *)(log->erases + log->sectors);
+    log->valid = (uint8_t *)(log->map + log->lpages);
+    log->flags = log->valid + log->sectors;
+    memset(log->map, 0xFF, log->lpages * sizeof(uint16_t));
+    memset(log->valid, 0, log->sectors * 2);
+
+    for (s = 0; s < log->sectors; s++) {
+        if (io->read(io->dev, s * sector_size, &hdr, sizeof(hdr)) < 0)
+            goto err;
+        seqs[s] = FLASHFS_LOG_FREE;
+        if (hdr.magic != FLASHFS_LOG_MAGIC || hdr.sectors != log->sectors ||
+                hdr.lpages != log->lpages) {
+            log->flags[s] = LOG_F_DIRTY;
+            continue;
+        }
+        log->erases[s] = hdr.erase_count;
+        if (hdr.erase_count > max_erase)
+            max_erase = hdr.erase_count;
+        if (hdr.seq == FLASHFS_LOG_FREE) {
+            log->flags[s] = LOG_F_FREE;
+            continue;
+        }
+        seqs[s] = hdr.seq;
+        if (hdr.seq >= max_seq) {
+            max_seq = hdr.seq;
+            last = s;
+        }
+    }
+
+    for (s = 0; s < log->sectors; s++) {
+        if (log->flags[s] & LOG_F_DIRTY)
+            log->erases[s] = max_erase;
+        if (log->flags[s]) {
+            log->free++;
+            continue;
+        }
+        if (io->read(io->dev, s * sector_size + FLASHFS_LOG_TAGS_OFF, log_tags,
+                    log->slots * sizeof(uint16_t)) < 0)
+            goto err;
+        for (k = 0; k < log->slots; k++) {
+            uint32_t cur;
+            lp = log_tags[k];
+            if (lp >= log->lpages)
+                continue;
+            cur = log->map[lp];
+            if (cur == FLASHFS_LOG_NOPAGE || log_sector_of(log, cur) == s ||
+                    seqs[log_sector_of(log, cur)] < seqs[s])
+                log->map[lp] = (uint16_t)log_ppage(log, s, k);
+        }
+        if (s == last) {
+            k = log_resume_slot(log, s);
+            if (k < log->slots) {
+                log->head = (uint16_t)s;
+                log->head_slot = (uint16_t)k;
+            }
+        }
+    }
+    for (lp = 0; lp < log->lpages; lp++) {
+        if (log->map[lp] != FLASHFS_LOG_NOPAGE)
+            log->valid[log_sector_of(log, log->map[lp])]++;
+    }
+    log->next_seq = max_seq + 1;
+    kfree(seqs);
+    return 0;
+
+err:
+    kfree(seqs);
+    kfree(block);
+    log->map = NULL;
+    return -EIO;
+}
+
+void flashfs_log_unmount(struct flashfs_log *log)
+{
+    if (log->map)
+        kfree(log->erases);
+    log->map = NULL;
+}
+
+/* Read through the map; unwritten logical pages read as erased flash */
+int flashfs_log_read(struct flashfs_log *log, uint32_t addr, void *buf, uint32_t len)
+{
+    uint8_t *dst = buf;
+
+    while (len > 0) {
+        uint32_t lp = addr / FLASH_PAGE_SIZE;
+        uint32_t off = addr % FLASH_PAGE_SIZE;
+        uint32_t chunk = FLASH_PAGE_SIZE - off;
+        uint32_t p;
+
+        if (lp >= log->lpages)
+            return -EINVAL;
+        if (chunk > len)
+            chunk = len;
+        p = log->map[lp];
+        if (p == FLASHFS_LOG_NOPAGE)
+            memset(dst, 0xFF, chunk);
+        else if (log->io.read(log->io.dev, p * FLASH_PAGE_SIZE + off, dst, chunk) < 0)
+            return -EIO;
+        dst += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+int flashfs_log_write(struct flashfs_log *log, uint32_t lpage, const uint8_t *buf)
+{
+    if (lpage >= log->lpages)
+        return -EINVAL;
+    log->stats.writes++;
+    return log_append(log, lpage, buf, 0);
+}
+
+/* The page was freed by the filesystem: GC no longer needs to copy it */
+void flashfs_log_trim(struct flashfs_log *log, uint32_t lpage)
+{
+    uint32_t p;
+
+    if (lpage >= log->lpages)
+        return;
+    p = log->map[lpage];
+    if (p == FLASHFS_LOG_NOPAGE)
+        return;
+    log->valid[log_sector_of(log, p)]--;
+    log->map[lpage] = FLASHFS_LOG_NOPAGE;
+}
+
+/* Background step: collect one sector if fewer than min_free are free.
+ * Returns 1 if a sector was reclaimed, 0 if there was nothing to do. */
+int flashfs_log_gc(struct flashfs_log *log, uint16_t min_free)
+{
+    int ret;
+
+    if (!log->map || log->free >= min_free)
+        return 0;
+    ret = log_gc_one(log);
+    if (ret == -ENOSPC)
+        return 0;
+    return ret < 0 ? ret : 1;
+}
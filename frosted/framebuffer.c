@@ -219,6 +219,22 @@ int framebuffer_flush(uint32_t x, uint32_t y, uint32_t w, uint32_t h)
     return fb[0]->fbops->fb_update(fb[0], x, y, w, h);
 }
 
+int framebuffer_vscroll(uint32_t lines, uint32_t offset)
+{
+    if (!fb[0] || !fb[0]->fbops || !fb[0]->fbops->fb_vscroll)
+        return -ENOSYS;
+    return fb[0]->fbops->fb_vscroll(fb[0], lines, offset);
+}
+
+int framebuffer_get_res(uint32_t *xres, uint32_t *yres)
+{
+    if (!fb[0])
+        return -ENODEV;
+    *xres = fb[0]->var.xres;
+    *yres = fb[0]->var.yres;
+    return 0;
+}
+
 /* Register a low-level framebuffer driver */
 int register_framebuffer(struct fb_info *fb_info)
 {
@@ -51,6 +51,7 @@
 #ifdef CONFIG_PIPE
 void sys_pipe_init(void);
 #endif
+void epoll_init(void);
 
 #if CONFIG_USB && CONFIG_USB_NET
 int netusb_init(void);
@@ -76,10 +77,10 @@ void tcpip_lock_init(void)
     tcpip_lock_ensure();
 }
 
-void tcpip_lock(void)
+int tcpip_lock(void)
 {
     tcpip_lock_ensure();
-    mutex_lock(tcpip_mutex);
+    return mutex_lock(tcpip_mutex);
 }
 
 void tcpip_unlock(void)
@@ -293,6 +294,7 @@ int frosted_init(void)
 #ifdef CONFIG_PIPE
     sys_pipe_init();
 #endif
+    epoll_init();
 
     memfs_init();
     xipfs_init();
@@ -303,7 +305,7 @@ int frosted_init(void)
 #endif
 
     tft_init();
-    fbcon_init(320, 240);
+    fbcon_init(240, 320);
     tty_console_init();
 
     vfs_mount(NULL, "/tmp", "memfs", 0, NULL);
@@ -419,9 +421,14 @@ void frosted_kernel(int xipfs_mounted)
 
     frosted_scheduler_on();
 
+    /* The kernel thread only gets the CPU when tasklets are pending or
+     * no task is runnable: hand it back as soon as the work is done. */
     while(1) {
         check_tasklets();
-        asm volatile ("wfe");
+        if (scheduler_runnable())
+            task_preempt();
+        else
+            systick_idle();
     }
 }
 
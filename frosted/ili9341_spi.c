@@ -34,7 +34,9 @@ int tft_init(void)
 #define ILI9341_CMD_CASET     0x2AU
 #define ILI9341_CMD_PASET     0x2BU
 #define ILI9341_CMD_RAMWR     0x2CU
+#define ILI9341_CMD_VSCRDEF   0x33U
 #define ILI9341_CMD_MADCTL    0x36U
+#define ILI9341_CMD_VSCRSADD  0x37U
 #define ILI9341_CMD_COLMOD    0x3AU
 #define ILI9341_CMD_FRMCTR1   0xB1U
 #define ILI9341_CMD_DFUNCTR   0xB6U
@@ -62,6 +64,7 @@ struct ili9341_panel {
     struct ili9341_gpio bl;
     uint16_t palette[256];
     uint8_t *frontbuffer;
+    uint16_t vscroll_lines;     /* scroll area last programmed, 0 if none */
 };
 
 static struct ili9341_panel ili9341;
@@ -447,6 +450,36 @@ static int ili9341_fb_update(struct fb_info *info, uint32_t x, uint32_t y, uint3
     return 0;
 }
 
+/* Hardware vertical scroll: GRAM rows [0, lines) become a ring shown
+ * starting from row 'offset', rows below it stay fixed. */
+static int ili9341_fb_vscroll(struct fb_info *info, uint32_t lines, uint32_t offset)
+{
+    struct ili9341_panel *panel = info ? info->priv : NULL;
+    uint8_t start[2];
+
+    if (!panel)
+        return -ENODEV;
+    if (lines == 0 || lines > ILI9341_HEIGHT || offset >= lines)
+        return -EINVAL;
+
+    if (panel->vscroll_lines != lines) {
+        uint32_t bfa = ILI9341_HEIGHT - lines;
+        uint8_t area[] = {
+            0, 0,                                   /* top fixed area */
+            (uint8_t)(lines >> 8), (uint8_t)(lines & 0xff),
+            (uint8_t)(bfa >> 8), (uint8_t)(bfa & 0xff),
+        };
+        if (ili9341_write_command(ILI9341_CMD_VSCRDEF, area, sizeof(area)) < 0)
+            return -EIO;
+        panel->vscroll_lines = (uint16_t)lines;
+    }
+    start[0] = (uint8_t)(offset >> 8);
+    start[1] = (uint8_t)(offset & 0xff);
+    if (ili9341_write_command(ILI9341_CMD_VSCRSADD, start, sizeof(start)) < 0)
+        return -EIO;
+    return 0;
+}
+
 static struct fb_ops ili9341_ops = {
     .fb_open = NULL,
     .fb_release = NULL,
@@ -457,6 +490,7 @@ static struct fb_ops ili9341_ops = {
     .fb_ioctl = NULL,
     .fb_destroy = NULL,
     .fb_update = ili9341_fb_update,
+    .fb_vscroll = ili9341_fb_vscroll,
 };
 
 static void ili9341_configure_fb(struct fb_info *fb, uint8_t *buffer)
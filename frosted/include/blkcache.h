@@ -0,0 +1,63 @@
+#ifndef BLKCACHE_INC
+#define BLKCACHE_INC
+
+#include <stdint.h>
+
+/*
+ * Write-back block cache for SPI flash (see blkcache.c). Blocks are one
+ * flash page; devices describe how to move runs of them with
+ * struct blkcache_ops.
+ */
+#define BLKCACHE_BLOCK_SIZE 256     /* FLASH_PAGE_SIZE */
+/* Most blocks written back in one call: a 4 KB erase sector */
+#define BLKCACHE_GROUP_MAX  16
+/* Widest read-ahead, in blocks */
+#define BLKCACHE_RA_MAX     8
+
+struct blkcache_ops {
+    /* Read 'count' consecutive blocks starting at 'blk' */
+    int (*read)(void *priv, uint32_t blk, uint8_t *const *bufs, uint32_t count);
+    /* Write back blocks of one group starting at 'blk'; NULL entries
+     * are not dirty and must be left as they are */
+    int (*write)(void *priv, uint32_t blk, const uint8_t *const *bufs, uint32_t count);
+    /* Optional: the block no longer holds data */
+    void (*trim)(void *priv, uint32_t blk);
+};
+
+struct blkcache_dev {
+    const struct blkcache_ops *ops;
+    void *priv;
+    uint32_t blocks;
+    uint32_t next_blk;      /* block after the last miss: sequential reads */
+    uint8_t group;          /* blocks per erase unit, written back together */
+    uint8_t ra;             /* current read-ahead window */
+};
+
+struct blkcache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t readahead;     /* blocks fetched ahead of the reader */
+    uint32_t ra_hits;       /* ... and later used */
+    uint32_t writes;        /* block writes absorbed */
+    uint32_t flushes;       /* backend write calls */
+    uint32_t flushed;       /* dirty blocks written back */
+    uint32_t evictions;     /* dirty blocks written back to make room */
+    uint32_t errors;
+    uint16_t pages;
+    uint16_t dirty;
+};
+
+void blkcache_dev_init(struct blkcache_dev *dev, const struct blkcache_ops *ops,
+        void *priv, uint32_t blocks, uint32_t group);
+int blkcache_dev_release(struct blkcache_dev *dev);
+int blkcache_invalidate(struct blkcache_dev *dev);
+int blkcache_read(struct blkcache_dev *dev, uint32_t addr, void *buf, uint32_t len);
+int blkcache_write(struct blkcache_dev *dev, uint32_t addr, const void *buf, uint32_t len);
+int blkcache_flush(struct blkcache_dev *dev);
+int blkcache_trim(struct blkcache_dev *dev, uint32_t blk);
+int blkcache_lock(void);
+int blkcache_trylock(void);
+void blkcache_unlock(void);
+void blkcache_get_stats(struct blkcache_stats *st);
+
+#endif
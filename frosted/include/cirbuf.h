@@ -1,10 +1,18 @@
-#include "frosted.h"
-
 #ifndef CIR_BUF_H
 #define CIR_BUF_H
 
+#include <stdint.h>
+#include <stddef.h>
+
 struct cirbuf;
 
+/* One contiguous chunk of a region; the second chunk of a wrapped
+ * region starts at the beginning of the storage. */
+struct cirbuf_seg {
+    uint8_t *ptr;
+    int len;
+};
+
 struct cirbuf * cirbuf_create(int size);
 /* 0 on success, -1 on fail */
 int cirbuf_writebyte(struct cirbuf *cb, uint8_t byte);
@@ -18,4 +26,16 @@ int cirbuf_readbytes(struct cirbuf *cb, void *bytes, int len);
 size_t cirbuf_bytesfree(struct cirbuf *cb);
 size_t cirbuf_bytesinuse(struct cirbuf *cb);
 
+/* Bulk access: fill seg[0..1] with the readable (or writable) region and
+ * return its total length, then commit the bytes actually consumed (or
+ * produced). */
+int cirbuf_peek_read(struct cirbuf *cb, struct cirbuf_seg seg[2]);
+void cirbuf_commit_read(struct cirbuf *cb, int len);
+int cirbuf_peek_write(struct cirbuf *cb, struct cirbuf_seg seg[2]);
+void cirbuf_commit_write(struct cirbuf *cb, int len);
+
+/* Move (consume != 0) or copy up to len bytes between two buffers.
+ * Returns the number of bytes transferred. */
+int cirbuf_transfer(struct cirbuf *dst, struct cirbuf *src, int len, int consume);
+
 #endif
@@ -1,6 +1,8 @@
 #ifndef WOLF_CONFIG_H
 #define WOLF_CONFIG_H
 
+#include <stdint.h>
+
 #define ETHERNET
 
 #ifndef LINK_MTU
@@ -37,6 +39,56 @@
 #define TXBUF_SIZE 1024
 #endif
 
+#ifdef CONFIG_RXBUF_MAX
+#define WOLFIP_RXBUF_MAX CONFIG_RXBUF_MAX
+#else
+#define WOLFIP_RXBUF_MAX 16384
+#endif
+
+#ifdef CONFIG_TXBUF_MAX
+#define WOLFIP_TXBUF_MAX CONFIG_TXBUF_MAX
+#else
+#define WOLFIP_TXBUF_MAX 16384
+#endif
+
+#ifdef CONFIG_SOCKBUF_BUDGET
+#define WOLFIP_SOCKBUF_BUDGET CONFIG_SOCKBUF_BUDGET
+#else
+#define WOLFIP_SOCKBUF_BUDGET 65536
+#endif
+
+#ifdef CONFIG_SOCKBUF_AUTOTUNE
+#define WOLFIP_SOCKBUF_AUTOTUNE CONFIG_SOCKBUF_AUTOTUNE
+#else
+#define WOLFIP_SOCKBUF_AUTOTUNE 1
+#endif
+
+#ifdef CONFIG_REASM_CTX
+#define WOLFIP_REASM_CTX CONFIG_REASM_CTX
+#else
+#define WOLFIP_REASM_CTX 2
+#endif
+
+#ifdef CONFIG_REASM_MAX
+#define WOLFIP_REASM_MAX CONFIG_REASM_MAX
+#else
+#define WOLFIP_REASM_MAX 4608
+#endif
+
+#ifdef CONFIG_REASM_TIMEOUT
+#define WOLFIP_REASM_TIMEOUT_MS CONFIG_REASM_TIMEOUT
+#else
+#define WOLFIP_REASM_TIMEOUT_MS 15000
+#endif
+
+/* Socket buffers come from the kernel heap */
+#ifndef WOLFIP_BUF_ALLOC
+void *kalloc(uint32_t size);
+void kfree(void *ptr);
+#define WOLFIP_BUF_ALLOC(sz) kalloc(sz)
+#define WOLFIP_BUF_FREE(p) kfree(p)
+#endif
+
 #define CONFIG_IPFILTER 0
 
 #ifdef CONFIG_WOLFIP_RAWSOCKETS
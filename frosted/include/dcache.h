@@ -0,0 +1,44 @@
+#ifndef DCACHE_INC
+#define DCACHE_INC
+
+#include <stdint.h>
+
+/*
+ * Path lookup cache (dcache.c): remembers which fnode a name resolves to
+ * under a directory, or that it does not exist there. Keys are the parent
+ * fnode and one path component.
+ */
+#define DCACHE_SETS     16
+#define DCACHE_WAYS     4
+#define DCACHE_NAME_MAX 32          /* CONFIG_MAX_FNAME */
+
+struct fnode;
+
+struct dcache_stats {
+    uint32_t enabled;
+    uint32_t entries;       /* valid entries, negative included */
+    uint32_t negative;      /* ... of which negative */
+    uint32_t hits;
+    uint32_t neg_hits;      /* hits telling the name does not exist */
+    uint32_t misses;
+    uint32_t evictions;     /* entries replaced to make room */
+    uint32_t invalidated;   /* entries dropped by create/unlink */
+    uint32_t flushes;       /* whole cache dropped: mount/umount */
+};
+
+/* Returns 1 and sets *child if (parent, name) is cached; *child is NULL
+ * if the name is known not to exist. Returns 0 on a miss. */
+int dcache_lookup(struct fnode *parent, const char *name, int len, struct fnode **child);
+/* Record the result of a lookup; NULL child records a negative entry */
+void dcache_insert(struct fnode *parent, const char *name, int len, struct fnode *child);
+/* A name was created under parent */
+void dcache_forget(struct fnode *parent, const char *name, int len);
+/* fno is going away: drop it as a result and as a parent */
+void dcache_forget_fnode(struct fnode *fno);
+void dcache_flush(void);
+
+void dcache_enable(int on);
+void dcache_get_stats(struct dcache_stats *st);
+void dcache_reset_stats(void);
+
+#endif
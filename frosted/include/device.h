@@ -6,7 +6,6 @@
 struct device {
     struct fnode *fno;
     mutex_t * mutex;
-    struct task *task;
 };
 
 int device_open(const char *path, int flags);
@@ -0,0 +1,37 @@
+#ifndef _DWT_H
+#define _DWT_H
+
+#include <stdint.h>
+
+/* Debug Exception and Monitor Control / Data Watchpoint and Trace */
+#define DEMCR              (*(volatile uint32_t *)(0xE000EDFCUL))
+#define DWT_BASE           (0xE0001000UL)
+#define DWT_CTRL           (*(volatile uint32_t *)(DWT_BASE + 0x00))
+#define DWT_CYCCNT         (*(volatile uint32_t *)(DWT_BASE + 0x04))
+
+#define DEMCR_TRCENA       (1U << 24)
+#define DWT_CTRL_CYCCNTENA (1U << 0)
+#define DWT_CTRL_NOCYCCNT  (1U << 25)
+
+/* Start the free-running cycle counter. Returns -1 if the core
+ * has no CYCCNT implemented. A counter already running is left alone:
+ * the scheduler keeps timestamps taken from it.
+ */
+static inline int dwt_cyccnt_enable(void)
+{
+    DEMCR |= DEMCR_TRCENA;
+    if (DWT_CTRL & DWT_CTRL_NOCYCCNT)
+        return -1;
+    if (DWT_CTRL & DWT_CTRL_CYCCNTENA)
+        return 0;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+    return 0;
+}
+
+static inline uint32_t dwt_cyccnt(void)
+{
+    return DWT_CYCCNT;
+}
+
+#endif /* _DWT_H */
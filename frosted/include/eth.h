@@ -10,9 +10,50 @@ struct eth_config {
     const int has_phy_reset;
 };
 
+/* Driver counters, exported through /sys/eth */
+struct eth_stats {
+    uint32_t zerocopy;
+    uint32_t loopback;
+    uint32_t csum_offload;
+    uint32_t link;
+    uint32_t link_checks;
+    uint32_t link_changes;
+    uint32_t rx_frames;
+    uint32_t rx_bytes;
+    uint32_t rx_dropped;
+    uint32_t rx_zerocopy;
+    uint32_t rx_copied;
+    uint32_t rx_csum_err;
+    uint32_t tx_frames;
+    uint32_t tx_bytes;
+    uint32_t tx_busy;
+    uint32_t tx_kicks;
+    uint32_t irqs;
+};
+
+/* One piece of a frame for stm32_eth_send_frags() */
+struct eth_frag {
+    const void *data;
+    uint32_t len;
+};
+
+/* PHY registers sampled on demand through /sys/eth_phy */
+#define ETH_PHY_SAMPLE_REGS 8
+struct eth_phy_sample {
+    uint32_t addr;
+    uint8_t reg[ETH_PHY_SAMPLE_REGS];
+    uint16_t val[ETH_PHY_SAMPLE_REGS];
+};
+
 #if CONFIG_ETH
 int ethernet_init(const struct eth_config *conf);
 void stm32_eth_enable_loopback(int enable);
+void stm32_eth_set_zerocopy(int enable);
+void stm32_eth_set_csum_offload(int enable);
+void stm32_eth_get_stats(struct eth_stats *st);
+void stm32_eth_reset_stats(void);
+int stm32_eth_send_frags(const struct eth_frag *frags, int nfrags);
+void stm32_eth_phy_sample(struct eth_phy_sample *ps);
 #else
 #  define ethernet_init(x) ((int)(-2))
 #  define stm32_eth_enable_loopback(x) ((void)0)
@@ -24,4 +24,9 @@
 #define O_CLOEXEC   0x40000 /* Close on exec */
 #define O_DIRECTORY 0x200000 /* Must be a directory */
 
+/* splice()/tee() flags */
+#define SPLICE_F_MOVE       0x01
+#define SPLICE_F_NONBLOCK   0x02
+#define SPLICE_F_MORE       0x04
+
 #endif /* _FROSTED_FCNTL_H */
@@ -3,6 +3,8 @@
 
 #include "frosted.h"
 
+#include "flashfs_index.h"
+
 #ifdef CONFIG_FLASHFS
 
 #ifdef CONFIG_JEDEC_SPI_FLASH
@@ -0,0 +1,71 @@
+#ifndef FLASHFS_INDEX_INC
+#define FLASHFS_INDEX_INC
+
+#include <stdint.h>
+
+/* On-flash layout, shared by flashfs.c and the index (flashfs_index.c) */
+#ifndef FLASH_PAGE_SIZE
+#define FLASH_PAGE_SIZE 256
+#endif
+
+#define F_PREV_PAGE 0xFFFE
+#define F_DIR_FLAG  0x8000   /* top bit of fname_len marks a directory entry */
+
+#define BITS_PER_BMP_PAGE (FLASH_PAGE_SIZE * 8)
+#define MAX_FNAME 128
+
+struct __attribute__((packed)) flashfs_file_hdr {
+    uint16_t fname_len;
+    uint16_t fsize;
+};
+
+/*
+ * RAM index of a mounted volume: path hash -> first page of the entry.
+ * Directories that only exist as a prefix of file paths get an implicit
+ * entry counting the files below them. Hits must be confirmed against the
+ * name stored on flash; a miss is final only while 'complete' is set.
+ */
+#define FLASHFS_INDEX_NOPAGE 0xFFFF
+
+struct flashfs_index_ent {
+    uint32_t hash;      /* 0: free slot */
+    uint16_t page;      /* entry page, or a file below an implicit dir */
+    uint16_t refs;      /* 0: on-flash entry, else files below the dir */
+};
+
+struct flashfs_index {
+    struct flashfs_index_ent *tab;
+    uint32_t size;      /* slots, a power of two */
+    uint32_t count;
+    uint32_t max;       /* entry limit */
+    uint8_t complete;   /* every on-flash entry is in the table */
+};
+
+/* Page access for the mount-time scan and the checkpoint */
+struct flashfs_index_io {
+    int (*read)(void *dev, uint32_t addr, void *buf, uint32_t len);
+    int (*write_page)(void *dev, uint32_t page, const uint8_t *buf);
+    void *dev;
+    uint32_t total_pages;       /* including the bitmap pages */
+};
+
+uint32_t flashfs_hash(const void *data, uint32_t len);
+void flashfs_index_init(struct flashfs_index *idx, uint32_t max);
+void flashfs_index_free(struct flashfs_index *idx);
+int flashfs_index_insert(struct flashfs_index *idx, const char *path, uint32_t len,
+        uint16_t page);
+void flashfs_index_remove(struct flashfs_index *idx, const char *path, uint32_t len,
+        uint16_t page);
+void flashfs_index_move(struct flashfs_index *idx, const char *path, uint32_t len,
+        uint16_t old_page, uint16_t new_page);
+const struct flashfs_index_ent *flashfs_index_next(const struct flashfs_index *idx,
+        uint32_t hash, uint32_t *pos);
+int flashfs_index_scan(struct flashfs_index *idx, const struct flashfs_index_io *io);
+uint32_t flashfs_index_bmp_hash(const struct flashfs_index_io *io);
+int flashfs_index_load(struct flashfs_index *idx, const struct flashfs_index_io *io,
+        uint32_t first, uint32_t npages, uint32_t bmp_hash);
+int flashfs_index_store(const struct flashfs_index *idx, const struct flashfs_index_io *io,
+        uint32_t first, uint32_t npages, uint32_t bmp_hash);
+int flashfs_index_invalidate(const struct flashfs_index_io *io, uint32_t first);
+
+#endif
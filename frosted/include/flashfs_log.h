@@ -0,0 +1,80 @@
+#ifndef FLASHFS_LOG_INC
+#define FLASHFS_LOG_INC
+
+#include <stdint.h>
+#include "flashfs_index.h"
+
+/*
+ * Log-structured page store under a flashfs volume (see flashfs_log.c).
+ * flashfs keeps addressing logical pages laid out exactly like the classic
+ * format; every page write is appended to the current erase sector and the
+ * RAM map points each logical page at its newest copy.
+ *
+ * On-flash: the first page of every erase sector is its header, followed
+ * by one tag per data page naming the logical page stored there.
+ */
+#define FLASHFS_LOG_MAGIC   0x474F4C46u /* "FLOG" */
+#define FLASHFS_LOG_FREE    0xFFFFFFFFu /* seq of an erased, unused sector */
+#define FLASHFS_LOG_NOPAGE  0xFFFF
+
+/* Free sectors kept back for garbage collection */
+#define FLASHFS_LOG_GC_RESERVE 2
+/* Sectors a volume needs beyond its logical pages: GC reserve + head */
+#define FLASHFS_LOG_MIN_SPARE (FLASHFS_LOG_GC_RESERVE + 1)
+/* Erase count spread that makes GC move cold data */
+#define FLASHFS_LOG_WEAR_DELTA 32
+
+struct __attribute__((packed)) flashfs_log_sect {
+    uint32_t magic;
+    uint32_t erase_count;
+    uint32_t seq;           /* programmed when the sector starts taking data */
+    uint16_t lpages;        /* volume geometry, repeated in every sector */
+    uint16_t sectors;
+    /* uint16_t tag[pages per sector - 1] follows */
+};
+
+#define FLASHFS_LOG_TAGS_OFF sizeof(struct flashfs_log_sect)
+
+struct flashfs_log_io {
+    int (*read)(void *dev, uint32_t addr, void *buf, uint32_t len);
+    int (*program)(void *dev, uint32_t addr, const void *buf, uint32_t len);
+    int (*erase)(void *dev, uint32_t addr);
+    void *dev;
+};
+
+struct flashfs_log_stats {
+    uint32_t writes;        /* logical page writes */
+    uint32_t programs;      /* data pages programmed, GC copies included */
+    uint32_t copies;        /* pages moved by GC */
+    uint32_t erases;
+    uint32_t gc_runs;
+};
+
+struct flashfs_log {
+    struct flashfs_log_io io;
+    uint32_t sector_size;
+    uint32_t next_seq;
+    uint16_t sectors;
+    uint16_t slots;         /* data pages per sector */
+    uint16_t lpages;
+    uint16_t head;          /* sector taking appends, or sectors if none */
+    uint16_t head_slot;
+    uint16_t free;
+    uint16_t *map;          /* logical page -> physical page; NULL: not mounted */
+    uint32_t *erases;       /* per sector */
+    uint8_t *valid;         /* live data pages per sector */
+    uint8_t *flags;
+    struct flashfs_log_stats stats;
+};
+
+int flashfs_log_format(const struct flashfs_log_io *io, uint32_t sector_size,
+        uint16_t sectors, uint16_t lpages);
+int flashfs_log_mount(struct flashfs_log *log, const struct flashfs_log_io *io,
+        uint32_t sector_size, uint32_t dev_sectors, uint32_t max_lpages);
+void flashfs_log_unmount(struct flashfs_log *log);
+int flashfs_log_read(struct flashfs_log *log, uint32_t addr, void *buf, uint32_t len);
+int flashfs_log_write(struct flashfs_log *log, uint32_t lpage, const uint8_t *buf);
+void flashfs_log_trim(struct flashfs_log *log, uint32_t lpage);
+int flashfs_log_gc(struct flashfs_log *log, uint16_t min_free);
+
+#endif
@@ -59,6 +59,9 @@ struct fb_ops {
 
         /* flush an updated rectangle to the display */
         int (*fb_update)(struct fb_info *info, uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+
+        /* wrap the first 'lines' rows so that row 'offset' is shown on top (optional) */
+        int (*fb_vscroll)(struct fb_info *info, uint32_t lines, uint32_t offset);
 };
 
 
@@ -70,6 +73,8 @@ int register_framebuffer(struct fb_info *fb_info);
 unsigned char *framebuffer_get(void);
 int framebuffer_setcmap(const uint32_t *cmap);
 int framebuffer_flush(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+int framebuffer_vscroll(uint32_t lines, uint32_t offset);
+int framebuffer_get_res(uint32_t *xres, uint32_t *yres);
 
 /* kernel init */
 int fb_init(void);
@@ -79,6 +84,8 @@ int fb_init(void);
 #  define framebuffer_get() NULL
 #  define framebuffer_setcmap(...) ((-ENOENT))
 #  define framebuffer_flush(...) ((-ENOENT))
+#  define framebuffer_vscroll(...) ((-ENOENT))
+#  define framebuffer_get_res(...) ((-ENOENT))
 #endif
 
 #endif
@@ -36,6 +36,7 @@ typedef char wint_t;
 
 /* Types */
 struct task;
+struct waitq;
 struct fnode;
 struct semaphore;
 struct termios;
@@ -97,6 +98,20 @@ int ktimer_add(uint32_t count, void (*handler)(uint32_t, void *), void *arg);
 int ktimer_del(int tid);
 void ktimer_cancel(struct ktimer *t);
 
+/* Idle loop of the kernel thread. With CONFIG_TICKLESS the periodic
+ * tick is stopped until the next ktimer expires.
+ */
+struct systick_idle_stats {
+    uint32_t tickless;
+    uint32_t idle_jiffies;
+    uint32_t sleeps;
+    uint32_t wakeups_timer;
+    uint32_t wakeups_irq;
+    uint32_t max_sleep;
+};
+void systick_idle(void);
+void systick_idle_get_stats(struct systick_idle_stats *st);
+
 /* FS initializers */
 void memfs_init(void);
 struct sysfs_fnode {
@@ -113,6 +128,7 @@ void xipfs_task_cleanup(uint16_t pid);
 #define NICE_DEFAULT (0)
 #define NICE_RT (0 - 20)
 #define NICE_MAX (20)
+#define SCHED_LEVELS (NICE_MAX - NICE_RT + 1)
 
 /* Called by boot code.
  * Set system NVIC priorities and start systick. */
@@ -137,6 +153,29 @@ unsigned scheduler_stack_used(int pid);
 int scheduler_get_nice(int pid);
 int scheduler_get_pids(uint16_t *pids, int max);
 
+/* Run queue level 0 is NICE_RT, SCHED_LEVELS - 1 is NICE_MAX */
+int scheduler_runqueue_stats(int level, uint32_t *nr, uint32_t *picks);
+int scheduler_runnable(void);
+
+/* CPU time of a process (all its threads), from the DWT cycle counter */
+struct task_cputime {
+    uint32_t utime_sec;
+    uint32_t utime_usec;
+    uint32_t stime_sec;     /* inside syscalls */
+    uint32_t stime_usec;
+    uint32_t nvcsw;         /* switched out while blocked */
+    uint32_t nivcsw;        /* preempted while runnable */
+    uint32_t nsyscalls;
+};
+int scheduler_task_cputime(int pid, struct task_cputime *ct);
+/* Context switches since boot; average cycles per switch spent in
+ * task_switch() and, within it, in CPU time accounting. */
+void scheduler_switch_stats(uint32_t *switches, uint32_t *sw_cycles,
+                            uint32_t *acct_cycles);
+/* The idle loop slept 'cycles' core clock cycles, of which the cycle
+ * counter saw 'counted' */
+void scheduler_acct_idle(uint32_t cycles, uint32_t counted);
+
 /* Get the task object for the current task */
 struct task *this_task(void);
 uint16_t this_task_getpid(void);
@@ -152,6 +191,9 @@ void task_hit_breakpoint(struct task *t);
 /* Fill in task info structure */
 int task_meminfo(uint16_t pid, struct task_meminfo *info);
 
+/* Invalidate cached MPU regions after a change in the memory layout of pid */
+void task_mpu_invalidate(uint16_t pid);
+
 /* Functions targeting the Current (Running) task
  * */
 int task_in_syscall(void);
@@ -174,10 +216,29 @@ int task_fd_readable(int fd);
 int task_fd_writable(int fd);
 int task_filedesc_del(int fd);
 void task_suspend(void);
+/* Sleep on a wait queue until one of 'events' is signalled: the caller
+ * returns the result (SYS_CALL_AGAIN) from its syscall handler. */
+int task_waitq_sleep(struct waitq *wq, uint16_t events);
+int task_waitq_sleep_timeout(struct waitq *wq, uint16_t events, int timeout_ms);
+int task_timed_out(void);
+void task_timeout_cancel(void);
+/* Priority inheritance. task_prio() is the run queue level (0 runs
+ * first); task_prio_inherit() lifts t to at least 'prio', or drops the
+ * inherited level when prio < 0. */
+int task_prio(struct task *t);
+void task_prio_inherit(struct task *t, int prio);
+/* Non-zero while t runs at an inherited level */
+int task_prio_boosted(struct task *t);
+/* Add 'delta' to the count of kernel mutexes held by t, return the count */
+int task_mutex_held(struct task *t, int delta);
+/* Lock wait queue t is blocked on, or NULL */
+struct waitq *task_waiting_on(struct task *t);
 /* Validate userspace pointers passed in the syscalls. */
 int task_ptr_valid(const void *ptr);
 int task_ptr_range_valid(const void *ptr, unsigned int len);
 int task_is_live(struct task *t, uint16_t pid);
+/* Syscalls t has finished. The same on every pass of a restarted one. */
+uint32_t task_syscall_seq(struct task *t);
 /* Slice off one unit from the task current run time */
 int task_timeslice(void);
 struct fnode *task_getcwd(void);
@@ -204,6 +265,8 @@ int mutex_trylock(mutex_t *s);
 int mutex_unlock(mutex_t *s);
 mutex_t *mutex_init();
 void mutex_destroy(mutex_t *s);
+/* Non-zero if the calling task holds s */
+int mutex_owned(mutex_t *s);
 #endif
 
 #define schedule()   *((uint32_t volatile *)0xE000ED04) = 0x10000000
@@ -214,6 +277,7 @@ int Timer_on(unsigned int n);
 /* Tasklets */
 int tasklet_add(void (*exe)(void*), void *arg);
 void check_tasklets(void);
+int tasklets_pending(void);
 
 /* Kthreads */
 struct task *kthread_create(void (routine)(void *), void *arg);
@@ -284,6 +348,32 @@ void fno_use(struct fnode *f);
 #define CONFIG_MAX_FNODES 128
 #define CONFIG_MAX_MOUNTS 8
 #define CONFIG_MAX_DEVICES 16
+#define CONFIG_MAX_TASKS 16
+
+/* Wait queues.
+ *
+ * Every fnode carries a wait queue. Whoever wants to know when the file
+ * becomes ready (a blocked reader, poll(), an epoll instance) links a
+ * waitq_entry on it, and the driver calls waitq_wake() with the readiness
+ * bits (POLLIN, POLLOUT, POLLHUP...) that just became true. Entries with a
+ * callback are notified through it; plain entries accumulate the bits in
+ * 'ready' and get their task resumed.
+ */
+struct waitq_entry;
+typedef void (*waitq_func)(struct waitq_entry *e, uint16_t events);
+
+struct waitq {
+    struct waitq_entry *head;
+};
+
+struct waitq_entry {
+    struct waitq *wq;           /* queue the entry is linked on, or NULL */
+    struct waitq_entry *next;
+    struct task *task;
+    waitq_func func;
+    uint16_t events;            /* bits the waiter is interested in */
+    uint16_t ready;             /* bits signalled since the entry was armed */
+};
 
 struct fnode {
     struct module *owner;
@@ -299,6 +389,7 @@ struct fnode {
     uint16_t ws_col;
     uint16_t ws_row;
     struct fnode *next;
+    struct waitq wq;
 };
 
 #define FNO_MOD_PRIV(fno,mod) (((fno == NULL)?NULL:((mod != fno->owner)?NULL:(fno->priv))))
@@ -317,6 +408,18 @@ struct fnode *fno_create_wronly(struct module *owner, const char *name, struct f
 struct fnode *fno_mkdir(struct module *owner, const char *name, struct fnode *parent);
 void fno_unlink(struct fnode *fno);
 void fno_detach(struct fnode *fno);
+
+/* Wait queues (see struct waitq) */
+void waitq_add(struct waitq *wq, struct waitq_entry *e);
+void waitq_del(struct waitq_entry *e);
+int waitq_wake(struct waitq *wq, uint16_t events);
+void waitq_flush(struct waitq *wq);
+#define fno_wake(fno, events) waitq_wake(&(fno)->wq, (events))
+/* Tasks blocked on a mutex or semaphore (locks.c) sleep with WQ_LOCK.
+ * The lock wakes them one at a time, highest priority first. */
+#define WQ_LOCK 0x8000
+/* A task woken from a lock queue left it without retrying */
+void lock_waiter_abandon(struct waitq *wq);
 struct fnode *fno_search(const char *path);
 int vfs_symlink(char *file, char *link);
 
@@ -377,6 +480,7 @@ struct module {
         int (*creat)(struct fnode *fno);
         int (*unlink)(struct fnode *fno);
         int (*truncate)(struct fnode *fno, unsigned int size);
+        int (*fsync)(struct fnode *fno);
         int (*exe)(struct fnode *fno, void *arg, struct task_exec_info *info);
 
 
@@ -426,6 +530,15 @@ void *kcalloc(uint32_t nmemb, uint32_t size);
 void *krealloc(void *ptr, uint32_t size);
 void kfree(void *ptr);
 
+struct kalloc_stats {
+    uint32_t pages;
+    uint32_t heap_bytes;
+    uint32_t free_bytes;
+    uint32_t free_blocks;
+    uint32_t largest_free;
+};
+void kalloc_get_stats(struct kalloc_stats *st);
+
 /* task_space_alloc/free: implemented via static pool in scheduler.c */
 void *task_space_alloc(void);
 void task_space_free(void *x);
@@ -464,14 +577,16 @@ void defrost(void);
 
 #if CONFIG_TCPIP
 void tcpip_lock_init(void);
-void tcpip_lock(void);
+int tcpip_lock(void);
 void tcpip_unlock(void);
 int tcpip_trylock(void);
+void socket_in_wakeup(void);
 #else
 static inline void tcpip_lock_init(void) {}
-static inline void tcpip_lock(void) {}
+static inline int tcpip_lock(void) { return 0; }
 static inline void tcpip_unlock(void) {}
 static inline int tcpip_trylock(void) { return 0; }
+static inline void socket_in_wakeup(void) {}
 #endif
 
 #endif /* BSP_INCLUDED_H */
@@ -1,117 +1,164 @@
 
-#include "stdint.h"
-#include "string.h"
-#include "stddef.h"
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+/* Indexed binary min-heap.
+ *
+ * Elements are kept in a 1-based array ordered by 'orderby', compared
+ * as wrapping 32-bit counters (jiffies). Every element also owns a slot
+ * in a side table that tracks its current position in the heap, so
+ * that heap_delete() finds it in O(1) and re-heapifies in O(log n).
+ *
+ * The id returned by heap_insert() is (generation << HEAP_SLOT_BITS) |
+ * slot: a stale id of an element that already left the heap does not
+ * match the slot's current generation and is rejected.
+ *
+ * Storage grows geometrically and is never shrunk.
+ */
+#define HEAP_SLOT_BITS 16
+#define HEAP_SLOT_MASK ((1U << HEAP_SLOT_BITS) - 1)
+#define HEAP_GEN_MASK (0x7FFFFFFFU >> HEAP_SLOT_BITS)
+#define HEAP_SLOT_FREE 0x80000000U
+#define HEAP_SLOT_NONE HEAP_SLOT_MASK
+#define HEAP_INIT_SIZE 8
+#define HEAP_BEFORE(a, b) ((int32_t)((uint32_t)(a) - (uint32_t)(b)) < 0)
 
 #define DECLARE_HEAP(type, orderby)                                                     \
 struct heap_element_##type {                                                            \
     uint32_t id;                                                                        \
     type data;                                                                          \
 };                                                                                      \
+struct heap_slot_##type {                                                               \
+    uint32_t pos; /* heap position, or HEAP_SLOT_FREE | next free slot */               \
+    uint32_t id;                                                                        \
+};                                                                                      \
 struct heap_##type {                                                                    \
     uint32_t size;                                                                      \
     uint32_t n;                                                                         \
-    uint32_t last_id;                                                                   \
+    uint32_t free_slot;                                                                 \
     struct heap_element_##type *top;                                                    \
+    struct heap_slot_##type *slots;                                                     \
 };                                                                                      \
 typedef struct heap_##type heap_##type;                                                 \
-static uint32_t _heap_idx_count = 0;                                                    \
-static inline int heap_insert(struct heap_##type *heap, type *el)                       \
+static inline void heap_place(struct heap_##type *heap, uint32_t i,                     \
+        struct heap_element_##type *el)                                                 \
+{                                                                                       \
+    memcpy(&heap->top[i], el, sizeof(struct heap_element_##type));                     \
+    heap->slots[el->id & HEAP_SLOT_MASK].pos = i;                                       \
+}                                                                                       \
+static inline void heap_sift_up(struct heap_##type *heap, uint32_t i)                   \
 {                                                                                       \
-    int i;                                                                              \
-    uint32_t old_size;                                                                  \
-    struct heap_element_##type *old_top;                                                \
-    struct heap_element_##type *new_top;                                                \
     struct heap_element_##type etmp;                                                    \
-    memcpy(&etmp.data, el, sizeof(type));                                               \
-    if (++heap->n >= heap->size) {                                                      \
-        old_size = heap->size;                                                          \
-        old_top = heap->top;                                                            \
-        new_top = krealloc(heap->top,                                                   \
-                (heap->n + 1) * sizeof(struct heap_element_##type));                    \
-        if (!new_top) {                                                                 \
-            heap->n--;                                                                  \
-            heap->size = old_size;                                                      \
-            heap->top = old_top;                                                        \
-            return -1;                                                                  \
-        }                                                                               \
-        heap->top = new_top;                                                            \
-        heap->size = old_size + 1;                                                      \
+    memcpy(&etmp, &heap->top[i], sizeof(etmp));                                         \
+    while ((i > 1) &&                                                                   \
+            HEAP_BEFORE(etmp.data.orderby, heap->top[i / 2].data.orderby)) {            \
+        heap_place(heap, i, &heap->top[i / 2]);                                         \
+        i /= 2;                                                                         \
     }                                                                                   \
-    etmp.id = heap->last_id++;                                                          \
-    if ((heap->last_id & 0x80000000U) != 0)                                             \
-       heap->last_id = 0; /* Wrap around */                                             \
-    if (heap->n == 1) {                                                                 \
-        memcpy(&heap->top[1], &etmp, sizeof(struct heap_element_##type));               \
-        return (int)etmp.id;                                                            \
+    heap_place(heap, i, &etmp);                                                         \
+}                                                                                       \
+static inline void heap_sift_down(struct heap_##type *heap, uint32_t i)                 \
+{                                                                                       \
+    struct heap_element_##type etmp;                                                    \
+    uint32_t child;                                                                     \
+    memcpy(&etmp, &heap->top[i], sizeof(etmp));                                         \
+    while ((child = 2 * i) <= heap->n) {                                                \
+        if ((child != heap->n) &&                                                       \
+            HEAP_BEFORE(heap->top[child + 1].data.orderby,                              \
+                heap->top[child].data.orderby))                                         \
+            child++;                                                                    \
+        if (!HEAP_BEFORE(heap->top[child].data.orderby, etmp.data.orderby))             \
+            break;                                                                      \
+        heap_place(heap, i, &heap->top[child]);                                         \
+        i = child;                                                                      \
     }                                                                                   \
-    for (i = heap->n; ((i > 1) &&                                                       \
-                (heap->top[i / 2].data.orderby > el->orderby)); i /= 2) {               \
-        memcpy(&heap->top[i], &heap->top[i / 2], sizeof(struct heap_element_##type));   \
+    heap_place(heap, i, &etmp);                                                         \
+}                                                                                       \
+static inline int heap_grow(struct heap_##type *heap)                                   \
+{                                                                                       \
+    uint32_t new_size = heap->size ? (heap->size * 2) : HEAP_INIT_SIZE;                 \
+    struct heap_element_##type *new_top;                                                \
+    struct heap_slot_##type *new_slots;                                                 \
+    uint32_t i;                                                                         \
+    if (new_size > HEAP_SLOT_NONE)                                                      \
+        new_size = HEAP_SLOT_NONE;                                                      \
+    if (new_size <= heap->size)                                                         \
+        return -1;                                                                      \
+    new_top = krealloc(heap->top,                                                       \
+            (new_size + 1) * sizeof(struct heap_element_##type));                       \
+    if (!new_top)                                                                       \
+        return -1;                                                                      \
+    heap->top = new_top;                                                                \
+    new_slots = krealloc(heap->slots, new_size * sizeof(struct heap_slot_##type));      \
+    if (!new_slots)                                                                     \
+        return -1;                                                                      \
+    heap->slots = new_slots;                                                            \
+    for (i = heap->size; i < new_size; i++) {                                           \
+        heap->slots[i].id = i;                                                          \
+        heap->slots[i].pos = HEAP_SLOT_FREE |                                           \
+            ((i + 1 < new_size) ? (i + 1) : heap->free_slot);                           \
     }                                                                                   \
-    memcpy(&heap->top[i], &etmp, sizeof(struct heap_element_##type));                   \
-    return (int)etmp.id;                                                                \
+    heap->free_slot = heap->size;                                                       \
+    heap->size = new_size;                                                              \
+    return 0;                                                                           \
+}                                                                                       \
+static inline void heap_slot_release(struct heap_##type *heap, uint32_t id)             \
+{                                                                                       \
+    uint32_t s = id & HEAP_SLOT_MASK;                                                   \
+    heap->slots[s].pos = HEAP_SLOT_FREE | heap->free_slot;                              \
+    heap->free_slot = s;                                                                \
+}                                                                                       \
+static inline int heap_insert(struct heap_##type *heap, type *el)                       \
+{                                                                                       \
+    struct heap_element_##type *e;                                                      \
+    uint32_t s, gen;                                                                    \
+    if ((heap->n >= heap->size) || (heap->free_slot == HEAP_SLOT_NONE)) {               \
+        if (heap_grow(heap) < 0)                                                        \
+            return -1;                                                                  \
+    }                                                                                   \
+    s = heap->free_slot;                                                                \
+    heap->free_slot = heap->slots[s].pos & ~HEAP_SLOT_FREE;                             \
+    gen = ((heap->slots[s].id >> HEAP_SLOT_BITS) + 1) & HEAP_GEN_MASK;                  \
+    heap->slots[s].id = (gen << HEAP_SLOT_BITS) | s;                                    \
+    e = &heap->top[++heap->n];                                                          \
+    e->id = heap->slots[s].id;                                                          \
+    memcpy(&e->data, el, sizeof(type));                                                 \
+    heap->slots[s].pos = heap->n;                                                       \
+    heap_sift_up(heap, heap->n);                                                        \
+    return (int)heap->slots[s].id;                                                      \
 } \
 static inline int heap_peek(struct heap_##type *heap, type *first)                      \
 {                                                                                       \
-    type *ptr = NULL;                                                                   \
-    struct heap_element_##type *last;                                                   \
-    int i, child, ret;                                                                  \
-    if(heap->n == 0) {                                                                  \
+    if (heap->n == 0) {                                                                 \
         return -1;                                                                      \
     }                                                                                   \
     memcpy(first, &heap->top[1].data, sizeof(type));                                    \
-    last = &heap->top[heap->n--];                                                       \
-    for(i = 1; (i * 2) <= heap->n; i = child) {                                         \
-        child = 2 * i;                                                                  \
-        if ((child != heap->n) &&                                                       \
-            (heap->top[child + 1]).data.orderby                                         \
-            < (heap->top[child]).data.orderby)                                          \
-            child++;                                                                    \
-        if (last->data.orderby >                                                        \
-            heap->top[child].data.orderby)                                              \
-            memcpy(&heap->top[i], &heap->top[child],                                    \
-                    sizeof(struct heap_element_##type));                                \
-        else                                                                            \
-            break;                                                                      \
+    heap_slot_release(heap, heap->top[1].id);                                           \
+    if (--heap->n > 0) {                                                                \
+        heap_place(heap, 1, &heap->top[heap->n + 1]);                                   \
+        heap_sift_down(heap, 1);                                                        \
     }                                                                                   \
-    memcpy(&heap->top[i], last, sizeof(struct heap_element_##type));                    \
     return 0;                                                                           \
 } \
 static inline int heap_delete(struct heap_##type *heap, int id)                         \
 {                                                                                       \
-    int found = 0;                                                                      \
-    int i, child;                                                                       \
-    struct heap_element_##type *last, temp;                                             \
-    if (heap->n == 0) {                                                                 \
-        return -1;                                                                      \
-    }                                                                                   \
-    for (i = 1; i <= heap->n; i++) {                                                    \
-        if (heap->top[i].id == id) {                                                    \
-                found = i;                                                              \
-                break;                                                                  \
-        }                                                                               \
-    }                                                                                   \
-    if (!found) {                                                                       \
+    uint32_t s = (uint32_t)id & HEAP_SLOT_MASK;                                         \
+    uint32_t pos;                                                                       \
+    if ((id < 0) || (s >= heap->size) || (heap->slots[s].id != (uint32_t)id) ||         \
+            (heap->slots[s].pos & HEAP_SLOT_FREE)) {                                    \
         return -1;                                                                      \
     }                                                                                   \
-    if (found == 1) {                                                                   \
-        (void)heap_peek(heap, &temp.data);                                              \
+    pos = heap->slots[s].pos;                                                           \
+    heap_slot_release(heap, (uint32_t)id);                                              \
+    if (pos == heap->n--)                                                               \
         return 0;                                                                       \
-    }                                                                                   \
-    if (found == heap->n) {                                                             \
-        heap->n--;                                                                      \
-        return 0;                                                                       \
-    }                                                                                   \
-    last = &heap->top[heap->n--];                                                       \
-    memcpy(&heap->top[found], last, sizeof(struct heap_element_##type));                \
-    for(i = found; i < heap->n; i++) {                                                  \
-        if (heap->top[i].data.orderby > heap->top[i + 1].data.orderby) {                \
-            memcpy(&temp, &heap->top[i], sizeof(struct heap_element_##type));           \
-            memcpy(&heap->top[i], &heap->top[i+1], sizeof(struct heap_element_##type)); \
-            memcpy(&heap->top[i+1], &temp, sizeof(struct heap_element_##type));         \
-        }                                                                               \
-    }                                                                                   \
+    heap_place(heap, pos, &heap->top[heap->n + 1]);                                     \
+    if ((pos > 1) && HEAP_BEFORE(heap->top[pos].data.orderby,                           \
+                heap->top[pos / 2].data.orderby))                                       \
+        heap_sift_up(heap, pos);                                                        \
+    else                                                                                \
+        heap_sift_down(heap, pos);                                                      \
     return 0;                                                                           \
 } \
 static inline type *heap_first(heap_##type *heap)                                       \
@@ -122,11 +169,14 @@ static inline type *heap_first(heap_##type *heap)
 } \
 static inline heap_##type *heap_init(void)                                              \
 {                                                                                       \
-    heap_##type *p = kcalloc(1, sizeof(heap_##type));                                    \
+    heap_##type *p = kcalloc(1, sizeof(heap_##type));                                   \
+    if (p)                                                                              \
+        p->free_slot = HEAP_SLOT_NONE;                                                  \
     return p;                                                                           \
 } \
 static inline void heap_destroy(heap_##type *h)                                         \
 {                                                                                       \
     kfree(h->top);                                                                      \
+    kfree(h->slots);                                                                    \
     kfree(h);                                                                           \
 }
@@ -0,0 +1,100 @@
+#ifndef INET_CSUM_H
+#define INET_CSUM_H
+
+#include <stdint.h>
+
+/* Internet checksum (RFC 1071) kernels.
+ *
+ * The ones' complement sum does not depend on byte order as long as it
+ * is folded and stored in the same order it was computed, so words are
+ * loaded natively and summed into a 64-bit accumulator: on Cortex-M this
+ * is one LDR plus an ADDS/ADC pair per 32 bits, instead of a halfword
+ * load, a byte swap and an add per 16 bits.
+ *
+ * The buffer may start at any address: a leading odd byte and halfword
+ * are consumed first so that the unrolled loop only issues aligned word
+ * loads; an odd start shifts the pairing by one byte, which is undone by
+ * swapping the folded result (as in the BSD and Linux implementations).
+ *
+ * inet_csum_partial() returns a partial sum that can be fed back into a
+ * further call, provided every piece starts at an even offset of the
+ * checksummed data (e.g. pseudo header, then segment). inet_csum_fold()
+ * folds and complements it into the 16-bit checksum, in the byte order
+ * of the packet: store it with memcpy, or ee16() it for a host value.
+ */
+
+typedef uint16_t __attribute__((__may_alias__)) inet_csum_u16;
+typedef uint32_t __attribute__((__may_alias__)) inet_csum_u32;
+
+static inline uint32_t inet_csum_partial(const void *buf, uint32_t len, uint32_t sum)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    uint64_t acc = 0;
+    uint32_t r;
+    int odd;
+
+    if (len == 0)
+        return sum;
+    odd = (int)((uintptr_t)p & 1U);
+    if (odd) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        acc = (uint32_t)p[0] << 8;
+#else
+        acc = p[0];
+#endif
+        p++;
+        len--;
+    }
+    if ((len >= 2) && ((uintptr_t)p & 2U)) {
+        acc += *(const inet_csum_u16 *)p;
+        p += 2;
+        len -= 2;
+    }
+    while (len >= 16) {
+        const inet_csum_u32 *w = (const inet_csum_u32 *)p;
+        acc += w[0];
+        acc += w[1];
+        acc += w[2];
+        acc += w[3];
+        p += 16;
+        len -= 16;
+    }
+    while (len >= 4) {
+        acc += *(const inet_csum_u32 *)p;
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        acc += *(const inet_csum_u16 *)p;
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        acc += p[0];
+#else
+        acc += (uint32_t)p[0] << 8;
+#endif
+    }
+
+    acc = (acc & 0xFFFFFFFFU) + (acc >> 32);
+    acc = (acc & 0xFFFFFFFFU) + (acc >> 32);
+    r = (uint32_t)acc;
+    r = (r & 0xFFFFU) + (r >> 16);
+    r = (r & 0xFFFFU) + (r >> 16);
+    if (odd)
+        r = ((r & 0xFFU) << 8) | (r >> 8);
+    r += sum;
+    if (r < sum)
+        r++;
+    return r;
+}
+
+static inline uint16_t inet_csum_fold(uint32_t sum)
+{
+    sum = (sum & 0xFFFFU) + (sum >> 16);
+    sum = (sum & 0xFFFFU) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+#endif
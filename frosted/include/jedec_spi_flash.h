@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "spi.h"
+#include "blkcache.h"
 
 /* JEDEC SPI NOR flash command opcodes */
 #define JEDEC_CMD_WREN       0x06
@@ -53,6 +54,11 @@ struct jedec_spi_flash {
 
     bool probed;
     bool ready;
+
+#if CONFIG_BLKCACHE
+    /* Raw device pages, shared by /dev/spiflash0 and classic flashfs */
+    struct blkcache_dev cache;
+#endif
 };
 
 /*
@@ -75,6 +81,14 @@ int jedec_spi_flash_register_device(struct jedec_spi_flash *flash, const char *d
 int jedec_spi_flash_read(const struct jedec_spi_flash *flash, uint32_t addr,
                          void *buf, uint32_t len);
 
+/*
+ * Read 'count' consecutive pages of 'size' bytes from 'addr' into
+ * separate buffers, with a single READ command.
+ * Returns 0 on success, negative errno on failure.
+ */
+int jedec_spi_flash_read_pages(const struct jedec_spi_flash *flash, uint32_t addr,
+                               uint8_t *const *pages, uint32_t count, uint32_t size);
+
 /*
  * Rewrite one logical flashfs page at 'addr'. The implementation preserves
  * surrounding data by rewriting the containing erase sector when needed.
@@ -82,6 +96,21 @@ int jedec_spi_flash_read(const struct jedec_spi_flash *flash, uint32_t addr,
 int jedec_spi_flash_write_page(const struct jedec_spi_flash *flash, uint32_t addr,
                                const void *buf, uint32_t len);
 
+/*
+ * Rewrite 'count' consecutive pages of 'size' bytes from 'addr', all in
+ * one erase sector; NULL pages keep their contents. The sector is erased
+ * at most once for all of them.
+ */
+int jedec_spi_flash_write_pages(const struct jedec_spi_flash *flash, uint32_t addr,
+                                const uint8_t *const *pages, uint32_t count, uint32_t size);
+
+/*
+ * Program 'len' bytes at 'addr' without erasing first: bits can only be
+ * cleared. For callers that manage erase sectors themselves.
+ */
+int jedec_spi_flash_program(const struct jedec_spi_flash *flash, uint32_t addr,
+                            const void *buf, uint32_t len);
+
 /*
  * Send WREN, then erase a 4KB sector at 'addr'.
  * Polls status register until BUSY bit clears.
@@ -100,4 +129,11 @@ int jedec_spi_flash_erase_all(const struct jedec_spi_flash *flash);
  */
 int jedec_spi_flash_is_blank(const struct jedec_spi_flash *flash);
 
+#if CONFIG_BLKCACHE
+/*
+ * Block cache over the raw device, or NULL before the probe.
+ */
+struct blkcache_dev *jedec_spi_flash_cache(const struct jedec_spi_flash *flash);
+#endif
+
 #endif /* _JEDEC_SPI_FLASH_H */
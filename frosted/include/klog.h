@@ -0,0 +1,36 @@
+#ifndef KLOG_INC
+#define KLOG_INC
+
+#include <stdint.h>
+#include "kprintf.h"
+
+/*
+ * Kernel log ring (klog_ring.c): kprintf() stores binary records, the
+ * /dev/klog reader (klog.c) turns them into text.
+ */
+struct klog_stats {
+    uint32_t records;       /* records stored */
+    uint32_t overruns;      /* records dropped: ring full */
+    uint32_t ratelimited;   /* records dropped by the rate limit */
+    uint32_t used;          /* bytes waiting for the reader */
+    uint32_t hwm;           /* most bytes ever waiting */
+    uint32_t size;
+    uint32_t rate;          /* records per second, 0: no limit */
+    uint8_t level;
+};
+
+/* Copy up to 'len' bytes of formatted log to 'buf'. Returns 0 when there
+ * is nothing left to read. One reader at a time. */
+int klog_ring_read(char *buf, uint32_t len);
+int klog_ring_pending(void);
+
+void klog_get_stats(struct klog_stats *st);
+int klog_set_level(uint32_t level);
+void klog_set_rate(uint32_t rate);
+void klog_reset_stats(void);
+
+/* Called by the ring after each record; provided by the /dev/klog driver.
+ * May run in interrupt context. */
+void klog_notify(void);
+
+#endif
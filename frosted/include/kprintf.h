@@ -1,12 +1,98 @@
 #ifndef KPRINTF_H
 #define KPRINTF_H
 
+/* Log levels, as in syslog(3) */
+#define KLOG_EMERG   0
+#define KLOG_ALERT   1
+#define KLOG_CRIT    2
+#define KLOG_ERR     3
+#define KLOG_WARNING 4
+#define KLOG_NOTICE  5
+#define KLOG_INFO    6
+#define KLOG_DEBUG   7
+
 #ifdef CONFIG_KLOG
+#include <stdint.h>
+
+/*
+ * kprintf() and klog() do not format anything: the record stored in the
+ * log ring (klog_ring.c) holds the format pointer, a timestamp, the
+ * level and up to KLOG_MAX_ARGS arguments taken as 32-bit words.
+ * Formatting happens when /dev/klog is read.
+ *
+ * The format must be a string literal. Arguments of type char * are
+ * copied into the record when they are not in flash, so that %s still
+ * prints the right thing after the caller's buffer is gone; the other
+ * arguments must fit 32 bits.
+ */
+#define KLOG_MAX_ARGS 8
+
+extern uint8_t klog_level;
+
 int klog_init(void);
-int ksprintf(char *out, const char *format, ...);
-int kprintf(const char *format, ...);
+void klog_write(uint32_t meta, const char *fmt, const uint32_t *args);
+
+#define KLOG_META(lvl, n, str) ((uint32_t)(lvl) | ((uint32_t)(n) << 4) | ((uint32_t)(str) << 8))
+#define KLOG_A(x) ((uint32_t)(uintptr_t)(x))
+#define KLOG_S(x, i) ((uint32_t)_Generic((x), char *: 1, const char *: 1, default: 0) << (i))
+
+#define KLOG_CAT_(a, b) a##b
+#define KLOG_CAT(a, b) KLOG_CAT_(a, b)
+#define KLOG_NARGS_(_f, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define KLOG_NARGS(...) KLOG_NARGS_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0, 0)
+
+#define KLOG_EMIT_0(l, f) klog_write(KLOG_META(l, 0, 0), f, 0)
+#define KLOG_EMIT_1(l, f, a) do { \
+        const uint32_t _ka[] = { KLOG_A(a) }; \
+        klog_write(KLOG_META(l, 1, KLOG_S(a, 0)), f, _ka); \
+    } while (0)
+#define KLOG_EMIT_2(l, f, a, b) do { \
+        const uint32_t _ka[] = { KLOG_A(a), KLOG_A(b) }; \
+        klog_write(KLOG_META(l, 2, KLOG_S(a, 0) | KLOG_S(b, 1)), f, _ka); \
+    } while (0)
+#define KLOG_EMIT_3(l, f, a, b, c) do { \
+        const uint32_t _ka[] = { KLOG_A(a), KLOG_A(b), KLOG_A(c) }; \
+        klog_write(KLOG_META(l, 3, KLOG_S(a, 0) | KLOG_S(b, 1) | KLOG_S(c, 2)), f, _ka); \
+    } while (0)
+#define KLOG_EMIT_4(l, f, a, b, c, d) do { \
+        const uint32_t _ka[] = { KLOG_A(a), KLOG_A(b), KLOG_A(c), KLOG_A(d) }; \
+        klog_write(KLOG_META(l, 4, KLOG_S(a, 0) | KLOG_S(b, 1) | KLOG_S(c, 2) | \
+                    KLOG_S(d, 3)), f, _ka); \
+    } while (0)
+#define KLOG_EMIT_5(l, f, a, b, c, d, e) do { \
+        const uint32_t _ka[] = { KLOG_A(a), KLOG_A(b), KLOG_A(c), KLOG_A(d), KLOG_A(e) }; \
+        klog_write(KLOG_META(l, 5, KLOG_S(a, 0) | KLOG_S(b, 1) | KLOG_S(c, 2) | \
+                    KLOG_S(d, 3) | KLOG_S(e, 4)), f, _ka); \
+    } while (0)
+#define KLOG_EMIT_6(l, f, a, b, c, d, e, g) do { \
+        const uint32_t _ka[] = { KLOG_A(a), KLOG_A(b), KLOG_A(c), KLOG_A(d), KLOG_A(e), \
+            KLOG_A(g) }; \
+        klog_write(KLOG_META(l, 6, KLOG_S(a, 0) | KLOG_S(b, 1) | KLOG_S(c, 2) | \
+                    KLOG_S(d, 3) | KLOG_S(e, 4) | KLOG_S(g, 5)), f, _ka); \
+    } while (0)
+#define KLOG_EMIT_7(l, f, a, b, c, d, e, g, h) do { \
+        const uint32_t _ka[] = { KLOG_A(a), KLOG_A(b), KLOG_A(c), KLOG_A(d), KLOG_A(e), \
+            KLOG_A(g), KLOG_A(h) }; \
+        klog_write(KLOG_META(l, 7, KLOG_S(a, 0) | KLOG_S(b, 1) | KLOG_S(c, 2) | \
+                    KLOG_S(d, 3) | KLOG_S(e, 4) | KLOG_S(g, 5) | KLOG_S(h, 6)), f, _ka); \
+    } while (0)
+#define KLOG_EMIT_8(l, f, a, b, c, d, e, g, h, i) do { \
+        const uint32_t _ka[] = { KLOG_A(a), KLOG_A(b), KLOG_A(c), KLOG_A(d), KLOG_A(e), \
+            KLOG_A(g), KLOG_A(h), KLOG_A(i) }; \
+        klog_write(KLOG_META(l, 8, KLOG_S(a, 0) | KLOG_S(b, 1) | KLOG_S(c, 2) | \
+                    KLOG_S(d, 3) | KLOG_S(e, 4) | KLOG_S(g, 5) | KLOG_S(h, 6) | \
+                    KLOG_S(i, 7)), f, _ka); \
+    } while (0)
+
+/* Levels above klog_level cost a load and a compare */
+#define klog(lvl, ...) do { \
+        if ((lvl) <= klog_level) \
+            KLOG_CAT(KLOG_EMIT_, KLOG_NARGS(__VA_ARGS__))(lvl, __VA_ARGS__); \
+    } while (0)
+#define kprintf(...) klog(KLOG_INFO, __VA_ARGS__)
 #else
 #   define klog_init() (0)
+#   define klog(...) do { } while (0)
 #   define kprintf(...) do { } while (0)
 #endif
 
@@ -1,23 +1,21 @@
-#include "frosted.h"
 #ifndef LOCKS_H
 #define LOCKS_H
 
-#define SEM_MAX_LISTENERS 8
+/* Include frosted.h first: struct waitq, mutex_t */
 
 /* Structures */
+
+/* User semaphores live in the caller's memory: this must fit the
+ * 20 bytes of the libc sem_t. */
 struct semaphore {
     int value;
     uint32_t signature;
-    int listeners;
-    int last;
-    struct task *listener[SEM_MAX_LISTENERS];
-    uint16_t listener_pid[SEM_MAX_LISTENERS];
+    struct waitq wq;            /* blocked tasks, see locks.c */
+    struct task *owner;         /* mutexes: holder, NULL if not a task */
+    uint16_t owner_pid;
 };
 
 
-int suspend_on_sem_wait(sem_t *s);
-int suspend_on_mutex_lock(mutex_t *s);
-
 mutex_t *mutex_init(void);
 int mutex_lock(mutex_t *s);
 int mutex_unlock(mutex_t *s);
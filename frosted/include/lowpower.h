@@ -14,8 +14,18 @@ static inline int lowpower_sleep(int stdby, uint32_t interval)
     (void)interval;
     return -1;
 }
+
+/* Called by the idle loop with interrupts masked: must return on any
+ * pending interrupt. 'ticks' is the expected idle time in jiffies.
+ */
+static inline void lowpower_idle(uint32_t ticks)
+{
+    (void)ticks;
+    asm volatile ("wfi");
+}
 #else
     int lowpower_init(void);
     int lowpower_sleep(int stdby, uint32_t interval);
+    void lowpower_idle(uint32_t ticks);
 #endif
 #endif
@@ -1,6 +1,36 @@
 #ifndef FROSTED_MPU_H
 #define FROSTED_MPU_H
+#include <stdint.h>
+
+/* Regions 0 and 1 (XIP flash, peripherals) are static background regions.
+ * Regions 2..7 are reprogrammed on every task switch.
+ */
+#define MPU_TASK_FIRST_REGION 2u
+#define MPU_TASK_REGIONS      6u
+
+/* Precomputed per-task MPU layout. Built once from secure_meminfo() and
+ * reused on every switch until the task memory layout changes.
+ */
+struct mpu_task_regions {
+    uint32_t rbar[MPU_TASK_REGIONS];
+    uint32_t rlar[MPU_TASK_REGIONS];
+    uint32_t psplim;
+    uint16_t ppid;
+    uint8_t valid;
+};
+
+struct mpu_cache_stats {
+    uint32_t enabled;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t hit_cycles;
+    uint32_t miss_cycles;
+};
+
 void mpu_task_on(uint16_t pid, uint16_t ppid);
+void mpu_task_regions_on(struct mpu_task_regions *r, uint16_t pid, uint16_t ppid);
 void mpu_init(void);
+void mpu_cache_enable(int on);
+void mpu_cache_get_stats(struct mpu_cache_stats *st);
+void mpu_cache_reset_stats(void);
 #endif
-
@@ -17,6 +17,8 @@ Author: Maxime Vincent, Daniele Lacamera
 
 #define SO_ERROR            (4103)
 #define SO_REUSEADDR        (2)
+#define SO_SNDBUF           (4097)
+#define SO_RCVBUF           (4098)
 #define IPPROTO_ICMP        (1)
 #define IPPROTO_UDP         (17)
 #define IPPROTO_TCP         (6)
@@ -29,14 +29,35 @@ struct spi_config {
     struct gpio_config pio_nss;
 };
 
+#define MAX_SPIS 2
+
+/* Transfers of at least this many bytes go through DMA */
+#ifndef CONFIG_SPI_DMA_MIN
+#define CONFIG_SPI_DMA_MIN 64
+#endif
+
+/* Per-bus counters, exported through /sys/spi */
+struct spi_stats {
+    uint32_t bytes;
+    uint32_t dma_xfers;
+    uint32_t dma_bytes;
+    uint32_t poll_xfers;
+    uint32_t errors;
+};
+
 struct spi_slave {
     uint8_t bus;
+    /* End of a devspi_xfer_sleep() transfer, from interrupt context */
     void (*isr)(struct spi_slave *);
     void *priv;
 };
 
 int devspi_create(const struct spi_config *spi_config);
 int devspi_xfer(struct spi_slave *spi, const char *obuf, char *ibuf, unsigned int len);
+/* Restartable syscalls: may sleep with SYS_CALL_AGAIN (see stm32_spi.c) */
+int devspi_xfer_sleep(struct spi_slave *spi, const char *obuf, char *ibuf, unsigned int len);
+int devspi_xfer_pending(struct spi_slave *spi);
 int spi_bus_init(void);
+int devspi_get_stats(int bus, struct spi_stats *st);
 
 #endif
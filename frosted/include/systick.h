@@ -16,6 +16,9 @@
 #define SYST_CSR_ENABLE     (1U << 0)  /* Counter enable */
 #define SYST_CSR_TICKINT    (1U << 1)  /* Interrupt enable */
 #define SYST_CSR_CLKSOURCE  (1U << 2)  /* Clock source: 0 = external, 1 = processor */
+#define SYST_CSR_COUNTFLAG  (1U << 16) /* Counted to 0 since last read (clear on read) */
+
+#define SYST_RVR_MAX        (0x00FFFFFFUL)
 
 /* SysTick API */
 
@@ -96,22 +96,31 @@ typedef uint32_t uint;
 // NCM CLASS CONFIGURATION, SEE "ncm.h" FOR PERFORMANCE TUNING
 //--------------------------------------------------------------------
 
-// Must be >> MTU
-// Can be set to 2048 without impact
-#define CFG_TUD_NCM_IN_NTB_MAX_SIZE (2 * LINK_MTU)
+#ifndef CONFIG_USB_NET_NTB_SIZE
+#define CONFIG_USB_NET_NTB_SIZE 4096
+#endif
+
+// Both directions use the same NTB size: the driver checks the IN
+// (device to host) fill level against the OUT size.
+// Must be >> MTU, Linux uses 2048 as minimal size
+#define CFG_TUD_NCM_IN_NTB_MAX_SIZE CONFIG_USB_NET_NTB_SIZE
+#define CFG_TUD_NCM_OUT_NTB_MAX_SIZE CONFIG_USB_NET_NTB_SIZE
 
-// Must be >> MTU
-// Can be set to smaller values if wNtbOutMaxDatagrams==1
-#define CFG_TUD_NCM_OUT_NTB_MAX_SIZE (2 * LINK_MTU)
+// Datagrams packed into one NTB: bare ACKs are small, so allow more
+// per block than the driver default
+#define CFG_TUD_NCM_IN_MAX_DATAGRAMS_PER_NTB 16
+#define CFG_TUD_NCM_OUT_MAX_DATAGRAMS_PER_NTB 8
 
-// Number of NCM transfer blocks for reception side
+// Number of NCM transfer blocks for reception side: one is filled by
+// the host while the other is handed to the glue logic
 #ifndef CFG_TUD_NCM_OUT_NTB_N
-  #define CFG_TUD_NCM_OUT_NTB_N 1
+  #define CFG_TUD_NCM_OUT_NTB_N 2
 #endif
 
-// Number of NCM transfer blocks for transmission side
+// Number of NCM transfer blocks for transmission side: one is on the
+// bus while frames are packed into the other
 #ifndef CFG_TUD_NCM_IN_NTB_N
-  #define CFG_TUD_NCM_IN_NTB_N 1
+  #define CFG_TUD_NCM_IN_NTB_N 2
 #endif
 
 //------------- CLASS -------------//
@@ -72,6 +72,22 @@ typedef unsigned long size_t;
 #endif
 #endif
 
+#ifndef WOLFIP_SO_SNDBUF
+#ifdef SO_SNDBUF
+#define WOLFIP_SO_SNDBUF SO_SNDBUF
+#else
+#define WOLFIP_SO_SNDBUF 7
+#endif
+#endif
+
+#ifndef WOLFIP_SO_RCVBUF
+#ifdef SO_RCVBUF
+#define WOLFIP_SO_RCVBUF SO_RCVBUF
+#else
+#define WOLFIP_SO_RCVBUF 8
+#endif
+#endif
+
 #ifdef IP_MULTICAST
 #ifndef WOLFIP_IP_ADD_MEMBERSHIP
 #ifdef IP_ADD_MEMBERSHIP
@@ -163,6 +179,15 @@ typedef uint32_t ip4;
 #define LOG(fmt, ...) do{}while(0)
 #endif
 
+/* Checksum offload flags (wolfIP_ll_dev.csum_offload, .rx_csum).
+ * TX: wolfIP leaves the checksum fields zeroed for the MAC to fill in.
+ * RX: wolfIP skips verification of frames the driver flagged as valid.
+ */
+#define WOLFIP_CSUM_TX_IP   0x01    /* IPv4 header */
+#define WOLFIP_CSUM_TX_L4   0x02    /* TCP, UDP and ICMP */
+#define WOLFIP_CSUM_RX_IP   0x04
+#define WOLFIP_CSUM_RX_L4   0x08
+
 /* Device driver interface */
 /* Struct to contain link-layer (ll) device description
  */
@@ -175,6 +200,20 @@ struct wolfIP_ll_dev {
     int (*poll)(struct wolfIP_ll_dev *ll, void *buf, uint32_t len);
     /* send function */
     int (*send)(struct wolfIP_ll_dev *ll, void *buf, uint32_t len);
+    /* optional zero-copy receive: points *frame at the next received
+     * frame in driver memory and returns its length. The frame stays
+     * valid until rx_release() is called. */
+    int (*rx_peek)(struct wolfIP_ll_dev *ll, void **frame);
+    void (*rx_release)(struct wolfIP_ll_dev *ll);
+    /* optional TX batching: frames sent between tx_begin() and tx_flush()
+     * may be queued and started with a single doorbell */
+    void (*tx_begin)(struct wolfIP_ll_dev *ll);
+    void (*tx_flush)(struct wolfIP_ll_dev *ll);
+    /* checksum offload: WOLFIP_CSUM_* work the driver does in hardware */
+    uint8_t csum_offload;
+    /* WOLFIP_CSUM_RX_* checksums found valid by the hardware for the
+     * frame returned by the last poll()/rx_peek() */
+    uint8_t rx_csum;
     /* optional context private pointer */
     void *priv;
 };
@@ -381,7 +420,17 @@ int nslookup(struct wolfIP *s, const char *name, uint16_t *id,
 void wolfIP_init(struct wolfIP *s);
 void wolfIP_init_static(struct wolfIP **s);
 size_t wolfIP_instance_size(void);
+/* Bytes currently allocated for socket buffers */
+uint32_t wolfIP_sockbuf_mem(struct wolfIP *s);
+/* IPv4 datagrams reassembled, dropped before completion, fragments sent */
+void wolfIP_ip_frag_stats(struct wolfIP *s, uint32_t *reasm_ok, uint32_t *reasm_drop,
+        uint32_t *frag_out);
+/* Upper limit of frames taken from each interface per wolfIP_poll() */
+#ifndef WOLFIP_POLL_BUDGET
+#define WOLFIP_POLL_BUDGET 128
+#endif
 int wolfIP_poll(struct wolfIP *s, uint64_t now);
+int wolfIP_poll_timeout(struct wolfIP *s, uint64_t now);
 void wolfIP_recv(struct wolfIP *s, void *buf, uint32_t len);
 void wolfIP_recv_ex(struct wolfIP *s, unsigned int if_idx, void *buf, uint32_t len);
 void wolfIP_ipconfig_set(struct wolfIP *s, ip4 ip, ip4 mask, ip4 gw);
@@ -5,6 +5,9 @@
  * ID, and exposes low-level read / sector-erase / format helpers.
  *
  * FlashFS uses these helpers to mount an external flash device under /mnt/flash.
+ * /dev/spiflash0 reads and writes the raw device; with CONFIG_BLKCACHE both
+ * go through the block cache (blkcache.c), whose write-back groups are the
+ * erase sectors.
  *
  * The driver uses the existing devspi SPI framework (from stm32_spi.c) for
  * all bus transactions.  The flash is always a SPI master peripheral on the
@@ -42,6 +45,15 @@ static struct module mod_jedec_flash;
 static struct device *jedec_flash_dev;
 static uint8_t jedec_sector_shadow[JEDEC_SECTOR_SIZE];
 
+static int jedec_dev_read(struct fnode *fno, void *buf, unsigned int len);
+static int jedec_dev_write(struct fnode *fno, const void *buf, unsigned int len);
+static int jedec_dev_seek(struct fnode *fno, int off, int whence);
+static int jedec_dev_fsync(struct fnode *fno);
+static int jedec_dev_close(struct fnode *fno);
+#if !CONFIG_BLKCACHE
+static void jedec_xfer_end(struct spi_slave *sl);
+#endif
+
 #define JEDEC_VERIFY_CHUNK 256U
 
 static bool jedec_uses_emulator_fallback(const struct jedec_spi_flash *flash)
@@ -350,6 +362,43 @@ static uint32_t jedec_bus_base_for_index(int spi_bus)
 
 /* jedec_spi_flash_probe */
 
+#if CONFIG_BLKCACHE
+static int jedec_cache_read(void *priv, uint32_t blk, uint8_t *const *bufs, uint32_t count)
+{
+    return jedec_spi_flash_read_pages(priv, blk * BLKCACHE_BLOCK_SIZE, bufs, count,
+            BLKCACHE_BLOCK_SIZE) < 0 ? -EIO : 0;
+}
+
+static int jedec_cache_write(void *priv, uint32_t blk, const uint8_t *const *bufs,
+        uint32_t count)
+{
+    return jedec_spi_flash_write_pages(priv, blk * BLKCACHE_BLOCK_SIZE, bufs, count,
+            BLKCACHE_BLOCK_SIZE) < 0 ? -EIO : 0;
+}
+
+static const struct blkcache_ops jedec_cache_ops = {
+    .read = jedec_cache_read,
+    .write = jedec_cache_write,
+};
+
+struct blkcache_dev *jedec_spi_flash_cache(const struct jedec_spi_flash *flash)
+{
+    if (!flash || !flash->cache.ops)
+        return NULL;
+    return (struct blkcache_dev *)&flash->cache;
+}
+#endif
+
+/* Geometry is known: set up the cache, one write-back group per sector */
+static void jedec_probe_done(struct jedec_spi_flash *flash)
+{
+#if CONFIG_BLKCACHE
+    blkcache_dev_init(&flash->cache, &jedec_cache_ops, flash,
+            flash->size_bytes / BLKCACHE_BLOCK_SIZE, flash->sector_size / BLKCACHE_BLOCK_SIZE);
+#endif
+    flash->probed = true;
+}
+
 int jedec_spi_flash_probe(struct jedec_spi_flash *flash,
     int spi_bus, uint8_t cs_pin, const char *gpio_bank, uint32_t baud)
 {
@@ -452,6 +501,9 @@ int jedec_spi_flash_probe(struct jedec_spi_flash *flash,
     flash->spi_bus    = (uint8_t)spi_bus;
     flash->spi_slave.bus = devspi_bus;
     flash->spi_slave.priv = flash;
+#if !CONFIG_BLKCACHE
+    flash->spi_slave.isr = jedec_xfer_end;
+#endif
 
     /* Read JEDEC ID (RDID = 0x9F: returns 3 bytes) */
     memset(id, 0xFF, sizeof(id));
@@ -473,7 +525,7 @@ int jedec_spi_flash_probe(struct jedec_spi_flash *flash,
         flash->jedec_id = 0xFFFF;
         flash->size_bytes = 0x800000UL;
         flash->page_count = flash->size_bytes / flash->page_size;
-        flash->probed = true;
+        jedec_probe_done(flash);
         return 0;
     }
 
@@ -490,7 +542,7 @@ int jedec_spi_flash_probe(struct jedec_spi_flash *flash,
             spi_bus + 1, flash->manufacturer, flash->jedec_id,
             (unsigned long)flash->size_bytes, (unsigned long)flash->page_count);
 
-    flash->probed = true;
+    jedec_probe_done(flash);
     return 0;
 }
 
@@ -520,10 +572,16 @@ int jedec_spi_flash_register_device(struct jedec_spi_flash *flash, const char *d
     mod_jedec_flash.name[sizeof(mod_jedec_flash.name) - 1] = '\0';
     mod_jedec_flash.family = FAMILY_FILE;
     mod_jedec_flash.ops.open = device_open;
+    mod_jedec_flash.ops.read = jedec_dev_read;
+    mod_jedec_flash.ops.write = jedec_dev_write;
+    mod_jedec_flash.ops.seek = jedec_dev_seek;
+    mod_jedec_flash.ops.fsync = jedec_dev_fsync;
+    mod_jedec_flash.ops.close = jedec_dev_close;
 
     jedec_flash_dev = device_fno_init(&mod_jedec_flash, name, devfs, 0, flash);
     if (!jedec_flash_dev)
         return -ENOMEM;
+    jedec_flash_dev->fno->size = flash->size_bytes;
 
     flash->dev_path = dev_path;
     register_module(&mod_jedec_flash);
@@ -559,6 +617,34 @@ done:
     return (ret < 0) ? ret : (int)len;
 }
 
+/* jedec_spi_flash_read_pages */
+
+int jedec_spi_flash_read_pages(const struct jedec_spi_flash *flash, uint32_t addr,
+                               uint8_t *const *pages, uint32_t count, uint32_t size)
+{
+    uint8_t cmd[4];
+    uint32_t i;
+    int ret;
+
+    if (!flash || !pages || count == 0)
+        return -EINVAL;
+    if ((addr + count * size) < addr || (addr + count * size) > flash->size_bytes)
+        return -EINVAL;
+
+    cmd[0] = JEDEC_CMD_READ;
+    cmd[1] = (uint8_t)(addr >> 16);
+    cmd[2] = (uint8_t)(addr >> 8);
+    cmd[3] = (uint8_t)(addr);
+
+    /* One command, the data phase split across the buffers */
+    stm32x5_gpio_reset(flash->gpio_base, flash->cs_pin);
+    ret = devspi_xfer((struct spi_slave *)&flash->spi_slave, (const char *)cmd, NULL, 4);
+    for (i = 0; ret >= 0 && i < count; i++)
+        ret = devspi_xfer((struct spi_slave *)&flash->spi_slave, NULL, (char *)pages[i], size);
+    stm32x5_gpio_set(flash->gpio_base, flash->cs_pin);
+    return (ret < 0) ? ret : 0;
+}
+
 int jedec_spi_flash_write_page(const struct jedec_spi_flash *flash, uint32_t addr,
                          const void *buf, uint32_t len)
 {
@@ -591,6 +677,68 @@ int jedec_spi_flash_write_page(const struct jedec_spi_flash *flash, uint32_t add
             flash->sector_size);
 }
 
+/* jedec_spi_flash_write_pages */
+
+int jedec_spi_flash_write_pages(const struct jedec_spi_flash *flash, uint32_t addr,
+                                const uint8_t *const *pages, uint32_t count, uint32_t size)
+{
+    uint32_t sector_base;
+    uint32_t off;
+    uint32_t i;
+    int erase = 0;
+    int ret;
+
+    if (!flash || !pages || count == 0 || size == 0)
+        return -EINVAL;
+    sector_base = addr & ~(flash->sector_size - 1U);
+    if (addr + count * size > sector_base + flash->sector_size ||
+            addr + count * size > flash->size_bytes)
+        return -EINVAL;
+    off = addr - sector_base;
+
+    ret = jedec_spi_flash_read(flash, sector_base, jedec_sector_shadow, flash->sector_size);
+    if (ret < 0)
+        return ret;
+    for (i = 0; i < count && !erase; i++) {
+        if (pages[i] && jedec_page_needs_erase(jedec_sector_shadow + off + i * size,
+                    pages[i], size))
+            erase = 1;
+    }
+
+    if (!erase) {
+        for (i = 0; i < count; i++) {
+            if (!pages[i] || memcmp(jedec_sector_shadow + off + i * size, pages[i], size) == 0)
+                continue;
+            ret = jedec_spi_flash_program_range(flash, addr + i * size, pages[i], size);
+            if (ret < 0)
+                return ret;
+        }
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (pages[i])
+            memcpy(jedec_sector_shadow + off + i * size, pages[i], size);
+    }
+    ret = jedec_spi_flash_erase_sector(flash, sector_base);
+    if (ret < 0)
+        return ret;
+    return jedec_spi_flash_program_range(flash, sector_base, jedec_sector_shadow,
+            flash->sector_size);
+}
+
+/* jedec_spi_flash_program */
+
+int jedec_spi_flash_program(const struct jedec_spi_flash *flash, uint32_t addr,
+                            const void *buf, uint32_t len)
+{
+    if (!flash || !buf || len == 0)
+        return -EINVAL;
+    if ((addr + len) < addr || (addr + len) > flash->size_bytes)
+        return -EINVAL;
+    return jedec_spi_flash_program_range(flash, addr, buf, len);
+}
+
 /* jedec_spi_flash_erase_sector */
 
 int jedec_spi_flash_erase_sector(const struct jedec_spi_flash *flash, uint32_t addr)
@@ -674,3 +822,162 @@ int jedec_spi_flash_is_blank(const struct jedec_spi_flash *flash)
     }
     return 1;
 }
+
+/* /dev/spiflash0: the raw device, a byte offset per open file */
+
+#if !CONFIG_BLKCACHE
+/* A data phase started by jedec_dev_read_raw() is over */
+static void jedec_xfer_end(struct spi_slave *sl)
+{
+    struct jedec_spi_flash *flash = sl->priv;
+
+    stm32x5_gpio_set(flash->gpio_base, flash->cs_pin);
+}
+
+/* jedec_spi_flash_read() for the read syscall: the data phase may sleep
+ * in devspi_xfer_sleep(). The chip then stays selected until the
+ * transfer is over, and the restarted read goes straight to collecting
+ * it. Returns the bytes read, possibly fewer than 'len'. */
+static int jedec_dev_read_raw(struct jedec_spi_flash *flash, uint32_t addr,
+                              void *buf, uint32_t len)
+{
+    uint8_t cmd[4];
+    int ret;
+
+    if (!devspi_xfer_pending(&flash->spi_slave)) {
+        cmd[0] = JEDEC_CMD_READ;
+        cmd[1] = (uint8_t)(addr >> 16);
+        cmd[2] = (uint8_t)(addr >> 8);
+        cmd[3] = (uint8_t)(addr);
+        stm32x5_gpio_reset(flash->gpio_base, flash->cs_pin);
+        ret = devspi_xfer(&flash->spi_slave, (const char *)cmd, NULL, 4);
+        if (ret < 0) {
+            stm32x5_gpio_set(flash->gpio_base, flash->cs_pin);
+            return ret;
+        }
+    }
+    ret = devspi_xfer_sleep(&flash->spi_slave, NULL, (char *)buf, len);
+    if ((ret == SYS_CALL_AGAIN) && devspi_xfer_pending(&flash->spi_slave))
+        return ret;
+    stm32x5_gpio_set(flash->gpio_base, flash->cs_pin);
+    return ret;
+}
+#endif
+
+static int jedec_dev_read(struct fnode *fno, void *buf, unsigned int len)
+{
+    struct jedec_spi_flash *flash = FNO_MOD_PRIV(fno, &mod_jedec_flash);
+    uint32_t off;
+    int ret;
+
+    if (!flash)
+        return -ENOENT;
+    off = task_fd_get_off(fno);
+    if (off >= flash->size_bytes)
+        return 0;
+    if (len > flash->size_bytes - off)
+        len = flash->size_bytes - off;
+    if (len == 0)
+        return 0;
+#if CONFIG_BLKCACHE
+    ret = blkcache_read(&flash->cache, off, buf, len);
+    if (ret == SYS_CALL_AGAIN)
+        return ret;
+#else
+    ret = jedec_dev_read_raw(flash, off, buf, len);
+    if (ret == SYS_CALL_AGAIN)
+        return ret;
+    if (ret >= 0)
+        len = ret;
+#endif
+    if (ret < 0)
+        return -EIO;
+    task_fd_set_off(fno, off + len);
+    return len;
+}
+
+static int jedec_dev_write(struct fnode *fno, const void *buf, unsigned int len)
+{
+    struct jedec_spi_flash *flash = FNO_MOD_PRIV(fno, &mod_jedec_flash);
+    uint32_t off;
+    int ret = 0;
+
+    if (!flash)
+        return -ENOENT;
+    off = task_fd_get_off(fno);
+    if (off >= flash->size_bytes)
+        return -ENOSPC;
+    if (len > flash->size_bytes - off)
+        len = flash->size_bytes - off;
+    if (len == 0)
+        return 0;
+#if CONFIG_BLKCACHE
+    ret = blkcache_write(&flash->cache, off, buf, len);
+    if (ret == SYS_CALL_AGAIN)
+        return ret;
+#else
+    {
+        const uint8_t *src = buf;
+        uint32_t done = 0;
+
+        /* One sector read-modify-write per sector touched */
+        while (ret >= 0 && done < len) {
+            uint32_t chunk = flash->sector_size - ((off + done) & (flash->sector_size - 1U));
+            if (chunk > len - done)
+                chunk = len - done;
+            ret = jedec_spi_flash_write_page(flash, off + done, src + done, chunk);
+            done += chunk;
+        }
+    }
+#endif
+    if (ret < 0)
+        return -EIO;
+    task_fd_set_off(fno, off + len);
+    return len;
+}
+
+static int jedec_dev_seek(struct fnode *fno, int off, int whence)
+{
+    int new_off;
+
+    switch (whence) {
+        case SEEK_CUR:
+            new_off = task_fd_get_off(fno) + off;
+            break;
+        case SEEK_SET:
+            new_off = off;
+            break;
+        case SEEK_END:
+            new_off = fno->size + off;
+            break;
+        default:
+            return -EINVAL;
+    }
+    if (new_off < 0 || (uint32_t)new_off > fno->size)
+        return -EINVAL;
+    task_fd_set_off(fno, new_off);
+    return new_off;
+}
+
+static int jedec_dev_fsync(struct fnode *fno)
+{
+#if CONFIG_BLKCACHE
+    struct jedec_spi_flash *flash = FNO_MOD_PRIV(fno, &mod_jedec_flash);
+    int ret;
+
+    if (!flash)
+        return -ENOENT;
+    ret = blkcache_flush(&flash->cache);
+    if (ret == SYS_CALL_AGAIN)
+        return ret;
+    return ret < 0 ? -EIO : 0;
+#else
+    (void)fno;
+    return 0;
+#endif
+}
+
+static int jedec_dev_close(struct fnode *fno)
+{
+    return jedec_dev_fsync(fno);
+}
@@ -0,0 +1,105 @@
+/*
+ *      This file is part of frosted.
+ *
+ *      frosted is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License version 2, as
+ *      published by the Free Software Foundation.
+ *
+ *
+ *      frosted is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with frosted.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * /dev/klog: text view of the kernel log ring (klog_ring.c).
+ *
+ * Records are formatted as they are read. A blocked reader is woken from
+ * a tasklet, since kprintf() may be called with interrupts masked or from
+ * the scheduler itself.
+ */
+
+#include "frosted.h"
+#include "device.h"
+#include "locks.h"
+#include "string.h"
+#include "poll.h"
+#include "klog.h"
+
+static struct module mod_klog;
+static struct fnode *klog_fno;
+static mutex_t *klog_mutex;
+static volatile uint8_t klog_wake_pending;
+
+static void klog_wake(void *arg)
+{
+    (void)arg;
+    klog_wake_pending = 0;
+    if (klog_fno)
+        fno_wake(klog_fno, POLLIN);
+}
+
+void klog_notify(void)
+{
+    if (!klog_fno || !klog_fno->wq.head || klog_wake_pending)
+        return;
+    klog_wake_pending = 1;
+    if (tasklet_add(klog_wake, NULL) < 0)
+        klog_wake_pending = 0;
+}
+
+static int klog_read(struct fnode *fno, void *buf, unsigned int len)
+{
+    int ret;
+
+    if (len == 0)
+        return 0;
+    mutex_lock(klog_mutex);
+    ret = klog_ring_read(buf, len);
+    mutex_unlock(klog_mutex);
+    if (ret > 0)
+        return ret;
+    if (!FNO_BLOCKING(fno))
+        return -EWOULDBLOCK;
+    ret = task_waitq_sleep(&fno->wq, POLLIN);
+    /* A record logged after the ring was read but before we were on the
+     * queue found nobody to wake: now that we are, ask again. */
+    if (klog_ring_pending())
+        klog_notify();
+    return ret;
+}
+
+static int klog_poll(struct fnode *fno, uint16_t events, uint16_t *revents)
+{
+    if ((events & POLLIN) && klog_ring_pending()) {
+        *revents |= POLLIN;
+        return 1;
+    }
+    return 0;
+}
+
+int klog_init(void)
+{
+    struct fnode *devfs = fno_search("/dev");
+
+    if (!devfs)
+        return -ENOENT;
+    strncpy(mod_klog.name, "klog", sizeof(mod_klog.name) - 1);
+    mod_klog.name[sizeof(mod_klog.name) - 1] = '\0';
+    mod_klog.family = FAMILY_FILE;
+    mod_klog.ops.open = device_open;
+    mod_klog.ops.read = klog_read;
+    mod_klog.ops.poll = klog_poll;
+
+    klog_mutex = mutex_init();
+    klog_fno = fno_create_rdonly(&mod_klog, "klog", devfs);
+    if (!klog_fno)
+        return -ENOMEM;
+    register_module(&mod_klog);
+    return 0;
+}
@@ -0,0 +1,458 @@
+/*
+ *      This file is part of frosted.
+ *
+ *      frosted is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License version 2, as
+ *      published by the Free Software Foundation.
+ *
+ *
+ *      frosted is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with frosted.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Binary kernel log ring.
+ *
+ * kprintf() stores a record: a header word, the jiffies timestamp, the
+ * format pointer and the raw 32-bit arguments, plus a copy of the strings
+ * that are not in flash. Nothing is formatted until /dev/klog is read.
+ *
+ * Writers may be any mix of tasks and interrupt handlers. Space is
+ * reserved by moving the head with a compare-and-swap (LDREX/STREX); the
+ * record is filled in place and published by storing its header last.
+ * The reader stops at the first record whose header is not published yet,
+ * zeroes what it consumed and then moves the tail, so a writer never
+ * reuses space the reader is still looking at.
+ *
+ * When the ring is full new records are dropped and counted; the reader
+ * prints how many were lost once it has caught up. Below KLOG_ERR, the
+ * number of records per second can be capped.
+ */
+
+#include "frosted.h"
+#include "klog.h"
+#include <string.h>
+
+#ifndef CONFIG_KLOG_SIZE
+#define CONFIG_KLOG_SIZE 2048
+#endif
+#ifndef CONFIG_KLOG_LEVEL
+#define CONFIG_KLOG_LEVEL KLOG_INFO
+#endif
+#ifndef CONFIG_KLOG_RATE
+#define CONFIG_KLOG_RATE 0
+#endif
+
+/* String arguments pointing below this are in flash and stay valid */
+#ifndef KLOG_IN_ROM
+#define KLOG_IN_ROM(p) ((uintptr_t)(p) < 0x20000000u)
+#endif
+
+#define KLOG_STR_MAX  32        /* bytes kept of a copied string, with NUL */
+#define KLOG_LINE_MAX 160
+
+/* Header word */
+#define KLOG_H_WORDS(h)  ((h) & 0xFFu)
+#define KLOG_H_NARGS(h)  (((h) >> 8) & 0x0Fu)
+#define KLOG_H_LEVEL(h)  (((h) >> 12) & 0x07u)
+#define KLOG_H_PAD       0x8000u
+#define KLOG_H_COPIED(h) (((h) >> 16) & 0xFFu)
+#define KLOG_H_COMMIT    0x80000000u
+
+/* hdr, timestamp, format */
+#define KLOG_REC_WORDS 3
+
+typedef char klog_size_check[((CONFIG_KLOG_SIZE & (CONFIG_KLOG_SIZE - 1)) == 0 &&
+        CONFIG_KLOG_SIZE >= 512) ? 1 : -1];
+
+static uint32_t klog_ring[CONFIG_KLOG_SIZE / 4];
+static uint32_t klog_head;          /* bytes reserved, free running */
+static uint32_t klog_tail;          /* bytes consumed, free running */
+
+uint8_t klog_level = CONFIG_KLOG_LEVEL;
+static uint32_t klog_rate = CONFIG_KLOG_RATE;
+static uint32_t klog_rate_win;
+static uint32_t klog_rate_count;
+
+static uint32_t klog_records;
+static uint32_t klog_overruns;
+static uint32_t klog_ratelimited;
+static uint32_t klog_hwm;
+
+/* Reader state */
+static char klog_line[KLOG_LINE_MAX];
+static uint16_t klog_line_len;
+static uint16_t klog_line_off;
+static uint8_t klog_bol = 1;
+static uint32_t klog_lost_seen;
+
+static inline void klog_count(uint32_t *ctr)
+{
+    __atomic_fetch_add(ctr, 1, __ATOMIC_RELAXED);
+}
+
+/* Windows of 1024 jiffies: close enough to a second, and no division */
+static int klog_rate_ok(void)
+{
+    uint32_t win = jiffies >> 10;
+
+    if (win != klog_rate_win) {
+        klog_rate_win = win;
+        klog_rate_count = 0;
+    }
+    if (klog_rate_count >= klog_rate)
+        return 0;
+    klog_rate_count++;
+    return 1;
+}
+
+static uint32_t klog_strlen(const char *s)
+{
+    uint32_t n = 0;
+
+    while (n < KLOG_STR_MAX - 1 && s[n])
+        n++;
+    return n;
+}
+
+void klog_write(uint32_t meta, const char *fmt, const uint32_t *args)
+{
+    uint32_t level = meta & 0x0Fu;
+    uint32_t nargs = (meta >> 4) & 0x0Fu;
+    uint32_t strs = (meta >> 8) & 0xFFu;
+    uint32_t slen[KLOG_MAX_ARGS];
+    uint32_t copied = 0;
+    uint32_t words, bytes, need, old, off, used, i;
+    uint32_t *rec;
+
+    if (nargs > KLOG_MAX_ARGS)
+        return;
+    if (klog_rate && level > KLOG_ERR && !klog_rate_ok()) {
+        klog_count(&klog_ratelimited);
+        return;
+    }
+
+    words = KLOG_REC_WORDS + nargs;
+    if (strs) {
+        bytes = 0;
+        for (i = 0; i < nargs; i++) {
+            const char *s = (const char *)(uintptr_t)args[i];
+            if (!(strs & (1u << i)) || !s || KLOG_IN_ROM(s))
+                continue;
+            slen[i] = klog_strlen(s);
+            bytes += slen[i] + 1;
+            copied |= 1u << i;
+        }
+        words += (bytes + 3) / 4;
+    }
+    bytes = words * 4;
+
+    old = __atomic_load_n(&klog_head, __ATOMIC_RELAXED);
+    do {
+        off = old & (CONFIG_KLOG_SIZE - 1);
+        need = bytes;
+        if (off + bytes > CONFIG_KLOG_SIZE)
+            need += CONFIG_KLOG_SIZE - off;     /* skip the end of the ring */
+        used = old + need - __atomic_load_n(&klog_tail, __ATOMIC_ACQUIRE);
+        if (used > CONFIG_KLOG_SIZE) {
+            klog_count(&klog_overruns);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&klog_head, &old, old + need, 1,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    if (used > klog_hwm)
+        klog_hwm = used;
+
+    if (need != bytes) {
+        __atomic_store_n(&klog_ring[off / 4], KLOG_H_COMMIT | KLOG_H_PAD |
+                ((CONFIG_KLOG_SIZE - off) / 4), __ATOMIC_RELEASE);
+        off = 0;
+    }
+    rec = &klog_ring[off / 4];
+    rec[1] = jiffies;
+    rec[2] = (uint32_t)(uintptr_t)fmt;
+    for (i = 0; i < nargs; i++)
+        rec[KLOG_REC_WORDS + i] = args[i];
+    if (copied) {
+        uint8_t *s = (uint8_t *)&rec[KLOG_REC_WORDS + nargs];
+        for (i = 0; i < nargs; i++) {
+            if (!(copied & (1u << i)))
+                continue;
+            memcpy(s, (const void *)(uintptr_t)args[i], slen[i]);
+            s[slen[i]] = '\0';
+            rec[KLOG_REC_WORDS + i] = (uint32_t)(s - (uint8_t *)rec);
+            s += slen[i] + 1;
+        }
+    }
+    __atomic_store_n(&rec[0], KLOG_H_COMMIT | words | (nargs << 8) | (level << 12) |
+            (copied << 16), __ATOMIC_RELEASE);
+    klog_count(&klog_records);
+    klog_notify();
+}
+
+/* Formatting, on the reader side */
+
+struct klog_out {
+    char *buf;
+    uint32_t len;
+    uint32_t size;
+};
+
+static inline void klog_putc(struct klog_out *o, char c)
+{
+    if (o->len < o->size)
+        o->buf[o->len++] = c;
+}
+
+static void klog_puts(struct klog_out *o, const char *s, uint32_t width, int left)
+{
+    uint32_t n = 0;
+
+    while (s[n])
+        n++;
+    if (!left)
+        for (; width > n; width--)
+            klog_putc(o, ' ');
+    while (*s)
+        klog_putc(o, *s++);
+    for (; width > n; width--)
+        klog_putc(o, ' ');
+}
+
+static void klog_putnum(struct klog_out *o, uint32_t v, uint32_t base, int upper,
+        int neg, uint32_t width, char pad, int left)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[12];
+    uint32_t n = 0, len;
+
+    do {
+        tmp[n++] = digits[v % base];
+        v /= base;
+    } while (v);
+    len = n + (neg ? 1 : 0);
+    if (neg && pad == '0')
+        klog_putc(o, '-');
+    if (!left)
+        for (; width > len; width--)
+            klog_putc(o, pad);
+    if (neg && pad != '0')
+        klog_putc(o, '-');
+    while (n)
+        klog_putc(o, tmp[--n]);
+    for (; width > len; width--)
+        klog_putc(o, ' ');
+}
+
+static uint32_t klog_format(const uint32_t *rec, uint32_t h, char *buf, uint32_t size)
+{
+    const char *fmt = (const char *)(uintptr_t)rec[2];
+    uint32_t nargs = KLOG_H_NARGS(h);
+    uint32_t copied = KLOG_H_COPIED(h);
+    uint32_t argi = 0;
+    struct klog_out o;
+
+    o.buf = buf;
+    o.len = 0;
+    o.size = size;
+    if (klog_bol) {
+        klog_putc(&o, '[');
+        klog_putnum(&o, rec[1] / 1000, 10, 0, 0, 5, ' ', 0);
+        klog_putc(&o, '.');
+        klog_putnum(&o, rec[1] % 1000, 10, 0, 0, 3, '0', 0);
+        klog_putc(&o, ']');
+        klog_putc(&o, ' ');
+    }
+    while (*fmt) {
+        uint32_t width = 0, v;
+        char pad = ' ';
+        int left = 0;
+        char c = *fmt++;
+
+        if (c != '%') {
+            klog_putc(&o, c);
+            continue;
+        }
+        for (; *fmt == '-' || *fmt == '0'; fmt++) {
+            if (*fmt == '-')
+                left = 1;
+            else
+                pad = '0';
+        }
+        while (*fmt >= '0' && *fmt <= '9')
+            width = width * 10 + (uint32_t)(*fmt++ - '0');
+        while (*fmt == 'l' || *fmt == 'h' || *fmt == 'z')
+            fmt++;
+        c = *fmt;
+        if (!c)
+            break;
+        fmt++;
+        if (left)
+            pad = ' ';
+        if (c == '%') {
+            klog_putc(&o, '%');
+            continue;
+        }
+        if (argi >= nargs) {
+            klog_putc(&o, '?');
+            continue;
+        }
+        v = rec[KLOG_REC_WORDS + argi];
+        switch (c) {
+        case 'd':
+        case 'i':
+            if ((int32_t)v < 0)
+                klog_putnum(&o, 0u - v, 10, 0, 1, width, pad, left);
+            else
+                klog_putnum(&o, v, 10, 0, 0, width, pad, left);
+            break;
+        case 'u':
+            klog_putnum(&o, v, 10, 0, 0, width, pad, left);
+            break;
+        case 'x':
+        case 'X':
+            klog_putnum(&o, v, 16, c == 'X', 0, width, pad, left);
+            break;
+        case 'p':
+            klog_putnum(&o, v, 16, 0, 0, 8, '0', 0);
+            break;
+        case 'c':
+            klog_putc(&o, (char)v);
+            break;
+        case 's':
+            if (copied & (1u << argi))
+                klog_puts(&o, (const char *)rec + v, width, left);
+            else if (!v)
+                klog_puts(&o, "(null)", width, left);
+            else if (KLOG_IN_ROM(v))
+                klog_puts(&o, (const char *)(uintptr_t)v, width, left);
+            else
+                klog_puts(&o, "(?)", width, left);
+            break;
+        default:
+            klog_putc(&o, '%');
+            klog_putc(&o, c);
+            break;
+        }
+        argi++;
+    }
+    if (o.len == size)
+        buf[size - 1] = '\n';   /* truncated */
+    klog_bol = (o.len > 0 && buf[o.len - 1] == '\n');
+    return o.len;
+}
+
+/* Format the next record into klog_line. Returns its length, 0 if the
+ * ring is empty or the next record is still being written. Once caught
+ * up, report the records dropped since the last report. */
+static uint32_t klog_next_line(void)
+{
+    uint32_t tail, head, h, words, len, lost;
+    uint32_t *rec;
+
+    for (;;) {
+        tail = klog_tail;
+        head = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+        if (tail == head)
+            break;
+        rec = &klog_ring[(tail & (CONFIG_KLOG_SIZE - 1)) / 4];
+        h = __atomic_load_n(&rec[0], __ATOMIC_ACQUIRE);
+        if (!(h & KLOG_H_COMMIT))
+            break;
+        words = KLOG_H_WORDS(h);
+        len = 0;
+        if (!(h & KLOG_H_PAD))
+            len = klog_format(rec, h, klog_line, KLOG_LINE_MAX);
+        memset(rec, 0, words * 4);
+        __atomic_store_n(&klog_tail, tail + words * 4, __ATOMIC_RELEASE);
+        if (len > 0)
+            return len;
+    }
+
+    lost = klog_overruns + klog_ratelimited;
+    if (lost == klog_lost_seen)
+        return 0;
+    {
+        uint32_t fake[KLOG_REC_WORDS + 1];
+        fake[1] = jiffies;
+        fake[2] = (uint32_t)(uintptr_t)"klog: %u messages lost\n";
+        fake[3] = lost - klog_lost_seen;
+        klog_lost_seen = lost;
+        len = 0;
+        if (!klog_bol) {
+            klog_line[len++] = '\n';
+            klog_bol = 1;
+        }
+        return len + klog_format(fake, 1u << 8, klog_line + len, KLOG_LINE_MAX - len);
+    }
+}
+
+int klog_ring_read(char *buf, uint32_t len)
+{
+    uint32_t done = 0, n;
+
+    while (done < len) {
+        if (klog_line_off == klog_line_len) {
+            klog_line_off = 0;
+            klog_line_len = (uint16_t)klog_next_line();
+            if (klog_line_len == 0)
+                break;
+        }
+        n = klog_line_len - klog_line_off;
+        if (n > len - done)
+            n = len - done;
+        memcpy(buf + done, klog_line + klog_line_off, n);
+        klog_line_off += n;
+        done += n;
+    }
+    return (int)done;
+}
+
+int klog_ring_pending(void)
+{
+    return klog_line_off != klog_line_len ||
+        __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE) != klog_tail ||
+        klog_overruns + klog_ratelimited != klog_lost_seen;
+}
+
+void klog_get_stats(struct klog_stats *st)
+{
+    st->records = klog_records;
+    st->overruns = klog_overruns;
+    st->ratelimited = klog_ratelimited;
+    st->used = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE) - klog_tail;
+    st->hwm = klog_hwm;
+    st->size = CONFIG_KLOG_SIZE;
+    st->rate = klog_rate;
+    st->level = klog_level;
+}
+
+int klog_set_level(uint32_t level)
+{
+    if (level > KLOG_DEBUG)
+        return -EINVAL;
+    klog_level = (uint8_t)level;
+    return 0;
+}
+
+void klog_set_rate(uint32_t rate)
+{
+    klog_rate_count = 0;
+    klog_rate = rate;
+}
+
+void klog_reset_stats(void)
+{
+    klog_records = 0;
+    klog_hwm = 0;
+    klog_overruns = 0;
+    klog_ratelimited = 0;
+    /* Lost records not reported yet are forgotten too */
+    klog_lost_seen = 0;
+}
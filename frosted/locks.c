@@ -29,6 +29,7 @@
 POOL_DEFINE(mutex_pool, mutex_t, CONFIG_MAX_MUTEXES);
 static int mutex_pool_inited = 0;
 
+#if defined(__arm__)
 static int __attribute__((naked)) _mutex_lock(void *m) {
     __asm__ volatile (
         "_mutex_lock:\n"
@@ -132,58 +133,196 @@ static int __attribute__((naked)) _sem_post(void *s) {
     );
 }
 
-/* Semaphore: internal functions */
-static void _add_listener(sem_t *s)
+#else
+/* Host builds (tests/): the same primitives on compiler atomics */
+static int _sem_wait(void *s)
 {
-    int i;
-    struct task *t = this_task();
-    uint16_t pid = this_task_getpid();
+    int *v = s;
+    int old = __atomic_load_n(v, __ATOMIC_RELAXED);
+
+    do {
+        if (old == 0)
+            return -1;
+    } while (!__atomic_compare_exchange_n(v, &old, old - 1, 0,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    return 0;
+}
 
-    irq_off();
+static int _sem_post(void *s)
+{
+    int *v = s;
+    int old = __atomic_load_n(v, __ATOMIC_RELAXED);
+
+    do {
+        if (old == 0x7FFFFFFF)
+            return -EOVERFLOW;
+    } while (!__atomic_compare_exchange_n(v, &old, old + 1, 0,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    return (old + 1 >= 1) ? 1 : 0;
+}
 
-    if (s->last >= 0) {
-        if ((t == s->listener[s->last]) && (pid == s->listener_pid[s->last])) {
-            irq_on();
-            return;
-        }
-    }
+static int _mutex_lock(void *m)
+{
+    return _sem_wait(m);
+}
 
-    for (i = s->last + 1; i < s->listeners; i++) {
-        if (s->listener[i] == NULL) {
-            s->listener[i] = t;
-            s->listener_pid[i] = pid;
-            s->last = i;
-            irq_on();
-            return;
+static int _mutex_unlock(void *m)
+{
+    int *v = m;
+    int old = 0;
+
+    if (!__atomic_compare_exchange_n(v, &old, 1, 0,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return -1;
+    return 0;
+}
+#endif
+
+/* Wait queues.
+ *
+ * Blocked tasks sleep on the lock's own waitq with WQ_LOCK. Releasing
+ * the lock wakes one of them: the highest priority waiter, the oldest
+ * among equals. The woken task retries when its syscall restarts; until
+ * then its entry stays on the queue, marked ready, and is skipped by the
+ * next wakeup. If it leaves without retrying (signal, timeout, exit) the
+ * scheduler calls lock_waiter_abandon() and the wakeup is passed on.
+ *
+ * Mutexes remember their owner. A task blocking on a mutex lends its
+ * priority to the owner, and along the chain of mutexes the owner is
+ * itself waiting for; the owner gives it back on unlock.
+ */
+#define LOCK_PI_DEPTH 8
+
+static struct semaphore *lock_of(struct waitq *wq)
+{
+    struct semaphore *s;
+
+    if (!wq)
+        return NULL;
+    s = (struct semaphore *)((char *)wq - offsetof(struct semaphore, wq));
+    if ((s->signature != SIGN_MUTEX) && (s->signature != SIGN_SEMAP))
+        return NULL;
+    return s;
+}
+
+/* Entries are pushed at the head: of two waiters with the same priority,
+ * the one further down has waited longer. With 'woken', waiters already
+ * woken are candidates too. Interrupts must be off. */
+static struct waitq_entry *lock_top_waiter(struct semaphore *s, int woken)
+{
+    struct waitq_entry *e, *best = NULL;
+    int prio, best_prio = 0;
+
+    for (e = s->wq.head; e; e = e->next) {
+        if (!e->task || (e->ready && !woken))
+            continue;
+        prio = task_prio(e->task);
+        if (!best || (prio <= best_prio)) {
+            best = e;
+            best_prio = prio;
         }
     }
-    for (i = 0; i < s->last; i++) {
-        if (s->listener[i] == NULL) {
-            s->listener[i] = t;
-            s->listener_pid[i] = pid;
-            s->last = i;
-            irq_on();
-            return;
-        }
+    return best;
+}
+
+static void lock_wake_one(struct semaphore *s)
+{
+    struct waitq_entry *e;
+    uint32_t irq_state;
+
+    irq_state = irq_save();
+    e = lock_top_waiter(s, 0);
+    if (e) {
+        e->ready |= WQ_LOCK;
+        task_resume_lock(e->task);
     }
-    irq_on();
+    irq_restore(irq_state);
 }
 
-static void _del_listener(sem_t *s)
+/* The caller got the lock: stop waiting for it */
+static void lock_leave(struct semaphore *s)
 {
-    int i;
     struct task *t = this_task();
+    struct waitq_entry *e;
+    uint32_t irq_state;
+
+    if (!t || !s->wq.head)
+        return;
+    irq_state = irq_save();
+    for (e = s->wq.head; e; e = e->next) {
+        if (e->task == t)
+            break;
+    }
+    if (e)
+        waitq_del(e);
+    irq_restore(irq_state);
+}
+
+static int lock_sleep(struct semaphore *s, int timeout_ms)
+{
+    return task_waitq_sleep_timeout(&s->wq, WQ_LOCK, timeout_ms);
+}
+
+void lock_waiter_abandon(struct waitq *wq)
+{
+    struct semaphore *s = lock_of(wq);
+
+    if (s && (s->value > 0))
+        lock_wake_one(s);
+}
 
-    irq_off();
-    for (i = 0; i < s->listeners; i++) {
-        if (s->listener[i] == t) {
-            s->listener[i] = NULL;
-            s->listener_pid[i] = 0;
-            irq_on();
+/* Priority inheritance */
+static void mutex_pi_boost(mutex_t *s, struct task *waiter)
+{
+    int prio = task_prio(waiter);
+    struct task *owner;
+    int depth;
+
+    for (depth = 0; s && (depth < LOCK_PI_DEPTH); depth++) {
+        owner = s->owner;
+        if (!owner || (owner == waiter) || !task_is_live(owner, s->owner_pid))
+            return;
+        if (task_prio(owner) <= prio)
+            return;
+        task_prio_inherit(owner, prio);
+        /* The owner may be blocked on another mutex in turn */
+        s = lock_of(task_waiting_on(owner));
+        if (s && (s->signature != SIGN_MUTEX))
             return;
-        }
     }
-    irq_on();
+}
+
+/* After t released a mutex: keep the priority of the most urgent
+ * waiter on the mutexes t still holds, if any. Only a boosted task
+ * still holding other mutexes needs to look for them in the pool. */
+static void mutex_pi_restore(struct task *t)
+{
+    mutex_t *m = (mutex_t *)mutex_pool.base;
+    struct waitq_entry *e;
+    uint32_t irq_state;
+    int prio = -1;
+    int p;
+    uint32_t i;
+
+    if (!task_prio_boosted(t))
+        return;
+    if (task_mutex_held(t, 0) == 0) {
+        task_prio_inherit(t, -1);
+        return;
+    }
+    irq_state = irq_save();
+    for (i = 0; i < mutex_pool.capacity; i++, m++) {
+        if ((m->signature != SIGN_MUTEX) || (m->owner != t))
+            continue;
+        e = lock_top_waiter(m, 1);
+        if (!e)
+            continue;
+        p = task_prio(e->task);
+        if ((prio < 0) || (p < prio))
+            prio = p;
+    }
+    irq_restore(irq_state);
+    task_prio_inherit(t, prio);
 }
 
 static int sem_spinwait(sem_t *s)
@@ -209,30 +348,28 @@ int sem_trywait(sem_t *s)
 
 int sem_wait(sem_t *s, struct timespec *timeout)
 {
+    int32_t time_left = -1;
+
     if (this_task() == NULL)
         return sem_spinwait(s);
     if (!s)
         return -EINVAL;
-    if(_sem_wait(s) != 0) {
-        if (timeout) {
-            uint32_t deadline = (uint32_t)((timeout->tv_sec * 1000) +
-                                (timeout->tv_nsec / 1000 / 1000));
-            int32_t time_left = (int32_t)(deadline - (uint32_t)jiffies);
-            if ((time_left > 0) && (task_get_timer_id() < 0)) {
-                task_set_timer_id(ktimer_add((uint32_t)time_left, sleepy_task_wakeup, NULL));
-            } else {
-                if (time_left < 0) {
-                    return -ETIMEDOUT;
-                }
-                return SYS_CALL_AGAIN;
-            }
+    if (_sem_wait(s) == 0) {
+        lock_leave(s);
+        if (timeout)
+            task_timeout_cancel();
+        return 0;
+    }
+    if (timeout) {
+        uint32_t deadline = (uint32_t)((timeout->tv_sec * 1000) +
+                            (timeout->tv_nsec / 1000 / 1000));
+        time_left = (int32_t)(deadline - (uint32_t)jiffies);
+        if ((time_left <= 0) || task_timed_out()) {
+            task_timeout_cancel();
+            return -ETIMEDOUT;
         }
-        _add_listener(s);
-        task_suspend();
-        return SYS_CALL_AGAIN;
     }
-    _del_listener(s);
-    return 0;
+    return lock_sleep(s, time_left);
 }
 
 int sem_post(sem_t *s)
@@ -244,48 +381,26 @@ int sem_post(sem_t *s)
     ret = _sem_post(s);
     if (ret < 0)
         return ret;
-    if (ret > 0) {
-        int i;
-        irq_off();
-        for(i = s->last+1; i < s->listeners; i++) {
-            struct task *t = s->listener[i];
-            if (t && task_is_live(t, s->listener_pid[i])) {
-                task_resume_lock(t);
-            }
-            s->listener[i] = NULL;
-            s->listener_pid[i] = 0;
-        }
-        for(i = 0; i <= s->last; i++) {
-            struct task *t = s->listener[i];
-            if (t && task_is_live(t, s->listener_pid[i])) {
-                task_resume_lock(t);
-            }
-            s->listener[i] = NULL;
-            s->listener_pid[i] = 0;
-        }
-        irq_on();
-    }
+    if ((ret > 0) && s->wq.head)
+        lock_wake_one(s);
     return 0;
 }
 
 int sem_destroy(sem_t *sem)
 {
+    sem->signature = 0;
+    waitq_flush(&sem->wq);
     kfree(sem);
     return 0;
 }
 
 int sem_init(sem_t *s, int val)
 {
-    int i;
     s->signature = SIGN_SEMAP;
     s->value = val;
-    s->listeners = SEM_MAX_LISTENERS;
-    s->last = -1;
-    for (i = 0; i < s->listeners; i++)
-        s->listener[i] = NULL;
-    for (i = 0; i < s->listeners; i++)
-        s->listener_pid[i] = 0;
-
+    s->wq.head = NULL;
+    s->owner = NULL;
+    s->owner_pid = 0;
     return 0;
 }
 
@@ -341,23 +456,9 @@ int sys_sem_destroy_hdlr(struct semaphore *s, int arg2, int arg3, int arg4, int
     return sem_destroy(s);
 }
 
-int suspend_on_sem_wait(sem_t *s)
-{
-    int ret;
-    if (!s)
-        return -EINVAL;
-    ret = _sem_wait(s);
-    if (ret != 0) {
-        _add_listener(s);
-        return EAGAIN;
-    }
-    return 0;
-}
-
 /* Mutex: API */
 mutex_t *mutex_init()
 {
-    int i;
     mutex_t *s;
     if (!mutex_pool_inited) {
         pool_init(&mutex_pool);
@@ -367,19 +468,27 @@ mutex_t *mutex_init()
     if (s) {
         s->signature = SIGN_MUTEX;
         s->value = 1; /* Unlocked. */
-        s->listeners = SEM_MAX_LISTENERS;
-        s->last = -1;
-        for (i = 0; i < s->listeners; i++)
-            s->listener[i] = NULL;
+        s->wq.head = NULL;
+        s->owner = NULL;
+        s->owner_pid = 0;
     }
     return s;
 }
 
 void mutex_destroy(mutex_t *s)
 {
+    s->signature = 0;
+    waitq_flush(&s->wq);
     pool_free(&mutex_pool, s);
 }
 
+static void mutex_set_owner(mutex_t *s)
+{
+    s->owner = this_task();
+    s->owner_pid = s->owner ? this_task_getpid() : 0;
+    task_mutex_held(s->owner, 1);
+}
+
 static int mutex_spinlock(mutex_t *s)
 {
     if (!s)
@@ -387,6 +496,7 @@ static int mutex_spinlock(mutex_t *s)
     while (_mutex_lock(s) != 0) {
         /* spin... */
     }
+    mutex_set_owner(s);
     return 0;
 }
 
@@ -396,60 +506,60 @@ int mutex_trylock(mutex_t *s)
         return -EINVAL;
     if(_mutex_lock(s) != 0)
         return -EAGAIN;
+    mutex_set_owner(s);
     return 0;
 }
 
+int mutex_owned(mutex_t *s)
+{
+    struct task *t = this_task();
+
+    return s && t && (s->owner == t) && task_is_live(t, s->owner_pid);
+}
+
 int mutex_lock(mutex_t *s)
 {
-    if (this_task() == NULL)
+    struct task *t = this_task();
+
+    if (t == NULL)
         return mutex_spinlock(s);
     if (!s)
         return -EINVAL;
     if(_mutex_lock(s) != 0) {
-        _add_listener(s);
-        task_suspend();
-        return SYS_CALL_AGAIN;
+        mutex_pi_boost(s, t);
+        return lock_sleep(s, -1);
     }
-    _del_listener(s);
+    mutex_set_owner(s);
+    lock_leave(s);
     return 0;
 }
 
 int mutex_unlock(mutex_t *s)
 {
-    if (!s)
-        return -EINVAL;
-    if (_mutex_unlock(s) == 0) {
-        int i;
-        for(i = s->last+1; i < s->listeners; i++) {
-            struct task *t = s->listener[i];
-            if (t) {
-                task_resume_lock(t);
-                s->listener[i] = NULL;
-                return 0;
-            }
-        }
-        for(i = 0; i <= s->last; i++) {
-            struct task *t = s->listener[i];
-            if (t) {
-                task_resume_lock(t);
-                s->listener[i] = NULL;
-                return 0;
-            }
-        }
-        return 0;
-    }
-    return -EAGAIN;
-}
+    struct task *t = this_task();
+    struct task *owner;
+    uint16_t owner_pid;
 
-int suspend_on_mutex_lock(mutex_t *s)
-{
-    int ret;
     if (!s)
         return -EINVAL;
-    ret = _mutex_lock(s);
-    if (ret != 0) {
-        _add_listener(s);
-        return EAGAIN;
+    owner = s->owner;
+    owner_pid = s->owner_pid;
+    if (owner && !task_is_live(owner, owner_pid))
+        owner = NULL; /* Died holding it */
+    if (t && owner && (owner != t))
+        return -EPERM;
+    s->owner = NULL;
+    s->owner_pid = 0;
+    if (_mutex_unlock(s) != 0) {
+        s->owner = owner;
+        s->owner_pid = owner ? owner_pid : 0;
+        return -EAGAIN;
+    }
+    if (s->wq.head)
+        lock_wake_one(s);
+    if (owner) {
+        task_mutex_held(owner, -1);
+        mutex_pi_restore(owner);
     }
     return 0;
 }
@@ -41,7 +41,8 @@ struct msghdr {
 
 #if CONFIG_TCPIP
 #define TCPIP_LOCK() tcpip_lock()
-#define TCPIP_UNLOCK() tcpip_unlock()
+/* Socket calls queue work for the TCP/IP thread: wake it on the way out */
+#define TCPIP_UNLOCK() do { tcpip_unlock(); socket_in_wakeup(); } while (0)
 #else
 #define TCPIP_LOCK() do {} while (0)
 #define TCPIP_UNLOCK() do {} while (0)
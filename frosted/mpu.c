@@ -29,6 +29,8 @@
 
 #include "frosted.h"
 #include "taskmem.h"
+#include "dwt.h"
+#include "string.h"
 
 #if defined(__ARM_ARCH_8M_MAIN__) || defined(__ARM_FEATURE_CMSE)
 static inline void mpu_set_psplim(uintptr_t limit)
@@ -160,6 +162,28 @@ void mpu_on(void)
     __ISB();
 }
 
+
+/* Layout loaded for the kernel and for tasks without a valid meminfo:
+ * R2 covers all RAM, privileged only. Built once in mpu_init().
+ */
+static struct mpu_task_regions mpu_kernel_regions;
+
+static int mpu_cache_enabled = 1;
+static uint32_t mpu_cache_hits = 0;
+static uint32_t mpu_cache_misses = 0;
+static uint32_t mpu_cache_hit_cycles = 0;
+static uint32_t mpu_cache_miss_cycles = 0;
+
+static void mpu_kernel_regions_build(struct mpu_task_regions *r)
+{
+    memset(r, 0, sizeof(*r));
+    // ---- Region 2: RAM (microkernel + Kernel + processes). RW, Privileged, Executable ----
+    r->rbar[0] = RBAR(RAM_START, SH_INNER_SHAREABLE, AP_RW_PRIVONLY, XN_EXECUTE);
+    r->rlar[0] = RLAR(RAM_END, IDX_NORMAL_WBWA);
+    r->psplim = 0;
+    r->valid = 1;
+}
+
 void mpu_init(void)
 {
 #if CONFIG_MPU
@@ -177,6 +201,8 @@ void mpu_init(void)
     MPU->MAIR0 = mair0;
     
     mpu_background_regions();
+    mpu_kernel_regions_build(&mpu_kernel_regions);
+    dwt_cyccnt_enable();
     mpu_on();
 
 #endif
@@ -187,26 +213,18 @@ volatile uintptr_t debug_mpu_stack_base = 0u;
 volatile uintptr_t debug_mpu_stack_limit = 0u;
 volatile uint16_t debug_mpu_pid = 0u;
 
-void mpu_task_on(uint16_t pid, uint16_t ppid)
+/* Compute RBAR/RLAR for regions 2..7 of a task. This is the expensive
+ * part: it walks the task list and calls into the secure world.
+ * Unused regions are left disabled, so nothing leaks from the previous
+ * task's layout.
+ */
+static int mpu_task_regions_build(struct mpu_task_regions *r, uint16_t pid, uint16_t ppid)
 {
-#if CONFIG_MPU
     struct task_meminfo cur, parent;
 
-    // Configure with MPU disabled
-    mpu_off();
-
-    if ((pid == 0) || (task_meminfo(pid, &cur) != 0)){
-        /* Unable to retrieve regions: activate bg-only */
-        mpu_background_regions();
-        // ---- Region 2: RAM (microkernel + Kernel + processes). RW, Privileged, Executable ----
-        MPU->RNR = 2u;
-        MPU->RBAR = RBAR(RAM_START, SH_INNER_SHAREABLE, AP_RW_PRIVONLY, XN_EXECUTE);
-        MPU->RLAR = RLAR(RAM_END, IDX_NORMAL_WBWA);
-
-        mpu_set_psplim(0);
-        mpu_on();
-        return;
-    }
+    memset(r, 0, sizeof(*r));
+    if ((pid == 0) || (task_meminfo(pid, &cur) != 0))
+        return -1;
 
     // --- R2: Task stack (NS RAM), RW, unprivileged, XN ---
     // Inner-shareable makes sense for D-cache-less MCUs too; adjust if needed.
@@ -220,20 +238,15 @@ void mpu_task_on(uint16_t pid, uint16_t ppid)
         debug_mpu_pid = pid;
         debug_mpu_stack_base = sb;
         debug_mpu_stack_limit = sl;
-        MPU->RNR = 2u;
-        MPU->RBAR = RBAR(sb, SH_INNER_SHAREABLE, AP_RW_FULL, XN_NEVER);
-        MPU->RLAR = RLAR(mpu_region_limit(sl), IDX_NORMAL_WBWA); // Normal memory; XN via RBAR
-        mpu_set_psplim(sb);
-    } else {
-        mpu_set_psplim(0);
+        r->rbar[0] = RBAR(sb, SH_INNER_SHAREABLE, AP_RW_FULL, XN_NEVER);
+        r->rlar[0] = RLAR(mpu_region_limit(sl), IDX_NORMAL_WBWA); // Normal memory; XN via RBAR
+        r->psplim = sb;
     }
 
-
     if (ppid > 0u) {
         // vfork(): allow access to parent's RAM while still executing parent's code.
-        int ret = task_meminfo(ppid, &parent);
-        if (ret == 0) {
-            // R4: Parent stack, RW, XN
+        if (task_meminfo(ppid, &parent) == 0) {
+            // R3: Parent stack, RW, XN
             if (parent.stack_size > 0) {
                 uintptr_t sb;
                 uintptr_t sl;
@@ -241,48 +254,136 @@ void mpu_task_on(uint16_t pid, uint16_t ppid)
                 sb = (uintptr_t)parent.stack_base;
                 MPU_ASSERT_BASE_ALIGNED(sb);
                 sl = sb + parent.stack_size - 1u;
-                MPU->RNR = 3u;
-                MPU->RBAR = RBAR(sb, SH_INNER_SHAREABLE, AP_RW_FULL, XN_NEVER);
-                MPU->RLAR = RLAR(mpu_region_limit(sl), IDX_NORMAL_WBWA);
+                r->rbar[1] = RBAR(sb, SH_INNER_SHAREABLE, AP_RW_FULL, XN_NEVER);
+                r->rlar[1] = RLAR(mpu_region_limit(sl), IDX_NORMAL_WBWA);
             }
-            // R5: Parent main segment (data + bss in RAM)
+            // R4: Parent main segment (data + bss in RAM)
             if (parent.ram_size > 0) {
                 uintptr_t mb = (uintptr_t)parent.ram_base;
                 uintptr_t ml = mb + parent.ram_size - 1u;
                 MPU_ASSERT_BASE_ALIGNED(mb);
-                MPU->RNR = 4u;
                 /* Keep the shared parent data readable for the child, but never writable. */
-                MPU->RBAR = RBAR(mb, SH_NON_SHAREABLE, AP_RO_FULL, XN_NEVER);
-                MPU->RLAR = RLAR(mpu_region_limit(ml), IDX_NORMAL_WT);
+                r->rbar[2] = RBAR(mb, SH_NON_SHAREABLE, AP_RO_FULL, XN_NEVER);
+                r->rlar[2] = RLAR(mpu_region_limit(ml), IDX_NORMAL_WT);
             }
         }
     } else {
-        // --- R4: Task main segment ---
+        // --- R3: Task main segment ---
         if (cur.ram_size > 0) {
             uintptr_t mb = (uintptr_t)cur.ram_base;
             uintptr_t ml = mb + cur.ram_size - 1u;
             MPU_ASSERT_BASE_ALIGNED(mb);
-            MPU->RNR = 3u;
             // If main lives in flash XIP: map RO+Exec; if it’s RAM, map RW+XN. We assume flash XIP here.
-            MPU->RBAR = RBAR(mb, SH_NON_SHAREABLE, AP_RW_FULL, XN_NEVER);
-            MPU->RLAR = RLAR(mpu_region_limit(ml), IDX_NORMAL_WT); // Normal WT attr for XIP
+            r->rbar[1] = RBAR(mb, SH_NON_SHAREABLE, AP_RW_FULL, XN_NEVER);
+            r->rlar[1] = RLAR(mpu_region_limit(ml), IDX_NORMAL_WT); // Normal WT attr for XIP
         }
-        // --- R4..R7: Heaps / extra RAM, RW, executable ---
-        for (uint32_t k = 0u; (k < cur.n_heap_regions) && (k < 4u); k++) {
+        // --- R4..R6: Heaps / extra RAM, RW, executable ---
+        for (uint32_t k = 0u; (k < cur.n_heap_regions) && (k < 3u); k++) {
             uintptr_t hb = cur.heap[k].base;
             uintptr_t hl = hb + cur.heap[k].size - 1u;
             MPU_ASSERT_BASE_ALIGNED(hb);
-            MPU->RNR = (4u + k);
-            MPU->RBAR = RBAR(hb, SH_INNER_SHAREABLE, AP_RW_FULL, XN_EXECUTE);
-            MPU->RLAR = RLAR(mpu_region_limit(hl), IDX_NORMAL_WBWA);
-        }
-        for (uint32_t k = cur.n_heap_regions; k < 4u; k++) {
-            MPU->RNR = (4u + k);
-            MPU->RBAR = 0u;
-            MPU->RLAR = 0u;
+            r->rbar[2 + k] = RBAR(hb, SH_INNER_SHAREABLE, AP_RW_FULL, XN_EXECUTE);
+            r->rlar[2 + k] = RLAR(mpu_region_limit(hl), IDX_NORMAL_WBWA);
         }
     }
+    r->ppid = ppid;
+    r->valid = 1;
+    return 0;
+}
+
+/* Write a precomputed layout to regions 2..7. The RBAR/RLAR alias
+ * registers address RNR[7:2]:n, so two RNR writes cover all six regions.
+ */
+static void mpu_task_regions_load(const struct mpu_task_regions *r)
+{
+    mpu_off();
+    MPU->RNR = 0u;
+    MPU->RBAR_A2 = r->rbar[0];
+    MPU->RLAR_A2 = r->rlar[0];
+    MPU->RBAR_A3 = r->rbar[1];
+    MPU->RLAR_A3 = r->rlar[1];
+    MPU->RNR = 4u;
+    MPU->RBAR = r->rbar[2];
+    MPU->RLAR = r->rlar[2];
+    MPU->RBAR_A1 = r->rbar[3];
+    MPU->RLAR_A1 = r->rlar[3];
+    MPU->RBAR_A2 = r->rbar[4];
+    MPU->RLAR_A2 = r->rlar[4];
+    MPU->RBAR_A3 = r->rbar[5];
+    MPU->RLAR_A3 = r->rlar[5];
+    mpu_set_psplim(r->psplim);
     // Enable MPU with background map
     mpu_on();
+}
+
+/* Uncached path: rebuild the layout from the secure world every time. */
+void mpu_task_on(uint16_t pid, uint16_t ppid)
+{
+#if CONFIG_MPU
+    struct mpu_task_regions r;
+
+    if (pid == 0) {
+        mpu_task_regions_load(&mpu_kernel_regions);
+        return;
+    }
+    if (mpu_task_regions_build(&r, pid, ppid) != 0) {
+        /* Unable to retrieve regions: activate bg-only */
+        mpu_task_regions_load(&mpu_kernel_regions);
+        return;
+    }
+    mpu_task_regions_load(&r);
+#endif
+}
+
+/* Cached path, called on every context switch and syscall return.
+ * The cache is invalidated by the scheduler (task_mpu_invalidate())
+ * whenever the secure memory layout of the task changes.
+ */
+void mpu_task_regions_on(struct mpu_task_regions *r, uint16_t pid, uint16_t ppid)
+{
+#if CONFIG_MPU
+    uint32_t start = dwt_cyccnt();
+
+    if ((pid == 0) || (r == NULL)) {
+        mpu_task_regions_load(&mpu_kernel_regions);
+        return;
+    }
+    if (mpu_cache_enabled && r->valid && (r->ppid == ppid)) {
+        mpu_task_regions_load(r);
+        mpu_cache_hits++;
+        mpu_cache_hit_cycles += dwt_cyccnt() - start;
+        return;
+    }
+    if (mpu_task_regions_build(r, pid, ppid) != 0)
+        mpu_task_regions_load(&mpu_kernel_regions);
+    else
+        mpu_task_regions_load(r);
+    mpu_cache_misses++;
+    mpu_cache_miss_cycles += dwt_cyccnt() - start;
 #endif
 }
+
+/* Turning the cache off forces a rebuild on every switch (the old
+ * behaviour), which is useful to compare both paths on the same boot.
+ */
+void mpu_cache_enable(int on)
+{
+    mpu_cache_enabled = !!on;
+}
+
+void mpu_cache_get_stats(struct mpu_cache_stats *st)
+{
+    st->enabled = mpu_cache_enabled;
+    st->hits = mpu_cache_hits;
+    st->misses = mpu_cache_misses;
+    st->hit_cycles = mpu_cache_hit_cycles;
+    st->miss_cycles = mpu_cache_miss_cycles;
+}
+
+void mpu_cache_reset_stats(void)
+{
+    mpu_cache_hits = 0;
+    mpu_cache_misses = 0;
+    mpu_cache_hit_cycles = 0;
+    mpu_cache_miss_cycles = 0;
+}
@@ -21,20 +21,26 @@
 #include "frosted.h"
 #include "cirbuf.h"
 #include "string.h"
+#include "fcntl.h"
 #include "sys/termios.h"
 #include "poll.h"
 
 #ifdef CONFIG_PIPE
-#define PIPE_BUFSIZE 64
+#ifdef CONFIG_PIPE_BUFSIZE
+#define PIPE_BUFSIZE CONFIG_PIPE_BUFSIZE
+#else
+#define PIPE_BUFSIZE 512
+#endif
 
 static struct module mod_pipe;
 
 
+/* Blocked readers sleep on fno_r's wait queue, blocked writers on
+ * fno_w's; poll() and epoll register on the same queues.
+ */
 struct pipe_priv {
     struct fnode *fno_r;
     struct fnode *fno_w;
-    struct task *task_r;
-    struct task *task_w;
     int w_off;
     struct cirbuf *cb;
 };
@@ -79,8 +85,6 @@ int sys_pipe2_hdlr(int *pfd, int flags)
 
     pp->fno_r = rd;
     pp->fno_w = wr;
-    pp->task_r = NULL;
-    pp->task_w = NULL;
     pp->w_off = 0;
     pp->cb = cirbuf_create(PIPE_BUFSIZE);
     if (!pp->cb) {
@@ -131,8 +135,6 @@ static int pipe_close(struct fnode *f)
 {
     static mutex_t *pipe_mutex = NULL;
     struct pipe_priv *pp;
-    struct task *t;
-    t = this_task();
     if (!f)
         return -EINVAL;
 
@@ -149,21 +151,16 @@ static int pipe_close(struct fnode *f)
     mutex_lock(pipe_mutex);
 
     if (f == pp->fno_r) {
-        struct task *waiting_w = pp->task_w;
-
-        pp->task_w = NULL;
         pp->fno_r = NULL;
         fno_unlink(f);
-        if ((waiting_w != t) && (waiting_w != NULL)) {
-            task_resume(waiting_w);
-        }
+        if (pp->fno_w)
+            fno_wake(pp->fno_w, POLLHUP);
     }
     if (f == pp->fno_w) {
         pp->fno_w = NULL;
         fno_unlink(f);
-        if ((pp->task_r != t) && (pp->task_r != NULL)) {
-            task_resume(pp->task_r);
-        }
+        if (pp->fno_r)
+            fno_wake(pp->fno_r, POLLHUP);
     }
     if ((!pp->fno_w) && (!pp->fno_r))
         kfree(pp);
@@ -177,7 +174,6 @@ static int pipe_read(struct fnode *f, void *buf, unsigned int len)
     struct pipe_priv *pp;
     int out;
     size_t len_available;
-    uint8_t *ptr = buf;
 
     if (f->owner != &mod_pipe)
         return -EINVAL;
@@ -193,30 +189,24 @@ static int pipe_read(struct fnode *f, void *buf, unsigned int len)
     if (len_available == 0) {
         if ((pp->fno_w == NULL) || (pp->fno_w->usage_count <= 1))
             return 0;
-        if (FNO_BLOCKING(f)) {
-            pp->task_r = this_task();
-            task_suspend();
-            return SYS_CALL_AGAIN;
-        } else {
+        if (FNO_BLOCKING(f))
+            return task_waitq_sleep(&f->wq, POLLIN);
+        else
             return -EWOULDBLOCK;
-        }
     }
 
-    for(out = 0; out < len; out++) {
-        /* read data */
-        if (cirbuf_readbyte(pp->cb, ptr) != 0)
-            break;
-        ptr++;
-    }
-    pp->task_r = 0;
+    out = cirbuf_readbytes(pp->cb, buf, (int)len);
+    if (out < 0)
+        out = 0;
+    if ((out > 0) && pp->fno_w)
+        fno_wake(pp->fno_w, POLLOUT);
     return out;
 }
 
 static int pipe_write(struct fnode *f, const void *buf, unsigned int len)
 {
     struct pipe_priv *pp;
-    unsigned int out, end;
-    size_t len_available;
+    unsigned int out;
     const uint8_t *ptr = buf;
 
     if (f->owner != &mod_pipe)
@@ -234,36 +224,95 @@ static int pipe_write(struct fnode *f, const void *buf, unsigned int len)
     out = (unsigned int)pp->w_off;
     if (out >= len) {
         pp->w_off = 0;
-        pp->task_w = NULL;
         return (int)len;
     }
 
-    len_available = cirbuf_bytesfree(pp->cb);
-    if (len_available > (len - out))
-        len_available = (size_t)(len - out);
-    end = out + (unsigned int)len_available;
-    for(; out < end; out++) {
-        /* write data */
-        if (cirbuf_writebyte(pp->cb, *(ptr + out)) != 0)
-            break;
-    }
+    out += (unsigned int)cirbuf_writebytes(pp->cb, ptr + out, (int)(len - out));
+    if ((out > (unsigned int)pp->w_off) && pp->fno_r)
+        fno_wake(pp->fno_r, POLLIN);
 
     if (out < len) {
         if (FNO_BLOCKING(f)) {
-            pp->task_w = this_task();
             pp->w_off = out;
-            task_suspend();
-            return SYS_CALL_AGAIN;
+            return task_waitq_sleep(&f->wq, POLLOUT);
         } else {
             if (out == 0)
                 return -EWOULDBLOCK;
         }
     }
     pp->w_off = 0;
-    pp->task_w = NULL;
     return out;
 }
 
+static struct pipe_priv *pipe_from_fd(int fd, int writer)
+{
+    struct fnode *f = task_filedesc_get(fd);
+    struct pipe_priv *pp;
+
+    if (!f || (f->owner != &mod_pipe))
+        return NULL;
+    pp = (struct pipe_priv *)f->priv;
+    if (!pp || (f != (writer ? pp->fno_w : pp->fno_r)))
+        return NULL;
+    return pp;
+}
+
+/* Pipe to pipe transfer without a bounce through userspace. The data
+ * is moved (splice) or copied (tee) straight between the two buffers.
+ * Blocks until something can be transferred, unless SPLICE_F_NONBLOCK
+ * is set or either end is nonblocking.
+ */
+static int pipe_transfer(int fd_in, int fd_out, unsigned int len, unsigned int flags, int consume)
+{
+    struct pipe_priv *in = pipe_from_fd(fd_in, 0);
+    struct pipe_priv *out = pipe_from_fd(fd_out, 1);
+    int nonblock, ret;
+
+    if (!in || !out)
+        return -EINVAL;
+    if (in == out)
+        return -EINVAL;
+    if (len == 0)
+        return 0;
+    if (len > 0x7FFFFFFF)
+        len = 0x7FFFFFFF;
+    nonblock = (flags & SPLICE_F_NONBLOCK) || !FNO_BLOCKING(in->fno_r) ||
+        !FNO_BLOCKING(out->fno_w);
+
+    if (cirbuf_bytesinuse(in->cb) == 0) {
+        if ((in->fno_w == NULL) || (in->fno_w->usage_count <= 1))
+            return 0;
+        if (nonblock)
+            return -EAGAIN;
+        return task_waitq_sleep(&in->fno_r->wq, POLLIN);
+    }
+    if (!out->fno_r)
+        return -EPIPE;
+    if (cirbuf_bytesfree(out->cb) == 0) {
+        if (nonblock)
+            return -EAGAIN;
+        return task_waitq_sleep(&out->fno_w->wq, POLLOUT);
+    }
+
+    ret = cirbuf_transfer(out->cb, in->cb, (int)len, consume);
+    if (ret > 0) {
+        fno_wake(out->fno_r, POLLIN);
+        if (consume && in->fno_w)
+            fno_wake(in->fno_w, POLLOUT);
+    }
+    return ret;
+}
+
+int sys_splice_hdlr(int fd_in, int fd_out, unsigned int len, unsigned int flags)
+{
+    return pipe_transfer(fd_in, fd_out, len, flags, 1);
+}
+
+int sys_tee_hdlr(int fd_in, int fd_out, unsigned int len, unsigned int flags)
+{
+    return pipe_transfer(fd_in, fd_out, len, flags, 0);
+}
+
 void sys_pipe_init(void)
 {
     mod_pipe.family = FAMILY_DEV;
@@ -281,4 +330,10 @@ void sys_pipe_init(void)
 int sys_pipe2_hdlr(int *pfd, int flags) {
     return -ENOSYS;
 }
+int sys_splice_hdlr(int fd_in, int fd_out, unsigned int len, unsigned int flags) {
+    return -ENOSYS;
+}
+int sys_tee_hdlr(int fd_in, int fd_out, unsigned int len, unsigned int flags) {
+    return -ENOSYS;
+}
 #endif
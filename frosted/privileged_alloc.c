@@ -29,26 +29,60 @@
 #define ALIGNMENT 8
 #define MAX_PAGES 32
 #define ALIGN_UP(x, a) (((x) + ((a) - 1)) & ~((a) - 1))
-#define BLOCK_FREE 0x80000000
-#define BLOCK_SIZE_MASK 0x7FFFFFFF
+
+/* Two-level segregated fit (TLSF) allocator.
+ *
+ * Every block starts with a 32-bit header: the block size (header
+ * included, multiple of ALIGNMENT) and two flags in the low bits.
+ * Free blocks also carry the free-list links and repeat their size in
+ * the last word, so that the block that follows can find and merge
+ * with them in constant time.
+ *
+ * Free blocks are binned by a first level (power of two) and a second
+ * level (SL_COUNT linear steps inside it). Two bitmaps locate the
+ * smallest bin that is guaranteed to fit, so kalloc() and kfree() run
+ * in constant time regardless of the heap size or fragmentation.
+ */
+#define BLOCK_FREE 0x1u
+#define BLOCK_PREV_FREE 0x2u
+#define BLOCK_FLAGS_MASK (ALIGNMENT - 1u)
+#define BLOCK_SIZE_MASK (~(uint32_t)BLOCK_FLAGS_MASK)
+#define BLOCK_HDR sizeof(uint32_t)
+
+#define SL_LOG2 4
+#define SL_COUNT (1u << SL_LOG2)
+#define FL_SHIFT (SL_LOG2 + 3) /* log2(ALIGNMENT) == 3 */
+#define SMALL_BLOCK (1u << FL_SHIFT)
+#define FL_MAX 24
+#define FL_COUNT (FL_MAX - FL_SHIFT + 1)
+
+struct free_block {
+    uint32_t hdr;
+    struct free_block *next;
+    struct free_block *prev;
+};
+
+#define BLOCK_MIN ALIGN_UP(sizeof(struct free_block) + sizeof(uint32_t), ALIGNMENT)
 
 struct __attribute__((__packed__)) page {
     void *base;
-    uint32_t offset;
     uint32_t capacity;
 };
 
 static struct page pages[MAX_PAGES];
 static uint32_t page_count = 0;
 
+static struct free_block *free_lists[FL_COUNT][SL_COUNT];
+static uint32_t fl_bitmap = 0;
+static uint32_t sl_bitmap[FL_COUNT];
+static uint32_t free_bytes = 0;
+static uint32_t free_blocks = 0;
+
 void *kalloc(uint32_t size);
 void *kcalloc(uint32_t nmemb, uint32_t size);
 void *krealloc(void *ptr, uint32_t size);
 void kfree(void *ptr);
 
-static void *alloc_from_pages(uint32_t size);
-static void try_merge_blocks(uint8_t *base, uint32_t *offset, uint32_t capacity);
-
 static uint32_t heap_segment_size(uint32_t size)
 {
     uint32_t rounded = ALIGN_UP(size, PAGE_SIZE);
@@ -63,16 +97,176 @@ static uint32_t heap_segment_size(uint32_t size)
     return rounded;
 }
 
+static inline uint32_t block_size(const uint32_t *hdr)
+{
+    return *hdr & BLOCK_SIZE_MASK;
+}
+
+static inline uint32_t *block_next(uint32_t *hdr)
+{
+    return (uint32_t *)((uint8_t *)hdr + block_size(hdr));
+}
+
+/* Only valid when BLOCK_PREV_FREE is set: reads the footer of the
+ * free block that precedes 'hdr'. */
+static inline uint32_t *block_prev(uint32_t *hdr)
+{
+    return (uint32_t *)((uint8_t *)hdr - *(hdr - 1));
+}
+
+static inline void block_set_footer(uint32_t *hdr)
+{
+    *(uint32_t *)((uint8_t *)hdr + block_size(hdr) - sizeof(uint32_t)) = block_size(hdr);
+}
+
+static inline int fls32(uint32_t x)
+{
+    return 31 - __builtin_clz(x);
+}
+
+static void mapping_insert(uint32_t size, int *fl, int *sl)
+{
+    int f;
+
+    if (size < SMALL_BLOCK) {
+        *fl = 0;
+        *sl = (int)(size / (SMALL_BLOCK / SL_COUNT));
+        return;
+    }
+    f = fls32(size);
+    *sl = (int)((size >> (f - SL_LOG2)) ^ SL_COUNT);
+    *fl = f - (FL_SHIFT - 1);
+}
+
+/* Round the request up to the next bin boundary, so that any block
+ * in the selected bin is large enough. */
+static void mapping_search(uint32_t size, int *fl, int *sl)
+{
+    if (size >= SMALL_BLOCK)
+        size += (1u << (fls32(size) - SL_LOG2)) - 1;
+    mapping_insert(size, fl, sl);
+}
+
+static void freelist_insert(uint32_t *hdr)
+{
+    struct free_block *b = (struct free_block *)hdr;
+    int fl, sl;
+
+    mapping_insert(block_size(hdr), &fl, &sl);
+    b->prev = NULL;
+    b->next = free_lists[fl][sl];
+    if (b->next)
+        b->next->prev = b;
+    free_lists[fl][sl] = b;
+    fl_bitmap |= (1u << fl);
+    sl_bitmap[fl] |= (1u << sl);
+    free_bytes += block_size(hdr);
+    free_blocks++;
+}
+
+static void freelist_remove(uint32_t *hdr)
+{
+    struct free_block *b = (struct free_block *)hdr;
+    int fl, sl;
+
+    mapping_insert(block_size(hdr), &fl, &sl);
+    if (b->prev)
+        b->prev->next = b->next;
+    else
+        free_lists[fl][sl] = b->next;
+    if (b->next)
+        b->next->prev = b->prev;
+    if (!free_lists[fl][sl]) {
+        sl_bitmap[fl] &= ~(1u << sl);
+        if (!sl_bitmap[fl])
+            fl_bitmap &= ~(1u << fl);
+    }
+    free_bytes -= block_size(hdr);
+    free_blocks--;
+}
+
+static uint32_t *freelist_find(uint32_t size)
+{
+    uint32_t sl_map, fl_map;
+    int fl, sl;
+
+    mapping_search(size, &fl, &sl);
+    if (fl >= (int)FL_COUNT)
+        return NULL;
+    sl_map = sl_bitmap[fl] & (~0u << sl);
+    if (!sl_map) {
+        if (fl + 1 >= (int)FL_COUNT)
+            return NULL;
+        fl_map = fl_bitmap & (~0u << (fl + 1));
+        if (!fl_map)
+            return NULL;
+        fl = __builtin_ctz(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+    return (uint32_t *)free_lists[fl][sl];
+}
+
+/* Turn 'hdr' (not in any free list) into a free block of 'size' bytes,
+ * merging with a free successor, and publish it. */
+static void block_release(uint32_t *hdr, uint32_t size)
+{
+    uint32_t *next = (uint32_t *)((uint8_t *)hdr + size);
+
+    if (*next & BLOCK_FREE) {
+        freelist_remove(next);
+        size += block_size(next);
+    }
+    *hdr = size | BLOCK_FREE | (*hdr & BLOCK_PREV_FREE);
+    block_set_footer(hdr);
+    *block_next(hdr) |= BLOCK_PREV_FREE;
+    freelist_insert(hdr);
+}
+
+/* Shrink the used block 'hdr' to 'size' bytes, returning the tail to
+ * the free lists when it is large enough to form a block. */
+static void block_trim(uint32_t *hdr, uint32_t size)
+{
+    uint32_t cur = block_size(hdr);
+    uint32_t *rem;
+
+    if (cur - size < BLOCK_MIN)
+        return;
+    *hdr = size | (*hdr & BLOCK_PREV_FREE);
+    rem = (uint32_t *)((uint8_t *)hdr + size);
+    *rem = 0;
+    block_release(rem, cur - size);
+}
+
+static void *heap_alloc(uint32_t size)
+{
+    uint32_t *hdr = freelist_find(size);
+
+    if (!hdr)
+        return NULL;
+    freelist_remove(hdr);
+    *hdr &= ~BLOCK_FREE;
+    *block_next(hdr) &= ~BLOCK_PREV_FREE;
+    block_trim(hdr, size);
+    return hdr;
+}
+
+/* A page is one free block followed by a zero-sized, always used
+ * sentinel header that stops forward merging at the end of the page. */
 static int add_new_page(uint32_t page_size)
 {
     uint32_t irq_state = irq_save();
+    uint32_t *hdr, *end;
+    uint32_t usable;
+    void *mem;
+
     if (page_count >= MAX_PAGES) {
         irq_restore(irq_state);
         return -1;
     }
     irq_restore(irq_state);
 
-    void *mem = secure_mmap(page_size, 0, 0);
+    mem = secure_mmap(page_size, 0, 0);
     if (!mem)
         return -1;
 
@@ -83,30 +277,47 @@ static int add_new_page(uint32_t page_size)
         return -1;
     }
     pages[page_count].base = mem;
-    pages[page_count].offset = 0;
     pages[page_count].capacity = page_size;
     page_count++;
+
+    usable = (page_size - ALIGNMENT) & BLOCK_SIZE_MASK;
+    hdr = (uint32_t *)mem;
+    end = (uint32_t *)((uint8_t *)mem + usable);
+    *end = 0;
+    *hdr = 0;
+    block_release(hdr, usable);
     irq_restore(irq_state);
     return 0;
 }
 
+static uint32_t kalloc_block_size(uint32_t size)
+{
+    uint32_t total = ALIGN_UP(size + BLOCK_HDR, ALIGNMENT);
+
+    if (total < BLOCK_MIN)
+        total = BLOCK_MIN;
+    return total;
+}
+
 void *kalloc(uint32_t size)
 {
     if ((size == 0) ||
-        (size > (UINT32_MAX - sizeof(uint32_t) - (ALIGNMENT - 1u)))) {
+        (size > ((1u << FL_MAX) - BLOCK_HDR - ALIGNMENT))) {
         return 0;
     }
 
-    uint32_t total = ALIGN_UP(size + sizeof(uint32_t), ALIGNMENT);
+    uint32_t total = kalloc_block_size(size);
     while (1) {
         uint32_t irq_state = irq_save();
-        void *ptr = alloc_from_pages(total);
+        void *ptr = heap_alloc(total);
         if (ptr) {
             irq_restore(irq_state);
-            return (uint8_t *)ptr + sizeof(uint32_t);
+            return (uint8_t *)ptr + BLOCK_HDR;
         }
         irq_restore(irq_state);
-        uint32_t page_size = heap_segment_size(total);
+        /* Room for the block, the end sentinel, and the bin round-up
+         * that mapping_search() applies to large requests. */
+        uint32_t page_size = heap_segment_size(total + (total >> SL_LOG2) + ALIGNMENT);
         if (add_new_page(page_size) != 0) {
             return 0;
         }
@@ -136,11 +347,35 @@ void *krealloc(void *ptr, uint32_t size)
         kfree(ptr);
         return 0;
     }
-    uint8_t *block = (uint8_t *)ptr - sizeof(uint32_t);
-    uint32_t old_size = *((uint32_t *)block) & BLOCK_SIZE_MASK;
+    if (size > ((1u << FL_MAX) - BLOCK_HDR - ALIGNMENT))
+        return 0;
+
+    uint32_t *hdr = (uint32_t *)((uint8_t *)ptr - BLOCK_HDR);
+    uint32_t total = kalloc_block_size(size);
+    uint32_t irq_state = irq_save();
+    uint32_t old_size = block_size(hdr);
+    uint32_t *next;
+
+    /* Shrink, or grow into a free successor without moving */
+    if (total <= old_size) {
+        block_trim(hdr, total);
+        irq_restore(irq_state);
+        return ptr;
+    }
+    next = block_next(hdr);
+    if ((*next & BLOCK_FREE) && (old_size + block_size(next) >= total)) {
+        freelist_remove(next);
+        *hdr = (old_size + block_size(next)) | (*hdr & BLOCK_PREV_FREE);
+        *block_next(hdr) &= ~BLOCK_PREV_FREE;
+        block_trim(hdr, total);
+        irq_restore(irq_state);
+        return ptr;
+    }
+    irq_restore(irq_state);
+
     void *newptr = kalloc(size);
     if (!newptr) return 0;
-    memcpy(newptr, ptr, (size < old_size - sizeof(uint32_t)) ? size : (old_size - sizeof(uint32_t)));
+    memcpy(newptr, ptr, old_size - BLOCK_HDR);
     kfree(ptr);
     return newptr;
 }
@@ -149,86 +384,66 @@ void kfree(void *ptr)
 {
     if (!ptr) return;
     uint32_t irq_state = irq_save();
-    uint8_t *block = (uint8_t *)ptr - sizeof(uint32_t);
-    uint32_t size = *((uint32_t *)block) & BLOCK_SIZE_MASK;
-    *((uint32_t *)block) = size | BLOCK_FREE;
-    for (uint32_t i = 0; i < page_count; i++) {
-        uint8_t *base = (uint8_t *)pages[i].base;
-        if (block >= base && block < base + pages[i].capacity) {
-            try_merge_blocks(base, &pages[i].offset, pages[i].capacity);
-            break;
-        }
-    }
-    irq_restore(irq_state);
-}
+    uint32_t *hdr = (uint32_t *)((uint8_t *)ptr - BLOCK_HDR);
+    uint32_t size = block_size(hdr);
 
-static void *alloc_from_pages(uint32_t size)
-{
-    for (uint32_t i = 0; i < page_count; i++) {
-        struct page *pg = &pages[i];
-        uint8_t *ptr = (uint8_t *)pg->base;
-        uint32_t off = 0;
-        while (off < pg->offset) {
-            uint32_t *hdr = (uint32_t *)(ptr + off);
-            uint32_t blk_size = *hdr & BLOCK_SIZE_MASK;
-            if (blk_size == 0)
-                break;
-            if ((*hdr & BLOCK_FREE) && blk_size >= size) {
-                *hdr = blk_size;
-                return (void *)hdr;
-            }
-            off += blk_size;
-        }
-        if ((uint32_t)(pg->capacity - pg->offset) >= size) {
-            void *p = ptr + pg->offset;
-            *((uint32_t *)p) = size;
-            pg->offset += size;
-            return (uint8_t *)p;
-        }
+    if (*hdr & BLOCK_FREE) {
+        /* Double free: leave the free lists alone */
+        irq_restore(irq_state);
+        return;
     }
-    return 0;
+    if (*hdr & BLOCK_PREV_FREE) {
+        uint32_t *prev = block_prev(hdr);
+        freelist_remove(prev);
+        size += block_size(prev);
+        hdr = prev;
+    }
+    block_release(hdr, size);
+    irq_restore(irq_state);
 }
 
+void kalloc_get_stats(struct kalloc_stats *st)
+{
+    uint32_t irq_state = irq_save();
+    struct free_block *b;
+    uint32_t i;
+    int fl, sl;
 
-static void try_merge_blocks(uint8_t *base, uint32_t *offset, uint32_t capacity)
-{
-    uint32_t off = 0;
-    uint32_t max_used = 0;
-    while (off < *offset && off + sizeof(uint32_t) <= capacity) {
-        uint32_t *hdr = (uint32_t *)(base + off);
-        uint32_t size = *hdr & BLOCK_SIZE_MASK;
-        if (!size)
-            break;
-        uint32_t next_off = off + size;
-        if (!(*hdr & BLOCK_FREE)) {
-            max_used = next_off;
-        } else if (next_off < *offset) {
-            uint32_t *next = (uint32_t *)(base + next_off);
-            uint32_t next_size = *next & BLOCK_SIZE_MASK;
-            if ((*next & BLOCK_FREE) && next_size) {
-                *hdr = (size + next_size) | BLOCK_FREE;
-                continue;
-            }
+    st->pages = page_count;
+    st->heap_bytes = 0;
+    for (i = 0; i < page_count; i++)
+        st->heap_bytes += pages[i].capacity;
+    st->free_bytes = free_bytes;
+    st->free_blocks = free_blocks;
+    st->largest_free = 0;
+    if (fl_bitmap) {
+        fl = fls32(fl_bitmap);
+        sl = fls32(sl_bitmap[fl]);
+        for (b = free_lists[fl][sl]; b; b = b->next) {
+            if (block_size(&b->hdr) > st->largest_free)
+                st->largest_free = block_size(&b->hdr);
         }
-        off = next_off;
     }
-    if (max_used > capacity)
-        max_used = capacity;
-    *offset = max_used;
+    irq_restore(irq_state);
 }
 
 void *sys_mmap_hdlr(uint32_t len, uint16_t pid, uint32_t flags)
 {
     uint32_t size;
+    void *ret;
     pid = this_task_getpid();
     flags = 0;
 
     size = heap_segment_size(len);
-    return secure_mmap(size, pid, flags);
+    ret = secure_mmap(size, pid, flags);
+    if (ret)
+        task_mpu_invalidate(pid);
+    return ret;
 }
 
 int sys_munmap_hdlr(void *addr, uint16_t pid)
 {
     secure_munmap(addr, pid);
+    task_mpu_invalidate(pid);
     return 0;
 }
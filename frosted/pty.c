@@ -37,10 +37,10 @@ static struct devptmx {
 
 
 
+/* Tasks blocked on either side sleep on that side's fnode wait queue. */
 struct devpty {
     struct fnode *fno;
     struct devpts *slave;
-    struct task *task;
     uint16_t idx;
     uint16_t creator_pid;
     int sid;
@@ -48,7 +48,6 @@ struct devpty {
 
 struct devpts {
     struct device *dev;
-    struct task *task;
     struct devpty *master;
     struct cirbuf *miso, *mosi;
     int sid;
@@ -87,14 +86,10 @@ static int pty_release_locked(struct devpty *pty, struct devpts *pts,
         pts->slave_closed = 1;
     }
 
-    if (pty && pty->task) {
-        task_resume(pty->task);
-        pty->task = NULL;
-    }
-    if (pts->task) {
-        task_resume(pts->task);
-        pts->task = NULL;
-    }
+    if (pty && pty->fno)
+        fno_wake(pty->fno, POLLHUP);
+    if (pts->dev && pts->dev->fno)
+        fno_wake(pts->dev->fno, POLLHUP);
 
     if (pts->refs > 0)
         pts->refs--;
@@ -161,8 +156,6 @@ static int pts_create(void)
     pty->fno->flags |= FL_TTY;
     pty->fno->priv = pty;
     pty->slave = pts;
-    pty->task = NULL;
-    pts->task = NULL;
     pty->sid = -1;
     pts->sid = -1;
     pts->refs = 2;
@@ -219,12 +212,10 @@ static int pty_read(struct fnode *fno, void *buf, unsigned int len)
             ret = -EPIPE;
         } else if (cirbuf_bytesinuse(pts->miso) > 0) {
             ret = cirbuf_readbytes(pts->miso, buf, len);
-            if ((ret > 0) && pts->task)
-                task_resume(pts->task);
+            if (ret > 0)
+                fno_wake(pts->dev->fno, POLLOUT);
         } else {
-            pty->task = this_task();
-            task_suspend();
-            ret = SYS_CALL_AGAIN;
+            ret = task_waitq_sleep(&pty->fno->wq, POLLIN);
         }
         mutex_unlock(pts->dev->mutex);
     }
@@ -245,12 +236,10 @@ static int pty_write(struct fnode *fno, const void *buf, unsigned int len)
             ret = -EPIPE;
         } else if (cirbuf_bytesfree(pts->mosi) > 0) {
             ret = cirbuf_writebytes(pts->mosi, buf, len);
-            if ((ret > 0) && pts->task)
-                task_resume(pts->task);
+            if (ret > 0)
+                fno_wake(pts->dev->fno, POLLIN);
         } else {
-            pty->task = this_task();
-            task_suspend();
-            ret = SYS_CALL_AGAIN;
+            ret = task_waitq_sleep(&pty->fno->wq, POLLOUT);
         }
         mutex_unlock(pts->dev->mutex);
     }
@@ -285,9 +274,6 @@ static int pty_poll(struct fnode *fno, uint16_t events, uint16_t *revents)
             ret = 1;
         }
     }
-    if (ret == 0) {
-        pty->task = this_task();
-    }
     mutex_unlock(pts->dev->mutex);
     return ret;
 }
@@ -362,12 +348,10 @@ static int pts_read(struct fnode *fno, void *buf, unsigned int len)
     }
     if (cirbuf_bytesinuse(pts->mosi) > 0) {
         ret = cirbuf_readbytes(pts->mosi, buf, len);
-        if ((ret > 0) && pty->task)
-            task_resume(pty->task);
+        if (ret > 0)
+            fno_wake(pty->fno, POLLOUT);
     } else {
-        pts->task = this_task();
-        task_suspend();
-        ret = SYS_CALL_AGAIN;
+        ret = task_waitq_sleep(&fno->wq, POLLIN);
     }
 out:
     mutex_unlock(pts->dev->mutex);
@@ -390,12 +374,10 @@ static int pts_write(struct fnode *fno, const void *buf, unsigned int len)
     }
     if (cirbuf_bytesfree(pts->miso) > 0) {
         ret = cirbuf_writebytes(pts->miso, buf, len);
-        if ((ret > 0) && pty->task)
-            task_resume(pty->task);
+        if (ret > 0)
+            fno_wake(pty->fno, POLLIN);
     } else {
-        pts->task = this_task();
-        task_suspend();
-        ret = SYS_CALL_AGAIN;
+        ret = task_waitq_sleep(&fno->wq, POLLOUT);
     }
 out:
     mutex_unlock(pts->dev->mutex);
@@ -427,9 +409,6 @@ static int pts_poll(struct fnode *fno, uint16_t events, uint16_t *revents)
         *revents |= POLLIN;
         ret = 1;
     }
-    if (ret == 0) {
-        pts->task = this_task();
-    }
 out:
     mutex_unlock(pts->dev->mutex);
     return ret;
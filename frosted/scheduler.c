@@ -34,6 +34,7 @@ typedef void * _PTR;
 #include "frosted.h"
 #include "pool.h"
 #include "taskmem.h"
+#include "dwt.h"
 
 /* Minimal libc */
 #include "string.h"
@@ -317,8 +318,9 @@ struct filedesc {
     uint32_t flags;
 };
 
+#ifndef CONFIG_MAX_FDS
 #define CONFIG_MAX_FDS 16
-#define CONFIG_MAX_TASKS 16
+#endif
 
 struct filedesc_table {
     uint32_t n_files;
@@ -349,6 +351,15 @@ struct thread_group {
 #endif
 
 
+/* Raw CPU time counters, in DWT cycles */
+struct task_cpu {
+    uint64_t utime;
+    uint64_t stime;
+    uint32_t nvcsw;
+    uint32_t nivcsw;
+    uint32_t nsyscalls;
+};
+
 struct __attribute__((packed)) task_block {
     /* Watch out for alignment here
      * (try to pack togehter smaller fields)
@@ -380,11 +391,24 @@ struct __attribute__((packed)) task_block {
     void *osp;
     void *cur_stack;
     struct task *next;
+    struct task *rq_next;
+    struct task *rq_prev;
+    struct waitq_entry wait;
+    struct waitq_entry *pollwait;
+    uint16_t rq_level;
+    uint16_t on_rq;
+    uint16_t pi_level;      /* 1 + inherited run queue level, 0: none */
+    uint16_t mutex_held;    /* kernel mutexes owned, see locks.c */
+    uint32_t *futex;        /* word waited on in futex_wait() */
+    uint32_t syscalls;      /* finished, see task_syscall_seq() */
     struct task_exec_info exec_info;
     int timer_id;
     uint32_t *specifics;
     uint32_t n_specifics;
     char name[16];
+    struct mpu_task_regions mpu;
+    struct task_cpu cpu;
+    struct task_cpu cpu_children;   /* reaped children */
 };
 
 struct __attribute__((packed)) task {
@@ -392,6 +416,23 @@ struct __attribute__((packed)) task {
     struct task_block tb;
 };
 
+/* tb.wait is linked into wait queues by address. struct task is packed,
+ * but the entry is on a word boundary, so the pointer is aligned. */
+_Static_assert((offsetof(struct task, tb.wait) % 4) == 0,
+               "tb.wait must be word aligned");
+static inline struct waitq_entry *task_wait_entry(struct task *t)
+{
+    return (struct waitq_entry *)((uint8_t *)t + offsetof(struct task, tb.wait));
+}
+
+/* The cached MPU layout, likewise, is updated in place by mpu.c */
+_Static_assert((offsetof(struct task, tb.mpu) % 4) == 0,
+               "tb.mpu must be word aligned");
+static inline struct mpu_task_regions *task_mpu_regions(struct task *t)
+{
+    return (struct mpu_task_regions *)((uint8_t *)t + offsetof(struct task, tb.mpu));
+}
+
 /* Syscall trace record exposed to userland via PTRACE_GET_SYSCALL_INFO. */
 struct strace_event {
     uint32_t nr;
@@ -591,25 +632,161 @@ static struct task *tasklist_get(struct task **list, uint16_t pid)
 
 static struct task *tasks_running = NULL;
 static struct task *tasks_idling = NULL;
+
+/* Priority run queue.
+ *
+ * Every runnable task (except the kernel main thread, which doubles as
+ * the idle task) sits in one FIFO per nice level; level 0 is NICE_RT.
+ * A set bit in rq_bitmap marks a non-empty level, MSB of word 0 first,
+ * so the highest runnable level is found with a single CLZ per word.
+ * tasks_running/tasks_idling remain the membership lists used for
+ * lookups; the run queue only decides who runs next.
+ */
+#define RQ_BITMAP_WORDS ((SCHED_LEVELS + 31) / 32)
+
+struct runqueue {
+    struct task *head;
+    struct task *tail;
+    uint32_t nr;
+    uint32_t picks;
+};
+
+static struct runqueue runqueue[SCHED_LEVELS];
+static uint32_t rq_bitmap[RQ_BITMAP_WORDS];
+
+static uint16_t nice_to_level(int nice)
+{
+    if (nice < NICE_RT)
+        nice = NICE_RT;
+    if (nice > NICE_MAX)
+        nice = NICE_MAX;
+    return (uint16_t)(nice - NICE_RT);
+}
+
+/* Run queue level from nice, or the level inherited from a
+ * higher priority task waiting on a mutex t holds. */
+static uint16_t task_level(struct task *t)
+{
+    uint16_t lvl = nice_to_level(t->tb.nice);
+
+    if (t->tb.pi_level && (t->tb.pi_level - 1 < lvl))
+        lvl = t->tb.pi_level - 1;
+    return lvl;
+}
+
+static void runq_enqueue(struct task *t)
+{
+    struct runqueue *rq;
+    uint16_t lvl;
+
+    if (t->tb.on_rq || ((t->tb.pid == 0) && (t->tb.tid <= 1)))
+        return;
+    lvl = task_level(t);
+    rq = &runqueue[lvl];
+    t->tb.rq_level = lvl;
+    t->tb.rq_next = NULL;
+    t->tb.rq_prev = rq->tail;
+    if (rq->tail)
+        rq->tail->tb.rq_next = t;
+    else
+        rq->head = t;
+    rq->tail = t;
+    rq->nr++;
+    rq_bitmap[lvl >> 5] |= (0x80000000UL >> (lvl & 0x1F));
+    t->tb.on_rq = 1;
+}
+
+static void runq_dequeue(struct task *t)
+{
+    struct runqueue *rq;
+    uint16_t lvl;
+
+    if (!t->tb.on_rq)
+        return;
+    lvl = t->tb.rq_level;
+    rq = &runqueue[lvl];
+    if (t->tb.rq_prev)
+        t->tb.rq_prev->tb.rq_next = t->tb.rq_next;
+    else
+        rq->head = t->tb.rq_next;
+    if (t->tb.rq_next)
+        t->tb.rq_next->tb.rq_prev = t->tb.rq_prev;
+    else
+        rq->tail = t->tb.rq_prev;
+    t->tb.rq_next = NULL;
+    t->tb.rq_prev = NULL;
+    t->tb.on_rq = 0;
+    if (--rq->nr == 0)
+        rq_bitmap[lvl >> 5] &= ~(0x80000000UL >> (lvl & 0x1F));
+}
+
+static int runq_first_level(void)
+{
+    int w;
+
+    for (w = 0; w < RQ_BITMAP_WORDS; w++) {
+        if (rq_bitmap[w])
+            return (w << 5) + __builtin_clz(rq_bitmap[w]);
+    }
+    return -1;
+}
+
+/* Returns 1 if 'w' should take the CPU from 'cur' right away. */
+static int runq_preempts(struct task *w, struct task *cur)
+{
+    if (!w->tb.on_rq)
+        return 0;
+    if (!cur->tb.on_rq)
+        return 1;
+    return (w->tb.rq_level < cur->tb.rq_level);
+}
+
+int scheduler_runqueue_stats(int level, uint32_t *nr, uint32_t *picks)
+{
+    if ((level < 0) || (level >= SCHED_LEVELS))
+        return -1;
+    *nr = runqueue[level].nr;
+    *picks = runqueue[level].picks;
+    return 0;
+}
+
+int scheduler_runnable(void)
+{
+    return (runq_first_level() >= 0);
+}
+
+static void running_add(struct task *t)
+{
+    tasklist_add(&tasks_running, t);
+    runq_enqueue(t);
+}
+
+static int running_del(struct task *t)
+{
+    runq_dequeue(t);
+    return tasklist_del(&tasks_running, t);
+}
 void task_resume(struct task *t);
 void task_resume_lock(struct task *t);
 void task_stop(struct task *t);
 void task_continue(struct task *t);
 void task_terminate(struct task *t);
 static void task_suspend_to(int newstate);
+static void task_waitq_release(struct task *t);
+static void task_waitq_abandon(struct task *t);
 
 static void ftable_destroy(struct task *t);
 static void idling_to_running(struct task *t)
 {
     if (tasklist_del(&tasks_idling, t) == 0)
-        tasklist_add(&tasks_running, t);
+        running_add(t);
 }
 
 static void running_to_idling(struct task *t)
 {
     if ((t->tb.pid < 1) && (t->tb.tid <= 1))
         return;
-    if (tasklist_del(&tasks_running, t) == 0)
+    if (running_del(t) == 0)
         tasklist_add(&tasks_idling, t);
 }
 
@@ -636,6 +813,48 @@ int task_is_live(struct task *t, uint16_t pid)
            task_is_live_in_list(tasks_idling, t, pid);
 }
 
+uint32_t task_syscall_seq(struct task *t)
+{
+    if (!t)
+        return 0;
+    return t->tb.syscalls;
+}
+
+/* Drop the cached MPU layout of every task whose memory map depends on
+ * @pid: the task itself, its threads, and a vfork child still borrowing
+ * the parent's stack and data. Must be called after any secure_mmap(),
+ * secure_munmap(), secure_swap_stack() or ownership change for @pid.
+ */
+void task_mpu_invalidate(uint16_t pid)
+{
+    struct task *t;
+    uint32_t irq_state;
+
+    if (pid == 0)
+        return;
+
+    irq_state = irq_save();
+    for (t = tasks_running; t; t = t->tb.next) {
+        if ((t->tb.pid == pid) || (t->tb.ppid == pid))
+            t->tb.mpu.valid = 0;
+    }
+    for (t = tasks_idling; t; t = t->tb.next) {
+        if ((t->tb.pid == pid) || (t->tb.ppid == pid))
+            t->tb.mpu.valid = 0;
+    }
+    irq_restore(irq_state);
+}
+
+/* Program the MPU for @t, reusing its cached layout when still valid. */
+static void task_mpu_on(struct task *t)
+{
+    uint16_t ppid = 0;
+
+    if (t->tb.flags & TASK_FLAG_VFORK_CHILD)
+        ppid = t->tb.ppid;
+    mpu_task_regions_on(task_mpu_regions(t), t->tb.pid, ppid);
+}
+
 static void task_clear_links_to(struct task *dead)
 {
     struct task *t;
@@ -696,7 +915,8 @@ static void task_destroy(void *arg)
     if (!t)
         return;
     task_clear_links_to(t);
-    tasklist_del(&tasks_running, t);
+    task_waitq_abandon(t);
+    running_del(t);
     tasklist_del(&tasks_idling, t);
 #ifdef CONFIG_PTHREADS
     grp = t->tb.tgroup;
@@ -784,7 +1004,6 @@ static void task_destroy(void *arg)
 }
 
 static struct task *_cur_task = NULL;
-static struct task *forced_task = NULL;
 
 static __inl int in_kernel(void)
 {
@@ -817,6 +1036,151 @@ int task_in_syscall(void)
             TASK_FLAG_IN_SYSCALL);
 }
 
+/* CPU time accounting.
+ *
+ * Every context switch and every syscall entry and exit charges the DWT
+ * cycles elapsed since the previous one to the current task: to stime
+ * while it is inside a syscall, to utime otherwise. Interrupts are
+ * charged to whoever they interrupted; the kernel thread's utime is idle
+ * time plus tasklets. CYCCNT usually stops while the core sleeps in
+ * WFI: the idle loop times its sleeps with SysTick and the cycles
+ * missed are added by scheduler_acct_idle().
+ */
+static uint32_t acct_stamp;
+static uint32_t sched_switches;
+/* Cycles spent in task_switch() over the last sched_stat_n calls;
+ * all three are halved before the sums overflow. */
+static uint32_t sched_sw_cycles;
+static uint32_t sched_acct_cycles;
+static uint32_t sched_stat_n;
+
+static __inl void task_acct(struct task *t, uint32_t now)
+{
+    uint32_t d = now - acct_stamp;
+
+    acct_stamp = now;
+    if (t->tb.flags & TASK_FLAG_IN_SYSCALL)
+        t->tb.cpu.stime += d;
+    else
+        t->tb.cpu.utime += d;
+}
+
+/* Called from sv_call_handler() around the syscall, while
+ * TASK_FLAG_IN_SYSCALL is still clear (enter) or still set (exit). */
+static void syscall_acct_enter(void)
+{
+    task_acct(_cur_task, dwt_cyccnt());
+    _cur_task->tb.cpu.nsyscalls++;
+}
+
+static void syscall_acct_exit(void)
+{
+    task_acct(_cur_task, dwt_cyccnt());
+}
+
+void scheduler_acct_idle(uint32_t cycles, uint32_t counted)
+{
+    if (cycles > counted)
+        kernel->tb.cpu.utime += cycles - counted;
+}
+
+/* 'src' is taken by value: the counters live in the packed struct task,
+ * whose members are copied rather than pointed to. */
+static void task_cpu_add(struct task_cpu *dst, struct task_cpu src)
+{
+    dst->utime += src.utime;
+    dst->stime += src.stime;
+    dst->nvcsw += src.nvcsw;
+    dst->nivcsw += src.nivcsw;
+    dst->nsyscalls += src.nsyscalls;
+}
+
+/* n / d for d < 65536, one 16-bit digit at a time: no 64-bit division */
+static uint64_t div64_u16(uint64_t n, uint32_t d, uint32_t *rem)
+{
+    uint64_t q = 0;
+    uint32_t r = 0;
+    uint32_t x;
+    int i;
+
+    for (i = 48; i >= 0; i -= 16) {
+        x = (r << 16) | (uint32_t)((n >> i) & 0xFFFF);
+        q = (q << 16) | (x / d);
+        r = x % d;
+    }
+    if (rem)
+        *rem = r;
+    return q;
+}
+
+static void cycles_to_time(uint64_t cycles, uint32_t *sec, uint32_t *usec)
+{
+    uint32_t us_rem, ms_rem;
+    uint64_t t;
+
+    t = div64_u16(cycles, CONFIG_SYS_CLOCK / 1000000, NULL);
+    t = div64_u16(t, 1000, &us_rem);
+    t = div64_u16(t, 1000, &ms_rem);
+    *sec = (uint32_t)t;
+    *usec = ms_rem * 1000 + us_rem;
+}
+
+static void tasklist_cpu_sum(struct task *list, int pid, int children,
+                             struct task_cpu *sum)
+{
+    struct task *t;
+
+    for (t = list; t; t = t->tb.next) {
+        if (t->tb.pid != pid)
+            continue;
+        task_cpu_add(sum, children ? t->tb.cpu_children : t->tb.cpu);
+    }
+}
+
+/* Sum the counters of all the threads of 'pid', or of its reaped children.
+ * Returns -1 if there is no such process. */
+static int task_cpu_get(int pid, int children, struct task_cpu *sum)
+{
+    uint32_t flags;
+
+    if (!tasklist_get(&tasks_running, pid) && !tasklist_get(&tasks_idling, pid))
+        return -1;
+    memset(sum, 0, sizeof(*sum));
+    flags = irq_save();
+    /* bring the caller's own counters up to date */
+    task_acct(_cur_task, dwt_cyccnt());
+    tasklist_cpu_sum(tasks_running, pid, children, sum);
+    tasklist_cpu_sum(tasks_idling, pid, children, sum);
+    irq_restore(flags);
+    return 0;
+}
+
+int scheduler_task_cputime(int pid, struct task_cputime *ct)
+{
+    struct task_cpu cpu;
+
+    if (task_cpu_get(pid, 0, &cpu) < 0)
+        return -1;
+    cycles_to_time(cpu.utime, &ct->utime_sec, &ct->utime_usec);
+    cycles_to_time(cpu.stime, &ct->stime_sec, &ct->stime_usec);
+    ct->nvcsw = cpu.nvcsw;
+    ct->nivcsw = cpu.nivcsw;
+    ct->nsyscalls = cpu.nsyscalls;
+    return 0;
+}
+
+void scheduler_switch_stats(uint32_t *switches, uint32_t *sw_cycles,
+                            uint32_t *acct_cycles)
+{
+    uint32_t flags = irq_save();
+    uint32_t n = sched_stat_n;
+
+    *switches = sched_switches;
+    *sw_cycles = n ? sched_sw_cycles / n : 0;
+    *acct_cycles = n ? sched_acct_cycles / n : 0;
+    irq_restore(flags);
+}
+
 static int next_pid(void)
 {
     static unsigned int next_available = 0;
@@ -924,6 +1288,7 @@ static int task_filedesc_del_from_task(struct task *t, int fd)
     /* If this was the last user of the file, close it. */
     fno->usage_count--;
     if (fno->usage_count <= 0) {
+        waitq_flush(&fno->wq);
         if (fno->owner && fno->owner->ops.close)
             fno->owner->ops.close(fno);
     }
@@ -1620,6 +1985,8 @@ static void task_create_real(struct task *new, void *arg, unsigned int nice)
     new->tb.timer_id = -1;
     new->tb.specifics = NULL;
     new->tb.n_specifics = 0;
+    /* Stack and data segments are about to change */
+    task_mpu_invalidate(new->tb.pid);
 
     if ((new->tb.flags & TASK_FLAG_VFORK_CHILD) != 0) {
         struct task *pt = tasklist_get(&tasks_idling, new->tb.ppid);
@@ -1638,6 +2005,7 @@ static void task_create_real(struct task *new, void *arg, unsigned int nice)
             /* Restore parent's stack and put it back in the schedule */
             memcpy(pt->stack, new->stack, SCHEDULER_STACK_SIZE);
             secure_swap_stack(pt->tb.pid, new->tb.pid);
+            task_mpu_invalidate(pt->tb.pid);
             task_resume_vfork(pt);
         }
         new->tb.flags &= (~TASK_FLAG_VFORK_CHILD);
@@ -1723,7 +2091,7 @@ int task_create(struct task_exec_info *exec_info, void *arg, unsigned int nice)
     }
 
     new->tb.next = NULL;
-    tasklist_add(&tasks_running, new);
+    running_add(new);
 
     number_of_tasks++;
     memcpy(&new->tb.exec_info, exec_info, sizeof(struct task_exec_info));
@@ -1771,7 +2139,7 @@ int scheduler_exec(struct task_exec_info *info, void *args)
     }
     asm volatile("msr " PSP ", %0" ::"r"(_cur_task->tb.sp));
     t->tb.state = TASK_RUNNING;
-    mpu_task_on(_cur_task->tb.pid, 0);
+    task_mpu_on(_cur_task);
     return 0;
 }
 
@@ -1833,7 +2201,7 @@ int sys_vfork_hdlr(void)
 
 
     new->tb.next = NULL;
-    tasklist_add(&tasks_running, new);
+    running_add(new);
     number_of_tasks++;
 
     /* Set parent's vfork retval by writing on stacked r0 */
@@ -1851,6 +2219,7 @@ int sys_vfork_hdlr(void)
     if (new != _cur_task) {
         /* Swap the stack spaces */
         secure_swap_stack(new->tb.ppid, new->tb.pid);
+        task_mpu_invalidate(new->tb.ppid);
         new->tb.cur_stack = _cur_task->tb.cur_stack;
         new->tb.state = TASK_RUNNABLE;
     }
@@ -2005,7 +2374,7 @@ static inline void thread_create(struct task *new,
     new->tb.start = start_routine;
     new->tb.arg = arg;
     new->tb.next = NULL;
-    tasklist_add(&tasks_running, new);
+    running_add(new);
     number_of_tasks++;
     new->tb.timeslice = TIMESLICE(new);
     new->tb.state = TASK_RUNNABLE;
@@ -2145,7 +2514,7 @@ int kthread_cancel(struct task *t)
     if (!t || (t->tb.pid != 0) || (t->tb.tid <= 1))
         return -1;
     irq_off();
-    if (tasklist_del(&tasks_running, t) == 0)
+    if (running_del(t) == 0)
         tasklist_add(&tasks_idling, t);
     t->tb.state = TASK_OVER;
     tasklet_add(task_destroy, t);
@@ -2521,24 +2890,73 @@ static __naked void restore_task_context(void)
 
 static __inl void task_switch(void)
 {
-    struct task *t;
-    if (forced_task) {
-        _cur_task = forced_task;
-        forced_task = NULL;
-        return;
+    struct task *prev = _cur_task;
+    struct task *t = _cur_task;
+    uint32_t start = dwt_cyccnt();
+    uint32_t acct;
+    int lvl;
+
+    /* A task that used up (or gave away) its timeslice goes to the back
+     * of its level. A task preempted by a higher level keeps its place
+     * and the rest of its slice.
+     */
+    if (t->tb.on_rq && (t->tb.timeslice == 0)) {
+        runq_dequeue(t);
+        runq_enqueue(t);
+    }
+
+    /* Pending tasklets (deferred ISR work, ktimers) run in the kernel
+     * thread, ahead of any task. With nothing runnable, the kernel
+     * thread is the idle task.
+     */
+    if (tasklets_pending()) {
+        t = kernel;
+    } else {
+        t = NULL;
+        while ((lvl = runq_first_level()) >= 0) {
+            t = runqueue[lvl].head;
+            if ((t->tb.state == TASK_RUNNING) || (t->tb.state == TASK_RUNNABLE))
+                break;
+            /* Stale entry: the task left the runnable states without
+             * going through running_to_idling(). */
+            runq_dequeue(t);
+            t = NULL;
+        }
+        if (!t)
+            t = kernel;
+        else
+            runqueue[lvl].picks++;
+    }
+    if (t->tb.timeslice == 0)
+        t->tb.timeslice = TIMESLICE(t);
+
+    /* Charge 'prev' up to the start of the switch; the rest of it goes
+     * to the next task. */
+    acct = dwt_cyccnt();
+    task_acct(prev, start);
+    if (t != prev) {
+        sched_switches++;
+        if (prev->tb.state == TASK_RUNNABLE)
+            prev->tb.cpu.nivcsw++;
+        else
+            prev->tb.cpu.nvcsw++;
     }
-    t = _cur_task;
-    /* Checks that the _cur_task hasn't left the "task_running" list.
-     * If it's not in the valid state, revert task-switching to the head of
-     * task_running */
-    if (((t->tb.state != TASK_RUNNING) && (t->tb.state != TASK_RUNNABLE)) ||
-        (t->tb.next == NULL))
-        t = tasks_running;
-    else
-        t = t->tb.next;
-    t->tb.timeslice = TIMESLICE(t);
     t->tb.state = TASK_RUNNING;
     _cur_task = t;
+
+    /* Checked here rather than in pend_sv_handler(): kprintf() needs a
+     * stack frame, which a naked function does not have. */
+    if (((int)(t->tb.sp) - (int)(&t->stack)) < STACK_THRESHOLD)
+        kprintf("PendSV: Process %d is running out of stack space!\n", t->tb.pid);
+
+    sched_acct_cycles += dwt_cyccnt() - acct;
+    sched_sw_cycles += dwt_cyccnt() - start;
+    sched_stat_n++;
+    if (sched_sw_cycles & 0x80000000UL) {
+        sched_sw_cycles >>= 1;
+        sched_acct_cycles >>= 1;
+        sched_stat_n >>= 1;
+    }
 }
 
 #pragma GCC push_options
@@ -2573,12 +2991,6 @@ void __naked pend_sv_handler(void)
     //        _cur_task->tb.sp += 32;
     //    }
 
-    if (((int)(_cur_task->tb.sp) - (int)(&_cur_task->stack)) <
-        STACK_THRESHOLD) {
-        kprintf("PendSV: Process %d is running out of stack space!\n",
-                _cur_task->tb.pid);
-    }
-
     /* write new stack pointer and restore context */
     if (in_kernel()) {
         asm volatile("msr " MSP ", %0" ::"r"(_cur_task->tb.sp));
@@ -2593,10 +3005,7 @@ void __naked pend_sv_handler(void)
         asm volatile("isb");
         restore_task_context();
         runnable = RUN_USER;
-        if (_cur_task->tb.flags & TASK_FLAG_VFORK_CHILD)
-            mpu_task_on(_cur_task->tb.pid, _cur_task->tb.ppid);
-        else
-            mpu_task_on(_cur_task->tb.pid, 0);
+        task_mpu_on(_cur_task);
         asm volatile("msr control, %0" ::"r"(0x03) : "memory");
         asm volatile("isb");
     }
@@ -2641,6 +3050,8 @@ void kernel_task_init(void)
     kernel->tb.state = TASK_RUNNABLE;
     kernel->tb.next = NULL;
     tasklist_add(&tasks_running, kernel);
+    dwt_cyccnt_enable();
+    acct_stamp = dwt_cyccnt();
     irq_on();
 
     /* Set kernel as current task */
@@ -2666,6 +3077,177 @@ void task_suspend(void)
     return task_suspend_to(TASK_WAITING);
 }
 
+int task_waitq_sleep(struct waitq *wq, uint16_t events)
+{
+    struct waitq_entry *e = task_wait_entry(_cur_task);
+
+    e->task = _cur_task;
+    e->func = NULL;
+    e->events = events;
+    waitq_add(wq, e);
+    task_suspend();
+    return SYS_CALL_AGAIN;
+}
+
+/* Like task_waitq_sleep(), bounded by timeout_ms (< 0: no bound). The
+ * timer is armed on the first call only; the restarted syscall checks
+ * task_timed_out() and calls task_timeout_cancel() once it is done.
+ */
+int task_waitq_sleep_timeout(struct waitq *wq, uint16_t events, int timeout_ms)
+{
+    if ((timeout_ms > 0) && (_cur_task->tb.timer_id < 0))
+        _cur_task->tb.timer_id =
+            ktimer_add((uint32_t)timeout_ms, sleepy_task_wakeup, _cur_task);
+    return task_waitq_sleep(wq, events);
+}
+
+int task_timed_out(void)
+{
+    if ((_cur_task->tb.flags & TASK_FLAG_TIMEOUT) == 0)
+        return 0;
+    _cur_task->tb.flags &= (~TASK_FLAG_TIMEOUT);
+    return 1;
+}
+
+void task_timeout_cancel(void)
+{
+    if (_cur_task->tb.timer_id >= 0) {
+        ktimer_del(_cur_task->tb.timer_id);
+        _cur_task->tb.timer_id = -1;
+    }
+    _cur_task->tb.flags &= (~TASK_FLAG_TIMEOUT);
+}
+
+/* Futexes: sleep on a word in user memory until another task wakes the
+ * address. Userspace does the locking (pthread mutexes, see
+ * frosted-headers/sys/frosted_pthread_mutex.c) and only comes here when
+ * contended. There is no MMU: the user address is the physical one, so
+ * threads and processes sharing the word meet on the same key. Waiters
+ * are hashed by address; the task's own wait entry is used.
+ */
+#define FUTEX_HASH 16
+#define WQ_FUTEX 0x4000
+
+static struct waitq futex_wq[FUTEX_HASH];
+
+static struct waitq *futex_bucket(uint32_t *uaddr)
+{
+    uint32_t a = (uint32_t)uaddr;
+
+    return &futex_wq[((a >> 2) ^ (a >> 6)) & (FUTEX_HASH - 1)];
+}
+
+int sys_futex_wait_hdlr(uint32_t *uaddr, uint32_t val, int timeout_ms)
+{
+    struct waitq_entry *e = task_wait_entry(_cur_task);
+    struct waitq *wq;
+
+    if (!uaddr || ((uint32_t)uaddr & 3))
+        return -EINVAL;
+    if (task_ptr_valid(uaddr))
+        return -EACCES;
+    wq = futex_bucket(uaddr);
+
+    /* Restarted after a wakeup or a timeout */
+    if ((e->wq == wq) && (_cur_task->tb.futex == uaddr)) {
+        if (e->ready) {
+            waitq_del(e);
+            task_timeout_cancel();
+            return 0;
+        }
+        if (task_timed_out()) {
+            waitq_del(e);
+            task_timeout_cancel();
+            return -ETIMEDOUT;
+        }
+    }
+    /* Syscalls are not preempted: nobody can change the word from here
+     * until the task is on the queue. */
+    if (*uaddr != val) {
+        task_timeout_cancel();
+        return -EAGAIN;
+    }
+    if (timeout_ms == 0)
+        return -ETIMEDOUT;
+    _cur_task->tb.futex = uaddr;
+    return task_waitq_sleep_timeout(wq, WQ_FUTEX, timeout_ms);
+}
+
+/* Wake up to n tasks waiting on uaddr, most urgent first */
+int sys_futex_wake_hdlr(uint32_t *uaddr, int n)
+{
+    struct waitq *wq;
+    struct waitq_entry *e, *best;
+    uint32_t irq_state;
+    int woken = 0;
+    int preempt = 0;
+
+    if (!uaddr || ((uint32_t)uaddr & 3))
+        return -EINVAL;
+    if (task_ptr_valid(uaddr))
+        return -EACCES;
+    wq = futex_bucket(uaddr);
+    irq_state = irq_save();
+    while (woken < n) {
+        best = NULL;
+        for (e = wq->head; e; e = e->next) {
+            if (e->ready || (e->task->tb.futex != uaddr))
+                continue;
+            /* Entries are pushed at the head: older ones win ties */
+            if (!best || (task_level(e->task) <= task_level(best->task)))
+                best = e;
+        }
+        if (!best)
+            break;
+        best->ready |= WQ_FUTEX;
+        task_resume_lock(best->task);
+        preempt |= runq_preempts(best->task, _cur_task);
+        woken++;
+    }
+    irq_restore(irq_state);
+    if (preempt)
+        schedule();
+    return woken;
+}
+
+/* Unlink every wait queue entry owned by t. Called when a task leaves
+ * the kernel without going back to sleep, and when it dies.
+ */
+static void task_waitq_release(struct task *t)
+{
+    struct waitq_entry *pw = t->tb.pollwait;
+    struct waitq *wq = t->tb.wait.wq;
+    int i;
+
+    if (wq) {
+        waitq_del(task_wait_entry(t));
+        /* Woken by a lock, gone without taking it: wake someone else */
+        if ((t->tb.wait.events & WQ_LOCK) && t->tb.wait.ready)
+            lock_waiter_abandon(wq);
+    }
+    if (pw) {
+        t->tb.pollwait = NULL;
+        for (i = 0; pw[i].task; i++)
+            waitq_del(&pw[i]);
+        kfree(pw);
+    }
+}
+
+/* t gives up the syscall it was going to restart (signal, exit). Others
+ * on the queue it was woken from may be waiting for it to come back and
+ * finish (see devspi_xfer_sleep()): wake them to look again. Lock
+ * queues pass the wakeup on by themselves. */
+static void task_waitq_abandon(struct task *t)
+{
+    struct waitq *wq = t->tb.wait.wq;
+    uint16_t events = t->tb.wait.events;
+    int woken = t->tb.wait.ready && !(events & WQ_LOCK);
+
+    task_waitq_release(t);
+    if (wq && woken)
+        waitq_wake(wq, events);
+}
+
 void task_stop(struct task *t)
 {
     if (!t)
@@ -2715,10 +3297,8 @@ static void task_resume_real(struct task *t, int lock)
         idling_to_running(t);
         t->tb.state = TASK_RUNNABLE;
     }
-    if (!lock && (t->tb.nice == NICE_RT)) {
-        forced_task = t;
-        task_preempt_all();
-    }
+    if (!lock && runq_preempts(t, _cur_task))
+        schedule();
 }
 
 void task_resume_lock(struct task *t)
@@ -2793,6 +3373,7 @@ void task_terminate(struct task *t)
                 if (pt) {
                     memcpy(t->stack, pt->stack, SCHEDULER_STACK_SIZE);
                     secure_swap_stack(pt->tb.pid, t->tb.pid);
+                    task_mpu_invalidate(pt->tb.pid);
                 }
                 task_resume_vfork(t);
             }
@@ -2938,70 +3519,125 @@ int sys_sched_yield_hdlr(void)
     return 0;
 }
 
-int sys_poll_hdlr(struct pollfd *pfd, int n, int timeout_param)
+/* Check every fd once. Returns the number of ready fds, or a negative
+ * error for an fd that cannot be polled.
+ */
+static int poll_scan(struct pollfd *pfd, int n)
 {
+    struct fnode *f;
+    int i, ret = 0;
+
+    for (i = 0; i < n; i++) {
+        f = task_filedesc_get(pfd[i].fd);
+        if (!f || !f->owner || !f->owner->ops.poll) {
+            return -EOPNOTSUPP;
+        }
+        pfd[i].revents = 0;
+        ret += f->owner->ops.poll(f, pfd[i].events, &pfd[i].revents);
+    }
+    return ret;
+}
+
+/* Link one wait queue entry per fd, so that only the drivers that
+ * signal readiness get polled again on wakeup. If the entries cannot
+ * be allocated poll() falls back to rescanning every fd.
+ */
+static void poll_register(struct pollfd *pfd, int n)
+{
+    struct waitq_entry *pw;
+    struct fnode *f;
     int i;
-    uint32_t timeout = 0;
-    int endless = 0;
-    int ret = 0;
+
+    pw = kcalloc(n + 1, sizeof(struct waitq_entry));
+    if (!pw)
+        return;
+    for (i = 0; i < n; i++) {
+        f = task_filedesc_get(pfd[i].fd);
+        pw[i].task = _cur_task;
+        pw[i].events = pfd[i].events;
+        waitq_add(&f->wq, &pw[i]);
+    }
+    _cur_task->tb.pollwait = pw;
+}
+
+/* Re-poll the fds whose wait queue was signalled. A wakeup that did not
+ * come through a wait queue (a driver resuming the task directly) makes
+ * every fd a candidate.
+ */
+static int poll_rescan(struct pollfd *pfd, int n)
+{
+    struct waitq_entry *pw = _cur_task->tb.pollwait;
     struct fnode *f;
+    int i, ret = 0, signalled = 0;
+
+    for (i = 0; i < n; i++) {
+        pfd[i].revents = 0;
+        if (pw[i].ready == 0)
+            continue;
+        pw[i].ready = 0;
+        signalled++;
+        f = task_filedesc_get(pfd[i].fd);
+        if (!f || (pw[i].wq != &f->wq)) {
+            pfd[i].revents = POLLNVAL;
+            ret++;
+            continue;
+        }
+        ret += f->owner->ops.poll(f, pfd[i].events, &pfd[i].revents);
+    }
+    if (signalled == 0)
+        return poll_scan(pfd, n);
+    return ret;
+}
+
+int sys_poll_hdlr(struct pollfd *pfd, int n, int timeout_param)
+{
+    int ret = 0;
 
     if (!pfd || task_ptr_valid(pfd))
         return -EACCES;
-
-    if (timeout_param < 0) {
-        endless = 1;
-    }
+    if ((n < 0) || (n > CONFIG_MAX_FDS))
+        return -EINVAL;
 
     if ((_cur_task->tb.flags & TASK_FLAG_TIMEOUT) != 0) {
         _cur_task->tb.flags &= (~TASK_FLAG_TIMEOUT);
+        task_waitq_release(_cur_task);
         return 0;
     }
 
-    if (!endless) {
-        if ((_cur_task->tb.flags & TASK_FLAG_TIMEOUT) == 0)
-            timeout = (uint32_t)jiffies + (uint32_t)timeout_param;
-        else
-            timeout = (uint32_t)jiffies;
-    }
-
-    while (endless || !jiffies_after((uint32_t)jiffies, timeout)) {
-        for (i = 0; i < n; i++) {
-            f = task_filedesc_get(pfd[i].fd);
-            if (!f || !f->owner || !f->owner->ops.poll) {
-                return -EOPNOTSUPP;
-            }
-            pfd[i].revents = 0;
-            ret += f->owner->ops.poll(f, pfd[i].events, &pfd[i].revents);
-        }
-        if (ret > 0) {
-            if (this_task()->tb.timer_id >= 0) {
-                ktimer_del(this_task()->tb.timer_id);
-                this_task()->tb.timer_id = -1;
-            }
-            _cur_task->tb.flags &= (~TASK_FLAG_TIMEOUT);
-            return ret;
-        }
+    if (_cur_task->tb.pollwait)
+        ret = poll_rescan(pfd, n);
+    else
+        ret = poll_scan(pfd, n);
 
-        if (!endless && (this_task()->tb.timer_id < 0)) {
-            uint32_t now = (uint32_t)jiffies;
-            uint32_t delay = jiffies_after(now, timeout) ? 0u : (timeout - now);
-            this_task()->tb.timer_id =
-                ktimer_add(delay, sleepy_task_wakeup, this_task());
+    if (ret != 0) {
+        if (this_task()->tb.timer_id >= 0) {
+            ktimer_del(this_task()->tb.timer_id);
+            this_task()->tb.timer_id = -1;
         }
-        task_suspend();
-        return SYS_CALL_AGAIN;
+        _cur_task->tb.flags &= (~TASK_FLAG_TIMEOUT);
+        task_waitq_release(_cur_task);
+        return ret;
     }
-    if (_cur_task->tb.timer_id >= 0) {
-        ktimer_del(_cur_task->tb.timer_id);
-        _cur_task->tb.timer_id = -1;
+
+    if (timeout_param == 0)
+        return 0;
+
+    if (!_cur_task->tb.pollwait)
+        poll_register(pfd, n);
+
+    /* The timer is armed once, on the first pass: restarts keep it */
+    if ((timeout_param > 0) && (this_task()->tb.timer_id < 0)) {
+        this_task()->tb.timer_id =
+            ktimer_add((uint32_t)timeout_param, sleepy_task_wakeup, this_task());
     }
-    return 0;
+    task_suspend();
+    return SYS_CALL_AGAIN;
 }
 
 int sys_waitpid_hdlr(int pid, int *status , int options)
 {
     struct task *t = NULL;
+    struct task_cpu children;
     if (status && task_ptr_valid(status))
         return -EACCES;
     if (pid == 0)
@@ -3063,6 +3699,10 @@ child_found:
         *status = t->tb.exitval;
     }
     pid = t->tb.pid;
+    children = _cur_task->tb.cpu_children;
+    task_cpu_add(&children, t->tb.cpu);
+    task_cpu_add(&children, t->tb.cpu_children);
+    _cur_task->tb.cpu_children = children;
     /* if this is a thread this is the last active one because it sent a SIGCHLD
      */
 #ifdef CONFIG_PTHREADS
@@ -3293,6 +3933,88 @@ int sys_ptrace_hdlr(enum __ptrace_request request, uint32_t pid, void *addr, voi
     return -1;
 }
 
+/* Apply a new nice value to every thread of process 'pid', moving
+ * runnable ones to the matching run queue level.
+ */
+static void task_set_nice(uint16_t pid, int nice)
+{
+    struct task *lists[2] = { tasks_running, tasks_idling };
+    struct task *t;
+    uint32_t flags;
+    int i, lvl;
+
+    flags = irq_save();
+    for (i = 0; i < 2; i++) {
+        for (t = lists[i]; t; t = t->tb.next) {
+            if (t->tb.pid != pid)
+                continue;
+            if (t->tb.on_rq) {
+                runq_dequeue(t);
+                t->tb.nice = (int8_t)nice;
+                runq_enqueue(t);
+            } else {
+                t->tb.nice = (int8_t)nice;
+            }
+        }
+    }
+    lvl = runq_first_level();
+    irq_restore(flags);
+    if ((lvl >= 0) && (!_cur_task->tb.on_rq || (lvl < _cur_task->tb.rq_level)))
+        schedule();
+}
+
+int task_prio(struct task *t)
+{
+    return task_level(t);
+}
+
+void task_prio_inherit(struct task *t, int prio)
+{
+    uint16_t pi = (prio < 0) ? 0 : (uint16_t)(prio + 1);
+    uint32_t flags;
+    int lvl;
+
+    if (!t || (t->tb.pi_level == pi))
+        return;
+    flags = irq_save();
+    if (t->tb.on_rq) {
+        runq_dequeue(t);
+        t->tb.pi_level = pi;
+        runq_enqueue(t);
+    } else {
+        t->tb.pi_level = pi;
+    }
+    lvl = runq_first_level();
+    irq_restore(flags);
+    if ((lvl >= 0) && (!_cur_task->tb.on_rq || (lvl < _cur_task->tb.rq_level)))
+        schedule();
+}
+
+int task_prio_boosted(struct task *t)
+{
+    return t && (t->tb.pi_level != 0);
+}
+
+int task_mutex_held(struct task *t, int delta)
+{
+    if (!t)
+        return 0;
+    if ((delta < 0) && (t->tb.mutex_held < (uint16_t)(-delta)))
+        t->tb.mutex_held = 0;
+    else
+        t->tb.mutex_held += delta;
+    return t->tb.mutex_held;
+}
+
+struct waitq *task_waiting_on(struct task *t)
+{
+    if (!t || (t->tb.state != TASK_WAITING))
+        return NULL;
+    if (!(t->tb.wait.events & WQ_LOCK) || t->tb.wait.ready)
+        return NULL;
+    return t->tb.wait.wq;
+}
+
 int sys_setpriority_hdlr(int which, int pid, int nice)
 {
     struct task *t = tasklist_get(&tasks_idling, pid);
@@ -3304,7 +4026,11 @@ int sys_setpriority_hdlr(int which, int pid, int nice)
     if (!t)
         return -ESRCH;
 
-    t->tb.nice = nice;
+    if (nice < NICE_RT)
+        nice = NICE_RT;
+    if (nice > NICE_MAX)
+        nice = NICE_MAX;
+    task_set_nice(t->tb.pid, nice);
     return 0;
 }
 
@@ -3322,6 +4048,44 @@ int sys_getpriority_hdlr(int which, int pid)
     return (int)t->tb.nice;
 }
 
+/* Userland struct rusage, assuming newlib time_t is long */
+struct rusage_kernel {
+    long utime_sec;
+    long utime_usec;
+    long stime_sec;
+    long stime_usec;
+    long maxrss;
+    long unused[11];    /* ru_ixrss .. ru_nsignals */
+    long nvcsw;
+    long nivcsw;
+};
+
+int sys_getrusage_hdlr(int who, struct rusage_kernel *ru)
+{
+    struct task_cpu cpu;
+    uint32_t sec, usec;
+
+    if (!ru)
+        return -EFAULT;
+    if (task_ptr_range_valid(ru, sizeof(*ru)))
+        return -EACCES;
+    if ((who != 0) && (who != -1)) /* RUSAGE_SELF, RUSAGE_CHILDREN */
+        return -EINVAL;
+    if (task_cpu_get(_cur_task->tb.pid, (who == -1), &cpu) < 0)
+        return -ESRCH;
+
+    memset(ru, 0, sizeof(*ru));
+    cycles_to_time(cpu.utime, &sec, &usec);
+    ru->utime_sec = sec;
+    ru->utime_usec = usec;
+    cycles_to_time(cpu.stime, &sec, &usec);
+    ru->stime_sec = sec;
+    ru->stime_usec = usec;
+    ru->nvcsw = cpu.nvcsw;
+    ru->nivcsw = cpu.nivcsw;
+    return 0;
+}
+
 int sys_kill_hdlr(uint32_t pid, uint32_t sig)
 {
     struct task *t = tasklist_get(&tasks_idling, pid);
@@ -3772,6 +4536,8 @@ int __naked sv_call_handler(void)
         _cur_task->tb.flags &= (~(TASK_FLAG_SIGNALED));
         if (*syscall_retval == SYS_CALL_AGAIN_VAL) {
             *syscall_retval = -EINTR;
+            _cur_task->tb.syscalls++;
+            task_waitq_abandon(_cur_task);
         }
         cur_extra = _cur_task->tb.sp + NVIC_FRAME_SIZE + EXTRA_FRAME_SIZE;
         irq_on();
@@ -3798,6 +4564,7 @@ int __naked sv_call_handler(void)
 #endif
 
     /* Execute syscall */
+    syscall_acct_enter();
     _cur_task->tb.flags |= TASK_FLAG_IN_SYSCALL;
     call = sys_syscall_handlers[n_syscall];
     if (!call) {
@@ -3823,10 +4590,20 @@ int __naked sv_call_handler(void)
     }
 
     /* out of syscall */
+    syscall_acct_exit();
     _cur_task->tb.flags &= (~TASK_FLAG_IN_SYSCALL);
+    /* A pass returning SYS_CALL_AGAIN is restarted, not finished */
+    if (*((int *)(_cur_task->tb.sp + EXTRA_FRAME_SIZE)) != SYS_CALL_AGAIN_VAL)
+        _cur_task->tb.syscalls++;
 
     strace_on_syscall(n_syscall);
 
+    /* Leaving the kernel without sleeping: stop listening on wait queues */
+    if ((_cur_task->tb.state != TASK_WAITING) &&
+            (_cur_task->tb.wait.wq || _cur_task->tb.pollwait)) {
+        task_waitq_release(_cur_task);
+    }
+
     if (_cur_task->tb.state != TASK_RUNNING) {
         task_switch();
     }
@@ -3847,10 +4624,7 @@ return_from_syscall:
         asm volatile("isb");
         restore_task_context();
         runnable = RUN_USER;
-        if (_cur_task->tb.flags & TASK_FLAG_VFORK_CHILD)
-            mpu_task_on(_cur_task->tb.pid, _cur_task->tb.ppid);
-        else
-            mpu_task_on(_cur_task->tb.pid, 0);
+        task_mpu_on(_cur_task);
         asm volatile("msr control, %0" ::"r"(0x03) : "memory");
         asm volatile("isb");
     }
@@ -149,8 +149,6 @@ static void netdev_attach_registered(void)
 struct frosted_inet_socket {
     struct fnode *node;
     int fd;
-    struct task *task;
-    uint16_t events;
     uint16_t revents;
     int bytes;
     int sock_fd;
@@ -243,44 +241,45 @@ static int ipv4_wire_packet_valid(const void *buf, unsigned int len)
     return 1;
 }
 
+static uint16_t sock_poll_bits(uint16_t cb_events)
+{
+    uint16_t bits = 0;
+
+    if (cb_events & CB_EVENT_CLOSED)
+        bits |= POLLHUP;
+    if (cb_events & CB_EVENT_TIMEOUT)
+        bits |= POLLERR;
+    if (cb_events & CB_EVENT_READABLE)
+        bits |= POLLIN;
+    if (cb_events & CB_EVENT_WRITABLE)
+        bits |= POLLOUT;
+    return bits;
+}
+
 static int sock_poll(struct fnode *f, uint16_t events, uint16_t *revents)
 {
     struct frosted_inet_socket *s;
     s = (struct frosted_inet_socket *)f->priv;
 
-    if (s->revents & CB_EVENT_CLOSED)
-        *revents |= POLLHUP;
-
-    if (s->revents & CB_EVENT_TIMEOUT)
-        *revents |= POLLERR;
-
-    if (s->revents & CB_EVENT_READABLE)
-        *revents |= POLLIN;
-
-    if (s->revents & CB_EVENT_WRITABLE)
-        *revents |= POLLOUT;
+    *revents |= sock_poll_bits(s->revents);
 
     if (((*revents) & (POLLHUP | POLLERR)) != 0) {
         return 1;
     }
     if ((events & *revents) != 0)
         return 1;
-
-    s->events |= events;
-    s->task = this_task();
     return 0;
 }
 
+/* Runs in the TCP/IP thread: record the event and wake whoever sleeps on
+ * the socket (blocked syscalls, poll, epoll). */
 static void wolfip_socket_event(int sockfd, uint16_t events, void *arg)
 {
     struct frosted_inet_socket *s = sockfd_inet(sockfd);
-    if (!s)
+    if (!s || !s->node)
         return;
     s->revents |= events;
-    if (((s->revents & s->events) != 0) && s->task) {
-        task_resume(s->task);
-        s->events = 0;
-    }
+    fno_wake(s->node, sock_poll_bits(events));
 }
 
 static int sock_close(struct fnode *fno)
@@ -300,6 +299,7 @@ static int sock_close(struct fnode *fno)
 
     wolfIP_sock_close(IPStack, s->sock_fd);
     kfree((struct fnode *)s->node);
+    s->node = NULL;
     ret = 0;
 out:
     
@@ -359,10 +359,7 @@ static int sock_recvfrom(int fd, void *buf, unsigned int len, int flags, struct
         if ((ret == 0) || (ret == -WOLFIP_EAGAIN)) {
             s->revents &= (~CB_EVENT_READABLE);
             if (SOCK_BLOCKING(s))  {
-                s->events = CB_EVENT_READABLE;
-                s->task = this_task();
-                task_suspend();
-                ret = SYS_CALL_AGAIN;
+                ret = task_waitq_sleep(&s->node->wq, POLLIN);
                 goto out;
             }
         }
@@ -377,7 +374,6 @@ static int sock_recvfrom(int fd, void *buf, unsigned int len, int flags, struct
         ret = -EBADMSG;
     }
     s->bytes = 0;
-    s->events  &= (~CB_EVENT_READABLE);
     s->revents &= (~CB_EVENT_READABLE);
     if ((ret == 0) && !SOCK_BLOCKING(s)) {
         ret = -EAGAIN;
@@ -415,10 +411,7 @@ static int sock_sendto(int fd, const void *buf, unsigned int len, int flags, str
         if (ret == 0 || ret == -WOLFIP_EAGAIN) {
             s->revents &= (~CB_EVENT_WRITABLE);
             if (SOCK_BLOCKING(s)) {
-                s->events = CB_EVENT_WRITABLE;
-                s->task = this_task();
-                task_suspend();
-                ret = SYS_CALL_AGAIN;
+                ret = task_waitq_sleep(&s->node->wq, POLLOUT);
                 goto out;
             }
             if (ret == -WOLFIP_EAGAIN) {
@@ -440,7 +433,6 @@ static int sock_sendto(int fd, const void *buf, unsigned int len, int flags, str
     }
     ret = s->bytes;
     s->bytes = 0;
-    s->events  &= (~CB_EVENT_WRITABLE);
     if ((ret == 0) && !SOCK_BLOCKING(s)) {
         ret = -EAGAIN;
     }
@@ -471,17 +463,14 @@ static int sock_accept(int fd, struct sockaddr *addr, unsigned int *addrlen)
     if (!l) {
         return -EINVAL;
     }
-    l->events = CB_EVENT_READABLE;
-
     sock_fd = wolfIP_sock_accept(IPStack, l->sock_fd, (struct wolfIP_sockaddr *)addr, addrlen);
     if ((sock_fd < 0) && (sock_fd != -WOLFIP_EAGAIN))
         return sock_fd;
     if (sock_fd == -WOLFIP_EAGAIN) {
-        if (SOCK_BLOCKING(l)) {
-            l->task = this_task();
-            task_suspend();
-        }
-        return SYS_CALL_AGAIN;
+        l->revents &= (~CB_EVENT_READABLE);
+        if (SOCK_BLOCKING(l))
+            return task_waitq_sleep(&l->node->wq, POLLIN);
+        return -EAGAIN;
     }
     
     l->revents &= (~CB_EVENT_READABLE);
@@ -520,19 +509,14 @@ static int sock_connect(int fd, struct sockaddr *addr, unsigned int addrlen)
     ret = wolfIP_sock_connect(IPStack, s->sock_fd, (struct wolfIP_sockaddr *)addr, addrlen);
     if (ret == 0) {
         /* Already connected (UDP or TCP_ESTABLISHED). */
-        s->events  &= ~(CB_EVENT_WRITABLE);
         s->revents &= ~(CB_EVENT_WRITABLE);
         return 0;
     }
     if (ret == -WOLFIP_EAGAIN) {
         /* TCP handshake in progress — wait for writable event. */
         s->revents &= ~(CB_EVENT_WRITABLE);
-        if (SOCK_BLOCKING(s)) {
-            s->events = CB_EVENT_WRITABLE | CB_EVENT_CLOSED;
-            s->task = this_task();
-            task_suspend();
-            return SYS_CALL_AGAIN;
-        }
+        if (SOCK_BLOCKING(s))
+            return task_waitq_sleep(&s->node->wq, POLLOUT);
         return -EAGAIN;
     }
     return ret;
@@ -548,7 +532,6 @@ static int sock_listen(int fd, int backlog)
         goto out;
     }
     ret = wolfIP_sock_listen(IPStack, s->sock_fd, backlog);
-    s->events |= CB_EVENT_READABLE;
 out:
     
     return ret;
@@ -1030,12 +1013,27 @@ int sysfs_net_route_list(struct sysfs_fnode *sfs, void *buf, int len)
     return len;
 }
 
+/* The C library uses the BSD numbering for socket level options */
+#define SOL_SOCKET_BSD (0xffff)
+
+static void sock_opt_translate(int *level, int *optname)
+{
+    if ((*level != SOL_SOCKET) && (*level != SOL_SOCKET_BSD))
+        return;
+    *level = WOLFIP_SOL_SOCKET;
+    if (*optname == SO_SNDBUF)
+        *optname = WOLFIP_SO_SNDBUF;
+    else if (*optname == SO_RCVBUF)
+        *optname = WOLFIP_SO_RCVBUF;
+}
+
 static int sock_getsockopt(int sd, int level, int optname, void *optval, unsigned int *optlen)
 {
     struct frosted_inet_socket *s;
     s = fd_inet(sd);
     if (!s)
         return -EINVAL;
+    sock_opt_translate(&level, &optname);
     return wolfIP_sock_getsockopt(IPStack, s->sock_fd, level, optname, optval, optlen);
 }
 
@@ -1045,6 +1043,7 @@ static int sock_setsockopt(int sd, int level, int optname, void *optval, unsigne
     s = fd_inet(sd);
     if (!s)
         return -EINVAL;
+    sock_opt_translate(&level, &optname);
     return wolfIP_sock_setsockopt(IPStack, s->sock_fd, level, optname, optval, optlen);
 }
 
@@ -1074,17 +1073,158 @@ static int sock_getpeername(int sd, struct sockaddr *addr, unsigned int *addrlen
 }
 
 
-#define IPTIMER_STACK_INTERVAL_MS 5
-typedef void (*timer_cb)(unsigned int,  void *);
+/* wolfIP runs in its own kernel thread. The thread sleeps until a
+ * network driver signals RX or TX completion, a socket call queues work,
+ * or the earliest wolfIP timer is due, then drains up to
+ * WOLFIP_POLL_BUDGET frames per interface and goes back to sleep.
+ */
+#define IPSTACK_IDLE_MAX_MS 1000
 
-static void ipstack_timer_cb(unsigned int ms, void *arg)
+struct ipstack_stats {
+    uint32_t wakeups;
+    uint32_t timer_wakeups;
+    uint32_t polls;
+    uint32_t frames;
+    uint32_t repolls;
+};
+
+static struct task *ipstack_task;
+static volatile uint32_t ipstack_wake_pending;
+static uint32_t ipstack_timer_expire;
+static struct ipstack_stats ipstack_stats;
+
+void socket_in_wakeup(void)
 {
-    if (IPStack) {
-        tcpip_lock();
-        wolfIP_poll(IPStack, jiffies);
-        tcpip_unlock();
+    ipstack_wake_pending = 1;
+    if (ipstack_task)
+        task_resume(ipstack_task);
+}
+
+static void ipstack_timer_cb(uint32_t now, void *arg)
+{
+    (void)now;
+    (void)arg;
+    ipstack_timer = -1;
+    ipstack_stats.timer_wakeups++;
+    socket_in_wakeup();
+}
+
+/* Keep a single ktimer armed on the next wolfIP deadline. */
+static void ipstack_timer_arm(int ms)
+{
+    uint32_t expire;
+
+    if ((ms < 0) || (ms > IPSTACK_IDLE_MAX_MS))
+        ms = IPSTACK_IDLE_MAX_MS;
+    expire = jiffies + (uint32_t)ms;
+    if (ipstack_timer >= 0) {
+        if (expire == ipstack_timer_expire)
+            return;
+        ktimer_del(ipstack_timer);
     }
-    ktimer_add(IPTIMER_STACK_INTERVAL_MS, (timer_cb)ipstack_timer_cb, NULL);
+    ipstack_timer_expire = expire;
+    ipstack_timer = ktimer_add((uint32_t)ms, ipstack_timer_cb, NULL);
+}
+
+static void ipstack_wait(void)
+{
+    irq_off();
+    while (!ipstack_wake_pending) {
+        task_suspend();
+        /* The switch happens as soon as interrupts are enabled */
+        irq_on();
+        irq_off();
+    }
+    ipstack_wake_pending = 0;
+    irq_on();
+}
+
+static void ipstack_thread(void *arg)
+{
+    int frames, timeout;
+
+    (void)arg;
+    while (1) {
+        ipstack_stats.wakeups++;
+        for (;;) {
+            /* Sleeps until the lock is free, lending the holder our
+             * priority: a lower level holder would never run while we
+             * spin */
+            while (tcpip_lock() != 0)
+                ;
+            frames = wolfIP_poll(IPStack, jiffies);
+            timeout = wolfIP_poll_timeout(IPStack, jiffies);
+            tcpip_unlock();
+            ipstack_stats.polls++;
+            ipstack_stats.frames += (uint32_t)frames;
+            if ((frames < WOLFIP_POLL_BUDGET) && (timeout != 0))
+                break;
+            /* More work is already waiting: let others run, then drain */
+            ipstack_stats.repolls++;
+            kthread_yield();
+        }
+        ipstack_timer_arm(timeout);
+        ipstack_wait();
+    }
+}
+
+static int ipstack_stats_line(char *dst, int off, const char *label, uint32_t value)
+{
+    int len = strlen(label);
+
+    if (off + len + 14 >= MAX_SYSFS_BUFFER)
+        return off;
+    memcpy(dst + off, label, len);
+    off += len;
+    dst[off++] = '\t';
+    off += ul_to_str(value, dst + off);
+    dst[off++] = '\r';
+    dst[off++] = '\n';
+    return off;
+}
+
+static int sysfs_net_stack_read(struct sysfs_fnode *sfs, void *buf, int len)
+{
+    char *res = (char *)buf;
+    struct fnode *fno = sfs->fnode;
+    static char *txt;
+    static int off;
+    uint32_t cur_off = task_fd_get_off(fno);
+    uint32_t reasm_ok, reasm_drop, frag_out;
+
+    sysfs_lock();
+    if (cur_off == 0) {
+        txt = kalloc(MAX_SYSFS_BUFFER);
+        if (!txt) {
+            sysfs_unlock();
+            return -1;
+        }
+        off = 0;
+        off = ipstack_stats_line(txt, off, "wakeups   ", ipstack_stats.wakeups);
+        off = ipstack_stats_line(txt, off, "timer     ", ipstack_stats.timer_wakeups);
+        off = ipstack_stats_line(txt, off, "polls     ", ipstack_stats.polls);
+        off = ipstack_stats_line(txt, off, "frames    ", ipstack_stats.frames);
+        off = ipstack_stats_line(txt, off, "repolls   ", ipstack_stats.repolls);
+        off = ipstack_stats_line(txt, off, "sockbuf   ", wolfIP_sockbuf_mem(IPStack));
+        wolfIP_ip_frag_stats(IPStack, &reasm_ok, &reasm_drop, &frag_out);
+        off = ipstack_stats_line(txt, off, "reasm     ", reasm_ok);
+        off = ipstack_stats_line(txt, off, "reasmfail ", reasm_drop);
+        off = ipstack_stats_line(txt, off, "fragout   ", frag_out);
+    }
+    cur_off = task_fd_get_off(fno);
+    if (off == cur_off) {
+        kfree(txt);
+        txt = NULL;
+        sysfs_unlock();
+        return -1;
+    }
+    if (len > (off - cur_off))
+        len = off - cur_off;
+    memcpy(res, txt + cur_off, len);
+    cur_off += len;
+    task_fd_set_off(fno, cur_off);
+    sysfs_unlock();
+    return len;
 }
 
 int netdev_register(struct netdev_driver *driver)
@@ -1169,8 +1309,11 @@ void socket_in_init(void)
     /* Register /sys/net/route */
     sysfs_register("route", "/sys/net", sysfs_net_route_list, sysfs_no_write);
 
-    /* Start TCP/IP timer */
-    ipstack_timer = ktimer_add(IPTIMER_STACK_INTERVAL_MS, ipstack_timer_cb, NULL);
+    /* Register /sys/net/stack */
+    sysfs_register("stack", "/sys/net", sysfs_net_stack_read, sysfs_no_write);
+
+    /* Start the TCP/IP thread */
+    ipstack_task = kthread_create(ipstack_thread, NULL);
 
     socket_in_ready = 1;
 }
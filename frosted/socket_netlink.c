@@ -154,6 +154,8 @@ static int nl_queue_push(struct nl_sock *s, const void *buf, uint32_t len)
         s->rx_tail->next = r;
     s->rx_tail = r;
     s->queued_bytes += len;
+    if (s->node)
+        fno_wake(s->node, POLLIN);
     return 0;
 }
 
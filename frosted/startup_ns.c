@@ -74,6 +74,12 @@ void debug_mon_handler(void)
 }
 
 void usb_irq_handler(void);
+#if defined(TARGET_stm32h563) && CONFIG_ETH
+void eth_irq_handler(void);
+#endif
+#if defined(TARGET_stm32h563) && CONFIG_SPI_DMA
+void spi_dma_irq_handler(void);
+#endif
 #if defined(TARGET_stm32h563)
 void usart3_irq_handler(void);
 #else
@@ -133,7 +139,11 @@ void (* const vector_table[])(void) = {
     empty_handler, /* 31 */
     empty_handler, /* 32 */
     empty_handler, /* 33 */
+#if defined(TARGET_stm32h563) && CONFIG_SPI_DMA
+    spi_dma_irq_handler, /* 34: GPDMA1 channel 7 */
+#else
     empty_handler, /* 34 */
+#endif
     empty_handler, /* 35 */
     empty_handler, /* 36 */
     empty_handler, /* 37 */
@@ -192,6 +202,43 @@ void (* const vector_table[])(void) = {
     empty_handler, /* 77 */
     empty_handler, /* 78 */
     empty_handler, /* 79 */
+#if defined(TARGET_stm32h563)
+    empty_handler, /* 80 */
+    empty_handler, /* 81 */
+    empty_handler, /* 82 */
+    empty_handler, /* 83 */
+    empty_handler, /* 84 */
+    empty_handler, /* 85 */
+    empty_handler, /* 86 */
+    empty_handler, /* 87 */
+    empty_handler, /* 88 */
+    empty_handler, /* 89 */
+    empty_handler, /* 90 */
+    empty_handler, /* 91 */
+    empty_handler, /* 92 */
+    empty_handler, /* 93 */
+    empty_handler, /* 94 */
+    empty_handler, /* 95 */
+    empty_handler, /* 96 */
+    empty_handler, /* 97 */
+    empty_handler, /* 98 */
+    empty_handler, /* 99 */
+    empty_handler, /* 100 */
+    empty_handler, /* 101 */
+    empty_handler, /* 102 */
+    empty_handler, /* 103 */
+    empty_handler, /* 104 */
+    empty_handler, /* 105 */
+#if CONFIG_ETH
+    eth_irq_handler, /* 106 */
+#else
+    empty_handler, /* 106 */
+#endif
+#endif
 };
 
+#if defined(TARGET_stm32h563)
+#define NUM_IRQS (107)
+#else
 #define NUM_IRQS (80)
+#endif
@@ -9,6 +9,7 @@
 #include <stddef.h>
 #include <errno.h>
 #include "lan8742.h"
+#include "nvic.h"
 
 #if CONFIG_ETH
 static struct module mod_deveth = {
@@ -95,6 +96,7 @@ static inline void stm32_eth_invalidate_dcache_range(void *addr, size_t len)
 #define ETH_DMACRXDTPR      ETH_REG(0x1128)
 #define ETH_DMACTXRLR       ETH_REG(0x112C)
 #define ETH_DMACRXRLR       ETH_REG(0x1130)
+#define ETH_DMACIER         ETH_REG(0x1134)
 #define ETH_DMACSR          ETH_REG(0x1160)
 #define ETH_MACMDIOAR       ETH_REG(0x0200)
 #define ETH_MACMDIODR       ETH_REG(0x0204)
@@ -104,6 +106,7 @@ static inline void stm32_eth_invalidate_dcache_range(void *addr, size_t len)
 #define ETH_MACCR_TE        (1U << 1)
 #define ETH_MACCR_DM        (1U << 13)
 #define ETH_MACCR_FES       (1U << 14)
+#define ETH_MACCR_IPC       (1U << 27)
 
 /* DMA bits */
 #define ETH_DMAMR_SWR       (1U << 0)
@@ -114,7 +117,14 @@ static inline void stm32_eth_invalidate_dcache_range(void *addr, size_t len)
 #define ETH_DMACTXCR_OSF    (1U << 4)
 #define ETH_DMACRXCR_SR     (1U << 0)
 #define ETH_DMACRXCR_RBSZ_SHIFT 1
+#define ETH_DMACSR_TI       (1U << 0)
 #define ETH_DMACSR_TBU      (1U << 2)
+#define ETH_DMACSR_RI       (1U << 6)
+#define ETH_DMACSR_NIS      (1U << 15)
+#define ETH_DMACIER_TIE     (1U << 0)
+#define ETH_DMACIER_RIE     (1U << 6)
+#define ETH_DMACIER_NIE     (1U << 15)
+#define ETH_IRQN            106U
 #define ETH_DMACTXCR_TPBL_SHIFT 16
 #define ETH_DMACTXCR_TPBL(val) (((uint32_t)(val) & 0x3FU) << ETH_DMACTXCR_TPBL_SHIFT)
 #define ETH_DMACRXCR_RPBL_SHIFT 16
@@ -199,21 +209,41 @@ struct stm32_eth_dma_desc {
 #define STM32_ETH_TDES3_FD       (1U << 29)
 #define STM32_ETH_TDES3_LD       (1U << 28)
 #define STM32_ETH_TDES2_B1L_MASK (0x3FFFU)
+#define STM32_ETH_TDES2_IOC      (1U << 31)
 #define STM32_ETH_TDES3_FL_MASK  (0x7FFFU)
+/* Checksum insertion: IP header and TCP/UDP/ICMP payload, pseudo header
+ * computed by the MAC */
+#define STM32_ETH_TDES3_CIC_FULL (3U << 16)
 
 #define STM32_ETH_RDES3_OWN      (1U << 31)
+#define STM32_ETH_RDES3_IOC      (1U << 30)
 #define STM32_ETH_RDES3_BUF1V    (1U << 24)
 #define STM32_ETH_RDES3_FS       (1U << 29)
 #define STM32_ETH_RDES3_LS       (1U << 28)
 #define STM32_ETH_RDES3_PL_MASK  (0x3FFFU)
+#define STM32_ETH_RDES3_RS1V     (1U << 26)
+#define STM32_ETH_RDES1_PT_MASK  (0x7U)
+#define STM32_ETH_RDES1_IPHE     (1U << 3)
+#define STM32_ETH_RDES1_IPV4     (1U << 4)
+#define STM32_ETH_RDES1_IPCB     (1U << 6)
+#define STM32_ETH_RDES1_IPCE     (1U << 7)
 
 #define STM32_ETH_RX_DESC_COUNT  4U
 #define STM32_ETH_TX_DESC_COUNT  3U
+/* A full ring would put the tail pointer back on the DMA's current
+ * descriptor, which reads as empty: always leave one slot free. */
+#define STM32_ETH_TX_INFLIGHT_MAX (STM32_ETH_TX_DESC_COUNT - 1U)
 #define STM32_ETH_RX_BUF_SIZE    LINK_MTU
+/* RX buffers are handed to the stack in place: keep each one on its own
+ * cache lines so that invalidating a buffer never discards CPU writes to
+ * its neighbour. */
+#define STM32_ETH_RX_BUF_STRIDE  ((STM32_ETH_RX_BUF_SIZE + STM32_ETH_DCACHE_LINE_SIZE - 1U) & \
+                                  ~(STM32_ETH_DCACHE_LINE_SIZE - 1U))
 #define STM32_ETH_TX_BUF_SIZE    LINK_MTU
 #define STM32_ETH_FRAME_MIN_LEN  60U
 #define STM32_ETH_DMA_TPBL       32U
 #define STM32_ETH_DMA_RPBL       32U
+#define STM32_ETH_LINK_POLL_MS   1000U
 
 #define STM32_ETH_USE_STATIC_IP  1
 #define STM32_ETH_IP_ADDRESS     "192.168.12.11"
@@ -222,10 +252,8 @@ struct stm32_eth_dma_desc {
 
 static struct stm32_eth_dma_desc rx_ring[STM32_ETH_RX_DESC_COUNT] __attribute__((aligned(32),section(".eth_ring")));
 static struct stm32_eth_dma_desc tx_ring[STM32_ETH_TX_DESC_COUNT] __attribute__((aligned(32),section(".eth_ring")));
-static uint8_t rx_buffers[STM32_ETH_RX_DESC_COUNT][STM32_ETH_RX_BUF_SIZE] __attribute__((aligned(32),section(".eth_ring")));
+static uint8_t rx_buffers[STM32_ETH_RX_DESC_COUNT][STM32_ETH_RX_BUF_STRIDE] __attribute__((aligned(32),section(".eth_ring")));
 static uint8_t tx_buffers[STM32_ETH_TX_DESC_COUNT][STM32_ETH_TX_BUF_SIZE] __attribute__((aligned(32),section(".eth_ring")));
-/* Staging area keeps a CPU-owned copy once DMA hands ownership back. */
-static uint8_t rx_staging_buffer[STM32_ETH_RX_BUF_SIZE] __attribute__((aligned(32),section(".eth_ring")));
 
 /* Simple debug counters to probe for RX activity under GDB. */
 volatile uint32_t stm32_eth_rx_debug_count;
@@ -242,7 +270,11 @@ volatile uint32_t stm32_eth_phy_debug44;
 volatile uint32_t stm32_eth_phy_debug48;
 
 static uint32_t rx_idx;
-static uint32_t tx_idx;
+static uint32_t tx_idx;      /* next free TX descriptor */
+static uint32_t tx_clean;    /* oldest descriptor not yet reclaimed */
+static uint32_t tx_pending;  /* descriptors between tx_clean and tx_idx */
+static uint32_t tx_queued;   /* descriptors not yet covered by the tail pointer */
+static uint32_t tx_batching;
 static mutex_t *tx_lock;
 static int eth_initialized;
 static int eth_driver_registered;
@@ -250,6 +282,9 @@ static int eth_module_registered;
 static int32_t stm32_eth_phy_addr = -1;
 static lan8742_Object_t lan8742_dev;
 static int lan8742_initialized;
+static struct wolfIP_ll_dev *eth_ll;
+static uint32_t link_next_check;
+static struct eth_stats eth_stats;
 
 extern struct wolfIP *IPStack;
 
@@ -384,11 +419,15 @@ static void stm32_eth_init_desc(void)
         rx_ring[i].des2 = 0;
         rx_ring[i].des3 = (STM32_ETH_RX_BUF_SIZE & STM32_ETH_RDES3_PL_MASK) |
                           STM32_ETH_RDES3_OWN |
+                          STM32_ETH_RDES3_IOC |
                           STM32_ETH_RDES3_BUF1V;
     }
 
     rx_idx = 0;
     tx_idx = 0;
+    tx_clean = 0;
+    tx_pending = 0;
+    tx_queued = 0;
 
     stm32_eth_clean_dcache_range(tx_ring, sizeof(tx_ring));
     stm32_eth_clean_dcache_range(rx_ring, sizeof(rx_ring));
@@ -510,17 +549,20 @@ static int32_t stm32_eth_detect_phy(void)
     return -1;
 }
 
+/* Sample the PHY link state at most every STM32_ETH_LINK_POLL_MS: an
+ * MDIO read costs tens of microseconds and must stay out of the RX path.
+ * MAC speed and duplex follow the PHY when the link comes back up. */
 static void stm32_eth_update_link_status(void)
 {
-    static uint32_t sample_divider;
     uint16_t status;
+    uint32_t link;
 
     if (stm32_eth_phy_addr < 0)
         return;
-
-    sample_divider++;
-    if ((sample_divider & 0xFFU) != 0U)
+    if (jiffies_before(jiffies, link_next_check))
         return;
+    link_next_check = jiffies + STM32_ETH_LINK_POLL_MS;
+    eth_stats.link_checks++;
 
     status = stm32_eth_mdio_read((uint32_t)stm32_eth_phy_addr, STM32_ETH_PHY_REG_BSR);
     stm32_eth_phy_bsr_debug = status;
@@ -529,6 +571,14 @@ static void stm32_eth_update_link_status(void)
         stm32_eth_link_status_debug = (uint32_t)LAN8742_GetLinkState(&lan8742_dev);
     else
         stm32_eth_link_status_debug = (uint32_t)status;
+
+    link = (status & STM32_ETH_PHY_BSR_LINK_STATUS) ? 1U : 0U;
+    if (link != eth_stats.link) {
+        eth_stats.link = link;
+        eth_stats.link_changes++;
+        if (link)
+            stm32_eth_config_speed_duplex();
+    }
 }
 
 /* Wait until the PHY reports a valid link status.
@@ -579,6 +629,7 @@ static inline void stm32_eth_release_rx_desc(struct stm32_eth_dma_desc *desc)
     desc->des1 = 0;
     desc->des3 = (STM32_ETH_RX_BUF_SIZE & STM32_ETH_RDES3_PL_MASK) |
                  STM32_ETH_RDES3_OWN |
+                 STM32_ETH_RDES3_IOC |
                  STM32_ETH_RDES3_BUF1V;
     stm32_eth_clean_dcache_range(desc, sizeof(*desc));
     /* Keep the ownership handoff ordered even if cache helper internals change. */
@@ -586,116 +637,284 @@ static inline void stm32_eth_release_rx_desc(struct stm32_eth_dma_desc *desc)
     ETH_DMACRXDTPR = (uint32_t)desc;
 }
 
-static int stm32_eth_poll(struct wolfIP_ll_dev *dev, void *frame, uint32_t len)
+/* Translate the checksum status the MAC wrote back into the frame's
+ * rx_csum flags for wolfIP. Returns -1 for a frame that failed a check.
+ * Frames the MAC did not inspect (non-IPv4, fragments, bypass) are left
+ * for wolfIP to verify. */
+static int stm32_eth_rx_csum(const struct stm32_eth_dma_desc *desc, uint32_t status)
+{
+    uint32_t des1 = desc->des1;
+    uint8_t ok = 0;
+
+    if (eth_ll)
+        eth_ll->rx_csum = 0;
+    if (!eth_stats.csum_offload || !(status & STM32_ETH_RDES3_RS1V))
+        return 0;
+    if (!(des1 & STM32_ETH_RDES1_IPV4) || (des1 & STM32_ETH_RDES1_IPCB))
+        return 0;
+    if (des1 & (STM32_ETH_RDES1_IPHE | STM32_ETH_RDES1_IPCE))
+        return -1;
+    ok = WOLFIP_CSUM_RX_IP;
+    /* Payload type 1..3: UDP, TCP, ICMP */
+    if (((des1 & STM32_ETH_RDES1_PT_MASK) >= 1U) && ((des1 & STM32_ETH_RDES1_PT_MASK) <= 3U))
+        ok |= WOLFIP_CSUM_RX_L4;
+    if (eth_ll)
+        eth_ll->rx_csum = ok;
+    return 0;
+}
+
+/* Return the next complete frame in the RX ring, or NULL when the DMA
+ * still owns the current descriptor. Frames split across descriptors are
+ * dropped. The returned buffer stays CPU-owned until
+ * stm32_eth_rx_release() re-arms its descriptor. */
+static uint8_t *stm32_eth_rx_next(uint32_t *frame_len)
 {
     struct stm32_eth_dma_desc *desc;
     uint32_t status;
+    uint32_t i;
+
+    stm32_eth_update_link_status();
+
+    for (i = 0; i < STM32_ETH_RX_DESC_COUNT; i++) {
+        desc = &rx_ring[rx_idx];
+        stm32_eth_invalidate_dcache_range(desc, sizeof(*desc));
+        status = desc->des3;
+
+        if (status & STM32_ETH_RDES3_OWN)
+            return NULL;
+
+        if ((status & (STM32_ETH_RDES3_FS | STM32_ETH_RDES3_LS)) ==
+                (STM32_ETH_RDES3_FS | STM32_ETH_RDES3_LS)) {
+            if (stm32_eth_rx_csum(desc, status) < 0) {
+                eth_stats.rx_csum_err++;
+                eth_stats.rx_dropped++;
+                stm32_eth_release_rx_desc(desc);
+                rx_idx = (rx_idx + 1U) % STM32_ETH_RX_DESC_COUNT;
+                continue;
+            }
+            *frame_len = status & STM32_ETH_RDES3_PL_MASK;
+            if (*frame_len > STM32_ETH_RX_BUF_SIZE)
+                *frame_len = STM32_ETH_RX_BUF_SIZE;
+            stm32_eth_invalidate_dcache_range(rx_buffers[rx_idx], *frame_len);
+            stm32_eth_rx_debug_last_len = *frame_len;
+            stm32_eth_rx_debug_count++;
+            eth_stats.rx_frames++;
+            eth_stats.rx_bytes += *frame_len;
+            return rx_buffers[rx_idx];
+        }
+
+        eth_stats.rx_dropped++;
+        stm32_eth_release_rx_desc(desc);
+        rx_idx = (rx_idx + 1U) % STM32_ETH_RX_DESC_COUNT;
+    }
+    return NULL;
+}
+
+static void stm32_eth_rx_release(struct wolfIP_ll_dev *dev)
+{
+    (void)dev;
+    stm32_eth_release_rx_desc(&rx_ring[rx_idx]);
+    rx_idx = (rx_idx + 1U) % STM32_ETH_RX_DESC_COUNT;
+}
+
+/* Zero-copy receive: the stack parses the frame straight out of the DMA
+ * buffer and calls stm32_eth_rx_release() when done with it. */
+static int stm32_eth_rx_peek(struct wolfIP_ll_dev *dev, void **frame)
+{
     uint32_t frame_len = 0;
+    uint8_t *buf;
 
     (void)dev;
 
-    stm32_eth_update_link_status();
+    buf = stm32_eth_rx_next(&frame_len);
+    if (!buf)
+        return 0;
+    eth_stats.rx_zerocopy++;
+    *frame = buf;
+    return (int)frame_len;
+}
 
-    desc = &rx_ring[rx_idx];
-    stm32_eth_invalidate_dcache_range(desc, sizeof(*desc));
+static int stm32_eth_poll(struct wolfIP_ll_dev *dev, void *frame, uint32_t len)
+{
+    uint32_t frame_len = 0;
+    uint8_t *buf;
 
-    if (desc->des3 & STM32_ETH_RDES3_OWN)
+    buf = stm32_eth_rx_next(&frame_len);
+    if (!buf)
         return 0;
+    if (frame_len > len)
+        frame_len = len;
+    memcpy(frame, buf, frame_len);
+    eth_stats.rx_copied++;
+    stm32_eth_rx_release(dev);
 
-    status = desc->des3;
-
-    if ((status & (STM32_ETH_RDES3_FS | STM32_ETH_RDES3_LS)) ==
-            (STM32_ETH_RDES3_FS | STM32_ETH_RDES3_LS)) {
-        frame_len = status & STM32_ETH_RDES3_PL_MASK;
-        if (frame_len > len)
-            frame_len = len;
-        stm32_eth_invalidate_dcache_range(rx_buffers[rx_idx], frame_len);
-        memcpy(rx_staging_buffer, rx_buffers[rx_idx], frame_len);
-        memcpy(frame, rx_staging_buffer, frame_len);
-        stm32_eth_rx_debug_last_len = frame_len;
-        stm32_eth_rx_debug_count++;
+    return (int)frame_len;
+}
+
+/* Reclaim the descriptors the DMA is done with. */
+static void stm32_eth_tx_reclaim(void)
+{
+    struct stm32_eth_dma_desc *desc;
+
+    while (tx_pending > 0U) {
+        desc = &tx_ring[tx_clean];
+        stm32_eth_invalidate_dcache_range(desc, sizeof(*desc));
+        if (desc->des3 & STM32_ETH_TDES3_OWN)
+            break;
+        tx_clean = (tx_clean + 1U) % STM32_ETH_TX_DESC_COUNT;
+        tx_pending--;
     }
+}
 
-    stm32_eth_release_rx_desc(desc);
-    rx_idx = (rx_idx + 1U) % STM32_ETH_RX_DESC_COUNT;
+/* Hand every queued descriptor to the DMA with one tail pointer write. */
+static void stm32_eth_tx_kick(void)
+{
+    if (tx_queued == 0U)
+        return;
 
-    return (int)frame_len;
+    /* Descriptors must be visible before the tail pointer moves */
+    __asm volatile ("dsb sy" ::: "memory");
+    ETH_DMACTXDTPR = (uint32_t)&tx_ring[tx_idx];
+    __asm volatile ("dsb sy" ::: "memory");
+    ETH_DMACSR = ETH_DMACSR_TBU;
+    stm32_eth_trigger_tx();
+
+    stm32_eth_tx_last_desc3_debug = tx_ring[(tx_idx + STM32_ETH_TX_DESC_COUNT - 1U) %
+                                            STM32_ETH_TX_DESC_COUNT].des3;
+    stm32_eth_tx_dma_status_debug = ETH_DMACSR;
+    eth_stats.tx_kicks++;
+    tx_queued = 0;
 }
 
-static int stm32_eth_send(struct wolfIP_ll_dev *dev, void *frame, uint32_t len)
+/* Gather a frame from fragments into the next free TX slot. Called with
+ * tx_lock held; the tail pointer is left alone. */
+static int stm32_eth_tx_queue(const struct eth_frag *frags, int nfrags)
 {
     struct stm32_eth_dma_desc *desc;
+    uint8_t *dst;
+    uint32_t len = 0;
     uint32_t dma_len;
-    uint32_t next_idx;
-    uint32_t debug_val;
-
-    (void)dev;
+    int i;
 
+    for (i = 0; i < nfrags; i++)
+        len += frags[i].len;
     if (len == 0 || len > STM32_ETH_TX_BUF_SIZE)
         return -EMSGSIZE;
 
-    if (tx_lock)
-        mutex_lock(tx_lock);
+    stm32_eth_tx_reclaim();
+    if (tx_pending == STM32_ETH_TX_INFLIGHT_MAX) {
+        /* Ring full: start what is queued so it can drain */
+        stm32_eth_tx_kick();
+        stm32_eth_tx_reclaim();
+        if (tx_pending == STM32_ETH_TX_INFLIGHT_MAX) {
+            eth_stats.tx_busy++;
+            return -EAGAIN;
+        }
+    }
 
     desc = &tx_ring[tx_idx];
-    stm32_eth_invalidate_dcache_range(desc, sizeof(*desc));
-
-    if (desc->des3 & STM32_ETH_TDES3_OWN) {
-        if (tx_lock)
-            mutex_unlock(tx_lock);
-        return -EAGAIN;
+    dst = tx_buffers[tx_idx];
+    for (i = 0; i < nfrags; i++) {
+        memcpy(dst, frags[i].data, frags[i].len);
+        dst += frags[i].len;
     }
-
-    memcpy(tx_buffers[tx_idx], frame, len);
     dma_len = (len < STM32_ETH_FRAME_MIN_LEN) ? STM32_ETH_FRAME_MIN_LEN : len;
     if (dma_len > len)
         memset(tx_buffers[tx_idx] + len, 0, dma_len - len);
     desc->des0 = (uint32_t)tx_buffers[tx_idx];
     desc->des1 = 0;
     desc->des2 = (dma_len & STM32_ETH_TDES2_B1L_MASK);
+    /* Only ask for a completion interrupt when this fills the ring: the
+     * TCP/IP thread is then woken as soon as a slot frees up. */
+    if (tx_pending + 1U == STM32_ETH_TX_INFLIGHT_MAX)
+        desc->des2 |= STM32_ETH_TDES2_IOC;
     stm32_eth_clean_dcache_range(tx_buffers[tx_idx], dma_len);
     /* Ensure the payload is visible before we hand ownership to the DMA */
     __asm volatile ("dsb sy" ::: "memory");
     desc->des3 = (dma_len & STM32_ETH_TDES3_FL_MASK) |
                  STM32_ETH_TDES3_FD |
                  STM32_ETH_TDES3_LD |
+                 (eth_stats.csum_offload ? STM32_ETH_TDES3_CIC_FULL : 0U) |
                  STM32_ETH_TDES3_OWN;
     stm32_eth_clean_dcache_range(desc, sizeof(*desc));
 
-    stm32_eth_tx_last_desc3_debug = desc->des3;
-    stm32_eth_tx_dma_status_debug = ETH_DMACSR;
-
-    next_idx = (tx_idx + 1U) % STM32_ETH_TX_DESC_COUNT;
-    ETH_DMACTXDTPR = (uint32_t)&tx_ring[next_idx];
-    __asm volatile ("dsb sy" ::: "memory");
-
-    ETH_DMACSR = ETH_DMACSR_TBU;
+    tx_idx = (tx_idx + 1U) % STM32_ETH_TX_DESC_COUNT;
+    tx_pending++;
+    tx_queued++;
+    eth_stats.tx_frames++;
+    eth_stats.tx_bytes += len;
+    return (int)len;
+}
 
-    /* Kick the DMA on the very first transmission after init. */
-    if (tx_idx == 0U)
-        stm32_eth_trigger_tx();
+/* Send a frame made of several fragments (e.g. headers and payload).
+ * Inside a tx_begin()/tx_flush() batch the frame is only queued. */
+int stm32_eth_send_frags(const struct eth_frag *frags, int nfrags)
+{
+    int ret;
 
-    tx_idx = next_idx;
+    if (!frags || nfrags <= 0)
+        return -EINVAL;
 
-    debug_val = stm32_eth_mdio_read((uint32_t)stm32_eth_phy_addr, 0x0011U);
-    debug_val |= stm32_eth_mdio_read((uint32_t)stm32_eth_phy_addr, 0x001BU) << 16;
-    stm32_eth_phy_debug40 = debug_val;
+    if (tx_lock)
+        mutex_lock(tx_lock);
+    ret = stm32_eth_tx_queue(frags, nfrags);
+    if (tx_batching == 0U)
+        stm32_eth_tx_kick();
+    if (tx_lock)
+        mutex_unlock(tx_lock);
+    return ret;
+}
 
-    debug_val = stm32_eth_mdio_read((uint32_t)stm32_eth_phy_addr, 0x0019U);
-    debug_val |= stm32_eth_mdio_read((uint32_t)stm32_eth_phy_addr, 0x001FU) << 16;
-    stm32_eth_phy_debug44 = debug_val;
+static int stm32_eth_send(struct wolfIP_ll_dev *dev, void *frame, uint32_t len)
+{
+    struct eth_frag frag;
 
-    debug_val = stm32_eth_mdio_read((uint32_t)stm32_eth_phy_addr, 0x0010U);
-    debug_val |= stm32_eth_mdio_read((uint32_t)stm32_eth_phy_addr, 0x001AU) << 16;
-    stm32_eth_phy_debug48 = debug_val;
+    (void)dev;
+    frag.data = frame;
+    frag.len = len;
+    return stm32_eth_send_frags(&frag, 1);
+}
 
-    stm32_eth_tx_last_desc3_debug = desc->des3;
-    stm32_eth_tx_dma_status_debug = ETH_DMACSR;
+static void stm32_eth_tx_begin(struct wolfIP_ll_dev *dev)
+{
+    (void)dev;
+    tx_batching++;
+}
 
+static void stm32_eth_tx_flush(struct wolfIP_ll_dev *dev)
+{
+    (void)dev;
+    if (tx_lock)
+        mutex_lock(tx_lock);
+    if (tx_batching > 0U)
+        tx_batching--;
+    if (tx_batching == 0U)
+        stm32_eth_tx_kick();
+    stm32_eth_tx_reclaim();
     if (tx_lock)
         mutex_unlock(tx_lock);
+}
 
-    return (int)len;
+/* Sample the PHY vendor registers that used to be read after every
+ * transmitted frame. Only called on demand from /sys/eth_phy. */
+void stm32_eth_phy_sample(struct eth_phy_sample *ps)
+{
+    static const uint8_t regs[ETH_PHY_SAMPLE_REGS] = {
+        0x00U, 0x01U, 0x10U, 0x11U, 0x19U, 0x1AU, 0x1BU, 0x1FU
+    };
+    uint32_t i;
+
+    memset(ps, 0, sizeof(*ps));
+    if (stm32_eth_phy_addr < 0)
+        return;
+    ps->addr = (uint32_t)stm32_eth_phy_addr;
+    for (i = 0; i < ETH_PHY_SAMPLE_REGS; i++) {
+        ps->reg[i] = regs[i];
+        ps->val[i] = stm32_eth_mdio_read((uint32_t)stm32_eth_phy_addr, regs[i]);
+    }
+    stm32_eth_phy_debug40 = ps->val[3] | ((uint32_t)ps->val[6] << 16);
+    stm32_eth_phy_debug44 = ps->val[4] | ((uint32_t)ps->val[7] << 16);
+    stm32_eth_phy_debug48 = ps->val[2] | ((uint32_t)ps->val[5] << 16);
 }
 
 static void stm32_eth_phy_initialize(void)
@@ -829,6 +1048,16 @@ static void stm32_eth_ack_status(void)
         ETH_DMACSR = status;
 }
 
+/* RX and TX completion only wake the TCP/IP thread, which does the work */
+void eth_irq_handler(void)
+{
+    uint32_t status = ETH_DMACSR;
+
+    ETH_DMACSR = status & (ETH_DMACSR_RI | ETH_DMACSR_TI | ETH_DMACSR_NIS);
+    eth_stats.irqs++;
+    socket_in_wakeup();
+}
+
 void stm32_eth_enable_loopback(int enable)
 {
     uint32_t maccr = ETH_MACCR;
@@ -839,6 +1068,53 @@ void stm32_eth_enable_loopback(int enable)
         maccr &= ~ETH_MACCR_LM;
 
     ETH_MACCR = maccr;
+    eth_stats.loopback = enable ? 1U : 0U;
+}
+
+void stm32_eth_set_zerocopy(int enable)
+{
+    eth_stats.zerocopy = enable ? 1U : 0U;
+    if (eth_ll)
+        eth_ll->rx_peek = enable ? stm32_eth_rx_peek : NULL;
+}
+
+/* The MAC inserts checksums on every frame when enabled (non-IP frames
+ * are left alone), so toggling only needs to agree with wolfIP's flags. */
+void stm32_eth_set_csum_offload(int enable)
+{
+    uint32_t maccr = ETH_MACCR;
+
+    if (enable)
+        maccr |= ETH_MACCR_IPC;
+    else
+        maccr &= ~ETH_MACCR_IPC;
+    ETH_MACCR = maccr;
+    eth_stats.csum_offload = enable ? 1U : 0U;
+    if (eth_ll) {
+        eth_ll->csum_offload = enable ? (WOLFIP_CSUM_TX_IP | WOLFIP_CSUM_TX_L4 |
+                WOLFIP_CSUM_RX_IP | WOLFIP_CSUM_RX_L4) : 0;
+        eth_ll->rx_csum = 0;
+    }
+}
+
+void stm32_eth_get_stats(struct eth_stats *st)
+{
+    memcpy(st, &eth_stats, sizeof(*st));
+}
+
+void stm32_eth_reset_stats(void)
+{
+    eth_stats.rx_frames = 0;
+    eth_stats.rx_bytes = 0;
+    eth_stats.rx_dropped = 0;
+    eth_stats.rx_zerocopy = 0;
+    eth_stats.rx_copied = 0;
+    eth_stats.rx_csum_err = 0;
+    eth_stats.tx_frames = 0;
+    eth_stats.tx_bytes = 0;
+    eth_stats.tx_busy = 0;
+    eth_stats.tx_kicks = 0;
+    eth_stats.irqs = 0;
 }
 
 static int stm32_eth_attach(struct wolfIP *stack, struct wolfIP_ll_dev *ll, unsigned int if_idx)
@@ -855,6 +1131,11 @@ static int stm32_eth_attach(struct wolfIP *stack, struct wolfIP_ll_dev *ll, unsi
     ll->ifname[sizeof(ll->ifname) - 1] = '\0';
     ll->poll = stm32_eth_poll;
     ll->send = stm32_eth_send;
+    ll->rx_release = stm32_eth_rx_release;
+    ll->tx_begin = stm32_eth_tx_begin;
+    ll->tx_flush = stm32_eth_tx_flush;
+    eth_ll = ll;
+    stm32_eth_set_zerocopy(1);
 
     if (!tx_lock)
         tx_lock = mutex_init();
@@ -872,9 +1153,15 @@ static int stm32_eth_attach(struct wolfIP *stack, struct wolfIP_ll_dev *ll, unsi
     /* Wait for the PHY to report a live link before we enable TX */
     (void)wait_for_link();
     stm32_eth_ack_status();
+    ETH_DMACIER = ETH_DMACIER_NIE | ETH_DMACIER_RIE | ETH_DMACIER_TIE;
+    nvic_set_priority(ETH_IRQN, 1 << 5);
+    nvic_enable_irq(ETH_IRQN);
+    stm32_eth_set_csum_offload(1);
     stm32_eth_start();
     stm32_eth_link_status_debug =
         (uint32_t)stm32_eth_mdio_read((uint32_t)stm32_eth_phy_addr, STM32_ETH_PHY_REG_BSR);
+    eth_stats.link = (stm32_eth_link_status_debug & STM32_ETH_PHY_BSR_LINK_STATUS) ? 1U : 0U;
+    link_next_check = jiffies + STM32_ETH_LINK_POLL_MS;
 
 #if STM32_ETH_USE_STATIC_IP
     wolfIP_ipconfig_set_ex(stack,
@@ -2,6 +2,7 @@
 #include "device.h"
 #include "locks.h"
 #include "spi.h"
+#include "poll.h"
 #include "stm32h5xx.h"
 #define STM32_RCC_BASE RCC_BASE
 #include "stm32x5_board_common.h"
@@ -76,10 +77,57 @@ extern uint32_t SystemCoreClock;
 #define SPI_IFCR_MODFC     (1U << 9)
 #define SPI_IFCR_SUSPC     (1U << 11)
 
+#define SPI_CFG1_RXDMAEN   (1U << 14)
+#define SPI_CFG1_TXDMAEN   (1U << 15)
+
 #define SPI3_NS_BASE       0x40003C00UL
 #define SPI_WAIT_RETRIES   1000000U
 
-#define MAX_SPIS 2
+#if CONFIG_SPI_DMA
+/* GPDMA channel registers, 'ch' is the channel number (0..7) */
+#define GPDMA1_NS_BASE     0x40020000UL
+#define GPDMA_CH(base, ch, off) (*(volatile uint32_t *)((base) + 0x50U + ((ch) * 0x80U) + (off)))
+#define GPDMA_CFCR(b, c)   GPDMA_CH(b, c, 0x0CU)
+#define GPDMA_CSR(b, c)    GPDMA_CH(b, c, 0x10U)
+#define GPDMA_CCR(b, c)    GPDMA_CH(b, c, 0x14U)
+#define GPDMA_CTR1(b, c)   GPDMA_CH(b, c, 0x40U)
+#define GPDMA_CTR2(b, c)   GPDMA_CH(b, c, 0x44U)
+#define GPDMA_CBR1(b, c)   GPDMA_CH(b, c, 0x48U)
+#define GPDMA_CSAR(b, c)   GPDMA_CH(b, c, 0x4CU)
+#define GPDMA_CDAR(b, c)   GPDMA_CH(b, c, 0x50U)
+#define GPDMA_CLLR(b, c)   GPDMA_CH(b, c, 0x7CU)
+
+#define GPDMA_CCR_EN       (1U << 0)
+#define GPDMA_CCR_RESET    (1U << 1)
+#define GPDMA_CCR_SUSP     (1U << 2)
+#define GPDMA_CCR_TCIE     (1U << 8)
+#define GPDMA_CCR_DTEIE    (1U << 10)
+#define GPDMA_CCR_USEIE    (1U << 12)
+#define GPDMA_CSR_IDLEF    (1U << 0)
+#define GPDMA_CSR_TCF      (1U << 8)
+#define GPDMA_CSR_DTEF     (1U << 10)
+#define GPDMA_CSR_USEF     (1U << 12)
+#define GPDMA_CSR_SUSPF    (1U << 13)
+#define GPDMA_CFCR_ALL     (0x7FU << 8)
+#define GPDMA_CTR1_SINC    (1U << 3)
+#define GPDMA_CTR1_DINC    (1U << 19)
+#define GPDMA_CTR2_REQSEL_MASK 0x7FU
+#define GPDMA_CTR2_DREQ    (1U << 10)
+
+#define RCC_AHB1ENR        (*(volatile uint32_t *)(STM32_RCC_BASE + 0x088UL))
+#define RCC_AHB1ENR_GPDMA1EN (1U << 0)
+
+/* GPDMA1 request lines and the channels/IRQs given to SPI3 */
+#define GPDMA1_REQ_SPI3_RX 10U
+#define GPDMA1_REQ_SPI3_TX 11U
+#define SPI3_DMA_TX_CH     6U
+#define SPI3_DMA_RX_CH     7U
+#define SPI3_DMA_RX_IRQ    34U
+
+#define SPI_DMA_TIMEOUT_MS 1000U
+/* Result of a chunk that has not ended yet */
+#define SPI_DMA_RUNNING    1
+#endif
 
 struct dev_spi {
     struct device *dev;
@@ -88,9 +136,38 @@ struct dev_spi {
     uint8_t idx;
     mutex_t *mutex;
     struct spi_config config;
+    struct spi_stats stats;
+#if CONFIG_SPI_DMA
+    /* Chunk in flight. The RX channel interrupt (or the timeout) ends it,
+     * puts the bus back in polled mode and stores the result through
+     * dma_result; the bus mutex is not held meanwhile. */
+    volatile int dma_busy;
+    volatile int *dma_result;
+    struct spi_slave *dma_slave;
+    uint32_t dma_len;
+    uint32_t dma_cfg1;
+    uint32_t dma_deadline;
+    uint8_t dma_watchdog;
+    uint8_t dma_dummy_tx;
+    uint8_t dma_dummy_rx;
+    /* Tasks sleeping until a chunk ends */
+    struct waitq dma_wq;
+    /* Syscall that started a transfer with devspi_xfer_sleep() and gets
+     * the result when restarted */
+    struct task *owner;
+    uint16_t owner_pid;
+    uint32_t owner_seq;
+    const char *owner_tx;
+    char *owner_rx;
+    uint32_t owner_len;
+    volatile int owner_ret;
+#endif
 };
 
 static struct dev_spi *DEV_SPI[MAX_SPIS];
+#if CONFIG_SPI_DMA
+static void stm32_spi_dma_init(struct dev_spi *spi);
+#endif
 static int spi_dev_write(struct fnode *fno, const void *buf, unsigned int len);
 static struct module mod_devspi;
 
@@ -115,7 +192,7 @@ static int spi_dev_write(struct fnode *fno, const void *buf, unsigned int len)
     struct dev_spi *spi = (struct dev_spi *)FNO_MOD_PRIV(fno, &mod_devspi);
     if (!spi)
         return -ENODEV;
-    return devspi_xfer(&spi->file_slave, buf, NULL, len);
+    return devspi_xfer_sleep(&spi->file_slave, buf, NULL, len);
 }
 
 static struct module mod_devspi = {
@@ -292,6 +369,9 @@ int devspi_create(const struct spi_config *conf)
     stm32_spi_program_hw(spi);
 
     DEV_SPI[conf->idx] = spi;
+#if CONFIG_SPI_DMA
+    stm32_spi_dma_init(spi);
+#endif
 
     devfs = fno_search("/dev");
     if (devfs) {
@@ -303,12 +383,291 @@ int devspi_create(const struct spi_config *conf)
     return 0;
 }
 
+/* Move one chunk byte by byte, polling TXP/RXP. */
+static int stm32_spi_xfer_polled(struct dev_spi *spi, const uint8_t *tx, uint8_t *rx, uint32_t chunk)
+{
+    uint32_t i;
+
+    stm32_spi_begin_transfer(spi->base, chunk);
+    for (i = 0; i < chunk; i++) {
+        uint8_t value = tx ? tx[i] : 0xFFU;
+        uint32_t tx_retries = SPI_WAIT_RETRIES;
+        uint32_t rx_retries = SPI_WAIT_RETRIES;
+
+        while (!(SPI_SR(spi->base) & SPI_SR_TXP) && tx_retries--)
+            ;
+        if (tx_retries == 0U) {
+            kprintf("[devspi] TX timeout bus=%u base=0x%08lx i=%lu chunk=%lu sr=0x%08lx cr1=0x%08lx cr2=0x%08lx\n",
+                    (unsigned)spi->idx,
+                    (unsigned long)spi->base,
+                    (unsigned long)i,
+                    (unsigned long)chunk,
+                    (unsigned long)SPI_SR(spi->base),
+                    (unsigned long)SPI_CR1(spi->base),
+                    (unsigned long)SPI_CR2(spi->base));
+            return -ETIMEDOUT;
+        }
+        SPI_TXDR(spi->base) = value;
+        /* Always clock and consume RX; store if caller provided a buffer. */
+        while (!(SPI_SR(spi->base) & SPI_SR_RXP) && rx_retries--)
+            ;
+        if (rx_retries == 0U) {
+            kprintf("[devspi] RX timeout bus=%u base=0x%08lx i=%lu chunk=%lu sr=0x%08lx cr1=0x%08lx cr2=0x%08lx\n",
+                    (unsigned)spi->idx,
+                    (unsigned long)spi->base,
+                    (unsigned long)i,
+                    (unsigned long)chunk,
+                    (unsigned long)SPI_SR(spi->base),
+                    (unsigned long)SPI_CR1(spi->base),
+                    (unsigned long)SPI_CR2(spi->base));
+            return -ETIMEDOUT;
+        }
+        if (rx)
+            rx[i] = (uint8_t)SPI_RXDR(spi->base);
+        else
+            (void)SPI_RXDR(spi->base);
+    }
+    stm32_spi_wait_eot(spi->base);
+    if (SPI_SR(spi->base) & (SPI_SR_RXP | SPI_SR_RXWNE))
+        (void)SPI_RXDR(spi->base);
+    return 0;
+}
+
+#if CONFIG_SPI_DMA
+static void stm32_spi_dma_stop(uint32_t dma, uint32_t ch)
+{
+    uint32_t retries = SPI_WAIT_RETRIES;
+
+    if (GPDMA_CCR(dma, ch) & GPDMA_CCR_EN) {
+        GPDMA_CCR(dma, ch) |= GPDMA_CCR_SUSP;
+        while (!(GPDMA_CSR(dma, ch) & (GPDMA_CSR_SUSPF | GPDMA_CSR_IDLEF)) && retries--)
+            ;
+    }
+    GPDMA_CCR(dma, ch) = GPDMA_CCR_RESET;
+    GPDMA_CFCR(dma, ch) = GPDMA_CFCR_ALL;
+}
+
+/* Program a single-block, byte-wide channel. A NULL memory buffer is
+ * replaced by a one-byte dummy that is not incremented. */
+static void stm32_spi_dma_setup(uint32_t dma, uint32_t ch, uint32_t req,
+        uint32_t src, uint32_t dst, uint32_t tr1, uint32_t tr2, uint32_t len, uint32_t ccr)
+{
+    GPDMA_CCR(dma, ch) = 0;
+    GPDMA_CFCR(dma, ch) = GPDMA_CFCR_ALL;
+    GPDMA_CLLR(dma, ch) = 0;
+    GPDMA_CTR1(dma, ch) = tr1; /* byte wide on both sides */
+    GPDMA_CTR2(dma, ch) = (req & GPDMA_CTR2_REQSEL_MASK) | tr2;
+    GPDMA_CBR1(dma, ch) = len;
+    GPDMA_CSAR(dma, ch) = src;
+    GPDMA_CDAR(dma, ch) = dst;
+    GPDMA_CCR(dma, ch) = ccr | GPDMA_CCR_EN;
+}
+
+/* The chunk in flight is over: check how it ended, put the bus back in
+ * polled mode and tell whoever waits for it. Runs from the RX channel
+ * interrupt, or with interrupts off when the chunk timed out. */
+static void stm32_spi_dma_end(struct dev_spi *spi, int ret)
+{
+    uint32_t base = spi->base;
+    uint32_t dma = spi->config.tx_dma.base;
+    uint32_t tx_ch = spi->config.tx_dma.stream;
+    uint32_t rx_ch = spi->config.rx_dma.stream;
+    struct spi_slave *sl = spi->dma_slave;
+
+    if (!spi->dma_busy)
+        return;
+    if (ret == 0) {
+        stm32_spi_wait_eot(base);
+    } else {
+        kprintf("[devspi] DMA %s bus=%u chunk=%lu sr=0x%08lx dma=0x%08lx\n",
+                (ret == -EIO) ? "error" : "timeout",
+                (unsigned)spi->idx,
+                (unsigned long)spi->dma_len,
+                (unsigned long)SPI_SR(base),
+                (unsigned long)GPDMA_CSR(dma, rx_ch));
+        stm32_spi_dma_stop(dma, tx_ch);
+        stm32_spi_dma_stop(dma, rx_ch);
+    }
+
+    /* Back to the polled configuration */
+    stm32_spi_disable(base);
+    SPI_CFG1(base) = spi->dma_cfg1;
+    stm32_spi_clear_flags(base);
+    SPI_CR1(base) = SPI_CR1_SPE | SPI_CR1_SSI;
+    SPI_CR1(base) |= SPI_CR1_CSTART;
+
+    if (ret == 0) {
+        spi->stats.dma_xfers++;
+        spi->stats.dma_bytes += spi->dma_len;
+        spi->stats.bytes += spi->dma_len;
+    } else {
+        spi->stats.errors++;
+    }
+    if (spi->dma_result)
+        *spi->dma_result = ret;
+    spi->dma_result = NULL;
+    spi->dma_slave = NULL;
+    spi->dma_busy = 0;
+    /* The device may release its chip select */
+    if (sl && sl->isr)
+        sl->isr(sl);
+    waitq_wake(&spi->dma_wq, POLLIN);
+}
+
+/* GPDMA1 channel 7 interrupt: SPI3 (bus 0) is the only bus with DMA */
+void spi_dma_irq_handler(void)
+{
+    struct dev_spi *spi = DEV_SPI[0];
+    uint32_t dma, ch, sr;
+
+    if (!spi)
+        return;
+    dma = spi->config.rx_dma.base;
+    ch = spi->config.rx_dma.stream;
+    sr = GPDMA_CSR(dma, ch);
+    GPDMA_CFCR(dma, ch) = GPDMA_CFCR_ALL;
+    if (!(sr & (GPDMA_CSR_TCF | GPDMA_CSR_DTEF | GPDMA_CSR_USEF)))
+        return;
+    stm32_spi_dma_end(spi, (sr & (GPDMA_CSR_DTEF | GPDMA_CSR_USEF)) ? -EIO : 0);
+}
+
+static void stm32_spi_dma_watchdog_arm(struct dev_spi *spi);
+
+/* Ends a chunk whose interrupt never came, so that its waiters sleeping
+ * on dma_wq wake up */
+static void stm32_spi_dma_watchdog(uint32_t now, void *arg)
+{
+    struct dev_spi *spi = (struct dev_spi *)arg;
+
+    (void)now;
+    spi->dma_watchdog = 0;
+    irq_off();
+    if (spi->dma_busy && jiffies_reached(spi->dma_deadline))
+        stm32_spi_dma_end(spi, -ETIMEDOUT);
+    irq_on();
+    if (spi->dma_busy)
+        stm32_spi_dma_watchdog_arm(spi);
+}
+
+static void stm32_spi_dma_watchdog_arm(struct dev_spi *spi)
+{
+    if (spi->dma_watchdog)
+        return;
+    if (ktimer_add(SPI_DMA_TIMEOUT_MS, stm32_spi_dma_watchdog, spi) >= 0)
+        spi->dma_watchdog = 1;
+}
+
+/* Sleep while *state is SPI_DMA_RUNNING (or dma_busy is set). Tasks and
+ * kernel threads sleep on dma_wq until the completion interrupt. The
+ * kernel thread cannot be switched out, and neither can a syscall that
+ * is not restartable at this point: they idle in WFI, and end the chunk
+ * themselves if it is overdue since ktimers do not run meanwhile. */
+static void stm32_spi_dma_sleep(struct dev_spi *spi, volatile int *state)
+{
+    struct task *t = this_task();
+    struct waitq_entry e;
+
+    while (*state == SPI_DMA_RUNNING) {
+        if (t && !task_in_syscall()) {
+            memset(&e, 0, sizeof(e));
+            e.task = t;
+            e.events = POLLIN;
+            irq_off();
+            if (*state == SPI_DMA_RUNNING) {
+                waitq_add(&spi->dma_wq, &e);
+                task_suspend();
+            }
+            irq_on();
+            waitq_del(&e);
+        } else if (jiffies_reached(spi->dma_deadline)) {
+            irq_off();
+            stm32_spi_dma_end(spi, -ETIMEDOUT);
+            irq_on();
+        } else {
+            __asm volatile ("wfi");
+        }
+    }
+}
+
+/* Start one chunk on the TX and RX channels of the bus, with the bus
+ * locked and idle. RX is the one that finishes last and raises the
+ * completion interrupt; the result goes to *result. */
+static void stm32_spi_dma_start(struct dev_spi *spi, struct spi_slave *sl, volatile int *result,
+        const uint8_t *tx, uint8_t *rx, uint32_t chunk)
+{
+    uint32_t base = spi->base;
+    uint32_t dma = spi->config.tx_dma.base;
+    uint32_t tx_ch = spi->config.tx_dma.stream;
+    uint32_t rx_ch = spi->config.rx_dma.stream;
+    uint32_t cfg1;
+
+    *result = SPI_DMA_RUNNING;
+    spi->dma_result = result;
+    spi->dma_slave = sl;
+    spi->dma_len = chunk;
+    spi->dma_deadline = jiffies + SPI_DMA_TIMEOUT_MS;
+    spi->dma_busy = 1;
+    stm32_spi_dma_watchdog_arm(spi);
+
+    spi->dma_dummy_tx = 0xFFU;
+    stm32_spi_disable(base);
+    stm32_spi_clear_flags(base);
+    cfg1 = SPI_CFG1(base);
+    spi->dma_cfg1 = cfg1;
+    SPI_CFG1(base) = cfg1 | SPI_CFG1_RXDMAEN;
+    stm32_spi_dma_setup(dma, rx_ch, spi->config.rx_dma.channel,
+            base + 0x30U, rx ? (uint32_t)rx : (uint32_t)&spi->dma_dummy_rx,
+            rx ? GPDMA_CTR1_DINC : 0U, 0U, chunk,
+            GPDMA_CCR_TCIE | GPDMA_CCR_DTEIE | GPDMA_CCR_USEIE);
+    stm32_spi_dma_setup(dma, tx_ch, spi->config.tx_dma.channel,
+            tx ? (uint32_t)tx : (uint32_t)&spi->dma_dummy_tx, base + 0x20U,
+            tx ? GPDMA_CTR1_SINC : 0U, GPDMA_CTR2_DREQ, chunk, 0U);
+    SPI_CFG1(base) = cfg1 | SPI_CFG1_RXDMAEN | SPI_CFG1_TXDMAEN;
+    SPI_CR2(base) = (SPI_CR2(base) & ~SPI_CR2_TSIZE_MASK) |
+        ((chunk << SPI_CR2_TSIZE_SHIFT) & SPI_CR2_TSIZE_MASK);
+    SPI_CR1(base) = SPI_CR1_SPE | SPI_CR1_SSI;
+    SPI_CR1(base) |= SPI_CR1_CSTART;
+}
+
+static void stm32_spi_dma_init(struct dev_spi *spi)
+{
+    const struct spi_config *conf = &spi->config;
+
+    if (!conf->tx_dma.base || !conf->rx_dma.base)
+        return;
+    RCC_AHB1ENR |= RCC_AHB1ENR_GPDMA1EN;
+    (void)RCC_AHB1ENR;
+    stm32_spi_dma_stop(conf->tx_dma.base, conf->tx_dma.stream);
+    stm32_spi_dma_stop(conf->rx_dma.base, conf->rx_dma.stream);
+    nvic_set_priority(conf->rx_dma.irq, 1 << 5);
+    nvic_enable_irq(conf->rx_dma.irq);
+}
+#endif
+
+/* Lock the bus, once the DMA chunk in flight (if any) is over. In a
+ * syscall, contention returns SYS_CALL_AGAIN with the task queued on the
+ * lock. */
+static int stm32_spi_claim(struct dev_spi *spi)
+{
+    int ret = mutex_lock(spi->mutex);
+
+#if CONFIG_SPI_DMA
+    while ((ret == 0) && spi->dma_busy) {
+        mutex_unlock(spi->mutex);
+        stm32_spi_dma_sleep(spi, &spi->dma_busy);
+        ret = mutex_lock(spi->mutex);
+    }
+#endif
+    return ret;
+}
+
 int devspi_xfer(struct spi_slave *sl, const char *obuf, char *ibuf, unsigned int len)
 {
     struct dev_spi *spi;
     const uint8_t *tx = (const uint8_t *)obuf;
     uint8_t *rx = (uint8_t *)ibuf;
     unsigned int remaining = len;
+    int ret = 0;
 
     if (!sl || sl->bus >= MAX_SPIS)
         return -EINVAL;
@@ -320,55 +679,37 @@ int devspi_xfer(struct spi_slave *sl, const char *obuf, char *ibuf, unsigned int
     if (len == 0U)
         return 0;
 
-    mutex_lock(spi->mutex);
     while (remaining > 0U) {
         uint32_t chunk = remaining > 0xFFFFU ? 0xFFFFU : remaining;
-        uint32_t i;
-
-        stm32_spi_begin_transfer(spi->base, chunk);
-        for (i = 0; i < chunk; i++) {
-            uint8_t value = tx ? tx[i] : 0xFFU;
-            uint32_t tx_retries = SPI_WAIT_RETRIES;
-            uint32_t rx_retries = SPI_WAIT_RETRIES;
-
-            while (!(SPI_SR(spi->base) & SPI_SR_TXP) && tx_retries--)
-                ;
-            if (tx_retries == 0U) {
-                kprintf("[devspi] TX timeout bus=%u base=0x%08lx i=%lu chunk=%lu sr=0x%08lx cr1=0x%08lx cr2=0x%08lx\n",
-                        (unsigned)sl->bus,
-                        (unsigned long)spi->base,
-                        (unsigned long)i,
-                        (unsigned long)chunk,
-                        (unsigned long)SPI_SR(spi->base),
-                        (unsigned long)SPI_CR1(spi->base),
-                        (unsigned long)SPI_CR2(spi->base));
-                mutex_unlock(spi->mutex);
-                return -ETIMEDOUT;
-            }
-            SPI_TXDR(spi->base) = value;
-            /* Always clock and consume RX; store if caller provided a buffer. */
-            while (!(SPI_SR(spi->base) & SPI_SR_RXP) && rx_retries--)
-                ;
-            if (rx_retries == 0U) {
-                kprintf("[devspi] RX timeout bus=%u base=0x%08lx i=%lu chunk=%lu sr=0x%08lx cr1=0x%08lx cr2=0x%08lx\n",
-                        (unsigned)sl->bus,
-                        (unsigned long)spi->base,
-                        (unsigned long)i,
-                        (unsigned long)chunk,
-                        (unsigned long)SPI_SR(spi->base),
-                        (unsigned long)SPI_CR1(spi->base),
-                        (unsigned long)SPI_CR2(spi->base));
-                mutex_unlock(spi->mutex);
-                return -ETIMEDOUT;
+
+        ret = stm32_spi_claim(spi);
+        if (ret != 0)
+            break;
+#if CONFIG_SPI_DMA
+        /* Short commands cost less to poll than to set up the channels */
+        if (spi->config.rx_dma.base && (chunk >= CONFIG_SPI_DMA_MIN)) {
+            volatile int result;
+
+            stm32_spi_dma_start(spi, NULL, &result, tx, rx, chunk);
+            mutex_unlock(spi->mutex);
+            stm32_spi_dma_sleep(spi, &result);
+            ret = result;
+            if (ret < 0)
+                break;
+        } else
+#endif
+        {
+            ret = stm32_spi_xfer_polled(spi, tx, rx, chunk);
+            if (ret == 0) {
+                spi->stats.poll_xfers++;
+                spi->stats.bytes += chunk;
+            } else {
+                spi->stats.errors++;
             }
-            if (rx)
-                rx[i] = (uint8_t)SPI_RXDR(spi->base);
-            else
-                (void)SPI_RXDR(spi->base);
+            mutex_unlock(spi->mutex);
+            if (ret < 0)
+                break;
         }
-        stm32_spi_wait_eot(spi->base);
-        if (SPI_SR(spi->base) & (SPI_SR_RXP | SPI_SR_RXWNE))
-            (void)SPI_RXDR(spi->base);
 
         if (tx)
             tx += chunk;
@@ -376,11 +717,130 @@ int devspi_xfer(struct spi_slave *sl, const char *obuf, char *ibuf, unsigned int
             rx += chunk;
         remaining -= chunk;
     }
-    mutex_unlock(spi->mutex);
 
+    if (ret < 0)
+        return ret;
     return (int)len;
 }
 
+#if CONFIG_SPI_DMA
+/* The syscall that started the transfer is still to collect it. One
+ * that ended without coming back (EINTR, exit) no longer holds the bus:
+ * the scheduler wakes dma_wq when that happens. */
+static int devspi_owner_waiting(struct dev_spi *spi)
+{
+    return task_is_live(spi->owner, spi->owner_pid) &&
+        (task_syscall_seq(spi->owner) == spi->owner_seq);
+}
+#endif
+
+/*
+ * devspi_xfer() for the top of a syscall that can be restarted from
+ * scratch, on buffers that outlive it (user memory, driver statics).
+ * A transfer long enough for DMA is started and the task goes to sleep
+ * with SYS_CALL_AGAIN instead of holding the core until it is over; the
+ * restarted syscall makes the same call and gets the result. Meanwhile
+ * devspi_xfer_pending() is true: whatever led to the transfer (e.g. a
+ * command sent under the same chip select) must not be sent again, and
+ * sl->isr, if set, runs from the interrupt when the transfer ends.
+ * Anywhere else, or for short transfers, this is devspi_xfer(). At most
+ * 0xFFFF bytes are moved per call.
+ */
+int devspi_xfer_sleep(struct spi_slave *sl, const char *obuf, char *ibuf, unsigned int len)
+{
+#if CONFIG_SPI_DMA
+    struct task *t = this_task();
+    struct dev_spi *spi = NULL;
+    int ret;
+
+    if (sl && sl->bus < MAX_SPIS)
+        spi = DEV_SPI[sl->bus];
+    if (!t || !task_in_syscall() || !spi || !spi->mutex || !spi->config.rx_dma.base)
+        return devspi_xfer(sl, obuf, ibuf, len);
+
+    if (devspi_xfer_pending(sl)) {
+        irq_off();
+        if (spi->owner_ret == SPI_DMA_RUNNING) {
+            ret = task_waitq_sleep(&spi->dma_wq, POLLIN);
+            irq_on();
+            return ret;
+        }
+        irq_on();
+        spi->owner = NULL;
+        ret = spi->owner_ret;
+        waitq_wake(&spi->dma_wq, POLLIN);
+        if ((spi->owner_tx == obuf) && (spi->owner_rx == ibuf) &&
+                (spi->owner_len <= len))
+            return (ret < 0) ? ret : (int)spi->owner_len;
+        /* Left behind by a syscall that did not come back for it */
+    }
+
+    if (len < CONFIG_SPI_DMA_MIN)
+        return devspi_xfer(sl, obuf, ibuf, len);
+    if (len > 0xFFFFU)
+        len = 0xFFFFU;
+
+    ret = mutex_lock(spi->mutex);
+    if (ret != 0)
+        return ret;
+    if (spi->owner && !devspi_owner_waiting(spi))
+        spi->owner = NULL;
+    irq_off();
+    if (spi->dma_busy || spi->owner) {
+        /* Wait for the bus, or for the last owner to collect */
+        ret = task_waitq_sleep(&spi->dma_wq, POLLIN);
+        irq_on();
+        mutex_unlock(spi->mutex);
+        return ret;
+    }
+    irq_on();
+    spi->owner = t;
+    spi->owner_pid = this_task_getpid();
+    spi->owner_seq = task_syscall_seq(t);
+    spi->owner_tx = obuf;
+    spi->owner_rx = ibuf;
+    spi->owner_len = len;
+    /* Queued before the channels start: the interrupt cannot be missed */
+    ret = task_waitq_sleep(&spi->dma_wq, POLLIN);
+    stm32_spi_dma_start(spi, sl, &spi->owner_ret, (const uint8_t *)obuf, (uint8_t *)ibuf, len);
+    mutex_unlock(spi->mutex);
+    return ret;
+#else
+    return devspi_xfer(sl, obuf, ibuf, len);
+#endif
+}
+
+/* The calling syscall has a transfer started by devspi_xfer_sleep() on
+ * this bus, running or not yet collected */
+int devspi_xfer_pending(struct spi_slave *sl)
+{
+#if CONFIG_SPI_DMA
+    struct dev_spi *spi;
+    struct task *t = this_task();
+
+    if (!t || !sl || sl->bus >= MAX_SPIS)
+        return 0;
+    spi = DEV_SPI[sl->bus];
+    return spi && (spi->owner == t) && devspi_owner_waiting(spi);
+#else
+    (void)sl;
+    return 0;
+#endif
+}
+
+int devspi_get_stats(int bus, struct spi_stats *st)
+{
+    struct dev_spi *spi;
+
+    if ((bus < 0) || (bus >= MAX_SPIS) || !st)
+        return -EINVAL;
+    spi = DEV_SPI[bus];
+    if (!spi)
+        return -ENODEV;
+    memcpy(st, &spi->stats, sizeof(*st));
+    return 0;
+}
+
 int spi_bus_init(void)
 {
 #if defined(TARGET_stm32h563)
@@ -398,6 +858,21 @@ int spi_bus_init(void)
         .dff_16 = 0,
         .enable_software_slave_management = 1,
         .send_msb_first = 1,
+#if CONFIG_SPI_DMA
+        /* stream: GPDMA1 channel, channel: request line */
+        .tx_dma = {
+            .base = GPDMA1_NS_BASE,
+            .stream = SPI3_DMA_TX_CH,
+            .channel = GPDMA1_REQ_SPI3_TX,
+            .irq = 0,
+        },
+        .rx_dma = {
+            .base = GPDMA1_NS_BASE,
+            .stream = SPI3_DMA_RX_CH,
+            .channel = GPDMA1_REQ_SPI3_RX,
+            .irq = SPI3_DMA_RX_IRQ,
+        },
+#endif
         .pio_sck = {
             .base = GPIOC_BASE,
             .pin = 10,
@@ -105,6 +105,15 @@ extern int sys_dlsym_hdlr(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
 extern int sys_dlclose_hdlr(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
 extern int sys_sendmsg_hdlr(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
 extern int sys_recvmsg_hdlr(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+extern int sys_epoll_create_hdlr(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+extern int sys_epoll_ctl_hdlr(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+extern int sys_epoll_wait_hdlr(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+extern int sys_splice_hdlr(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+extern int sys_tee_hdlr(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+extern int sys_fsync_hdlr(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+extern int sys_getrusage_hdlr(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+extern int sys_futex_wait_hdlr(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+extern int sys_futex_wake_hdlr(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
 
 void syscalls_init(void) {
 	sys_register_handler(0, sys_sleep_hdlr);
@@ -208,4 +217,13 @@ void syscalls_init(void) {
 	sys_register_handler(98, sys_dlclose_hdlr);
 	sys_register_handler(99, sys_sendmsg_hdlr);
 	sys_register_handler(100, sys_recvmsg_hdlr);
+	sys_register_handler(101, sys_epoll_create_hdlr);
+	sys_register_handler(102, sys_epoll_ctl_hdlr);
+	sys_register_handler(103, sys_epoll_wait_hdlr);
+	sys_register_handler(104, sys_splice_hdlr);
+	sys_register_handler(105, sys_tee_hdlr);
+	sys_register_handler(106, sys_fsync_hdlr);
+	sys_register_handler(107, sys_getrusage_hdlr);
+	sys_register_handler(108, sys_futex_wait_hdlr);
+	sys_register_handler(109, sys_futex_wake_hdlr);
 }
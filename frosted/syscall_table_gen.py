@@ -112,6 +112,26 @@ syscalls = [
     ["dlclose", 1, "sys_dlclose_hdlr"],
     ["sendmsg", 3, "sys_sendmsg_hdlr"],
     ["recvmsg", 3, "sys_recvmsg_hdlr"],
+    ["epoll_create", 1, "sys_epoll_create_hdlr"],
+    ["epoll_ctl", 4, "sys_epoll_ctl_hdlr"],
+    ["epoll_wait", 4, "sys_epoll_wait_hdlr"],
+    ["splice", 4, "sys_splice_hdlr"],
+    ["tee", 4, "sys_tee_hdlr"],
+    ["fsync", 1, "sys_fsync_hdlr"],
+    ["getrusage", 2, "sys_getrusage_hdlr"],
+    ["futex_wait", 3, "sys_futex_wait_hdlr"],
+    ["futex_wake", 2, "sys_futex_wake_hdlr"],
+]
+
+# Syscalls the C library reaches through a userspace implementation:
+# no stub is generated, sys/frosted_pthread_mutex.c provides sys_<name>.
+# The kernel handlers stay for binaries linked against older stubs.
+userspace = [
+    "pthread_mutex_init",
+    "pthread_mutex_destroy",
+    "pthread_mutex_lock",
+    "pthread_mutex_trylock",
+    "pthread_mutex_unlock",
 ]
 
    #
@@ -140,6 +160,8 @@ kernel_hdr.write("#define _SYSCALLS_NR (%d) /* We have %d syscalls! */\n" % (len
 for n in range(len(syscalls)):
     name = syscalls[n][0]
     tp = syscalls[n][1]
+    if name in userspace:
+        continue
     usercode.write( "/* Syscall: %s(%d arguments) */\n" % (name, tp))
     if (tp == 0):
         usercode.write( "int sys_%s(void){\n" % name)
@@ -172,6 +194,7 @@ for n in range(len(syscalls)):
         usercode.write( "}\n")
         usercode.write("\n")
 
+usercode.write("/* Userspace fast paths */\n#include \"frosted_pthread_mutex.c\"\n")
 usercode.close()
 kernel_hdr.close()
 
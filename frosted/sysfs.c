@@ -23,9 +23,22 @@
 #include "string.h"
 #include "gpio.h"
 #include "lowpower.h"
+#include "eth.h"
+#include "spi.h"
+#include "dcache.h"
+#if CONFIG_BLKCACHE
+#include "blkcache.h"
+#endif
+#ifdef CONFIG_KLOG
+#include "klog.h"
+#endif
 
 #define MAX_SYSFS_BUFFER 1024
-#define CONFIG_MAX_SYSFS_FNODES 32
+#define TASKS_SYSFS_BUFFER (2 * MAX_SYSFS_BUFFER)
+/* The nodes registered at boot, plus "mem" and "stat" under
+ * /sys/proc/<pid> for every task */
+#define SYSFS_STATIC_FNODES 32
+#define CONFIG_MAX_SYSFS_FNODES (SYSFS_STATIC_FNODES + 2 * CONFIG_MAX_TASKS)
 
 POOL_DEFINE(sysfs_fnode_pool, struct sysfs_fnode, CONFIG_MAX_SYSFS_FNODES);
 
@@ -167,6 +180,26 @@ int nice_to_str(int8_t n, char *s)
     return (i - 1);
 }
 
+/* CPU time as seconds and milliseconds, "12.345": a plain count of ms
+ * would wrap after 49.7 days */
+static int cputime_to_str(uint32_t sec, uint32_t usec, char *s)
+{
+    uint32_t ms = usec / 1000;
+    int off;
+
+    if (ms > 999) {
+        sec += ms / 1000;
+        ms %= 1000;
+    }
+    off = ul_to_str(sec, s);
+    s[off++] = '.';
+    s[off++] = (char)('0' + ms / 100);
+    s[off++] = (char)('0' + (ms / 10) % 10);
+    s[off++] = (char)('0' + ms % 10);
+    s[off] = '\0';
+    return off;
+}
+
 int sysfs_time_read(struct sysfs_fnode *sfs, void *buf, int len)
 {
     char *res = (char *)buf;
@@ -452,11 +485,14 @@ int sysfs_tasks_read(struct sysfs_fnode *sfs, void *buf, int len)
     int p_state;
     int nice;
     uint16_t pids[16];
-    const char legend[]="pid\tstate\tstack\theap\tnice\tname\r\n";
+    struct task_cputime ct;
+    const char legend[]="pid\tstate\tstack\theap\tnice\tutime\tstime\tvcsw\tivcsw\tname\r\n";
+    const char rq_legend[]="\r\nrq_nice\tqueued\tpicks\r\n";
+    const char sw_legend[]="\r\nswitches\tcyc/sw\tacct/sw\tkernel\r\n";
     uint32_t cur_off = task_fd_get_off(fno);
     if (cur_off == 0) {
         mutex_lock(sysfs_mutex);
-        task_txt = kalloc(MAX_SYSFS_BUFFER);
+        task_txt = kalloc(TASKS_SYSFS_BUFFER);
         if (!task_txt)
             return -1;
         off = 0;
@@ -468,6 +504,8 @@ int sysfs_tasks_read(struct sysfs_fnode *sfs, void *buf, int len)
         for (i = 0; i < n_pids; i++) {
             uint16_t pid = pids[i];
             p_state = scheduler_task_state(pid);
+            if (off + 128 > TASKS_SYSFS_BUFFER)
+                break;
             if ((p_state != TASK_IDLE) && (p_state != TASK_OVER)) {
                 off += ul_to_str(pid, task_txt + off);
                 task_txt[off++] = '\t';
@@ -505,6 +543,18 @@ int sysfs_tasks_read(struct sysfs_fnode *sfs, void *buf, int len)
                 nice = scheduler_get_nice(pid);
                 off += nice_to_str(nice, task_txt + off);
 
+                /* CPU time in seconds, context switches */
+                if (scheduler_task_cputime(pid, &ct) < 0)
+                    memset(&ct, 0, sizeof(ct));
+                task_txt[off++] = '\t';
+                off += cputime_to_str(ct.utime_sec, ct.utime_usec, task_txt + off);
+                task_txt[off++] = '\t';
+                off += cputime_to_str(ct.stime_sec, ct.stime_usec, task_txt + off);
+                task_txt[off++] = '\t';
+                off += ul_to_str(ct.nvcsw, task_txt + off);
+                task_txt[off++] = '\t';
+                off += ul_to_str(ct.nivcsw, task_txt + off);
+
                 task_txt[off++] = '\t';
                 name = scheduler_task_name(pid);
                 if (name)
@@ -517,6 +567,49 @@ int sysfs_tasks_read(struct sysfs_fnode *sfs, void *buf, int len)
                 task_txt[off++] = '\n';
             }
         }
+
+        /* Run queue: one line per level that is populated or has been
+         * picked since boot. */
+        strcpy(task_txt + off, rq_legend);
+        off += strlen(rq_legend);
+        for (i = 0; i < SCHED_LEVELS; i++) {
+            uint32_t nr, picks;
+            if (scheduler_runqueue_stats(i, &nr, &picks) < 0)
+                break;
+            if ((nr == 0) && (picks == 0))
+                continue;
+            if (off + 40 > TASKS_SYSFS_BUFFER)
+                break;
+            off += nice_to_str(i + NICE_RT, task_txt + off);
+            task_txt[off++] = '\t';
+            off += ul_to_str(nr, task_txt + off);
+            task_txt[off++] = '\t';
+            off += ul_to_str(picks, task_txt + off);
+            task_txt[off++] = '\r';
+            task_txt[off++] = '\n';
+        }
+
+        /* Context switches, what a switch costs, and the CPU time (s) of
+         * the kernel thread: idle time and tasklets. */
+        if (off + sizeof(sw_legend) + 48 <= TASKS_SYSFS_BUFFER) {
+            uint32_t sw, sw_cyc, acct_cyc;
+            scheduler_switch_stats(&sw, &sw_cyc, &acct_cyc);
+            if (scheduler_task_cputime(0, &ct) < 0)
+                memset(&ct, 0, sizeof(ct));
+            strcpy(task_txt + off, sw_legend);
+            off += strlen(sw_legend);
+            off += ul_to_str(sw, task_txt + off);
+            task_txt[off++] = '\t';
+            task_txt[off++] = '\t';
+            off += ul_to_str(sw_cyc, task_txt + off);
+            task_txt[off++] = '\t';
+            off += ul_to_str(acct_cyc, task_txt + off);
+            task_txt[off++] = '\t';
+            off += cputime_to_str(ct.utime_sec + ct.stime_sec,
+                    ct.utime_usec + ct.stime_usec, task_txt + off);
+            task_txt[off++] = '\r';
+            task_txt[off++] = '\n';
+        }
         task_txt[off++] = '\0';
     }
 
@@ -537,19 +630,16 @@ int sysfs_tasks_read(struct sysfs_fnode *sfs, void *buf, int len)
 
 #define NPOOLS 5
 
-static int sysfs_mem_append_line(char *dst, int dst_len, int off,
-        const char *label, uint32_t value)
+static int sysfs_append_field(char *dst, int dst_len, int off,
+        const char *label, const char *value_buf, int value_len)
 {
-    char value_buf[11];
     int label_len;
-    int value_len;
     int remaining;
 
     if (!dst || !label || off < 0 || dst_len <= 0 || off >= dst_len)
         return -1;
 
     label_len = strlen(label);
-    value_len = ul_to_str(value, value_buf);
     remaining = dst_len - off;
     if (remaining <= (label_len + 1 + value_len + 2))
         return -1;
@@ -564,6 +654,15 @@ static int sysfs_mem_append_line(char *dst, int dst_len, int off,
     return off;
 }
 
+static int sysfs_mem_append_line(char *dst, int dst_len, int off,
+        const char *label, uint32_t value)
+{
+    char value_buf[11];
+
+    return sysfs_append_field(dst, dst_len, off, label, value_buf,
+            ul_to_str(value, value_buf));
+}
+
 static int sysfs_append_truncated(char *dst, int dst_len, int off,
         const char *src, int tail_reserve)
 {
@@ -609,6 +708,7 @@ int sysfs_mem_read(struct sysfs_fnode *sfs, void *buf, int len)
 
     if (cur_off == 0) {
         struct mempool_stats stats;
+        struct kalloc_stats kstats;
         mutex_lock(sysfs_mutex);
         mem_txt = kalloc(MAX_SYSFS_BUFFER);
         if (!mem_txt) {
@@ -645,6 +745,19 @@ int sysfs_mem_read(struct sysfs_fnode *sfs, void *buf, int len)
                 "chunks   ", stats.n_free_chunks);
         if (off < 0)
             goto mem_overflow;
+        kalloc_get_stats(&kstats);
+        off = sysfs_mem_append_line(mem_txt, MAX_SYSFS_BUFFER, off,
+                "kheap    ", kstats.heap_bytes);
+        if (off < 0)
+            goto mem_overflow;
+        off = sysfs_mem_append_line(mem_txt, MAX_SYSFS_BUFFER, off,
+                "kheap_free", kstats.free_bytes);
+        if (off < 0)
+            goto mem_overflow;
+        off = sysfs_mem_append_line(mem_txt, MAX_SYSFS_BUFFER, off,
+                "kheap_max", kstats.largest_free);
+        if (off < 0)
+            goto mem_overflow;
         mem_txt[off++] = '\0';
     }
 
@@ -668,6 +781,648 @@ mem_overflow:
     return -1;
 }
 
+static int sysfs_idle_read(struct sysfs_fnode *sfs, void *buf, int len)
+{
+    char *res = (char *)buf;
+    struct fnode *fno = sfs->fnode;
+    static char *idle_txt;
+    static int off;
+    uint32_t cur_off = task_fd_get_off(fno);
+
+    if (cur_off == 0) {
+        struct systick_idle_stats st;
+        uint32_t now = jiffies;
+        uint32_t residency = 0;
+        mutex_lock(sysfs_mutex);
+        idle_txt = kalloc(MAX_SYSFS_BUFFER);
+        if (!idle_txt) {
+            mutex_unlock(sysfs_mutex);
+            return -1;
+        }
+        systick_idle_get_stats(&st);
+        if (now >= 100)
+            residency = st.idle_jiffies / (now / 100);
+        off = 0;
+        off = sysfs_mem_append_line(idle_txt, MAX_SYSFS_BUFFER, off,
+                "tickless  ", st.tickless);
+        if (off < 0)
+            goto idle_overflow;
+        off = sysfs_mem_append_line(idle_txt, MAX_SYSFS_BUFFER, off,
+                "uptime_ms ", now);
+        if (off < 0)
+            goto idle_overflow;
+        off = sysfs_mem_append_line(idle_txt, MAX_SYSFS_BUFFER, off,
+                "idle_ms   ", st.idle_jiffies);
+        if (off < 0)
+            goto idle_overflow;
+        off = sysfs_mem_append_line(idle_txt, MAX_SYSFS_BUFFER, off,
+                "idle_pct  ", residency);
+        if (off < 0)
+            goto idle_overflow;
+        off = sysfs_mem_append_line(idle_txt, MAX_SYSFS_BUFFER, off,
+                "sleeps    ", st.sleeps);
+        if (off < 0)
+            goto idle_overflow;
+        off = sysfs_mem_append_line(idle_txt, MAX_SYSFS_BUFFER, off,
+                "wake_timer", st.wakeups_timer);
+        if (off < 0)
+            goto idle_overflow;
+        off = sysfs_mem_append_line(idle_txt, MAX_SYSFS_BUFFER, off,
+                "wake_irq  ", st.wakeups_irq);
+        if (off < 0)
+            goto idle_overflow;
+        off = sysfs_mem_append_line(idle_txt, MAX_SYSFS_BUFFER, off,
+                "max_sleep ", st.max_sleep);
+        if (off < 0)
+            goto idle_overflow;
+        idle_txt[off++] = '\0';
+    }
+
+    cur_off = task_fd_get_off(fno);
+    if (off == cur_off) {
+        kfree(idle_txt);
+        mutex_unlock(sysfs_mutex);
+        return -1;
+    }
+    if (len > (off - cur_off)) {
+        len = off - cur_off;
+    }
+    memcpy(res, idle_txt + cur_off, len);
+    cur_off += len;
+    task_fd_set_off(fno, cur_off);
+    return len;
+
+idle_overflow:
+    kfree(idle_txt);
+    mutex_unlock(sysfs_mutex);
+    return -1;
+}
+
+#if CONFIG_MPU
+/* MPU region cache statistics. Cycle sums are 32 bit: write "reset"
+ * before a measurement run. Writing "0"/"1" disables/enables the cache.
+ */
+static int sysfs_mpu_read(struct sysfs_fnode *sfs, void *buf, int len)
+{
+    char *res = (char *)buf;
+    struct fnode *fno = sfs->fnode;
+    static char *mpu_txt;
+    static int off;
+    uint32_t cur_off = task_fd_get_off(fno);
+
+    if (cur_off == 0) {
+        struct mpu_cache_stats st;
+        mutex_lock(sysfs_mutex);
+        mpu_txt = kalloc(MAX_SYSFS_BUFFER);
+        if (!mpu_txt) {
+            mutex_unlock(sysfs_mutex);
+            return -1;
+        }
+        mpu_cache_get_stats(&st);
+        off = 0;
+        off = sysfs_mem_append_line(mpu_txt, MAX_SYSFS_BUFFER, off,
+                "cache     ", st.enabled);
+        if (off < 0)
+            goto mpu_overflow;
+        off = sysfs_mem_append_line(mpu_txt, MAX_SYSFS_BUFFER, off,
+                "hits      ", st.hits);
+        if (off < 0)
+            goto mpu_overflow;
+        off = sysfs_mem_append_line(mpu_txt, MAX_SYSFS_BUFFER, off,
+                "misses    ", st.misses);
+        if (off < 0)
+            goto mpu_overflow;
+        off = sysfs_mem_append_line(mpu_txt, MAX_SYSFS_BUFFER, off,
+                "hit_cyc   ", st.hits ? (st.hit_cycles / st.hits) : 0);
+        if (off < 0)
+            goto mpu_overflow;
+        off = sysfs_mem_append_line(mpu_txt, MAX_SYSFS_BUFFER, off,
+                "miss_cyc  ", st.misses ? (st.miss_cycles / st.misses) : 0);
+        if (off < 0)
+            goto mpu_overflow;
+        mpu_txt[off++] = '\0';
+    }
+
+    cur_off = task_fd_get_off(fno);
+    if (off == cur_off) {
+        kfree(mpu_txt);
+        mutex_unlock(sysfs_mutex);
+        return -1;
+    }
+    if (len > (off - cur_off)) {
+        len = off - cur_off;
+    }
+    memcpy(res, mpu_txt + cur_off, len);
+    cur_off += len;
+    task_fd_set_off(fno, cur_off);
+    return len;
+
+mpu_overflow:
+    kfree(mpu_txt);
+    mutex_unlock(sysfs_mutex);
+    return -1;
+}
+
+static int sysfs_mpu_write(struct sysfs_fnode *sfs, const void *buf, int len)
+{
+    const char *cmd = (const char *)buf;
+
+    if (len < 1)
+        return -1;
+    if (cmd[0] == '0')
+        mpu_cache_enable(0);
+    else if (cmd[0] == '1')
+        mpu_cache_enable(1);
+    else if ((len >= 5) && (strncmp(cmd, "reset", 5) == 0))
+        mpu_cache_reset_stats();
+    else
+        return -1;
+    return len;
+}
+#endif
+
+#if CONFIG_ETH
+/* Ethernet driver counters. Writing "zerocopy 0|1", "loopback 0|1" or
+ * "csum 0|1" switches the RX path, the MAC loopback or the checksum
+ * offload, "reset" clears the traffic counters.
+ */
+static int sysfs_eth_read(struct sysfs_fnode *sfs, void *buf, int len)
+{
+    char *res = (char *)buf;
+    struct fnode *fno = sfs->fnode;
+    static char *eth_txt;
+    static int off;
+    uint32_t cur_off = task_fd_get_off(fno);
+
+    if (cur_off == 0) {
+        struct eth_stats st;
+        const struct {
+            const char *label;
+            const uint32_t *value;
+        } lines[] = {
+            { "zerocopy  ", &st.zerocopy },
+            { "loopback  ", &st.loopback },
+            { "csum_ofld ", &st.csum_offload },
+            { "link      ", &st.link },
+            { "link_chk  ", &st.link_checks },
+            { "link_chg  ", &st.link_changes },
+            { "rx_frames ", &st.rx_frames },
+            { "rx_bytes  ", &st.rx_bytes },
+            { "rx_drop   ", &st.rx_dropped },
+            { "rx_zcopy  ", &st.rx_zerocopy },
+            { "rx_copy   ", &st.rx_copied },
+            { "rx_csumerr", &st.rx_csum_err },
+            { "tx_frames ", &st.tx_frames },
+            { "tx_bytes  ", &st.tx_bytes },
+            { "tx_busy   ", &st.tx_busy },
+            { "tx_kicks  ", &st.tx_kicks },
+            { "irqs      ", &st.irqs },
+        };
+        unsigned int i;
+        stm32_eth_get_stats(&st);
+        mutex_lock(sysfs_mutex);
+        eth_txt = kalloc(MAX_SYSFS_BUFFER);
+        if (!eth_txt) {
+            mutex_unlock(sysfs_mutex);
+            return -1;
+        }
+        off = 0;
+        for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+            off = sysfs_mem_append_line(eth_txt, MAX_SYSFS_BUFFER, off,
+                    lines[i].label, *lines[i].value);
+            if (off < 0)
+                goto eth_overflow;
+        }
+        eth_txt[off++] = '\0';
+    }
+
+    cur_off = task_fd_get_off(fno);
+    if (off == cur_off) {
+        kfree(eth_txt);
+        mutex_unlock(sysfs_mutex);
+        return -1;
+    }
+    if (len > (off - cur_off)) {
+        len = off - cur_off;
+    }
+    memcpy(res, eth_txt + cur_off, len);
+    cur_off += len;
+    task_fd_set_off(fno, cur_off);
+    return len;
+
+eth_overflow:
+    kfree(eth_txt);
+    mutex_unlock(sysfs_mutex);
+    return -1;
+}
+
+/* PHY registers, sampled over MDIO on every read of /sys/eth_phy. */
+static int sysfs_eth_phy_read(struct sysfs_fnode *sfs, void *buf, int len)
+{
+    char *res = (char *)buf;
+    struct fnode *fno = sfs->fnode;
+    static char *phy_txt;
+    static int off;
+    uint32_t cur_off = task_fd_get_off(fno);
+
+    if (cur_off == 0) {
+        static const char hex[] = "0123456789abcdef";
+        struct eth_phy_sample ps;
+        char label[] = "reg 0x00  ";
+        int i;
+        mutex_lock(sysfs_mutex);
+        phy_txt = kalloc(MAX_SYSFS_BUFFER);
+        if (!phy_txt) {
+            mutex_unlock(sysfs_mutex);
+            return -1;
+        }
+        stm32_eth_phy_sample(&ps);
+        off = 0;
+        off = sysfs_mem_append_line(phy_txt, MAX_SYSFS_BUFFER, off,
+                "phy_addr  ", ps.addr);
+        if (off < 0)
+            goto phy_overflow;
+        for (i = 0; i < ETH_PHY_SAMPLE_REGS; i++) {
+            label[6] = hex[ps.reg[i] >> 4];
+            label[7] = hex[ps.reg[i] & 0x0F];
+            off = sysfs_mem_append_line(phy_txt, MAX_SYSFS_BUFFER, off,
+                    label, ps.val[i]);
+            if (off < 0)
+                goto phy_overflow;
+        }
+        phy_txt[off++] = '\0';
+    }
+
+    cur_off = task_fd_get_off(fno);
+    if (off == cur_off) {
+        kfree(phy_txt);
+        mutex_unlock(sysfs_mutex);
+        return -1;
+    }
+    if (len > (off - cur_off)) {
+        len = off - cur_off;
+    }
+    memcpy(res, phy_txt + cur_off, len);
+    cur_off += len;
+    task_fd_set_off(fno, cur_off);
+    return len;
+
+phy_overflow:
+    kfree(phy_txt);
+    mutex_unlock(sysfs_mutex);
+    return -1;
+}
+
+static int sysfs_eth_write(struct sysfs_fnode *sfs, const void *buf, int len)
+{
+    const char *cmd = (const char *)buf;
+
+    if ((len >= 10) && (strncmp(cmd, "zerocopy ", 9) == 0))
+        stm32_eth_set_zerocopy(cmd[9] == '1');
+    else if ((len >= 10) && (strncmp(cmd, "loopback ", 9) == 0))
+        stm32_eth_enable_loopback(cmd[9] == '1');
+    else if ((len >= 6) && (strncmp(cmd, "csum ", 5) == 0))
+        stm32_eth_set_csum_offload(cmd[5] == '1');
+    else if ((len >= 5) && (strncmp(cmd, "reset", 5) == 0))
+        stm32_eth_reset_stats();
+    else
+        return -1;
+    return len;
+}
+#endif
+
+#if CONFIG_SPI3
+/* SPI bus counters: bytes moved (dmab: by DMA), transfers done by DMA
+ * or polled, failed transfers */
+static int sysfs_spi_read(struct sysfs_fnode *sfs, void *buf, int len)
+{
+    char *res = (char *)buf;
+    struct fnode *fno = sfs->fnode;
+    static char *spi_txt;
+    static int off;
+    uint32_t cur_off = task_fd_get_off(fno);
+
+    if (cur_off == 0) {
+        struct spi_stats st;
+        char label[] = "spi0_bytes";
+        int bus;
+        mutex_lock(sysfs_mutex);
+        spi_txt = kalloc(MAX_SYSFS_BUFFER);
+        if (!spi_txt) {
+            mutex_unlock(sysfs_mutex);
+            return -1;
+        }
+        off = 0;
+#if CONFIG_SPI_DMA
+        off = sysfs_mem_append_line(spi_txt, MAX_SYSFS_BUFFER, off,
+                "dma_min   ", CONFIG_SPI_DMA_MIN);
+        if (off < 0)
+            goto spi_overflow;
+#endif
+        for (bus = 0; bus < MAX_SPIS; bus++) {
+            const struct {
+                const char *label;
+                const uint32_t *value;
+            } lines[] = {
+                { "_bytes", &st.bytes },
+                { "_dmab ", &st.dma_bytes },
+                { "_dma  ", &st.dma_xfers },
+                { "_poll ", &st.poll_xfers },
+                { "_err  ", &st.errors },
+            };
+            unsigned int i;
+            if (devspi_get_stats(bus, &st) < 0)
+                continue;
+            label[3] = (char)('1' + bus);
+            for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+                memcpy(label + 4, lines[i].label, 6);
+                off = sysfs_mem_append_line(spi_txt, MAX_SYSFS_BUFFER, off,
+                        label, *lines[i].value);
+                if (off < 0)
+                    goto spi_overflow;
+            }
+        }
+        spi_txt[off++] = '\0';
+    }
+
+    cur_off = task_fd_get_off(fno);
+    if (off == cur_off) {
+        kfree(spi_txt);
+        mutex_unlock(sysfs_mutex);
+        return -1;
+    }
+    if (len > (off - cur_off)) {
+        len = off - cur_off;
+    }
+    memcpy(res, spi_txt + cur_off, len);
+    cur_off += len;
+    task_fd_set_off(fno, cur_off);
+    return len;
+
+spi_overflow:
+    kfree(spi_txt);
+    mutex_unlock(sysfs_mutex);
+    return -1;
+}
+#endif
+
+#if CONFIG_BLKCACHE
+/* Flash page cache: occupancy, hit rate, read-ahead and write-back */
+static int sysfs_blkcache_read(struct sysfs_fnode *sfs, void *buf, int len)
+{
+    char *res = (char *)buf;
+    struct fnode *fno = sfs->fnode;
+    static char *bc_txt;
+    static int off;
+    uint32_t cur_off = task_fd_get_off(fno);
+
+    if (cur_off == 0) {
+        struct blkcache_stats st;
+        unsigned int i;
+        blkcache_get_stats(&st);
+        {
+            const struct {
+                const char *label;
+                uint32_t value;
+            } lines[] = {
+                { "pages     ", st.pages },
+                { "dirty     ", st.dirty },
+                { "hits      ", st.hits },
+                { "misses    ", st.misses },
+                { "readahead ", st.readahead },
+                { "ra_hits   ", st.ra_hits },
+                { "writes    ", st.writes },
+                { "flushes   ", st.flushes },
+                { "flushed   ", st.flushed },
+                { "evictions ", st.evictions },
+                { "errors    ", st.errors },
+            };
+            mutex_lock(sysfs_mutex);
+            bc_txt = kalloc(MAX_SYSFS_BUFFER);
+            if (!bc_txt) {
+                mutex_unlock(sysfs_mutex);
+                return -1;
+            }
+            off = 0;
+            for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+                off = sysfs_mem_append_line(bc_txt, MAX_SYSFS_BUFFER, off,
+                        lines[i].label, lines[i].value);
+                if (off < 0)
+                    goto bc_overflow;
+            }
+        }
+        bc_txt[off++] = '\0';
+    }
+
+    cur_off = task_fd_get_off(fno);
+    if (off == cur_off) {
+        kfree(bc_txt);
+        mutex_unlock(sysfs_mutex);
+        return -1;
+    }
+    if (len > (off - cur_off)) {
+        len = off - cur_off;
+    }
+    memcpy(res, bc_txt + cur_off, len);
+    cur_off += len;
+    task_fd_set_off(fno, cur_off);
+    return len;
+
+bc_overflow:
+    kfree(bc_txt);
+    mutex_unlock(sysfs_mutex);
+    return -1;
+}
+#endif
+
+/* Path lookup cache. Writing "0"/"1" disables/enables it, "flush" drops
+ * every entry, "reset" clears the counters.
+ */
+static int sysfs_dcache_read(struct sysfs_fnode *sfs, void *buf, int len)
+{
+    char *res = (char *)buf;
+    struct fnode *fno = sfs->fnode;
+    static char *dc_txt;
+    static int off;
+    uint32_t cur_off = task_fd_get_off(fno);
+
+    if (cur_off == 0) {
+        struct dcache_stats st;
+        unsigned int i;
+        dcache_get_stats(&st);
+        {
+            const struct {
+                const char *label;
+                uint32_t value;
+            } lines[] = {
+                { "cache     ", st.enabled },
+                { "entries   ", st.entries },
+                { "negative  ", st.negative },
+                { "hits      ", st.hits },
+                { "neg_hits  ", st.neg_hits },
+                { "misses    ", st.misses },
+                { "evictions ", st.evictions },
+                { "invalid   ", st.invalidated },
+                { "flushes   ", st.flushes },
+            };
+            mutex_lock(sysfs_mutex);
+            dc_txt = kalloc(MAX_SYSFS_BUFFER);
+            if (!dc_txt) {
+                mutex_unlock(sysfs_mutex);
+                return -1;
+            }
+            off = 0;
+            for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+                off = sysfs_mem_append_line(dc_txt, MAX_SYSFS_BUFFER, off,
+                        lines[i].label, lines[i].value);
+                if (off < 0)
+                    goto dc_overflow;
+            }
+        }
+        dc_txt[off++] = '\0';
+    }
+
+    cur_off = task_fd_get_off(fno);
+    if (off == cur_off) {
+        kfree(dc_txt);
+        mutex_unlock(sysfs_mutex);
+        return -1;
+    }
+    if (len > (off - cur_off)) {
+        len = off - cur_off;
+    }
+    memcpy(res, dc_txt + cur_off, len);
+    cur_off += len;
+    task_fd_set_off(fno, cur_off);
+    return len;
+
+dc_overflow:
+    kfree(dc_txt);
+    mutex_unlock(sysfs_mutex);
+    return -1;
+}
+
+static int sysfs_dcache_write(struct sysfs_fnode *sfs, const void *buf, int len)
+{
+    const char *cmd = (const char *)buf;
+
+    if (len < 1)
+        return -1;
+    if (cmd[0] == '0')
+        dcache_enable(0);
+    else if (cmd[0] == '1')
+        dcache_enable(1);
+    else if ((len >= 5) && (strncmp(cmd, "flush", 5) == 0))
+        dcache_flush();
+    else if ((len >= 5) && (strncmp(cmd, "reset", 5) == 0))
+        dcache_reset_stats();
+    else
+        return -1;
+    return len;
+}
+
+#ifdef CONFIG_KLOG
+/* Kernel log ring: level, rate limit, records stored and dropped, ring
+ * use. Writing "level N" (0-7), "rate N" (messages per second, 0: no
+ * limit) or "reset" changes them.
+ */
+static int sysfs_klog_read(struct sysfs_fnode *sfs, void *buf, int len)
+{
+    char *res = (char *)buf;
+    struct fnode *fno = sfs->fnode;
+    static char *klog_txt;
+    static int off;
+    uint32_t cur_off = task_fd_get_off(fno);
+
+    if (cur_off == 0) {
+        struct klog_stats st;
+        unsigned int i;
+        klog_get_stats(&st);
+        {
+            const struct {
+                const char *label;
+                uint32_t value;
+            } lines[] = {
+                { "level     ", st.level },
+                { "rate      ", st.rate },
+                { "records   ", st.records },
+                { "overruns  ", st.overruns },
+                { "ratelimit ", st.ratelimited },
+                { "used      ", st.used },
+                { "hwm       ", st.hwm },
+                { "size      ", st.size },
+            };
+            mutex_lock(sysfs_mutex);
+            klog_txt = kalloc(MAX_SYSFS_BUFFER);
+            if (!klog_txt) {
+                mutex_unlock(sysfs_mutex);
+                return -1;
+            }
+            off = 0;
+            for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+                off = sysfs_mem_append_line(klog_txt, MAX_SYSFS_BUFFER, off,
+                        lines[i].label, lines[i].value);
+                if (off < 0)
+                    goto klog_overflow;
+            }
+        }
+        klog_txt[off++] = '\0';
+    }
+
+    cur_off = task_fd_get_off(fno);
+    if (off == cur_off) {
+        kfree(klog_txt);
+        mutex_unlock(sysfs_mutex);
+        return -1;
+    }
+    if (len > (off - cur_off)) {
+        len = off - cur_off;
+    }
+    memcpy(res, klog_txt + cur_off, len);
+    cur_off += len;
+    task_fd_set_off(fno, cur_off);
+    return len;
+
+klog_overflow:
+    kfree(klog_txt);
+    mutex_unlock(sysfs_mutex);
+    return -1;
+}
+
+/* Decimal value after a "name " prefix; -1 if there is none */
+static int sysfs_klog_arg(const char *cmd, int len, int start, uint32_t *val)
+{
+    int i = start;
+
+    *val = 0;
+    if (i >= len || cmd[i] < '0' || cmd[i] > '9')
+        return -1;
+    for (; i < len && cmd[i] >= '0' && cmd[i] <= '9'; i++)
+        *val = *val * 10 + (uint32_t)(cmd[i] - '0');
+    return 0;
+}
+
+static int sysfs_klog_write(struct sysfs_fnode *sfs, const void *buf, int len)
+{
+    const char *cmd = (const char *)buf;
+    uint32_t val;
+
+    if ((len >= 7) && (strncmp(cmd, "level ", 6) == 0)) {
+        if (sysfs_klog_arg(cmd, len, 6, &val) < 0 || klog_set_level(val) < 0)
+            return -1;
+    } else if ((len >= 6) && (strncmp(cmd, "rate ", 5) == 0)) {
+        if (sysfs_klog_arg(cmd, len, 5, &val) < 0)
+            return -1;
+        klog_set_rate(val);
+    } else if ((len >= 5) && (strncmp(cmd, "reset", 5) == 0)) {
+        klog_reset_stats();
+    } else {
+        return -1;
+    }
+    return len;
+}
+#endif
+
 int sysfs_modules_read(struct sysfs_fnode *sfs, void *buf, int len)
 {
     char *res = (char *)buf;
@@ -962,7 +1717,7 @@ int sysfs_register(char *name, char *dir,
     return -1;
 }
 
-/* ---- /sys/proc/<pid>/mem (CONFIG_PROCFS) ---- */
+/* ---- /sys/proc/<pid>/{mem,stat} (CONFIG_PROCFS) ---- */
 #if CONFIG_PROCFS
 
 static struct fnode *procfs_dir;
@@ -1058,22 +1813,74 @@ proc_mem_overflow:
     return -1;
 }
 
-/* Called from scheduler when a new task is created. */
-void procfs_pid_create(uint16_t pid)
+/* /sys/proc/<pid>/stat: CPU time (seconds) and context switches */
+static int procfs_stat_read(struct sysfs_fnode *sfs, void *buf, int len)
 {
-    char name[8];
-    struct fnode *pid_dir, *fno;
-    struct sysfs_fnode *mfs;
+    struct fnode *fno = sfs->fnode;
+    static char *stat_txt;
+    static int off;
+    uint32_t cur_off = task_fd_get_off(fno);
 
-    if (!procfs_dir)
-        return;
+    if (cur_off == 0) {
+        uint16_t pid = (uint16_t)(uintptr_t)fno->dir_ptr; /* stashed PID */
+        struct task_cputime ct;
+        const char *labels[3] = { "nvcsw", "nivcsw", "syscalls" };
+        uint32_t values[3];
+        char cpu_buf[16];
+        int i;
 
-    ul_to_str(pid, name);
-    pid_dir = fno_mkdir(&mod_sysfs, name, procfs_dir);
-    if (!pid_dir)
-        return;
+        mutex_lock(sysfs_mutex);
+        stat_txt = kalloc(MAX_SYSFS_BUFFER);
+        if (!stat_txt) {
+            mutex_unlock(sysfs_mutex);
+            return -1;
+        }
+        off = 0;
+
+        if (scheduler_task_cputime(pid, &ct) != 0) {
+            strcpy(stat_txt, "no info\r\n");
+            off = 9;
+        } else {
+            off = sysfs_append_field(stat_txt, MAX_SYSFS_BUFFER, off, "utime",
+                    cpu_buf, cputime_to_str(ct.utime_sec, ct.utime_usec, cpu_buf));
+            off = sysfs_append_field(stat_txt, MAX_SYSFS_BUFFER, off, "stime",
+                    cpu_buf, cputime_to_str(ct.stime_sec, ct.stime_usec, cpu_buf));
+            values[0] = ct.nvcsw;
+            values[1] = ct.nivcsw;
+            values[2] = ct.nsyscalls;
+            for (i = 0; (i < 3) && (off >= 0); i++)
+                off = sysfs_mem_append_line(stat_txt, MAX_SYSFS_BUFFER, off,
+                        labels[i], values[i]);
+            if (off < 0) {
+                kfree(stat_txt);
+                mutex_unlock(sysfs_mutex);
+                return -1;
+            }
+        }
+        stat_txt[off++] = '\0';
+    }
+
+    cur_off = task_fd_get_off(fno);
+    if (off == cur_off) {
+        kfree(stat_txt);
+        mutex_unlock(sysfs_mutex);
+        return -1;
+    }
+    if (len > (off - cur_off))
+        len = off - cur_off;
+    memcpy(buf, stat_txt + cur_off, len);
+    cur_off += len;
+    task_fd_set_off(fno, cur_off);
+    return len;
+}
 
-    fno = fno_create(&mod_sysfs, "mem", pid_dir);
+static void procfs_pid_file(struct fnode *pid_dir, const char *name,
+        uint16_t pid, int (*do_read)(struct sysfs_fnode *, void *, int))
+{
+    struct fnode *fno;
+    struct sysfs_fnode *mfs;
+
+    fno = fno_create(&mod_sysfs, name, pid_dir);
     if (!fno)
         return;
     fno->dir_ptr = (uint32_t)pid;
@@ -1085,10 +1892,28 @@ void procfs_pid_create(uint16_t pid)
     }
     mfs->fnode = fno;
     fno->priv = mfs;
-    mfs->do_read = procfs_mem_read;
+    mfs->do_read = do_read;
     mfs->do_write = NULL;
 }
 
+/* Called from scheduler when a new task is created. */
+void procfs_pid_create(uint16_t pid)
+{
+    char name[8];
+    struct fnode *pid_dir;
+
+    if (!procfs_dir)
+        return;
+
+    ul_to_str(pid, name);
+    pid_dir = fno_mkdir(&mod_sysfs, name, procfs_dir);
+    if (!pid_dir)
+        return;
+
+    procfs_pid_file(pid_dir, "mem", pid, procfs_mem_read);
+    procfs_pid_file(pid_dir, "stat", pid, procfs_stat_read);
+}
+
 /* Called from scheduler when a task is destroyed. */
 void procfs_pid_destroy(uint16_t pid)
 {
@@ -1108,7 +1933,7 @@ void procfs_pid_destroy(uint16_t pid)
     if (!pid_dir)
         return;
 
-    /* Remove children (the "mem" file) */
+    /* Remove children (the "mem" and "stat" files) */
     while ((child = pid_dir->children) != NULL) {
         if (child->priv)
             pool_free(&sysfs_fnode_pool, child->priv);
@@ -1149,6 +1974,24 @@ static int sysfs_mount(char *source, char *tgt, uint32_t flags, void *args)
     sysfs_register("modules", "/sys", sysfs_modules_read, sysfs_no_write);
     sysfs_register("mtab", "/sys", sysfs_mtab_read, sysfs_no_write);
     sysfs_register("df", "/sys", sysfs_df_read, sysfs_no_write);
+    sysfs_register("idle", "/sys", sysfs_idle_read, sysfs_no_write);
+    sysfs_register("dcache", "/sys", sysfs_dcache_read, sysfs_dcache_write);
+#if CONFIG_MPU
+    sysfs_register("mpu", "/sys", sysfs_mpu_read, sysfs_mpu_write);
+#endif
+#if CONFIG_ETH
+    sysfs_register("eth", "/sys", sysfs_eth_read, sysfs_eth_write);
+    sysfs_register("eth_phy", "/sys", sysfs_eth_phy_read, sysfs_no_write);
+#endif
+#if CONFIG_SPI3
+    sysfs_register("spi", "/sys", sysfs_spi_read, sysfs_no_write);
+#endif
+#if CONFIG_BLKCACHE
+    sysfs_register("blkcache", "/sys", sysfs_blkcache_read, sysfs_no_write);
+#endif
+#ifdef CONFIG_KLOG
+    sysfs_register("klog", "/sys", sysfs_klog_read, sysfs_klog_write);
+#endif
 #if defined(STM32F4) || defined(STM32F7)
     sysfs_register("pins", "/sys", sysfs_pins_read, sysfs_no_write);
 #endif
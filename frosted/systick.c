@@ -23,6 +23,7 @@
 #include "nvic.h"
 #include "systick.h"
 #include "kprintf.h"
+#include "dwt.h"
 #include "errno.h"
 #include <stdbool.h>
 
@@ -33,12 +34,31 @@ volatile int ktimer_check_pending = 0;
 volatile int sleep_mode = 0;
 static int _sched_active = 0;
 
+#ifndef CONFIG_TICKLESS
+#define CONFIG_TICKLESS 0
+#endif
+
+/* SysTick counts per jiffy, sampled from the reload value programmed
+ * by the boot code. */
+static uint32_t tick_period = 0;
+
+/* Jiffies accounted by the next SysTick interrupt. Greater than one
+ * while a tickless one-shot period is armed. */
+static volatile uint32_t tick_credit = 1;
+
+/* Set when SYST_RVR holds anything other than the periodic value. */
+static volatile int tick_reload_dirty = 0;
+
+static struct systick_idle_stats idle_stats;
+
 void frosted_scheduler_on(void)
 {
     nvic_set_priority(NVIC_PENDSV_IRQ, 4 << 5);
     nvic_set_priority(NVIC_SV_CALL_IRQ, 3 << 5);
     nvic_set_priority(NVIC_SYSTICK_IRQ, 2 << 5);
     nvic_enable_irq(NVIC_SYSTICK_IRQ);
+    tick_period = systick_get_reload() + 1;
+    idle_stats.tickless = CONFIG_TICKLESS;
     systick_counter_enable();
     systick_interrupt_enable();
     _sched_active = 1;
@@ -193,27 +213,164 @@ static void ktimers_check_tasklet(void *arg)
     ktimer_check_pending = 0;
 }
 
+/* Number of jiffies the CPU may sleep before the first ktimer is due,
+ * bounded by the 24-bit SysTick reload register. Interrupts off.
+ */
+static uint32_t ktimer_idle_ticks(void)
+{
+    struct ktimer *t;
+    uint32_t max_ticks;
+
+    if (tick_period == 0)
+        return 1;
+    max_ticks = SYST_RVR_MAX / tick_period;
+    if (ktimer_list && (ktimer_list->n > 0)) {
+        t = heap_first(ktimer_list);
+        if (jiffies_reached(t->expire_time))
+            return 0;
+        if ((t->expire_time - jiffies) < max_ticks)
+            max_ticks = t->expire_time - jiffies;
+    }
+    return max_ticks;
+}
+
+static void systick_reload_restore(void)
+{
+    SYST_RVR = tick_period - 1;
+    SYST_CVR = 0;
+    tick_credit = 1;
+    tick_reload_dirty = 0;
+}
+
+#if CONFIG_TICKLESS
+/* Stretch the current tick until 'ticks' jiffy boundaries from now
+ * have passed, sleep, then account for the time actually spent.
+ * Interrupts off.
+ */
+static void systick_idle_tickless(uint32_t ticks)
+{
+    uint32_t cvr0 = SYST_CVR;
+    uint32_t reload, cvr, elapsed, passed, rem;
+    uint32_t cyc0;
+
+    if ((cvr0 == 0) || (cvr0 > tick_period))
+        cvr0 = tick_period;
+    reload = cvr0 + (ticks - 1) * tick_period;
+    SYST_RVR = reload - 1;
+    SYST_CVR = 0;
+    tick_credit = ticks;
+    tick_reload_dirty = 1;
+
+    cyc0 = dwt_cyccnt();
+    lowpower_idle(ticks);
+
+    /* CVR first: if the counter wraps in between, COUNTFLAG catches it. */
+    cvr = SYST_CVR;
+    if (SYST_CSR & SYST_CSR_COUNTFLAG) {
+        /* Full period elapsed, SysTick is pending and will credit
+         * 'ticks' jiffies and restore the periodic reload. */
+        scheduler_acct_idle(reload + (reload - 1 - cvr), dwt_cyccnt() - cyc0);
+        idle_stats.wakeups_timer++;
+        idle_stats.idle_jiffies += ticks;
+        return;
+    }
+
+    /* Woken early by another interrupt: credit the jiffy boundaries
+     * already crossed, and let the next SysTick fire on the following
+     * one so the tick phase is preserved. */
+    elapsed = reload - cvr;
+    scheduler_acct_idle(elapsed, dwt_cyccnt() - cyc0);
+    if (elapsed < cvr0) {
+        passed = 0;
+    } else {
+        passed = 1 + (elapsed - cvr0) / tick_period;
+    }
+    rem = cvr % tick_period;
+    if (rem == 0)
+        rem = tick_period;
+    jiffies += passed;
+    /* A reload of 0 stops the counter: a boundary one cycle away is
+     * credited with the following one instead. */
+    if (rem < 2) {
+        rem += tick_period;
+        tick_credit = 2;
+    } else {
+        tick_credit = 1;
+    }
+    SYST_RVR = rem - 1;
+    SYST_CVR = 0;
+    idle_stats.wakeups_irq++;
+    idle_stats.idle_jiffies += passed;
+}
+#endif
+
+void systick_idle(void)
+{
+    uint32_t ticks;
+    uint32_t start;
+    uint32_t cvr0, cvr, cyc0;
+
+    irq_off();
+    if (tasklets_pending() || scheduler_runnable()) {
+        irq_on();
+        return;
+    }
+    idle_stats.sleeps++;
+    ticks = ktimer_idle_ticks();
+    if (ticks > idle_stats.max_sleep)
+        idle_stats.max_sleep = ticks;
+#if CONFIG_TICKLESS
+    /* Reading CSR clears COUNTFLAG: if it was set, a SysTick is already
+     * pending for the current period and must not be stretched. */
+    if (_sched_active && (ticks > 1) && !(SYST_CSR & SYST_CSR_COUNTFLAG)) {
+        systick_idle_tickless(ticks);
+        irq_on();
+        return;
+    }
+#endif
+    start = jiffies;
+    cvr0 = SYST_CVR;
+    cyc0 = dwt_cyccnt();
+    lowpower_idle(1);
+    /* SysTick counts core clock cycles, and keeps counting in WFI.
+     * Woken by it, the counter has wrapped once. */
+    cvr = SYST_CVR;
+    if (SYST_CSR & SYST_CSR_COUNTFLAG)
+        scheduler_acct_idle(cvr0 + (tick_period - cvr), dwt_cyccnt() - cyc0);
+    else
+        scheduler_acct_idle(cvr0 - cvr, dwt_cyccnt() - cyc0);
+    irq_on();
+    /* Periodic mode: the pending SysTick (if any) has run by now */
+    if (jiffies != start) {
+        idle_stats.wakeups_timer++;
+        idle_stats.idle_jiffies += jiffies - start;
+    } else {
+        idle_stats.wakeups_irq++;
+    }
+}
+
+void systick_idle_get_stats(struct systick_idle_stats *st)
+{
+    memcpy(st, &idle_stats, sizeof(idle_stats));
+}
+
 void sys_tick_handler(void)
 {
-    uint32_t next_timer = 0;
-    volatile uint32_t reload = systick_get_reload();
-    uint32_t this_timeslice;
     SysTick_Hook();
-    jiffies ++;
+    jiffies += tick_credit;
     _n_int++;
+    if (tick_reload_dirty)
+        systick_reload_restore();
 
     if (ktimer_expired()) {
+        if (!ktimer_check_pending) {
+            ktimer_check_pending++;
+            tasklet_add(ktimers_check_tasklet, NULL);
+        }
         task_preempt_all();
-        goto end;
+        return;
     }
 
-    if (_sched_active && ((task_timeslice() == 0) || (!task_running()))) {
+    if (_sched_active && ((task_timeslice() == 0) || (!task_running())))
         schedule();
-        (void)next_timer;
-    }
-end:
-    if (!ktimer_check_pending) {
-        ktimer_check_pending++;
-        tasklet_add(ktimers_check_tasklet, NULL);
-    }
 }
@@ -97,6 +97,11 @@ int tasklet_add(void (*exe)(void*), void *arg)
     return -EAGAIN;
 }
 
+int tasklets_pending(void)
+{
+    return (n_tasklets > 0);
+}
+
 void check_tasklets(void)
 {
     int i;
@@ -0,0 +1,37 @@
+/*
+ * Helpers shared by the host benchmarks: a monotonic clock and a
+ * reproducible pseudo-random sequence.
+ *
+ * Define BENCH_RND_SEED before including this to start rnd() from a
+ * different state.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+#ifndef BENCH_RND_SEED
+#define BENCH_RND_SEED 0x2545F491
+#endif
+
+static uint32_t rnd_state = BENCH_RND_SEED;
+
+/* xorshift32: the same sequence on every run */
+static inline uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,414 @@
+/*
+ * Host simulation of the SPI flash block cache (blkcache.c).
+ *
+ * A RAM NOR model (4 KB sector erase, program only clears bits) counts
+ * what crosses the SPI bus. The backend behaves like the JEDEC driver:
+ * reads are one command each, a write-back reads its sector, erases it
+ * only when some bit has to go from 0 to 1, and programs the pages that
+ * changed. "direct" is /dev/spiflash0 without the cache: every read and
+ * write goes to the device as issued.
+ *
+ * Workloads:
+ *   seq      64 KB file read with 128-byte read() calls (script, audio)
+ *   random   128-byte reads at random offsets over 1 MB
+ *   hot      as random, but 90% of them on 8 pages (directory, bitmap)
+ *   append   48-byte records appended to a log, fsync every 32
+ *   rewrite  256-byte pages rewritten at random in a 32 KB database,
+ *            fsync every 16
+ *
+ * Checks: every read returns the shadow copy, and after the final
+ * flush the device matches it. The flush timer is fired by hand once, and
+ * the flush thread's work done, to check that it writes back what fsync
+ * did not.
+ *
+ * Time estimates: read command 10 us + 0.17 us per byte (48 MHz bus),
+ * page program 30 us + 1.5 us per byte, sector erase 45 ms.
+ *
+ * Usage: blkcache_bench [ops]
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+typedef struct { int locked; } mutex_t;
+
+static mutex_t bench_lock;
+static void (*bench_timer)(uint32_t, void *);
+
+static inline mutex_t *mutex_init(void)
+{
+    return &bench_lock;
+}
+
+static inline int mutex_lock(mutex_t *m)
+{
+    m->locked = 1;
+    return 0;
+}
+
+static inline int mutex_trylock(mutex_t *m)
+{
+    if (m->locked)
+        return -EAGAIN;
+    m->locked = 1;
+    return 0;
+}
+
+static inline int mutex_unlock(mutex_t *m)
+{
+    m->locked = 0;
+    return 0;
+}
+
+static inline int mutex_owned(mutex_t *m)
+{
+    (void)m;
+    return 0;
+}
+
+static inline int ktimer_add(uint32_t ms, void (*cb)(uint32_t, void *), void *arg)
+{
+    (void)ms;
+    (void)arg;
+    bench_timer = cb;
+    return 0;
+}
+
+/* No flush thread: check_timer() does its work by hand */
+struct task;
+
+static inline struct task *kthread_create(void (*routine)(void *), void *arg)
+{
+    (void)routine;
+    (void)arg;
+    return NULL;
+}
+
+static inline void task_resume(struct task *t)
+{
+    (void)t;
+}
+
+static inline void task_suspend(void)
+{
+}
+
+static inline void irq_off(void)
+{
+}
+
+static inline void irq_on(void)
+{
+}
+
+#include "../blkcache.c"
+
+#define PAGE BLKCACHE_BLOCK_SIZE
+#define SECTOR_SIZE 4096u
+#define SECTORS 256u
+#define DEV_SIZE (SECTOR_SIZE * SECTORS)
+#define PAGES_PER_SECTOR (SECTOR_SIZE / PAGE)
+
+#define T_CMD_US 10.0
+#define T_RD_BYTE_US 0.17
+#define T_PP_US 30.0
+#define T_PP_BYTE_US 1.5
+#define T_SE_US 45000.0
+
+#define FILE_SIZE (64u * 1024u)
+#define LOG_BASE (512u * 1024u)
+#define DB_BASE (768u * 1024u)
+#define DB_SIZE (32u * 1024u)
+
+struct nor {
+    uint8_t mem[DEV_SIZE];
+    uint32_t cmds, pp, erases;
+    uint64_t bus_bytes;
+    double busy_us;
+};
+
+enum { DIRECT, CACHE, CACHE_RA, MODES };
+static const char *mode_names[MODES] = { "direct", "cache", "cache+ra" };
+
+static struct nor nor;
+static uint8_t shadow[DEV_SIZE];
+static struct blkcache_dev dev;
+static uint8_t sect_buf[SECTOR_SIZE];
+
+static void nor_read(uint32_t addr, void *buf, uint32_t len)
+{
+    memcpy(buf, nor.mem + addr, len);
+    nor.cmds++;
+    nor.bus_bytes += len;
+    nor.busy_us += T_CMD_US + len * T_RD_BYTE_US;
+}
+
+static void nor_program(uint32_t addr, const uint8_t *src, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+        nor.mem[addr + i] &= src[i];
+    nor.cmds++;
+    nor.pp++;
+    nor.bus_bytes += len;
+    nor.busy_us += T_PP_US + len * T_PP_BYTE_US;
+}
+
+/* jedec_spi_flash_write_pages(): 'img' is the new content of the sector */
+static void nor_update(uint32_t base, const uint8_t *img)
+{
+    uint8_t old[SECTOR_SIZE];
+    uint32_t i, p;
+    int erase = 0;
+
+    nor_read(base, old, SECTOR_SIZE);
+    for (i = 0; i < SECTOR_SIZE && !erase; i++) {
+        if (img[i] & ~old[i])
+            erase = 1;
+    }
+    if (erase) {
+        memset(nor.mem + base, 0xFF, SECTOR_SIZE);
+        memset(old, 0xFF, SECTOR_SIZE);
+        nor.cmds++;
+        nor.erases++;
+        nor.busy_us += T_SE_US;
+    }
+    for (p = 0; p < PAGES_PER_SECTOR; p++) {
+        if (memcmp(old + p * PAGE, img + p * PAGE, PAGE) != 0)
+            nor_program(base + p * PAGE, img + p * PAGE, PAGE);
+    }
+}
+
+static int cache_read(void *priv, uint32_t blk, uint8_t *const *bufs, uint32_t count)
+{
+    uint8_t tmp[BLKCACHE_RA_MAX * PAGE];
+    uint32_t i;
+
+    (void)priv;
+    nor_read(blk * PAGE, tmp, count * PAGE);
+    for (i = 0; i < count; i++)
+        memcpy(bufs[i], tmp + i * PAGE, PAGE);
+    return 0;
+}
+
+static int cache_write(void *priv, uint32_t blk, const uint8_t *const *bufs, uint32_t count)
+{
+    uint32_t base = (blk * PAGE) & ~(SECTOR_SIZE - 1);
+    uint32_t off = blk * PAGE - base;
+    uint32_t i;
+
+    (void)priv;
+    memcpy(sect_buf, nor.mem + base, SECTOR_SIZE);
+    for (i = 0; i < count; i++) {
+        if (bufs[i])
+            memcpy(sect_buf + off + i * PAGE, bufs[i], PAGE);
+    }
+    nor_update(base, sect_buf);
+    return 0;
+}
+
+static const struct blkcache_ops bench_ops = {
+    .read = cache_read,
+    .write = cache_write,
+};
+
+static void reset(void)
+{
+    uint32_t i;
+
+    memset(&nor, 0, sizeof(nor));
+    memset(nor.mem, 0xFF, DEV_SIZE);
+    for (i = 0; i < FILE_SIZE; i++)
+        nor.mem[i] = (uint8_t)rnd();
+    for (i = 0; i < DB_SIZE; i++)
+        nor.mem[DB_BASE + i] = (uint8_t)rnd();
+    memcpy(shadow, nor.mem, DEV_SIZE);
+
+    memset(bc_entry, 0, sizeof(bc_entry));
+    memset(&bc_stats, 0, sizeof(bc_stats));
+    bc_clock = 0;
+    bc_dirty = 0;
+    bc_timer_pending = 0;
+    bench_timer = NULL;
+    blkcache_dev_init(&dev, &bench_ops, NULL, DEV_SIZE / PAGE, SECTOR_SIZE / PAGE);
+}
+
+static int do_read(int mode, uint32_t addr, uint32_t len)
+{
+    uint8_t buf[PAGE];
+
+    if (mode == DIRECT) {
+        nor_read(addr, buf, len);
+    } else {
+        if (blkcache_read(&dev, addr, buf, len) != 0)
+            return -1;
+        if (mode == CACHE)
+            dev.next_blk = 0xFFFFFFFFu;    /* no sequential detection */
+    }
+    if (memcmp(buf, shadow + addr, len) != 0) {
+        fprintf(stderr, "%s: bad read at 0x%x\n", mode_names[mode], addr);
+        return -1;
+    }
+    return 0;
+}
+
+/* What /dev/spiflash0 does without the cache: each sector touched is
+ * rewritten on the spot */
+static void direct_write(uint32_t addr, const uint8_t *src, uint32_t len)
+{
+    while (len > 0) {
+        uint32_t base = addr & ~(SECTOR_SIZE - 1);
+        uint32_t chunk = base + SECTOR_SIZE - addr;
+        if (chunk > len)
+            chunk = len;
+        memcpy(sect_buf, nor.mem + base, SECTOR_SIZE);
+        memcpy(sect_buf + (addr - base), src, chunk);
+        nor_update(base, sect_buf);
+        addr += chunk;
+        src += chunk;
+        len -= chunk;
+    }
+}
+
+static int do_write(int mode, uint32_t addr, const uint8_t *src, uint32_t len)
+{
+    memcpy(shadow + addr, src, len);
+    if (mode == DIRECT) {
+        direct_write(addr, src, len);
+        return 0;
+    }
+    return blkcache_write(&dev, addr, src, len);
+}
+
+static int do_sync(int mode)
+{
+    return mode == DIRECT ? 0 : blkcache_flush(&dev);
+}
+
+static int run(int mode, int load, int ops)
+{
+    uint8_t rec[PAGE];
+    uint32_t addr, i;
+    int n;
+
+    reset();
+    switch (load) {
+    case 0:     /* seq */
+        for (n = 0; n < ops; n++) {
+            addr = (uint32_t)n * 128u % FILE_SIZE;
+            if (do_read(mode, addr, 128) < 0)
+                return -1;
+        }
+        break;
+    case 1:     /* random */
+        for (n = 0; n < ops; n++) {
+            addr = rnd() % (DEV_SIZE / 128u) * 128u;
+            if (do_read(mode, addr, 128) < 0)
+                return -1;
+        }
+        break;
+    case 2:     /* hot */
+        for (n = 0; n < ops; n++) {
+            if (rnd() % 10 != 0)
+                addr = (rnd() % 8u) * PAGE * 7u + (rnd() % 2u) * 128u;
+            else
+                addr = rnd() % (DEV_SIZE / 128u) * 128u;
+            if (do_read(mode, addr, 128) < 0)
+                return -1;
+        }
+        break;
+    case 3:     /* append */
+        addr = LOG_BASE;
+        for (n = 0; n < ops; n++) {
+            for (i = 0; i < 48; i++)
+                rec[i] = (uint8_t)rnd();
+            if (addr + 48 > DB_BASE)
+                break;
+            if (do_write(mode, addr, rec, 48) < 0)
+                return -1;
+            addr += 48;
+            if ((n + 1) % 32 == 0 && do_sync(mode) < 0)
+                return -1;
+        }
+        break;
+    case 4:     /* rewrite */
+        for (n = 0; n < ops; n++) {
+            addr = DB_BASE + rnd() % (DB_SIZE / PAGE) * PAGE;
+            for (i = 0; i < PAGE; i++)
+                rec[i] = (uint8_t)rnd();
+            if (do_write(mode, addr, rec, PAGE) < 0)
+                return -1;
+            if ((n + 1) % 16 == 0 && do_sync(mode) < 0)
+                return -1;
+        }
+        break;
+    }
+    return do_sync(mode);
+}
+
+static int check_timer(void)
+{
+    uint8_t rec[48];
+
+    reset();
+    memset(rec, 0x5A, sizeof(rec));
+    if (do_write(CACHE, LOG_BASE, rec, sizeof(rec)) < 0 || !bench_timer || bc_dirty == 0)
+        return -1;
+    bench_timer(0, NULL);
+    if (!bc_flush_wake)
+        return -1;
+    bc_flush_wake = 0;
+    bc_flush_work();
+    if (bc_dirty != 0 || memcmp(nor.mem, shadow, DEV_SIZE) != 0)
+        return -1;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *names[] = { "seq", "random", "hot", "append", "rewrite" };
+    int ops = 4000;
+    int load, mode;
+
+    if (argc > 1)
+        ops = atoi(argv[1]);
+    if (ops < 100)
+        ops = 100;
+
+    printf("1 MB SPI NOR, 4 KB sectors, %d-page cache, %d ops per run:\n",
+           CONFIG_BLKCACHE_PAGES, ops);
+    printf("  %-8s %-9s %8s %9s %7s %7s %7s %9s\n", "load", "mode", "cmds",
+           "bus KB", "pp", "erases", "hit %", "ms total");
+    for (load = 0; load < 5; load++) {
+        for (mode = 0; mode < MODES; mode++) {
+            uint32_t lookups;
+            if (mode == CACHE_RA && load > 2)
+                continue;       /* read-ahead does not apply to writes */
+            if (run(mode, load, ops) != 0) {
+                fprintf(stderr, "%s: %s run failed\n", names[load], mode_names[mode]);
+                return 1;
+            }
+            if (memcmp(nor.mem, shadow, DEV_SIZE) != 0 || bc_dirty != 0) {
+                fprintf(stderr, "%s: %s device does not match\n", names[load],
+                        mode_names[mode]);
+                return 1;
+            }
+            lookups = bc_stats.hits + bc_stats.misses;
+            printf("  %-8s %-9s %8u %9.1f %7u %7u %7.1f %9.1f\n", names[load],
+                   mode_names[mode], nor.cmds, nor.bus_bytes / 1024.0, nor.pp,
+                   nor.erases, lookups ? 100.0 * bc_stats.hits / lookups : 0.0,
+                   nor.busy_us / 1000.0);
+        }
+    }
+    if (check_timer() != 0) {
+        fprintf(stderr, "flush timer did not write back\n");
+        return 1;
+    }
+    printf("flush timer: OK\n");
+    return 0;
+}
@@ -0,0 +1,453 @@
+/*
+ * Host simulation of the VFS path lookup cache (dcache.c).
+ *
+ * The tree is shaped like the target's: /bin belongs to a lazy module
+ * (xipfs: applets get an fnode when a lookup finds them in the image's
+ * file table), /var to another (flashfs: files and directories found by
+ * reading entries off the medium), /dev and /sys keep their nodes in RAM.
+ * Paths are resolved one component at a time through the same fno_child()
+ * as vfs.c: the cache, then the children list, then the module's lookup.
+ * "nocache" is the same walk with the cache disabled, as before.
+ *
+ * Counted per stat(): name comparisons against children, module lookups
+ * and the medium entries those read.
+ *
+ * Workloads:
+ *   boot   cold start: init runs 200 commands drawn from 30 applets, each
+ *          searched along PATH=/usr/bin:/sbin:/bin, and probes 100 config
+ *          files, half of which do not exist
+ *   stat   a loop over 16 paths, present and missing, shallow and deep
+ *
+ * Checks: both modes resolve every path alike; a name created after a
+ * failed lookup is found; an fnode unlinked and reused elsewhere is not
+ * returned under its old name, nor as the parent of its old children;
+ * after a mount the new module answers; more names than entries still
+ * resolve.
+ *
+ * Usage: dcache_bench [loops]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+#define CONFIG_MAX_FNAME 32
+#define MEDIUM_MAX 128
+#define POOL_SIZE 512
+
+struct medium;
+
+struct fnode {
+    char fname[CONFIG_MAX_FNAME];
+    struct fnode *parent;
+    struct fnode *children;
+    struct fnode *next;
+    struct medium *lazy;        /* owner has a lookup: NULL if RAM only */
+};
+
+#include "../dcache.c"
+
+/* One directory of a lazy module, as stored on its medium */
+struct medium {
+    int count;
+    char names[MEDIUM_MAX][CONFIG_MAX_FNAME];
+    struct medium *sub[MEDIUM_MAX];         /* directories */
+};
+
+static struct {
+    uint64_t stats;
+    uint64_t compares;
+    uint64_t lookups;
+    uint64_t reads;
+} cnt;
+
+static struct fnode pool[POOL_SIZE];
+static struct fnode *pool_free_list;
+static struct fnode root;
+static struct medium bin_m, var_m, etc_m, www_m, data_m, logs_m, mnt_m;
+
+/* _fno_create(): pushed at the head of the parent's children */
+static struct fnode *create(struct fnode *parent, const char *name, struct medium *lazy)
+{
+    struct fnode *fno = pool_free_list;
+
+    if (!fno)
+        abort();
+    pool_free_list = fno->next;
+    memset(fno, 0, sizeof(*fno));
+    strcpy(fno->fname, name);
+    fno->parent = parent;
+    fno->next = parent->children;
+    parent->children = fno;
+    fno->lazy = lazy;
+    dcache_forget(parent, name, strlen(name));
+    return fno;
+}
+
+/* fno_detach() */
+static void detach(struct fnode *fno)
+{
+    struct fnode **pp = &fno->parent->children;
+
+    while (*pp && *pp != fno)
+        pp = &(*pp)->next;
+    if (*pp)
+        *pp = fno->next;
+    dcache_forget_fnode(fno);
+    fno->next = pool_free_list;
+    pool_free_list = fno;
+}
+
+/* xipfs_lookup() / flashfs_lookup(): read the directory's entries */
+static struct fnode *lookup(struct fnode *dir, const char *name)
+{
+    struct medium *m = dir->lazy;
+    int i;
+
+    cnt.lookups++;
+    for (i = 0; i < m->count; i++) {
+        cnt.reads++;
+        if (strcmp(m->names[i], name) == 0)
+            return create(dir, name, m->sub[i]);
+    }
+    return NULL;
+}
+
+/* Same as fno_child() in vfs.c */
+static struct fnode *fno_child(struct fnode *dir, const char *name, int len)
+{
+    struct fnode *child;
+    char fname[CONFIG_MAX_FNAME];
+
+    if (dcache_lookup(dir, name, len, &child))
+        return child;
+    for (child = dir->children; child; child = child->next) {
+        cnt.compares++;
+        if ((strncmp(child->fname, name, len) == 0) && (child->fname[len] == '\0'))
+            break;
+    }
+    if (!child && dir->lazy) {
+        memcpy(fname, name, len);
+        fname[len] = '\0';
+        child = lookup(dir, fname);
+    }
+    dcache_insert(dir, name, len, child);
+    return child;
+}
+
+static struct fnode *walk(const char *path)
+{
+    struct fnode *dir = &root;
+    const char *p = path;
+
+    cnt.stats++;
+    while (*p == '/')
+        p++;
+    while (*p && dir) {
+        int len = 0;
+        while (p[len] && p[len] != '/')
+            len++;
+        if (len >= CONFIG_MAX_FNAME)
+            return NULL;
+        dir = fno_child(dir, p, len);
+        p += len;
+        while (*p == '/')
+            p++;
+    }
+    return dir;
+}
+
+static void medium_add(struct medium *m, const char *name, struct medium *sub)
+{
+    strcpy(m->names[m->count], name);
+    m->sub[m->count] = sub;
+    m->count++;
+}
+
+static void build_media(void)
+{
+    char name[CONFIG_MAX_FNAME];
+    int i;
+
+    for (i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "app%02d", i);
+        medium_add(&bin_m, name, NULL);
+    }
+    for (i = 0; i < 25; i++) {
+        snprintf(name, sizeof(name), "conf%02d", i);
+        medium_add(&etc_m, name, NULL);
+    }
+    for (i = 0; i < 40; i++) {
+        snprintf(name, sizeof(name), "page%02d.html", i);
+        medium_add(&www_m, name, NULL);
+    }
+    medium_add(&www_m, "index.html", NULL);
+    for (i = 0; i < 20; i++) {
+        snprintf(name, sizeof(name), "log%02d", i);
+        medium_add(&logs_m, name, NULL);
+    }
+    medium_add(&data_m, "logs", &logs_m);
+    for (i = 0; i < 10; i++) {
+        snprintf(name, sizeof(name), "file%d", i);
+        medium_add(&var_m, name, NULL);
+    }
+    medium_add(&var_m, "etc", &etc_m);
+    medium_add(&var_m, "www", &www_m);
+    medium_add(&var_m, "data", &data_m);
+    medium_add(&mnt_m, "a", NULL);
+}
+
+/* Boot state: module roots and the RAM nodes, nothing materialised */
+static void reset(int cached)
+{
+    struct fnode *dev, *sys, *proc, *pid;
+    char name[CONFIG_MAX_FNAME];
+    int i;
+
+    pool_free_list = NULL;
+    for (i = POOL_SIZE - 1; i >= 0; i--) {
+        pool[i].next = pool_free_list;
+        pool_free_list = &pool[i];
+    }
+    memset(&root, 0, sizeof(root));
+    dcache_enable(cached);
+    dcache_reset_stats();
+
+    create(&root, "mnt", NULL);
+    dev = create(&root, "dev", NULL);
+    for (i = 0; i < 24; i++) {
+        snprintf(name, sizeof(name), "tty%d", i);
+        create(dev, name, NULL);
+    }
+    create(dev, "null", NULL);
+    create(dev, "spiflash0", NULL);
+    sys = create(&root, "sys", NULL);
+    create(sys, "tasks", NULL);
+    create(sys, "mem", NULL);
+    create(sys, "mpu", NULL);
+    create(sys, "dcache", NULL);
+    proc = create(sys, "proc", NULL);
+    for (i = 1; i <= 12; i++) {
+        snprintf(name, sizeof(name), "%d", i);
+        pid = create(proc, name, NULL);
+        create(pid, "mem", NULL);
+        create(pid, "stat", NULL);
+    }
+    create(&root, "var", &var_m);
+    create(&root, "bin", &bin_m);
+    memset(&cnt, 0, sizeof(cnt));
+}
+
+#define BOOT_MAX 1024
+
+static char boot_paths[BOOT_MAX][64];
+static int boot_count;
+
+static void build_boot(void)
+{
+    static const char *const path_dirs[] = { "/usr/bin", "/sbin", "/bin" };
+    int i, d;
+
+    for (i = 0; i < 200; i++) {
+        int app = rnd() % 30;
+        for (d = 0; d < 3; d++)
+            snprintf(boot_paths[boot_count++], 64, "%s/app%02d", path_dirs[d], app);
+    }
+    for (i = 0; i < 100; i++)
+        snprintf(boot_paths[boot_count++], 64, "/var/etc/conf%02u", rnd() % 50);
+    for (i = 0; i < 20; i++)
+        snprintf(boot_paths[boot_count++], 64, "/dev/tty%u", rnd() % 30);
+}
+
+static const char *const loop_paths[] = {
+    "/bin/app05", "/bin/app77", "/bin/nosuch", "/usr/bin/app05",
+    "/sbin/app05", "/var/www/page31.html", "/var/www/index.html",
+    "/var/data/logs/log07", "/var/etc/conf03", "/var/etc/conf40",
+    "/dev/tty7", "/dev/null", "/dev/missing", "/sys/proc/9/stat",
+    "/sys/mem", "/var/data",
+};
+#define LOOP_PATHS (int)(sizeof(loop_paths) / sizeof(loop_paths[0]))
+
+static void report(const char *label, uint64_t ns)
+{
+    double n = (double)cnt.stats;
+
+    printf("  %-8s %7.1f ns/stat  %6.2f compares  %5.3f lookups  %6.2f medium reads\n",
+           label, (double)ns / n, cnt.compares / n, cnt.lookups / n, cnt.reads / n);
+}
+
+/* Resolve 'paths', recording the full name of each result */
+static uint64_t run(const char *const *paths, int count, int loops, char (*res)[64])
+{
+    uint64_t t0 = now_ns();
+    int l, i;
+
+    for (l = 0; l < loops; l++) {
+        for (i = 0; i < count; i++) {
+            struct fnode *f = walk(paths[i]);
+            if (res && l == 0)
+                snprintf(res[i], 64, "%s/%s", f && f->parent ? f->parent->fname : "",
+                         f ? f->fname : "-");
+        }
+    }
+    return now_ns() - t0;
+}
+
+static int checks(void)
+{
+    struct fnode *dev, *p, *etc, *f;
+    struct dcache_stats st;
+
+    reset(1);
+    dev = walk("/dev");
+    if (walk("/dev/newdev") != NULL || walk("/dev/newdev") != NULL)
+        return -1;
+    p = create(dev, "newdev", NULL);
+    if (walk("/dev/newdev") != p)
+        return -2;
+
+    /* Unlinked, then reused under another name */
+    p = walk("/dev/tty3");
+    detach(p);
+    if (walk("/dev/tty3") != NULL)
+        return -3;
+    f = walk("/dev/tty4");
+    detach(f);
+    if (create(walk("/sys"), "x", NULL) != f || walk("/dev/tty4") != NULL ||
+            walk("/sys/x") != f)
+        return -4;
+
+    /* A directory reused: its old children must not show up under it */
+    if (!walk("/var/etc/conf03"))
+        return -5;
+    etc = walk("/var/etc");
+    detach(etc);
+    if (create(&root, "etc2", NULL) != etc || walk("/etc2/conf03") != NULL)
+        return -6;
+
+    /* Mount: the cache had "a" as missing under /mnt */
+    p = walk("/mnt");
+    if (walk("/mnt/a") != NULL)
+        return -7;
+    p->lazy = &mnt_m;
+    dcache_flush();
+    f = walk("/mnt/a");
+    if (!f || f->parent != p)
+        return -8;
+
+    dcache_get_stats(&st);
+    if (st.neg_hits == 0 || st.invalidated == 0)
+        return -9;
+    return 0;
+}
+
+/* More names than entries: every result still matches the plain walk */
+static int check_capacity(void)
+{
+    static char paths[400][64];
+    static const char *ptrs[400];
+    static char plain[400][64], cached[400][64];
+    struct dcache_stats st;
+    int i;
+
+    for (i = 0; i < 400; i++) {
+        switch (i % 4) {
+        case 0:
+            snprintf(paths[i], 64, "/bin/app%02d", (i / 4) % 110);
+            break;
+        case 1:
+            snprintf(paths[i], 64, "/var/www/page%02d.html", (i / 4) % 45);
+            break;
+        case 2:
+            snprintf(paths[i], 64, "/dev/tty%d", i % 30);
+            break;
+        default:
+            snprintf(paths[i], 64, "/sys/proc/%d/stat", i % 15);
+        }
+        ptrs[i] = paths[i];
+    }
+    reset(0);
+    run(ptrs, 400, 1, plain);
+    reset(1);
+    run(ptrs, 400, 1, NULL);
+    run(ptrs, 400, 1, cached);
+    for (i = 0; i < 400; i++) {
+        if (strcmp(plain[i], cached[i]) != 0) {
+            fprintf(stderr, "capacity: %s gave %s, %s without cache\n", paths[i],
+                    cached[i], plain[i]);
+            return -1;
+        }
+    }
+    dcache_get_stats(&st);
+    printf("capacity: OK, %u evictions, %u of %u entries in use\n", st.evictions,
+           st.entries, DCACHE_SETS * DCACHE_WAYS);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *boot_ptrs[BOOT_MAX];
+    static char boot_res[2][BOOT_MAX][64];
+    static char loop_res[2][LOOP_PATHS][64];
+    struct dcache_stats st;
+    uint64_t ns;
+    int loops = 20000;
+    int mode, i, ret;
+
+    if (argc > 1)
+        loops = atoi(argv[1]);
+    if (loops < 10)
+        loops = 10;
+
+    build_media();
+    build_boot();
+    for (i = 0; i < boot_count; i++)
+        boot_ptrs[i] = boot_paths[i];
+
+    ret = checks();
+    if (ret != 0) {
+        fprintf(stderr, "checks: failed (%d)\n", ret);
+        return 1;
+    }
+    printf("checks: OK\n");
+    if (check_capacity() != 0)
+        return 1;
+
+    printf("boot: %d stat() from a cold start\n", boot_count);
+    for (mode = 0; mode < 2; mode++) {
+        reset(mode);
+        ns = run(boot_ptrs, boot_count, 1, boot_res[mode]);
+        report(mode ? "dcache" : "nocache", ns);
+    }
+    dcache_get_stats(&st);
+    printf("  dcache: %u hits, %u negative hits, %u misses, %u evictions\n", st.hits,
+           st.neg_hits, st.misses, st.evictions);
+
+    printf("stat: %d paths x %d\n", LOOP_PATHS, loops);
+    for (mode = 0; mode < 2; mode++) {
+        reset(mode);
+        run(loop_paths, LOOP_PATHS, 1, NULL);
+        memset(&cnt, 0, sizeof(cnt));
+        ns = run(loop_paths, LOOP_PATHS, loops, loop_res[mode]);
+        report(mode ? "dcache" : "nocache", ns);
+    }
+
+    for (i = 0; i < boot_count; i++) {
+        if (strcmp(boot_res[0][i], boot_res[1][i]) != 0) {
+            fprintf(stderr, "boot: %s gave %s, %s without cache\n", boot_paths[i],
+                    boot_res[1][i], boot_res[0][i]);
+            return 1;
+        }
+    }
+    for (i = 0; i < LOOP_PATHS; i++) {
+        if (strcmp(loop_res[0][i], loop_res[1][i]) != 0) {
+            fprintf(stderr, "stat: %s gave %s, %s without cache\n", loop_paths[i],
+                    loop_res[1][i], loop_res[0][i]);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,515 @@
+/*
+ * Host benchmark for the flashfs directory index (flashfs_index.c).
+ *
+ * An 8 MB image laid out like mkflashfs.py output (bytewise sorted
+ * paths, explicit directory entries, bitmap in the last pages) is served
+ * by a RAM model of the JEDEC emulator fallback that counts SPI read
+ * transactions and bytes. Against it, the linear scan flashfs_lookup()
+ * used to do is compared with index lookups, and a mount-time scan with
+ * loading the index checkpoint. Times on the target are estimated from
+ * the SPI traffic at 25 MHz plus a fixed cost per transaction.
+ *
+ * Every file and directory must be found by both methods at the same
+ * page, missing names by neither; the index must follow unlink and
+ * relocation, a checkpoint must reload to the same table and be refused
+ * once the allocation bitmap changes. An image without directory entries
+ * (older layout) is checked as well.
+ *
+ * Usage: flashfs_index_bench [files]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+static inline void *kalloc(uint32_t size)
+{
+    return malloc(size);
+}
+
+static inline void kfree(void *ptr)
+{
+    free(ptr);
+}
+
+#include "../flashfs_index.c"
+
+#define IMAGE_SIZE (8u << 20)
+#define TOTAL_PAGES (IMAGE_SIZE / FLASH_PAGE_SIZE)
+#define BMP_PAGES ((TOTAL_PAGES + BITS_PER_BMP_PAGE - 1) / BITS_PER_BMP_PAGE)
+#define USABLE_PAGES (TOTAL_PAGES - BMP_PAGES)
+#define CKPT_PAGES 133     /* room for INDEX_MAX entries */
+#define CKPT_FIRST (USABLE_PAGES - CKPT_PAGES)
+#define INDEX_MAX 4096
+
+#define SPI_HZ 25000000.0
+#define SPI_XFER_US 5.0         /* CS, command setup and DMA per transaction */
+
+#define ENTRY_FILE 1
+#define ENTRY_DIR 2
+#define ENTRY_PREFIX 3
+
+struct emu {
+    uint8_t *mem;
+    unsigned long xfers, bytes;
+};
+
+struct node {
+    char path[MAX_FNAME + 1];
+    int is_dir;
+    uint32_t page;
+};
+
+static struct emu emu;
+static struct node *nodes;
+static int n_nodes;
+
+static int emu_read(void *dev, uint32_t addr, void *buf, uint32_t len)
+{
+    struct emu *e = dev;
+
+    if (addr + len > IMAGE_SIZE)
+        return -EIO;
+    e->xfers++;
+    e->bytes += len;
+    memcpy(buf, e->mem + addr, len);
+    return 0;
+}
+
+static int emu_write_page(void *dev, uint32_t page, const uint8_t *buf)
+{
+    struct emu *e = dev;
+
+    memcpy(e->mem + page * FLASH_PAGE_SIZE, buf, FLASH_PAGE_SIZE);
+    return 0;
+}
+
+static const struct flashfs_index_io io = {
+    .read = emu_read,
+    .write_page = emu_write_page,
+    .dev = &emu,
+    .total_pages = TOTAL_PAGES,
+};
+
+static void emu_reset_counters(void)
+{
+    emu.xfers = 0;
+    emu.bytes = 0;
+}
+
+/* Estimated time on the target for the traffic since the last reset */
+static double emu_ms(void)
+{
+    return (emu.bytes + 4.0 * emu.xfers) * 8.0 / SPI_HZ * 1000.0 +
+        emu.xfers * SPI_XFER_US / 1000.0;
+}
+
+static void bmp_mark(uint32_t page, int used)
+{
+    uint8_t *b = emu.mem + (USABLE_PAGES + page / BITS_PER_BMP_PAGE) * FLASH_PAGE_SIZE +
+        (page % BITS_PER_BMP_PAGE) / 8;
+
+    if (used)
+        *b &= (uint8_t)~(1 << (page & 7));
+    else
+        *b |= (uint8_t)(1 << (page & 7));
+}
+
+static int cmp_node(const void *a, const void *b)
+{
+    return strcmp(((const struct node *)a)->path, ((const struct node *)b)->path);
+}
+
+/* Python-library-like tree: lib/pkgNN[/subM]/modK.py, bytewise sorted
+ * and packed from page 0 like mkflashfs.py does. */
+static int build_image(int files, int with_dirs)
+{
+    int i, n = 0;
+    uint32_t page = 0;
+
+    memset(emu.mem, 0xFF, IMAGE_SIZE);
+    free(nodes);
+    nodes = calloc((size_t)files * 3 + 1, sizeof(*nodes));
+    if (!nodes)
+        return -1;
+    for (i = 0; i < files; i++) {
+        int pkg = i / 24, sub = (i / 8) % 3, mod = i % 8;
+
+        if (sub == 0)
+            snprintf(nodes[n].path, MAX_FNAME, "lib/pkg%02d/mod%d.py", pkg, mod);
+        else
+            snprintf(nodes[n].path, MAX_FNAME, "lib/pkg%02d/sub%d/mod%d.py", pkg, sub, mod);
+        n++;
+        if (with_dirs && (i % 24) == 0)
+            snprintf(nodes[n++].path, MAX_FNAME, "lib/pkg%02d", pkg);
+        if (with_dirs && (i % 24) != 0 && mod == 0)
+            snprintf(nodes[n++].path, MAX_FNAME, "lib/pkg%02d/sub%d", pkg, sub);
+        if (with_dirs && nodes[n - 1].path[0] != 'l')
+            n--;
+    }
+    if (with_dirs)
+        strcpy(nodes[n++].path, "lib");
+    for (i = 0; i < n; i++)
+        nodes[i].is_dir = (strstr(nodes[i].path, ".py") == NULL);
+    qsort(nodes, (size_t)n, sizeof(*nodes), cmp_node);
+
+    for (i = 0; i < n; i++) {
+        uint32_t len = (uint32_t)strlen(nodes[i].path);
+        uint32_t fsize = nodes[i].is_dir ? 0 : 100 + rnd() % 3000;
+        uint32_t first_cap = FLASH_PAGE_SIZE - (sizeof(struct flashfs_file_hdr) + len + 1);
+        uint32_t cont_cap = FLASH_PAGE_SIZE - sizeof(struct flashfs_file_hdr);
+        uint32_t npages = 1, p;
+        uint8_t *pg = emu.mem + page * FLASH_PAGE_SIZE;
+        struct flashfs_file_hdr hdr;
+
+        if (fsize > first_cap)
+            npages += (fsize - first_cap + cont_cap - 1) / cont_cap;
+        hdr.fname_len = (uint16_t)(len | (nodes[i].is_dir ? F_DIR_FLAG : 0));
+        hdr.fsize = (uint16_t)fsize;
+        memcpy(pg, &hdr, sizeof(hdr));
+        memcpy(pg + sizeof(hdr), nodes[i].path, len + 1);
+        for (p = 1; p < npages; p++) {
+            hdr.fname_len = F_PREV_PAGE;
+            hdr.fsize = 0;
+            memcpy(pg + p * FLASH_PAGE_SIZE, &hdr, sizeof(hdr));
+        }
+        nodes[i].page = page;
+        for (p = 0; p < npages; p++)
+            bmp_mark(page + p, 1);
+        page += npages;
+    }
+    n_nodes = n;
+    return 0;
+}
+
+/* flashfs_page_used(): one bitmap page cached across calls */
+static uint32_t bmp_cache_page = 0xFFFFFFFFu;
+static uint8_t bmp_cache[FLASH_PAGE_SIZE];
+
+static int page_used(uint32_t page)
+{
+    uint32_t bp = USABLE_PAGES + page / BITS_PER_BMP_PAGE;
+
+    if (bp != bmp_cache_page) {
+        emu_read(&emu, bp * FLASH_PAGE_SIZE, bmp_cache, FLASH_PAGE_SIZE);
+        bmp_cache_page = bp;
+    }
+    return !(bmp_cache[(page % BITS_PER_BMP_PAGE) / 8] & (1 << (page & 7)));
+}
+
+/* flashfs_read_entry(): whole page read, name validated */
+static int read_entry(uint32_t page, char *fname)
+{
+    uint8_t buf[FLASH_PAGE_SIZE];
+    struct flashfs_file_hdr hdr;
+    uint16_t len;
+
+    emu_read(&emu, page * FLASH_PAGE_SIZE, buf, FLASH_PAGE_SIZE);
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (hdr.fname_len == 0xFFFF || hdr.fname_len == 0 || hdr.fname_len == F_PREV_PAGE)
+        return 0;
+    len = hdr.fname_len & ~F_DIR_FLAG;
+    if (len > MAX_FNAME || buf[sizeof(hdr) + len] != 0)
+        return 0;
+    memcpy(fname, buf + sizeof(hdr), len + 1u);
+    return (hdr.fname_len & F_DIR_FLAG) ? ENTRY_DIR : ENTRY_FILE;
+}
+
+/* The scan flashfs_lookup() did before the index */
+static int lookup_scan(const char *target, uint32_t *out_page)
+{
+    char fname[MAX_FNAME + 1];
+    size_t tlen = strlen(target);
+    uint32_t page;
+
+    for (page = 0; page < USABLE_PAGES; page++) {
+        int rc, cmp;
+
+        if (!page_used(page))
+            continue;
+        rc = read_entry(page, fname);
+        if (rc <= 0)
+            continue;
+        cmp = strncmp(fname, target, tlen);
+        if (cmp > 0 || (cmp == 0 && fname[tlen] != '\0' && fname[tlen] != '/'))
+            break;
+        if (cmp < 0)
+            continue;
+        *out_page = page;
+        return fname[tlen] == '\0' ? rc : ENTRY_PREFIX;
+    }
+    return 0;
+}
+
+/* flashfs_lookup_index() */
+static int lookup_index(const struct flashfs_index *idx, const char *target,
+        uint32_t *out_page)
+{
+    char fname[MAX_FNAME + 1];
+    const struct flashfs_index_ent *e;
+    uint32_t tlen = (uint32_t)strlen(target);
+    uint32_t pos = 0;
+    int unsure = !idx->complete;
+
+    while ((e = flashfs_index_next(idx, flashfs_hash(target, tlen), &pos)) != NULL) {
+        int rc;
+
+        if (e->page == FLASHFS_INDEX_NOPAGE) {
+            unsure = 1;
+            continue;
+        }
+        if (!page_used(e->page))
+            continue;
+        rc = read_entry(e->page, fname);
+        if (rc <= 0 || strncmp(fname, target, tlen) != 0)
+            continue;
+        if ((!e->refs && fname[tlen] == '\0') || (e->refs && fname[tlen] == '/')) {
+            *out_page = e->page;
+            return e->refs ? ENTRY_PREFIX : rc;
+        }
+    }
+    return unsure ? -1 : 0;
+}
+
+static int lookup_both(const struct flashfs_index *idx, const char *target)
+{
+    uint32_t p_scan = 0, p_idx = 0;
+    int r_scan = lookup_scan(target, &p_scan);
+    int r_idx = lookup_index(idx, target, &p_idx);
+
+    if (r_idx < 0)
+        r_idx = lookup_scan(target, &p_idx);
+    /* The scan may report a directory through its first child, the index
+     * through the dir entry or any child: only the kind has to agree. */
+    if ((r_scan == 0) != (r_idx == 0) ||
+            (r_scan == ENTRY_FILE) != (r_idx == ENTRY_FILE) ||
+            (r_scan == ENTRY_FILE && p_scan != p_idx)) {
+        fprintf(stderr, "lookup '%s': scan %d@%u index %d@%u\n", target,
+                r_scan, p_scan, r_idx, p_idx);
+        return -1;
+    }
+    return r_scan;
+}
+
+/* Every node, all parent prefixes and a few missing names */
+static int check_lookups(const struct flashfs_index *idx)
+{
+    char name[MAX_FNAME + 16];
+    int i;
+
+    for (i = 0; i < n_nodes; i++) {
+        char *slash;
+
+        if (lookup_both(idx, nodes[i].path) <= 0)
+            return -1;
+        strcpy(name, nodes[i].path);
+        while ((slash = strrchr(name, '/')) != NULL) {
+            *slash = '\0';
+            if (lookup_both(idx, name) <= 0)
+                return -1;
+        }
+        snprintf(name, sizeof(name), "%s.missing", nodes[i].path);
+        if (lookup_both(idx, name) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int same_table(const struct flashfs_index *a, const struct flashfs_index *b)
+{
+    uint32_t i;
+
+    if (a->count != b->count)
+        return 0;
+    for (i = 0; i < a->size; i++) {
+        const struct flashfs_index_ent *e;
+        uint32_t pos = 0;
+        int found = 0;
+
+        if (!a->tab[i].hash)
+            continue;
+        while (!found && (e = flashfs_index_next(b, a->tab[i].hash, &pos)) != NULL)
+            found = (e->page == a->tab[i].page && e->refs == a->tab[i].refs);
+        if (!found)
+            return 0;
+    }
+    return 1;
+}
+
+/* unlink and relocation, as flashfs.c applies them; returns the number
+ * of entries changed */
+static int check_updates(struct flashfs_index *idx)
+{
+    int i, changed = 0;
+
+    for (i = 0; i < n_nodes; i += 3) {
+        uint32_t len = (uint32_t)strlen(nodes[i].path);
+        struct flashfs_file_hdr hdr;
+
+        if (nodes[i].is_dir)
+            continue;
+        memcpy(&hdr, emu.mem + nodes[i].page * FLASH_PAGE_SIZE, sizeof(hdr));
+        if (i % 2) {
+            /* unlink: bitmap cleared, header left behind */
+            bmp_mark(nodes[i].page, 0);
+            flashfs_index_remove(idx, nodes[i].path, len, (uint16_t)nodes[i].page);
+            nodes[i].path[0] = '#';
+        } else {
+            /* relocation to the end of the volume */
+            uint32_t np = CKPT_FIRST - 1 - (uint32_t)i;
+            memcpy(emu.mem + np * FLASH_PAGE_SIZE, emu.mem + nodes[i].page * FLASH_PAGE_SIZE,
+                    FLASH_PAGE_SIZE);
+            bmp_mark(np, 1);
+            bmp_mark(nodes[i].page, 0);
+            flashfs_index_move(idx, nodes[i].path, len, (uint16_t)nodes[i].page, (uint16_t)np);
+            nodes[i].page = np;
+        }
+        changed++;
+    }
+    bmp_cache_page = 0xFFFFFFFFu;
+    for (i = 0; i < n_nodes; i++) {
+        uint32_t page = 0;
+
+        if (nodes[i].path[0] == '#') {
+            if (lookup_index(idx, nodes[i].path + 1, &page) != 0) {
+                fprintf(stderr, "unlinked '%s' still indexed\n", nodes[i].path + 1);
+                return -1;
+            }
+            continue;
+        }
+        if (lookup_index(idx, nodes[i].path, &page) <= 0 ||
+                (!nodes[i].is_dir && page != nodes[i].page)) {
+            fprintf(stderr, "'%s' lost after updates\n", nodes[i].path);
+            return -1;
+        }
+    }
+    return changed;
+}
+
+static void time_lookups(const struct flashfs_index *idx, int use_index,
+        unsigned long *xfers, double *ms, double *host_ns)
+{
+    uint64_t t0;
+    uint32_t page;
+    int i;
+
+    bmp_cache_page = 0xFFFFFFFFu;
+    emu_reset_counters();
+    t0 = now_ns();
+    for (i = 0; i < n_nodes; i++) {
+        if (use_index)
+            lookup_index(idx, nodes[i].path, &page);
+        else
+            lookup_scan(nodes[i].path, &page);
+    }
+    *host_ns = (double)(now_ns() - t0) / n_nodes;
+    *xfers = emu.xfers;
+    *ms = emu_ms() / n_nodes;
+}
+
+static int run(int files, int with_dirs)
+{
+    struct flashfs_index idx, ck;
+    unsigned long x_scan, x_idx;
+    double ms_scan, ms_idx, ns_scan, ns_idx;
+    uint64_t t0, t_scan, t_load;
+    unsigned long mx_scan, mx_load;
+    double mms_scan, mms_load;
+    uint32_t bmp_hash;
+    int ret;
+
+    if (build_image(files, with_dirs) < 0)
+        return -1;
+    printf("%d files%s, %d entries on flash:\n", files,
+           with_dirs ? "" : " (no directory entries)", n_nodes);
+
+    flashfs_index_init(&idx, INDEX_MAX);
+    emu_reset_counters();
+    t0 = now_ns();
+    ret = flashfs_index_scan(&idx, &io);
+    t_scan = now_ns() - t0;
+    mx_scan = emu.xfers;
+    mms_scan = emu_ms();
+    if (ret != 0 || !idx.complete) {
+        fprintf(stderr, "index scan failed (%d)\n", ret);
+        return -1;
+    }
+    bmp_cache_page = 0xFFFFFFFFu;
+    if (check_lookups(&idx) < 0)
+        return -1;
+
+    /* Checkpoint: reserve its pages, store, mount again from it */
+    for (ret = 0; ret < CKPT_PAGES; ret++)
+        bmp_mark(CKPT_FIRST + ret, 1);
+    if (flashfs_index_store(&idx, &io, CKPT_FIRST, CKPT_PAGES,
+                flashfs_index_bmp_hash(&io)) != 0) {
+        fprintf(stderr, "checkpoint store failed (%u entries)\n", idx.count);
+        return -1;
+    }
+    flashfs_index_init(&ck, INDEX_MAX);
+    emu_reset_counters();
+    t0 = now_ns();
+    bmp_hash = flashfs_index_bmp_hash(&io);
+    ret = flashfs_index_load(&ck, &io, CKPT_FIRST, CKPT_PAGES, bmp_hash);
+    t_load = now_ns() - t0;
+    mx_load = emu.xfers;
+    mms_load = emu_ms();
+    if (ret != 0 || !same_table(&idx, &ck) || !same_table(&ck, &idx)) {
+        fprintf(stderr, "checkpoint load mismatch (%d)\n", ret);
+        return -1;
+    }
+
+    printf("  mount   scan %6lu xfers %8.1f ms (host %7.1f us)   checkpoint %3lu xfers %6.2f ms (host %5.1f us)\n",
+           mx_scan, mms_scan, t_scan / 1000.0, mx_load, mms_load, t_load / 1000.0);
+
+    time_lookups(&idx, 0, &x_scan, &ms_scan, &ns_scan);
+    time_lookups(&idx, 1, &x_idx, &ms_idx, &ns_idx);
+    printf("  lookup  scan %8.1f xfers %6.2f ms (host %7.0f ns)   index %4.2f xfers %6.3f ms (host %5.0f ns)\n",
+           (double)x_scan / n_nodes, ms_scan, ns_scan, (double)x_idx / n_nodes, ms_idx, ns_idx);
+    printf("  index   %u entries, %u slots, %u bytes\n", idx.count, idx.size,
+           idx.size * (unsigned)sizeof(struct flashfs_index_ent));
+
+    ret = check_updates(&idx);
+    if (ret < 0)
+        return -1;
+    /* Allocation changed since the checkpoint: it must be refused */
+    flashfs_index_free(&ck);
+    if (ret > 0 && flashfs_index_load(&ck, &io, CKPT_FIRST, CKPT_PAGES, flashfs_index_bmp_hash(&io)) == 0) {
+        fprintf(stderr, "stale checkpoint accepted\n");
+        return -1;
+    }
+    if (flashfs_index_invalidate(&io, CKPT_FIRST) != 0 ||
+            flashfs_index_load(&ck, &io, CKPT_FIRST, CKPT_PAGES, bmp_hash) != -ENOENT) {
+        fprintf(stderr, "invalidated checkpoint accepted\n");
+        return -1;
+    }
+    flashfs_index_free(&ck);
+    flashfs_index_free(&idx);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int files = 400;
+
+    if (argc > 1)
+        files = atoi(argv[1]);
+    if (files < 1)
+        files = 1;
+
+    emu.mem = malloc(IMAGE_SIZE);
+    if (!emu.mem)
+        return 1;
+    printf("8 MB JEDEC image, SPI at %.0f MHz + %.0f us per transaction:\n",
+           SPI_HZ / 1e6, SPI_XFER_US);
+    if (run(files, 1) < 0 || run(files, 0) < 0)
+        return 1;
+    free(nodes);
+    free(emu.mem);
+    return 0;
+}
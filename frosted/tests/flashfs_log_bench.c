@@ -0,0 +1,590 @@
+/*
+ * Host simulation of flashfs write amplification on SPI NOR: classic
+ * in-place pages against the log-structured store (flashfs_log.c).
+ *
+ * A RAM NOR model (program only clears bits, 4 KB sector erase, erase
+ * counters) holds a 1 MB volume. The same page write stream is replayed
+ * on both layouts: the classic one goes through the sector
+ * read-modify-erase of jedec_spi_flash_write_page(), the log one through
+ * flashfs_log_write(). The stream comes from a small model of what
+ * flashfs.c writes for each call: data pages, the header page when the
+ * size changes, one bitmap page write per page allocated or freed.
+ *
+ * Workloads, on top of cold files filling part of the volume:
+ *   klog    40-120 byte appends to a 16 KB log file, rotated when full
+ *   sqlite  transactions: journal created and written, two database
+ *           pages rewritten, journal deleted
+ *
+ * Checks: both layouts read back what the model wrote, the log never
+ * programs a 0 bit back to 1, remounting the log rebuilds the same map,
+ * and after power cuts at random points (torn programs and erases
+ * included) the log remounts with every page either before or after the
+ * write in flight.
+ *
+ * Time estimates use W25Q-class figures: page program 30 us + 1.5 us per
+ * byte, sector erase 45 ms.
+ *
+ * Usage: flashfs_log_bench [ops]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+static inline void *kalloc(uint32_t size)
+{
+    return malloc(size);
+}
+
+static inline void kfree(void *ptr)
+{
+    free(ptr);
+}
+
+#include "../flashfs_log.c"
+
+#define SECTOR_SIZE 4096u
+#define SECTORS 256u
+#define DEV_SIZE (SECTOR_SIZE * SECTORS)
+#define SLOTS (SECTOR_SIZE / FLASH_PAGE_SIZE - 1)
+#define SPARE_PCT 10            /* mkflashfs.py --log default */
+
+#define T_PP_US 30.0
+#define T_PP_BYTE_US 1.5
+#define T_SE_US 45000.0
+
+struct nor {
+    uint8_t mem[DEV_SIZE];
+    uint32_t erase_count[SECTORS];
+    uint64_t prog_bytes;
+    uint32_t pp, erases, violations;
+    double busy_us;
+    long budget;                /* operations left before power is cut, 0: none */
+    int dead;
+};
+
+struct backend {
+    int classic;
+    struct nor nor;
+    struct flashfs_log log;
+    struct flashfs_log_io io;
+};
+
+static uint32_t lpages, usable;
+static uint8_t *img;            /* model of the logical volume */
+static uint8_t *live;           /* page holds data the model cares about */
+static uint64_t app_bytes;
+
+static int nor_read(void *dev, uint32_t addr, void *buf, uint32_t len)
+{
+    struct nor *n = dev;
+
+    if (addr + len > DEV_SIZE)
+        return -EIO;
+    memcpy(buf, n->mem + addr, len);
+    return 0;
+}
+
+static int nor_program(void *dev, uint32_t addr, const void *buf, uint32_t len)
+{
+    struct nor *n = dev;
+    const uint8_t *b = buf;
+    uint32_t i;
+
+    if (n->dead || addr + len > DEV_SIZE)
+        return -EIO;
+    if (n->budget > 0 && --n->budget == 0) {
+        /* Torn program: half of it made it */
+        for (i = 0; i < len / 2; i++)
+            n->mem[addr + i] &= b[i];
+        n->dead = 1;
+        return -EIO;
+    }
+    for (i = 0; i < len; i++) {
+        if ((n->mem[addr + i] & b[i]) != b[i])
+            n->violations++;
+        n->mem[addr + i] &= b[i];
+    }
+    n->prog_bytes += len;
+    n->pp += (len + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    n->busy_us += T_PP_US * ((len + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE) + T_PP_BYTE_US * len;
+    return 0;
+}
+
+static int nor_erase(void *dev, uint32_t addr)
+{
+    struct nor *n = dev;
+    uint32_t s = addr / SECTOR_SIZE;
+
+    if (n->dead || s >= SECTORS)
+        return -EIO;
+    if (n->budget > 0 && --n->budget == 0) {
+        /* Torn erase: part of the sector is blank */
+        memset(n->mem + s * SECTOR_SIZE, 0xFF, SECTOR_SIZE / 2);
+        n->dead = 1;
+        return -EIO;
+    }
+    memset(n->mem + s * SECTOR_SIZE, 0xFF, SECTOR_SIZE);
+    n->erase_count[s]++;
+    n->erases++;
+    n->busy_us += T_SE_US;
+    return 0;
+}
+
+/* jedec_spi_flash_write_page(): program if only bits clear, else erase
+ * and reprogram the whole sector */
+static int classic_write_page(struct nor *n, uint32_t lp, const uint8_t *buf)
+{
+    static uint8_t shadow[SECTOR_SIZE];
+    uint32_t addr = lp * FLASH_PAGE_SIZE;
+    uint32_t base = addr & ~(SECTOR_SIZE - 1);
+    uint32_t i;
+
+    memcpy(shadow, n->mem + base, SECTOR_SIZE);
+    for (i = 0; i < FLASH_PAGE_SIZE; i++) {
+        if ((shadow[addr - base + i] & buf[i]) != buf[i])
+            break;
+    }
+    if (i == FLASH_PAGE_SIZE)
+        return nor_program(n, addr, buf, FLASH_PAGE_SIZE);
+    memcpy(shadow + addr - base, buf, FLASH_PAGE_SIZE);
+    if (nor_erase(n, base) < 0)
+        return -EIO;
+    return nor_program(n, base, shadow, SECTOR_SIZE);
+}
+
+static int be_init(struct backend *be, int classic)
+{
+    memset(be, 0, sizeof(*be));
+    memset(be->nor.mem, 0xFF, DEV_SIZE);
+    be->classic = classic;
+    if (classic)
+        return 0;
+    be->io.read = nor_read;
+    be->io.program = nor_program;
+    be->io.erase = nor_erase;
+    be->io.dev = &be->nor;
+    if (flashfs_log_format(&be->io, SECTOR_SIZE, SECTORS, (uint16_t)lpages) != 0)
+        return -1;
+    /* Formatting is not part of the workload */
+    be->nor.prog_bytes = 0;
+    be->nor.pp = be->nor.erases = 0;
+    be->nor.busy_us = 0;
+    memset(be->nor.erase_count, 0, sizeof(be->nor.erase_count));
+    return flashfs_log_mount(&be->log, &be->io, SECTOR_SIZE, SECTORS, 0xFFFF);
+}
+
+/* The write in flight, for the power cut check */
+static uint32_t inflight_lp;
+static uint8_t inflight_old[FLASH_PAGE_SIZE];
+
+static int w_page(struct backend *be, uint32_t lp, const uint8_t *buf)
+{
+    int ret;
+
+    inflight_lp = lp;
+    memcpy(inflight_old, img + lp * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
+    if (be->classic)
+        ret = classic_write_page(&be->nor, lp, buf);
+    else
+        ret = flashfs_log_write(&be->log, lp, buf);
+    if (ret < 0)
+        return ret;
+    memcpy(img + lp * FLASH_PAGE_SIZE, buf, FLASH_PAGE_SIZE);
+    live[lp] = 1;
+    return 0;
+}
+
+/* --- flashfs model: what each call writes --- */
+
+struct file {
+    uint32_t start, extent, size;
+    char name[16];
+};
+
+static inline uint32_t first_cap(const struct file *f)
+{
+    return FLASH_PAGE_SIZE - (sizeof(struct flashfs_file_hdr) + strlen(f->name) + 1);
+}
+
+static uint32_t pages_for(const struct file *f, uint32_t size)
+{
+    uint32_t cont = FLASH_PAGE_SIZE - sizeof(struct flashfs_file_hdr);
+
+    if (size <= first_cap(f))
+        return 1;
+    return 1 + (size - first_cap(f) + cont - 1) / cont;
+}
+
+/* fs_bmp_set() / fs_bmp_clear(): one bitmap page write per page */
+static int bmp_mark(struct backend *be, uint32_t page, int used)
+{
+    uint8_t buf[FLASH_PAGE_SIZE];
+    uint32_t bp = usable + page / BITS_PER_BMP_PAGE;
+
+    memcpy(buf, img + bp * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
+    if (used)
+        buf[(page % BITS_PER_BMP_PAGE) / 8] &= (uint8_t)~(1 << (page & 7));
+    else
+        buf[(page % BITS_PER_BMP_PAGE) / 8] |= (uint8_t)(1 << (page & 7));
+    return w_page(be, bp, buf);
+}
+
+static int file_creat(struct backend *be, struct file *f)
+{
+    uint8_t buf[FLASH_PAGE_SIZE];
+    struct flashfs_file_hdr hdr;
+
+    if (bmp_mark(be, f->start, 1) < 0)
+        return -1;
+    memset(buf, 0xFF, sizeof(buf));
+    hdr.fname_len = (uint16_t)strlen(f->name);
+    hdr.fsize = 0;
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), f->name, hdr.fname_len + 1u);
+    f->size = 0;
+    return w_page(be, f->start, buf);
+}
+
+static int file_unlink(struct backend *be, struct file *f)
+{
+    uint32_t i, n = pages_for(f, f->size);
+
+    for (i = 0; i < n; i++) {
+        if (bmp_mark(be, f->start + i, 0) < 0)
+            return -1;
+        if (!be->classic)
+            flashfs_log_trim(&be->log, f->start + i);
+        live[f->start + i] = 0;
+    }
+    return 0;
+}
+
+/* flashfs_write(): touched pages once each, the size in the first page
+ * when it is touched anyway, else a separate header write */
+static int file_write(struct backend *be, struct file *f, uint32_t off, uint32_t len)
+{
+    uint8_t buf[FLASH_PAGE_SIZE];
+    uint32_t end = off + len;
+    uint32_t old_pages = pages_for(f, f->size);
+    uint32_t cont = FLASH_PAGE_SIZE - sizeof(struct flashfs_file_hdr);
+    int grown = end > f->size, hdr_done = 0;
+    struct flashfs_file_hdr hdr;
+    uint32_t i, p;
+
+    if (pages_for(f, end) > f->extent)
+        return -1;
+    if (grown) {
+        for (i = old_pages; i < pages_for(f, end); i++) {
+            if (bmp_mark(be, f->start + i, 1) < 0)
+                return -1;
+        }
+        f->size = end;
+    }
+    while (off < end) {
+        uint32_t page_off, n;
+
+        if (off < first_cap(f)) {
+            p = 0;
+            page_off = sizeof(hdr) + strlen(f->name) + 1 + off;
+            n = first_cap(f) - off;
+        } else {
+            p = 1 + (off - first_cap(f)) / cont;
+            page_off = sizeof(hdr) + (off - first_cap(f)) % cont;
+            n = FLASH_PAGE_SIZE - page_off;
+        }
+        if (n > end - off)
+            n = end - off;
+        memcpy(buf, img + (f->start + p) * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
+        if (p > 0 && p >= old_pages) {
+            hdr.fname_len = F_PREV_PAGE;
+            hdr.fsize = 0;
+            memcpy(buf, &hdr, sizeof(hdr));
+        }
+        for (i = 0; i < n; i++)
+            buf[page_off + i] = (uint8_t)rnd();
+        if (p == 0 && grown) {
+            memcpy(&hdr, buf, sizeof(hdr));
+            hdr.fsize = (uint16_t)f->size;
+            memcpy(buf, &hdr, sizeof(hdr));
+            hdr_done = 1;
+        }
+        if (w_page(be, f->start + p, buf) < 0)
+            return -1;
+        off += n;
+    }
+    if (grown && !hdr_done) {
+        memcpy(buf, img + f->start * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
+        memcpy(&hdr, buf, sizeof(hdr));
+        hdr.fsize = (uint16_t)f->size;
+        memcpy(buf, &hdr, sizeof(hdr));
+        if (w_page(be, f->start, buf) < 0)
+            return -1;
+    }
+    app_bytes += len;
+    return 0;
+}
+
+/* --- workloads --- */
+
+#define MAX_FILES 512
+
+static struct file files[MAX_FILES];
+static int n_files;
+static uint32_t next_page;
+
+static struct file *file_new(const char *name, uint32_t extent)
+{
+    struct file *f = &files[n_files++];
+
+    snprintf(f->name, sizeof(f->name), "%s", name);
+    f->start = next_page;
+    f->extent = extent;
+    f->size = 0;
+    next_page += extent;
+    return f;
+}
+
+/* Cold files up to cold_pct of the usable pages, written once */
+static int fill_cold(struct backend *be, int cold_pct)
+{
+    char name[16];
+
+    while (next_page < usable * (uint32_t)cold_pct / 100) {
+        uint32_t size = 1024 + rnd() % 7168;
+        struct file *f;
+
+        snprintf(name, sizeof(name), "c%03d.bin", n_files);
+        f = file_new(name, 0);
+        f->extent = pages_for(f, size);
+        next_page += f->extent;
+        if (file_creat(be, f) < 0 || file_write(be, f, 0, size) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int run_klog(struct backend *be, int ops)
+{
+    struct file *f = file_new("klog", 66);
+    int i;
+
+    if (file_creat(be, f) < 0)
+        return -1;
+    for (i = 0; i < ops; i++) {
+        if (f->size > 16000 && (file_unlink(be, f) < 0 || file_creat(be, f) < 0))
+            return -1;
+        if (file_write(be, f, f->size, 40 + rnd() % 81) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int run_sqlite(struct backend *be, int ops)
+{
+    struct file *db = file_new("app.db", 66);
+    struct file *jr = file_new("app.db-journal", 4);
+    uint32_t cont = FLASH_PAGE_SIZE - sizeof(struct flashfs_file_hdr);
+    int i, k;
+
+    if (file_creat(be, db) < 0 || file_write(be, db, 0, 64 * cont) < 0)
+        return -1;
+    for (i = 0; i < ops; i++) {
+        if (file_creat(be, jr) < 0 || file_write(be, jr, 0, 512) < 0)
+            return -1;
+        for (k = 0; k < 2; k++) {
+            if (file_write(be, db, first_cap(db) + (rnd() % 63) * cont, cont) < 0)
+                return -1;
+        }
+        if (file_unlink(be, jr) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int run(struct backend *be, int classic, int workload, int cold_pct, int ops)
+{
+    memset(img, 0xFF, (size_t)lpages * FLASH_PAGE_SIZE);
+    memset(live, 0, lpages);
+    n_files = 0;
+    next_page = 0;
+    app_bytes = 0;
+    rnd_state = BENCH_RND_SEED;
+    if (be_init(be, classic) != 0)
+        return -1;
+    if (fill_cold(be, cold_pct) < 0)
+        return -1;
+    /* Count the workload only */
+    app_bytes = 0;
+    be->nor.prog_bytes = 0;
+    be->nor.pp = be->nor.erases = 0;
+    be->nor.busy_us = 0;
+    memset(be->nor.erase_count, 0, sizeof(be->nor.erase_count));
+    return workload ? run_sqlite(be, ops) : run_klog(be, ops);
+}
+
+/* Every live page reads back as modelled */
+static int check_contents(struct backend *be, int skip_inflight)
+{
+    uint8_t buf[FLASH_PAGE_SIZE];
+    uint32_t lp;
+
+    for (lp = 0; lp < lpages; lp++) {
+        const uint8_t *want = img + lp * FLASH_PAGE_SIZE;
+
+        if (!live[lp])
+            continue;
+        if (be->classic)
+            memcpy(buf, be->nor.mem + lp * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
+        else if (flashfs_log_read(&be->log, lp * FLASH_PAGE_SIZE, buf, FLASH_PAGE_SIZE) != 0)
+            return -1;
+        if (memcmp(buf, want, FLASH_PAGE_SIZE) == 0)
+            continue;
+        if (skip_inflight && lp == inflight_lp)
+            continue;
+        fprintf(stderr, "page %u differs\n", lp);
+        return -1;
+    }
+    return 0;
+}
+
+static int check_remount(struct backend *be)
+{
+    struct flashfs_log old = be->log;
+    uint32_t lp;
+    int ret;
+
+    be->log.map = NULL;
+    ret = flashfs_log_mount(&be->log, &be->io, SECTOR_SIZE, SECTORS, 0xFFFF);
+    if (ret != 0) {
+        fprintf(stderr, "remount failed (%d)\n", ret);
+        flashfs_log_unmount(&old);
+        return -1;
+    }
+    /* Trims only live in RAM (flashfs redoes them from its bitmap) */
+    for (lp = 0; lp < lpages; lp++) {
+        if (!live[lp])
+            flashfs_log_trim(&be->log, lp);
+        else if (be->log.map[lp] != old.map[lp]) {
+            fprintf(stderr, "remount maps page %u elsewhere\n", lp);
+            ret = -1;
+        }
+    }
+    flashfs_log_unmount(&old);
+    if (ret == 0)
+        ret = check_contents(be, 0);
+    return ret;
+}
+
+static void report(const char *name, int cold_pct, struct backend *be, int ops)
+{
+    uint32_t s, lo = 0xFFFFFFFFu, hi = 0;
+
+    for (s = 0; s < SECTORS; s++) {
+        if (be->nor.erase_count[s] < lo)
+            lo = be->nor.erase_count[s];
+        if (be->nor.erase_count[s] > hi)
+            hi = be->nor.erase_count[s];
+    }
+    printf("  %-7s %3d%%  %-7s %8.1f %9.1f %7.2f %8u %6u/%-6u %8.2f\n",
+           name, cold_pct, be->classic ? "classic" : "log",
+           app_bytes / 1024.0, be->nor.prog_bytes / 1024.0,
+           (double)be->nor.prog_bytes / (double)app_bytes,
+           be->nor.erases, lo, hi, be->nor.busy_us / 1000.0 / ops);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct backend be;
+    static const char *names[] = { "klog", "sqlite" };
+    static const int cold[] = { 50, 85 };
+    int ops = 20000;
+    int w, c, classic, cuts = 0;
+    long t;
+
+    if (argc > 1)
+        ops = atoi(argv[1]);
+    if (ops < 100)
+        ops = 100;
+
+    lpages = (SECTORS - FLASHFS_LOG_MIN_SPARE) * SLOTS * (100 - SPARE_PCT) / 100;
+    usable = lpages - (lpages + BITS_PER_BMP_PAGE - 1) / BITS_PER_BMP_PAGE;
+    img = malloc((size_t)lpages * FLASH_PAGE_SIZE);
+    live = malloc(lpages);
+    if (!img || !live)
+        return 1;
+
+    printf("1 MB SPI NOR, 4 KB sectors, %u logical pages, %d ops per run:\n", lpages, ops);
+    printf("  %-7s %4s  %-7s %8s %9s %7s %8s %13s %8s\n", "load", "cold", "layout",
+           "app KB", "flash KB", "WA", "erases", "erase min/max", "ms/op");
+    for (w = 0; w < 2; w++) {
+        for (c = 0; c < 2; c++) {
+            for (classic = 1; classic >= 0; classic--) {
+                if (run(&be, classic, w, cold[c], ops) != 0) {
+                    fprintf(stderr, "%s: %s run failed\n", names[w],
+                            classic ? "classic" : "log");
+                    return 1;
+                }
+                if (check_contents(&be, 0) != 0)
+                    return 1;
+                if (!classic && (be.nor.violations || check_remount(&be) != 0)) {
+                    fprintf(stderr, "%s: log volume inconsistent (%u bad programs)\n",
+                            names[w], be.nor.violations);
+                    return 1;
+                }
+                report(names[w], cold[c], &be, ops);
+                if (!classic)
+                    flashfs_log_unmount(&be.log);
+            }
+        }
+    }
+
+    /* Power cuts, torn programs and erases included */
+    for (t = 1; t <= 60; t++) {
+        long budget = 400 + (long)(rnd() % 60000);
+
+        /* Format and fill first, then arm the cut */
+        be.nor.budget = 0;
+        if (run(&be, 0, (int)(t & 1), 50, 0) != 0)
+            return 1;
+        be.nor.budget = budget;
+        if ((t & 1) ? run_sqlite(&be, 1000000) == 0 : run_klog(&be, 1000000) == 0) {
+            fprintf(stderr, "power cut never happened\n");
+            return 1;
+        }
+        flashfs_log_unmount(&be.log);
+        be.nor.dead = 0;
+        be.nor.budget = 0;
+        if (flashfs_log_mount(&be.log, &be.io, SECTOR_SIZE, SECTORS, 0xFFFF) != 0 ||
+                check_contents(&be, 1) != 0) {
+            fprintf(stderr, "power cut after %ld operations: volume lost\n", budget);
+            return 1;
+        }
+        /* The write in flight may or may not have landed */
+        {
+            uint8_t buf[FLASH_PAGE_SIZE];
+
+            flashfs_log_read(&be.log, inflight_lp * FLASH_PAGE_SIZE, buf, FLASH_PAGE_SIZE);
+            if (live[inflight_lp] &&
+                    memcmp(buf, img + inflight_lp * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE) != 0 &&
+                    memcmp(buf, inflight_old, FLASH_PAGE_SIZE) != 0) {
+                fprintf(stderr, "page %u in flight is neither old nor new\n", inflight_lp);
+                return 1;
+            }
+            if (flashfs_log_write(&be.log, inflight_lp, buf) != 0) {
+                fprintf(stderr, "write after power cut failed\n");
+                return 1;
+            }
+        }
+        flashfs_log_unmount(&be.log);
+        cuts++;
+    }
+    printf("power cuts: %d remounts, every page old or new\n", cuts);
+    free(img);
+    free(live);
+    return 0;
+}
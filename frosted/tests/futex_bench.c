@@ -0,0 +1,193 @@
+/*
+ * Host test and microbenchmark for the userspace pthread mutexes
+ * (frosted-headers/sys/frosted_pthread_mutex.c).
+ *
+ * The kernel half, futex_wait/futex_wake, is Linux's own futex here:
+ * same contract (sleep only if the word still holds the value, wake
+ * up to n sleepers). Every call is counted.
+ *
+ * The mutexes are used as the C library does: the address of the word
+ * goes to init, lock and trylock, its value to unlock and destroy.
+ *
+ * Checks:
+ *   api        init, trylock on a held mutex, unlock of a free one,
+ *              destroy of a held one, a statically initialized mutex
+ *   fast path  uncontended lock/unlock pairs make no system call (the
+ *              previous stubs made two per pair, one trap each)
+ *   contended  threads incrementing a counter under the mutex, now and
+ *              then yielding the CPU while holding it: no update lost;
+ *              futex calls per acquisition are reported
+ *
+ * Build with -no-pie: the stubs pass the lock word as a 32-bit address,
+ * so the mutexes must sit below 4 GB as they do on the target.
+ *
+ * Usage: futex_bench [ops]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+static unsigned long futex_waits, futex_wakes;
+
+int sys_futex_wait(uint32_t arg1, uint32_t arg2, uint32_t arg3)
+{
+    (void)arg3;
+    __atomic_add_fetch(&futex_waits, 1, __ATOMIC_RELAXED);
+    return syscall(SYS_futex, (uint32_t *)(uintptr_t)arg1, FUTEX_WAIT_PRIVATE, arg2,
+                   NULL, NULL, 0);
+}
+
+int sys_futex_wake(uint32_t arg1, uint32_t arg2)
+{
+    __atomic_add_fetch(&futex_wakes, 1, __ATOMIC_RELAXED);
+    return syscall(SYS_futex, (uint32_t *)(uintptr_t)arg1, FUTEX_WAKE_PRIVATE, arg2,
+                   NULL, NULL, 0);
+}
+
+#include "../../frosted-headers/sys/frosted_pthread_mutex.c"
+
+#define THREADS 4
+
+static uint32_t mutex_word;
+static uint32_t api_word;
+/* volatile: the mutex is in this file, the compiler could keep counter in
+ * a register across lock/unlock */
+static volatile unsigned long counter;
+static int per_thread;
+
+static int m_init(uint32_t *w)
+{
+    return sys_pthread_mutex_init((uint32_t)(uintptr_t)w, 0);
+}
+
+static int m_destroy(uint32_t *w)
+{
+    return sys_pthread_mutex_destroy(*w);
+}
+
+static int m_trylock(uint32_t *w)
+{
+    return sys_pthread_mutex_trylock((uint32_t)(uintptr_t)w);
+}
+
+static int m_lock(uint32_t *w)
+{
+    return sys_pthread_mutex_lock((uint32_t)(uintptr_t)w);
+}
+
+static int m_unlock(uint32_t *w)
+{
+    return sys_pthread_mutex_unlock(*w);
+}
+
+static int api(void)
+{
+    api_word = 0x55;
+    if (m_init(&api_word) != 0 || (api_word & MUTEX_STATE) != MUTEX_UNLOCKED)
+        return -1;
+    if (m_trylock(&api_word) != 0)
+        return -1;
+    if (m_trylock(&api_word) != -EAGAIN)
+        return -1;
+    if (m_destroy(&api_word) != -EBUSY)
+        return -1;
+    if (m_unlock(&api_word) != 0)
+        return -1;
+    if (m_unlock(&api_word) != -EPERM)
+        return -1;
+    if (m_destroy(&api_word) != 0)
+        return -1;
+    if (sys_pthread_mutex_lock(0) != -EINVAL)
+        return -1;
+
+    /* PTHREAD_MUTEX_INITIALIZER: used without init */
+    api_word = 0;
+    if (m_unlock(&api_word) != -EPERM || m_destroy(&api_word) != 0)
+        return -1;
+    if (m_lock(&api_word) != 0 || m_trylock(&api_word) != -EAGAIN)
+        return -1;
+    if (m_unlock(&api_word) != 0 || m_destroy(&api_word) != 0)
+        return -1;
+    return 0;
+}
+
+static void *worker(void *arg)
+{
+    int i;
+
+    (void)arg;
+    for (i = 0; i < per_thread; i++) {
+        m_lock(&mutex_word);
+        counter++;
+        /* Give the CPU away while holding it now and then, so that the
+         * other threads block on it even on a single core */
+        if ((i & 63) == 0)
+            sched_yield();
+        m_unlock(&mutex_word);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t th[THREADS];
+    unsigned long calls;
+    uint64_t t0, t1;
+    int ops = 2000000;
+    int i;
+
+    if (argc > 1)
+        ops = atoi(argv[1]);
+    if (ops < 1000)
+        ops = 1000;
+
+    if (api() != 0) {
+        fprintf(stderr, "api: unexpected result\n");
+        return 1;
+    }
+    printf("api: OK\n");
+
+    t0 = now_ns();
+    for (i = 0; i < ops; i++) {
+        m_lock(&mutex_word);
+        m_unlock(&mutex_word);
+    }
+    t1 = now_ns();
+    calls = futex_waits + futex_wakes;
+    printf("uncontended: %d pairs, %.1f ns/pair, %lu syscalls (previously %d)\n", ops,
+           (double)(t1 - t0) / ops, calls, 2 * ops);
+    if (calls != 0) {
+        fprintf(stderr, "uncontended path entered the kernel\n");
+        return 1;
+    }
+
+    per_thread = ops / THREADS;
+    t0 = now_ns();
+    for (i = 0; i < THREADS; i++)
+        pthread_create(&th[i], NULL, worker, NULL);
+    for (i = 0; i < THREADS; i++)
+        pthread_join(th[i], NULL);
+    t1 = now_ns();
+    printf("contended: %d threads x %d, %.1f ns/acquisition, futex_wait %.3f "
+           "futex_wake %.3f per acquisition\n", THREADS, per_thread,
+           (double)(t1 - t0) / (per_thread * THREADS),
+           (double)futex_waits / (per_thread * THREADS),
+           (double)futex_wakes / (per_thread * THREADS));
+    if (counter != (unsigned long)per_thread * THREADS ||
+            (mutex_word & MUTEX_STATE) != MUTEX_UNLOCKED) {
+        fprintf(stderr, "contended: counter %lu of %d, word %u\n", counter,
+                per_thread * THREADS, mutex_word);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,501 @@
+/*
+ * Stress test and benchmark for wolfIP IPv4 fragmentation, reassembly and
+ * path MTU discovery (wolfip.c), over the loopback interface.
+ *
+ * UDP datagrams of random size up to the largest reassembled datagram
+ * are sent from one socket to another on 127.0.0.1. Datagrams above the
+ * 1500 byte loopback MTU leave the sender in fragments, which are caught
+ * on their way to the loopback queue and handed to the receiving side
+ * directly, after being mangled according to the run. Both sockets
+ * start with the default buffer sizes, below the largest datagrams:
+ *   in order    fragments delivered as sent
+ *   shuffled    fragments of each datagram reordered, 10% duplicated
+ *   lossy       reordered, 5% of the fragments lost
+ *   overlap     reordered, 10% of the datagrams get an extra fragment
+ *               overlapping received data with different contents
+ * Every datagram received is checked against its expected contents; in
+ * the lossless runs all of them must arrive, in the lossy run exactly
+ * those that lost no fragment. After each run the reassembly timeout is
+ * let expire: no context may be left, nor any buffer allocated.
+ *
+ * The pmtu run streams data over a TCP connection, drops one segment on
+ * the way and answers it with an ICMP "fragmentation needed" announcing
+ * a 1000 byte path MTU: the dropped segment has to be resent in
+ * fragments, and all later segments must fit the new path MTU.
+ *
+ * Usage: ip_frag_bench [datagrams]
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+static long buf_allocs;
+
+static void *bench_alloc(size_t size)
+{
+    void *p = malloc(size);
+
+    if (p)
+        buf_allocs++;
+    return p;
+}
+
+static void bench_free(void *p)
+{
+    if (p)
+        buf_allocs--;
+    free(p);
+}
+
+#define CONFIG_RXBUF_MAX 16384
+#define CONFIG_TXBUF_MAX 16384
+#define WOLFIP_BUF_ALLOC(sz) bench_alloc(sz)
+#define WOLFIP_BUF_FREE(p) bench_free(p)
+#include "../include/config.h"
+#include "../wolfip.c"
+
+#define RX_PORT 7001
+#define TCP_PORT 5001
+#define MAX_DGRAM (WOLFIP_REASM_MAX - IP_HEADER_LEN - UDP_HEADER_LEN)
+#define MAX_FRAGS 16
+#define PMTU 1000
+#define TCP_TOTAL (4u << 20)
+#define CHUNK 4096
+#define STALL_NS 3000000000ull
+
+struct run {
+    const char *label;
+    int shuffle;
+    unsigned dup_pct, loss_pct, overlap_pct;
+};
+
+struct frag {
+    uint32_t len;
+    uint8_t frame[ETH_HEADER_LEN + IP_MTU_MAX];
+};
+
+static struct wolfIP stack;
+static uint64_t skew_ms;
+
+/* Fragments caught on the way out, and the copies handed to the stack */
+static struct frag caught[MAX_FRAGS];
+static int ncaught;
+static struct frag *order[2 * MAX_FRAGS];
+static struct frag extra[MAX_FRAGS];
+
+static uint8_t tx[MAX_DGRAM], rx[MAX_DGRAM];
+static uint8_t *expect;         /* per datagram: 0 must arrive, 1 must not, 2 either */
+static uint8_t *delivered;
+
+uint32_t wolfIP_getrandom(void)
+{
+    return rnd();
+}
+
+static void poll_stack(void)
+{
+    wolfIP_poll(&stack, now_ns() / 1000000ull + skew_ms);
+}
+
+static void fill(uint8_t *buf, uint32_t seq, uint32_t len)
+{
+    uint32_t i;
+
+    memcpy(buf, &seq, sizeof(seq));
+    for (i = sizeof(seq); i < len; i++)
+        buf[i] = (uint8_t)(seq * 7 + i);
+}
+
+static uint16_t ip_fo(const uint8_t *frame)
+{
+    const struct wolfIP_ip_packet *ip = (const struct wolfIP_ip_packet *)frame;
+
+    return ee16(ip->flags_fo);
+}
+
+/* Loopback send hook: keep fragments for the test to deliver */
+static int catch_send(struct wolfIP_ll_dev *ll, void *buf, uint32_t len)
+{
+    struct frag *f;
+
+    if (len < IP_HEADER_LEN ||
+            !(ip_fo((uint8_t *)buf - ETH_HEADER_LEN) & (IP_FLAG_MF | IP_FRAG_OFF_MASK)))
+        return wolfIP_loopback_send(ll, buf, len);
+    if (ncaught == MAX_FRAGS)
+        return -WOLFIP_EAGAIN;
+    f = &caught[ncaught++];
+    memset(f->frame, 0, ETH_HEADER_LEN);
+    memcpy(f->frame + ETH_HEADER_LEN, buf, len);
+    f->len = ETH_HEADER_LEN + len;
+    return (int)len;
+}
+
+static void inject(struct frag *f)
+{
+    uint8_t frame[ETH_HEADER_LEN + IP_MTU_MAX];
+
+    /* The stack may rewrite what it is handed */
+    memcpy(frame, f->frame, f->len);
+    wolfIP_recv_on(&stack, WOLFIP_LOOPBACK_IF_IDX, frame, f->len);
+}
+
+/* A copy of fragment f moved 8 bytes up, with different contents */
+static struct frag *make_overlap(const struct frag *f, struct frag *o)
+{
+    struct wolfIP_ip_packet *ip = (struct wolfIP_ip_packet *)o->frame;
+    uint16_t fo;
+    uint32_t i;
+
+    *o = *f;
+    fo = ee16(ip->flags_fo);
+    ip->flags_fo = ee16((uint16_t)(fo + 1));
+    for (i = ETH_HEADER_LEN + IP_HEADER_LEN; i < o->len; i++)
+        o->frame[i] ^= 0x5A;
+    ip->csum = 0;
+    iphdr_set_checksum(ip);
+    return o;
+}
+
+/* Deliver the fragments of the datagram just sent. Returns 1 when one of
+ * them was lost, 2 when the datagram may or may not make it. */
+static int release(const struct run *r)
+{
+    int n = 0, nextra = 0, i, fate = 0;
+
+    for (i = 0; i < ncaught; i++) {
+        if (r->loss_pct && rnd() % 100 < r->loss_pct) {
+            fate = 1;
+            continue;
+        }
+        order[n++] = &caught[i];
+        if (r->dup_pct && rnd() % 100 < r->dup_pct)
+            order[n++] = &caught[i];
+    }
+    if (r->overlap_pct && ncaught > 1 && rnd() % 100 < r->overlap_pct) {
+        /* Any fragment but the last one, so it stays within the datagram */
+        order[n++] = make_overlap(&caught[rnd() % (ncaught - 1)], &extra[nextra++]);
+        if (!fate)
+            fate = 2;
+    }
+    if (r->shuffle) {
+        for (i = n - 1; i > 0; i--) {
+            int j = (int)(rnd() % (uint32_t)(i + 1));
+            struct frag *t = order[i];
+
+            order[i] = order[j];
+            order[j] = t;
+        }
+    }
+    for (i = 0; i < n; i++)
+        inject(order[i]);
+    ncaught = 0;
+    return fate;
+}
+
+static int set_buf(int fd, int optname, int size)
+{
+    return wolfIP_sock_setsockopt(&stack, fd, WOLFIP_SOL_SOCKET, optname, &size, sizeof(size));
+}
+
+static int drain(const struct run *r, int fd, uint32_t count)
+{
+    int n;
+
+    while ((n = wolfIP_sock_recvfrom(&stack, fd, rx, sizeof(rx), 0, NULL, NULL)) > 0) {
+        uint32_t seq;
+
+        memcpy(&seq, rx, sizeof(seq));
+        if (n < (int)sizeof(seq) || seq >= count || expect[seq] == 1) {
+            fprintf(stderr, "%s: unexpected datagram (%d bytes)\n", r->label, n);
+            return -1;
+        }
+        fill(tx, seq, (uint32_t)n);
+        if (memcmp(rx, tx, (size_t)n) != 0) {
+            fprintf(stderr, "%s: datagram %u corrupted\n", r->label, seq);
+            return -1;
+        }
+        delivered[seq]++;
+    }
+    return 0;
+}
+
+static int check_idle(const char *label)
+{
+    int i;
+
+    /* Let incomplete datagrams time out */
+    skew_ms += WOLFIP_REASM_TIMEOUT_MS + 1;
+    poll_stack();
+    for (i = 0; i < WOLFIP_REASM_CTX; i++) {
+        if (stack.reasm[i].buf) {
+            fprintf(stderr, "%s: reassembly context %d still in use\n", label, i);
+            return -1;
+        }
+    }
+    for (i = 0; i < MAX_TCPSOCKETS; i++)
+        close_socket(&stack.tcpsockets[i]);
+    for (i = 0; i < MAX_UDPSOCKETS; i++)
+        close_socket(&stack.udpsockets[i]);
+    if (buf_allocs != 0) {
+        fprintf(stderr, "%s: %ld buffers leaked\n", label, buf_allocs);
+        return -1;
+    }
+    return 0;
+}
+
+static int run_udp(const struct run *r, uint32_t count)
+{
+    struct wolfIP_sockaddr_in sin;
+    uint64_t t0, bytes = 0;
+    uint32_t seq, arrived = 0, dups = 0, lost = 0, reasm_ok, reasm_drop, frag_out;
+    int sfd, rfd;
+
+    wolfIP_init(&stack);
+    wolfIP_getdev_ex(&stack, WOLFIP_LOOPBACK_IF_IDX)->send = catch_send;
+    memset(expect, 0, count);
+    memset(delivered, 0, count);
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = ee16(RX_PORT);
+    sin.sin_addr.s_addr = ee32(WOLFIP_LOOPBACK_IP);
+    sfd = wolfIP_sock_socket(&stack, AF_INET, IPSTACK_SOCK_DGRAM, WI_IPPROTO_UDP);
+    rfd = wolfIP_sock_socket(&stack, AF_INET, IPSTACK_SOCK_DGRAM, WI_IPPROTO_UDP);
+    if (sfd < 0 || rfd < 0 ||
+            wolfIP_sock_bind(&stack, rfd, (struct wolfIP_sockaddr *)&sin, sizeof(sin)) < 0)
+        return -1;
+
+    t0 = now_ns();
+    for (seq = 0; seq < count; seq++) {
+        uint32_t len = sizeof(seq) + rnd() % (MAX_DGRAM - sizeof(seq) + 1);
+
+        fill(tx, seq, len);
+        if (wolfIP_sock_sendto(&stack, sfd, tx, len, 0,
+                    (struct wolfIP_sockaddr *)&sin, sizeof(sin)) != (int)len) {
+            fprintf(stderr, "%s: sendto(%u bytes) failed\n", r->label, len);
+            return -1;
+        }
+        poll_stack();
+        if (ncaught)
+            expect[seq] = (uint8_t)release(r);
+        poll_stack();
+        if (drain(r, rfd, count) < 0)
+            return -1;
+        bytes += len;
+    }
+    t0 = now_ns() - t0;
+
+    for (seq = 0; seq < count; seq++) {
+        if (delivered[seq])
+            arrived++;
+        if (delivered[seq] > 1)
+            dups += delivered[seq] - 1u;
+        if (expect[seq] == 1)
+            lost++;
+        if (expect[seq] == 0 && !delivered[seq]) {
+            fprintf(stderr, "%s: datagram %u never arrived\n", r->label, seq);
+            return -1;
+        }
+    }
+    wolfIP_ip_frag_stats(&stack, &reasm_ok, &reasm_drop, &frag_out);
+    printf("  %-9s %6u sent %6u received %5u lost %4u dup  %6u frags  %6u reasm  %5u dropped  %7.1f MB/s\n",
+           r->label, count, arrived, lost, dups, frag_out, reasm_ok, reasm_drop,
+           t0 ? (double)bytes * 1000.0 / (double)t0 : 0.0);
+    if (!r->loss_pct && !r->overlap_pct && !r->dup_pct && reasm_drop != 0) {
+        fprintf(stderr, "%s: %u datagrams dropped\n", r->label, reasm_drop);
+        return -1;
+    }
+    return check_idle(r->label);
+}
+
+/*
+ * Path MTU discovery
+ */
+static struct frag dropped_seg;
+static int drop_armed;
+static int drop_done;            /* 1: segment dropped, 2: ICMP sent back */
+static uint32_t max_tcp_after;   /* largest TCP packet after the ICMP */
+static uint32_t frags_after;
+
+static int tcp_send(struct wolfIP_ll_dev *ll, void *buf, uint32_t len)
+{
+    const struct wolfIP_ip_packet *ip =
+        (const struct wolfIP_ip_packet *)((uint8_t *)buf - ETH_HEADER_LEN);
+
+    if (len > IP_HEADER_LEN + TCP_HEADER_LEN + TCP_OPTIONS_LEN && ip->proto == WI_IPPROTO_TCP) {
+        if (drop_armed && !drop_done && !(ee16(ip->flags_fo) & (IP_FLAG_MF | IP_FRAG_OFF_MASK))) {
+            /* A router on the way could not forward this one */
+            memset(dropped_seg.frame, 0, ETH_HEADER_LEN);
+            memcpy(dropped_seg.frame + ETH_HEADER_LEN, buf, len);
+            dropped_seg.len = ETH_HEADER_LEN + len;
+            drop_done = 1;
+            return (int)len;
+        }
+        if (drop_done == 2) {
+            if (len > max_tcp_after)
+                max_tcp_after = len;
+            if (ee16(ip->flags_fo) & (IP_FLAG_MF | IP_FRAG_OFF_MASK))
+                frags_after++;
+        }
+    }
+    return wolfIP_loopback_send(ll, buf, len);
+}
+
+static void inject_frag_needed(void)
+{
+    struct frag f;
+    struct wolfIP_icmp_packet *icmp = (struct wolfIP_icmp_packet *)f.frame;
+    const struct wolfIP_ip_packet *orig = (const struct wolfIP_ip_packet *)dropped_seg.frame;
+    uint16_t mtu = ee16(PMTU);
+    uint32_t quoted = IP_HEADER_LEN + 8;
+
+    memset(&f, 0, sizeof(f));
+    icmp->ip.ver_ihl = 0x45;
+    icmp->ip.ttl = 64;
+    icmp->ip.proto = WI_IPPROTO_ICMP;
+    icmp->ip.len = ee16((uint16_t)(IP_HEADER_LEN + ICMP_HEADER_LEN + quoted));
+    icmp->ip.src = orig->dst;
+    icmp->ip.dst = orig->src;
+    iphdr_set_checksum(&icmp->ip);
+    icmp->type = ICMP_DEST_UNREACH;
+    icmp->code = ICMP_FRAG_NEEDED;
+    memcpy(&icmp->unused[2], &mtu, sizeof(mtu));
+    memcpy((uint8_t *)icmp + sizeof(*icmp), dropped_seg.frame + ETH_HEADER_LEN, quoted);
+    icmp->csum = ee16(icmp_checksum(icmp, (uint16_t)(ICMP_HEADER_LEN + quoted)));
+    f.len = ETH_HEADER_LEN + IP_HEADER_LEN + ICMP_HEADER_LEN + quoted;
+    inject(&f);
+}
+
+static int run_pmtu(void)
+{
+    static uint8_t pat[CHUNK + 251], dst[CHUNK];
+    struct wolfIP_sockaddr_in sin;
+    uint64_t sent = 0, recvd = 0, t0, t_progress;
+    uint32_t reasm_ok, reasm_drop, frag_out, i;
+    int lfd, cfd, afd = -1, n;
+    struct tsocket *ts;
+
+    for (i = 0; i < sizeof(pat); i++)
+        pat[i] = (uint8_t)(i % 251);
+    wolfIP_init(&stack);
+    wolfIP_getdev_ex(&stack, WOLFIP_LOOPBACK_IF_IDX)->send = tcp_send;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = ee16(TCP_PORT);
+    sin.sin_addr.s_addr = ee32(WOLFIP_LOOPBACK_IP);
+    lfd = wolfIP_sock_socket(&stack, AF_INET, IPSTACK_SOCK_STREAM, 0);
+    cfd = wolfIP_sock_socket(&stack, AF_INET, IPSTACK_SOCK_STREAM, 0);
+    /* Buffers large enough that recovering from the dropped segment
+     * never waits for a backed-off retransmission timer */
+    if (lfd < 0 || cfd < 0 ||
+            set_buf(lfd, WOLFIP_SO_RCVBUF, 16384) < 0 ||
+            set_buf(cfd, WOLFIP_SO_SNDBUF, 16384) < 0 ||
+            wolfIP_sock_bind(&stack, lfd, (struct wolfIP_sockaddr *)&sin, sizeof(sin)) < 0 ||
+            wolfIP_sock_listen(&stack, lfd, 1) < 0)
+        return -1;
+    ts = &stack.tcpsockets[SOCKET_UNMARK(cfd)];
+
+    t0 = now_ns();
+    while ((n = wolfIP_sock_connect(&stack, cfd, (struct wolfIP_sockaddr *)&sin, sizeof(sin))) != 0) {
+        if (n != -WOLFIP_EAGAIN || now_ns() - t0 > STALL_NS) {
+            fprintf(stderr, "pmtu: connect failed (%d)\n", n);
+            return -1;
+        }
+        poll_stack();
+        if (afd < 0)
+            afd = wolfIP_sock_accept(&stack, lfd, NULL, NULL);
+    }
+
+    t0 = t_progress = now_ns();
+    while (recvd < TCP_TOTAL) {
+        poll_stack();
+        if (afd < 0) {
+            afd = wolfIP_sock_accept(&stack, lfd, NULL, NULL);
+            if (afd < 0)
+                afd = -1;
+        }
+        if (drop_done == 1) {
+            inject_frag_needed();
+            drop_done = 2;
+        }
+        if (sent >= TCP_TOTAL / 4)
+            drop_armed = 1;
+        if (sent < TCP_TOTAL) {
+            n = wolfIP_sock_sendto(&stack, cfd, pat + (sent % 251),
+                    (TCP_TOTAL - sent < CHUNK) ? (size_t)(TCP_TOTAL - sent) : CHUNK, 0, NULL, 0);
+            if (n > 0)
+                sent += (uint64_t)n;
+        }
+        if (afd >= 0) {
+            n = wolfIP_sock_recvfrom(&stack, afd, dst, CHUNK, 0, NULL, NULL);
+            if (n > 0) {
+                if (memcmp(dst, pat + (recvd % 251), (size_t)n) != 0) {
+                    fprintf(stderr, "pmtu: data mismatch at %llu\n", (unsigned long long)recvd);
+                    return -1;
+                }
+                recvd += (uint64_t)n;
+                t_progress = now_ns();
+            }
+        }
+        if (now_ns() - t_progress > STALL_NS) {
+            fprintf(stderr, "pmtu: stalled after %llu bytes\n", (unsigned long long)recvd);
+            return -1;
+        }
+    }
+    t0 = now_ns() - t0;
+
+    wolfIP_ip_frag_stats(&stack, &reasm_ok, &reasm_drop, &frag_out);
+    printf("  pmtu      path MTU %u  largest packet after ICMP %u  %u fragments  %u reasm  %7.1f MB/s\n",
+           ts->sock.tcp.pmtu, max_tcp_after, frags_after, reasm_ok,
+           t0 ? (double)recvd * 1000.0 / (double)t0 : 0.0);
+    if (ts->sock.tcp.pmtu != PMTU || frags_after == 0 || reasm_ok == 0) {
+        fprintf(stderr, "pmtu: ICMP fragmentation needed not acted upon\n");
+        return -1;
+    }
+    if (max_tcp_after > PMTU) {
+        fprintf(stderr, "pmtu: %u byte packet sent above the path MTU\n", max_tcp_after);
+        return -1;
+    }
+    return check_idle("pmtu");
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct run runs[] = {
+        { "in order", 0, 0, 0, 0 },
+        { "shuffled", 1, 10, 0, 0 },
+        { "lossy", 1, 0, 5, 0 },
+        { "overlap", 1, 0, 0, 10 },
+    };
+    uint32_t count = 20000;
+    unsigned i;
+
+    if (argc > 1)
+        count = (uint32_t)atoi(argv[1]);
+    if (count == 0)
+        count = 1000;
+    expect = malloc(count);
+    delivered = malloc(count);
+    if (!expect || !delivered)
+        return 1;
+
+    printf("loopback UDP datagrams of 4..%u bytes, %d reassembly contexts:\n",
+           (unsigned)MAX_DGRAM, WOLFIP_REASM_CTX);
+    for (i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        if (run_udp(&runs[i], count) < 0)
+            return 1;
+    }
+    printf("loopback TCP transfer, %u MB, ICMP fragmentation needed for %u bytes:\n",
+           TCP_TOTAL >> 20, PMTU);
+    if (run_pmtu() < 0)
+        return 1;
+    free(expect);
+    free(delivered);
+    return 0;
+}
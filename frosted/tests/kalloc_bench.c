@@ -0,0 +1,384 @@
+/*
+ * Host benchmark for the kernel heap (privileged_alloc.c).
+ *
+ * Replays allocation traces against kalloc/krealloc/kfree and reports
+ * per-operation latency (average and worst case), heap growth and
+ * fragmentation. After each trace the heap layout is walked to check
+ * the allocator invariants.
+ *
+ * Usage: kalloc_bench [trace-file]
+ *   Without arguments, a set of synthetic traces modelled on kernel
+ *   usage is replayed. A trace file has one operation per line:
+ *     a <id> <size>    kalloc
+ *     r <id> <size>    krealloc
+ *     f <id>           kfree
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+/* Include the allocator directly so that static state is visible. */
+#include "../privileged_alloc.c"
+
+#define ARENA_SIZE (256 * 1024)
+#define MAX_IDS 4096
+#define MAX_OPS 200000
+
+static uint8_t arena[ARENA_SIZE] __attribute__((aligned(8)));
+static uint32_t arena_used = 0;
+
+void *secure_mmap(size_t size, uint16_t task_id, uint32_t flags)
+{
+    void *p;
+
+    (void)task_id;
+    (void)flags;
+    if (arena_used + size > ARENA_SIZE)
+        return NULL;
+    p = arena + arena_used;
+    arena_used += size;
+    return p;
+}
+
+void secure_munmap(void *addr, uint16_t task_id)
+{
+    (void)addr;
+    (void)task_id;
+}
+
+static void heap_reset(void)
+{
+    memset(pages, 0, sizeof(pages));
+    page_count = 0;
+    memset(free_lists, 0, sizeof(free_lists));
+    fl_bitmap = 0;
+    memset(sl_bitmap, 0, sizeof(sl_bitmap));
+    free_bytes = 0;
+    free_blocks = 0;
+    arena_used = 0;
+}
+
+/* Walk every page and check headers, footers, flags and counters. */
+static int heap_verify(void)
+{
+    uint32_t i, seen_free = 0, seen_blocks = 0;
+
+    for (i = 0; i < page_count; i++) {
+        uint8_t *base = pages[i].base;
+        uint32_t *hdr = (uint32_t *)base;
+        int prev_free = 0;
+
+        while (block_size(hdr) != 0) {
+            uint32_t sz = block_size(hdr);
+            if (((*hdr & BLOCK_PREV_FREE) != 0) != prev_free) {
+                fprintf(stderr, "page %u: bad PREV_FREE at +%ld\n", i, (long)((uint8_t *)hdr - base));
+                return -1;
+            }
+            if (*hdr & BLOCK_FREE) {
+                if (prev_free) {
+                    fprintf(stderr, "page %u: adjacent free blocks at +%ld\n", i, (long)((uint8_t *)hdr - base));
+                    return -1;
+                }
+                if (*(uint32_t *)((uint8_t *)hdr + sz - sizeof(uint32_t)) != sz) {
+                    fprintf(stderr, "page %u: bad footer at +%ld\n", i, (long)((uint8_t *)hdr - base));
+                    return -1;
+                }
+                seen_free += sz;
+                seen_blocks++;
+            }
+            prev_free = (*hdr & BLOCK_FREE) != 0;
+            hdr = block_next(hdr);
+            if ((uint8_t *)hdr > base + pages[i].capacity) {
+                fprintf(stderr, "page %u: block runs past the end\n", i);
+                return -1;
+            }
+        }
+    }
+    if ((seen_free != free_bytes) || (seen_blocks != free_blocks)) {
+        fprintf(stderr, "free accounting mismatch: %u/%u bytes, %u/%u blocks\n",
+                seen_free, free_bytes, seen_blocks, free_blocks);
+        return -1;
+    }
+    return 0;
+}
+
+struct op {
+    char type;
+    uint16_t id;
+    uint32_t size;
+};
+
+static struct op ops[MAX_OPS];
+static int n_ops;
+
+static void emit(char type, int id, uint32_t size)
+{
+    if (n_ops < MAX_OPS) {
+        ops[n_ops].type = type;
+        ops[n_ops].id = (uint16_t)id;
+        ops[n_ops].size = size;
+        n_ops++;
+    }
+}
+
+static uint32_t rnd_range(uint32_t lo, uint32_t hi)
+{
+    return lo + rnd() % (hi - lo + 1);
+}
+
+/* Long-lived fnodes and names, with a short-lived tail: what boot and
+ * mounting filesystems look like. */
+static void gen_boot(void)
+{
+    int i;
+
+    for (i = 0; i < 600; i++) {
+        emit('a', i, rnd_range(40, 96));
+        if ((i % 3) == 0)
+            emit('a', 1000 + i, rnd_range(8, 32));
+        if ((i % 5) == 0)
+            emit('f', 1000 + i - 3 * (i % 2), 0);
+    }
+}
+
+/* Packet buffers and socket control blocks, freed roughly in FIFO
+ * order with a few stragglers. */
+static void gen_net(void)
+{
+    int i, head = 0;
+
+    for (i = 0; i < 20000; i++) {
+        int id = i % 64;
+        if (i >= 64)
+            emit('f', id, 0);
+        emit('a', id, (rnd() & 1) ? 1536 : rnd_range(60, 300));
+        if ((i % 97) == 0) {
+            emit('f', 100 + head, 0);
+            emit('a', 100 + head, rnd_range(200, 600));
+            head = (head + 1) % 32;
+        }
+    }
+}
+
+/* Arrays grown one element at a time through krealloc (heap.h), with
+ * small allocations interleaved. */
+static void gen_grow(void)
+{
+    int i, j;
+
+    for (j = 0; j < 8; j++) {
+        for (i = 1; i <= 200; i++) {
+            emit('r', j, 12 * i + 8);
+            if ((i % 10) == 0)
+                emit('a', 100 + (j * 20) + i / 10, rnd_range(16, 64));
+        }
+    }
+    for (j = 0; j < 8; j++)
+        emit('f', j, 0);
+}
+
+/* Uniform random sizes, random frees: worst case for fragmentation. */
+static void gen_random(void)
+{
+    static uint8_t live[200];
+    int i;
+
+    memset(live, 0, sizeof(live));
+    for (i = 0; i < 50000; i++) {
+        int id = rnd() % 200;
+        if (live[id]) {
+            if (rnd() % 4 == 0)
+                emit('r', id, rnd_range(8, 2048));
+            else {
+                emit('f', id, 0);
+                live[id] = 0;
+            }
+        } else {
+            emit('a', id, rnd_range(8, 2048));
+            live[id] = 1;
+        }
+    }
+}
+
+static int load_trace(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[64];
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char type;
+        unsigned id, size = 0;
+        if (sscanf(line, " %c %u %u", &type, &id, &size) < 2)
+            continue;
+        if ((type != 'a' && type != 'r' && type != 'f') || id >= MAX_IDS)
+            continue;
+        emit(type, id, size);
+    }
+    fclose(f);
+    return 0;
+}
+
+struct lat {
+    uint64_t n;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+static void lat_add(struct lat *l, uint64_t ns)
+{
+    l->n++;
+    l->total_ns += ns;
+    if (ns > l->max_ns)
+        l->max_ns = ns;
+}
+
+static void lat_print(const char *name, const struct lat *l)
+{
+    if (!l->n)
+        return;
+    printf("    %-8s %8llu ops  avg %5llu ns  max %6llu ns\n", name,
+           (unsigned long long)l->n,
+           (unsigned long long)(l->total_ns / l->n),
+           (unsigned long long)l->max_ns);
+}
+
+static int replay(const char *name)
+{
+    static void *ptrs[MAX_IDS];
+    static uint32_t sizes[MAX_IDS];
+    struct lat la = {0}, lr = {0}, lf = {0};
+    struct kalloc_stats st;
+    uint64_t live = 0, peak = 0;
+    uint32_t failed = 0, worst_frag = 0;
+    int i;
+
+    heap_reset();
+    memset(ptrs, 0, sizeof(ptrs));
+    memset(sizes, 0, sizeof(sizes));
+
+    for (i = 0; i < n_ops; i++) {
+        struct op *o = &ops[i];
+        uint64_t t0, t1;
+        void *p;
+
+        switch (o->type) {
+        case 'a':
+            if (ptrs[o->id])
+                continue;
+            t0 = now_ns();
+            p = kalloc(o->size);
+            t1 = now_ns();
+            lat_add(&la, t1 - t0);
+            if (!p) {
+                failed++;
+                continue;
+            }
+            memset(p, o->id & 0xFF, o->size);
+            ptrs[o->id] = p;
+            sizes[o->id] = o->size;
+            live += o->size;
+            break;
+        case 'r':
+            t0 = now_ns();
+            p = krealloc(ptrs[o->id], o->size);
+            t1 = now_ns();
+            lat_add(&lr, t1 - t0);
+            if (!p) {
+                failed++;
+                continue;
+            }
+            live -= sizes[o->id];
+            ptrs[o->id] = p;
+            sizes[o->id] = o->size;
+            live += o->size;
+            break;
+        case 'f':
+            if (!ptrs[o->id])
+                continue;
+            t0 = now_ns();
+            kfree(ptrs[o->id]);
+            t1 = now_ns();
+            lat_add(&lf, t1 - t0);
+            live -= sizes[o->id];
+            ptrs[o->id] = NULL;
+            sizes[o->id] = 0;
+            break;
+        }
+        if (live > peak)
+            peak = live;
+        if ((i & 0xFF) == 0) {
+            kalloc_get_stats(&st);
+            if (st.free_bytes && (st.free_bytes > 4096)) {
+                uint32_t frag = 100 - (uint32_t)((uint64_t)st.largest_free * 100 / st.free_bytes);
+                if (frag > worst_frag)
+                    worst_frag = frag;
+            }
+        }
+    }
+
+    kalloc_get_stats(&st);
+    printf("%s: %d ops\n", name, n_ops);
+    lat_print("kalloc", &la);
+    lat_print("krealloc", &lr);
+    lat_print("kfree", &lf);
+    printf("    heap %u bytes in %u pages, peak live %llu bytes, failed %u\n",
+           st.heap_bytes, st.pages, (unsigned long long)peak, failed);
+    printf("    end: %u bytes free in %u blocks, largest %u, fragmentation %u%% (worst %u%%)\n",
+           st.free_bytes, st.free_blocks, st.largest_free,
+           st.free_bytes ? 100 - (uint32_t)((uint64_t)st.largest_free * 100 / st.free_bytes) : 0,
+           worst_frag);
+
+    for (i = 0; i < MAX_IDS; i++) {
+        if (ptrs[i])
+            kfree(ptrs[i]);
+    }
+    if (heap_verify() < 0) {
+        fprintf(stderr, "%s: heap corrupted\n", name);
+        return -1;
+    }
+    kalloc_get_stats(&st);
+    if (st.free_blocks != st.pages) {
+        fprintf(stderr, "%s: %u free blocks left after freeing everything (%u pages)\n",
+                name, st.free_blocks, st.pages);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        void (*gen)(void);
+    } traces[] = {
+        { "boot", gen_boot },
+        { "net", gen_net },
+        { "grow", gen_grow },
+        { "random", gen_random },
+    };
+    unsigned i;
+    int ret = 0;
+
+    if (argc > 1) {
+        n_ops = 0;
+        if (load_trace(argv[1]) < 0)
+            return 1;
+        return replay(argv[1]) < 0;
+    }
+    for (i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+        n_ops = 0;
+        traces[i].gen();
+        if (replay(traces[i].name) < 0)
+            ret = 1;
+    }
+    return ret;
+}
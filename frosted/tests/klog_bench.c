@@ -0,0 +1,378 @@
+/*
+ * Host test and microbenchmark for the binary kernel log ring
+ * (klog_ring.c).
+ *
+ * Checks:
+ *   format   mixed kprintf() calls, read back in random-sized chunks
+ *            (klogd reads 31 bytes at a time), must match snprintf()
+ *            of the same calls; strings in "RAM" are overwritten right
+ *            after the call to check they were copied
+ *   overrun  a full ring drops new records and reports how many
+ *   rate     the rate limit drops info messages but not errors
+ *   irq      kprintf() from a SIGALRM handler interrupting kprintf() and
+ *            the reader at random points: no record is torn, each
+ *            writer's records come out in order, and records read plus
+ *            records reported lost add up to records written
+ *
+ * Then the cost of a kprintf() call against formatting the same message
+ * on the spot with snprintf(), and of a call filtered out by level.
+ *
+ * Build with -no-pie: records keep pointers as 32-bit words, so format
+ * strings must sit below 4 GB as they do on the target.
+ *
+ * Usage: klog_bench [ops]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "bench.h"
+
+#define CONFIG_KLOG 1
+#define CONFIG_KLOG_SIZE 2048
+
+volatile unsigned int jiffies;
+
+/* Strings the test overwrites after logging them: the "RAM" of the target */
+static char dyn[64];
+#define KLOG_IN_ROM(p) (!((uintptr_t)(p) >= (uintptr_t)dyn && \
+            (uintptr_t)(p) < (uintptr_t)dyn + sizeof(dyn)))
+
+static volatile unsigned long notifications;
+
+void klog_notify(void)
+{
+    notifications++;
+}
+
+#include "../klog_ring.c"
+
+static char *expect, *got;
+static size_t expect_len, got_len, buf_size;
+static int expect_bol = 1;
+
+static void bench_reset(void)
+{
+    memset(klog_ring, 0, sizeof(klog_ring));
+    klog_head = klog_tail = 0;
+    klog_records = klog_overruns = klog_ratelimited = klog_hwm = 0;
+    klog_lost_seen = 0;
+    klog_line_len = klog_line_off = 0;
+    klog_bol = 1;
+    klog_level = KLOG_INFO;
+    klog_set_rate(0);
+    expect_len = got_len = 0;
+    expect_bol = 1;
+}
+
+static void expect_add(const char *fmt, ...)
+{
+    char line[KLOG_LINE_MAX];
+    va_list ap;
+    int n;
+
+    if (expect_bol)
+        expect_len += (size_t)sprintf(expect + expect_len, "[%5u.%03u] ",
+                jiffies / 1000, jiffies % 1000);
+    va_start(ap, fmt);
+    n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    memcpy(expect + expect_len, line, (size_t)n);
+    expect_len += (size_t)n;
+    expect_bol = (n > 0 && line[n - 1] == '\n');
+}
+
+static void drain(uint32_t chunk)
+{
+    int n;
+
+    do {
+        if (got_len + chunk > buf_size) {
+            fprintf(stderr, "output buffer full\n");
+            exit(1);
+        }
+        n = klog_ring_read(got + got_len, chunk);
+        got_len += (size_t)n;
+    } while (n > 0);
+}
+
+static void set_dyn(uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+        dyn[i] = (char)('a' + rnd() % 26);
+    dyn[len] = '\0';
+}
+
+static void emit(int kind)
+{
+    uint32_t a = rnd(), b = rnd(), c = rnd();
+    int sa = (int)(rnd() % 2000) - 1000;
+
+    switch (kind) {
+    case 0:
+        kprintf("boot: %d tasks, %u free\n", sa, a);
+        expect_add("boot: %d tasks, %u free\n", sa, a);
+        break;
+    case 1:
+        kprintf("[devspi] TX timeout bus=%u base=0x%08lx i=%lu chunk=%lu sr=0x%08lx cr1=0x%08lx cr2=0x%08lx\n",
+                a % 3, (unsigned long)b, (unsigned long)(c % 100), (unsigned long)(a % 512),
+                (unsigned long)(b & 0xFF), (unsigned long)c, (unsigned long)(a ^ b));
+        expect_add("[devspi] TX timeout bus=%u base=0x%08lx i=%lu chunk=%lu sr=0x%08lx cr1=0x%08lx cr2=0x%08lx\n",
+                a % 3, (unsigned long)b, (unsigned long)(c % 100), (unsigned long)(a % 512),
+                (unsigned long)(b & 0xFF), (unsigned long)c, (unsigned long)(a ^ b));
+        break;
+    case 2:
+        set_dyn(1 + rnd() % 20);
+        kprintf("xipfs: exec %s (%s) pid %d\n", dyn, "bin", sa);
+        expect_add("xipfs: exec %s (%s) pid %d\n", dyn, "bin", sa);
+        memset(dyn, 'X', sizeof(dyn) - 1);
+        break;
+    case 3:
+        kprintf("partial: %3d|%-4d|%04X|%c", sa % 100, (int)(a % 100), b & 0xFFFF,
+                'A' + (int)(c % 26));
+        expect_add("partial: %3d|%-4d|%04X|%c", sa % 100, (int)(a % 100), b & 0xFFFF,
+                'A' + (int)(c % 26));
+        break;
+    case 4:
+        kprintf(" end\n");
+        expect_add(" end\n");
+        break;
+    case 5:
+        kprintf("neg %d %5d %-6d| %x %X\n", sa, sa % 100, -(int)(a % 1000), a, b);
+        expect_add("neg %d %5d %-6d| %x %X\n", sa, sa % 100, -(int)(a % 1000), a, b);
+        break;
+    case 6:
+        klog(KLOG_DEBUG, "debug %u\n", a);
+        break;
+    case 7:
+        set_dyn(40);
+        kprintf("name %s.\n", dyn);
+        expect_add("name %.31s.\n", dyn);
+        memset(dyn, 'X', sizeof(dyn) - 1);
+        break;
+    case 8:
+        kprintf("%s and %s: %u%%\n", (char *)NULL, "flash", a % 101);
+        expect_add("%s and %s: %u%%\n", (char *)NULL, "flash", a % 101);
+        break;
+    }
+}
+
+static int check_format(int ops)
+{
+    struct klog_stats st;
+    int n;
+
+    bench_reset();
+    for (n = 0; n < ops; n++) {
+        jiffies += rnd() % 50;
+        emit((int)(rnd() % 9));
+        klog_get_stats(&st);
+        if (rnd() % 4 == 0 || st.used > CONFIG_KLOG_SIZE / 2)
+            drain(1 + rnd() % 64);
+    }
+    drain(31);
+    if (klog_overruns || got_len != expect_len || memcmp(got, expect, got_len) != 0) {
+        size_t i;
+        for (i = 0; i < got_len && i < expect_len && got[i] == expect[i]; i++)
+            ;
+        fprintf(stderr, "format: output differs at byte %zu (overruns %u)\n", i, klog_overruns);
+        fprintf(stderr, "  got:    %.60s\n  expect: %.60s\n", got + i, expect + i);
+        return -1;
+    }
+    printf("format: %d calls, %zu bytes of text, OK\n", ops, got_len);
+    return 0;
+}
+
+static int check_overrun(void)
+{
+    char line[64];
+    uint32_t i, stored;
+
+    bench_reset();
+    for (i = 0; i < 500; i++)
+        kprintf("fill %u\n", i);
+    stored = klog_records;
+    if (stored == 0 || klog_overruns != 500 - stored)
+        return -1;
+    for (i = 0; i < stored; i++)
+        expect_add("fill %u\n", i);
+    expect_add("klog: %u messages lost\n", 500 - stored);
+    drain(31);
+    if (got_len != expect_len || memcmp(got, expect, got_len) != 0)
+        return -1;
+    /* Reported once only */
+    if (klog_ring_read(line, sizeof(line)) != 0)
+        return -1;
+    printf("overrun: %u of 500 stored, %u reported lost, OK\n", stored, klog_overruns);
+    return 0;
+}
+
+static int check_rate(void)
+{
+    uint32_t i;
+
+    bench_reset();
+    jiffies = 5000;
+    klog_set_rate(10);
+    for (i = 0; i < 50; i++)
+        kprintf("info %u\n", i);
+    for (i = 0; i < 5; i++)
+        klog(KLOG_ERR, "err %u\n", i);
+    if (klog_records != 15 || klog_ratelimited != 40)
+        return -1;
+    jiffies += 1024;
+    for (i = 0; i < 50; i++)
+        kprintf("info %u\n", i);
+    if (klog_records != 25 || klog_ratelimited != 80)
+        return -1;
+    drain(64);
+    printf("rate: 10/s, 25 of 110 stored, 80 dropped, OK\n");
+    return 0;
+}
+
+static volatile uint32_t irq_written;
+
+static void irq_handler(int sig)
+{
+    (void)sig;
+    kprintf("irq %u\n", irq_written);
+    irq_written++;
+}
+
+static int check_irq(int ops)
+{
+    struct itimerval it;
+    uint32_t main_written, seen_main = 0, seen_irq = 0, lost = 0;
+    long last_main = -1, last_irq = -1;
+    char *p, *end;
+
+    bench_reset();
+    jiffies = 0;
+    signal(SIGALRM, irq_handler);
+    memset(&it, 0, sizeof(it));
+    it.it_interval.tv_usec = 20;
+    it.it_value.tv_usec = 20;
+    setitimer(ITIMER_REAL, &it, NULL);
+    for (main_written = 0; main_written < (uint32_t)ops * 50; main_written++) {
+        kprintf("main %u\n", main_written);
+        /* A reader slower than the writers, so that the ring overflows */
+        if (main_written % 8 == 0)
+            got_len += (size_t)klog_ring_read(got + got_len, 1 + rnd() % 96);
+    }
+    memset(&it, 0, sizeof(it));
+    setitimer(ITIMER_REAL, &it, NULL);
+    signal(SIGALRM, SIG_DFL);
+    drain(64);
+
+    got[got_len] = '\0';
+    for (p = got; p < got + got_len; p = end + 1) {
+        unsigned long v;
+        end = strchr(p, '\n');
+        if (!end || strncmp(p, "[    0.000] ", 12) != 0)
+            goto bad;
+        *end = '\0';
+        p += 12;
+        if (sscanf(p, "main %lu", &v) == 1) {
+            if ((long)v <= last_main)
+                goto bad;
+            last_main = (long)v;
+            seen_main++;
+        } else if (sscanf(p, "irq %lu", &v) == 1) {
+            if ((long)v <= last_irq)
+                goto bad;
+            last_irq = (long)v;
+            seen_irq++;
+        } else if (sscanf(p, "klog: %lu messages lost", &v) == 1) {
+            lost += (uint32_t)v;
+        } else {
+            goto bad;
+        }
+    }
+    if (seen_main + seen_irq + lost != main_written + irq_written) {
+        fprintf(stderr, "irq: %u + %u read, %u lost, %u written\n", seen_main, seen_irq,
+                lost, main_written + irq_written);
+        return -1;
+    }
+    printf("irq: %u task + %u handler records, %u lost to overruns, OK\n",
+           seen_main, seen_irq, lost);
+    return 0;
+bad:
+    fprintf(stderr, "irq: bad line \"%.40s\"\n", p);
+    return -1;
+}
+
+static void bench(int ops)
+{
+    char line[KLOG_LINE_MAX];
+    uint64_t t0 = 0, t_log = 0, t_read = 0, t_fmt, t_skip;
+    uint32_t i, n = (uint32_t)ops * 250;
+    size_t bytes = 0;
+
+    bench_reset();
+    for (i = 0; i < n; i++) {
+        if (i % 32 == 0) {
+            t0 = now_ns();
+            while (klog_ring_read(line, sizeof(line)) > 0)
+                ;
+            t_read += now_ns() - t0;
+            t0 = now_ns();
+        }
+        kprintf("flashfs: page %u, sector %u of %u free\n", i, i >> 4, 256u);
+        if (i % 32 == 31)
+            t_log += now_ns() - t0;
+    }
+    t0 = now_ns();
+    for (i = 0; i < n; i++)
+        bytes += (size_t)snprintf(line, sizeof(line), "[%5u.%03u] flashfs: page %u, sector %u of %u free\n",
+                jiffies / 1000, jiffies % 1000, i, i >> 4, 256u);
+    t_fmt = now_ns() - t0;
+    t0 = now_ns();
+    for (i = 0; i < n; i++)
+        klog(KLOG_DEBUG, "flashfs: page %u, sector %u of %u free\n", i, i >> 4, 256u);
+    t_skip = now_ns() - t0;
+
+    printf("cost per message (3 args, %u calls, %zu bytes of text):\n", n, bytes / n);
+    printf("  kprintf() into the ring    %6.1f ns\n", (double)t_log / n);
+    printf("  snprintf() at the call     %6.1f ns\n", (double)t_fmt / n);
+    printf("  reader formatting          %6.1f ns\n", (double)t_read / n);
+    printf("  filtered by level          %6.1f ns\n", (double)t_skip / n);
+}
+
+int main(int argc, char *argv[])
+{
+    int ops = 20000;
+
+    if (argc > 1)
+        ops = atoi(argv[1]);
+    if (ops < 100)
+        ops = 100;
+    buf_size = (size_t)ops * 50 * 24 + (1 << 20);
+    expect = malloc(buf_size);
+    got = malloc(buf_size + 1);
+    if (!expect || !got)
+        return 1;
+
+    if (check_format(ops) != 0)
+        return 1;
+    if (check_overrun() != 0) {
+        fprintf(stderr, "overrun: check failed\n");
+        return 1;
+    }
+    if (check_rate() != 0) {
+        fprintf(stderr, "rate: check failed\n");
+        return 1;
+    }
+    if (check_irq(ops) != 0)
+        return 1;
+    bench(ops);
+    return 0;
+}
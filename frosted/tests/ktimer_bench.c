@@ -0,0 +1,152 @@
+/*
+ * Host microbenchmark for the ktimer heap (include/heap.h).
+ *
+ * For increasing numbers of concurrent timers, measures the throughput
+ * of insert, cancel-by-id and expire (pop in deadline order), the three
+ * operations behind ktimer_add(), ktimer_del() and the ktimer tasklet.
+ * Ordering and id validity are checked along the way.
+ *
+ * Usage: ktimer_bench [max-timers]
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_RND_SEED 0x9E3779B9
+#include "bench.h"
+
+static inline void *krealloc(void *ptr, uint32_t size)
+{
+    return realloc(ptr, size);
+}
+
+static inline void *kcalloc(uint32_t nmemb, uint32_t size)
+{
+    return calloc(nmemb, size);
+}
+
+static inline void kfree(void *ptr)
+{
+    free(ptr);
+}
+
+#include "../include/heap.h"
+
+typedef struct ktimer {
+    uint32_t expire_time;
+    void *arg;
+    void (*handler)(uint32_t time, void *arg);
+} ktimer;
+
+DECLARE_HEAP(ktimer, expire_time);
+
+static void report(const char *op, int n, uint64_t ns)
+{
+    printf("    %-7s %7d ops  %6.1f ns/op  %6.2f Mops/s\n", op, n,
+           (double)ns / n, ns ? (n * 1000.0) / (double)ns : 0.0);
+}
+
+static int run(int n, uint32_t jiffies)
+{
+    heap_ktimer *h = heap_init();
+    int *ids = malloc(n * sizeof(int));
+    struct ktimer t, prev;
+    uint64_t t0;
+    int i, cancelled = 0, expired = 0;
+
+    if (!h || !ids)
+        return -1;
+    memset(&t, 0, sizeof(t));
+
+    printf("%d timers (jiffies base %08x):\n", n, jiffies);
+    t0 = now_ns();
+    for (i = 0; i < n; i++) {
+        t.expire_time = jiffies + (rnd() % 60000);
+        t.arg = (void *)(uintptr_t)i;
+        ids[i] = heap_insert(h, &t);
+        if (ids[i] < 0) {
+            fprintf(stderr, "insert %d failed\n", i);
+            return -1;
+        }
+    }
+    report("insert", n, now_ns() - t0);
+
+    /* Cancel every other timer, in random order */
+    for (i = n - 1; i > 0; i--) {
+        int j = rnd() % (i + 1);
+        int tmp = ids[i];
+        ids[i] = ids[j];
+        ids[j] = tmp;
+    }
+    t0 = now_ns();
+    for (i = 0; i < n; i += 2) {
+        if (heap_delete(h, ids[i]) != 0) {
+            fprintf(stderr, "cancel of id %d failed\n", ids[i]);
+            return -1;
+        }
+        cancelled++;
+    }
+    report("cancel", cancelled, now_ns() - t0);
+
+    /* A stale id must not cancel anything */
+    if ((n > 1) && (heap_delete(h, ids[0]) == 0)) {
+        fprintf(stderr, "stale id %d accepted\n", ids[0]);
+        return -1;
+    }
+
+    t0 = now_ns();
+    while (heap_peek(h, &t) == 0) {
+        if (expired && HEAP_BEFORE(t.expire_time, prev.expire_time)) {
+            fprintf(stderr, "out of order: %u after %u\n", t.expire_time, prev.expire_time);
+            return -1;
+        }
+        prev = t;
+        expired++;
+    }
+    report("expire", expired, now_ns() - t0);
+    if (expired + cancelled != n) {
+        fprintf(stderr, "%d expired + %d cancelled != %d\n", expired, cancelled, n);
+        return -1;
+    }
+
+    /* Steady state: sleep/poll style add+del pairs on a loaded heap */
+    for (i = 0; i < n; i++) {
+        t.expire_time = jiffies + (rnd() % 60000);
+        ids[i] = heap_insert(h, &t);
+    }
+    t0 = now_ns();
+    for (i = 0; i < n; i++) {
+        int id;
+        t.expire_time = jiffies + (rnd() % 1000);
+        id = heap_insert(h, &t);
+        if (heap_delete(h, id) != 0) {
+            fprintf(stderr, "add/del pair failed\n");
+            return -1;
+        }
+    }
+    report("add+del", n, now_ns() - t0);
+
+    heap_destroy(h);
+    free(ids);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int max = 16384;
+    int n;
+
+    if (argc > 1)
+        max = atoi(argv[1]);
+    for (n = 256; n <= max; n *= 4) {
+        if (run(n, 0x1000) < 0)
+            return 1;
+    }
+    /* Deadlines straddling the 32-bit jiffies wrap */
+    if (run(max, 0xFFFFFFFFu - 30000) < 0)
+        return 1;
+    return 0;
+}
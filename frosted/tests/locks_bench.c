@@ -0,0 +1,678 @@
+/*
+ * Host simulation of kernel mutexes and semaphores (locks.c).
+ *
+ * A tick-driven model of the scheduler runs scripted tasks: each tick
+ * the most urgent runnable task (lowest level, inherited priority
+ * included; round robin among equals) executes one step of its script.
+ * Lock operations are syscalls: one returning SYS_CALL_AGAIN puts the
+ * task to sleep and is restarted from scratch once it is resumed, and
+ * a task leaving a syscall awake drops its wait entry, as
+ * task_waitq_release() does.
+ *
+ * Checks:
+ *   inversion  L holds a mutex H wants while M hogs the CPU: with
+ *              priority inheritance H waits for L's critical section
+ *              only, without it for all of M
+ *   chain      H waits on a mutex held by a task that waits on one
+ *              held by L: the boost must reach L
+ *   order      waiters take a released mutex by priority, then in
+ *              arrival order
+ *   wake-one   each sem_post() wakes a single waiter
+ *   abandon    a waiter woken by sem_post() and interrupted before it
+ *              retries passes the wakeup on
+ *   timeout    sem_wait() with a deadline gives up on time, and still
+ *              takes a post that comes first
+ *
+ * Then equal priority tasks contending on one mutex (wakeups, and
+ * wakeups lost to a task that took the mutex first), and the cost of
+ * uncontended operations on the host.
+ *
+ * Usage: locks_bench [iterations]
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+/* Kernel types used by locks.c, as in frosted.h */
+struct task;
+struct waitq_entry;
+typedef void (*waitq_func)(struct waitq_entry *e, uint16_t events);
+
+struct waitq {
+    struct waitq_entry *head;
+};
+
+struct waitq_entry {
+    struct waitq *wq;
+    struct waitq_entry *next;
+    struct task *task;
+    waitq_func func;
+    uint16_t events;
+    uint16_t ready;
+};
+
+typedef struct semaphore sem_t;
+typedef struct semaphore mutex_t;
+
+#define WQ_LOCK 0x8000
+#define WQ_HUP  0x0010
+#define SYS_CALL_AGAIN (-1024)
+
+volatile unsigned int jiffies;
+
+enum { T_IDLE, T_RUN, T_WAIT, T_DONE };
+
+enum { OP_END, OP_LOCK, OP_UNLOCK, OP_WORK, OP_WAIT, OP_TWAIT, OP_POST, OP_LOOP };
+
+struct op {
+    int code;
+    int arg;        /* lock index, ticks or loop count */
+};
+
+struct task {
+    const char *name;
+    int prio;               /* base level: lower is more urgent */
+    const struct op *op;
+    unsigned arrive;
+    /* Run state, cleared by reset() */
+    int pi;                 /* 1 + inherited level, 0: none */
+    int held;               /* mutexes owned */
+    int state;
+    struct waitq_entry wait;
+    unsigned timer;         /* timeout deadline, 0: none */
+    int timed_out;
+    int pc;
+    int left;               /* OP_WORK: ticks left, OP_TWAIT: deadline */
+    int iter;
+    int result;
+    unsigned last_run;
+    unsigned done_at;
+    int woken;
+    unsigned long wakeups;
+    unsigned long spurious;
+    unsigned long blocked;
+    unsigned long acquired;
+};
+
+static struct task *cur;
+static int pi_enabled = 1;
+static unsigned tick;
+
+struct task *this_task(void)
+{
+    return cur;
+}
+
+int task_ptr_valid(const void *ptr)
+{
+    (void)ptr;
+    return 0;
+}
+
+void kfree(void *ptr)
+{
+    (void)ptr;
+}
+
+int task_is_live(struct task *t, uint16_t pid)
+{
+    (void)pid;
+    return t && (t->state != T_DONE);
+}
+
+int task_prio(struct task *t)
+{
+    int lvl = t->prio;
+
+    if (t->pi && (t->pi - 1 < lvl))
+        lvl = t->pi - 1;
+    return lvl;
+}
+
+void task_prio_inherit(struct task *t, int prio)
+{
+    if (pi_enabled && t)
+        t->pi = (prio < 0) ? 0 : prio + 1;
+}
+
+int task_prio_boosted(struct task *t)
+{
+    return t && (t->pi != 0);
+}
+
+int task_mutex_held(struct task *t, int delta)
+{
+    if (!t)
+        return 0;
+    t->held += delta;
+    if (t->held < 0)
+        t->held = 0;
+    return t->held;
+}
+
+struct waitq *task_waiting_on(struct task *t)
+{
+    if (!t || (t->state != T_WAIT))
+        return NULL;
+    if (!(t->wait.events & WQ_LOCK) || t->wait.ready)
+        return NULL;
+    return t->wait.wq;
+}
+
+void task_resume(struct task *t)
+{
+    if (t && (t->state == T_WAIT)) {
+        t->state = T_RUN;
+        t->woken = 1;
+        t->wakeups++;
+    }
+}
+
+void task_resume_lock(struct task *t)
+{
+    task_resume(t);
+}
+
+/* waitq_add/del/flush, as in vfs.c */
+void waitq_del(struct waitq_entry *e);
+
+void waitq_add(struct waitq *wq, struct waitq_entry *e)
+{
+    if (e->wq != wq) {
+        if (e->wq)
+            waitq_del(e);
+        e->wq = wq;
+        e->next = wq->head;
+        wq->head = e;
+    }
+    e->ready = 0;
+}
+
+void waitq_del(struct waitq_entry *e)
+{
+    struct waitq_entry **pp;
+
+    if (!e->wq)
+        return;
+    for (pp = &e->wq->head; *pp; pp = &(*pp)->next) {
+        if (*pp == e) {
+            *pp = e->next;
+            break;
+        }
+    }
+    e->wq = NULL;
+    e->next = NULL;
+}
+
+void waitq_flush(struct waitq *wq)
+{
+    struct waitq_entry *e;
+
+    while ((e = wq->head) != NULL) {
+        wq->head = e->next;
+        e->wq = NULL;
+        e->next = NULL;
+        e->ready |= WQ_HUP;
+        task_resume(e->task);
+    }
+}
+
+int task_waitq_sleep_timeout(struct waitq *wq, uint16_t events, int timeout_ms)
+{
+    struct waitq_entry *e = &cur->wait;
+
+    if ((timeout_ms > 0) && !cur->timer)
+        cur->timer = jiffies + (unsigned)timeout_ms;
+    e->task = cur;
+    e->func = NULL;
+    e->events = events;
+    waitq_add(wq, e);
+    cur->state = T_WAIT;
+    return SYS_CALL_AGAIN;
+}
+
+int task_timed_out(void)
+{
+    if (!cur->timed_out)
+        return 0;
+    cur->timed_out = 0;
+    return 1;
+}
+
+void task_timeout_cancel(void)
+{
+    cur->timer = 0;
+    cur->timed_out = 0;
+}
+
+#include "../locks.c"
+
+#define NLOCKS 2
+
+static mutex_t *mtx[NLOCKS];
+static sem_t sems[NLOCKS];
+static int in_cs[NLOCKS];
+static int order[16];
+static int n_order;
+static int errors;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, __VA_ARGS__); \
+        fputc('\n', stderr); \
+        errors++; \
+    } \
+} while (0)
+
+/* The task leaves the kernel: see task_waitq_release() */
+static void syscall_exit(struct task *t)
+{
+    struct waitq *wq = t->wait.wq;
+
+    if ((t->state == T_WAIT) || !wq)
+        return;
+    waitq_del(&t->wait);
+    if ((t->wait.events & WQ_LOCK) && t->wait.ready)
+        lock_waiter_abandon(wq);
+}
+
+/* A signal: the pending syscall fails with EINTR */
+static void interrupt(struct task *t)
+{
+    if (t->state == T_WAIT)
+        t->state = T_RUN;
+    t->result = -EINTR;
+    t->pc++;
+    syscall_exit(t);
+}
+
+static void step(struct task *t, struct task *ts)
+{
+    const struct op *op = &t->op[t->pc];
+    struct timespec ts_abs;
+    int r = 0;
+
+    cur = t;
+    t->last_run = tick;
+    switch (op->code) {
+    case OP_WORK:
+        if (t->left == 0)
+            t->left = op->arg;
+        if (--t->left == 0)
+            t->pc++;
+        break;
+    case OP_LOCK:
+        r = mutex_lock(mtx[op->arg]);
+        if (r == 0) {
+            CHECK(++in_cs[op->arg] == 1, "%s: mutex %d taken twice", t->name, op->arg);
+            t->acquired++;
+            if (n_order < 16)
+                order[n_order++] = (int)(t - ts);
+            t->pc++;
+        }
+        break;
+    case OP_UNLOCK:
+        in_cs[op->arg]--;
+        r = mutex_unlock(mtx[op->arg]);
+        CHECK(r == 0, "%s: unlock returned %d", t->name, r);
+        t->pc++;
+        break;
+    case OP_WAIT:
+        r = sem_wait(&sems[op->arg], NULL);
+        if (r == 0) {
+            t->acquired++;
+            t->pc++;
+        }
+        break;
+    case OP_TWAIT:
+        if (t->left == 0)
+            t->left = (int)jiffies + op->arg;
+        ts_abs.tv_sec = t->left / 1000;
+        ts_abs.tv_nsec = (t->left % 1000) * 1000000L;
+        r = sem_wait(&sems[0], &ts_abs);
+        if (r != SYS_CALL_AGAIN) {
+            t->result = r;
+            t->left = 0;
+            t->pc++;
+        }
+        break;
+    case OP_POST:
+        r = sem_post(&sems[op->arg]);
+        CHECK(r == 0, "%s: sem_post returned %d", t->name, r);
+        t->pc++;
+        break;
+    case OP_LOOP:
+        if (++t->iter < op->arg)
+            t->pc = 0;
+        else
+            t->pc++;
+        break;
+    case OP_END:
+        t->state = T_DONE;
+        t->done_at = tick;
+        break;
+    }
+    if (r == SYS_CALL_AGAIN) {
+        if (t->woken)
+            t->spurious++;
+        else
+            t->blocked++;
+    } else if (r < 0 && (op->code != OP_TWAIT)) {
+        CHECK(0, "%s: op %d returned %d", t->name, op->code, r);
+    }
+    t->woken = 0;
+    syscall_exit(t);
+    cur = NULL;
+}
+
+static void reset(struct task *ts, int n)
+{
+    int i;
+
+    for (i = 0; i < NLOCKS; i++) {
+        if (mtx[i])
+            mutex_destroy(mtx[i]);
+        mtx[i] = mutex_init();
+        sem_init(&sems[i], 0);
+        in_cs[i] = 0;
+    }
+    for (i = 0; i < n; i++) {
+        memset(&ts[i].pi, 0, sizeof(struct task) - offsetof(struct task, pi));
+        ts[i].state = T_IDLE;
+    }
+    n_order = 0;
+    tick = 0;
+    jiffies = 1000;
+}
+
+/* Run until every task is done or 'ticks' have passed. Returns the
+ * number of tasks still not done. */
+static int run(struct task *ts, int n, unsigned ticks)
+{
+    unsigned end = tick + ticks;
+    struct task *t, *best;
+    int i, live;
+
+    for (; tick < end; tick++, jiffies++) {
+        best = NULL;
+        live = 0;
+        for (i = 0; i < n; i++) {
+            t = &ts[i];
+            if ((t->state == T_IDLE) && (t->arrive <= tick))
+                t->state = T_RUN;
+            if ((t->state == T_WAIT) && t->timer && (jiffies >= t->timer)) {
+                t->timer = 0;
+                t->timed_out = 1;
+                task_resume(t);
+            }
+            if (t->state != T_DONE)
+                live++;
+            if (t->state != T_RUN)
+                continue;
+            if (!best || (task_prio(t) < task_prio(best)) ||
+                    ((task_prio(t) == task_prio(best)) && (t->last_run < best->last_run)))
+                best = t;
+        }
+        if (!live)
+            break;
+        if (best)
+            step(best, ts);
+    }
+    live = 0;
+    for (i = 0; i < n; i++)
+        live += (ts[i].state != T_DONE);
+    return live;
+}
+
+/* Priority inversion: returns H's latency */
+static const struct op inv_l[] = { { OP_LOCK, 0 }, { OP_WORK, 10 }, { OP_UNLOCK, 0 }, { OP_END, 0 } };
+static const struct op inv_m[] = { { OP_WORK, 200 }, { OP_END, 0 } };
+static const struct op inv_h[] = { { OP_LOCK, 0 }, { OP_WORK, 1 }, { OP_UNLOCK, 0 }, { OP_END, 0 } };
+
+static unsigned inversion(int pi)
+{
+    struct task ts[3] = {
+        { .name = "L", .prio = 20, .op = inv_l, .arrive = 0 },
+        { .name = "M", .prio = 10, .op = inv_m, .arrive = 3 },
+        { .name = "H", .prio = 0, .op = inv_h, .arrive = 2 },
+    };
+
+    pi_enabled = pi;
+    reset(ts, 3);
+    CHECK(run(ts, 3, 1000) == 0, "inversion: tasks stuck");
+    CHECK(ts[0].pi == 0, "inversion: L kept an inherited priority");
+    pi_enabled = 1;
+    return ts[2].done_at - ts[2].arrive;
+}
+
+static const struct op ch_l[] = { { OP_LOCK, 0 }, { OP_WORK, 20 }, { OP_UNLOCK, 0 }, { OP_END, 0 } };
+static const struct op ch_mid[] = { { OP_LOCK, 1 }, { OP_LOCK, 0 }, { OP_WORK, 2 }, { OP_UNLOCK, 0 },
+    { OP_UNLOCK, 1 }, { OP_END, 0 } };
+static const struct op ch_h[] = { { OP_LOCK, 1 }, { OP_WORK, 1 }, { OP_UNLOCK, 1 }, { OP_END, 0 } };
+static const struct op ch_hog[] = { { OP_WORK, 300 }, { OP_END, 0 } };
+
+static unsigned chain(int pi)
+{
+    struct task ts[4] = {
+        { .name = "L", .prio = 20, .op = ch_l, .arrive = 0 },
+        { .name = "Mid", .prio = 10, .op = ch_mid, .arrive = 1 },
+        { .name = "H", .prio = 0, .op = ch_h, .arrive = 3 },
+        { .name = "hog", .prio = 5, .op = ch_hog, .arrive = 4 },
+    };
+    int boosted;
+
+    pi_enabled = pi;
+    reset(ts, 4);
+    run(ts, 4, 6);
+    boosted = task_prio(&ts[0]);
+    CHECK(run(ts, 4, 1000) == 0, "chain: tasks stuck");
+    if (pi)
+        CHECK(boosted == 0, "chain: L runs at level %d, not H's", boosted);
+    CHECK(ts[0].pi == 0 && ts[1].pi == 0, "chain: inherited priority left behind");
+    pi_enabled = 1;
+    return ts[2].done_at - ts[2].arrive;
+}
+
+/* Each waiter blocks before the next one arrives */
+static const struct op ord_holder[] = { { OP_LOCK, 0 }, { OP_WORK, 50 }, { OP_UNLOCK, 0 }, { OP_END, 0 } };
+static const struct op ord_waiter[] = { { OP_LOCK, 0 }, { OP_WORK, 1 }, { OP_UNLOCK, 0 }, { OP_END, 0 } };
+
+static void wake_order(void)
+{
+    struct task ts[6] = {
+        { .name = "holder", .prio = 30, .op = ord_holder, .arrive = 0 },
+        { .name = "w5a", .prio = 5, .op = ord_waiter, .arrive = 1 },
+        { .name = "w5b", .prio = 5, .op = ord_waiter, .arrive = 4 },
+        { .name = "w1a", .prio = 1, .op = ord_waiter, .arrive = 7 },
+        { .name = "w9", .prio = 9, .op = ord_waiter, .arrive = 10 },
+        { .name = "w1b", .prio = 1, .op = ord_waiter, .arrive = 13 },
+    };
+    static const int expect[6] = { 0, 3, 5, 1, 2, 4 };
+    int i;
+
+    reset(ts, 6);
+    CHECK(run(ts, 6, 1000) == 0, "order: tasks stuck");
+    CHECK(n_order == 6, "order: %d acquisitions", n_order);
+    for (i = 0; i < 6 && i < n_order; i++)
+        CHECK(order[i] == expect[i], "order: acquisition %d by %s, expected %s", i,
+              ts[order[i]].name, ts[expect[i]].name);
+    printf("order:     ");
+    for (i = 0; i < n_order; i++)
+        printf(" %s", ts[order[i]].name);
+    printf("\n");
+}
+
+static const struct op wo_waiter[] = { { OP_WAIT, 0 }, { OP_END, 0 } };
+static const struct op wo_poster[] = { { OP_POST, 0 }, { OP_WORK, 2 }, { OP_POST, 0 }, { OP_WORK, 2 },
+    { OP_POST, 0 }, { OP_WORK, 2 }, { OP_POST, 0 }, { OP_WORK, 2 }, { OP_POST, 0 }, { OP_END, 0 } };
+
+static void wake_one(void)
+{
+    struct task ts[6];
+    unsigned long wakeups = 0, spurious = 0;
+    int i;
+
+    memset(ts, 0, sizeof(ts));
+    for (i = 0; i < 5; i++) {
+        ts[i].name = "waiter";
+        ts[i].prio = 5;
+        ts[i].op = wo_waiter;
+    }
+    ts[5].name = "poster";
+    ts[5].prio = 10;
+    ts[5].op = wo_poster;
+    ts[5].arrive = 2;
+    reset(ts, 6);
+    CHECK(run(ts, 6, 1000) == 0, "wake-one: tasks stuck");
+    for (i = 0; i < 5; i++) {
+        wakeups += ts[i].wakeups;
+        spurious += ts[i].spurious;
+    }
+    CHECK(wakeups == 5 && spurious == 0, "wake-one: %lu wakeups, %lu spurious for 5 posts",
+          wakeups, spurious);
+    CHECK(sems[0].value == 0 && !sems[0].wq.head, "wake-one: semaphore left dirty");
+    printf("wake-one:   5 posts, %lu wakeups, %lu spurious\n", wakeups, spurious);
+}
+
+static void abandon(void)
+{
+    struct task ts[2] = {
+        { .name = "A", .prio = 1, .op = wo_waiter },
+        { .name = "B", .prio = 2, .op = wo_waiter },
+    };
+
+    reset(ts, 2);
+    run(ts, 2, 5);
+    CHECK(ts[0].state == T_WAIT && ts[1].state == T_WAIT, "abandon: waiters not asleep");
+    sem_post(&sems[0]);
+    CHECK(ts[0].state == T_RUN && ts[1].state == T_WAIT, "abandon: post did not wake A alone");
+    interrupt(&ts[0]);
+    CHECK(ts[1].state == T_RUN, "abandon: wakeup not passed on to B");
+    run(ts, 2, 10);
+    CHECK(ts[0].result == -EINTR && ts[1].acquired == 1, "abandon: B did not take the post");
+    CHECK(sems[0].value == 0 && !sems[0].wq.head, "abandon: semaphore left dirty");
+    printf("abandon:    OK\n");
+}
+
+static const struct op to_waiter[] = { { OP_TWAIT, 30 }, { OP_END, 0 } };
+static const struct op to_poster[] = { { OP_POST, 0 }, { OP_END, 0 } };
+
+static void timeout(void)
+{
+    struct task ts[2] = {
+        { .name = "waiter", .prio = 1, .op = to_waiter },
+        { .name = "poster", .prio = 5, .op = to_poster, .arrive = 1000 },
+    };
+
+    reset(ts, 1);
+    run(ts, 1, 100);
+    CHECK(ts[0].result == -ETIMEDOUT, "timeout: returned %d", ts[0].result);
+    CHECK(ts[0].done_at >= 30 && ts[0].done_at <= 32, "timeout: gave up at tick %u",
+          ts[0].done_at);
+    CHECK(!sems[0].wq.head, "timeout: waiter left on the queue");
+    ts[1].arrive = 10;
+    reset(ts, 2);
+    run(ts, 2, 100);
+    CHECK(ts[0].result == 0 && ts[0].done_at < 30, "timeout: post missed, returned %d",
+          ts[0].result);
+    CHECK(ts[0].timer == 0, "timeout: timer left armed");
+    printf("timeout:    OK\n");
+}
+
+#define CONT_TASKS 8
+
+static void contention(int iterations)
+{
+    const struct op script[] = { { OP_LOCK, 0 }, { OP_WORK, 3 }, { OP_UNLOCK, 0 }, { OP_WORK, 5 },
+        { OP_LOOP, iterations }, { OP_END, 0 } };
+    struct task ts[CONT_TASKS];
+    unsigned long acquired = 0, blocked = 0, wakeups = 0, spurious = 0;
+    int i;
+
+    memset(ts, 0, sizeof(ts));
+    for (i = 0; i < CONT_TASKS; i++) {
+        ts[i].name = "worker";
+        ts[i].prio = 5;
+        ts[i].op = script;
+    }
+    reset(ts, CONT_TASKS);
+    CHECK(run(ts, CONT_TASKS, 100u * iterations * CONT_TASKS) == 0, "contention: tasks stuck");
+    for (i = 0; i < CONT_TASKS; i++) {
+        acquired += ts[i].acquired;
+        blocked += ts[i].blocked;
+        wakeups += ts[i].wakeups;
+        spurious += ts[i].spurious;
+    }
+    CHECK(acquired == (unsigned long)iterations * CONT_TASKS, "contention: %lu acquisitions",
+          acquired);
+    CHECK(wakeups <= blocked + spurious, "contention: %lu wakeups for %lu sleeps", wakeups,
+          blocked + spurious);
+    printf("contention: %d tasks x %d: %lu sleeps, %lu wakeups (%.2f per sleep), "
+           "%lu lost to barging, %u ticks\n", CONT_TASKS, iterations, blocked + spurious,
+           wakeups, (blocked + spurious) ? (double)wakeups / (blocked + spurious) : 0.0,
+           spurious, tick);
+}
+
+static void uncontended(int n)
+{
+    struct task t = { .name = "solo", .prio = 5, .state = T_RUN };
+    uint64_t t0, t1, t2;
+    int i;
+
+    reset(&t, 0);
+    cur = &t;
+    t0 = now_ns();
+    for (i = 0; i < n; i++) {
+        mutex_lock(mtx[0]);
+        mutex_unlock(mtx[0]);
+    }
+    t1 = now_ns();
+    for (i = 0; i < n; i++) {
+        sem_post(&sems[0]);
+        sem_trywait(&sems[0]);
+    }
+    t2 = now_ns();
+    cur = NULL;
+    printf("uncontended (host): mutex lock+unlock %.1f ns, sem post+trywait %.1f ns\n",
+           (double)(t1 - t0) / n, (double)(t2 - t1) / n);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = 200;
+    unsigned with, without;
+
+    if (argc > 1)
+        iterations = atoi(argv[1]);
+    if (iterations < 10)
+        iterations = 10;
+
+    with = inversion(1);
+    without = inversion(0);
+    printf("inversion:  H latency %u ticks with inheritance, %u without\n", with, without);
+    CHECK(with <= 16, "inversion: H waited %u ticks for a 10 tick critical section", with);
+    CHECK(without >= 200, "inversion: not reproduced without inheritance (%u)", without);
+
+    with = chain(1);
+    without = chain(0);
+    printf("chain:      H latency %u ticks with inheritance, %u without\n", with, without);
+    CHECK(with <= 36, "chain: H waited %u ticks", with);
+
+    wake_order();
+    wake_one();
+    abandon();
+    timeout();
+    contention(iterations);
+    uncontended(iterations * 10000);
+
+    if (errors) {
+        fprintf(stderr, "%d check(s) failed\n", errors);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Host benchmark for the pipe data path (cirbuf.c).
+ *
+ * A producer and a consumer alternate on one circular buffer, the way
+ * a writer and a reader share a pipe, and push a known byte pattern
+ * through it. Three strategies are compared:
+ *   byte      cirbuf_writebyte()/cirbuf_readbyte() loops (old pipe path)
+ *   bulk      cirbuf_writebytes()/cirbuf_readbytes() (memcpy, two segments)
+ *   splice    cirbuf_transfer() between two buffers (pipe to pipe)
+ * Every byte received is checked against the pattern.
+ *
+ * Usage: pipe_bench [megabytes]
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+static inline void *kalloc(uint32_t size)
+{
+    return malloc(size);
+}
+
+static inline void kfree(void *ptr)
+{
+    free(ptr);
+}
+
+#include "../cirbuf.c"
+
+#define MAX_CHUNK 4096
+
+/* The pattern repeats every PATTERN_PERIOD bytes: the data at stream
+ * offset 'off' is pat[off % PATTERN_PERIOD] onwards, so sending and
+ * checking are a pointer offset and a memcmp. */
+#define PATTERN_PERIOD 251
+
+static uint8_t pat[MAX_CHUNK + PATTERN_PERIOD];
+static uint8_t dst[MAX_CHUNK];
+
+static const uint8_t *pattern_at(uint64_t off)
+{
+    return pat + (off % PATTERN_PERIOD);
+}
+
+static int check(const uint8_t *buf, uint64_t off, int len)
+{
+    if (memcmp(buf, pattern_at(off), len) != 0) {
+        fprintf(stderr, "mismatch in [%llu, %llu)\n", (unsigned long long)off,
+                (unsigned long long)off + len);
+        return -1;
+    }
+    return 0;
+}
+
+static int write_byte(struct cirbuf *cb, const uint8_t *buf, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (cirbuf_writebyte(cb, buf[i]) != 0)
+            break;
+    }
+    return i;
+}
+
+static int read_byte(struct cirbuf *cb, uint8_t *buf, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (cirbuf_readbyte(cb, &buf[i]) != 0)
+            break;
+    }
+    return i;
+}
+
+static int write_bulk(struct cirbuf *cb, const uint8_t *buf, int len)
+{
+    return cirbuf_writebytes(cb, buf, len);
+}
+
+static int read_bulk(struct cirbuf *cb, uint8_t *buf, int len)
+{
+    int ret = cirbuf_readbytes(cb, buf, len);
+
+    return (ret < 0) ? 0 : ret;
+}
+
+static void report(const char *label, int bufsize, int chunk, uint64_t bytes, uint64_t ns)
+{
+    printf("    %-7s buf %5d  chunk %5d  %8.1f MB/s\n", label, bufsize, chunk,
+           ns ? (double)bytes * 1000.0 / (double)ns : 0.0);
+}
+
+/* write(chunk) / read(chunk) pairs, like a writer and a reader taking
+ * turns on a pipe; short transfers are retried from where they stopped */
+static int run_rw(const char *label, int bufsize, int chunk, uint64_t total,
+        int (*wr)(struct cirbuf *, const uint8_t *, int),
+        int (*rd)(struct cirbuf *, uint8_t *, int))
+{
+    struct cirbuf *cb = cirbuf_create(bufsize);
+    uint64_t sent = 0, recvd = 0, t0;
+    int wpend = 0, n;
+
+    if (!cb)
+        return -1;
+    t0 = now_ns();
+    while (recvd < total) {
+        if (wpend == 0)
+            wpend = chunk;
+        n = wr(cb, pattern_at(sent), wpend);
+        wpend -= n;
+        sent += n;
+        n = rd(cb, dst, chunk);
+        if (check(dst, recvd, n) < 0)
+            return -1;
+        recvd += n;
+    }
+    report(label, bufsize, chunk, recvd, now_ns() - t0);
+    kfree(cb->buf);
+    kfree(cb);
+    return 0;
+}
+
+/* writer -> pipe A -> splice -> pipe B -> reader */
+static int run_splice(int bufsize, int chunk, uint64_t total)
+{
+    struct cirbuf *a = cirbuf_create(bufsize);
+    struct cirbuf *b = cirbuf_create(bufsize);
+    uint64_t sent = 0, recvd = 0, t0;
+    int wpend = 0, n;
+
+    if (!a || !b)
+        return -1;
+    t0 = now_ns();
+    while (recvd < total) {
+        if (wpend == 0)
+            wpend = chunk;
+        n = cirbuf_writebytes(a, pattern_at(sent), wpend);
+        wpend -= n;
+        sent += n;
+        cirbuf_transfer(b, a, chunk, 1);
+        n = read_bulk(b, dst, chunk);
+        if (check(dst, recvd, n) < 0)
+            return -1;
+        recvd += n;
+    }
+    report("splice", bufsize, chunk, recvd, now_ns() - t0);
+    kfree(a->buf);
+    kfree(a);
+    kfree(b->buf);
+    kfree(b);
+    return 0;
+}
+
+/* tee must leave the source untouched */
+static int check_tee(void)
+{
+    struct cirbuf *a = cirbuf_create(64);
+    struct cirbuf *b = cirbuf_create(64);
+    int n;
+
+    if (!a || !b)
+        return -1;
+    /* Force the readable region to wrap */
+    cirbuf_writebytes(a, pattern_at(0), 50);
+    cirbuf_readbytes(a, dst, 40);
+    cirbuf_writebytes(a, pattern_at(50), 40);
+    n = cirbuf_transfer(b, a, 64, 0);
+    if ((n != 50) || (cirbuf_bytesinuse(a) != 50)) {
+        fprintf(stderr, "tee: copied %d, %zu left in source\n", n, cirbuf_bytesinuse(a));
+        return -1;
+    }
+    if ((read_bulk(b, dst, 64) != 50) || (check(dst, 40, 50) < 0))
+        return -1;
+    if ((read_bulk(a, dst, 64) != 50) || (check(dst, 40, 50) < 0))
+        return -1;
+    kfree(a->buf);
+    kfree(a);
+    kfree(b->buf);
+    kfree(b);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const int bufsizes[] = { 64, 512, 4096 };
+    static const int chunks[] = { 16, 128, 1024, 4096 };
+    uint64_t total = 16ull << 20;
+    unsigned i, j;
+
+    for (i = 0; i < sizeof(pat); i++)
+        pat[i] = (uint8_t)(i % PATTERN_PERIOD);
+    if (argc > 1)
+        total = (uint64_t)atoi(argv[1]) << 20;
+    if (total == 0)
+        total = 1 << 20;
+
+    if (check_tee() < 0)
+        return 1;
+    for (i = 0; i < sizeof(bufsizes) / sizeof(bufsizes[0]); i++) {
+        printf("%d byte buffer, %llu MB:\n", bufsizes[i], (unsigned long long)(total >> 20));
+        for (j = 0; j < sizeof(chunks) / sizeof(chunks[0]); j++) {
+            if (run_rw("byte", bufsizes[i], chunks[j], total, write_byte, read_byte) < 0)
+                return 1;
+            if (run_rw("bulk", bufsizes[i], chunks[j], total, write_bulk, read_bulk) < 0)
+                return 1;
+            if (run_splice(bufsizes[i], chunks[j], total) < 0)
+                return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,2 @@
+/* Host build shim: blkcache.c includes "blkcache.h" by its short name */
+#include "../../include/blkcache.h"
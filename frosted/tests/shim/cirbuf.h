@@ -0,0 +1,2 @@
+/* Host build shim: cirbuf.c includes "cirbuf.h" by its short name */
+#include "../../include/cirbuf.h"
@@ -0,0 +1,8 @@
+/* Host build shim: stands in for frosted/include/config.h */
+#ifndef HOST_SHIM_CONFIG_H
+#define HOST_SHIM_CONFIG_H
+
+#define HEAP_SEGMENT_GRANULARITY 4096
+#define HEAP_SEGMENT_MIN_SIZE 8192
+
+#endif
@@ -0,0 +1,2 @@
+/* Host build shim: dcache.c includes "dcache.h" by its short name */
+#include "../../include/dcache.h"
@@ -0,0 +1,2 @@
+/* Host build shim: flashfs_index.c includes "flashfs_index.h" by its short name */
+#include "../../include/flashfs_index.h"
@@ -0,0 +1,2 @@
+/* Host build shim: flashfs_log.c includes "flashfs_log.h" by its short name */
+#include "../../include/flashfs_log.h"
@@ -0,0 +1,42 @@
+/* Host build shim: the minimal subset of frosted/include/frosted.h
+ * needed to compile kernel sources on the build machine.
+ */
+#ifndef HOST_SHIM_FROSTED_H
+#define HOST_SHIM_FROSTED_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+static inline uint32_t irq_save(void)
+{
+    return 0;
+}
+
+static inline void irq_restore(uint32_t state)
+{
+    (void)state;
+}
+
+/* Backing store for kernel heap pages, provided by each test */
+void *secure_mmap(size_t size, uint16_t task_id, uint32_t flags);
+void secure_munmap(void *addr, uint16_t task_id);
+
+static inline void task_mpu_invalidate(uint16_t pid)
+{
+    (void)pid;
+}
+
+static inline uint16_t this_task_getpid(void)
+{
+    return 1;
+}
+
+struct kalloc_stats {
+    uint32_t pages;
+    uint32_t heap_bytes;
+    uint32_t free_bytes;
+    uint32_t free_blocks;
+    uint32_t largest_free;
+};
+
+#endif
@@ -0,0 +1,2 @@
+/* Host build shim: wolfip.c includes "inet_csum.h" by its short name */
+#include "../../include/inet_csum.h"
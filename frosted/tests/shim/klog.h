@@ -0,0 +1,2 @@
+/* Host build shim: klog_ring.c includes "klog.h" by its short name */
+#include "../../include/klog.h"
@@ -0,0 +1,2 @@
+/* Host build shim: klog.h includes "kprintf.h" by its short name */
+#include "../../include/kprintf.h"
@@ -0,0 +1,2 @@
+/* Host build shim: locks.c includes "locks.h" by its short name */
+#include "../../include/locks.h"
@@ -0,0 +1,2 @@
+/* Host build shim: locks.c includes "pool.h" by its short name */
+#include "../../include/pool.h"
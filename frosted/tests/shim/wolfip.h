@@ -0,0 +1,2 @@
+/* Host build shim: wolfip.c includes "wolfip.h" by its short name */
+#include "../../include/wolfip.h"
@@ -0,0 +1,513 @@
+/*
+ * Host benchmark for wolfIP socket demultiplexing (wolfip.c).
+ *
+ * The stack is built with 255 TCP sockets on a raw IP test interface.
+ * Two listeners are opened and handshakes are completed against them
+ * until 200 sockets are open, then a pcap trace of segments addressed
+ * to the host is replayed: pure ACKs on random connections and a share
+ * of segments for unknown connections, which end on a listener port.
+ *
+ * For every packet, the sockets found through the demux hash tables
+ * are checked against a linear scan of the socket table with the
+ * predicate tcp_input() applies (what it used to do per segment), then
+ * both lookups are timed, and so is the whole input path through
+ * wolfIP_recv_ex(). Connections are also reset and re-opened to check
+ * that the tables follow close and accept.
+ *
+ * Without a trace argument, the trace is generated (and saved by -w).
+ * Packets of other pcap files are replayed as is: IPv4 TCP segments
+ * that match no socket take the listener or miss path.
+ *
+ * Usage: tcp_demux_bench [-w out.pcap] [trace.pcap] [rounds]
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+#define CONFIG_MAX_TCPSOCKETS 255
+#define CONFIG_MAX_UDPSOCKETS 8
+#define WOLFIP_BUF_ALLOC(sz) malloc(sz)
+#define WOLFIP_BUF_FREE(p) free(p)
+#include "../include/config.h"
+#include "../wolfip.c"
+
+#define HOST_IP 0x0A000001U     /* 10.0.0.1/8 */
+#define HOST_MASK 0xFF000000U
+#define OPEN_SOCKETS 200
+#define LISTEN_PORT_A 1883
+#define LISTEN_PORT_B 80
+#define TRACE_PACKETS 4096
+#define MISS_PERCENT 10
+#define CHURN 50
+
+#define PCAP_MAGIC 0xA1B2C3D4U
+#define PCAP_MAGIC_SWAPPED 0xD4C3B2A1U
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+
+struct pkt {
+    uint32_t len;               /* IP packet length */
+    uint8_t frame[ETH_HEADER_LEN + 64];
+};
+
+static struct wolfIP stack;
+static struct pkt *trace;
+static int trace_len;
+static int listen_fd[2];
+static int conn_fd[MAX_TCPSOCKETS];
+static int conn_count;
+static unsigned long tx_frames;
+
+uint32_t wolfIP_getrandom(void)
+{
+    return rnd();
+}
+
+static int test_poll(struct wolfIP_ll_dev *ll, void *buf, uint32_t len)
+{
+    (void)ll;
+    (void)buf;
+    (void)len;
+    return 0;
+}
+
+static int test_send(struct wolfIP_ll_dev *ll, void *buf, uint32_t len)
+{
+    (void)ll;
+    (void)buf;
+    tx_frames++;
+    return (int)len;
+}
+
+/* Builds an option-less IPv4/TCP segment in wire order */
+static void build_seg(struct pkt *p, ip4 src, uint16_t sport, uint16_t dport,
+        uint32_t seq, uint32_t ack, uint8_t flags)
+{
+    struct wolfIP_tcp_seg *tcp = (struct wolfIP_tcp_seg *)p->frame;
+    uint8_t ph[12];
+    uint16_t tcp_len = TCP_HEADER_LEN;
+    uint32_t sum;
+
+    memset(p->frame, 0, sizeof(p->frame));
+    p->len = IP_HEADER_LEN + TCP_HEADER_LEN;
+    tcp->ip.ver_ihl = 0x45;
+    tcp->ip.len = ee16((uint16_t)p->len);
+    tcp->ip.ttl = 64;
+    tcp->ip.proto = WI_IPPROTO_TCP;
+    tcp->ip.src = ee32(src);
+    tcp->ip.dst = ee32(HOST_IP);
+    tcp->ip.csum = inet_csum_fold(inet_csum_partial(&tcp->ip.ver_ihl, IP_HEADER_LEN, 0));
+    tcp->src_port = ee16(sport);
+    tcp->dst_port = ee16(dport);
+    tcp->seq = ee32(seq);
+    tcp->ack = ee32(ack);
+    tcp->hlen = TCP_HEADER_LEN << 2;
+    tcp->flags = flags;
+    tcp->win = ee16(0xFFFF);
+    memcpy(ph, &tcp->ip.src, 8);
+    ph[8] = 0;
+    ph[9] = WI_IPPROTO_TCP;
+    ph[10] = (uint8_t)(tcp_len >> 8);
+    ph[11] = (uint8_t)tcp_len;
+    sum = inet_csum_partial(ph, sizeof(ph), 0);
+    tcp->csum = inet_csum_fold(inet_csum_partial(&tcp->src_port, tcp_len, sum));
+}
+
+static void deliver(struct pkt *p)
+{
+    wolfIP_recv_ex(&stack, WOLFIP_PRIMARY_IF_IDX, p->frame + ETH_HEADER_LEN, p->len);
+}
+
+static int open_listener(uint16_t port)
+{
+    struct wolfIP_sockaddr_in sin;
+    int fd = wolfIP_sock_socket(&stack, AF_INET, IPSTACK_SOCK_STREAM, 0);
+
+    if (fd < 0)
+        return -1;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = ee16(port);
+    if (wolfIP_sock_bind(&stack, fd, (struct wolfIP_sockaddr *)&sin, sizeof(sin)) < 0 ||
+            wolfIP_sock_listen(&stack, fd, 1) < 0)
+        return -1;
+    return fd;
+}
+
+/* SYN, accept(), final ACK: one more ESTABLISHED socket */
+static int open_connection(int lfd, uint16_t lport)
+{
+    struct pkt p;
+    struct tsocket *t;
+    ip4 peer = 0x0A010000U | (rnd() & 0xFFFF);
+    uint16_t port = (uint16_t)(1024 + rnd() % 60000);
+    uint32_t isn = rnd();
+    int fd;
+
+    build_seg(&p, peer, port, lport, isn, 0, TCP_FLAG_SYN);
+    deliver(&p);
+    fd = wolfIP_sock_accept(&stack, lfd, NULL, NULL);
+    if (fd < 0)
+        return -1;
+    t = &stack.tcpsockets[SOCKET_UNMARK(fd)];
+    build_seg(&p, peer, port, lport, t->sock.tcp.ack, t->sock.tcp.snd_una + 1, TCP_FLAG_ACK);
+    deliver(&p);
+    if (t->sock.tcp.state != TCP_ESTABLISHED)
+        return -1;
+    conn_fd[conn_count++] = fd;
+    return 0;
+}
+
+static int open_connections(int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        int which = (int)(rnd() & 1);
+
+        if (open_connection(listen_fd[which], which ? LISTEN_PORT_B : LISTEN_PORT_A) < 0) {
+            fprintf(stderr, "handshake %d failed\n", conn_count);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* The demux tables must hold every open socket exactly once, each in
+ * the bucket its current state and tuple select */
+static int check_tables(void)
+{
+    static uint8_t seen[MAX_TCPSOCKETS];
+    struct tsocket *t;
+    unsigned int slot, expect;
+    int i;
+
+    memset(seen, 0, sizeof(seen));
+    for (slot = 0; slot < TCP_CONN_BUCKETS + PORT_BUCKETS; slot++) {
+        for (t = demux_head(stack.tcp_hash, stack.tcpsockets, slot); t;
+                t = demux_next(stack.tcpsockets, t)) {
+            i = (int)(t - stack.tcpsockets);
+            if (t->proto != WI_IPPROTO_TCP || seen[i]++) {
+                fprintf(stderr, "socket %d: stale or duplicate link\n", i);
+                return -1;
+            }
+            if (t->sock.tcp.state > TCP_LISTEN)
+                expect = tcp_conn_slot(t->src_port, t->dst_port, t->remote_ip);
+            else
+                expect = TCP_CONN_BUCKETS + port_slot(t->src_port);
+            if (slot != expect || t->hash_slot != slot + 1) {
+                fprintf(stderr, "socket %d: in bucket %u, expected %u\n", i, slot, expect);
+                return -1;
+            }
+        }
+    }
+    for (i = 0; i < MAX_TCPSOCKETS; i++) {
+        if ((stack.tcpsockets[i].proto == WI_IPPROTO_TCP) != (seen[i] == 1)) {
+            fprintf(stderr, "socket %d: not linked\n", i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Whether tcp_input() hands the segment to this socket */
+static int seg_matches(const struct tsocket *t, const struct wolfIP_tcp_seg *tcp)
+{
+    if (t->proto == 0 || t->S == NULL)
+        return 0;
+    if (t->src_port != ee16(tcp->dst_port))
+        return 0;
+    if (t->sock.tcp.state > TCP_LISTEN) {
+        if (t->dst_port != ee16(tcp->src_port) || t->remote_ip != ee32(tcp->ip.src))
+            return 0;
+        if (t->local_ip != IPADDR_ANY && t->local_ip != ee32(tcp->ip.dst))
+            return 0;
+    }
+    return 1;
+}
+
+/* Old lookup: scan the whole table. Returns a set digest and count. */
+static uint32_t lookup_linear(const struct wolfIP_tcp_seg *tcp, int *count)
+{
+    uint32_t digest = 0;
+    int i;
+
+    *count = 0;
+    for (i = 0; i < MAX_TCPSOCKETS; i++) {
+        if (seg_matches(&stack.tcpsockets[i], tcp)) {
+            digest += (uint32_t)(i + 1) * 0x9E3779B1U;
+            (*count)++;
+        }
+    }
+    return digest;
+}
+
+static uint32_t lookup_hash(const struct wolfIP_tcp_seg *tcp, int *count, int *walked)
+{
+    uint32_t digest = 0;
+    struct tsocket *t;
+
+    *count = 0;
+    *walked = 0;
+    for (t = tcp_demux_collect(&stack, tcp); t;
+            t = t->demux_next ? &stack.tcpsockets[t->demux_next - 1] : NULL) {
+        (*walked)++;
+        if (seg_matches(t, tcp)) {
+            digest += (uint32_t)(t - stack.tcpsockets + 1) * 0x9E3779B1U;
+            (*count)++;
+        }
+    }
+    return digest;
+}
+
+static int check_lookups(const char *when)
+{
+    int i, n_lin, n_hash, walked;
+    int hits = 0;
+
+    for (i = 0; i < trace_len; i++) {
+        const struct wolfIP_tcp_seg *tcp = (const struct wolfIP_tcp_seg *)trace[i].frame;
+        uint32_t d_lin = lookup_linear(tcp, &n_lin);
+        uint32_t d_hash = lookup_hash(tcp, &n_hash, &walked);
+
+        if (d_lin != d_hash || n_lin != n_hash) {
+            fprintf(stderr, "%s: packet %d matched %d sockets by scan, %d by hash\n",
+                    when, i, n_lin, n_hash);
+            return -1;
+        }
+        hits += n_hash;
+    }
+    printf("%s: %d packets, %d socket matches, scan and hash agree\n", when, trace_len, hits);
+    return 0;
+}
+
+static int trace_add(const uint8_t *ip, uint32_t len)
+{
+    static int cap;
+    struct pkt *p;
+
+    if (len < IP_HEADER_LEN + TCP_HEADER_LEN || (ip[0] >> 4) != 4 ||
+            ip[9] != WI_IPPROTO_TCP || (ip[0] & 0x0F) != 5)
+        return 0;
+    if (len > sizeof(p->frame) - ETH_HEADER_LEN)
+        len = sizeof(p->frame) - ETH_HEADER_LEN; /* headers are enough */
+    if (trace_len == cap) {
+        cap = cap ? 2 * cap : 1024;
+        trace = realloc(trace, cap * sizeof(struct pkt));
+        if (!trace)
+            return -1;
+    }
+    p = &trace[trace_len++];
+    memset(p->frame, 0, ETH_HEADER_LEN);
+    memcpy(p->frame + ETH_HEADER_LEN, ip, len);
+    p->len = len;
+    return 0;
+}
+
+static void generate_trace(void)
+{
+    struct pkt p;
+    int i;
+
+    for (i = 0; i < TRACE_PACKETS; i++) {
+        if ((int)(rnd() % 100) < MISS_PERCENT) {
+            uint16_t port = (rnd() & 1) ? LISTEN_PORT_B : LISTEN_PORT_A;
+
+            build_seg(&p, 0x0A020000U | (rnd() & 0xFFFF), (uint16_t)(1024 + rnd() % 60000),
+                      port, rnd(), rnd(), TCP_FLAG_ACK);
+        } else {
+            struct tsocket *t = &stack.tcpsockets[SOCKET_UNMARK(conn_fd[rnd() % conn_count])];
+
+            build_seg(&p, t->remote_ip, t->dst_port, t->src_port, t->sock.tcp.ack,
+                      t->sock.tcp.snd_una, TCP_FLAG_ACK);
+        }
+        trace_add(p.frame + ETH_HEADER_LEN, p.len);
+    }
+}
+
+static int pcap_write(const char *path)
+{
+    uint32_t hdr[6] = { PCAP_MAGIC, 0x00040002U, 0, 0, 65535, LINKTYPE_RAW };
+    FILE *f = fopen(path, "wb");
+    int i;
+
+    if (!f)
+        return -1;
+    fwrite(hdr, sizeof(hdr), 1, f);
+    for (i = 0; i < trace_len; i++) {
+        uint32_t rec[4] = { 0, (uint32_t)i, trace[i].len, trace[i].len };
+
+        fwrite(rec, sizeof(rec), 1, f);
+        fwrite(trace[i].frame + ETH_HEADER_LEN, trace[i].len, 1, f);
+    }
+    return fclose(f);
+}
+
+static uint32_t pcap32(uint32_t v, int swapped)
+{
+    return swapped ? __builtin_bswap32(v) : v;
+}
+
+static int pcap_read(const char *path)
+{
+    static uint8_t buf[65536];
+    uint32_t hdr[6], rec[4], len, linktype;
+    FILE *f = fopen(path, "rb");
+    int swapped;
+
+    if (!f || fread(hdr, sizeof(hdr), 1, f) != 1)
+        return -1;
+    if (hdr[0] != PCAP_MAGIC && hdr[0] != PCAP_MAGIC_SWAPPED)
+        return -1;
+    swapped = (hdr[0] == PCAP_MAGIC_SWAPPED);
+    linktype = pcap32(hdr[5], swapped);
+    if (linktype != LINKTYPE_ETHERNET && linktype != LINKTYPE_RAW)
+        return -1;
+    while (fread(rec, sizeof(rec), 1, f) == 1) {
+        len = pcap32(rec[2], swapped);
+        if (len > sizeof(buf) || fread(buf, len, 1, f) != 1)
+            break;
+        if (linktype == LINKTYPE_RAW) {
+            if (trace_add(buf, len) < 0)
+                return -1;
+        } else if (len > 14 && buf[12] == 0x08 && buf[13] == 0x00) {
+            if (trace_add(buf + 14, len - 14) < 0)
+                return -1;
+        }
+    }
+    fclose(f);
+    return trace_len > 0 ? 0 : -1;
+}
+
+static volatile uint32_t sink;
+
+static void bench(int rounds)
+{
+    uint64_t t0, ns_lin, ns_hash, ns_input;
+    unsigned long walked_total = 0;
+    int r, i, n, walked;
+    unsigned int slot, len, longest = 0, used = 0;
+    unsigned long packets = (unsigned long)rounds * trace_len;
+
+    for (slot = 0; slot < TCP_CONN_BUCKETS; slot++) {
+        struct tsocket *t = demux_head(stack.tcp_hash, stack.tcpsockets, slot);
+
+        for (len = 0; t; t = demux_next(stack.tcpsockets, t))
+            len++;
+        used += len ? 1 : 0;
+        longest = len > longest ? len : longest;
+    }
+    printf("%d open sockets, %u/%u connection buckets used, longest chain %u\n",
+           conn_count + 2, used, TCP_CONN_BUCKETS, longest);
+
+    t0 = now_ns();
+    for (r = 0; r < rounds; r++)
+        for (i = 0; i < trace_len; i++)
+            sink += lookup_linear((const struct wolfIP_tcp_seg *)trace[i].frame, &n);
+    ns_lin = now_ns() - t0;
+
+    t0 = now_ns();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < trace_len; i++) {
+            sink += lookup_hash((const struct wolfIP_tcp_seg *)trace[i].frame, &n, &walked);
+            walked_total += walked;
+        }
+    }
+    ns_hash = now_ns() - t0;
+
+    t0 = now_ns();
+    for (r = 0; r < rounds; r++)
+        for (i = 0; i < trace_len; i++)
+            deliver(&trace[i]);
+    ns_input = now_ns() - t0;
+
+    printf("  lookup, table scan   %8.1f ns/packet\n", (double)ns_lin / packets);
+    printf("  lookup, hash         %8.1f ns/packet  (%.2f sockets visited)\n",
+           (double)ns_hash / packets, (double)walked_total / packets);
+    printf("  full tcp input       %8.1f ns/packet  (%lu frames sent)\n",
+           (double)ns_input / packets, tx_frames);
+}
+
+int main(int argc, char *argv[])
+{
+    struct wolfIP_ll_dev *ll;
+    const char *wpath = NULL, *rpath = NULL;
+    int rounds = 200;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            wpath = argv[++i];
+        else if (strstr(argv[i], ".pcap"))
+            rpath = argv[i];
+        else
+            rounds = atoi(argv[i]);
+    }
+    if (rounds < 1)
+        rounds = 1;
+
+    wolfIP_init(&stack);
+    ll = wolfIP_getdev_ex(&stack, WOLFIP_PRIMARY_IF_IDX);
+    ll->non_ethernet = 1;
+    ll->poll = test_poll;
+    ll->send = test_send;
+    wolfIP_ipconfig_set_ex(&stack, WOLFIP_PRIMARY_IF_IDX, HOST_IP, HOST_MASK, 0);
+
+    listen_fd[0] = open_listener(LISTEN_PORT_A);
+    listen_fd[1] = open_listener(LISTEN_PORT_B);
+    if (listen_fd[0] < 0 || listen_fd[1] < 0) {
+        fprintf(stderr, "listen failed\n");
+        return 1;
+    }
+    if (open_connections(OPEN_SOCKETS - 2) < 0 || check_tables() < 0)
+        return 1;
+
+    if (rpath) {
+        if (pcap_read(rpath) < 0) {
+            fprintf(stderr, "%s: no IPv4 TCP packets or not a pcap file\n", rpath);
+            return 1;
+        }
+    } else {
+        generate_trace();
+    }
+    if (wpath && pcap_write(wpath) < 0) {
+        fprintf(stderr, "%s: write failed\n", wpath);
+        return 1;
+    }
+    if (check_lookups("setup") < 0)
+        return 1;
+
+    /* Reset some connections from the peer side, then open new ones in
+     * the freed slots */
+    for (i = 0; i < CHURN; i++) {
+        struct tsocket *t = &stack.tcpsockets[SOCKET_UNMARK(conn_fd[i])];
+        struct pkt p;
+
+        build_seg(&p, t->remote_ip, t->dst_port, t->src_port, t->sock.tcp.ack, 0, TCP_FLAG_RST);
+        deliver(&p);
+        if (t->proto != 0) {
+            fprintf(stderr, "connection %d not reset\n", i);
+            return 1;
+        }
+    }
+    memmove(conn_fd, conn_fd + CHURN, (conn_count - CHURN) * sizeof(conn_fd[0]));
+    conn_count -= CHURN;
+    if (check_tables() < 0 || check_lookups("after reset") < 0)
+        return 1;
+    if (open_connections(CHURN) < 0 || check_tables() < 0)
+        return 1;
+    if (!rpath) {
+        trace_len = 0;
+        generate_trace();
+    }
+    if (check_lookups("after re-open") < 0)
+        return 1;
+
+    bench(rounds);
+    return check_tables() < 0;
+}
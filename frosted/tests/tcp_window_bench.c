@@ -0,0 +1,213 @@
+/*
+ * Host benchmark for wolfIP TCP socket buffers (wolfip.c).
+ *
+ * One connection is opened over the loopback interface (127.0.0.1) and
+ * a known byte pattern is streamed through it, calling wolfIP_poll()
+ * between application reads and writes the way the stack thread does.
+ * Runs differ in the buffer sizes:
+ *   1 KB        SO_RCVBUF/SO_SNDBUF of 1 KB (the old static buffers)
+ *   16 KB       SO_RCVBUF/SO_SNDBUF of 16 KB
+ *   autotune    default 1 KB buffers, grown by autotuning
+ *   grow        1 KB buffers raised to 16 KB in the middle of the transfer
+ * The receive buffer is set on the listener and inherited by accept().
+ * Every byte received is checked against the pattern, and once all the
+ * sockets are closed no buffer memory may be left allocated.
+ *
+ * Usage: tcp_window_bench [megabytes]
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+#define CONFIG_RXBUF_MAX 16384
+#define CONFIG_TXBUF_MAX 16384
+#define WOLFIP_BUF_ALLOC(sz) malloc(sz)
+#define WOLFIP_BUF_FREE(p) free(p)
+#include "../include/config.h"
+#include "../wolfip.c"
+
+#define PORT 5001
+#define CHUNK 4096
+#define STALL_NS 2000000000ull
+
+/* See pipe_bench: the data at stream offset 'off' is
+ * pat[off % PATTERN_PERIOD] onwards */
+#define PATTERN_PERIOD 251
+
+struct run {
+    const char *label;
+    int rcvbuf, sndbuf;         /* 0: default size, autotuned */
+    int grow;                   /* raise both to 16 KB half way */
+};
+
+static struct wolfIP stack;
+static uint8_t pat[CHUNK + PATTERN_PERIOD];
+static uint8_t dst[CHUNK];
+static unsigned long frames;
+
+uint32_t wolfIP_getrandom(void)
+{
+    return rnd();
+}
+
+static const uint8_t *pattern_at(uint64_t off)
+{
+    return pat + (off % PATTERN_PERIOD);
+}
+
+static int count_send(struct wolfIP_ll_dev *ll, void *buf, uint32_t len)
+{
+    int ret = wolfIP_loopback_send(ll, buf, len);
+
+    if (ret > 0)
+        frames++;
+    return ret;
+}
+
+static int set_buf(int fd, int optname, int size)
+{
+    int ret = wolfIP_sock_setsockopt(&stack, fd, WOLFIP_SOL_SOCKET, optname, &size, sizeof(size));
+
+    if (ret < 0)
+        fprintf(stderr, "setsockopt(%d, %d): %d\n", optname, size, ret);
+    return ret;
+}
+
+static int get_buf(int fd, int optname)
+{
+    socklen_t len = sizeof(int);
+    int size = -1;
+
+    wolfIP_sock_getsockopt(&stack, fd, WOLFIP_SOL_SOCKET, optname, &size, &len);
+    return size;
+}
+
+static void poll_stack(void)
+{
+    wolfIP_poll(&stack, now_ns() / 1000000ull);
+}
+
+static int run_transfer(const struct run *r, uint64_t total)
+{
+    struct wolfIP_sockaddr_in sin;
+    uint64_t sent = 0, recvd = 0, t0, t_progress;
+    uint32_t peak_mem = 0;
+    int lfd, cfd, afd = -1, n, i;
+
+    wolfIP_init(&stack);
+    wolfIP_getdev_ex(&stack, WOLFIP_LOOPBACK_IF_IDX)->send = count_send;
+    frames = 0;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = ee16(PORT);
+    sin.sin_addr.s_addr = ee32(WOLFIP_LOOPBACK_IP);
+    lfd = wolfIP_sock_socket(&stack, AF_INET, IPSTACK_SOCK_STREAM, 0);
+    cfd = wolfIP_sock_socket(&stack, AF_INET, IPSTACK_SOCK_STREAM, 0);
+    if (lfd < 0 || cfd < 0)
+        return -1;
+    if ((r->rcvbuf && set_buf(lfd, WOLFIP_SO_RCVBUF, r->rcvbuf) < 0) ||
+            (r->sndbuf && set_buf(cfd, WOLFIP_SO_SNDBUF, r->sndbuf) < 0))
+        return -1;
+    if (wolfIP_sock_bind(&stack, lfd, (struct wolfIP_sockaddr *)&sin, sizeof(sin)) < 0 ||
+            wolfIP_sock_listen(&stack, lfd, 1) < 0)
+        return -1;
+
+    t0 = t_progress = now_ns();
+    while ((n = wolfIP_sock_connect(&stack, cfd, (struct wolfIP_sockaddr *)&sin, sizeof(sin))) != 0) {
+        if (n != -WOLFIP_EAGAIN || now_ns() - t0 > STALL_NS) {
+            fprintf(stderr, "%s: connect failed (%d)\n", r->label, n);
+            return -1;
+        }
+        poll_stack();
+        if (afd < 0)
+            afd = wolfIP_sock_accept(&stack, lfd, NULL, NULL);
+    }
+
+    t0 = now_ns();
+    while (recvd < total) {
+        poll_stack();
+        if (afd < 0) {
+            afd = wolfIP_sock_accept(&stack, lfd, NULL, NULL);
+            if (afd < 0)
+                afd = -1;
+        }
+        if (r->grow && sent >= total / 2) {
+            if (set_buf(cfd, WOLFIP_SO_SNDBUF, 16384) < 0 ||
+                    (afd >= 0 && set_buf(afd, WOLFIP_SO_RCVBUF, 16384) < 0))
+                return -1;
+        }
+        if (sent < total) {
+            n = wolfIP_sock_sendto(&stack, cfd, pattern_at(sent),
+                    (total - sent < CHUNK) ? (size_t)(total - sent) : CHUNK, 0, NULL, 0);
+            if (n > 0)
+                sent += (uint64_t)n;
+        }
+        if (afd >= 0) {
+            n = wolfIP_sock_recvfrom(&stack, afd, dst, CHUNK, 0, NULL, NULL);
+            if (n > 0) {
+                if (memcmp(dst, pattern_at(recvd), (size_t)n) != 0) {
+                    fprintf(stderr, "%s: data mismatch in [%llu, %llu)\n", r->label,
+                            (unsigned long long)recvd, (unsigned long long)recvd + n);
+                    return -1;
+                }
+                recvd += (uint64_t)n;
+                t_progress = now_ns();
+            }
+        }
+        if (stack.sockbuf_mem > peak_mem)
+            peak_mem = stack.sockbuf_mem;
+        if (now_ns() - t_progress > STALL_NS) {
+            fprintf(stderr, "%s: stalled after %llu bytes\n", r->label,
+                    (unsigned long long)recvd);
+            return -1;
+        }
+    }
+    t0 = now_ns() - t0;
+
+    printf("  %-9s rcvbuf %5d  sndbuf %5d  %8.1f MB/s  %6.0f frames/MB  peak %6u bytes\n",
+           r->label, get_buf(afd, WOLFIP_SO_RCVBUF), get_buf(cfd, WOLFIP_SO_SNDBUF),
+           t0 ? (double)recvd * 1000.0 / (double)t0 : 0.0,
+           (double)frames * (1 << 20) / (double)recvd, peak_mem);
+
+    for (i = 0; i < MAX_TCPSOCKETS; i++)
+        close_socket(&stack.tcpsockets[i]);
+    for (i = 0; i < MAX_UDPSOCKETS; i++)
+        close_socket(&stack.udpsockets[i]);
+    if (stack.sockbuf_mem != 0) {
+        fprintf(stderr, "%s: %u bytes of socket buffers leaked\n", r->label, stack.sockbuf_mem);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct run runs[] = {
+        { "1 KB", 1024, 1024, 0 },
+        { "16 KB", 16384, 16384, 0 },
+        { "autotune", 0, 0, 0 },
+        { "grow", 1024, 1024, 1 },
+    };
+    uint64_t total = 16ull << 20;
+    unsigned i;
+
+    for (i = 0; i < sizeof(pat); i++)
+        pat[i] = (uint8_t)(i % PATTERN_PERIOD);
+    if (argc > 1)
+        total = (uint64_t)atoi(argv[1]) << 20;
+    if (total == 0)
+        total = 1 << 20;
+
+    printf("loopback TCP transfer, %llu MB:\n", (unsigned long long)(total >> 20));
+    for (i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        if (run_transfer(&runs[i], total) < 0)
+            return 1;
+    }
+    return 0;
+}
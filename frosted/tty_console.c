@@ -22,6 +22,7 @@
 #include "device.h"
 #include <stdint.h>
 #include "framebuffer.h"
+#include "poll.h"
 
 #define KBD_PATH "/dev/kbd0"
 #define FBCON_PATH "/dev/fbcon"
@@ -38,6 +39,7 @@ static struct tty_console {
     struct fnode *fbcon;
     struct module *mod_kbd;
     struct module *mod_fbcon;
+    struct waitq_entry kbd_wait;
     uint16_t pid;
 } TTY;
 
@@ -105,12 +107,24 @@ static int tty_read(struct fnode *fno, void *buf, unsigned int len)
     return ret;
 }
 
+/* Keyboard readiness is forwarded to the tty0 wait queue */
+static void tty_kbd_event(struct waitq_entry *e, uint16_t events)
+{
+    if (TTY.dev && TTY.dev->fno)
+        fno_wake(TTY.dev->fno, events);
+}
+
 static int tty_poll(struct fnode *fno, uint16_t events, uint16_t *revents)
 {
     if (!TTY.kbd)
         TTY.kbd = fno_search(KBD_PATH);
     if (!TTY.kbd)
         return 0;
+    if (!TTY.kbd_wait.wq) {
+        TTY.kbd_wait.func = tty_kbd_event;
+        TTY.kbd_wait.events = POLLIN | POLLOUT;
+        waitq_add(&TTY.kbd->wq, &TTY.kbd_wait);
+    }
     return TTY.mod_kbd->ops.poll(TTY.kbd, events, revents);
 }
 
@@ -130,7 +130,6 @@ static void stm32_uart_clear_errors(stm32_usart_t *regs, uint32_t isr)
 static void stm32_uart_irq_handler(struct stm32_uart_port *port)
 {
     uint32_t isr;
-    struct task *waiting;
 
     if (!port || !port->regs)
         return;
@@ -138,19 +137,32 @@ static void stm32_uart_irq_handler(struct stm32_uart_port *port)
     isr = port->regs->ISR;
 
     if (isr & USART_ISR_RXFNE) {
-        uint8_t data = (uint8_t)port->regs->RDR;
-
-        if (cirbuf_writebyte(port->rxbuf, data) == 0) {
-            if (port->dev) {
-                waiting = port->dev->task;
-                if (waiting) {
-                    port->dev->task = NULL;
-                    task_resume(waiting);
-                }
-            }
-            if (data == 0x03 && port->sid > 1) {
+        struct cirbuf_seg seg[2];
+        int room, got = 0, brk = 0;
+
+        /* Drain everything the RX FIFO holds straight into the free
+         * region of the buffer, then publish it and wake readers once. */
+        room = cirbuf_peek_write(port->rxbuf, seg);
+        do {
+            uint8_t data = (uint8_t)port->regs->RDR;
+
+            if (got >= room)
+                continue;
+            if (got < seg[0].len)
+                seg[0].ptr[got] = data;
+            else
+                seg[1].ptr[got - seg[0].len] = data;
+            got++;
+            if (data == 0x03)
+                brk = 1;
+        } while (port->regs->ISR & USART_ISR_RXFNE);
+
+        if (got > 0) {
+            cirbuf_commit_write(port->rxbuf, got);
+            if (port->dev && port->dev->fno)
+                fno_wake(port->dev->fno, POLLIN);
+            if (brk && port->sid > 1)
                 tasklet_add(stm32_uart_break_tasklet, port);
-            }
         }
     } else {
         stm32_uart_clear_errors(port->regs, isr);
@@ -279,7 +291,6 @@ static int stm32_uart_read(struct fnode *fno, void *buf, unsigned int len)
 {
     struct stm32_uart_port *port;
     size_t len_available;
-    uint8_t *ptr = (uint8_t *)buf;
     int out = 0;
 
     if (!buf || len == 0)
@@ -292,21 +303,20 @@ static int stm32_uart_read(struct fnode *fno, void *buf, unsigned int len)
     mutex_lock(port->dev->mutex);
     len_available =  cirbuf_bytesinuse(port->rxbuf);
     if (len_available == 0) {
-        port->dev->task = this_task();
-        task_suspend();
-        out = SYS_CALL_AGAIN;
+        out = task_waitq_sleep(&fno->wq, POLLIN);
+        /* Bytes received after the check above but before we were on the
+         * queue found nobody to wake: now that we are, look again. */
+        if (cirbuf_bytesinuse(port->rxbuf) > 0)
+            fno_wake(fno, POLLIN);
         goto again;
     }
 
     if (len_available < len)
         len = (unsigned int)len_available;
 
-    for(out = 0; out < len; out++) {
-        /* read data */
-        if (cirbuf_readbyte(port->rxbuf, ptr) != 0)
-            break;
-        ptr++;
-    }
+    out = cirbuf_readbytes(port->rxbuf, buf, (int)len);
+    if (out < 0)
+        out = 0;
 
 again:
     mutex_unlock(port->dev->mutex);
@@ -324,7 +334,6 @@ static int stm32_uart_poll(struct fnode *fno, uint16_t events, uint16_t *revents
         return -ENODEV;
 
     mutex_lock(port->dev->mutex);
-    port->dev->task = this_task();
     if ((events & POLLIN) && cirbuf_bytesinuse(port->rxbuf) > 0) {
         *revents |= POLLIN;
         ready = 1;
@@ -380,9 +389,6 @@ static int stm32_uart_close(struct fnode *fno)
     if (!port)
         return -ENODEV;
 
-    mutex_lock(port->dev->mutex);
-    port->dev->task = NULL;
-    mutex_unlock(port->dev->mutex);
     return 0;
 }
 
@@ -458,7 +464,9 @@ int uart_create(const struct uart_config *cfg)
     }
     port->regs->ICR = 0xFFFFFFFFU;
     port->regs->RQR = 0;
-    port->regs->CR1 = USART_CR1_UE | USART_CR1_RE | USART_CR1_TE | USART_CR1_RXFNEIE;
+    /* FIFO mode: the RX interrupt drains several characters at once */
+    port->regs->CR1 = USART_CR1_UE | USART_CR1_RE | USART_CR1_TE | USART_CR1_RXFNEIE |
+        USART_CR1_FIFOEN;
 
     nvic_set_priority(port->irq, 1U << 5);
     nvic_clear_pending(port->irq);
@@ -99,6 +99,8 @@ static struct module mod_devusbnet = {
     .family = FAMILY_NETDEV,
     .name = "usb_net",
 };
+
+static void usb_net_task(void);
 #endif
 
 uint32_t tusb_time_millis_api(void) {
@@ -122,27 +124,24 @@ static void cdc_task(void) {
             if (tud_cdc_n_available(itf)) {
                 uint8_t buf[64];
                 uint32_t count = tud_cdc_n_read(itf, buf, sizeof(buf));
-                int i;
+                uint32_t i, start = 0;
                 struct dev_ttyusb *u = &DEV_TTYUSB[itf];
                 if (count == 0)
                     continue;
-                for (i = 0; i < count; i++) {
-                    char b = ((char *)buf)[i];
-                    /* Intercept ^C */
-                    if (b == 3) {
-                        if (u->sid > 1) {
-                            tasklet_add(ttyusb_send_break, &u->sid);
-                        }
+                mutex_lock(u->dev->mutex);
+                /* Copy the runs between ^C characters into the circular buffer */
+                for (i = 0; i <= count; i++) {
+                    if ((i < count) && (buf[i] != 3))
                         continue;
-                    }
-                    mutex_lock(u->dev->mutex);
-                    /* read data into circular buffer */
-                    cirbuf_writebyte(u->inbuf, b);
-                    mutex_unlock(u->dev->mutex);
-                    /* If a process is attached, resume the process */
-                    if (u->dev->task != NULL)
-                        task_resume(u->dev->task);
+                    if (i > start)
+                        cirbuf_writebytes(u->inbuf, buf + start, (int)(i - start));
+                    start = i + 1;
+                    /* Intercept ^C */
+                    if ((i < count) && (u->sid > 1))
+                        tasklet_add(ttyusb_send_break, &u->sid);
                 }
+                mutex_unlock(u->dev->mutex);
+                fno_wake(u->dev->fno, POLLIN);
             }
         }
     }
@@ -157,6 +156,9 @@ void usb_tasklet(void *arg) {
         tud_task(); // tinyusb device task
         tud_cdc_write_flush();
         cdc_task();
+#if CONFIG_USB_NET && CONFIG_TCPIP
+        usb_net_task();
+#endif
         last_poll = jiffies;
     }
     if (jiffies_reached(last_poll + 500U)) {
@@ -433,22 +435,21 @@ static void ttyusb_tx_drain(struct dev_ttyusb *u)
 
     avail = tud_cdc_n_write_available(u->itf);
     while (avail && cirbuf_bytesinuse(u->outbuf)) {
+        struct cirbuf_seg seg[2];
         uint32_t chunk, wrote;
-        uint8_t tmp[64];                 /* bounded copy is fine; loop if larger */
 
+        /* Hand the first contiguous segment to TinyUSB directly and
+         * consume only what it accepted */
         mutex_lock(u->dev->mutex);
-        chunk = cirbuf_bytesinuse(u->outbuf);   /* contiguous bytes available to read */
+        cirbuf_peek_read(u->outbuf, seg);
+        chunk = (uint32_t)seg[0].len;
         if (chunk > avail)
             chunk = avail;
-
-        /* temporary pointer to the linear span */
-        if (chunk > sizeof(tmp)) 
-            chunk = sizeof(tmp);
-        cirbuf_readbytes(u->outbuf, tmp, chunk);
+        wrote = tud_cdc_n_write(u->itf, seg[0].ptr, chunk);
+        cirbuf_commit_read(u->outbuf, (int)wrote);
         mutex_unlock(u->dev->mutex);
-
-        wrote = tud_cdc_n_write(u->itf, tmp, (uint32_t)chunk);
-        (void)wrote; /* TinyUSB's CDC write is all-or-less, but we handle loop */
+        if (wrote == 0)
+            break;
         avail = tud_cdc_n_write_available(u->itf);
     }
     sem_post(&sem_usb);
@@ -505,7 +506,6 @@ static int ttyusb_read(struct fnode *fno, void *buf, unsigned int len)
 {
     int out;
     size_t len_available;
-    char *ptr = (char *)buf;
     struct dev_ttyusb *ttyusb;
 
     if (len <= 0)
@@ -518,21 +518,16 @@ static int ttyusb_read(struct fnode *fno, void *buf, unsigned int len)
     mutex_lock(ttyusb->dev->mutex);
     len_available =  cirbuf_bytesinuse(ttyusb->inbuf);
     if (len_available == 0) {
-        ttyusb->dev->task = this_task();
-        task_suspend();
-        out = SYS_CALL_AGAIN;
+        out = task_waitq_sleep(&fno->wq, POLLIN);
         goto again;
     }
 
     if (len_available < len)
         len = (unsigned int)len_available;
 
-    for(out = 0; out < len; out++) {
-        /* read data */
-        if (cirbuf_readbyte(ttyusb->inbuf, ptr) != 0)
-            break;
-        ptr++;
-    }
+    out = cirbuf_readbytes(ttyusb->inbuf, buf, (int)len);
+    if (out < 0)
+        out = 0;
 
 again:
     mutex_unlock(ttyusb->dev->mutex);
@@ -548,7 +543,6 @@ static int ttyusb_poll(struct fnode *fno, uint16_t events, uint16_t *revents)
     if (!ttyusb)
         return -1;
 
-    ttyusb->dev->task = this_task();
     mutex_lock(ttyusb->dev->mutex);
     if ((events & POLLOUT) && (tud_cdc_n_write_available(ttyusb->itf) > 0)) {
         *revents |= POLLOUT;
@@ -581,7 +575,6 @@ static int ttyusb_fno_init(uint8_t itf)
     u->dev = device_fno_init(&mod_devttyusb, name, devfs, FL_TTY, u);
     u->inbuf = cirbuf_create(256);
     u->outbuf = cirbuf_create(512);
-    u->dev->task = NULL;
 
     return 0;
 }
@@ -634,17 +627,36 @@ int ttyusb_init(void)
 #if CONFIG_USB_NET && CONFIG_TCPIP
 #include "wolfip.h"
 
-/* Two static buffers for RX frames from USB host */
-__attribute__((section(".usb_tud"))) uint8_t tusb_net_rxbuf[LINK_MTU][2];
-uint8_t tusb_net_rxbuf_used[2] =  {0, 0};
-uint16_t tusb_net_rxbuf_size[2] = {0, 0};
-
-/* Two static buffers for TX frames to USB host */
-__attribute__((section(".usb_tud"))) uint8_t tusb_net_txbuf[LINK_MTU][4];
-uint16_t tusb_net_txbuf_sz[4] = {0, 0, 0, 0};
+/* Frames received from the host are queued in a byte ring, each entry a
+ * 16-bit length followed by the frame and padded to 4 bytes. The 2-byte
+ * length keeps the IP header word aligned. wolfIP parses the frames in
+ * place through rx_peek()/rx_release(), so every datagram is copied
+ * exactly once, out of the NTB. tud_network_recv_cb() is the only
+ * producer and the TCP/IP thread the only consumer.
+ */
+#ifndef CONFIG_USB_NET_RX_RING
+#define CONFIG_USB_NET_RX_RING 4096
+#endif
+#if (CONFIG_USB_NET_RX_RING & 3) || (CONFIG_USB_NET_RX_RING < 2 * (LINK_MTU + 4))
+#error "CONFIG_USB_NET_RX_RING must be a multiple of 4 and hold two full frames"
+#endif
+#define USB_NET_RX_HDR      2U
+#define USB_NET_RX_WRAP     0xFFFFU
+#define USB_NET_RX_ENTRY(sz) ((USB_NET_RX_HDR + (uint32_t)(sz) + 3U) & ~3U)
+
+static uint8_t usb_net_rx_ring[CONFIG_USB_NET_RX_RING] __attribute__((aligned(4)));
+static volatile uint32_t usb_net_rx_head;
+static volatile uint32_t usb_net_rx_tail;
+/* A datagram was refused because the ring was full: TinyUSB holds it
+ * until tud_network_recv_renew() is called again */
+static volatile uint8_t usb_net_rx_held;
+/* A frame did not fit in the NTBs: wake the stack when one is free */
+static volatile uint8_t usb_net_tx_blocked;
 
 static int ll_usb_send(struct wolfIP_ll_dev *dev, void *frame, uint32_t sz);
 int ll_usb_poll(struct wolfIP_ll_dev *dev, void *frame, uint32_t sz);
+static int ll_usb_rx_peek(struct wolfIP_ll_dev *dev, void **frame);
+static void ll_usb_rx_release(struct wolfIP_ll_dev *dev);
 
 static int usb_netdev_attach(struct wolfIP *stack, struct wolfIP_ll_dev *ll, unsigned int if_idx)
 {
@@ -655,6 +667,8 @@ static int usb_netdev_attach(struct wolfIP *stack, struct wolfIP_ll_dev *ll, uns
     ll->ifname[sizeof(ll->ifname) - 1] = '\0';
     ll->poll = ll_usb_poll;
     ll->send = ll_usb_send;
+    ll->rx_peek = ll_usb_rx_peek;
+    ll->rx_release = ll_usb_rx_release;
 
     wolfIP_ipconfig_set_ex(stack, if_idx,
                            atoip4("192.168.7.2"),
@@ -669,101 +683,160 @@ static struct netdev_driver usb_net_driver = {
     .attach = usb_netdev_attach,
 };
 
-
+/* Frames are packed straight into the NTB being filled: TinyUSB copies
+ * them through tud_network_xmit_cb() before tud_network_xmit() returns.
+ * When both NTBs are busy the stack keeps the frame and retries once the
+ * USB tasklet has seen an NTB complete.
+ */
 static int ll_usb_send(struct wolfIP_ll_dev *dev, void *frame, uint32_t sz) {
-    uint16_t sz16 = (uint16_t)sz;
-    uint32_t i;
     (void) dev;
-    for (;;) {
-        if (!tud_ready()) {
-            sem_post(&sem_usb);
-            return 0;
-        }
-        if (tud_network_can_xmit(sz16)) {
-            for (i = 0; i < 4; i++) {
-                if (tusb_net_txbuf_sz[i] == 0) {
-                    memcpy(tusb_net_txbuf[i], frame, sz16);
-                    tusb_net_txbuf_sz[i] = sz16;
-                    tud_network_xmit(tusb_net_txbuf[i], tusb_net_txbuf_sz[i]);
-                    return (int)sz16;
-                }
-            }
-        }
-        tusb_int_handler(0, false);
-        tud_task();
+    if (sz > LINK_MTU)
+        return -1;
+    if (!tud_ready()) {
+        sem_post(&sem_usb);
+        return 0;
     }
+    if (!tud_network_can_xmit((uint16_t)sz)) {
+        usb_net_tx_blocked = 1;
+        return -WOLFIP_EAGAIN;
+    }
+    tud_network_xmit(frame, (uint16_t)sz);
+    return (int)sz;
 }
 
-/* This is the callback that TinyUSB calls when it is ready to send a frame.
- * This is where the write operation is finalized.
+/* This is the callback that TinyUSB calls from tud_network_xmit() to copy
+ * the frame into the current NTB.
  */
 uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg) {
-    uint16_t ret = arg;
-    (void) ref;
-    (void) arg;
     memcpy(dst, ref, arg);
-    if (ref == tusb_net_rxbuf[0])
-        tusb_net_txbuf_sz[0] = 0;
-    else if (ref == tusb_net_txbuf[1])
-        tusb_net_txbuf_sz[1] = 0;
-    else if (ref == tusb_net_txbuf[2])
-        tusb_net_txbuf_sz[2] = 0;
-    else if (ref == tusb_net_txbuf[3])
-        tusb_net_txbuf_sz[3] = 0;
-    sem_post(&sem_usb);
-    return ret;
+    return arg;
 }
 
-/* This is the callback that TinyUSB calls when it is ready to receive a frame.
- * This is where the read operation is initiated, the frame is copied to the
- * static buffer, and the buffer is marked as used.
- */
-
-static void tusb_net_push_rx(const uint8_t *src, uint16_t size) {
-    uint8_t *dst = NULL;
-    int i;
-    for (i = 0; i < 2; i++) {
-        if (!tusb_net_rxbuf_used[i]) {
-            dst = tusb_net_rxbuf[i];
-            break;
+/* Reserve an entry for a frame of 'size' bytes at the head of the ring.
+ * Returns the entry offset, or -1 if the ring is full. */
+static int usb_net_rx_reserve(uint16_t size)
+{
+    uint32_t need = USB_NET_RX_ENTRY(size);
+    uint32_t head = usb_net_rx_head;
+    uint32_t tail = usb_net_rx_tail;
+
+    if (head >= tail) {
+        /* Free space is [head, end) and [0, tail). head must not catch
+         * up with tail, or the ring would look empty. */
+        if ((CONFIG_USB_NET_RX_RING - head > need) ||
+                ((CONFIG_USB_NET_RX_RING - head == need) && (tail != 0)))
+            return (int)head;
+        if (tail > need) {
+            *(uint16_t *)(usb_net_rx_ring + head) = USB_NET_RX_WRAP;
+            return 0;
         }
+        return -1;
     }
-    if (dst) {
-        if (size > LINK_MTU) return;
-        memcpy(dst, src, size);
-        tusb_net_rxbuf_used[i] = 1;
-        tusb_net_rxbuf_size[i] = size;
-    }
+    if (tail - head > need)
+        return (int)head;
+    return -1;
 }
 
+/* This is the callback that TinyUSB calls for each datagram of a received
+ * NTB. Returning false leaves the datagram (and its NTB) with TinyUSB,
+ * which holds off the host until the ring has room again.
+ */
 bool tud_network_recv_cb(const uint8_t *src, uint16_t size) {
-    tusb_net_push_rx(src, size);
+    int off;
+    uint32_t next;
+
+    if ((size == 0) || (size > LINK_MTU)) {
+        tud_network_recv_renew();
+        return true;
+    }
+    off = usb_net_rx_reserve(size);
+    if (off < 0) {
+        usb_net_rx_held = 1;
+        socket_in_wakeup();
+        return false;
+    }
+    *(uint16_t *)(usb_net_rx_ring + off) = size;
+    memcpy(usb_net_rx_ring + off + USB_NET_RX_HDR, src, size);
+    next = (uint32_t)off + USB_NET_RX_ENTRY(size);
+    if (next == CONFIG_USB_NET_RX_RING)
+        next = 0;
+    __asm volatile ("dmb" ::: "memory");
+    usb_net_rx_head = next;
+    /* Move on to the next datagram of the NTB */
     tud_network_recv_renew();
+    socket_in_wakeup();
     return true;
 }
 
-/* This is the poll function of the wolfIP device driver.
- * It is called by the wolfIP stack when it is ready to receive a frame.
+/* Zero-copy receive: point wolfIP at the oldest frame in the ring. It
+ * stays there until ll_usb_rx_release(). */
+static int ll_usb_rx_peek(struct wolfIP_ll_dev *dev, void **frame)
+{
+    uint32_t tail = usb_net_rx_tail;
+    uint16_t size;
+
+    (void) dev;
+    if (tail == usb_net_rx_head)
+        return 0;
+    size = *(uint16_t *)(usb_net_rx_ring + tail);
+    if (size == USB_NET_RX_WRAP) {
+        tail = 0;
+        usb_net_rx_tail = 0;
+        if (tail == usb_net_rx_head)
+            return 0;
+        size = *(uint16_t *)(usb_net_rx_ring + tail);
+    }
+    *frame = usb_net_rx_ring + tail + USB_NET_RX_HDR;
+    return (int)size;
+}
+
+static void ll_usb_rx_release(struct wolfIP_ll_dev *dev)
+{
+    uint32_t tail = usb_net_rx_tail;
+
+    (void) dev;
+    tail += USB_NET_RX_ENTRY(*(uint16_t *)(usb_net_rx_ring + tail));
+    if (tail == CONFIG_USB_NET_RX_RING)
+        tail = 0;
+    __asm volatile ("dmb" ::: "memory");
+    usb_net_rx_tail = tail;
+    if (usb_net_rx_held) {
+        /* Let the USB tasklet hand over the datagram it is holding */
+        sem_post(&sem_usb);
+        tasklet_add(usb_tasklet, NULL);
+    }
+}
+
+/* This is the poll function of the wolfIP device driver, used when the
+ * stack copies frames out instead of parsing them in place.
  * It will return the number of bytes received, or 0 if no frame is available.
- *
- * Frames copied in tusb_net_push_rx are processed here and sent to the stack.
  */
 int  ll_usb_poll(struct wolfIP_ll_dev *dev, void *frame, uint32_t sz) {
-    int i;
-    (void) dev;
-    if (sz < 64)
+    void *src = NULL;
+    int len;
+
+    len = ll_usb_rx_peek(dev, &src);
+    if (len <= 0)
         return 0;
-    for (i = 0; i < 2; i++) {
-        if (tusb_net_rxbuf_used[i]) {
-            uint16_t actual_size = tusb_net_rxbuf_size[i];
-            uint32_t to_copy = (sz < actual_size) ? sz : actual_size;
-            memcpy(frame, tusb_net_rxbuf[i], to_copy);
-            tusb_net_rxbuf_used[i] = 0;
-            tusb_net_rxbuf_size[i] = 0;
-            return (int)to_copy;
-        }
+    if ((uint32_t)len > sz)
+        len = (int)sz;
+    memcpy(frame, src, (uint32_t)len);
+    ll_usb_rx_release(dev);
+    return len;
+}
+
+/* Called from the USB tasklet after tud_task(): restart reception held
+ * back by a full ring and wake the stack once an NTB has been sent. */
+static void usb_net_task(void)
+{
+    if (usb_net_rx_held) {
+        usb_net_rx_held = 0;
+        tud_network_recv_renew();
+    }
+    if (usb_net_tx_blocked) {
+        usb_net_tx_blocked = 0;
+        socket_in_wakeup();
     }
-    return 0;
 }
 
 
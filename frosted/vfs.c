@@ -82,6 +82,8 @@ int ksnprintf(char *buf, size_t size, const char *fmt, ...) {
 #include "stat.h"
 #include "fcntl.h"
 #include "taskmem.h"
+#include "poll.h"
+#include "dcache.h"
 
 #define O_MODE(o) ((o & O_ACCMODE))
 #define O_BLOCKING(f) ((f->flags & O_NONBLOCK) == 0)
@@ -416,6 +418,29 @@ static int path_check(const char *path, const char *dirname)
     return 0;
 }
 
+/* The entry called name[0..len) in dir: the first match among the
+ * children, else what the owner module finds on its medium. Results,
+ * "not found" included, are kept in the lookup cache (dcache.c).
+ */
+static struct fnode *fno_child(struct fnode *dir, const char *name, int len)
+{
+    struct fnode *child;
+    char fname[CONFIG_MAX_FNAME];
+
+    if (dcache_lookup(dir, name, len, &child))
+        return child;
+    for (child = dir->children; child; child = child->next) {
+        if ((strncmp(child->fname, name, len) == 0) && (child->fname[len] == '\0'))
+            break;
+    }
+    if (!child && dir->owner && dir->owner->ops.lookup) {
+        memcpy(fname, name, len);
+        fname[len] = '\0';
+        child = dir->owner->ops.lookup(dir, fname);
+    }
+    dcache_insert(dir, name, len, child);
+    return child;
+}
 
 static struct fnode *_fno_search_at(const char *path, struct fnode *dir,
                                     int follow, unsigned int symlink_depth)
@@ -459,8 +484,19 @@ static struct fnode *_fno_search_at(const char *path, struct fnode *dir,
     }
     {
         const char *rest = path_walk(path);
-        struct fnode *result = _fno_search_at(rest, dir->children, follow,
-                                              symlink_depth);
+        struct fnode *result;
+        int len = 0;
+
+        if (rest) {
+            while (rest[len] && rest[len] != '/')
+                len++;
+        }
+        /* Ordinary component: resolved through the lookup cache */
+        if (len > 0 && len < CONFIG_MAX_FNAME)
+            return _fno_search_at(rest, fno_child(dir, rest, len), follow,
+                                  symlink_depth);
+
+        result = _fno_search_at(rest, dir->children, follow, symlink_depth);
         if (!result && rest && dir->owner && dir->owner->ops.lookup) {
             /* Extract next path component name */
             char name[CONFIG_MAX_FNAME];
@@ -545,6 +581,8 @@ static struct fnode *_fno_create(struct module *owner, const char *name, struct
     fno->parent = parent;
     fno->next = fno->parent->children;
     fno->parent->children = fno;
+    /* A negative entry, or one for an older fnode of the same name */
+    dcache_forget(parent, name, nlen);
 
     fno->children = NULL;
     fno->owner = owner;
@@ -629,6 +667,8 @@ void fno_detach(struct fnode *fno)
         }
     }
 
+    dcache_forget_fnode(fno);
+    waitq_flush(&fno->wq);
     pool_free(&fnode_pool, fno);
 }
 
@@ -643,6 +683,107 @@ void fno_unlink(struct fnode *fno)
     fno_detach(fno);
 }
 
+/* Wait queues
+ *
+ * Queues are short (one entry per poller/reader of a file) and are
+ * touched from syscalls, tasklets and ISRs alike: every list operation
+ * runs with interrupts masked.
+ */
+void waitq_add(struct waitq *wq, struct waitq_entry *e)
+{
+    uint32_t irq_state;
+
+    if (!wq || !e)
+        return;
+    irq_state = irq_save();
+    if (e->wq != wq) {
+        if (e->wq)
+            waitq_del(e);
+        e->wq = wq;
+        e->next = wq->head;
+        wq->head = e;
+    }
+    e->ready = 0;
+    irq_restore(irq_state);
+}
+
+void waitq_del(struct waitq_entry *e)
+{
+    struct waitq_entry **pp;
+    uint32_t irq_state;
+
+    if (!e)
+        return;
+    irq_state = irq_save();
+    if (e->wq) {
+        pp = &e->wq->head;
+        while (*pp) {
+            if (*pp == e) {
+                *pp = e->next;
+                break;
+            }
+            pp = &(*pp)->next;
+        }
+        e->wq = NULL;
+        e->next = NULL;
+    }
+    irq_restore(irq_state);
+}
+
+static void waitq_notify(struct waitq_entry *e, uint16_t events)
+{
+    if (e->func) {
+        e->func(e, events);
+        return;
+    }
+    e->ready |= events;
+    if (e->task)
+        task_resume(e->task);
+}
+
+/* Signal 'events' to every entry interested in them. Error and hangup
+ * conditions are always delivered. Returns the number of waiters notified.
+ */
+int waitq_wake(struct waitq *wq, uint16_t events)
+{
+    struct waitq_entry *e, *next;
+    uint32_t irq_state;
+    uint16_t match;
+    int woken = 0;
+
+    if (!wq || !wq->head)
+        return 0;
+    irq_state = irq_save();
+    for (e = wq->head; e; e = next) {
+        next = e->next;
+        match = events & (e->events | POLLHUP | POLLERR | POLLNVAL);
+        if (match) {
+            waitq_notify(e, match);
+            woken++;
+        }
+    }
+    irq_restore(irq_state);
+    return woken;
+}
+
+/* The file is going away: unlink every waiter and tell it so. */
+void waitq_flush(struct waitq *wq)
+{
+    struct waitq_entry *e;
+    uint32_t irq_state;
+
+    if (!wq)
+        return;
+    irq_state = irq_save();
+    while ((e = wq->head) != NULL) {
+        wq->head = e->next;
+        e->wq = NULL;
+        e->next = NULL;
+        waitq_notify(e, POLLHUP | POLLNVAL);
+    }
+    irq_restore(irq_state);
+}
+
 int sys_readlink_hdlr(char *path, char *buf, size_t size)
 {
     char abs_p[MAX_FILE];
@@ -1111,6 +1252,18 @@ int sys_truncate_hdlr(char *path, uint32_t newsize)
     return vfs_truncate(fno, newsize);
 }
 
+/* Write back what the filesystem or device still holds in RAM. Files
+ * without anything to flush succeed. */
+int sys_fsync_hdlr(int fd)
+{
+    struct fnode *fno = task_filedesc_get(fd);
+    if (!fno)
+        return -EBADF;
+    if (!fno->owner || !fno->owner->ops.fsync)
+        return 0;
+    return fno->owner->ops.fsync(fno);
+}
+
 int sys_chdir_hdlr(char *path)
 {
     char abs_p[MAX_FILE];
@@ -1215,6 +1368,8 @@ int vfs_mount(char *source, char *target, char *module, uint32_t flags, void *ar
     if (!m || !m->mount)
         return -EOPNOTSUPP;
     ret = m->mount(source, target, flags, args);
+    /* Lookups under the target are answered by another module now */
+    dcache_flush();
     if (ret == 0) {
         struct mountpoint *mp = pool_alloc(&mountpoint_pool);
         if (mp) {
@@ -1253,6 +1408,7 @@ int vfs_umount(char *target, uint32_t flags)
         mutex_unlock(vfs_mutex);
         return ret;
     }
+    dcache_flush();
 
     while (*link) {
         mp = *link;
@@ -31,6 +31,7 @@
 #endif
 #include "config.h"
 #include "wolfip.h"
+#include "inet_csum.h"
 
 #ifndef LINK_MTU_MIN
 #define LINK_MTU_MIN 64U
@@ -69,7 +70,89 @@ struct wolfIP_udp_datagram;
 struct wolfIP_icmp_packet;
 
 /* Fixed size binary heap: each element is a timer. */
-#define MAX_TIMERS (MAX_TCPSOCKETS * 3)
+#define MAX_TIMERS (MAX_TCPSOCKETS * 3 + WOLFIP_REASM_CTX)
+
+/* Socket demultiplexing tables. Connected TCP sockets are hashed on
+ * their 4-tuple, unconnected ones (listening or just bound) and UDP
+ * sockets on their local port. Sized for about one socket per bucket
+ * at MAX_TCPSOCKETS. */
+#ifndef WOLFIP_TCP_HASH_BITS
+#if MAX_TCPSOCKETS > 128
+#define WOLFIP_TCP_HASH_BITS 8
+#elif MAX_TCPSOCKETS > 64
+#define WOLFIP_TCP_HASH_BITS 7
+#elif MAX_TCPSOCKETS > 32
+#define WOLFIP_TCP_HASH_BITS 6
+#elif MAX_TCPSOCKETS > 16
+#define WOLFIP_TCP_HASH_BITS 5
+#else
+#define WOLFIP_TCP_HASH_BITS 4
+#endif
+#endif
+#ifndef WOLFIP_PORT_HASH_BITS
+#define WOLFIP_PORT_HASH_BITS 4
+#endif
+#define TCP_CONN_BUCKETS (1U << WOLFIP_TCP_HASH_BITS)
+#define PORT_BUCKETS (1U << WOLFIP_PORT_HASH_BITS)
+
+/* Socket buffers are allocated at RXBUF_SIZE/TXBUF_SIZE when a socket is
+ * created, and may grow up to the *_MAX sizes (SO_RCVBUF/SO_SNDBUF or
+ * autotuning) as long as all socket buffers together stay within
+ * WOLFIP_SOCKBUF_BUDGET bytes. */
+#ifndef WOLFIP_BUF_ALLOC
+#include <stdlib.h>
+#define WOLFIP_BUF_ALLOC(sz) malloc(sz)
+#define WOLFIP_BUF_FREE(p) free(p)
+#endif
+#ifndef WOLFIP_RXBUF_MAX
+#define WOLFIP_RXBUF_MAX RXBUF_SIZE
+#endif
+#ifndef WOLFIP_TXBUF_MAX
+#define WOLFIP_TXBUF_MAX TXBUF_SIZE
+#endif
+#ifndef WOLFIP_SOCKBUF_BUDGET
+#define WOLFIP_SOCKBUF_BUDGET (4U * (WOLFIP_RXBUF_MAX + WOLFIP_TXBUF_MAX))
+#endif
+#ifndef WOLFIP_SOCKBUF_AUTOTUNE
+#define WOLFIP_SOCKBUF_AUTOTUNE 1
+#endif
+#define WOLFIP_SOCKBUF_MIN 512U
+#define SOCK_RCVBUF_LOCK 0x01
+#define SOCK_SNDBUF_LOCK 0x02
+#if (WOLFIP_RXBUF_MAX < RXBUF_SIZE) || (WOLFIP_TXBUF_MAX < TXBUF_SIZE)
+#error "WOLFIP_RXBUF_MAX/WOLFIP_TXBUF_MAX must not be smaller than the default buffer sizes"
+#endif
+
+/* IPv4 reassembly: at most WOLFIP_REASM_CTX datagrams of up to
+ * WOLFIP_REASM_MAX bytes (IP header included) are rebuilt at a time.
+ * A context holds its buffer only while fragments are outstanding, and
+ * is dropped WOLFIP_REASM_TIMEOUT_MS after its first fragment arrived.
+ * With WOLFIP_REASM_CTX set to 0 all fragments are dropped. */
+#ifndef WOLFIP_REASM_CTX
+#define WOLFIP_REASM_CTX 2
+#endif
+#ifndef WOLFIP_REASM_MAX
+#define WOLFIP_REASM_MAX 4608U
+#endif
+#ifndef WOLFIP_REASM_TIMEOUT_MS
+#define WOLFIP_REASM_TIMEOUT_MS 15000U
+#endif
+#ifndef WOLFIP_REASM_HOLES
+#define WOLFIP_REASM_HOLES 8
+#endif
+#if WOLFIP_REASM_CTX > 0 && (WOLFIP_REASM_MAX < 576U || WOLFIP_REASM_MAX > 65535U)
+#error "WOLFIP_REASM_MAX must be between 576 and 65535"
+#endif
+
+/* Path MTU discovery (RFC 1191): the path MTU learned from ICMP
+ * "fragmentation needed" is never taken below WOLFIP_PMTU_MIN, and is
+ * forgotten after WOLFIP_PMTU_AGE_MS so that a larger one is tried again. */
+#ifndef WOLFIP_PMTU_MIN
+#define WOLFIP_PMTU_MIN 552U
+#endif
+#ifndef WOLFIP_PMTU_AGE_MS
+#define WOLFIP_PMTU_AGE_MS 600000U
+#endif
 
 /* Constants */
 #define ICMP_ECHO_REPLY 0
@@ -154,12 +237,15 @@ struct wolfIP_icmp_packet;
 #ifndef TCP_FIN_WAIT_2_TIMEOUT_MS
 #define TCP_FIN_WAIT_2_TIMEOUT_MS 60000U
 #endif
-/* Arbitrary upper limit to avoid monopolizing the CPU during poll loops. */
-#define WOLFIP_POLL_BUDGET 128
 
 /* Macros */
 #define IS_IP_BCAST(ip) ((ip) == 0xFFFFFFFFU)
 
+/* IPv4 flags_fo field */
+#define IP_FLAG_DF 0x4000U
+#define IP_FLAG_MF 0x2000U
+#define IP_FRAG_OFF_MASK 0x1FFFU
+
 #define PKT_FLAG_SENT    0x01U
 #define PKT_FLAG_ACKED   0x02U
 #define PKT_FLAG_FIN     0x04U
@@ -182,7 +268,8 @@ struct wolfIP_icmp_packet;
 
 struct PACKED pkt_desc {
     uint32_t pos, len;
-    uint32_t flags;
+    uint16_t flags;
+    uint16_t frag_off; /* IP payload offset of the next fragment to send */
     uint32_t time_sent;
 };
 
@@ -338,7 +425,8 @@ static uint32_t fifo_len(struct fifo *f)
     }
 }
 
-/* Insert data into the FIFO */
+/* Insert data into the FIFO. With data NULL the space is only reserved,
+ * for the caller to fill in after the descriptor at f->last_pos. */
 static int fifo_push(struct fifo *f, void *data, uint32_t len)
 {
     struct pkt_desc desc;
@@ -389,7 +477,8 @@ static int fifo_push(struct fifo *f, void *data, uint32_t len)
     desc.len = len;
     memcpy((uint8_t *)f->data + head, &desc, sizeof(struct pkt_desc));
     head += sizeof(struct pkt_desc);
-    memcpy((uint8_t *)f->data + head, data, len);
+    if (data)
+        memcpy((uint8_t *)f->data + head, data, len);
     head += len;
     if (head == f->size) {
         /* Preserve wrapped/non-empty state when write lands exactly at end. */
@@ -1120,8 +1209,12 @@ struct tcpsocket {
     uint8_t is_listener;
     uint8_t ack_retry_pending;
     ip4 local_ip, remote_ip;
-    uint32_t peer_rwnd;
+    uint32_t peer_rwnd, peer_rwnd_max;
     uint16_t peer_mss;
+    /* Path MTU from ICMP fragmentation needed, 0 while the interface MTU
+     * applies */
+    uint16_t pmtu;
+    uint32_t pmtu_tick;
     uint8_t snd_wscale, rcv_wscale, ws_enabled, ws_offer;
     uint8_t ts_enabled, ts_offer;
     uint8_t sack_offer, sack_permitted;
@@ -1129,6 +1222,9 @@ struct tcpsocket {
     struct tcp_sack_block rx_sack[TCP_SACK_MAX_BLOCKS];
     struct tcp_sack_block peer_sack[TCP_SACK_MAX_BLOCKS];
     struct tcp_ooo_seg ooo[TCP_OOO_MAX_SEGS];
+    /* Receive buffer autotuning: bytes read by the application since
+     * rcv_space_tick */
+    uint32_t rcv_space_copied, rcv_space_tick;
     struct fifo txbuf;
     struct queue rxbuf;
 };
@@ -1161,8 +1257,14 @@ struct tsocket {
     uint8_t if_idx;
     uint8_t recv_ttl;
     uint8_t last_pkt_ttl;
-    uint8_t rxmem[RXBUF_SIZE];
-    uint8_t txmem[TXBUF_SIZE];
+    /* Demux links hold a socket index + 1, 0 ends the chain */
+    uint8_t hash_next;
+    uint8_t demux_next;
+    uint16_t hash_slot; /* bucket + 1, 0 when not hashed */
+    uint8_t buf_lock; /* SOCK_*BUF_LOCK: size set by the application */
+    uint8_t *rxmem;
+    uint8_t *txmem;
+    uint32_t rxmem_size, txmem_size;
     tsocket_cb callback;
     void *callback_arg;
 };
@@ -1229,6 +1331,7 @@ static void tcp_persist_start(struct tsocket *t, uint64_t now);
 static void tcp_persist_stop(struct tsocket *t);
 static void tcp_rto_update_from_sample(struct tsocket *t, uint32_t sample_ms);
 static void tcp_rto_cb(void *arg);
+static int tcp_mark_unsacked_for_retransmit(struct tsocket *t, uint32_t ack);
 static void tcp_ctrl_rto_start(struct tsocket *t, uint64_t now);
 static void tcp_ctrl_rto_stop(struct tsocket *t);
 static void tcp_fin_wait_2_timeout_start(struct tsocket *t, uint64_t now);
@@ -1312,6 +1415,29 @@ struct timers_binheap {
     uint32_t size;
 };
 
+#if WOLFIP_REASM_CTX > 0
+/* IPv4 reassembly context. The missing parts of the payload are kept as
+ * a list of holes (RFC 815): a fragment must fall entirely inside one of
+ * them, which it then splits in up to two smaller ones. */
+struct ip_reasm_hole {
+    uint16_t first, last;
+};
+
+struct ip_reasm {
+    struct wolfIP *S;
+    uint8_t *buf;           /* link + IP header + payload, NULL when unused */
+    ip4 src, dst;           /* network order */
+    uint16_t id;
+    uint8_t proto;
+    uint8_t nholes;
+    uint32_t total;         /* payload length, 0 until the last fragment */
+    uint32_t end;           /* end of the highest fragment received */
+    uint32_t tmr;
+    uint64_t started;
+    struct ip_reasm_hole holes[WOLFIP_REASM_HOLES];
+};
+#endif
+
 /* The main wolfip stack context structure. */
 struct wolfIP {
     struct wolfIP_ll_dev ll_dev[WOLFIP_MAX_INTERFACES];
@@ -1343,6 +1469,14 @@ struct wolfIP {
     struct tsocket tcpsockets[MAX_TCPSOCKETS];
     struct tsocket udpsockets[MAX_UDPSOCKETS];
     struct tsocket icmpsockets[MAX_ICMPSOCKETS];
+    uint8_t tcp_hash[TCP_CONN_BUCKETS + PORT_BUCKETS]; /* 4-tuple, then port buckets */
+    uint8_t udp_hash[PORT_BUCKETS];
+    uint32_t sockbuf_mem; /* bytes allocated for socket buffers */
+#if WOLFIP_REASM_CTX > 0
+    struct ip_reasm reasm[WOLFIP_REASM_CTX];
+#endif
+    /* IPv4 datagrams reassembled and dropped incomplete, fragments sent */
+    uint32_t reasm_ok, reasm_drop, frag_out;
 #if WOLFIP_RAWSOCKETS
     struct rawsocket rawsockets[WOLFIP_MAX_RAWSOCKETS];
 #if WOLFIP_PACKET_SOCKETS
@@ -1447,9 +1581,32 @@ static inline uint32_t wolfIP_socket_tcp_mss(const struct tsocket *t)
     return ip_mtu - (IP_HEADER_LEN + TCP_HEADER_LEN);
 }
 
+/* IP MTU towards the peer: the interface MTU, or the path MTU learned by
+ * a TCP socket when it is smaller. */
+static inline uint32_t wolfIP_socket_path_mtu(const struct tsocket *t)
+{
+    uint32_t mtu = wolfIP_socket_ip_mtu(t);
+
+    if (mtu && t->proto == WI_IPPROTO_TCP && t->sock.tcp.pmtu &&
+            t->sock.tcp.pmtu < mtu)
+        mtu = t->sock.tcp.pmtu;
+    return mtu;
+}
+
+/* Largest segment payload the path takes; the MSS option we send keeps
+ * advertising the interface one (wolfIP_socket_tcp_mss). */
+static inline uint32_t tcp_path_mss(const struct tsocket *t)
+{
+    uint32_t mtu = wolfIP_socket_path_mtu(t);
+
+    if (mtu <= (IP_HEADER_LEN + TCP_HEADER_LEN))
+        return 0;
+    return mtu - (IP_HEADER_LEN + TCP_HEADER_LEN);
+}
+
 static inline uint32_t tcp_cc_mss(const struct tsocket *t)
 {
-    uint32_t mss = t ? wolfIP_socket_tcp_mss(t) : TCP_MSS_MAX;
+    uint32_t mss = t ? tcp_path_mss(t) : TCP_MSS_MAX;
 
     if (mss == 0)
         mss = TCP_MSS_MAX;
@@ -1458,7 +1615,7 @@ static inline uint32_t tcp_cc_mss(const struct tsocket *t)
 
 static inline uint32_t tcp_tx_payload_cap(const struct tsocket *t)
 {
-    uint32_t cap = wolfIP_socket_tcp_mss(t);
+    uint32_t cap = tcp_path_mss(t);
 
     if (cap > TCP_OPTIONS_LEN)
         cap -= TCP_OPTIONS_LEN;
@@ -1473,6 +1630,20 @@ static inline uint32_t tcp_tx_payload_cap(const struct tsocket *t)
     return cap;
 }
 
+/* Segments are built at send() time and never split afterwards, so one
+ * larger than the peer's window could never leave: bound them to half the
+ * largest window offered, or to the whole window when it is smaller than
+ * the default MSS (RFC 1122 sender SWS avoidance). */
+static inline uint32_t tcp_bound_to_half_wnd(const struct tsocket *t, uint32_t cap)
+{
+    uint32_t max_wnd = t->sock.tcp.peer_rwnd_max;
+    uint32_t cutoff = (max_wnd > TCP_DEFAULT_MSS) ? (max_wnd >> 1) : max_wnd;
+
+    if (cutoff && cap > cutoff)
+        cap = cutoff;
+    return cap;
+}
+
 #if WOLFIP_ENABLE_LOOPBACK
 
 static void wolfIP_notify_loopback_space_available(struct wolfIP *s)
@@ -1579,6 +1750,34 @@ static inline int wolfIP_ll_is_non_ethernet(struct wolfIP *s, unsigned int if_id
     return (ll && ll->non_ethernet) ? 1 : 0;
 }
 
+/* Checksum offload. ESP transforms the packet after its headers are
+ * built and before the MAC sees it, so offload is never used with it. */
+static inline int wolfIP_ll_tx_csum_offload(struct wolfIP *s, unsigned int if_idx, uint8_t what)
+{
+#ifdef WOLFIP_ESP
+    (void)s;
+    (void)if_idx;
+    (void)what;
+    return 0;
+#else
+    struct wolfIP_ll_dev *ll = wolfIP_ll_at(s, if_idx);
+    return (ll && (ll->csum_offload & what)) ? 1 : 0;
+#endif
+}
+
+static inline int wolfIP_ll_rx_csum_ok(struct wolfIP *s, unsigned int if_idx, uint8_t what)
+{
+#ifdef WOLFIP_ESP
+    (void)s;
+    (void)if_idx;
+    (void)what;
+    return 0;
+#else
+    struct wolfIP_ll_dev *ll = wolfIP_ll_at(s, if_idx);
+    return (ll && (ll->csum_offload & what) && (ll->rx_csum & what)) ? 1 : 0;
+#endif
+}
+
 static inline int wolfIP_ll_send_frame(struct wolfIP *s, unsigned int if_idx,
                                        void *buf, uint32_t len)
 {
@@ -1637,19 +1836,7 @@ static inline int wolfIP_ip_is_multicast(ip4 addr)
 #ifdef IP_MULTICAST
 static uint16_t ip_checksum_buf(const void *buf, uint16_t len)
 {
-    const uint8_t *p = (const uint8_t *)buf;
-    uint32_t sum = 0;
-
-    while (len > 1) {
-        sum += ((uint16_t)p[0] << 8) | p[1];
-        p += 2;
-        len -= 2;
-    }
-    if (len)
-        sum += (uint16_t)p[0] << 8;
-    while (sum >> 16)
-        sum = (sum & 0xffffU) + (sum >> 16);
-    return (uint16_t)~sum;
+    return ee16(inet_csum_fold(inet_csum_partial(buf, len, 0)));
 }
 
 static void put_be16(uint8_t *p, uint16_t v)
@@ -2187,18 +2374,395 @@ static int is_timer_expired(struct timers_binheap *heap, uint64_t now)
     return (heap->timers[0].expires <= now)?1:0;
 }
 
+/* Take the timer out of the heap rather than leaving it behind disarmed:
+ * timers armed and cancelled at a high rate (RTO, IP reassembly) would
+ * otherwise fill it up. The last timer takes its place and is moved up or
+ * down to restore the heap order. */
 static void timer_binheap_cancel(struct timers_binheap *heap, uint32_t id)
 {
-    uint32_t i;
+    uint32_t i, j;
+    struct wolfIP_timer tmp;
+
     for (i = 0; i < heap->size; i++) {
-        if (heap->timers[i].id == id) {
-            heap->timers[i].expires = 0;
+        if (heap->timers[i].id == id)
+            break;
+    }
+    if (i == heap->size)
+        return;
+    heap->size--;
+    if (i == heap->size)
+        return;
+    heap->timers[i] = heap->timers[heap->size];
+    while (i > 0 && heap->timers[i].expires < heap->timers[(i-1)/2].expires) {
+        tmp = heap->timers[i];
+        heap->timers[i] = heap->timers[(i-1)/2];
+        heap->timers[(i-1)/2] = tmp;
+        i = (i-1)/2;
+    }
+    while ((j = 2*i+1) < heap->size) {
+        if (j+1 < heap->size && heap->timers[j+1].expires < heap->timers[j].expires)
+            j++;
+        if (heap->timers[i].expires <= heap->timers[j].expires)
+            break;
+        tmp = heap->timers[i];
+        heap->timers[i] = heap->timers[j];
+        heap->timers[j] = tmp;
+        i = j;
+    }
+}
+
+/* Socket demultiplexing
+ *
+ * Each socket table has an array of bucket heads; sockets in the same
+ * bucket are chained through hash_next. A socket is (re)linked whenever
+ * the fields its bucket depends on change, and unlinked when closed, so
+ * the input path only walks the sockets sharing a bucket with the
+ * segment instead of the whole table.
+ */
+static inline uint16_t demux_hash(uint32_t key, unsigned int bits)
+{
+    /* Fibonacci hashing: the top bits of the product mix all key bits */
+    return (uint16_t)((key * 0x9E3779B1U) >> (32 - bits));
+}
+
+static inline uint16_t port_slot(uint16_t port)
+{
+    return demux_hash(port, WOLFIP_PORT_HASH_BITS);
+}
+
+static inline uint16_t tcp_conn_slot(uint16_t local_port, uint16_t remote_port,
+        ip4 remote_ip)
+{
+    uint32_t key = (remote_ip * 0x9E3779B1U) ^
+        (((uint32_t)local_port << 16) | remote_port);
+    return demux_hash(key, WOLFIP_TCP_HASH_BITS);
+}
+
+static inline struct tsocket *demux_head(const uint8_t *heads,
+        struct tsocket *base, unsigned int slot)
+{
+    return heads[slot] ? &base[heads[slot] - 1] : NULL;
+}
+
+static inline struct tsocket *demux_next(struct tsocket *base,
+        const struct tsocket *t)
+{
+    return t->hash_next ? &base[t->hash_next - 1] : NULL;
+}
+
+static void demux_unlink(uint8_t *heads, struct tsocket *base, struct tsocket *t)
+{
+    uint8_t self = (uint8_t)(t - base + 1);
+    uint8_t *pp;
+
+    if (!t->hash_slot)
+        return;
+    pp = &heads[t->hash_slot - 1];
+    while (*pp) {
+        if (*pp == self) {
+            *pp = t->hash_next;
             break;
         }
+        pp = &base[*pp - 1].hash_next;
     }
+    t->hash_next = 0;
+    t->hash_slot = 0;
 }
 
+static void demux_link(uint8_t *heads, struct tsocket *base, struct tsocket *t,
+        unsigned int slot)
+{
+    if (t->hash_slot == slot + 1)
+        return;
+    demux_unlink(heads, base, t);
+    t->hash_next = heads[slot];
+    heads[slot] = (uint8_t)(t - base + 1);
+    t->hash_slot = (uint16_t)(slot + 1);
+}
+
+/* Called after a TCP socket changes state across LISTEN or changes its
+ * ports or peer address. */
+static void tcp_demux_update(struct tsocket *t)
+{
+    struct wolfIP *S = t->S;
+    unsigned int slot;
+
+    if (t->sock.tcp.state > TCP_LISTEN)
+        slot = tcp_conn_slot(t->src_port, t->dst_port, t->remote_ip);
+    else
+        slot = TCP_CONN_BUCKETS + port_slot(t->src_port);
+    demux_link(S->tcp_hash, S->tcpsockets, t, slot);
+}
+
+/* Connected sockets with this 4-tuple, in any state past LISTEN */
+static inline struct tsocket *tcp_demux_conn(struct wolfIP *S, uint16_t local_port,
+        uint16_t remote_port, ip4 remote_ip)
+{
+    return demux_head(S->tcp_hash, S->tcpsockets,
+            tcp_conn_slot(local_port, remote_port, remote_ip));
+}
+
+/* Links the sockets a segment may belong to through demux_next: the
+ * unconnected ones bound to its destination port, then the connected
+ * ones with its 4-tuple. The list is built up front because handling a
+ * segment can rehash or close the socket being looked at. */
+static struct tsocket *tcp_demux_collect(struct wolfIP *S,
+        const struct wolfIP_tcp_seg *tcp)
+{
+    uint16_t local_port = ee16(tcp->dst_port);
+    uint16_t remote_port = ee16(tcp->src_port);
+    ip4 remote_ip = ee32(tcp->ip.src);
+    uint8_t head = 0;
+    uint8_t *tail = &head;
+    struct tsocket *t;
+
+    t = demux_head(S->tcp_hash, S->tcpsockets, TCP_CONN_BUCKETS + port_slot(local_port));
+    for (; t; t = demux_next(S->tcpsockets, t)) {
+        if (t->src_port != local_port)
+            continue;
+        *tail = (uint8_t)(t - S->tcpsockets + 1);
+        tail = &t->demux_next;
+    }
+    t = tcp_demux_conn(S, local_port, remote_port, remote_ip);
+    for (; t; t = demux_next(S->tcpsockets, t)) {
+        if (t->src_port != local_port || t->dst_port != remote_port ||
+                t->remote_ip != remote_ip)
+            continue;
+        *tail = (uint8_t)(t - S->tcpsockets + 1);
+        tail = &t->demux_next;
+    }
+    *tail = 0;
+    return head ? &S->tcpsockets[head - 1] : NULL;
+}
+
+static void udp_demux_update(struct tsocket *t)
+{
+    struct wolfIP *S = t->S;
+
+    demux_link(S->udp_hash, S->udpsockets, t, port_slot(t->src_port));
+}
+
+/* Socket buffers */
+
+/* Allocate a socket buffer of 'size' bytes replacing one of 'old_size'.
+ * Growth beyond the budget is refused unless 'force' is set: default
+ * buffers for a new socket are always granted. */
+static uint8_t *sockbuf_alloc(struct wolfIP *S, uint32_t size, uint32_t old_size, int force)
+{
+    uint8_t *mem;
+
+    if (!force && (size > old_size) &&
+            ((S->sockbuf_mem - old_size + size) > WOLFIP_SOCKBUF_BUDGET))
+        return NULL;
+    mem = (uint8_t *)WOLFIP_BUF_ALLOC(size);
+    if (mem)
+        S->sockbuf_mem += size;
+    return mem;
+}
+
+static void sockbuf_free(struct wolfIP *S, uint8_t *mem, uint32_t size)
+{
+    if (!mem)
+        return;
+    WOLFIP_BUF_FREE(mem);
+    S->sockbuf_mem -= size;
+}
+
+static void sockbuf_release(struct tsocket *t)
+{
+    sockbuf_free(t->S, t->rxmem, t->rxmem_size);
+    sockbuf_free(t->S, t->txmem, t->txmem_size);
+    t->rxmem = t->txmem = NULL;
+    t->rxmem_size = t->txmem_size = 0;
+}
+
+static int sockbuf_init(struct tsocket *t)
+{
+    t->rxmem = sockbuf_alloc(t->S, RXBUF_SIZE, 0, 1);
+    t->rxmem_size = t->rxmem ? RXBUF_SIZE : 0;
+    t->txmem = sockbuf_alloc(t->S, TXBUF_SIZE, 0, 1);
+    t->txmem_size = t->txmem ? TXBUF_SIZE : 0;
+    if (!t->rxmem || !t->txmem) {
+        sockbuf_release(t);
+        return -1;
+    }
+    return 0;
+}
+
+/* Round a requested size to a word multiple within [MIN, max] */
+static uint32_t sockbuf_clamp(int val, uint32_t max)
+{
+    uint32_t size = (val < (int)WOLFIP_SOCKBUF_MIN) ? WOLFIP_SOCKBUF_MIN : (uint32_t)val;
+
+    size = (size + 3U) & ~3U;
+    if (size > max)
+        size = max & ~3U;
+    return size;
+}
+
+/* Move a fifo to a new buffer. Packets keep their offsets so descriptors
+ * remain valid; an implicit wrap at the old end is made explicit through
+ * h_wrap. Only an empty fifo can shrink. */
+static int fifo_resize(struct wolfIP *S, struct fifo *f, uint8_t **mem,
+        uint32_t *mem_size, uint32_t size)
+{
+    uint8_t *data;
+
+    if (size == f->size)
+        return 0;
+    if ((size < f->size) && !fifo_is_empty(f))
+        return -WOLFIP_EINVAL;
+    data = sockbuf_alloc(S, size, f->size, 0);
+    if (!data)
+        return -WOLFIP_ENOMEM;
+    if (fifo_is_empty(f)) {
+        fifo_init(f, data, size);
+    } else {
+        memcpy(data, f->data, f->size);
+        if ((f->h_wrap == 0) && (f->head < f->tail))
+            f->h_wrap = f->size;
+        f->data = data;
+        f->size = size;
+    }
+    sockbuf_free(S, *mem, *mem_size);
+    *mem = data;
+    *mem_size = size;
+    return 0;
+}
+
+/* Move the TCP receive queue to a new buffer, linearizing the queued
+ * bytes at its start. seq_base is unchanged. */
+static int queue_resize(struct wolfIP *S, struct queue *q, uint8_t **mem,
+        uint32_t *mem_size, uint32_t size)
+{
+    uint32_t len = queue_len(q);
+    uint32_t first_chunk;
+    uint8_t *data;
+
+    if (size == q->size)
+        return 0;
+    if (size <= len)
+        return -WOLFIP_EINVAL;
+    data = sockbuf_alloc(S, size, q->size, 0);
+    if (!data)
+        return -WOLFIP_ENOMEM;
+    if (q->tail + len > q->size) {
+        first_chunk = q->size - q->tail;
+        memcpy(data, q->data + q->tail, first_chunk);
+        memcpy(data + first_chunk, q->data, len - first_chunk);
+    } else if (len > 0) {
+        memcpy(data, q->data + q->tail, len);
+    }
+    q->data = data;
+    q->size = size;
+    q->tail = 0;
+    q->head = len;
+    sockbuf_free(S, *mem, *mem_size);
+    *mem = data;
+    *mem_size = size;
+    return 0;
+}
+
+static int sockbuf_set_rcv(struct tsocket *t, uint32_t size)
+{
+    if (t->proto == WI_IPPROTO_TCP) {
+        /* Shrinking would retract a window already advertised */
+        if ((size < t->rxmem_size) && (t->sock.tcp.state != TCP_CLOSED) &&
+                (t->sock.tcp.state != TCP_LISTEN))
+            return -WOLFIP_EINVAL;
+        return queue_resize(t->S, &t->sock.tcp.rxbuf, &t->rxmem, &t->rxmem_size, size);
+    }
+    return fifo_resize(t->S, &t->sock.udp.rxbuf, &t->rxmem, &t->rxmem_size, size);
+}
+
+static int sockbuf_set_snd(struct tsocket *t, uint32_t size)
+{
+    struct fifo *f = (t->proto == WI_IPPROTO_TCP) ? &t->sock.tcp.txbuf : &t->sock.udp.txbuf;
+
+    return fifo_resize(t->S, f, &t->txmem, &t->txmem_size, size);
+}
+
+#if WOLFIP_SOCKBUF_AUTOTUNE
+/* Receive buffer autotuning (dynamic right-sizing): if the application
+ * drained at least half the buffer within one round trip, the sender was
+ * most likely held back by our window, so the buffer is doubled. */
+static void tcp_rcvbuf_autotune(struct tsocket *t, uint32_t copied)
+{
+    struct tcpsocket *tcp = &t->sock.tcp;
+    uint32_t now = (uint32_t)t->S->last_tick;
+    uint32_t period = tcp->srtt >> 3;
+    uint32_t elapsed;
+    uint32_t size;
+
+    if ((t->buf_lock & SOCK_RCVBUF_LOCK) || (t->rxmem_size >= WOLFIP_RXBUF_MAX))
+        return;
+    if (period == 0)
+        period = 1;
+    tcp->rcv_space_copied += copied;
+    elapsed = now - tcp->rcv_space_tick;
+    if (elapsed < period)
+        return;
+    /* An idle application says nothing about the path: start over */
+    if ((elapsed < (period << 1)) && ((tcp->rcv_space_copied << 1) >= t->rxmem_size)) {
+        size = t->rxmem_size << 1;
+        if (size > WOLFIP_RXBUF_MAX)
+            size = WOLFIP_RXBUF_MAX;
+        (void)sockbuf_set_rcv(t, size);
+    }
+    tcp->rcv_space_copied = 0;
+    tcp->rcv_space_tick = now;
+}
+
+/* Send buffer autotuning: the buffer holds both unacknowledged and queued
+ * segments, so when it fills up it is grown towards twice the usable
+ * window (smaller of cwnd and the peer window). */
+static void tcp_sndbuf_autotune(struct tsocket *t)
+{
+    struct tcpsocket *tcp = &t->sock.tcp;
+    uint32_t win = (tcp->cwnd < tcp->peer_rwnd) ? tcp->cwnd : tcp->peer_rwnd;
+    uint32_t size;
+
+    if ((t->buf_lock & SOCK_SNDBUF_LOCK) || (t->txmem_size >= WOLFIP_TXBUF_MAX))
+        return;
+    if ((win << 1) <= t->txmem_size)
+        return;
+    size = t->txmem_size << 1;
+    if (size > WOLFIP_TXBUF_MAX)
+        size = WOLFIP_TXBUF_MAX;
+    if ((sockbuf_set_snd(t, size) == 0) && tx_has_writable_space(t))
+        t->events |= CB_EVENT_WRITABLE;
+}
+#endif
+
 /* UDP */
+
+/* Largest fifo entry a UDP socket grows for: a WOLFIP_REASM_MAX datagram */
+#define UDP_FIFO_FIT_MAX \
+    (((uint32_t)sizeof(struct pkt_desc) + ETH_HEADER_LEN + WOLFIP_REASM_MAX + 3U) & ~3U)
+
+/* Make room in a UDP fifo for a frame of 'len' bytes. The default
+ * buffers are smaller than a datagram sent or reassembled from
+ * fragments may be: unless the application set the size ('lock'), a
+ * buffer too small for it grows on demand, within UDP_FIFO_FIT_MAX more
+ * than it holds and the socket buffer budget. An empty fifo starts over
+ * at the beginning of its buffer. Returns non-zero if the frame fits. */
+static int udp_fifo_fit(struct tsocket *t, struct fifo *f, uint8_t **mem,
+        uint32_t *mem_size, uint32_t len, uint8_t lock)
+{
+    uint32_t needed = ((uint32_t)sizeof(struct pkt_desc) + len + 3U) & ~3U;
+    uint32_t size;
+
+    if (fifo_can_push_len(f, len))
+        return 1;
+    if (fifo_is_empty(f))
+        fifo_init(f, *mem, *mem_size);
+    if ((needed > f->size) && (needed <= UDP_FIFO_FIT_MAX) && !(t->buf_lock & lock)) {
+        size = fifo_is_empty(f) ? needed : f->size + needed;
+        (void)fifo_resize(t->S, f, mem, mem_size, size);
+    }
+    return fifo_can_push_len(f, len);
+}
+
 static struct tsocket *udp_new_socket(struct wolfIP *s)
 {
     struct tsocket *t;
@@ -2207,17 +2771,20 @@ static struct tsocket *udp_new_socket(struct wolfIP *s)
     for (i = 0; i < MAX_UDPSOCKETS; i++) {
         t = &s->udpsockets[i];
         if (t->proto == 0) {
-            t->proto = WI_IPPROTO_UDP;
             t->S = s;
+            if (sockbuf_init(t) < 0)
+                return NULL;
+            t->proto = WI_IPPROTO_UDP;
             t->if_idx = 0;
-            fifo_init(&t->sock.udp.rxbuf, t->rxmem, RXBUF_SIZE);
-            fifo_init(&t->sock.udp.txbuf, t->txmem, TXBUF_SIZE);
+            fifo_init(&t->sock.udp.rxbuf, t->rxmem, t->rxmem_size);
+            fifo_init(&t->sock.udp.txbuf, t->txmem, t->txmem_size);
 #ifdef IP_MULTICAST
             t->sock.udp.mcast_ttl = 1;
             t->sock.udp.mcast_loop = 1;
 #endif
             if (tx_has_writable_space(t))
                 t->events |= CB_EVENT_WRITABLE;
+            udp_demux_update(t);
             return t;
         }
     }
@@ -2227,7 +2794,7 @@ static struct tsocket *udp_new_socket(struct wolfIP *s)
 static void udp_try_recv(struct wolfIP *s, unsigned int if_idx,
                          struct wolfIP_udp_datagram *udp, uint32_t frame_len)
 {
-    int i;
+    struct tsocket *t;
     int matched = 0;
     ip4 dst_ip;
     ip4 src_ip;
@@ -2249,7 +2816,7 @@ static void udp_try_recv(struct wolfIP *s, unsigned int if_idx,
         return;
 
     /* validate UDP checksum per RFC 1122 (only if non-zero) */
-    if (udp->csum != 0) {
+    if ((udp->csum != 0) && !wolfIP_ll_rx_csum_ok(s, if_idx, WOLFIP_CSUM_RX_L4)) {
         union transport_pseudo_header ph;
         ph.ph.src = udp->ip.src;
         ph.ph.dst = udp->ip.dst;
@@ -2265,8 +2832,8 @@ static void udp_try_recv(struct wolfIP *s, unsigned int if_idx,
 
     if (wolfIP_filter_notify_udp(WOLFIP_FILT_RECEIVING, s, if_idx, udp, frame_len) != 0)
         return;
-    for (i = 0; i < MAX_UDPSOCKETS; i++) {
-        struct tsocket *t = &s->udpsockets[i];
+    t = demux_head(s->udp_hash, s->udpsockets, port_slot(ee16(udp->dst_port)));
+    for (; t; t = demux_next(s->udpsockets, t)) {
         uint32_t expected_len;
         int addr_match =
                 (((t->local_ip == 0) && DHCP_IS_RUNNING(s)) ||
@@ -2293,7 +2860,9 @@ static void udp_try_recv(struct wolfIP *s, unsigned int if_idx,
             /* A bound socket matched this datagram. If the RX FIFO is full,
              * drop silently instead of misreporting the port as closed. */
             matched = 1;
-            if (fifo_push(&t->sock.udp.rxbuf, udp, frame_len) == 0) {
+            if (udp_fifo_fit(t, &t->sock.udp.rxbuf, &t->rxmem, &t->rxmem_size,
+                        frame_len, SOCK_RCVBUF_LOCK) &&
+                    (fifo_push(&t->sock.udp.rxbuf, udp, frame_len) == 0)) {
                 t->events |= CB_EVENT_READABLE;
             }
         }
@@ -2322,11 +2891,13 @@ static struct tsocket *icmp_new_socket(struct wolfIP *s)
     for (i = 0; i < MAX_ICMPSOCKETS; i++) {
         t = &s->icmpsockets[i];
         if (t->proto == 0) {
-            t->proto = WI_IPPROTO_ICMP;
             t->S = s;
+            if (sockbuf_init(t) < 0)
+                return NULL;
+            t->proto = WI_IPPROTO_ICMP;
             t->if_idx = 0;
-            fifo_init(&t->sock.udp.rxbuf, t->rxmem, RXBUF_SIZE);
-            fifo_init(&t->sock.udp.txbuf, t->txmem, TXBUF_SIZE);
+            fifo_init(&t->sock.udp.rxbuf, t->rxmem, t->rxmem_size);
+            fifo_init(&t->sock.udp.txbuf, t->txmem, t->txmem_size);
             if (tx_has_writable_space(t))
                 t->events |= CB_EVENT_WRITABLE;
             return t;
@@ -2412,6 +2983,48 @@ static void icmp_try_recv(struct wolfIP *s, unsigned int if_idx,
     }
 }
 
+/* RFC 1191 §7: MTU plateaus, tried in turn by a router that does not
+ * report the next-hop MTU */
+static const uint16_t pmtu_plateaus[] = {
+    32000, 17914, 8166, 4352, 2002, 1492, 1006, 508, 296, 68
+};
+
+/* ICMP fragmentation needed for a segment in flight: lower the path MTU
+ * and resend the segment the router dropped right away, in fragments
+ * since it was built for the old MSS. Later segments are cut to the new
+ * MSS by send(). */
+static void tcp_pmtu_update(struct tsocket *t, uint16_t next_hop_mtu, uint16_t orig_len)
+{
+    uint32_t mtu = next_hop_mtu;
+    uint32_t cur = wolfIP_socket_path_mtu(t);
+    unsigned int i;
+
+    if (mtu == 0 || mtu >= orig_len) {
+        /* Old router, or a bogus report: guess from the datagram size */
+        mtu = 0;
+        for (i = 0; i < sizeof(pmtu_plateaus) / sizeof(pmtu_plateaus[0]); i++) {
+            if (pmtu_plateaus[i] < orig_len) {
+                mtu = pmtu_plateaus[i];
+                break;
+            }
+        }
+    }
+    if (mtu < WOLFIP_PMTU_MIN)
+        mtu = WOLFIP_PMTU_MIN;
+    if (mtu >= cur)
+        return;
+    t->sock.tcp.pmtu = (uint16_t)mtu;
+    t->sock.tcp.pmtu_tick = (uint32_t)t->S->last_tick;
+    tcp_mark_unsacked_for_retransmit(t, t->sock.tcp.snd_una);
+}
+
+static void tcp_pmtu_age(struct tsocket *t, uint64_t now)
+{
+    if (t->sock.tcp.pmtu &&
+            (uint32_t)now - t->sock.tcp.pmtu_tick >= WOLFIP_PMTU_AGE_MS)
+        t->sock.tcp.pmtu = 0;
+}
+
 static void icmp_try_deliver_tcp_error(struct wolfIP *s,
                                        const struct wolfIP_icmp_packet *icmp)
 {
@@ -2421,7 +3034,7 @@ static void icmp_try_deliver_tcp_error(struct wolfIP *s,
     uint32_t icmp_len;
     uint32_t avail;
     uint32_t orig_hlen;
-    int i;
+    struct tsocket *t;
 
     if (!s || !icmp)
         return;
@@ -2448,9 +3061,8 @@ static void icmp_try_deliver_tcp_error(struct wolfIP *s,
     orig_tcp = ((const uint8_t *)orig_ip) + orig_hlen;
     memcpy(&src_port, orig_tcp, sizeof(src_port));
     memcpy(&dst_port, orig_tcp + sizeof(src_port), sizeof(dst_port));
-    for (i = 0; i < MAX_TCPSOCKETS; i++) {
-        struct tsocket *t = &s->tcpsockets[i];
-
+    t = tcp_demux_conn(s, ee16(src_port), ee16(dst_port), ee32(orig_ip->dst));
+    for (; t; t = demux_next(s->tcpsockets, t)) {
         if (t->proto != WI_IPPROTO_TCP)
             continue;
         if (t->sock.tcp.state == TCP_CLOSED || t->sock.tcp.state == TCP_LISTEN)
@@ -2463,16 +3075,15 @@ static void icmp_try_deliver_tcp_error(struct wolfIP *s,
         if (icmp->type == ICMP_DEST_UNREACH) {
             if (icmp->code == ICMP_FRAG_NEEDED) {
                 uint16_t next_hop_mtu = 0;
+                uint32_t seq;
 
                 memcpy(&next_hop_mtu, &icmp->unused[2], sizeof(next_hop_mtu));
-                next_hop_mtu = ee16(next_hop_mtu);
-                if (next_hop_mtu > (IP_HEADER_LEN + TCP_HEADER_LEN)) {
-                    uint16_t new_mss =
-                        (uint16_t)(next_hop_mtu - (IP_HEADER_LEN + TCP_HEADER_LEN));
-
-                    if (t->sock.tcp.peer_mss == 0 || new_mss < t->sock.tcp.peer_mss)
-                        t->sock.tcp.peer_mss = new_mss;
-                }
+                memcpy(&seq, orig_tcp + 4, sizeof(seq));
+                seq = ee32(seq);
+                /* RFC 5927 §4.1: only act on errors quoting data in flight */
+                if (tcp_seq_leq(t->sock.tcp.snd_una, seq) &&
+                        tcp_seq_lt(seq, t->sock.tcp.seq))
+                    tcp_pmtu_update(t, ee16(next_hop_mtu), ee16(orig_ip->len));
             } else if (icmp->code == ICMP_PROT_UNREACH ||
                     icmp->code == ICMP_PORT_UNREACH) {
                 if (t->sock.tcp.state == TCP_SYN_SENT ||
@@ -2569,7 +3180,7 @@ static uint32_t tcp_initial_cwnd(uint32_t peer_rwnd, uint32_t smss)
 
 static uint32_t tcp_initial_ssthresh(uint32_t peer_rwnd)
 {
-    return (peer_rwnd < TXBUF_SIZE) ? peer_rwnd : TXBUF_SIZE;
+    return (peer_rwnd < WOLFIP_TXBUF_MAX) ? peer_rwnd : WOLFIP_TXBUF_MAX;
 }
 
 static struct tsocket *tcp_new_socket(struct wolfIP *s)
@@ -2579,8 +3190,10 @@ static struct tsocket *tcp_new_socket(struct wolfIP *s)
     for (i = 0; i < MAX_TCPSOCKETS; i++) {
         t = &s->tcpsockets[i];
         if (t->proto == 0) {
-            t->proto = WI_IPPROTO_TCP;
             t->S = s;
+            if (sockbuf_init(t) < 0)
+                return NULL;
+            t->proto = WI_IPPROTO_TCP;
             t->if_idx = 0;
             t->sock.tcp.state = TCP_CLOSED;
             t->sock.tcp.rto = TCP_RTO_MIN_MS;
@@ -2614,8 +3227,9 @@ static struct tsocket *tcp_new_socket(struct wolfIP *s)
             t->sock.tcp.peer_sack_count = 0;
             memset(t->sock.tcp.ooo, 0, sizeof(t->sock.tcp.ooo));
             {
-#if RXBUF_SIZE > 0xFFFF
-                uint32_t space = RXBUF_SIZE;
+                /* Scale for the largest window the buffer may grow to */
+#if WOLFIP_RXBUF_MAX > 0xFFFF
+                uint32_t space = WOLFIP_RXBUF_MAX;
                 uint8_t shift = 0;
                 while (shift < 14 && (space >> shift) > 0xFFFF)
                     shift++;
@@ -2629,8 +3243,9 @@ static struct tsocket *tcp_new_socket(struct wolfIP *s)
             t->sock.tcp.ws_offer = 1;
             t->sock.tcp.ts_offer = 1;
 
-            queue_init(&t->sock.tcp.rxbuf, t->rxmem, RXBUF_SIZE, 0);
-            fifo_init(&t->sock.tcp.txbuf, t->txmem, TXBUF_SIZE);
+            queue_init(&t->sock.tcp.rxbuf, t->rxmem, t->rxmem_size, 0);
+            fifo_init(&t->sock.tcp.txbuf, t->txmem, t->txmem_size);
+            tcp_demux_update(t);
             return t;
         }
     }
@@ -3645,29 +4260,11 @@ static void tcp_recv(struct tsocket *t, struct wolfIP_tcp_seg *seg)
 
 static uint16_t transport_checksum(union transport_pseudo_header *ph, void *_data)
 {
-    uint32_t sum = 0;
-    uint32_t i = 0;
-    const uint8_t *ptr = (const uint8_t *)ph->buf;
-    const uint8_t *data = (const uint8_t *)_data;
-    uint16_t len = ee16(ph->ph.len);
-    uint16_t word;
-    for (i = 0; i < 12; i += 2) {
-        memcpy(&word, ptr + i, sizeof(word));
-        sum += ee16(word);
-    }
-    for (i = 0; i < (len & ~1u); i += 2) {
-        memcpy(&word, data + i, sizeof(word));
-        sum += ee16(word);
-    }
-    if (len & 0x01) {
-        uint16_t spare = 0;
-        spare |= (uint16_t)((uint16_t)data[len - 1] << 8);
-        sum += spare;
-    }
-    while (sum >> 16) {
-        sum = (sum & 0xffff) + (sum >> 16);
-    }
-    return (uint16_t)~sum;
+    uint32_t sum;
+
+    sum = inet_csum_partial(ph->buf, 12, 0);
+    sum = inet_csum_partial(_data, ee16(ph->ph.len), sum);
+    return ee16(inet_csum_fold(sum));
 }
 
 static int transport_verify_checksum(union transport_pseudo_header *ph, void *data)
@@ -3677,52 +4274,23 @@ static int transport_verify_checksum(union transport_pseudo_header *ph, void *da
 
 static uint16_t icmp_checksum(struct wolfIP_icmp_packet *icmp, uint16_t len)
 {
-    uint32_t sum = 0;
-    uint32_t i = 0;
-    const uint8_t *ptr = (const uint8_t *)(&icmp->type);
-    uint16_t word;
-    for (i = 0; i < (len & ~1u); i += 2) {
-        memcpy(&word, ptr + i, sizeof(word));
-        sum += ee16(word);
-    }
-    if (len & 0x01) {
-        uint16_t spare = 0;
-        spare |= (uint16_t)((uint16_t)ptr[len - 1] << 8);
-        sum += spare;
-    }
-    while (sum >> 16) {
-        sum = (sum & 0xffff) + (sum >> 16);
-    }
-    return (uint16_t)(~sum & 0xFFFF);
+    return ee16(inet_csum_fold(inet_csum_partial(&icmp->type, len, 0)));
 }
 
 static void iphdr_set_checksum(struct wolfIP_ip_packet *ip)
 {
-    uint32_t sum = 0;
-    uint32_t i = 0;
     uint32_t ip_hlen = (uint32_t)(ip->ver_ihl & 0x0fU) << 2;
-    const uint8_t *ptr = (const uint8_t *)(&ip->ver_ihl);
 
     if (ip_hlen < IP_HEADER_LEN)
         ip_hlen = IP_HEADER_LEN;
 
-    for (i = 0; i < ip_hlen; i += 2) {
-        uint16_t word;
-        memcpy(&word, ptr + i, sizeof(word));
-        sum += ee16(word);
-    }
-    while (sum >> 16) {
-        sum = (sum & 0xffff) + (sum >> 16);
-    }
-    ip->csum = ee16((uint16_t)~sum);
+    /* inet_csum_fold() is already in network byte order */
+    ip->csum = inet_csum_fold(inet_csum_partial(&ip->ver_ihl, ip_hlen, 0));
 }
 
 static int iphdr_verify_checksum(struct wolfIP_ip_packet *ip)
 {
-    uint32_t sum = 0;
-    uint32_t i;
     uint32_t ip_hlen;
-    const uint8_t *ptr = (const uint8_t *)(&ip->ver_ihl);
 
     if ((ip->ver_ihl >> 4) != 4)
         return -1;
@@ -3730,14 +4298,7 @@ static int iphdr_verify_checksum(struct wolfIP_ip_packet *ip)
     if (ip_hlen < IP_HEADER_LEN)
         return -1;
 
-    for (i = 0; i < ip_hlen; i += 2) {
-        uint16_t word;
-        memcpy(&word, ptr + i, sizeof(word));
-        sum += ee16(word);
-    }
-    while (sum >> 16)
-        sum = (sum & 0xffff) + (sum >> 16);
-    return ((uint16_t)sum == 0xffffU) ? 0 : -1;
+    return (inet_csum_fold(inet_csum_partial(&ip->ver_ihl, ip_hlen, 0)) == 0) ? 0 : -1;
 }
 
 #ifdef ETHERNET
@@ -3978,7 +4539,10 @@ static int ip_output_add_header(struct tsocket *t, struct wolfIP_ip_packet *ip,
                                 uint8_t proto, uint16_t len)
 {
     union transport_pseudo_header ph;
-    unsigned int if_idx;
+    unsigned int if_idx = wolfIP_socket_if_idx(t);
+    /* The MAC cannot checksum a datagram that leaves in fragments */
+    int l4_offload = wolfIP_ll_tx_csum_offload(t->S, if_idx, WOLFIP_CSUM_TX_L4) &&
+            (len <= wolfIP_socket_path_mtu(t));
     memset(&ph, 0, sizeof(ph));
     memset(ip, 0, sizeof(struct wolfIP_ip_packet));
     ip->src = ee32(t->local_ip);
@@ -3986,7 +4550,7 @@ static int ip_output_add_header(struct tsocket *t, struct wolfIP_ip_packet *ip,
     ip->ver_ihl = 0x45;
     ip->tos = 0;
     ip->len = ee16(len);
-    ip->flags_fo = (proto == WI_IPPROTO_TCP) ? ee16(0x4000U) : 0;
+    ip->flags_fo = (proto == WI_IPPROTO_TCP) ? ee16(IP_FLAG_DF) : 0;
     ip->ttl = 64;
 #ifdef IP_MULTICAST
     if (proto == WI_IPPROTO_UDP && wolfIP_ip_is_multicast(t->remote_ip))
@@ -3996,14 +4560,24 @@ static int ip_output_add_header(struct tsocket *t, struct wolfIP_ip_packet *ip,
     ip->id = ee16(t->S->ipcounter);
     t->S->ipcounter = (uint16_t)(t->S->ipcounter + 1);
     ip->csum = 0;
-    iphdr_set_checksum(ip);
+    if (!wolfIP_ll_tx_csum_offload(t->S, if_idx, WOLFIP_CSUM_TX_IP))
+        iphdr_set_checksum(ip);
 
     ph.ph.src = ip->src;
     ph.ph.dst = ip->dst;
     ph.ph.zero = 0;
     ph.ph.proto = proto;
     ph.ph.len = ee16(len - IP_HEADER_LEN);
-    if (proto == WI_IPPROTO_TCP) {
+    if (l4_offload) {
+        /* The MAC computes the checksum, pseudo header included, into a
+         * zeroed field */
+        if (proto == WI_IPPROTO_TCP)
+            ((struct wolfIP_tcp_seg *)ip)->csum = 0;
+        else if (proto == WI_IPPROTO_UDP)
+            ((struct wolfIP_udp_datagram *)ip)->csum = 0;
+        else if (proto == WI_IPPROTO_ICMP)
+            ((struct wolfIP_icmp_packet *)ip)->csum = 0;
+    } else if (proto == WI_IPPROTO_TCP) {
         struct wolfIP_tcp_seg *tcp = (struct wolfIP_tcp_seg *)ip;
         tcp->csum = 0;
         tcp->csum = ee16(transport_checksum(&ph, &tcp->src_port));
@@ -4021,7 +4595,6 @@ static int ip_output_add_header(struct tsocket *t, struct wolfIP_ip_packet *ip,
         icmp->csum = ee16(icmp_checksum(icmp, ee16(ph.ph.len)));
     }
 #ifdef ETHERNET
-    if_idx = wolfIP_socket_if_idx(t);
     if (!wolfIP_ll_is_non_ethernet(t->S, if_idx)) {
         eth_output_add_header(t->S, if_idx, t->nexthop_mac, (struct wolfIP_eth_frame *)ip,
                               ETH_TYPE_IP);
@@ -4032,6 +4605,64 @@ static int ip_output_add_header(struct tsocket *t, struct wolfIP_ip_packet *ip,
     return 0;
 }
 
+/* Send a datagram built by ip_output_add_header() that is larger than the
+ * path MTU as IP fragments (RFC 791). When the driver runs out of room
+ * the offset reached is kept in the descriptor, and the next call resumes
+ * the same datagram from there: the caller must not rebuild its headers
+ * while desc->frag_off is set. */
+static int ip_output_fragments(struct tsocket *t, unsigned int if_idx,
+        struct pkt_desc *desc, struct wolfIP_ip_packet *ip, uint32_t len)
+{
+    struct wolfIP *s = t->S;
+    uint8_t frame[LINK_MTU];
+    struct wolfIP_ip_packet *frag = (struct wolfIP_ip_packet *)frame;
+    const uint8_t *payload = ((const uint8_t *)ip) + ETH_HEADER_LEN + IP_HEADER_LEN;
+    uint32_t mtu = wolfIP_socket_path_mtu(t);
+    uint32_t payload_len, chunk, off;
+
+    if (len <= (ETH_HEADER_LEN + IP_HEADER_LEN) || mtu < (IP_HEADER_LEN + 8U))
+        return -WOLFIP_EINVAL;
+    payload_len = len - (ETH_HEADER_LEN + IP_HEADER_LEN);
+    chunk = (mtu - IP_HEADER_LEN) & ~7U;
+    off = desc->frag_off;
+    while (off < payload_len) {
+        uint32_t n = payload_len - off;
+        uint16_t fo = (uint16_t)(off >> 3);
+        int ret;
+
+        if (n > chunk) {
+            n = chunk;
+            fo |= IP_FLAG_MF;
+        }
+        memcpy(frame, ip, ETH_HEADER_LEN + IP_HEADER_LEN);
+        memcpy(frame + ETH_HEADER_LEN + IP_HEADER_LEN, payload + off, n);
+        frag->len = ee16((uint16_t)(IP_HEADER_LEN + n));
+        frag->flags_fo = ee16(fo);
+        frag->csum = 0;
+        if (!wolfIP_ll_tx_csum_offload(s, if_idx, WOLFIP_CSUM_TX_IP))
+            iphdr_set_checksum(frag);
+        ret = wolfIP_ll_send_frame(s, if_idx, frame, ETH_HEADER_LEN + IP_HEADER_LEN + n);
+        if (ret < 0) {
+            desc->frag_off = (ret == -WOLFIP_EAGAIN) ? (uint16_t)off : 0;
+            return ret;
+        }
+        s->frag_out++;
+        off += n;
+    }
+    desc->frag_off = 0;
+    return (int)len;
+}
+
+/* Hand a socket's datagram to the interface, in fragments if the path
+ * MTU requires it */
+static int wolfIP_sock_send_frame(struct tsocket *t, unsigned int if_idx,
+        struct pkt_desc *desc, void *buf, uint32_t len)
+{
+    if (len > ETH_HEADER_LEN + wolfIP_socket_path_mtu(t))
+        return ip_output_fragments(t, if_idx, desc, (struct wolfIP_ip_packet *)buf, len);
+    return wolfIP_ll_send_frame(t->S, if_idx, buf, len);
+}
+
 /* Process timestamp option, calculate RTT */
 static int tcp_process_ts(struct tsocket *t, const struct wolfIP_tcp_seg *tcp,
         uint32_t frame_len)
@@ -4480,15 +5111,14 @@ static void tcp_ack(struct tsocket *t, const struct wolfIP_tcp_seg *tcp)
 static int tcp_listen_ack_matches_child_socket(struct wolfIP *S,
         const struct tsocket *listener, const struct wolfIP_tcp_seg *tcp)
 {
-    int i;
     uint16_t local_port = ee16(tcp->dst_port);
     uint16_t remote_port = ee16(tcp->src_port);
     ip4 local_ip = ee32(tcp->ip.dst);
     ip4 remote_ip = ee32(tcp->ip.src);
+    const struct tsocket *t;
 
-    for (i = 0; i < MAX_TCPSOCKETS; i++) {
-        const struct tsocket *t = &S->tcpsockets[i];
-
+    t = tcp_demux_conn(S, local_port, remote_port, remote_ip);
+    for (; t; t = demux_next(S->tcpsockets, t)) {
         if (t == listener || t->proto == 0 || t->S == NULL)
             continue;
         if (t->sock.tcp.state <= TCP_LISTEN)
@@ -4507,7 +5137,7 @@ static int tcp_listen_ack_matches_child_socket(struct wolfIP *S,
 static void tcp_input(struct wolfIP *S, unsigned int if_idx,
                       struct wolfIP_tcp_seg *tcp, uint32_t frame_len)
 {
-    int i;
+    struct tsocket *t, *next;
     int matched = 0;
 
     /* validate minimum TCP segment length */
@@ -4526,7 +5156,7 @@ static void tcp_input(struct wolfIP *S, unsigned int if_idx,
     }
 
     /* validate TCP checksum per RFC 793 */
-    {
+    if (!wolfIP_ll_rx_csum_ok(S, if_idx, WOLFIP_CSUM_RX_L4)) {
         union transport_pseudo_header ph;
         ph.ph.src = tcp->ip.src;
         ph.ph.dst = tcp->ip.dst;
@@ -4539,10 +5169,10 @@ static void tcp_input(struct wolfIP *S, unsigned int if_idx,
 
     if (wolfIP_filter_notify_tcp(WOLFIP_FILT_RECEIVING, S, if_idx, tcp, frame_len) != 0)
         return;
-    for (i = 0; i < MAX_TCPSOCKETS; i++) {
+    for (t = tcp_demux_collect(S, tcp); t; t = next) {
         uint32_t tcplen;
         uint32_t iplen;
-        struct tsocket *t = &S->tcpsockets[i];
+        next = t->demux_next ? &S->tcpsockets[t->demux_next - 1] : NULL;
         if (t->proto == 0 || t->S == NULL)
             continue;
         if (t->src_port == ee16(tcp->dst_port)) {
@@ -4624,6 +5254,8 @@ static void tcp_input(struct wolfIP *S, unsigned int if_idx,
                     (t->sock.tcp.ws_enabled && !(tcp->flags & TCP_FLAG_SYN)) ?
                     t->sock.tcp.snd_wscale : 0;
                 t->sock.tcp.peer_rwnd = (uint32_t)raw_win << ws_shift;
+                if (t->sock.tcp.peer_rwnd > t->sock.tcp.peer_rwnd_max)
+                    t->sock.tcp.peer_rwnd_max = t->sock.tcp.peer_rwnd;
                 if (t->sock.tcp.peer_rwnd > prev_peer_rwnd) {
                     if (t->sock.tcp.persist_active)
                         tcp_persist_stop(t);
@@ -4648,6 +5280,7 @@ static void tcp_input(struct wolfIP *S, unsigned int if_idx,
                     t->remote_ip = IPADDR_ANY;
                     t->dst_port = 0;
                     t->sock.tcp.ack = 0;
+                    tcp_demux_update(t);
                     continue;
                 }
                 if (t->sock.tcp.state == TCP_SYN_SENT) {
@@ -4696,8 +5329,9 @@ static void tcp_input(struct wolfIP *S, unsigned int if_idx,
                     /* Reject SYNs that match an already-active connection
                      * with the same 4-tuple (local_ip, local_port, remote_ip, remote_port).
                      */
-                    for (int k = 0; k < MAX_TCPSOCKETS; k++) {
-                        struct tsocket *tk = &S->tcpsockets[k];
+                    for (struct tsocket *tk = tcp_demux_conn(S, t->src_port,
+                                ee16(tcp->src_port), ee32(tcp->ip.src));
+                            tk; tk = demux_next(S->tcpsockets, tk)) {
                         if (tk == t)
                             continue;
                         if (tk->sock.tcp.state <= TCP_LISTEN ||
@@ -4726,6 +5360,7 @@ static void tcp_input(struct wolfIP *S, unsigned int if_idx,
                     t->sock.tcp.snd_una = t->sock.tcp.seq;
                     t->dst_port = ee16(tcp->src_port);
                     t->remote_ip = ee32(tcp->ip.src);
+                    tcp_demux_update(t);
                     t->events |= CB_EVENT_READABLE; /* Keep flag until application calls accept */
                     tcp_process_ts(t, tcp, frame_len);
                     tcp_send_syn(t, TCP_FLAG_SYN | TCP_FLAG_ACK);
@@ -4951,6 +5586,7 @@ static void tcp_rto_cb(void *arg)
                 ts->remote_ip = 0;
                 ts->dst_port = 0;
                 ts->events = 0;
+                tcp_demux_update(ts);
                 if (ts->bound_local_ip != IPADDR_ANY) {
                     int bound_match = 0;
                     unsigned int bound_if = wolfIP_if_for_local_ip(
@@ -5173,16 +5809,21 @@ static void close_socket(struct tsocket *ts)
     if (!ts)
         return;
     if (ts->proto == WI_IPPROTO_TCP) {
+        demux_unlink(ts->S->tcp_hash, ts->S->tcpsockets, ts);
         tcp_persist_stop(ts);
         if (ts->sock.tcp.tmr_rto != NO_TIMER) {
             timer_binheap_cancel(&ts->S->timers, ts->sock.tcp.tmr_rto);
             ts->sock.tcp.tmr_rto = NO_TIMER;
         }
     }
+    if (ts->proto == WI_IPPROTO_UDP)
+        demux_unlink(ts->S->udp_hash, ts->S->udpsockets, ts);
 #ifdef IP_MULTICAST
     if (ts->proto == WI_IPPROTO_UDP)
         udp_mcast_drop_all(ts);
 #endif
+    if (ts->S)
+        sockbuf_release(ts);
     memset(ts, 0, sizeof(struct tsocket));
 }
 
@@ -5450,15 +6091,18 @@ int wolfIP_sock_connect(struct wolfIP *s, int sockfd, const struct wolfIP_sockad
         ts->dst_port = ee16(sin->sin_port);
         ts->sock.tcp.seq = wolfIP_getrandom();
         ts->sock.tcp.snd_una = ts->sock.tcp.seq;
+        tcp_demux_update(ts);
         if (wolfIP_filter_notify_socket_event(
                 WOLFIP_FILT_CONNECTING, s, ts,
                 ts->local_ip, ts->src_port, ts->remote_ip, ts->dst_port) != 0) {
             ts->sock.tcp.state = TCP_CLOSED;
+            tcp_demux_update(ts);
             return -1;
         }
         ts->sock.tcp.ctrl_rto_retries = 0;
         if (tcp_send_syn(ts, TCP_FLAG_SYN) < 0) {
             ts->sock.tcp.state = TCP_CLOSED;
+            tcp_demux_update(ts);
             return -WOLFIP_EAGAIN;
         }
         tcp_ctrl_rto_start(ts, s->last_tick);
@@ -5493,6 +6137,10 @@ int wolfIP_sock_accept(struct wolfIP *s, int sockfd, struct wolfIP_sockaddr *add
             newts = tcp_new_socket(s);
             if (!newts)
                 return -1;
+            /* Inherit the listener's buffer sizes, best effort */
+            newts->buf_lock = ts->buf_lock;
+            (void)sockbuf_set_rcv(newts, ts->rxmem_size);
+            (void)sockbuf_set_snd(newts, ts->txmem_size);
             /* Don't signal writable until connection fully established */
             newts->events &= ~CB_EVENT_WRITABLE;
             newts->callback = ts->callback;
@@ -5510,6 +6158,7 @@ int wolfIP_sock_accept(struct wolfIP *s, int sockfd, struct wolfIP_sockaddr *add
             newts->sock.tcp.fast_recovery = 0;
             newts->sock.tcp.last_ts = ts->sock.tcp.last_ts;
             newts->sock.tcp.peer_rwnd = ts->sock.tcp.peer_rwnd;
+            newts->sock.tcp.peer_rwnd_max = ts->sock.tcp.peer_rwnd;
             newts->sock.tcp.cwnd = tcp_initial_cwnd(newts->sock.tcp.peer_rwnd, tcp_cc_mss(newts));
             newts->sock.tcp.ssthresh = tcp_initial_ssthresh(newts->sock.tcp.peer_rwnd);
             newts->sock.tcp.peer_mss = ts->sock.tcp.peer_mss;
@@ -5522,6 +6171,7 @@ int wolfIP_sock_accept(struct wolfIP *s, int sockfd, struct wolfIP_sockaddr *add
             newts->sock.tcp.sack_offer = ts->sock.tcp.sack_offer;
             newts->sock.tcp.sack_permitted = ts->sock.tcp.sack_permitted;
             newts->sock.tcp.state = TCP_SYN_RCVD;
+            tcp_demux_update(newts);
             /* Send SYN-ACK to accept connection.
              * Send the syn-ack from the newly established socket:
              * the caller could still close the listening socket
@@ -5541,6 +6191,7 @@ int wolfIP_sock_accept(struct wolfIP *s, int sockfd, struct wolfIP_sockaddr *add
                 sin->sin_addr.s_addr = ee32(ts->remote_ip);
             }
             ts->sock.tcp.state = TCP_LISTEN;
+            tcp_demux_update(ts);
             tcp_ctrl_rto_stop(ts);
             ts->sock.tcp.seq = wolfIP_getrandom();
             if (ts->bound_local_ip != IPADDR_ANY) {
@@ -5606,7 +6257,7 @@ int wolfIP_sock_sendto(struct wolfIP *s, int sockfd, const void *buf, size_t len
             uint32_t payload_cap = (uint32_t)(len - sent);
             uint32_t opt_len = ts->sock.tcp.ts_enabled ? TCP_OPTIONS_LEN : 0;
             uint32_t frame_base = (uint32_t)(sizeof(struct wolfIP_tcp_seg) + opt_len);
-            uint32_t tx_cap = tcp_tx_payload_cap(ts);
+            uint32_t tx_cap = tcp_bound_to_half_wnd(ts, tcp_tx_payload_cap(ts));
             push_iter++;
             if (payload_cap > tx_cap)
                 payload_cap = tx_cap;
@@ -5650,6 +6301,10 @@ int wolfIP_sock_sendto(struct wolfIP *s, int sockfd, const void *buf, size_t len
                 break;
             }
         }
+#if WOLFIP_SOCKBUF_AUTOTUNE
+        if (sent < len)
+            tcp_sndbuf_autotune(ts);
+#endif
         if (sent == 0) {
             return -WOLFIP_EAGAIN;
         } else {
@@ -5666,7 +6321,6 @@ int wolfIP_sock_sendto(struct wolfIP *s, int sockfd, const void *buf, size_t len
         const struct wolfIP_sockaddr_in *sin = (const struct wolfIP_sockaddr_in *)dest_addr;
         unsigned int if_idx;
         struct ipconf *conf;
-        uint32_t ip_mtu;
         uint32_t frame_len;
         if (SOCKET_UNMARK(sockfd) >= MAX_UDPSOCKETS)
             return -WOLFIP_EINVAL;
@@ -5687,6 +6341,7 @@ int wolfIP_sock_sendto(struct wolfIP *s, int sockfd, const void *buf, size_t len
             ts->src_port = (uint16_t)(wolfIP_getrandom() & 0xFFFF);
             if (ts->src_port < 1024)
                 ts->src_port += 1024;
+            udp_demux_update(ts);
         }
         if_idx = wolfIP_route_for_ip(s, ts->remote_ip);
 #ifdef IP_MULTICAST
@@ -5704,12 +6359,15 @@ int wolfIP_sock_sendto(struct wolfIP *s, int sockfd, const void *buf, size_t len
                     ts->local_ip = primary->ip;
             }
         }
-        ip_mtu = wolfIP_socket_ip_mtu(ts);
-        if (ip_mtu <= (IP_HEADER_LEN + UDP_HEADER_LEN) ||
-                len > ip_mtu - IP_HEADER_LEN - UDP_HEADER_LEN)
-            return -1; /* Fragmentation not supported */
+        /* Datagrams above the path MTU leave in fragments, but must fit
+         * in the send buffer, which grows for them if needed */
+        if (len > (0xFFFFU - IP_HEADER_LEN - UDP_HEADER_LEN))
+            return -1;
         frame_len = (uint32_t)sizeof(struct wolfIP_udp_datagram) + (uint32_t)len;
-        if (!fifo_can_push_len(&ts->sock.udp.txbuf, frame_len)) {
+        if (!udp_fifo_fit(ts, &ts->sock.udp.txbuf, &ts->txmem, &ts->txmem_size,
+                    frame_len, SOCK_SNDBUF_LOCK)) {
+            if (frame_len + sizeof(struct pkt_desc) > ts->sock.udp.txbuf.size)
+                return -1;
             return -WOLFIP_EAGAIN;
         }
 
@@ -5717,9 +6375,14 @@ int wolfIP_sock_sendto(struct wolfIP *s, int sockfd, const void *buf, size_t len
         udp->dst_port = ee16(ts->dst_port);
         udp->len = ee16(len + UDP_HEADER_LEN);
         udp->csum = 0;
-        memcpy(udp->data, buf, len);
-        if (fifo_push(&ts->sock.udp.txbuf, udp, frame_len) < 0)
+        if (fifo_push(&ts->sock.udp.txbuf, NULL, frame_len) < 0)
             return -WOLFIP_EAGAIN;
+        {
+            uint8_t *dgram = ts->txmem + ts->sock.udp.txbuf.last_pos + sizeof(struct pkt_desc);
+
+            memcpy(dgram, udp, sizeof(struct wolfIP_udp_datagram));
+            memcpy(dgram + sizeof(struct wolfIP_udp_datagram), buf, len);
+        }
         return len;
     } else if (IS_SOCKET_ICMP(sockfd)) {
         const struct wolfIP_sockaddr_in *sin = (const struct wolfIP_sockaddr_in *)dest_addr;
@@ -5985,7 +6648,11 @@ int wolfIP_sock_recvfrom(struct wolfIP *s, int sockfd, void *buf, size_t len, in
             uint16_t win_before = tcp_adv_win(ts, 1);
             int ret = queue_pop(&ts->sock.tcp.rxbuf, buf, len);
             if (ret > 0) {
-                uint16_t win_after = tcp_adv_win(ts, 1);
+                uint16_t win_after;
+#if WOLFIP_SOCKBUF_AUTOTUNE
+                tcp_rcvbuf_autotune(ts, (uint32_t)ret);
+#endif
+                win_after = tcp_adv_win(ts, 1);
                 if (queue_len(&ts->sock.tcp.rxbuf) > 0)
                     ts->events |= CB_EVENT_READABLE;
                 if (win_after > win_before)
@@ -6317,6 +6984,20 @@ int wolfIP_sock_setsockopt(struct wolfIP *s, int sockfd, int level, int optname,
     ts = wolfIP_socket_from_fd(s, sockfd);
     if (!ts)
         return -WOLFIP_EINVAL;
+    if (level == WOLFIP_SOL_SOCKET &&
+            (optname == WOLFIP_SO_RCVBUF || optname == WOLFIP_SO_SNDBUF)) {
+        int size;
+        if (!optval || optlen < (socklen_t)sizeof(int))
+            return -WOLFIP_EINVAL;
+        memcpy(&size, optval, sizeof(int));
+        /* An explicit size turns autotuning off for that direction */
+        if (optname == WOLFIP_SO_RCVBUF) {
+            ts->buf_lock |= SOCK_RCVBUF_LOCK;
+            return sockbuf_set_rcv(ts, sockbuf_clamp(size, WOLFIP_RXBUF_MAX));
+        }
+        ts->buf_lock |= SOCK_SNDBUF_LOCK;
+        return sockbuf_set_snd(ts, sockbuf_clamp(size, WOLFIP_TXBUF_MAX));
+    }
     if (level == WOLFIP_SOL_IP && optname == WOLFIP_IP_RECVTTL) {
         int enable;
         if (!optval || optlen < (socklen_t)sizeof(int))
@@ -6493,6 +7174,20 @@ int wolfIP_sock_getsockopt(struct wolfIP *s, int sockfd, int level, int optname,
         }
         return 0;
     }
+    if (level == WOLFIP_SOL_SOCKET &&
+            (optname == WOLFIP_SO_RCVBUF || optname == WOLFIP_SO_SNDBUF)) {
+        int value;
+        if (!optval || !optlen || *optlen < (socklen_t)sizeof(int))
+            return -WOLFIP_EINVAL;
+        /* Raw and packet sockets keep fixed, embedded buffers */
+        if (optname == WOLFIP_SO_RCVBUF)
+            value = ts ? (int)ts->rxmem_size : RXBUF_SIZE;
+        else
+            value = ts ? (int)ts->txmem_size : TXBUF_SIZE;
+        memcpy(optval, &value, sizeof(int));
+        *optlen = sizeof(int);
+        return 0;
+    }
 #ifdef IP_MULTICAST
     if (level == WOLFIP_SOL_IP && IS_SOCKET_UDP(sockfd)) {
         if (optname == WOLFIP_IP_MULTICAST_TTL ||
@@ -6833,6 +7528,7 @@ int wolfIP_sock_bind(struct wolfIP *s, int sockfd, const struct wolfIP_sockaddr
                 return -1;
             }
             ts->src_port = new_port;
+            tcp_demux_update(ts);
         }
         ts->bound_local_ip = bind_ip;
         return 0;
@@ -6868,6 +7564,7 @@ int wolfIP_sock_bind(struct wolfIP *s, int sockfd, const struct wolfIP_sockaddr
                 ts->src_port = prev_port;
                 return -1;
             }
+            udp_demux_update(ts);
         }
         ts->bound_local_ip = bind_ip;
         return 0;
@@ -7008,7 +7705,8 @@ static void icmp_input(struct wolfIP *s, unsigned int if_idx, struct wolfIP_ip_p
     if (len < (uint32_t)(ETH_HEADER_LEN + ee16(ip->len)))
         return;
     /* validate ICMP checksum before processing */
-    if (icmp_checksum(icmp, (uint16_t)(ee16(ip->len) - IP_HEADER_LEN)) != 0)
+    if (!wolfIP_ll_rx_csum_ok(s, if_idx, WOLFIP_CSUM_RX_L4) &&
+            (icmp_checksum(icmp, (uint16_t)(ee16(ip->len) - IP_HEADER_LEN)) != 0))
         return;
 
     if (wolfIP_filter_notify_icmp(WOLFIP_FILT_RECEIVING, s, if_idx, icmp, len) != 0)
@@ -8215,6 +8913,24 @@ size_t wolfIP_instance_size(void)
     return sizeof(struct wolfIP);
 }
 
+uint32_t wolfIP_sockbuf_mem(struct wolfIP *s)
+{
+    return s ? s->sockbuf_mem : 0;
+}
+
+void wolfIP_ip_frag_stats(struct wolfIP *s, uint32_t *reasm_ok, uint32_t *reasm_drop,
+        uint32_t *frag_out)
+{
+    if (!s)
+        return;
+    if (reasm_ok)
+        *reasm_ok = s->reasm_ok;
+    if (reasm_drop)
+        *reasm_drop = s->reasm_drop;
+    if (frag_out)
+        *frag_out = s->frag_out;
+}
+
 void wolfIP_set_dns_server(struct wolfIP *s, ip4 addr)
 {
     if (!s)
@@ -8226,6 +8942,170 @@ void wolfIP_set_dns_server(struct wolfIP *s, ip4 addr)
 #include "wolfip_debug.c"
 #endif /* DEBUG || DEBUG_ETH || DEBUG_IP || DEBUG_UDP */
 
+#if WOLFIP_REASM_CTX > 0
+/* Last byte of the trailing hole until the last fragment is in */
+#define REASM_HOLE_END 0xFFFFU
+
+static void ip_reasm_release(struct ip_reasm *r, int dropped)
+{
+    struct wolfIP *s = r->S;
+
+    if (r->tmr != NO_TIMER)
+        timer_binheap_cancel(&s->timers, r->tmr);
+    if (r->buf)
+        WOLFIP_BUF_FREE(r->buf);
+    if (dropped)
+        s->reasm_drop++;
+    memset(r, 0, sizeof(*r));
+}
+
+static void ip_reasm_timeout_cb(void *arg)
+{
+    struct ip_reasm *r = (struct ip_reasm *)arg;
+
+    r->tmr = NO_TIMER;
+    if (r->buf)
+        ip_reasm_release(r, 1);
+}
+
+static struct ip_reasm *ip_reasm_get(struct wolfIP *s, const struct wolfIP_ip_packet *ip)
+{
+    struct ip_reasm *r, *slot = NULL, *oldest = NULL;
+    struct wolfIP_timer tmr = {0};
+    int i;
+
+    for (i = 0; i < WOLFIP_REASM_CTX; i++) {
+        r = &s->reasm[i];
+        if (!r->buf) {
+            if (!slot)
+                slot = r;
+            continue;
+        }
+        if (r->id == ip->id && r->src == ip->src && r->dst == ip->dst &&
+                r->proto == ip->proto)
+            return r;
+        if (!oldest || r->started < oldest->started)
+            oldest = r;
+    }
+    if (!slot) {
+        /* All in use: the oldest datagram is the likeliest to have lost
+         * a fragment */
+        ip_reasm_release(oldest, 1);
+        slot = oldest;
+    }
+    slot->buf = WOLFIP_BUF_ALLOC(ETH_HEADER_LEN + WOLFIP_REASM_MAX);
+    if (!slot->buf)
+        return NULL;
+    slot->S = s;
+    slot->src = ip->src;
+    slot->dst = ip->dst;
+    slot->id = ip->id;
+    slot->proto = ip->proto;
+    slot->nholes = 1;
+    slot->holes[0].first = 0;
+    slot->holes[0].last = REASM_HOLE_END;
+    slot->started = s->last_tick;
+    tmr.cb = ip_reasm_timeout_cb;
+    tmr.arg = slot;
+    tmr.expires = s->last_tick + WOLFIP_REASM_TIMEOUT_MS;
+    slot->tmr = timers_binheap_insert(&s->timers, tmr);
+    return slot;
+}
+
+static int ip_reasm_add_hole(struct ip_reasm *r, uint32_t first, uint32_t last)
+{
+    if (r->nholes >= WOLFIP_REASM_HOLES)
+        return -1;
+    r->holes[r->nholes].first = (uint16_t)first;
+    r->holes[r->nholes].last = (uint16_t)last;
+    r->nholes++;
+    return 0;
+}
+
+/* Add a fragment to its datagram. Returns the complete datagram, in a
+ * buffer the caller frees with WOLFIP_BUF_FREE(), once the last hole is
+ * filled, NULL until then. */
+static uint8_t *ip_reasm_input(struct wolfIP *s, const struct wolfIP_ip_packet *ip,
+        uint32_t *len)
+{
+    uint32_t hlen = (uint32_t)(ip->ver_ihl & 0x0fU) << 2;
+    uint16_t fo = ee16(ip->flags_fo);
+    uint32_t first = (uint32_t)(fo & IP_FRAG_OFF_MASK) << 3;
+    int more = (fo & IP_FLAG_MF) ? 1 : 0;
+    struct ip_reasm_hole h;
+    struct ip_reasm *r;
+    struct wolfIP_ip_packet *dgram;
+    uint8_t *buf;
+    uint32_t n, last;
+    int i, hole = -1;
+
+    if (ee16(ip->len) <= hlen || *len < ETH_HEADER_LEN + (uint32_t)ee16(ip->len))
+        return NULL;
+    n = ee16(ip->len) - hlen;
+    last = first + n - 1;
+    /* All fragments but the last carry a multiple of 8 bytes */
+    if (more && (n & 7U))
+        return NULL;
+    r = ip_reasm_get(s, ip);
+    if (!r)
+        return NULL;
+    if (last >= WOLFIP_REASM_MAX - IP_HEADER_LEN ||
+            (r->total && last >= r->total) ||
+            (!more && (r->end > last + 1 || (r->total && r->total != last + 1)))) {
+        /* Too large, or at odds with the fragments received so far */
+        ip_reasm_release(r, 1);
+        return NULL;
+    }
+    for (i = 0; i < r->nholes; i++) {
+        if (first >= r->holes[i].first && last <= r->holes[i].last) {
+            hole = i;
+            break;
+        }
+        if (first <= r->holes[i].last && last >= r->holes[i].first) {
+            /* Overlaps data already received: overlapping fragments are
+             * a classic way past filters, drop the whole datagram */
+            ip_reasm_release(r, 1);
+            return NULL;
+        }
+    }
+    if (hole < 0)
+        return NULL; /* duplicate */
+
+    h = r->holes[hole];
+    r->holes[hole] = r->holes[--r->nholes];
+    if ((first > h.first && ip_reasm_add_hole(r, h.first, first - 1) < 0) ||
+            (more && last < h.last && ip_reasm_add_hole(r, last + 1, h.last) < 0)) {
+        ip_reasm_release(r, 1);
+        return NULL;
+    }
+    if (!more)
+        r->total = last + 1;
+    if (r->end < last + 1)
+        r->end = last + 1;
+    memcpy(r->buf + ETH_HEADER_LEN + IP_HEADER_LEN + first,
+            ((const uint8_t *)ip) + ETH_HEADER_LEN + hlen, n);
+    /* The datagram takes the headers of its first fragment (RFC 791),
+     * without IP options */
+    if (first == 0)
+        memcpy(r->buf, ip, ETH_HEADER_LEN + IP_HEADER_LEN);
+    if (r->nholes > 0)
+        return NULL;
+
+    buf = r->buf;
+    r->buf = NULL;
+    dgram = (struct wolfIP_ip_packet *)buf;
+    dgram->ver_ihl = 0x45;
+    dgram->len = ee16((uint16_t)(IP_HEADER_LEN + r->total));
+    dgram->flags_fo = 0;
+    dgram->csum = 0;
+    iphdr_set_checksum(dgram);
+    *len = ETH_HEADER_LEN + IP_HEADER_LEN + r->total;
+    ip_reasm_release(r, 0);
+    s->reasm_ok++;
+    return buf;
+}
+#endif /* WOLFIP_REASM_CTX > 0 */
+
 static inline void ip_recv(struct wolfIP *s, unsigned int if_idx,
                            struct wolfIP_ip_packet *ip, uint32_t len)
 {
@@ -8247,10 +9127,7 @@ static inline void ip_recv(struct wolfIP *s, unsigned int if_idx,
     if (ee16(ip->len) < ip_hlen)
         return;
     /* validate IP header checksum per RFC 1122 */
-    if (iphdr_verify_checksum(ip) != 0)
-        return;
-    /* Fragment reassembly is not implemented; drop all fragments. */
-    if ((ee16(ip->flags_fo) & 0x3FFFU) != 0U)
+    if (!wolfIP_ll_rx_csum_ok(s, if_idx, WOLFIP_CSUM_RX_IP) && (iphdr_verify_checksum(ip) != 0))
         return;
     /* RFC 1122 §3.2.1.3: discard packets with non-unicast source addresses. */
     {
@@ -8268,6 +9145,24 @@ static inline void ip_recv(struct wolfIP *s, unsigned int if_idx,
         }
     }
 #endif
+    if ((ee16(ip->flags_fo) & (IP_FLAG_MF | IP_FRAG_OFF_MASK)) != 0U) {
+#if WOLFIP_REASM_CTX > 0
+        /* Fragments only go further up as a whole datagram */
+        struct wolfIP_ll_dev *ll = wolfIP_ll_at(s, if_idx);
+        uint8_t *dgram = ip_reasm_input(s, ip, &len);
+
+        if (dgram) {
+            /* Checksum flags set by the driver were for the last fragment */
+            uint8_t rx_csum = ll->rx_csum;
+
+            ll->rx_csum = 0;
+            ip_recv(s, if_idx, (struct wolfIP_ip_packet *)dgram, len);
+            ll->rx_csum = rx_csum;
+            WOLFIP_BUF_FREE(dgram);
+        }
+#endif
+        return;
+    }
     if (wolfIP_filter_notify_ip(WOLFIP_FILT_RECEIVING, s, if_idx, ip, len) != 0)
         return;
 #if WOLFIP_RAWSOCKETS
@@ -8984,16 +9879,57 @@ int wolfIP_dns_ptr_lookup(struct wolfIP *s, uint32_t ip, uint16_t *id, void (*lo
  * It returns the number of milliseconds to wait before
  * calling it again (TODO).
  */
+/* Open or close a TX batch on every interface that supports it: frames
+ * sent while the batch is open are handed to the hardware together. */
+static void wolfIP_ll_tx_batch(struct wolfIP *s, int begin)
+{
+    unsigned int if_idx;
+    for (if_idx = 0; if_idx < s->if_count; if_idx++) {
+        struct wolfIP_ll_dev *ll = wolfIP_ll_at(s, if_idx);
+        if (!ll || !ll->tx_begin || !ll->tx_flush)
+            continue;
+        if (begin)
+            ll->tx_begin(ll);
+        else
+            ll->tx_flush(ll);
+    }
+}
+
+/* Milliseconds until wolfIP_poll() has work to do: 0 when frames are
+ * already queued on the loopback interface, -1 when no timer is armed. */
+int wolfIP_poll_timeout(struct wolfIP *s, uint64_t now)
+{
+    uint64_t expires;
+
+    if (!s)
+        return -1;
+#if WOLFIP_ENABLE_LOOPBACK
+    if (s->loopback_count > 0)
+        return 0;
+#endif
+    if (!is_timer_expired(&s->timers, now)) {
+        if (s->timers.size == 0)
+            return -1;
+        expires = s->timers.timers[0].expires;
+        if (expires - now > 0x7FFFFFFFU)
+            return 0x7FFFFFFF;
+        return (int)(expires - now);
+    }
+    return 0;
+}
+
 int wolfIP_poll(struct wolfIP *s, uint64_t now)
 {
     int len = 0;
     int i = 0;
+    int frames = 0;
     static uint8_t buf[LINK_MTU];
     unsigned int if_idx;
     struct wolfIP_timer tmr;
     memset(buf, 0, LINK_MTU);
 
     s->last_tick = now;
+    wolfIP_ll_tx_batch(s, 1);
 
     /* Step 1: Poll the device */
     for (if_idx = 0; if_idx < s->if_count; if_idx++) {
@@ -9002,6 +9938,18 @@ int wolfIP_poll(struct wolfIP *s, uint64_t now)
         if (!ll || !ll->poll)
             continue;
         do {
+            if (ll->rx_peek && ll->rx_release && !ll->non_ethernet) {
+                void *frame = NULL;
+                len = ll->rx_peek(ll, &frame);
+                if (len > 0) {
+                    /* Process the frame in place, then hand it back */
+                    wolfIP_recv_on(s, if_idx, frame, len);
+                    ll->rx_release(ll);
+                    budget--;
+                    frames++;
+                }
+                continue;
+            }
             if (ll->non_ethernet) {
                 uint32_t frame_mtu = wolfIP_ll_frame_mtu(ll);
                 if (frame_mtu <= ETH_HEADER_LEN)
@@ -9020,6 +9968,7 @@ int wolfIP_poll(struct wolfIP *s, uint64_t now)
                 /* Process packet */
                 wolfIP_recv_on(s, if_idx, buf, len);
                 budget--;
+                frames++;
             }
         } while (len > 0 && budget > 0);
     }
@@ -9085,6 +10034,7 @@ int wolfIP_poll(struct wolfIP *s, uint64_t now)
         struct pkt_desc *desc;
         struct wolfIP_tcp_seg *tcp;
         tcp_resync_inflight(s, ts, now);
+        tcp_pmtu_age(ts, now);
         if (ts->sock.tcp.ack_retry_pending) {
             int ack_ret = tcp_send_empty(ts, TCP_FLAG_ACK);
             if (ack_ret == -WOLFIP_EAGAIN)
@@ -9141,11 +10091,25 @@ int wolfIP_poll(struct wolfIP *s, uint64_t now)
                         struct wolfIP_timer new_tmr = {};
                         size = seg_ip_len;
                         tcp = (struct wolfIP_tcp_seg *)(ts->txmem + desc->pos + sizeof(*desc));
-                        /* Refresh ack counter */
-                        ts->sock.tcp.last_ack = ts->sock.tcp.ack;
-                        tcp->ack = ee32(ts->sock.tcp.ack);
-                        tcp->win = ee16(tcp_adv_win(ts, 1));
-                        ip_output_add_header(ts, (struct wolfIP_ip_packet *)tcp, WI_IPPROTO_TCP, size);
+                        /* A segment partly sent in fragments goes on unchanged */
+                        if (desc->frag_off == 0) {
+                            /* Refresh ack counter */
+                            ts->sock.tcp.last_ack = ts->sock.tcp.ack;
+                            tcp->ack = ee32(ts->sock.tcp.ack);
+                            tcp->win = ee16(tcp_adv_win(ts, 1));
+                            /* Stamp the timestamp option at (re)transmission,
+                             * not when send() queued the segment: pure ACKs sent
+                             * meanwhile carry a newer TSval, and the peer's PAWS
+                             * check would drop the older one for good. */
+                            if (ts->sock.tcp.ts_enabled &&
+                                    ((uint32_t)(tcp->hlen >> 2) >= TCP_HEADER_LEN + TCP_OPTIONS_LEN) &&
+                                    (tcp->data[0] == TCP_OPTION_TS)) {
+                                struct tcp_opt_ts *tsopt = (struct tcp_opt_ts *)tcp->data;
+                                tsopt->val = ee32(now & 0xFFFFFFFF);
+                                tsopt->ecr = ts->sock.tcp.last_ts;
+                            }
+                            ip_output_add_header(ts, (struct wolfIP_ip_packet *)tcp, WI_IPPROTO_TCP, size);
+                        }
                         if (wolfIP_filter_notify_tcp(WOLFIP_FILT_SENDING, ts->S, tx_if, tcp, desc->len) != 0) {
                             break;
                         }
@@ -9167,13 +10131,13 @@ int wolfIP_poll(struct wolfIP *s, uint64_t now)
                                 if (esp_err == 1) {
                                     /* ipsec not configured on this interface.
                                      * send plaintext. */
-                                    send_ret = wolfIP_ll_send_frame(s, tx_if, tcp, desc->len);
+                                    send_ret = wolfIP_sock_send_frame(ts, tx_if, desc, tcp, desc->len);
                                 }
                             } else {
-                                send_ret = wolfIP_ll_send_frame(s, tx_if, tcp, desc->len);
+                                send_ret = wolfIP_sock_send_frame(ts, tx_if, desc, tcp, desc->len);
                             }
                             #else
-                            send_ret = wolfIP_ll_send_frame(s, tx_if, tcp, desc->len);
+                            send_ret = wolfIP_sock_send_frame(ts, tx_if, desc, tcp, desc->len);
                             #endif /* WOLFIP_ESP */
                         }
                         if (send_ret == -WOLFIP_EAGAIN) {
@@ -9263,7 +10227,8 @@ int wolfIP_poll(struct wolfIP *s, uint64_t now)
             }
 #endif
             len = desc->len - ETH_HEADER_LEN;
-            ip_output_add_header(t, (struct wolfIP_ip_packet *)udp, WI_IPPROTO_UDP, len);
+            if (desc->frag_off == 0)
+                ip_output_add_header(t, (struct wolfIP_ip_packet *)udp, WI_IPPROTO_UDP, len);
             if (wolfIP_filter_notify_udp(WOLFIP_FILT_SENDING, t->S, tx_if, udp, desc->len) != 0)
                 break;
             if (wolfIP_filter_notify_ip(WOLFIP_FILT_SENDING, t->S, tx_if, &udp->ip, desc->len) != 0)
@@ -9284,13 +10249,13 @@ int wolfIP_poll(struct wolfIP *s, uint64_t now)
                     if (esp_send(ll, (struct wolfIP_ip_packet *)udp, len) == 1) {
                         /* ipsec not configured on this interface.
                          * send plaintext. */
-                        send_ret = wolfIP_ll_send_frame(s, tx_if, udp, desc->len);
+                        send_ret = wolfIP_sock_send_frame(t, tx_if, desc, udp, desc->len);
                     }
                 } else {
-                    send_ret = wolfIP_ll_send_frame(s, tx_if, udp, desc->len);
+                    send_ret = wolfIP_sock_send_frame(t, tx_if, desc, udp, desc->len);
                 }
                 #else
-                send_ret = wolfIP_ll_send_frame(s, tx_if, udp, desc->len);
+                send_ret = wolfIP_sock_send_frame(t, tx_if, desc, udp, desc->len);
                 #endif /* WOLFIP_ESP */
             }
             if (send_ret == -WOLFIP_EAGAIN)
@@ -9460,7 +10425,8 @@ int wolfIP_poll(struct wolfIP *s, uint64_t now)
         }
     }
 #endif
-    return 0;
+    wolfIP_ll_tx_batch(s, 0);
+    return frames;
 }
 
 void wolfIP_ipconfig_set(struct wolfIP *s, ip4 ip, ip4 mask, ip4 gw)
@@ -270,7 +270,7 @@ static int xipfs_exe(struct fnode *fno, void *arg, struct task_exec_info *info)
 
     phase0_bflt_trace_tag = 0;
 
-    kprintf("xipfs: GDB: add-symbol-file %s%s.gdb 0x%p -s .data 0x%p -s .bss 0x%p\n",
+    klog(KLOG_DEBUG, "xipfs: GDB: add-symbol-file %s%s.gdb 0x%p -s .data 0x%p -s .bss 0x%p\n",
             GDB_PATH, fno->fname, reloc_text, reloc_data, reloc_bss);
 
     info->init = init;
@@ -504,8 +504,10 @@ void xipfs_task_cleanup(uint16_t pid)
 
     for (i = 0; i < MAX_DLOPEN_LIBS; i++) {
         if (dlopen_handles[i].in_use && (dlopen_handles[i].owner_pid == pid)) {
-            if (dlopen_handles[i].runtime.alloc_base)
+            if (dlopen_handles[i].runtime.alloc_base) {
                 secure_munmap(dlopen_handles[i].runtime.alloc_base, pid);
+                task_mpu_invalidate(pid);
+            }
             memset(&dlopen_handles[i], 0, sizeof(dlopen_handles[i]));
         }
     }
@@ -600,8 +602,10 @@ int sys_dlclose_hdlr(void *handle_ptr)
         return 0;
     }
 
-    if (handle->runtime.alloc_base)
+    if (handle->runtime.alloc_base) {
         secure_munmap(handle->runtime.alloc_base, handle->owner_pid);
+        task_mpu_invalidate(handle->owner_pid);
+    }
     memset(handle, 0, sizeof(*handle));
     return 0;
 }
@@ -39,6 +39,24 @@ Layout invariant
 Entries are written in bytewise-sorted order by path. The kernel iterator
 relies on this: within the same parent directory, sibling entries appear
 contiguously, and the lookup early-exits once past the target window.
+
+Log-structured volumes (--log)
+------------------------------
+For SPI NOR with CONFIG_FLASHFS_LOG the layout above becomes the logical
+volume, and the image holds it as a log (frosted/flashfs_log.c):
+
+  Sector page 0 : [magic "FLOG"][erase_count:u32][seq:u32]
+                  [lpages:u16][sectors:u16][tag:u16 per data page]
+  Sector page 1..: data pages, tag = logical page stored there
+
+Used logical pages are packed into sectors with increasing seq; the rest
+of the sectors carry a header with seq 0xFFFFFFFF (free). The logical
+volume is smaller than the device: three sectors are kept back for
+garbage collection and --spare percent of the rest as over-provisioning,
+which is what keeps write amplification down once the volume is full.
+
+--convert IMAGE reads the files and directories back out of a classic
+image, so an existing image can be rebuilt as a log volume (or resized).
 """
 
 import argparse
@@ -53,6 +71,12 @@ F_PREV_PAGE = 0xFFFE
 F_DIR_FLAG = 0x8000   # top bit of fname_len marks a directory entry
 BITS_PER_BMP_PAGE = PAGE_SIZE * 8  # 2048
 
+LOG_MAGIC = 0x474F4C46        # "FLOG"
+LOG_FREE = 0xFFFFFFFF
+LOG_NOPAGE = 0xFFFF
+LOG_SECT_FMT = "<IIIHH"       # struct flashfs_log_sect
+LOG_MIN_SPARE = 3             # FLASHFS_LOG_MIN_SPARE
+
 
 def pages_for_file(relpath, data_len):
     """Return the number of flash pages needed for *relpath* with *data_len* bytes."""
@@ -108,13 +132,154 @@ def build_dir_page(relpath):
     return bytes(page)
 
 
+def parse_size(text):
+    """Parse an image size such as 8M, 64K or 1048576."""
+    text = text.upper().strip()
+    if text.endswith("M"):
+        return int(text[:-1]) * 1024 * 1024
+    if text.endswith("K"):
+        return int(text[:-1]) * 1024
+    return int(text)
+
+
+def read_classic_image(path):
+    """Return (flash_path, is_dir, data) for every entry of a classic image."""
+    with open(path, "rb") as f:
+        image = f.read()
+    total_pages = len(image) // PAGE_SIZE
+    bmp_count = math.ceil(total_pages / BITS_PER_BMP_PAGE)
+    usable_pages = total_pages - bmp_count
+    bmp = image[usable_pages * PAGE_SIZE : total_pages * PAGE_SIZE]
+
+    out = []
+    page = 0
+    while page < usable_pages:
+        if bmp[page // 8] & (1 << (page & 7)):
+            page += 1
+            continue
+        off = page * PAGE_SIZE
+        fname_len, fsize = struct.unpack_from("<HH", image, off)
+        if fname_len == F_PREV_PAGE or (fname_len & ~F_DIR_FLAG) == 0:
+            page += 1
+            continue
+        is_dir = bool(fname_len & F_DIR_FLAG)
+        fname_len &= ~F_DIR_FLAG
+        name = image[off + HDR_SIZE : off + HDR_SIZE + fname_len].decode("utf-8")
+        if is_dir:
+            out.append((name, True, None))
+            page += 1
+            continue
+        first_cap = PAGE_SIZE - (HDR_SIZE + fname_len + 1)
+        data_off = off + HDR_SIZE + fname_len + 1
+        data = bytearray(image[data_off : data_off + min(fsize, first_cap)])
+        npages = pages_for_file(name, fsize)
+        for i in range(1, npages):
+            cont = (page + i) * PAGE_SIZE + HDR_SIZE
+            data += image[cont : cont + min(fsize - len(data), PAGE_SIZE - HDR_SIZE)]
+        out.append((name, False, bytes(data)))
+        page += npages
+    return out
+
+
+def build_logical_image(merged, total_pages):
+    """Lay *merged* entries out in classic format over *total_pages* pages.
+
+    Returns (image, used_pages, file_count, dir_count)."""
+    bmp_count = math.ceil(total_pages / BITS_PER_BMP_PAGE)
+    usable_pages = total_pages - bmp_count
+
+    image = bytearray(b"\xff" * (total_pages * PAGE_SIZE))
+    cur_page = 0
+    file_count = 0
+    dir_count = 0
+
+    for flash_path, is_dir, data in merged:
+        if is_dir:
+            pages_to_write = [build_dir_page(flash_path)]
+        else:
+            if len(data) > 65535:
+                print(
+                    f"WARNING: Skipping '{flash_path}' ({len(data)} bytes > 64K limit)",
+                    file=sys.stderr,
+                )
+                continue
+            pages_to_write = build_file_pages(flash_path, data)
+
+        needed = len(pages_to_write)
+        if cur_page + needed > usable_pages:
+            print(
+                f"ERROR: Not enough space for '{flash_path}' "
+                f"({needed} pages, {usable_pages - cur_page} remaining)",
+                file=sys.stderr,
+            )
+            sys.exit(1)
+
+        for i, pg in enumerate(pages_to_write):
+            offset = (cur_page + i) * PAGE_SIZE
+            image[offset : offset + PAGE_SIZE] = pg
+
+        cur_page += needed
+        if is_dir:
+            dir_count += 1
+        else:
+            file_count += 1
+
+    # Write bitmap — clear bits for used pages
+    for page_idx in range(cur_page):
+        bmp_page_num = total_pages - bmp_count + page_idx // BITS_PER_BMP_PAGE
+        byte_off = (page_idx % BITS_PER_BMP_PAGE) // 8
+        bit = page_idx & 7
+        abs_byte = bmp_page_num * PAGE_SIZE + byte_off
+        image[abs_byte] &= ~(1 << bit)
+
+    return image, cur_page, file_count, dir_count
+
+
+def log_geometry(image_size, sector_size, spare_pct):
+    """Return (sectors, slots, lpages) of a log volume filling *image_size*."""
+    if sector_size % PAGE_SIZE or sector_size < 2 * PAGE_SIZE:
+        sys.exit(f"ERROR: sector size {sector_size} is not a multiple of {PAGE_SIZE}")
+    slots = sector_size // PAGE_SIZE - 1
+    if struct.calcsize(LOG_SECT_FMT) + 2 * slots > PAGE_SIZE:
+        sys.exit(f"ERROR: sector size {sector_size} too large for one tag page")
+    sectors = min(image_size // sector_size, 0xFFFF // (slots + 1))
+    if sectors <= LOG_MIN_SPARE:
+        sys.exit("ERROR: image too small for a log volume")
+    lpages = (sectors - LOG_MIN_SPARE) * slots * (100 - spare_pct) // 100
+    return sectors, slots, min(lpages, 0xFFFF)
+
+
+def build_log_image(logical, lpages, sectors, sector_size):
+    """Pack the used pages of the *logical* volume into log sectors."""
+    slots = sector_size // PAGE_SIZE - 1
+    blank = b"\xff" * PAGE_SIZE
+    used = [
+        lp for lp in range(lpages)
+        if logical[lp * PAGE_SIZE : (lp + 1) * PAGE_SIZE] != blank
+    ]
+
+    image = bytearray(b"\xff" * (sectors * sector_size))
+    for s in range(sectors):
+        chunk = used[s * slots : (s + 1) * slots]
+        seq = s + 1 if chunk else LOG_FREE
+        base = s * sector_size
+        struct.pack_into(LOG_SECT_FMT, image, base, LOG_MAGIC, 0, seq, lpages, sectors)
+        tags = base + struct.calcsize(LOG_SECT_FMT)
+        for slot, lp in enumerate(chunk):
+            struct.pack_into("<H", image, tags + 2 * slot, lp)
+            dst = base + (slot + 1) * PAGE_SIZE
+            image[dst : dst + PAGE_SIZE] = logical[lp * PAGE_SIZE : (lp + 1) * PAGE_SIZE]
+    return image, len(used)
+
+
+
 def main():
     parser = argparse.ArgumentParser(
         description="Build a flashfs image for Frosted OS"
     )
     parser.add_argument(
         "inputs",
-        nargs="+",
+        nargs="*",
         help="Files to include.  Use FLASH_PATH=HOST_PATH to set the "
         "on-flash path, or just HOST_PATH to derive it automatically.",
     )
@@ -133,21 +298,37 @@ def main():
         default=None,
         help="Strip this prefix from host paths when deriving flash paths.",
     )
+    parser.add_argument(
+        "-c", "--convert",
+        default=None,
+        metavar="IMAGE",
+        help="Take the files and directories of an existing classic image.",
+    )
+    parser.add_argument(
+        "--log",
+        action="store_true",
+        help="Build a log-structured volume (CONFIG_FLASHFS_LOG, SPI NOR).",
+    )
+    parser.add_argument(
+        "--sector-size",
+        default="4096",
+        help="Erase sector size of the log volume (default 4096).",
+    )
+    parser.add_argument(
+        "--spare",
+        type=int,
+        default=10,
+        metavar="PCT",
+        help="Log volume over-provisioning in percent (default 10).",
+    )
 
     args = parser.parse_args()
+    if not args.inputs and not args.convert:
+        parser.error("no input files")
+    if not 0 <= args.spare < 100:
+        parser.error("--spare must be between 0 and 99")
 
-    # Parse image size
-    size_str = args.size.upper().strip()
-    if size_str.endswith("M"):
-        image_size = int(size_str[:-1]) * 1024 * 1024
-    elif size_str.endswith("K"):
-        image_size = int(size_str[:-1]) * 1024
-    else:
-        image_size = int(size_str)
-
-    total_pages = image_size // PAGE_SIZE
-    bmp_count = math.ceil(total_pages / BITS_PER_BMP_PAGE)
-    usable_pages = total_pages - bmp_count
+    image_size = parse_size(args.size)
 
     # Collect files
     entries = []  # list of (flash_relpath, host_path)
@@ -175,61 +356,39 @@ def main():
             dirs.add(parent)
             parent = parent.rsplit("/", 1)[0] if "/" in parent else ""
 
-    # Build a merged, sorted list of (path, is_dir, host_path_or_None) with
+    # Build a merged, sorted list of (path, is_dir, data_or_None) with
     # strict bytewise ordering. The kernel iterator relies on this: sibling
     # entries under the same parent are contiguous, and lookup short-circuits
     # once the scan passes the target window. Locale-aware sort (the shell's
     # default) would break this — e.g. it can place `hashlib/_sha.py` after
     # `hashlib/__init__.py` even though '_' (0x5F) < 'i' (0x69) bytewise.
-    merged = [(p, False, h) for p, h in entries] + [(d, True, None) for d in dirs]
+    merged = []
+    seen = set()
+    for flash_path, host_path in entries:
+        with open(host_path, "rb") as f:
+            merged.append((flash_path, False, f.read()))
+        seen.add(flash_path)
+    merged += [(d, True, None) for d in dirs]
+    seen |= dirs
+    if args.convert:
+        # Files given on the command line replace the converted ones
+        merged += [e for e in read_classic_image(args.convert) if e[0] not in seen]
     merged.sort(key=lambda e: e[0].encode("utf-8"))
 
-    # Build pages for each entry
-    image = bytearray(b"\xff" * image_size)
-    cur_page = 0
-    file_count = 0
-    dir_count = 0
-
-    for flash_path, is_dir, host_path in merged:
-        if is_dir:
-            pages_to_write = [build_dir_page(flash_path)]
-        else:
-            with open(host_path, "rb") as f:
-                data = f.read()
-            if len(data) > 65535:
-                print(
-                    f"WARNING: Skipping '{flash_path}' ({len(data)} bytes > 64K limit)",
-                    file=sys.stderr,
-                )
-                continue
-            pages_to_write = build_file_pages(flash_path, data)
-
-        needed = len(pages_to_write)
-        if cur_page + needed > usable_pages:
-            print(
-                f"ERROR: Not enough space for '{flash_path}' "
-                f"({needed} pages, {usable_pages - cur_page} remaining)",
-                file=sys.stderr,
-            )
-            sys.exit(1)
-
-        for i, pg in enumerate(pages_to_write):
-            offset = (cur_page + i) * PAGE_SIZE
-            image[offset : offset + PAGE_SIZE] = pg
-
-        cur_page += needed
-        if is_dir:
-            dir_count += 1
-        else:
-            file_count += 1
+    if args.log:
+        sectors, slots, total_pages = log_geometry(
+            image_size, parse_size(args.sector_size), args.spare
+        )
+    else:
+        total_pages = image_size // PAGE_SIZE
+    bmp_count = math.ceil(total_pages / BITS_PER_BMP_PAGE)
+    usable_pages = total_pages - bmp_count
 
-    # Write bitmap — clear bits for used pages
-    for page_idx in range(cur_page):
-        bmp_page_num = total_pages - bmp_count + page_idx // BITS_PER_BMP_PAGE
-        byte_off = (page_idx % BITS_PER_BMP_PAGE) // 8
-        bit = page_idx & 7
-        abs_byte = bmp_page_num * PAGE_SIZE + byte_off
-        image[abs_byte] &= ~(1 << bit)
+    image, cur_page, file_count, dir_count = build_logical_image(merged, total_pages)
+    if args.log:
+        image, log_pages = build_log_image(
+            image, total_pages, sectors, parse_size(args.sector_size)
+        )
 
     with open(args.output, "wb") as f:
         f.write(image)
@@ -241,6 +400,11 @@ def main():
         f"{used_kb:.1f}K / {total_kb:.1f}K used, "
         f"{bmp_count} bitmap page(s)"
     )
+    if args.log:
+        print(
+            f"  log: {sectors} sectors of {slots} pages, {total_pages} logical pages, "
+            f"{math.ceil(log_pages / slots)} sectors in use"
+        )
 
 
 if __name__ == "__main__":
@@ -409,6 +409,8 @@ static inline void stm32h5_gtzc_setup(void)
     NVIC_ITNS[0] = 0xFFFFFFFF;
     NVIC_ITNS[1] = 0xFFFFFFFF;
     NVIC_ITNS[2] = 0xFFFFFFFF;
+    NVIC_ITNS[3] = 0xFFFFFFFF;
+    NVIC_ITNS[4] = 0xFFFFFFFF;
 
 
 }
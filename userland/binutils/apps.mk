@@ -27,6 +27,7 @@ powerctl: powerctl.o ICE
 prodcons: prodcons.o
 stat: stat.o ICE
 ps: ps.o ICE
+top: top.o ICE
 reboot: reboot.o ICE
 renice: renice.o ICE
 rm: rm.o ICE
@@ -78,6 +78,9 @@ extern int icebox_powerctl(int argc, char *argv[]);
 #ifdef APP_PS_MODULE
 extern int icebox_ps(int argc, char *argv[]);
 #endif
+#ifdef APP_TOP_MODULE
+extern int icebox_top(int argc, char *argv[]);
+#endif
 #ifdef APP_STAT_MODULE
 extern int icebox_stat(int argc, char *argv[]);
 #endif
@@ -273,6 +276,11 @@ int main(int argc, char *argv[])
         return icebox_ps(argc, argv);
 #endif
 
+#ifdef APP_TOP_MODULE
+    if(strcmp("top", argv[0]) == 0)
+        return icebox_top(argc, argv);
+#endif
+
 #ifdef APP_STAT_MODULE
     if(strcmp("stat", argv[0]) == 0)
         return icebox_stat(argc, argv);
@@ -81,6 +81,9 @@ static const char *syscall_name(uint32_t nr)
         "pthread_key_create", "pthread_setspecific", "pthread_getspecific",
         "alarm",            "ualarm",           "dlopen",         "dlsym",
         "dlclose",          "sendmsg",          "recvmsg",
+        "epoll_create",     "epoll_ctl",        "epoll_wait",
+        "splice",           "tee",              "fsync",          "getrusage",
+        "futex_wait",       "futex_wake",
     };
     if (nr < sizeof(names) / sizeof(names[0]))
         return names[nr];
@@ -102,7 +105,7 @@ static int syscall_arity(uint32_t nr)
         3,2,3,2,2,4,1,2,1,1,   /* 70..79 */
         0,2,0,2,1,1,1,1,2,2,   /* 80..89 */
         2,2,2,2,1,2,2,2,1,3,   /* 90..99 */
-        3,                      /* 100    */
+        3,1,4,4,4,4,1,2,3,2,   /* 100..109 */
     };
     if (nr < sizeof(arity) / sizeof(arity[0]))
         return arity[nr];
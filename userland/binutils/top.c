@@ -0,0 +1,260 @@
+/*
+ *      This file is part of frosted.
+ *
+ *      frosted is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License version 2, as
+ *      published by the Free Software Foundation.
+ *
+ *
+ *      frosted is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with frosted.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * top: CPU usage per task, from two samples of /sys/tasks.
+ *
+ * %CPU is the share of all the CPU time accounted between the two
+ * samples, including the kernel thread (idle time plus tasklets).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#define TASKS_FILE "/sys/tasks"
+#define TOP_MAX_TASKS 16
+#define TOP_BUF_SIZE 2048
+
+#ifndef CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC 4
+#endif
+
+extern int sys_clock_gettime(int clock_id, struct timespec *tp);
+
+struct top_task {
+    unsigned long pid;
+    char state;
+    unsigned long utime;    /* ms, modulo 2^32: only differences count */
+    unsigned long stime;
+    char utime_txt[12];     /* seconds, as read */
+    char stime_txt[12];
+    unsigned long vcsw;
+    unsigned long ivcsw;
+    char name[16];
+    unsigned long cpu;      /* ms used in the last interval */
+};
+
+struct top_sample {
+    int n;
+    struct top_task t[TOP_MAX_TASKS];
+    unsigned long switches;
+    unsigned long sw_cycles;
+    unsigned long acct_cycles;
+    unsigned long kernel;   /* ms used by the kernel thread */
+    unsigned long ms;
+};
+
+static char top_buf[TOP_BUF_SIZE];
+
+static unsigned long now_ms(void)
+{
+    struct timespec ts;
+    sys_clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* CPU time from /sys/tasks, "12.345" seconds, in ms */
+static unsigned long parse_cputime(const char *s)
+{
+    char *end;
+    unsigned long ms = strtoul(s, &end, 10) * 1000;
+
+    if (*end == '.')
+        ms += strtoul(end + 1, NULL, 10);
+    return ms;
+}
+
+/* Split 'line' in place on tabs, return the number of fields */
+static int split_tabs(char *line, char **f, int max)
+{
+    int n = 0;
+    f[n++] = line;
+    while (*line && n < max) {
+        if (*line == '\t') {
+            *line = '\0';
+            f[n++] = line + 1;
+        }
+        line++;
+    }
+    return n;
+}
+
+static int read_sample(struct top_sample *s)
+{
+    int fd, r, len = 0;
+    char *line, *next;
+    char *f[10];
+    int in_tasks = 1, in_sw = 0;
+
+    fd = open(TASKS_FILE, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    while ((r = read(fd, top_buf + len, TOP_BUF_SIZE - 1 - len)) > 0)
+        len += r;
+    close(fd);
+    top_buf[len] = '\0';
+    s->ms = now_ms();
+    s->n = 0;
+    s->kernel = 0;
+
+    /* skip the legend */
+    line = strchr(top_buf, '\n');
+    if (!line)
+        return -1;
+    line++;
+    for (; line && *line; line = next) {
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        if (line[0] == '\r' || line[0] == '\0') {
+            in_tasks = 0;
+            continue;
+        }
+        if (strchr(line, '\r'))
+            *strchr(line, '\r') = '\0';
+        if (in_tasks && s->n < TOP_MAX_TASKS &&
+                split_tabs(line, f, 10) == 10) {
+            struct top_task *t = &s->t[s->n++];
+            t->pid = strtoul(f[0], NULL, 10);
+            t->state = f[1][0];
+            t->utime = parse_cputime(f[5]);
+            t->stime = parse_cputime(f[6]);
+            strncpy(t->utime_txt, f[5], sizeof(t->utime_txt) - 1);
+            t->utime_txt[sizeof(t->utime_txt) - 1] = '\0';
+            strncpy(t->stime_txt, f[6], sizeof(t->stime_txt) - 1);
+            t->stime_txt[sizeof(t->stime_txt) - 1] = '\0';
+            t->vcsw = strtoul(f[7], NULL, 10);
+            t->ivcsw = strtoul(f[8], NULL, 10);
+            strncpy(t->name, f[9], sizeof(t->name) - 1);
+            t->name[sizeof(t->name) - 1] = '\0';
+            t->cpu = 0;
+        } else if (strncmp(line, "switches", 8) == 0) {
+            in_sw = 1;
+        } else if (in_sw) {
+            if (split_tabs(line, f, 5) == 5) {
+                s->switches = strtoul(f[0], NULL, 10);
+                s->sw_cycles = strtoul(f[2], NULL, 10);
+                s->acct_cycles = strtoul(f[3], NULL, 10);
+                s->kernel = parse_cputime(f[4]);
+            }
+            in_sw = 0;
+        }
+    }
+    return 0;
+}
+
+static const struct top_task *find_pid(const struct top_sample *s,
+                                       unsigned long pid)
+{
+    int i;
+    for (i = 0; i < s->n; i++) {
+        if (s->t[i].pid == pid)
+            return &s->t[i];
+    }
+    return NULL;
+}
+
+static void show(const struct top_sample *prev, struct top_sample *cur)
+{
+    unsigned long total = 0, idle = 0, dt;
+    struct top_task *order[TOP_MAX_TASKS];
+    int i, j;
+
+    for (i = 0; i < cur->n; i++) {
+        struct top_task *t = &cur->t[i];
+        const struct top_task *p = find_pid(prev, t->pid);
+        t->cpu = t->utime + t->stime;
+        if (p)
+            t->cpu -= p->utime + p->stime;
+        total += t->cpu;
+        /* insertion sort, busiest first */
+        for (j = i; j > 0 && order[j - 1]->cpu < t->cpu; j--)
+            order[j] = order[j - 1];
+        order[j] = t;
+    }
+    idle = cur->kernel - prev->kernel;
+    total += idle;
+    dt = cur->ms - prev->ms;
+    if (dt == 0)
+        dt = 1;
+    if (total == 0)
+        total = 1;
+
+    printf("\033[H\033[2J");
+    printf("tasks: %d  idle: %lu%%  ctxsw/s: %lu  switch: %lu cycles "
+           "(accounting %lu)\r\n\r\n",
+           cur->n, idle * 100 / total,
+           (cur->switches - prev->switches) * 1000 / dt,
+           cur->sw_cycles, cur->acct_cycles);
+    printf("  PID S  %%CPU     UTIME     STIME   VCSW  IVCSW NAME\r\n");
+    for (i = 0; i < cur->n; i++) {
+        const struct top_task *t = order[i];
+        unsigned long pct = t->cpu * 1000 / total;
+        printf("%5lu %c %3lu.%lu %9s %9s %6lu %6lu %s\r\n",
+               t->pid, t->state, pct / 10, pct % 10,
+               t->utime_txt, t->stime_txt, t->vcsw, t->ivcsw, t->name);
+    }
+}
+
+static void usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [-d seconds] [-n iterations]\r\n", name);
+    exit(1);
+}
+
+#ifndef APP_TOP_MODULE
+int main(int argc, char *args[])
+#else
+int icebox_top(int argc, char *args[])
+#endif
+{
+    static struct top_sample s[2];
+    int delay = 2, count = -1;
+    int cur = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(args[i], "-d") == 0 && i + 1 < argc)
+            delay = atoi(args[++i]);
+        else if (strcmp(args[i], "-n") == 0 && i + 1 < argc)
+            count = atoi(args[++i]);
+        else
+            usage(args[0]);
+    }
+    if (delay < 1)
+        delay = 1;
+
+    if (read_sample(&s[cur]) < 0) {
+        fprintf(stderr, "%s: cannot read %s\r\n", args[0], TASKS_FILE);
+        exit(2);
+    }
+    while (count != 0) {
+        sleep(delay);
+        if (read_sample(&s[cur ^ 1]) < 0)
+            exit(2);
+        show(&s[cur], &s[cur ^ 1]);
+        cur ^= 1;
+        if (count > 0)
+            count--;
+    }
+    exit(0);
+}
@@ -103,12 +103,17 @@ struct passwd *getpwuid(unsigned int uid)
     return NULL;
 }
 
+extern int sys_getrusage(int who, struct rusage *usage);
+
 __attribute__((weak))
 int getrusage(int who, struct rusage *usage)
 {
-    (void)who; (void)usage;
-    errno = ENOSYS;
-    return -1;
+    int ret = sys_getrusage(who, usage);
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+    return 0;
 }
 
 __attribute__((weak))
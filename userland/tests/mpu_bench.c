@@ -0,0 +1,186 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Compare syscall round-trip and context switch latency with the
+ * per-task MPU region cache enabled and disabled.
+ *
+ * The kernel measures the cost of programming the MPU with DWT CYCCNT
+ * and reports it in /sys/mpu; this program drives the workload and
+ * adds wall-clock time per operation.
+ */
+
+#define MPU_SYSFS "/sys/mpu"
+#define DEFAULT_ITERATIONS 10000
+
+struct mpu_sample {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long hit_cyc;
+    unsigned long miss_cyc;
+};
+
+static int mpu_ctl(const char *cmd)
+{
+    int fd = open(MPU_SYSFS, O_WRONLY);
+    int ret;
+
+    if (fd < 0)
+        return -1;
+    ret = write(fd, cmd, strlen(cmd));
+    close(fd);
+    return (ret < 0) ? -1 : 0;
+}
+
+static int mpu_read(struct mpu_sample *s)
+{
+    char buf[256];
+    char *line;
+    int fd, got, total = 0;
+
+    memset(s, 0, sizeof(*s));
+    fd = open(MPU_SYSFS, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    while (total < (int)sizeof(buf) - 1) {
+        got = read(fd, buf + total, sizeof(buf) - 1 - total);
+        if (got <= 0)
+            break;
+        total += got;
+    }
+    close(fd);
+    buf[total] = '\0';
+
+    for (line = strtok(buf, "\r\n"); line; line = strtok(NULL, "\r\n")) {
+        char *val = strchr(line, '\t');
+        if (!val)
+            continue;
+        val++;
+        if (strncmp(line, "hits", 4) == 0)
+            s->hits = strtoul(val, NULL, 10);
+        else if (strncmp(line, "misses", 6) == 0)
+            s->misses = strtoul(val, NULL, 10);
+        else if (strncmp(line, "hit_cyc", 7) == 0)
+            s->hit_cyc = strtoul(val, NULL, 10);
+        else if (strncmp(line, "miss_cyc", 8) == 0)
+            s->miss_cyc = strtoul(val, NULL, 10);
+    }
+    return 0;
+}
+
+static unsigned long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000UL + (unsigned long)(ts.tv_nsec / 1000);
+}
+
+static unsigned long bench_syscall(int iterations)
+{
+    unsigned long t0 = now_us();
+    int i;
+
+    for (i = 0; i < iterations; i++)
+        (void)getppid();
+    return now_us() - t0;
+}
+
+/* Parent and child bounce a byte through two pipes: every round trip
+ * costs two blocking syscalls and two context switches.
+ */
+static unsigned long bench_switch(int iterations)
+{
+    int p2c[2], c2p[2];
+    unsigned long t0, elapsed;
+    char c = 'x';
+    pid_t pid;
+    int i, status;
+
+    if (pipe(p2c) < 0 || pipe(c2p) < 0)
+        return 0;
+
+    pid = vfork();
+    if (pid < 0)
+        return 0;
+    if (pid == 0) {
+        char *const argv[] = { "mpu_bench", "--child", NULL };
+        dup2(p2c[0], STDIN_FILENO);
+        dup2(c2p[1], STDOUT_FILENO);
+        execve("/bin/mpu_bench", argv, NULL);
+        _exit(127);
+    }
+    close(p2c[0]);
+    close(c2p[1]);
+
+    t0 = now_us();
+    for (i = 0; i < iterations; i++) {
+        if (write(p2c[1], &c, 1) != 1)
+            break;
+        if (read(c2p[0], &c, 1) != 1)
+            break;
+    }
+    elapsed = now_us() - t0;
+    close(p2c[1]);
+    close(c2p[0]);
+    waitpid(pid, &status, 0);
+    return elapsed;
+}
+
+static int child_echo(void)
+{
+    char c;
+
+    while (read(STDIN_FILENO, &c, 1) == 1) {
+        if (write(STDOUT_FILENO, &c, 1) != 1)
+            break;
+    }
+    return 0;
+}
+
+static void run(const char *label, int iterations)
+{
+    struct mpu_sample s;
+    unsigned long us;
+
+    mpu_ctl("reset");
+    us = bench_syscall(iterations);
+    mpu_read(&s);
+    printf("%-8s syscall: %4lu.%02lu us/call  mpu hit %lu cyc x%lu, miss %lu cyc x%lu\n",
+           label, us / iterations, ((us * 100) / iterations) % 100,
+           s.hit_cyc, s.hits, s.miss_cyc, s.misses);
+
+    mpu_ctl("reset");
+    us = bench_switch(iterations / 10);
+    mpu_read(&s);
+    printf("%-8s switch : %4lu.%02lu us/rtt   mpu hit %lu cyc x%lu, miss %lu cyc x%lu\n",
+           label, us / (iterations / 10), ((us * 100) / (iterations / 10)) % 100,
+           s.hit_cyc, s.hits, s.miss_cyc, s.misses);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = DEFAULT_ITERATIONS;
+
+    if ((argc > 1) && (strcmp(argv[1], "--child") == 0))
+        return child_echo();
+    if (argc > 1)
+        iterations = atoi(argv[1]);
+    if (iterations < 10)
+        iterations = 10;
+
+    if (mpu_ctl("1") < 0) {
+        fprintf(stderr, "mpu_bench: cannot open %s (errno=%d)\n", MPU_SYSFS, errno);
+        return 1;
+    }
+    run("cached", iterations);
+    mpu_ctl("0");
+    run("uncached", iterations);
+    mpu_ctl("1");
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/frosted.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Cost of pthread mutexes, uncontended and contended.
+ *
+ * pthread_mutex_lock/unlock are taken in userspace with LDREX/STREX and
+ * only enter the kernel (futex_wait, futex_wake) when contended. The
+ * same loop is run against the kernel mutex handlers they used to call
+ * on every operation, still reachable through their syscall numbers.
+ *
+ * System calls are counted from /sys/proc/<pid>/stat; the cost of
+ * reading it is measured and subtracted.
+ */
+
+#define DEFAULT_ITERATIONS 20000
+#define CONTENDED_THREADS 2
+
+extern int syscall(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5);
+
+static pthread_mutex_t bench_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile unsigned long shared_counter;
+static int contended_iterations;
+
+static unsigned long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000UL + (unsigned long)(ts.tv_nsec / 1000);
+}
+
+static long syscall_count(void)
+{
+    char path[32];
+    char buf[128];
+    char *p;
+    int fd, got;
+
+    snprintf(path, sizeof(path), "/sys/proc/%d/stat", getpid());
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    got = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (got <= 0)
+        return -1;
+    buf[got] = '\0';
+    p = strstr(buf, "syscalls\t");
+    if (!p)
+        return -1;
+    return strtol(p + 9, NULL, 10);
+}
+
+static void report(const char *label, int iterations, unsigned long us, long calls)
+{
+    printf("%-22s %8lu ns/pair  ", label, (us * 1000UL) / (unsigned long)iterations);
+    if (calls < 0)
+        printf("syscalls n/a\r\n");
+    else
+        printf("%ld syscalls (%ld.%02ld per pair)\r\n", calls, calls / iterations,
+               ((calls % iterations) * 100) / iterations);
+}
+
+static void *contender(void *arg)
+{
+    int i;
+
+    (void)arg;
+    for (i = 0; i < contended_iterations; i++) {
+        pthread_mutex_lock(&bench_mutex);
+        shared_counter++;
+        pthread_mutex_unlock(&bench_mutex);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t th[CONTENDED_THREADS];
+    pthread_mutex_t kmutex = PTHREAD_MUTEX_INITIALIZER;
+    int iterations = DEFAULT_ITERATIONS;
+    long base, c0, c1, overhead;
+    unsigned long t0, t1;
+    int i;
+
+    if (argc > 1)
+        iterations = atoi(argv[1]);
+    if (iterations < 100)
+        iterations = 100;
+
+    /* Reading the counter costs open + read + close */
+    c0 = syscall_count();
+    c1 = syscall_count();
+    overhead = (c0 < 0 || c1 < 0) ? -1 : c1 - c0;
+    printf("%d lock/unlock pairs per run\r\n", iterations);
+
+    base = syscall_count();
+    t0 = now_us();
+    for (i = 0; i < iterations; i++) {
+        pthread_mutex_lock(&bench_mutex);
+        pthread_mutex_unlock(&bench_mutex);
+    }
+    t1 = now_us();
+    c1 = syscall_count();
+    report("userspace (futex)", iterations, t1 - t0,
+           (overhead < 0) ? -1 : c1 - base - overhead);
+
+    base = syscall_count();
+    t0 = now_us();
+    for (i = 0; i < iterations; i++) {
+        syscall(SYS_PTHREAD_MUTEX_LOCK, (uint32_t)&kmutex, 0, 0, 0, 0);
+        syscall(SYS_PTHREAD_MUTEX_UNLOCK, (uint32_t)kmutex, 0, 0, 0, 0);
+    }
+    t1 = now_us();
+    c1 = syscall_count();
+    report("kernel mutex (trap)", iterations, t1 - t0,
+           (overhead < 0) ? -1 : c1 - base - overhead);
+    syscall(SYS_PTHREAD_MUTEX_DESTROY, (uint32_t)kmutex, 0, 0, 0, 0);
+
+    /* Contended: checks that no update is lost. The threads' syscalls
+     * are not counted, their counters go away with them. */
+    contended_iterations = iterations / CONTENDED_THREADS;
+    shared_counter = 0;
+    t0 = now_us();
+    for (i = 0; i < CONTENDED_THREADS; i++) {
+        if (pthread_create(&th[i], NULL, contender, NULL) != 0) {
+            fprintf(stderr, "pthread_create failed\r\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < CONTENDED_THREADS; i++)
+        pthread_join(th[i], NULL);
+    t1 = now_us();
+    report("contended, 2 threads", contended_iterations * CONTENDED_THREADS, t1 - t0, -1);
+    if (shared_counter != (unsigned long)(contended_iterations * CONTENDED_THREADS)) {
+        fprintf(stderr, "lost updates: %lu of %d\r\n", shared_counter,
+                contended_iterations * CONTENDED_THREADS);
+        exit(2);
+    }
+    return 0;
+}
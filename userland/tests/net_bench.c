@@ -0,0 +1,191 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Latency and idle cost of the TCP/IP thread.
+ *
+ * Idle: with no traffic, samples /sys/idle and /sys/net/stack over a few
+ * seconds and reports CPU idle residency and stack wakeups per second.
+ * RTT: a child process echoes UDP datagrams on 127.0.0.1; the parent
+ * measures round trips and the number of stack wakeups each one costs.
+ */
+
+#define IDLE_SYSFS "/sys/idle"
+#define STACK_SYSFS "/sys/net/stack"
+#define ECHO_PORT 9100
+#define DEFAULT_ITERATIONS 1000
+#define IDLE_SECONDS 3
+#define PING_LEN 64
+
+static unsigned long sysfs_field(const char *path, const char *label)
+{
+    char buf[512];
+    char *line;
+    int fd, got, total = 0;
+    size_t label_len = strlen(label);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    while (total < (int)sizeof(buf) - 1) {
+        got = read(fd, buf + total, sizeof(buf) - 1 - total);
+        if (got <= 0)
+            break;
+        total += got;
+    }
+    close(fd);
+    buf[total] = '\0';
+
+    for (line = strtok(buf, "\r\n"); line; line = strtok(NULL, "\r\n")) {
+        char *val = strchr(line, '\t');
+        if (val && (strncmp(line, label, label_len) == 0))
+            return strtoul(val + 1, NULL, 10);
+    }
+    return 0;
+}
+
+static unsigned long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000UL + (unsigned long)(ts.tv_nsec / 1000);
+}
+
+static void bench_idle(void)
+{
+    unsigned long up0, idle0, wake0, up1, idle1, wake1;
+    unsigned long d_up;
+
+    up0 = sysfs_field(IDLE_SYSFS, "uptime_ms");
+    idle0 = sysfs_field(IDLE_SYSFS, "idle_ms");
+    wake0 = sysfs_field(STACK_SYSFS, "wakeups");
+    sleep(IDLE_SECONDS);
+    up1 = sysfs_field(IDLE_SYSFS, "uptime_ms");
+    idle1 = sysfs_field(IDLE_SYSFS, "idle_ms");
+    wake1 = sysfs_field(STACK_SYSFS, "wakeups");
+
+    d_up = up1 - up0;
+    if (d_up == 0)
+        d_up = 1;
+    printf("idle     : %lu ms  cpu idle %lu%%  stack wakeups %lu (%lu/s)\n",
+           d_up, ((idle1 - idle0) * 100UL) / d_up, wake1 - wake0,
+           ((wake1 - wake0) * 1000UL) / d_up);
+}
+
+static int udp_socket(struct sockaddr_in *addr, unsigned short port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (fd < 0)
+        return -1;
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    inet_aton("127.0.0.1", &addr->sin_addr);
+    return fd;
+}
+
+static int child_echo(void)
+{
+    struct sockaddr_in addr, peer;
+    socklen_t peer_len;
+    char buf[PING_LEN];
+    int fd, got;
+
+    fd = udp_socket(&addr, ECHO_PORT);
+    if (fd < 0)
+        return 1;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return 1;
+    for (;;) {
+        peer_len = sizeof(peer);
+        got = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&peer, &peer_len);
+        if (got <= 0)
+            continue;
+        if (buf[0] == 'q')
+            break;
+        sendto(fd, buf, got, 0, (struct sockaddr *)&peer, peer_len);
+    }
+    close(fd);
+    return 0;
+}
+
+static void bench_rtt(int iterations)
+{
+    struct sockaddr_in addr;
+    char buf[PING_LEN];
+    unsigned long t0, dt, min = ~0UL, max = 0, total = 0;
+    unsigned long wake0, wake1;
+    int fd, i, ok = 0, status;
+    pid_t pid;
+
+    pid = vfork();
+    if (pid < 0)
+        return;
+    if (pid == 0) {
+        char *const argv[] = { "net_bench", "--echo", NULL };
+        execve("/bin/net_bench", argv, NULL);
+        _exit(127);
+    }
+    usleep(200000);
+
+    fd = udp_socket(&addr, ECHO_PORT);
+    if (fd < 0) {
+        fprintf(stderr, "net_bench: socket failed (errno=%d)\n", errno);
+        return;
+    }
+    memset(buf, 'p', sizeof(buf));
+    wake0 = sysfs_field(STACK_SYSFS, "wakeups");
+    for (i = 0; i < iterations; i++) {
+        t0 = now_us();
+        if (sendto(fd, buf, sizeof(buf), 0, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+            continue;
+        if (recv(fd, buf, sizeof(buf), 0) <= 0)
+            continue;
+        dt = now_us() - t0;
+        total += dt;
+        if (dt < min)
+            min = dt;
+        if (dt > max)
+            max = dt;
+        ok++;
+    }
+    wake1 = sysfs_field(STACK_SYSFS, "wakeups");
+    buf[0] = 'q';
+    sendto(fd, buf, 1, 0, (struct sockaddr *)&addr, sizeof(addr));
+    close(fd);
+    waitpid(pid, &status, 0);
+
+    if (ok == 0) {
+        printf("rtt      : no replies\n");
+        return;
+    }
+    printf("rtt      : %d/%d  min %lu us  avg %lu us  max %lu us  wakeups/rtt %lu.%02lu\n",
+           ok, iterations, min, total / ok, max,
+           (wake1 - wake0) / ok, (((wake1 - wake0) * 100UL) / ok) % 100);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = DEFAULT_ITERATIONS;
+
+    if ((argc > 1) && (strcmp(argv[1], "--echo") == 0))
+        return child_echo();
+    if (argc > 1)
+        iterations = atoi(argv[1]);
+    if (iterations < 1)
+        iterations = 1;
+
+    bench_idle();
+    bench_rtt(iterations);
+    return 0;
+}
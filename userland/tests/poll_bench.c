@@ -0,0 +1,225 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Wakeup latency of poll() and epoll_wait() with many descriptors.
+ *
+ * N descriptors are watched for POLLIN: the read and write ends of N/2
+ * pipes (write ends never become readable and only make the set
+ * larger). A child process holds the write ends and, each time the
+ * parent sends it an index on a control pipe, writes one byte to that
+ * data pipe. The parent measures the time from the request to its
+ * return from poll() or epoll_wait() with the byte ready.
+ *
+ * Descriptor tables are sized by CONFIG_MAX_FDS; sets that do not fit
+ * are skipped, build the kernel with MAX_FDS=40 for the 32 fd run.
+ */
+
+#define DEFAULT_ITERATIONS 500
+#define MAX_PIPES 16
+
+/* The libc epoll wrappers are not built for every toolchain yet */
+extern int sys_epoll_create(uint32_t flags);
+extern int sys_epoll_ctl(uint32_t epfd, uint32_t op, uint32_t fd, uint32_t ev);
+extern int sys_epoll_wait(uint32_t epfd, uint32_t events, uint32_t maxevents, uint32_t timeout);
+
+struct result {
+    unsigned long min;
+    unsigned long max;
+    unsigned long total;
+    int ok;
+};
+
+static unsigned long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000UL + (unsigned long)(ts.tv_nsec / 1000);
+}
+
+static int child_writer(int argc, char *argv[])
+{
+    int ctrl = atoi(argv[2]);
+    int wfd[MAX_PIPES];
+    int i, n = 0;
+    unsigned char idx;
+    char c = 'x';
+
+    for (i = 3; (i < argc) && (n < MAX_PIPES); i++)
+        wfd[n++] = atoi(argv[i]);
+    while (read(ctrl, &idx, 1) == 1) {
+        if (idx >= n)
+            break;
+        write(wfd[idx], &c, 1);
+    }
+    return 0;
+}
+
+static void sample(struct result *r, unsigned long dt)
+{
+    r->total += dt;
+    if (dt < r->min)
+        r->min = dt;
+    if (dt > r->max)
+        r->max = dt;
+    r->ok++;
+}
+
+static void report(const char *label, int nfds, const struct result *r, int iterations)
+{
+    if (r->ok == 0) {
+        printf("%-7s %2d fds: no wakeups\n", label, nfds);
+        return;
+    }
+    printf("%-7s %2d fds: %d/%d  min %lu us  avg %lu us  max %lu us\n",
+           label, nfds, r->ok, iterations, r->min, r->total / r->ok, r->max);
+}
+
+static void run_poll(int ctrl, int rfd[], int wfd[], int npipes, int iterations)
+{
+    struct pollfd pfd[2 * MAX_PIPES];
+    struct result r = { ~0UL, 0, 0, 0 };
+    unsigned long t0;
+    unsigned char idx;
+    char c;
+    int i, j, ret;
+
+    for (i = 0; i < npipes; i++) {
+        pfd[2 * i].fd = rfd[i];
+        pfd[2 * i].events = POLLIN;
+        pfd[2 * i + 1].fd = wfd[i];
+        pfd[2 * i + 1].events = POLLIN;
+    }
+    for (i = 0; i < iterations; i++) {
+        idx = (unsigned char)(rand() % npipes);
+        for (j = 0; j < 2 * npipes; j++)
+            pfd[j].revents = 0;
+        t0 = now_us();
+        write(ctrl, &idx, 1);
+        ret = poll(pfd, 2 * npipes, 1000);
+        if ((ret == 1) && (pfd[2 * idx].revents & POLLIN))
+            sample(&r, now_us() - t0);
+        read(rfd[idx], &c, 1);
+    }
+    report("poll", 2 * npipes, &r, iterations);
+}
+
+static void run_epoll(int ctrl, int rfd[], int wfd[], int npipes, int iterations)
+{
+    struct epoll_event ev, out[4];
+    struct result r = { ~0UL, 0, 0, 0 };
+    unsigned long t0;
+    unsigned char idx;
+    char c;
+    int i, ep, ret;
+
+    ep = sys_epoll_create(0);
+    if (ep < 0) {
+        printf("epoll   %2d fds: epoll_create failed (%d)\n", 2 * npipes, ep);
+        return;
+    }
+    for (i = 0; i < npipes; i++) {
+        ev.events = EPOLLIN;
+        ev.data.u32 = (uint32_t)i;
+        sys_epoll_ctl(ep, EPOLL_CTL_ADD, rfd[i], (uint32_t)&ev);
+        ev.data.u32 = 0xFFFFU;
+        sys_epoll_ctl(ep, EPOLL_CTL_ADD, wfd[i], (uint32_t)&ev);
+    }
+    /* Consume the initial readiness check of the freshly added items */
+    sys_epoll_wait(ep, (uint32_t)out, 4, 0);
+
+    for (i = 0; i < iterations; i++) {
+        idx = (unsigned char)(rand() % npipes);
+        t0 = now_us();
+        write(ctrl, &idx, 1);
+        ret = sys_epoll_wait(ep, (uint32_t)out, 4, 1000);
+        if ((ret == 1) && (out[0].data.u32 == idx))
+            sample(&r, now_us() - t0);
+        read(rfd[idx], &c, 1);
+    }
+    close(ep);
+    report("epoll", 2 * npipes, &r, iterations);
+}
+
+static void bench(int npipes, int iterations)
+{
+    int rfd[MAX_PIPES], wfd[MAX_PIPES];
+    int ctrl[2], p[2];
+    char argbuf[MAX_PIPES + 1][8];
+    char *argv[MAX_PIPES + 4];
+    unsigned char quit = 0xFF;
+    int i, made = 0, status;
+    pid_t pid;
+
+    if (pipe(ctrl) < 0) {
+        printf("%2d fds: pipe failed (errno=%d)\n", 2 * npipes, errno);
+        return;
+    }
+    for (i = 0; i < npipes; i++) {
+        if (pipe(p) < 0)
+            break;
+        rfd[i] = p[0];
+        wfd[i] = p[1];
+        made++;
+    }
+    if (made < npipes) {
+        printf("%2d fds: skipped, descriptor table full (errno=%d)\n", 2 * npipes, errno);
+        goto out;
+    }
+
+    argv[0] = "poll_bench";
+    argv[1] = "--child";
+    snprintf(argbuf[0], sizeof(argbuf[0]), "%d", ctrl[0]);
+    argv[2] = argbuf[0];
+    for (i = 0; i < npipes; i++) {
+        snprintf(argbuf[i + 1], sizeof(argbuf[i + 1]), "%d", wfd[i]);
+        argv[i + 3] = argbuf[i + 1];
+    }
+    argv[npipes + 3] = NULL;
+
+    pid = vfork();
+    if (pid < 0)
+        goto out;
+    if (pid == 0) {
+        execve("/bin/poll_bench", argv, NULL);
+        _exit(127);
+    }
+
+    run_poll(ctrl[1], rfd, wfd, npipes, iterations);
+    run_epoll(ctrl[1], rfd, wfd, npipes, iterations);
+    write(ctrl[1], &quit, 1);
+    waitpid(pid, &status, 0);
+
+out:
+    for (i = 0; i < made; i++) {
+        close(rfd[i]);
+        close(wfd[i]);
+    }
+    close(ctrl[0]);
+    close(ctrl[1]);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = DEFAULT_ITERATIONS;
+
+    if ((argc > 2) && (strcmp(argv[1], "--child") == 0))
+        return child_writer(argc, argv);
+    if (argc > 1)
+        iterations = atoi(argv[1]);
+    if (iterations < 1)
+        iterations = 1;
+
+    bench(4, iterations);
+    bench(8, iterations);
+    bench(MAX_PIPES, iterations);
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Cost of path lookups, with the kernel's lookup cache enabled and
+ * disabled.
+ *
+ * "boot" replays what init scripts do from a cold cache: every command
+ * is searched along PATH=/usr/bin:/sbin:/bin, configuration files are
+ * probed under /var (flashfs) whether they exist or not. "stat" repeats
+ * the same list in a loop. Cache hits are read from /sys/dcache.
+ */
+
+#define DCACHE_SYSFS "/sys/dcache"
+#define DEFAULT_LOOPS 200
+
+static const char *const applets[] = {
+    "sh", "mount", "echo", "cat", "ls", "mkdir", "ln", "ps",
+    "kill", "sleep", "ifconfig", "route", "date", "uname", "dmesg", "test",
+};
+
+static const char *const probes[] = {
+    "/var/etc/rc.local", "/var/etc/hostname", "/var/etc/resolv.conf",
+    "/var/etc/network", "/var/etc/passwd", "/var/log", "/var/www/index.html",
+    "/dev/null", "/dev/ttyS0", "/dev/spiflash0", "/sys/tasks", "/sys/mem",
+    "/tmp", "/etc/profile", "/home", "/root/.profile",
+};
+
+#define APPLETS (int)(sizeof(applets) / sizeof(applets[0]))
+#define PROBES (int)(sizeof(probes) / sizeof(probes[0]))
+#define PATHS ((APPLETS * 3) + PROBES)
+
+static char paths[PATHS][48];
+
+struct dcache_sample {
+    unsigned long hits;
+    unsigned long neg_hits;
+    unsigned long misses;
+};
+
+static int dcache_ctl(const char *cmd)
+{
+    int fd = open(DCACHE_SYSFS, O_WRONLY);
+    int ret;
+
+    if (fd < 0)
+        return -1;
+    ret = write(fd, cmd, strlen(cmd));
+    close(fd);
+    return (ret < 0) ? -1 : 0;
+}
+
+static int dcache_read(struct dcache_sample *s)
+{
+    char buf[256];
+    char *line;
+    int fd, got, total = 0;
+
+    memset(s, 0, sizeof(*s));
+    fd = open(DCACHE_SYSFS, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    while (total < (int)sizeof(buf) - 1) {
+        got = read(fd, buf + total, sizeof(buf) - 1 - total);
+        if (got <= 0)
+            break;
+        total += got;
+    }
+    close(fd);
+    buf[total] = '\0';
+
+    for (line = strtok(buf, "\r\n"); line; line = strtok(NULL, "\r\n")) {
+        char *val = strchr(line, '\t');
+        if (!val)
+            continue;
+        val++;
+        if (strncmp(line, "hits", 4) == 0)
+            s->hits = strtoul(val, NULL, 10);
+        else if (strncmp(line, "neg_hits", 8) == 0)
+            s->neg_hits = strtoul(val, NULL, 10);
+        else if (strncmp(line, "misses", 6) == 0)
+            s->misses = strtoul(val, NULL, 10);
+    }
+    return 0;
+}
+
+static unsigned long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000UL + (unsigned long)(ts.tv_nsec / 1000);
+}
+
+static void build_paths(void)
+{
+    static const char *const path_dirs[] = { "/usr/bin", "/sbin", "/bin" };
+    int i, d, n = 0;
+
+    for (i = 0; i < APPLETS; i++) {
+        for (d = 0; d < 3; d++)
+            snprintf(paths[n++], sizeof(paths[0]), "%s/%s", path_dirs[d], applets[i]);
+    }
+    for (i = 0; i < PROBES; i++)
+        snprintf(paths[n++], sizeof(paths[0]), "%s", probes[i]);
+}
+
+/* Returns the elapsed time; *found counts the paths that exist */
+static unsigned long stat_pass(int loops, int *found)
+{
+    struct stat st;
+    unsigned long t0 = now_us();
+    int l, i;
+
+    *found = 0;
+    for (l = 0; l < loops; l++) {
+        for (i = 0; i < PATHS; i++) {
+            if (stat(paths[i], &st) == 0)
+                (*found)++;
+        }
+    }
+    return now_us() - t0;
+}
+
+static void run(const char *label, int loops)
+{
+    struct dcache_sample s;
+    unsigned long us;
+    unsigned long n;
+    int found;
+
+    /* Cold: as right after boot */
+    dcache_ctl("flush");
+    dcache_ctl("reset");
+    us = stat_pass(1, &found);
+    dcache_read(&s);
+    printf("%-8s boot: %6lu us for %d stat(), %d found   hits %lu neg %lu miss %lu\r\n",
+           label, us, PATHS, found, s.hits, s.neg_hits, s.misses);
+
+    dcache_ctl("reset");
+    us = stat_pass(loops, &found);
+    dcache_read(&s);
+    n = (unsigned long)loops * PATHS;
+    printf("%-8s stat: %4lu.%02lu us/stat                      hits %lu neg %lu miss %lu\r\n",
+           label, us / n, ((us * 100) / n) % 100, s.hits, s.neg_hits, s.misses);
+}
+
+int main(int argc, char *argv[])
+{
+    int loops = DEFAULT_LOOPS;
+
+    if (argc > 1)
+        loops = atoi(argv[1]);
+    if (loops < 1)
+        loops = 1;
+
+    build_paths();
+    if (dcache_ctl("1") < 0) {
+        fprintf(stderr, "stat_bench: cannot open %s (errno=%d)\r\n", DCACHE_SYSFS, errno);
+        return 1;
+    }
+    run("cached", loops);
+    dcache_ctl("0");
+    run("uncached", loops);
+    dcache_ctl("1");
+    return 0;
+}